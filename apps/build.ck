@@ -44,6 +44,7 @@ function build() {
     apps = [
         "//apps/debug:debug",
         "//apps/efiboot:efiboot",
+        "//apps/ktrace:ktrace",
         "//apps/mingen:mingen",
         "//apps/mount:mount",
         "//apps/netcon:netcon",
@@ -52,6 +53,7 @@ function build() {
         "//apps/setup:build_msetup",
         "//apps/swiss:swiss",
         "//apps/swiss:build_swiss",
+        "//apps/sysstat:sysstat",
         "//apps/tzcomp:tz_files",
         "//apps/unmount:umount",
         "//apps/vmstat:vmstat",
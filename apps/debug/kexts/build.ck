@@ -29,6 +29,7 @@ function build() {
     sources = [
         "acpiext.c",
         "kexts.c",
+        "locks.c",
         "memory.c",
         "objects.c",
         "reslist.c",
@@ -38,6 +38,7 @@ Module Name:
 #include "threads.h"
 #include "acpiext.h"
 #include "reslist.h"
+#include "locks.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -144,6 +145,19 @@ Return Value:
         TotalStatus = Status;
     }
 
+    Extension = "spinlocks";
+    OneLineDescription = "Prints or controls spin lock statistics.";
+    Status = DbgRegisterExtension(Context,
+                                  Token,
+                                  Extension,
+                                  OneLineDescription,
+                                  ExtSpinLocks);
+
+    if (Status != 0) {
+        DbgOut("Error: Unable to register %s.\n", Extension);
+        TotalStatus = Status;
+    }
+
     Extension = "acpi";
     OneLineDescription = "Provides help debugging ACPI issues.";
     Status = DbgRegisterExtension(Context,
@@ -0,0 +1,411 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    locks.c
+
+Abstract:
+
+    This module implements lock related debugger extensions.
+
+Author:
+
+    Evan Green 22-Mar-2017
+
+Environment:
+
+    Debug Client
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/debug/dbgext.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define SPIN_LOCK_STATISTICS_NAME "kernel!KeSpinLockStatistics"
+#define SPIN_LOCK_STATISTICS_ENABLED_NAME "kernel!KeSpinLockStatisticsEnabled"
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+INT
+ExtpSetSpinLockStatistics (
+    PDEBUGGER_CONTEXT Context,
+    PSTR Argument
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+ExtSpinLocks (
+    PDEBUGGER_CONTEXT Context,
+    PSTR Command,
+    ULONG ArgumentCount,
+    PSTR *ArgumentValues
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the per call site spin lock statistics collected by
+    the kernel. Arguments to the extension are:
+
+        on - Enables statistics collection.
+
+        off - Disables statistics collection.
+
+        clear - Resets all collected statistics.
+
+    With no arguments, the statistics are printed.
+
+Arguments:
+
+    Context - Supplies a pointer to the debugger applicaton context, which is
+        an argument to most of the API functions.
+
+    Command - Supplies the subcommand entered. This parameter is unused.
+
+    ArgumentCount - Supplies the number of arguments in the ArgumentValues
+        array.
+
+    ArgumentValues - Supplies the values of each argument. This memory will be
+        reused when the function returns, so extensions must not touch this
+        memory after returning from this call.
+
+Return Value:
+
+    0 if the debugger extension command was successful.
+
+    Returns an error code if a failure occurred along the way.
+
+--*/
+
+{
+
+    ULONGLONG AcquireCount;
+    ULONGLONG ContendedCount;
+    PVOID Data;
+    ULONG DataSize;
+    ULONGLONG EntryAddress;
+    ULONG Index;
+    ULONGLONG MaxHoldCycles;
+    ULONGLONG Site;
+    ULONG SitesPrinted;
+    ULONGLONG SpinCycles;
+    ULONGLONG StatisticsAddress;
+    INT Status;
+    PTYPE_SYMBOL StatisticsType;
+
+    Data = NULL;
+    if ((Command != NULL) || (ArgumentCount > 2)) {
+        DbgOut("Usage: !spinlocks [on|off|clear].\n"
+               "       The spinlocks extension prints spin lock statistics "
+               "for each call\n"
+               "       site that acquired a spin lock while statistics "
+               "collection was on.\n"
+               "       on - Enables statistics collection.\n"
+               "       off - Disables statistics collection.\n"
+               "       clear - Resets the collected statistics.\n");
+
+        return EINVAL;
+    }
+
+    if (ArgumentCount == 2) {
+        return ExtpSetSpinLockStatistics(Context, ArgumentValues[1]);
+    }
+
+    Status = DbgEvaluate(Context,
+                         SPIN_LOCK_STATISTICS_NAME,
+                         &StatisticsAddress);
+
+    if (Status != 0) {
+        DbgOut("Error: Unable to evaluate %s.\n", SPIN_LOCK_STATISTICS_NAME);
+        goto ExtSpinLocksEnd;
+    }
+
+    DbgOut("%-10s %12s %12s %16s %12s  %s\n",
+           "Site",
+           "Acquires",
+           "Contended",
+           "SpinCycles",
+           "MaxHold",
+           "Symbol");
+
+    SitesPrinted = 0;
+    EntryAddress = StatisticsAddress;
+    for (Index = 0; Index < SPIN_LOCK_STATISTICS_SITE_COUNT; Index += 1) {
+        Status = DbgReadTypeByName(Context,
+                                   EntryAddress,
+                                   "SPIN_LOCK_STATISTICS",
+                                   &StatisticsType,
+                                   &Data,
+                                   &DataSize);
+
+        if (Status != 0) {
+            DbgOut("Error: Could not read SPIN_LOCK_STATISTICS at 0x%I64x.\n",
+                   EntryAddress);
+
+            goto ExtSpinLocksEnd;
+        }
+
+        Status = DbgReadIntegerMember(Context,
+                                      StatisticsType,
+                                      "Site",
+                                      EntryAddress,
+                                      Data,
+                                      DataSize,
+                                      &Site);
+
+        if (Status != 0) {
+            goto ExtSpinLocksEnd;
+        }
+
+        if (Site == 0) {
+            EntryAddress += DataSize;
+            free(Data);
+            Data = NULL;
+            continue;
+        }
+
+        Status = DbgReadIntegerMember(Context,
+                                      StatisticsType,
+                                      "AcquireCount",
+                                      EntryAddress,
+                                      Data,
+                                      DataSize,
+                                      &AcquireCount);
+
+        if (Status != 0) {
+            goto ExtSpinLocksEnd;
+        }
+
+        Status = DbgReadIntegerMember(Context,
+                                      StatisticsType,
+                                      "ContendedCount",
+                                      EntryAddress,
+                                      Data,
+                                      DataSize,
+                                      &ContendedCount);
+
+        if (Status != 0) {
+            goto ExtSpinLocksEnd;
+        }
+
+        Status = DbgReadIntegerMember(Context,
+                                      StatisticsType,
+                                      "SpinCycles",
+                                      EntryAddress,
+                                      Data,
+                                      DataSize,
+                                      &SpinCycles);
+
+        if (Status != 0) {
+            goto ExtSpinLocksEnd;
+        }
+
+        Status = DbgReadIntegerMember(Context,
+                                      StatisticsType,
+                                      "MaxHoldCycles",
+                                      EntryAddress,
+                                      Data,
+                                      DataSize,
+                                      &MaxHoldCycles);
+
+        if (Status != 0) {
+            goto ExtSpinLocksEnd;
+        }
+
+        DbgOut("0x%08I64x %12I64d %12I64d %16I64d %12I64d  ",
+               Site,
+               AcquireCount,
+               ContendedCount,
+               SpinCycles,
+               MaxHoldCycles);
+
+        DbgPrintAddressSymbol(Context, Site);
+        DbgOut("\n");
+        SitesPrinted += 1;
+        EntryAddress += DataSize;
+        free(Data);
+        Data = NULL;
+    }
+
+    if (SitesPrinted == 0) {
+        DbgOut("No spin lock statistics. Use !spinlocks on to collect them.\n");
+    }
+
+    Status = 0;
+
+ExtSpinLocksEnd:
+    if (Data != NULL) {
+        free(Data);
+    }
+
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+INT
+ExtpSetSpinLockStatistics (
+    PDEBUGGER_CONTEXT Context,
+    PSTR Argument
+    )
+
+/*++
+
+Routine Description:
+
+    This routine enables, disables, or clears spin lock statistics collection
+    in the target.
+
+Arguments:
+
+    Context - Supplies a pointer to the debugger applicaton context.
+
+    Argument - Supplies the subcommand string: on, off, or clear.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error code on failure.
+
+--*/
+
+{
+
+    ULONGLONG Address;
+    ULONG BytesWritten;
+    PVOID Data;
+    ULONG DataSize;
+    BOOL Enabled;
+    PSTR Name;
+    ULONG Size;
+    INT Status;
+    PTYPE_SYMBOL StatisticsType;
+    PVOID Zeroes;
+
+    Zeroes = NULL;
+    if (strcasecmp(Argument, "clear") == 0) {
+        Name = SPIN_LOCK_STATISTICS_NAME;
+
+        //
+        // Get the size of an entry as the target sees it, which may differ
+        // from the debugger's idea of the structure.
+        //
+
+        Status = DbgGetTypeByName(Context,
+                                  "SPIN_LOCK_STATISTICS",
+                                  &StatisticsType);
+
+        if (Status != 0) {
+            DbgOut("Error: Could not find type SPIN_LOCK_STATISTICS.\n");
+            return Status;
+        }
+
+        Status = DbgEvaluate(Context, Name, &Address);
+        if (Status != 0) {
+            DbgOut("Error: Unable to evaluate %s.\n", Name);
+            return Status;
+        }
+
+        Status = DbgReadType(Context,
+                             Address,
+                             StatisticsType,
+                             &Data,
+                             &DataSize);
+
+        if (Status != 0) {
+            return Status;
+        }
+
+        free(Data);
+        Size = SPIN_LOCK_STATISTICS_SITE_COUNT * DataSize;
+        Zeroes = malloc(Size);
+        if (Zeroes == NULL) {
+            return ENOMEM;
+        }
+
+        memset(Zeroes, 0, Size);
+
+    } else if (strcasecmp(Argument, "on") == 0) {
+        Name = SPIN_LOCK_STATISTICS_ENABLED_NAME;
+        Enabled = TRUE;
+        Zeroes = &Enabled;
+        Size = sizeof(BOOL);
+
+    } else if (strcasecmp(Argument, "off") == 0) {
+        Name = SPIN_LOCK_STATISTICS_ENABLED_NAME;
+        Enabled = FALSE;
+        Zeroes = &Enabled;
+        Size = sizeof(BOOL);
+
+    } else {
+        DbgOut("Error: Unknown argument \"%s\".\n", Argument);
+        return EINVAL;
+    }
+
+    Status = DbgEvaluate(Context, Name, &Address);
+    if (Status != 0) {
+        DbgOut("Error: Unable to evaluate %s.\n", Name);
+        goto SetSpinLockStatisticsEnd;
+    }
+
+    Status = DbgWriteMemory(Context,
+                            TRUE,
+                            Address,
+                            Size,
+                            Zeroes,
+                            &BytesWritten);
+
+    if ((Status != 0) || (BytesWritten != Size)) {
+        DbgOut("Error: Unable to write %s.\n", Name);
+        if (Status == 0) {
+            Status = EINVAL;
+        }
+
+        goto SetSpinLockStatisticsEnd;
+    }
+
+SetSpinLockStatisticsEnd:
+    if ((Zeroes != NULL) && (Zeroes != &Enabled)) {
+        free(Zeroes);
+    }
+
+    return Status;
+}
+
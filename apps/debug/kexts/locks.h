@@ -0,0 +1,88 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    locks.h
+
+Abstract:
+
+    This header contains definitions for lock related debugger extensions.
+
+Author:
+
+    Evan Green 22-Mar-2017
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+INT
+ExtSpinLocks (
+    PDEBUGGER_CONTEXT Context,
+    PSTR Command,
+    ULONG ArgumentCount,
+    PSTR *ArgumentValues
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prints the per call site spin lock statistics collected by
+    the kernel. Arguments to the extension are:
+
+        on - Enables statistics collection.
+
+        off - Disables statistics collection.
+
+        clear - Resets all collected statistics.
+
+    With no arguments, the statistics are printed.
+
+Arguments:
+
+    Context - Supplies a pointer to the debugger applicaton context, which is
+        an argument to most of the API functions.
+
+    Command - Supplies the subcommand entered. This parameter is unused.
+
+    ArgumentCount - Supplies the number of arguments in the ArgumentValues
+        array.
+
+    ArgumentValues - Supplies the values of each argument. This memory will be
+        reused when the function returns, so extensions must not touch this
+        memory after returning from this call.
+
+Return Value:
+
+    0 if the debugger extension command was successful.
+
+    Returns an error code if a failure occurred along the way.
+
+--*/
+
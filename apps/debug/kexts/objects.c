@@ -745,13 +745,19 @@ Return Value:
         ExtpPrintIndentation(IndentationLevel);
         Status = DbgReadIntegerMember(Context,
                                       ObjectType,
-                                      "WaitQueue.Lock.LockHeld",
+                                      "WaitQueue.Lock.Tickets",
                                       ObjectAddress,
                                       ObjectData,
                                       ObjectDataSize,
                                       &LockHeld);
 
-        if ((Status == 0) && (LockHeld != FALSE)) {
+        //
+        // The lock is held if the next ticket (high half) differs from the
+        // ticket being served (low half).
+        //
+
+        if ((Status == 0) &&
+            (((LockHeld >> 16) & 0xFFFF) != (LockHeld & 0xFFFF))) {
             Status = DbgReadIntegerMember(Context,
                                           ObjectType,
                                           "WaitQueue.Lock.OwningThread",
@@ -0,0 +1,52 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ktrace
+
+Abstract:
+
+    This executable implements the ktrace application, which controls kernel
+    event tracing and prints event timelines.
+
+Author:
+
+    Evan Green 29-Mar-2017
+
+Environment:
+
+    User
+
+--*/
+
+function build() {
+    sources = [
+        "ktrace.c"
+    ];
+
+    dynlibs = [
+        "//apps/osbase:libminocaos"
+    ];
+
+    includes = [
+        "$//apps/libc/include"
+    ];
+
+    app = {
+        "label": "ktrace",
+        "inputs": sources + dynlibs,
+        "includes": includes
+    };
+
+    entries = application(app);
+    return entries;
+}
+
+return build();
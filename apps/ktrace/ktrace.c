@@ -0,0 +1,913 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ktrace.c
+
+Abstract:
+
+    This module implements the ktrace application, which controls kernel
+    event tracing and prints the recorded events as a timeline.
+
+Author:
+
+    Evan Green 29-Mar-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/minocaos.h>
+#include <minoca/kernel/sp.h>
+#include <minoca/lib/mlibc.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define KTRACE_VERSION_MAJOR 1
+#define KTRACE_VERSION_MINOR 0
+
+#define KTRACE_USAGE                                                       \
+    "usage: ktrace [options]\n\n"                                          \
+    "The ktrace utility controls kernel event tracing and prints the \n"   \
+    "recorded events as a timeline. With no options, the events \n"        \
+    "buffered so far are printed and consumed. Options are:\n"             \
+    "  -e, --enable=categories -- Enable tracing for the given \n"         \
+    "      comma-separated categories and exit. Valid categories are \n"   \
+    "      sched, io, memory, net, and all.\n"                             \
+    "  -d, --disable -- Disable tracing and exit.\n"                       \
+    "  -s, --status -- Print which categories are enabled and exit.\n"     \
+    "  -t, --time=seconds -- Trace for the given number of seconds, \n"    \
+    "      then restore the previous tracing state and print the \n"       \
+    "      events. Uses the categories from -e, or all if none given.\n"   \
+    "  -p, --pid=id -- Only print events from the given process.\n"        \
+    "  --help -- Display this help text.\n"                                \
+    "  --version -- Display the application version and exit.\n\n"
+
+#define KTRACE_OPTIONS_STRING "de:hp:st:V"
+
+//
+// Define how often the buffers are drained while tracing for a fixed time,
+// in milliseconds. This should be well under the time it takes a busy
+// processor to wrap its buffer.
+//
+
+#define KTRACE_DRAIN_INTERVAL 100
+
+//
+// Define the number of events read from the kernel per request.
+//
+
+#define KTRACE_READ_EVENTS 4096
+
+#define KTRACE_READ_SIZE                    \
+    (FIELD_OFFSET(SP_TRACE_DATA, Events) +  \
+     (KTRACE_READ_EVENTS * sizeof(SP_TRACE_EVENT)))
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure holds the events collected so far.
+
+Members:
+
+    Events - Stores the array of events.
+
+    Count - Stores the number of valid events in the array.
+
+    Capacity - Stores the number of events the array can hold.
+
+    LostCount - Stores the number of events the kernel dropped.
+
+    Frequency - Stores the frequency of the event timestamps, in Hertz.
+
+--*/
+
+typedef struct _KTRACE_LOG {
+    PSP_TRACE_EVENT Events;
+    ULONG Count;
+    ULONG Capacity;
+    ULONGLONG LostCount;
+    ULONGLONG Frequency;
+} KTRACE_LOG, *PKTRACE_LOG;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+INT
+KtraceGetSetControl (
+    PSP_TRACE_CONTROL Control,
+    BOOL Set
+    );
+
+INT
+KtraceParseCategories (
+    PSTR String,
+    PULONG Flags
+    );
+
+VOID
+KtracePrintCategories (
+    ULONG Flags
+    );
+
+INT
+KtraceDrain (
+    PKTRACE_LOG Log
+    );
+
+VOID
+KtracePrintTimeline (
+    PKTRACE_LOG Log,
+    LONG ProcessId
+    );
+
+VOID
+KtracePrintEvent (
+    PSP_TRACE_EVENT Event
+    );
+
+int
+KtraceCompareEvents (
+    const void *Left,
+    const void *Right
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+struct option KtraceLongOptions[] = {
+    {"disable", no_argument, 0, 'd'},
+    {"enable", required_argument, 0, 'e'},
+    {"pid", required_argument, 0, 'p'},
+    {"status", no_argument, 0, 's'},
+    {"time", required_argument, 0, 't'},
+    {"help", no_argument, 0, 'h'},
+    {"version", no_argument, 0, 'V'},
+    {NULL, 0, 0, 0}
+};
+
+//
+// Store the category names, in the order of the SP_TRACE_FLAG_* bits.
+//
+
+PSTR KtraceCategoryNames[] = {
+    "sched",
+    "io",
+    "memory",
+    "net",
+};
+
+//
+// Store the scheduler reason names, indexed by SCHEDULER_REASON.
+//
+
+PSTR KtraceSchedulerReasons[] = {
+    "invalid",
+    "preempt",
+    "block",
+    "yield",
+    "suspend",
+    "exit",
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the ktrace user mode program.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings. The array count is bounded by the
+        previous parameter, and the strings are null-terminated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PSTR AfterScan;
+    ULONG ArgumentIndex;
+    SP_TRACE_CONTROL Control;
+    BOOL Disable;
+    ULONG Duration;
+    ULONG Elapsed;
+    ULONG EnableFlags;
+    KTRACE_LOG Log;
+    INT Option;
+    ULONG PreviousFlags;
+    LONG ProcessId;
+    INT ReturnValue;
+    BOOL Status;
+    ULONG Value;
+
+    Disable = FALSE;
+    Duration = 0;
+    EnableFlags = 0;
+    memset(&Log, 0, sizeof(KTRACE_LOG));
+    PreviousFlags = 0;
+    ProcessId = -1;
+    ReturnValue = 0;
+    Status = FALSE;
+
+    //
+    // Process the control arguments.
+    //
+
+    while (TRUE) {
+        Option = getopt_long(ArgumentCount,
+                             Arguments,
+                             KTRACE_OPTIONS_STRING,
+                             KtraceLongOptions,
+                             NULL);
+
+        if (Option == -1) {
+            break;
+        }
+
+        if ((Option == '?') || (Option == ':')) {
+            ReturnValue = 1;
+            goto mainEnd;
+        }
+
+        switch (Option) {
+        case 'd':
+            Disable = TRUE;
+            break;
+
+        case 'e':
+            ReturnValue = KtraceParseCategories(optarg, &EnableFlags);
+            if (ReturnValue != 0) {
+                goto mainEnd;
+            }
+
+            break;
+
+        case 'p':
+        case 't':
+            Value = strtoul(optarg, &AfterScan, 10);
+            if ((AfterScan == optarg) || (*AfterScan != '\0')) {
+                fprintf(stderr, "ktrace: Invalid number %s\n", optarg);
+                ReturnValue = 1;
+                goto mainEnd;
+            }
+
+            if (Option == 'p') {
+                ProcessId = Value;
+
+            } else {
+                Duration = Value;
+            }
+
+            break;
+
+        case 's':
+            Status = TRUE;
+            break;
+
+        case 'V':
+            printf("ktrace version %d.%02d\n",
+                   KTRACE_VERSION_MAJOR,
+                   KTRACE_VERSION_MINOR);
+
+            ReturnValue = 1;
+            goto mainEnd;
+
+        case 'h':
+            printf(KTRACE_USAGE);
+            return 1;
+
+        default:
+
+            assert(FALSE);
+
+            ReturnValue = 1;
+            goto mainEnd;
+        }
+    }
+
+    ArgumentIndex = optind;
+    if (ArgumentIndex > ArgumentCount) {
+        ArgumentIndex = ArgumentCount;
+    }
+
+    if (ArgumentIndex < ArgumentCount) {
+        fprintf(stderr,
+                "ktrace: Unexpected argument %s\n",
+                Arguments[ArgumentIndex]);
+    }
+
+    ReturnValue = KtraceGetSetControl(&Control, FALSE);
+    if (ReturnValue != 0) {
+        goto mainEnd;
+    }
+
+    PreviousFlags = Control.Flags;
+    if (Status != FALSE) {
+        KtracePrintCategories(Control.Flags);
+        printf("%d events per processor.\n", Control.EventsPerProcessor);
+        goto mainEnd;
+    }
+
+    if (Disable != FALSE) {
+        Control.Flags = 0;
+        ReturnValue = KtraceGetSetControl(&Control, TRUE);
+        goto mainEnd;
+    }
+
+    //
+    // Without a duration, enabling just turns the categories on and leaves
+    // them running.
+    //
+
+    if (Duration == 0) {
+        if (EnableFlags != 0) {
+            Control.Flags = EnableFlags;
+            ReturnValue = KtraceGetSetControl(&Control, TRUE);
+            goto mainEnd;
+        }
+
+        ReturnValue = KtraceDrain(&Log);
+        if (ReturnValue == 0) {
+            KtracePrintTimeline(&Log, ProcessId);
+        }
+
+        goto mainEnd;
+    }
+
+    //
+    // Throw away anything stale, trace for the requested time, and then put
+    // the tracing state back the way it was.
+    //
+
+    if (EnableFlags == 0) {
+        EnableFlags = SP_TRACE_FLAG_ALL;
+    }
+
+    ReturnValue = KtraceDrain(&Log);
+    if (ReturnValue != 0) {
+        goto mainEnd;
+    }
+
+    Log.Count = 0;
+    Log.LostCount = 0;
+    Control.Flags = EnableFlags;
+    ReturnValue = KtraceGetSetControl(&Control, TRUE);
+    if (ReturnValue != 0) {
+        goto mainEnd;
+    }
+
+    Elapsed = 0;
+    while ((ReturnValue == 0) &&
+           (Elapsed < Duration * MILLISECONDS_PER_SECOND)) {
+
+        usleep(KTRACE_DRAIN_INTERVAL * MICROSECONDS_PER_MILLISECOND);
+        Elapsed += KTRACE_DRAIN_INTERVAL;
+        ReturnValue = KtraceDrain(&Log);
+    }
+
+    Control.Flags = PreviousFlags;
+    KtraceGetSetControl(&Control, TRUE);
+    if (ReturnValue == 0) {
+        KtracePrintTimeline(&Log, ProcessId);
+    }
+
+mainEnd:
+    if (Log.Events != NULL) {
+        free(Log.Events);
+    }
+
+    return ReturnValue;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+INT
+KtraceGetSetControl (
+    PSP_TRACE_CONTROL Control,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the kernel tracing state.
+
+Arguments:
+
+    Control - Supplies a pointer to the tracing state to set, or where the
+        current state is returned.
+
+    Set - Supplies a boolean indicating whether to set (TRUE) or get (FALSE)
+        the tracing state.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    INT Error;
+    UINTN Size;
+    KSTATUS Status;
+
+    Size = sizeof(SP_TRACE_CONTROL);
+    Status = OsGetSetSystemInformation(SystemInformationSp,
+                                       SpInformationTraceControl,
+                                       Control,
+                                       &Size,
+                                       Set);
+
+    if (!KSUCCESS(Status)) {
+        Error = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "ktrace: Failed to %s tracing state: status %d: %s.\n",
+                (Set != FALSE) ? "set" : "get",
+                Status,
+                strerror(Error));
+
+        return Error;
+    }
+
+    return 0;
+}
+
+INT
+KtraceParseCategories (
+    PSTR String,
+    PULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine parses a comma-separated list of trace category names.
+
+Arguments:
+
+    String - Supplies the string to parse. This string is modified.
+
+    Flags - Supplies a pointer where the matching SP_TRACE_FLAG_* bits are
+        ORed in.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    ULONG Index;
+    PSTR Name;
+
+    Name = strtok(String, ",");
+    while (Name != NULL) {
+        if (strcmp(Name, "all") == 0) {
+            *Flags |= SP_TRACE_FLAG_ALL;
+
+        } else {
+            for (Index = 0;
+                 Index < sizeof(KtraceCategoryNames) / sizeof(PSTR);
+                 Index += 1) {
+
+                if (strcmp(Name, KtraceCategoryNames[Index]) == 0) {
+                    *Flags |= 1 << Index;
+                    break;
+                }
+            }
+
+            if (Index == sizeof(KtraceCategoryNames) / sizeof(PSTR)) {
+                fprintf(stderr, "ktrace: Unknown category %s\n", Name);
+                return EINVAL;
+            }
+        }
+
+        Name = strtok(NULL, ",");
+    }
+
+    return 0;
+}
+
+VOID
+KtracePrintCategories (
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the names of the enabled trace categories.
+
+Arguments:
+
+    Flags - Supplies the enabled SP_TRACE_FLAG_* bits.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    if (Flags == 0) {
+        printf("Tracing is disabled.\n");
+        return;
+    }
+
+    printf("Tracing:");
+    for (Index = 0;
+         Index < sizeof(KtraceCategoryNames) / sizeof(PSTR);
+         Index += 1) {
+
+        if ((Flags & (1 << Index)) != 0) {
+            printf(" %s", KtraceCategoryNames[Index]);
+        }
+    }
+
+    printf("\n");
+    return;
+}
+
+INT
+KtraceDrain (
+    PKTRACE_LOG Log
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads all pending events from the kernel and appends them to
+    the log.
+
+Arguments:
+
+    Log - Supplies a pointer to the log to append to.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    INT Error;
+    PVOID NewEvents;
+    UINTN Size;
+    KSTATUS Status;
+    PSP_TRACE_DATA TraceData;
+
+    //
+    // Read in chunks until the kernel returns less than a full buffer.
+    //
+
+    TraceData = malloc(KTRACE_READ_SIZE);
+    if (TraceData == NULL) {
+        return ENOMEM;
+    }
+
+    while (TRUE) {
+        Size = KTRACE_READ_SIZE;
+        memset(TraceData, 0, sizeof(SP_TRACE_DATA));
+        TraceData->Version = SP_TRACE_DATA_VERSION;
+        Status = OsGetSetSystemInformation(SystemInformationSp,
+                                           SpInformationTraceData,
+                                           TraceData,
+                                           &Size,
+                                           FALSE);
+
+        if (!KSUCCESS(Status)) {
+            Error = ClConvertKstatusToErrorNumber(Status);
+            fprintf(stderr,
+                    "ktrace: Failed to read events: status %d: %s.\n",
+                    Status,
+                    strerror(Error));
+
+            free(TraceData);
+            return Error;
+        }
+
+        Log->Frequency = TraceData->TimeCounterFrequency;
+        Log->LostCount += TraceData->LostEventCount;
+        if (TraceData->EventCount == 0) {
+            break;
+        }
+
+        if (Log->Count + TraceData->EventCount > Log->Capacity) {
+            Log->Capacity = (Log->Capacity * 2) + TraceData->EventCount;
+            NewEvents = realloc(Log->Events,
+                                Log->Capacity * sizeof(SP_TRACE_EVENT));
+
+            if (NewEvents == NULL) {
+                free(TraceData);
+                return ENOMEM;
+            }
+
+            Log->Events = NewEvents;
+        }
+
+        memcpy(&(Log->Events[Log->Count]),
+               TraceData->Events,
+               TraceData->EventCount * sizeof(SP_TRACE_EVENT));
+
+        Log->Count += TraceData->EventCount;
+        if (TraceData->EventCount < KTRACE_READ_EVENTS) {
+            break;
+        }
+    }
+
+    free(TraceData);
+    return 0;
+}
+
+VOID
+KtracePrintTimeline (
+    PKTRACE_LOG Log,
+    LONG ProcessId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sorts the collected events by time and prints them.
+
+Arguments:
+
+    Log - Supplies a pointer to the collected events.
+
+    ProcessId - Supplies the process to print events for, or -1 to print all
+        events.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PSP_TRACE_EVENT Event;
+    ULONG Index;
+    ULONGLONG Start;
+    double Time;
+
+    if (Log->Count == 0) {
+        printf("No events.\n");
+        goto PrintTimelineEnd;
+    }
+
+    qsort(Log->Events,
+          Log->Count,
+          sizeof(SP_TRACE_EVENT),
+          KtraceCompareEvents);
+
+    Start = Log->Events[0].Time;
+    printf("%14s %3s %6s %6s  %-10s %s\n",
+           "Time (us)",
+           "CPU",
+           "PID",
+           "TID",
+           "Event",
+           "Details");
+
+    for (Index = 0; Index < Log->Count; Index += 1) {
+        Event = &(Log->Events[Index]);
+        if ((ProcessId >= 0) && (Event->ProcessId != ProcessId)) {
+            continue;
+        }
+
+        Time = 0.0;
+        if (Log->Frequency != 0) {
+            Time = (double)(Event->Time - Start) * MICROSECONDS_PER_SECOND /
+                   (double)Log->Frequency;
+        }
+
+        printf("%14.3f %3d %6d %6d  ",
+               Time,
+               Event->Processor,
+               Event->ProcessId,
+               Event->ThreadId);
+
+        KtracePrintEvent(Event);
+        if ((Event->Type == SpTraceEventPageFault) &&
+            (Event->Arguments[2] != 0) &&
+            (Log->Frequency != 0)) {
+
+            Time = (double)(Event->Time - Event->Arguments[2]) *
+                   MICROSECONDS_PER_SECOND / (double)Log->Frequency;
+
+            printf(" took %.3fus", Time);
+        }
+
+        printf("\n");
+    }
+
+PrintTimelineEnd:
+    if (Log->LostCount != 0) {
+        printf("%lld events lost.\n", Log->LostCount);
+    }
+
+    return;
+}
+
+VOID
+KtracePrintEvent (
+    PSP_TRACE_EVENT Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the name and details of a trace event.
+
+Arguments:
+
+    Event - Supplies a pointer to the event.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PSTR Reason;
+
+    switch (Event->Type) {
+    case SpTraceEventContextSwitch:
+        Reason = "unknown";
+        if (Event->Detail <
+            sizeof(KtraceSchedulerReasons) / sizeof(PSTR)) {
+
+            Reason = KtraceSchedulerReasons[Event->Detail];
+        }
+
+        printf("%-10s %s -> pid %lld tid %lld",
+               "switch",
+               Reason,
+               Event->Arguments[1],
+               Event->Arguments[0]);
+
+        break;
+
+    case SpTraceEventIrpSend:
+        printf("%-10s irp 0x%llx %s offset 0x%llx size 0x%llx",
+               "irp-send",
+               Event->Arguments[0],
+               (Event->Detail == IrpMinorIoWrite) ? "write" : "read",
+               Event->Arguments[1],
+               Event->Arguments[2]);
+
+        break;
+
+    case SpTraceEventIrpComplete:
+        printf("%-10s irp 0x%llx major %lld minor 0x%llx status %d",
+               "irp-done",
+               Event->Arguments[0],
+               Event->Arguments[1],
+               Event->Arguments[2],
+               (INT)Event->Detail);
+
+        break;
+
+    case SpTraceEventPageFault:
+        printf("%-10s address 0x%llx ip 0x%llx%s%s",
+               "fault",
+               Event->Arguments[0],
+               Event->Arguments[1],
+               ((Event->Detail & FAULT_FLAG_WRITE) != 0) ? " write" : "",
+               ((Event->Detail & FAULT_FLAG_PAGE_NOT_PRESENT) != 0) ?
+               " not-present" : "");
+
+        break;
+
+    case SpTraceEventNetworkReceive:
+        printf("%-10s link 0x%llx size %d",
+               "net-recv",
+               Event->Arguments[0],
+               Event->Detail);
+
+        break;
+
+    default:
+        printf("%-10s type %d", "unknown", Event->Type);
+        break;
+    }
+
+    return;
+}
+
+int
+KtraceCompareEvents (
+    const void *Left,
+    const void *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two trace events by time, breaking ties by
+    processor number.
+
+Arguments:
+
+    Left - Supplies a pointer to the left event.
+
+    Right - Supplies a pointer to the right event.
+
+Return Value:
+
+    Less than zero if the left event came first.
+
+    Zero if the events are equivalent.
+
+    Greater than zero if the right event came first.
+
+--*/
+
+{
+
+    const SP_TRACE_EVENT *LeftEvent;
+    const SP_TRACE_EVENT *RightEvent;
+
+    LeftEvent = Left;
+    RightEvent = Right;
+    if (LeftEvent->Time < RightEvent->Time) {
+        return -1;
+
+    } else if (LeftEvent->Time > RightEvent->Time) {
+        return 1;
+    }
+
+    return (INT)LeftEvent->Processor - (INT)RightEvent->Processor;
+}
+
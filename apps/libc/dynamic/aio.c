@@ -0,0 +1,985 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    aio.c
+
+Abstract:
+
+    This module implements POSIX asynchronous I/O on top of a kernel I/O
+    ring. Each process lazily creates one ring; operations are written into
+    its submission queue and completions are reaped from its completion queue
+    without a system call per operation.
+
+Author:
+
+    Evan Green 14-Mar-2017
+
+Environment:
+
+    User Mode C Library
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include "libcp.h"
+#include <aio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the number of entries in each queue of the ring. The completion
+// queue is as large as the number of operations that can be outstanding, so
+// the kernel never has to hold back a submission.
+//
+
+#define AIO_RING_ENTRIES AIO_MAX
+
+//
+// Define the longest time in milliseconds aio_suspend waits before checking
+// again whether another thread reaped the completion it was waiting for.
+//
+
+#define AIO_SUSPEND_SLICE 100
+
+//
+// Define the operation value used to indicate that the operation should come
+// from each control block's list opcode.
+//
+
+#define AIO_OPERATION_FROM_LIST ((USHORT)-1)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+int
+ClpAioSubmit (
+    struct aiocb *const List[],
+    int Count,
+    USHORT Operation
+    );
+
+int
+ClpAioCreateRing (
+    VOID
+    );
+
+VOID
+ClpAioReap (
+    VOID
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the lock serializing access to the process' ring.
+//
+
+pthread_mutex_t ClAioLock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Store the process' I/O ring, the ring number the kernel assigned it, and
+// the process the ring was created in. A forked child notices the process ID
+// changed and creates its own ring.
+//
+
+PIO_RING_HEADER ClAioRing;
+UINTN ClAioRingSize;
+LONG ClAioRingNumber;
+pid_t ClAioRingProcess;
+
+//
+// Store the number of operations submitted whose completions have not yet
+// been reaped.
+//
+
+ULONG ClAioOutstandingCount;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+LIBC_API
+int
+aio_read (
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous read. The read is equivalent to a
+    pread call with the descriptor, buffer, size, and offset in the given
+    control block.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block describing the read.
+        This memory and the buffer it points to must remain valid until the
+        operation completes.
+
+Return Value:
+
+    0 if the operation was queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    return ClpAioSubmit(&Control, 1, IO_RING_OPERATION_READ);
+}
+
+LIBC_API
+int
+aio_write (
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous write. The write is equivalent to a
+    pwrite call with the descriptor, buffer, size, and offset in the given
+    control block.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block describing the write.
+        This memory and the buffer it points to must remain valid until the
+        operation completes.
+
+Return Value:
+
+    0 if the operation was queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    return ClpAioSubmit(&Control, 1, IO_RING_OPERATION_WRITE);
+}
+
+LIBC_API
+int
+aio_fsync (
+    int Operation,
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous flush of the descriptor in the given
+    control block.
+
+Arguments:
+
+    Operation - Supplies either O_SYNC or O_DSYNC.
+
+    Control - Supplies a pointer to the control block. Only the descriptor
+        and signal event members are used.
+
+Return Value:
+
+    0 if the operation was queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    if ((Operation != O_SYNC) && (Operation != O_DSYNC)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ClpAioSubmit(&Control, 1, IO_RING_OPERATION_FLUSH);
+}
+
+LIBC_API
+int
+aio_error (
+    const struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the error status of an asynchronous operation.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block.
+
+Return Value:
+
+    0 if the operation completed successfully.
+
+    EINPROGRESS if the operation has not yet completed.
+
+    Otherwise, returns the error number the operation failed with.
+
+--*/
+
+{
+
+    //
+    // This may be called from a completion signal handler, so don't block
+    // on the lock. If someone else holds it, they are reaping anyway.
+    //
+
+    if (Control->__aio_error == EINPROGRESS) {
+        if (pthread_mutex_trylock(&ClAioLock) == 0) {
+            ClpAioReap();
+            pthread_mutex_unlock(&ClAioLock);
+        }
+    }
+
+    return Control->__aio_error;
+}
+
+LIBC_API
+ssize_t
+aio_return (
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the final return value of an asynchronous operation.
+    It should only be called once per operation, after aio_error reports that
+    the operation is no longer in progress.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block.
+
+Return Value:
+
+    Returns the value the equivalent synchronous call would have returned.
+
+--*/
+
+{
+
+    int Error;
+
+    Error = aio_error(Control);
+    if (Error == EINPROGRESS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (Error != 0) {
+        errno = Error;
+    }
+
+    return Control->__aio_return;
+}
+
+LIBC_API
+int
+aio_suspend (
+    const struct aiocb *const List[],
+    int Count,
+    const struct timespec *Timeout
+    )
+
+/*++
+
+Routine Description:
+
+    This routine blocks until at least one of the given asynchronous
+    operations has completed.
+
+Arguments:
+
+    List - Supplies an array of control block pointers. NULL entries are
+        ignored.
+
+    Count - Supplies the number of elements in the array.
+
+    Timeout - Supplies an optional pointer to the maximum relative time to
+        wait. Supply NULL to wait indefinitely.
+
+Return Value:
+
+    0 if at least one operation completed.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if the timeout expired.
+
+--*/
+
+{
+
+    ULONGLONG CurrentTime;
+    ULONGLONG EndTime;
+    ULONGLONG Frequency;
+    INT Index;
+    INT Result;
+    LONG RingNumber;
+    KSTATUS Status;
+    ULONG Submit;
+    ULONG TimeoutInMilliseconds;
+    ULONG WaitTime;
+
+    if (Count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Result = ClpConvertSpecificTimeoutToSystemTimeout(Timeout,
+                                                      &TimeoutInMilliseconds);
+
+    if (Result != 0) {
+        errno = Result;
+        return -1;
+    }
+
+    Frequency = OsGetTimeCounterFrequency();
+    EndTime = 0;
+    if (TimeoutInMilliseconds != SYS_WAIT_TIME_INDEFINITE) {
+        EndTime = OsQueryTimeCounter() +
+                  ((TimeoutInMilliseconds * Frequency) /
+                   MILLISECONDS_PER_SECOND);
+    }
+
+    while (TRUE) {
+        pthread_mutex_lock(&ClAioLock);
+        if ((ClAioRing != NULL) && (ClAioRingProcess == getpid())) {
+            ClpAioReap();
+        }
+
+        for (Index = 0; Index < Count; Index += 1) {
+            if ((List[Index] != NULL) &&
+                (List[Index]->__aio_error != EINPROGRESS)) {
+
+                pthread_mutex_unlock(&ClAioLock);
+                return 0;
+            }
+        }
+
+        RingNumber = ClAioRingNumber;
+        if ((ClAioRing == NULL) || (ClAioRingProcess != getpid())) {
+            RingNumber = 0;
+        }
+
+        pthread_mutex_unlock(&ClAioLock);
+
+        //
+        // Figure out how long to wait this time around. The wait is chopped
+        // into slices since another thread may reap the completion this one
+        // is waiting for between dropping the lock and entering the kernel.
+        //
+
+        WaitTime = AIO_SUSPEND_SLICE;
+        if (TimeoutInMilliseconds != SYS_WAIT_TIME_INDEFINITE) {
+            CurrentTime = OsQueryTimeCounter();
+            if (CurrentTime >= EndTime) {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            if (((EndTime - CurrentTime) * MILLISECONDS_PER_SECOND) /
+                Frequency < WaitTime) {
+
+                WaitTime = ((EndTime - CurrentTime) *
+                            MILLISECONDS_PER_SECOND) / Frequency;
+            }
+        }
+
+        //
+        // With no ring, there is nothing that could complete. Just sleep out
+        // the timeout.
+        //
+
+        if (RingNumber == 0) {
+            Status = OsDelayExecution(FALSE,
+                                      WaitTime * MICROSECONDS_PER_MILLISECOND);
+
+        } else {
+            Submit = MAX_ULONG;
+            Status = OsIoRingControl(IoRingControlEnter,
+                                     &RingNumber,
+                                     NULL,
+                                     &Submit,
+                                     1,
+                                     WaitTime);
+        }
+
+        if (Status == STATUS_INTERRUPTED) {
+            errno = EINTR;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+aio_cancel (
+    int FileDescriptor,
+    struct aiocb *Control
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to cancel asynchronous operations. Operations that
+    have been handed to the kernel run to completion, so this never actually
+    cancels anything.
+
+Arguments:
+
+    FileDescriptor - Supplies the descriptor whose operations should be
+        canceled.
+
+    Control - Supplies an optional pointer to a specific operation to cancel.
+
+Return Value:
+
+    AIO_ALLDONE if all operations have already completed.
+
+    AIO_NOTCANCELED if operations are still in progress.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    ULONG Outstanding;
+
+    if (fcntl(FileDescriptor, F_GETFD) < 0) {
+        return -1;
+    }
+
+    if (Control != NULL) {
+        if (Control->aio_fildes != FileDescriptor) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (aio_error(Control) == EINPROGRESS) {
+            return AIO_NOTCANCELED;
+        }
+
+        return AIO_ALLDONE;
+    }
+
+    //
+    // The ring does not track which descriptor each operation is for, so
+    // report whether anything at all is still running.
+    //
+
+    pthread_mutex_lock(&ClAioLock);
+    Outstanding = 0;
+    if ((ClAioRing != NULL) && (ClAioRingProcess == getpid())) {
+        ClpAioReap();
+        Outstanding = ClAioOutstandingCount;
+    }
+
+    pthread_mutex_unlock(&ClAioLock);
+    if (Outstanding != 0) {
+        return AIO_NOTCANCELED;
+    }
+
+    return AIO_ALLDONE;
+}
+
+LIBC_API
+int
+lio_listio (
+    int Mode,
+    struct aiocb *const List[],
+    int Count,
+    struct sigevent *Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine submits a list of asynchronous operations with a single
+    call into the kernel.
+
+Arguments:
+
+    Mode - Supplies whether to wait for all operations to complete
+        (LIO_WAIT) or return once they are queued (LIO_NOWAIT).
+
+    List - Supplies an array of control block pointers. NULL entries and
+        entries with an opcode of LIO_NOP are ignored.
+
+    Count - Supplies the number of elements in the array.
+
+    Event - Supplies an optional pointer to the notification to deliver when
+        all operations complete. Only SIGEV_NONE is supported.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information. EIO is
+    returned if any of the operations failed in LIO_WAIT mode.
+
+--*/
+
+{
+
+    const struct aiocb *Control;
+    BOOL Failed;
+    INT Index;
+    INT Result;
+
+    if (((Mode != LIO_WAIT) && (Mode != LIO_NOWAIT)) ||
+        (Count < 0) || (Count > AIO_LISTIO_MAX)) {
+
+        errno = EINVAL;
+        return -1;
+    }
+
+    //
+    // Completion of the list as a whole is not something the ring can signal,
+    // only each individual operation.
+    //
+
+    if ((Mode == LIO_NOWAIT) && (Event != NULL) &&
+        (Event->sigev_notify != SIGEV_NONE)) {
+
+        errno = EINVAL;
+        return -1;
+    }
+
+    Result = ClpAioSubmit(List, Count, AIO_OPERATION_FROM_LIST);
+    if ((Result != 0) || (Mode == LIO_NOWAIT)) {
+        return Result;
+    }
+
+    Failed = FALSE;
+    for (Index = 0; Index < Count; Index += 1) {
+        Control = List[Index];
+        if ((Control == NULL) || (Control->aio_lio_opcode == LIO_NOP)) {
+            continue;
+        }
+
+        while (aio_error(Control) == EINPROGRESS) {
+            if (aio_suspend(&Control, 1, NULL) != 0) {
+                if (errno == EINTR) {
+                    return -1;
+                }
+            }
+        }
+
+        if (Control->__aio_error != 0) {
+            Failed = TRUE;
+        }
+    }
+
+    if (Failed != FALSE) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+int
+ClpAioSubmit (
+    struct aiocb *const List[],
+    int Count,
+    USHORT Operation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes a batch of operations into the submission queue and
+    hands them to the kernel with a single system call.
+
+Arguments:
+
+    List - Supplies an array of control block pointers.
+
+    Count - Supplies the number of elements in the array.
+
+    Operation - Supplies the IO_RING_OPERATION_* to perform on every entry,
+        or AIO_OPERATION_FROM_LIST to take each entry's list opcode.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+{
+
+    struct aiocb *Control;
+    INT Index;
+    INT Result;
+    ULONG Space;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    PIO_RING_SUBMISSION Submissions;
+    ULONG Submit;
+    ULONG Tail;
+    ULONG Valid;
+
+    Tail = 0;
+
+    //
+    // Validate everything up front so the batch goes in all or nothing.
+    //
+
+    Valid = 0;
+    for (Index = 0; Index < Count; Index += 1) {
+        Control = List[Index];
+        if (Control == NULL) {
+            continue;
+        }
+
+        if (Operation == AIO_OPERATION_FROM_LIST) {
+            if (Control->aio_lio_opcode == LIO_NOP) {
+                continue;
+            }
+
+            if ((Control->aio_lio_opcode != LIO_READ) &&
+                (Control->aio_lio_opcode != LIO_WRITE)) {
+
+                errno = EINVAL;
+                return -1;
+            }
+        }
+
+        if ((Operation != IO_RING_OPERATION_FLUSH) &&
+            ((Control->aio_offset < 0) ||
+             (Control->aio_nbytes > (size_t)SSIZE_MAX))) {
+
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (Control->aio_sigevent.sigev_notify == SIGEV_SIGNAL) {
+            if ((Control->aio_sigevent.sigev_signo <= 0) ||
+                (Control->aio_sigevent.sigev_signo >= NSIG)) {
+
+                errno = EINVAL;
+                return -1;
+            }
+
+        } else if (Control->aio_sigevent.sigev_notify != SIGEV_NONE) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        Valid += 1;
+    }
+
+    if (Valid == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ClAioLock);
+    Result = ClpAioCreateRing();
+    if (Result != 0) {
+        goto AioSubmitEnd;
+    }
+
+    ClpAioReap();
+    Tail = ClAioRing->SubmissionTail;
+    Space = AIO_RING_ENTRIES - (Tail - ClAioRing->SubmissionHead);
+    if ((ClAioOutstandingCount + Valid > AIO_MAX) || (Valid > Space)) {
+        Result = EAGAIN;
+        goto AioSubmitEnd;
+    }
+
+    Submissions = IO_RING_SUBMISSIONS(ClAioRing);
+    for (Index = 0; Index < Count; Index += 1) {
+        Control = List[Index];
+        if (Control == NULL) {
+            continue;
+        }
+
+        if ((Operation == AIO_OPERATION_FROM_LIST) &&
+            (Control->aio_lio_opcode == LIO_NOP)) {
+
+            continue;
+        }
+
+        Submission = &(Submissions[Tail & (AIO_RING_ENTRIES - 1)]);
+        memset(Submission, 0, sizeof(IO_RING_SUBMISSION));
+        Submission->UserData = (UINTN)Control;
+        Submission->Handle = (HANDLE)(UINTN)(Control->aio_fildes);
+        Submission->TimeoutInMilliseconds = SYS_WAIT_TIME_INDEFINITE;
+        Submission->Operation = Operation;
+        if (Operation == AIO_OPERATION_FROM_LIST) {
+            Submission->Operation = IO_RING_OPERATION_READ;
+            if (Control->aio_lio_opcode == LIO_WRITE) {
+                Submission->Operation = IO_RING_OPERATION_WRITE;
+            }
+        }
+
+        if (Submission->Operation == IO_RING_OPERATION_FLUSH) {
+            Submission->Events = SYS_FLUSH_FLAG_WRITE;
+
+        } else {
+            Submission->Offset = Control->aio_offset;
+            Submission->Buffer = (PVOID)(Control->aio_buf);
+            Submission->Size = Control->aio_nbytes;
+        }
+
+        if (Control->aio_sigevent.sigev_notify == SIGEV_SIGNAL) {
+            Submission->Flags |= IO_RING_SUBMISSION_FLAG_SIGNAL;
+            Submission->SignalNumber = Control->aio_sigevent.sigev_signo;
+        }
+
+        Control->__aio_return = -1;
+        Control->__aio_error = EINPROGRESS;
+        Tail += 1;
+    }
+
+    //
+    // Publish the entries before the new tail.
+    //
+
+    RtlMemoryBarrier();
+    ClAioRing->SubmissionTail = Tail;
+    ClAioOutstandingCount += Valid;
+    Submit = MAX_ULONG;
+    Status = OsIoRingControl(IoRingControlEnter,
+                             &ClAioRingNumber,
+                             NULL,
+                             &Submit,
+                             0,
+                             0);
+
+    //
+    // The kernel only fails the enter before consuming anything, so the
+    // entries can simply be pulled back out.
+    //
+
+    if (!KSUCCESS(Status)) {
+        Result = ClConvertKstatusToErrorNumber(Status);
+        ClAioRing->SubmissionTail = Tail - Valid;
+        ClAioOutstandingCount -= Valid;
+        for (Index = 0; Index < Count; Index += 1) {
+            if ((List[Index] != NULL) &&
+                (List[Index]->__aio_error == EINPROGRESS)) {
+
+                List[Index]->__aio_error = Result;
+            }
+        }
+
+        goto AioSubmitEnd;
+    }
+
+    Result = 0;
+
+AioSubmitEnd:
+    pthread_mutex_unlock(&ClAioLock);
+    if (Result != 0) {
+        errno = Result;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+ClpAioCreateRing (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the process' I/O ring if it has not been created
+    yet. This routine assumes the AIO lock is held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    pid_t Process;
+    PVOID Ring;
+    LONG RingNumber;
+    UINTN Size;
+    KSTATUS Status;
+    ULONG SubmissionCount;
+
+    Process = getpid();
+    if (ClAioRing != NULL) {
+        if (ClAioRingProcess == Process) {
+            return 0;
+        }
+
+        //
+        // This is a forked child holding a copy of the parent's ring memory.
+        // The parent's operations do not complete here, so start fresh.
+        //
+
+        munmap(ClAioRing, ClAioRingSize);
+        ClAioRing = NULL;
+        ClAioOutstandingCount = 0;
+    }
+
+    //
+    // Map the ring shared so that a fork does not turn it copy-on-write,
+    // which would leave this process writing to different pages than the
+    // ones the kernel has locked.
+    //
+
+    Size = IO_RING_SIZE(AIO_RING_ENTRIES, AIO_RING_ENTRIES);
+    Ring = mmap(NULL,
+                Size,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS,
+                -1,
+                0);
+
+    if (Ring == MAP_FAILED) {
+        return errno;
+    }
+
+    RingNumber = 0;
+    SubmissionCount = AIO_RING_ENTRIES;
+    Status = OsIoRingControl(IoRingControlCreate,
+                             &RingNumber,
+                             Ring,
+                             &SubmissionCount,
+                             AIO_RING_ENTRIES,
+                             0);
+
+    if (!KSUCCESS(Status)) {
+        munmap(Ring, Size);
+        return ClConvertKstatusToErrorNumber(Status);
+    }
+
+    ClAioRing = Ring;
+    ClAioRingSize = Size;
+    ClAioRingNumber = RingNumber;
+    ClAioRingProcess = Process;
+    return 0;
+}
+
+VOID
+ClpAioReap (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine drains the completion queue, writing each result into its
+    control block. This routine assumes the AIO lock is held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_COMPLETION Completion;
+    struct aiocb *Control;
+    ULONG Head;
+
+    if ((ClAioRing == NULL) || (ClAioRingProcess != getpid())) {
+        return;
+    }
+
+    Head = ClAioRing->CompletionHead;
+    while (Head != ClAioRing->CompletionTail) {
+        RtlMemoryBarrier();
+        Completion = &(IO_RING_COMPLETIONS(ClAioRing)[Head &
+                                                      (AIO_RING_ENTRIES - 1)]);
+
+        Control = (struct aiocb *)(UINTN)(Completion->UserData);
+        if ((KSUCCESS(Completion->Status)) ||
+            (Completion->Status == STATUS_END_OF_FILE) ||
+            ((Completion->Status == STATUS_TIMEOUT) &&
+             (Completion->BytesCompleted != 0))) {
+
+            Control->__aio_return = Completion->BytesCompleted;
+            RtlMemoryBarrier();
+            Control->__aio_error = 0;
+
+        } else {
+            Control->__aio_return = -1;
+            RtlMemoryBarrier();
+            Control->__aio_error =
+                          ClConvertKstatusToErrorNumber(Completion->Status);
+        }
+
+        Head += 1;
+        ClAioOutstandingCount -= 1;
+    }
+
+    RtlMemoryBarrier();
+    ClAioRing->CompletionHead = Head;
+    return;
+}
+
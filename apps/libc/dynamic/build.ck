@@ -55,6 +55,7 @@ function build() {
     ];
 
     sources = [
+        "aio.c",
         "assert.c",
         "brk.c",
         "bsearch.c",
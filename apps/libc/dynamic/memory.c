@@ -33,8 +33,10 @@ Module Name:
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -478,6 +480,202 @@ Return Value:
     return 0;
 }
 
+LIBC_API
+int
+mempressure_open (
+    void
+    )
+
+/*++
+
+Routine Description:
+
+    This routine opens a descriptor that reports system memory pressure. The
+    descriptor can be passed to poll, select, or mempressure_wait to be
+    notified when memory gets low.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a file descriptor on success.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
+{
+
+    return open(MEMPRESSURE_PATH, O_RDONLY | O_CLOEXEC);
+}
+
+LIBC_API
+int
+mempressure_read (
+    int Descriptor,
+    struct mempressure_status *Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the current memory pressure status.
+
+Arguments:
+
+    Descriptor - Supplies a descriptor returned by mempressure_open.
+
+    Status - Supplies a pointer where the current memory pressure status will
+        be returned.
+
+Return Value:
+
+    Returns the current overall memory pressure level on success. See
+    MEMPRESSURE_* definitions.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
+{
+
+    ssize_t BytesRead;
+    MEMORY_PRESSURE_STATUS Pressure;
+
+    assert((MEMPRESSURE_NONE == MEMORY_PRESSURE_NONE) &&
+           (MEMPRESSURE_LOW == MEMORY_PRESSURE_LOW) &&
+           (MEMPRESSURE_CRITICAL == MEMORY_PRESSURE_CRITICAL));
+
+    do {
+        BytesRead = read(Descriptor, &Pressure, sizeof(Pressure));
+
+    } while ((BytesRead < 0) && (errno == EINTR));
+
+    if (BytesRead < 0) {
+        return -1;
+    }
+
+    if ((BytesRead != sizeof(Pressure)) ||
+        (Pressure.Version < MEMORY_PRESSURE_STATUS_VERSION)) {
+
+        errno = EIO;
+        return -1;
+    }
+
+    if (Status != NULL) {
+        Status->level = Pressure.Level;
+        Status->physical_level = Pressure.PhysicalLevel;
+        Status->virtual_level = Pressure.VirtualLevel;
+        Status->change_count = Pressure.ChangeCount;
+        Status->total_physical_pages = Pressure.TotalPhysicalPages;
+        Status->free_physical_pages = Pressure.FreePhysicalPages;
+        Status->total_virtual_bytes = Pressure.TotalVirtualBytes;
+        Status->free_virtual_bytes = Pressure.FreeVirtualBytes;
+    }
+
+    return Pressure.Level;
+}
+
+LIBC_API
+int
+mempressure_wait (
+    int Descriptor,
+    int Level,
+    int Timeout
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for the memory pressure to reach at least the given
+    level.
+
+Arguments:
+
+    Descriptor - Supplies a descriptor returned by mempressure_open.
+
+    Level - Supplies the level to wait for, either MEMPRESSURE_LOW or
+        MEMPRESSURE_CRITICAL.
+
+    Timeout - Supplies the number of milliseconds to wait. Supply -1 to wait
+        indefinitely, or 0 to simply check the current state.
+
+Return Value:
+
+    Returns the current memory pressure level if it is at least the given
+    level.
+
+    0 if the timeout expired before the pressure reached the given level.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
+{
+
+    int Current;
+    struct pollfd PollDescriptor;
+    int Result;
+
+    PollDescriptor.fd = Descriptor;
+    if (Level == MEMPRESSURE_LOW) {
+        PollDescriptor.events = POLLIN;
+
+    } else if (Level == MEMPRESSURE_CRITICAL) {
+        PollDescriptor.events = POLLPRI;
+
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    //
+    // The poll events reflect the level as of the last kernel sample, so
+    // confirm with a fresh read. When waiting indefinitely, go back to
+    // sleep if the pressure subsided in the meantime.
+    //
+
+    while (TRUE) {
+        PollDescriptor.revents = 0;
+        Result = poll(&PollDescriptor, 1, Timeout);
+        if (Result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        if (Result == 0) {
+            return 0;
+        }
+
+        if ((PollDescriptor.revents & (POLLERR | POLLNVAL)) != 0) {
+            errno = EBADF;
+            return -1;
+        }
+
+        Current = mempressure_read(Descriptor, NULL);
+        if (Current < 0) {
+            return -1;
+        }
+
+        if (Current >= Level) {
+            return Current;
+        }
+
+        if (Timeout >= 0) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 
@@ -104,6 +104,11 @@ Return Value:
     PPTHREAD_CONDITION ConditionInternal;
 
     ConditionInternal = (PPTHREAD_CONDITION)Condition;
+
+    ASSERT(sizeof(pthread_cond_t) >= sizeof(PTHREAD_CONDITION));
+
+    ConditionInternal->Waiters = 0;
+    ConditionInternal->RequeueAddress = NULL;
     if (Attribute == NULL) {
         ConditionInternal->State = 0;
         return 0;
@@ -578,7 +583,12 @@ Return Value:
 
 {
 
+    ULONG Flags;
+    KSTATUS KernelStatus;
+    ULONG NewState;
     ULONG Operation;
+    PULONG RequeueAddress;
+    ULONG RequeueCount;
     ULONG ThreadCount;
 
     //
@@ -586,13 +596,50 @@ Return Value:
     // get into the kernel.
     //
 
-    RtlAtomicAdd32(&(Condition->State), 1 << PTHREAD_CONDITION_COUNTER_SHIFT);
-    ThreadCount = Count;
-    Operation = UserLockWake;
-    if ((Condition->State & PTHREAD_CONDITION_SHARED) == 0) {
-        Operation |= USER_LOCK_PRIVATE;
+    NewState = RtlAtomicAdd32(&(Condition->State),
+                              1 << PTHREAD_CONDITION_COUNTER_SHIFT);
+
+    NewState += 1 << PTHREAD_CONDITION_COUNTER_SHIFT;
+    Flags = 0;
+    if ((NewState & PTHREAD_CONDITION_SHARED) == 0) {
+        Flags |= USER_LOCK_PRIVATE;
     }
 
+    //
+    // For a broadcast on a private condition, wake one thread and move the
+    // rest straight onto the mutex they are all about to acquire. They then
+    // get woken one at a time as the mutex is released, rather than all at
+    // once only to go right back to sleep on the mutex. The requeue address
+    // is only trustworthy while there are waiters, since they keep the mutex
+    // alive until they reacquire it. Shared conditions always wake everyone,
+    // since the address means nothing in another process.
+    //
+
+    if ((Count == MAX_ULONG) && (Flags != 0) && (Condition->Waiters != 0)) {
+        RequeueAddress = Condition->RequeueAddress;
+        if (RequeueAddress != NULL) {
+            ThreadCount = 1;
+            RequeueCount = MAX_ULONG;
+            KernelStatus = OsUserLockRequeue(&(Condition->State),
+                                             Flags,
+                                             NewState,
+                                             &ThreadCount,
+                                             RequeueAddress,
+                                             &RequeueCount);
+
+            //
+            // If the state changed again, another pulse raced in. Fall back
+            // to waking everybody.
+            //
+
+            if (KSUCCESS(KernelStatus)) {
+                return 0;
+            }
+        }
+    }
+
+    ThreadCount = Count;
+    Operation = UserLockWake | Flags;
     OsUserLock(&(Condition->State), Operation, &ThreadCount, 0);
     return 0;
 }
@@ -634,6 +681,7 @@ Return Value:
     KSTATUS KernelStatus;
     ULONG OldState;
     ULONG Operation;
+    BOOL Private;
     ULONG TimeoutInMilliseconds;
 
     //
@@ -649,16 +697,31 @@ Return Value:
     //
 
     OldState = Condition->State;
+    Operation = UserLockWait;
+    Private = FALSE;
+    if ((OldState & PTHREAD_CONDITION_SHARED) == 0) {
+        Operation |= USER_LOCK_PRIVATE;
+        Private = TRUE;
+    }
+
+    //
+    // Record where a broadcast can requeue this waiter while the mutex is
+    // still held and known to be valid, then count the waiter. The atomic
+    // add orders the two.
+    //
+
+    if (Private != FALSE) {
+        Condition->RequeueAddress =
+                   ClpGetMutexRequeueAddress((PPTHREAD_MUTEX)Mutex, FALSE);
+
+        RtlAtomicAdd32(&(Condition->Waiters), 1);
+    }
 
     //
     // Unlock the mutex and perform the wait.
     //
 
     pthread_mutex_unlock(Mutex);
-    Operation = UserLockWait;
-    if ((OldState & PTHREAD_CONDITION_SHARED) == 0) {
-        Operation |= USER_LOCK_PRIVATE;
-    }
 
     //
     // If a signal is delivered, the thread is to continue waiting on the
@@ -690,7 +753,11 @@ Return Value:
 
     } while (KernelStatus == STATUS_INTERRUPTED);
 
-    pthread_mutex_lock(Mutex);
+    if (Private != FALSE) {
+        RtlAtomicAdd32(&(Condition->Waiters), -1);
+    }
+
+    ClpAcquireMutexAfterConditionWait(Mutex);
     if (KernelStatus == STATUS_TIMEOUT) {
         return ETIMEDOUT;
     }
@@ -782,6 +782,126 @@ Return Value:
     return Result;
 }
 
+PULONG
+ClpGetMutexRequeueAddress (
+    PPTHREAD_MUTEX Mutex,
+    BOOL Shared
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the address that condition variable waiters can be
+    requeued onto for the given mutex. Only normal mutexes support this, since
+    their waiters can be woken one at a time by the release path.
+
+Arguments:
+
+    Mutex - Supplies a pointer to the mutex.
+
+    Shared - Supplies a boolean indicating whether or not the condition
+        variable is shared between processes. The mutex must match.
+
+Return Value:
+
+    Returns a pointer to the mutex state to requeue onto.
+
+    NULL if waiters cannot be requeued onto this mutex.
+
+--*/
+
+{
+
+    ULONG MutexShared;
+    ULONG State;
+
+    State = Mutex->State;
+    if ((State & PTHREAD_MUTEX_STATE_TYPE_MASK) != 0) {
+        return NULL;
+    }
+
+    MutexShared = FALSE;
+    if ((State & PTHREAD_MUTEX_STATE_SHARED) != 0) {
+        MutexShared = TRUE;
+    }
+
+    if (MutexShared != Shared) {
+        return NULL;
+    }
+
+    return &(Mutex->State);
+}
+
+int
+ClpAcquireMutexAfterConditionWait (
+    pthread_mutex_t *Mutex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reacquires a mutex after a condition variable wait. Other
+    waiters may have been requeued from the condition variable onto the mutex
+    without the mutex state reflecting it, so normal mutexes are acquired in
+    the contended state to make sure the eventual release wakes them.
+
+Arguments:
+
+    Mutex - Supplies a pointer to the mutex to acquire.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    KSTATUS KernelStatus;
+    ULONG LockedWithWaiters;
+    PPTHREAD_MUTEX MutexInternal;
+    ULONG OldState;
+    ULONG Operation;
+    ULONG Shared;
+    ULONG Unlocked;
+
+    MutexInternal = (PPTHREAD_MUTEX)Mutex;
+    if ((MutexInternal->State & PTHREAD_MUTEX_STATE_TYPE_MASK) != 0) {
+        return pthread_mutex_lock(Mutex);
+    }
+
+    Shared = MutexInternal->State & PTHREAD_MUTEX_STATE_SHARED;
+    LockedWithWaiters = Shared | PTHREAD_MUTEX_STATE_LOCKED_WITH_WAITERS;
+    Unlocked = Shared | PTHREAD_MUTEX_STATE_UNLOCKED;
+    Operation = UserLockWait;
+    if (Shared == 0) {
+        Operation |= USER_LOCK_PRIVATE;
+    }
+
+    while (TRUE) {
+        OldState = RtlAtomicExchange32(&(MutexInternal->State),
+                                       LockedWithWaiters);
+
+        if (OldState == Unlocked) {
+            break;
+        }
+
+        OldState = LockedWithWaiters;
+        KernelStatus = OsUserLock(&(MutexInternal->State),
+                                  Operation,
+                                  &OldState,
+                                  SYS_WAIT_TIME_INDEFINITE);
+
+        ASSERT(KernelStatus != STATUS_TIMEOUT);
+    }
+
+    return 0;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
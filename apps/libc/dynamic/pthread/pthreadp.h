@@ -141,10 +141,21 @@ Structure Description:
 
     State - Stores the state of the condition variable.
 
+    Waiters - Stores the number of threads waiting on a private condition
+        variable. This is not maintained for shared condition variables.
+
+    RequeueAddress - Stores the mutex state address that the most recent
+        waiter on a private condition variable will reacquire, or NULL if its
+        mutex doesn't support requeueing. Broadcasts move waiters directly
+        onto this address rather than waking them all to fight over the
+        mutex. It is only valid while there are waiters.
+
 --*/
 
 typedef struct _PTHREAD_CONDITION {
     ULONG State;
+    ULONG Waiters;
+    PULONG RequeueAddress;
 } PTHREAD_CONDITION, *PPTHREAD_CONDITION;
 
 /*++
@@ -471,3 +482,58 @@ Return Value:
 
 --*/
 
+PULONG
+ClpGetMutexRequeueAddress (
+    PPTHREAD_MUTEX Mutex,
+    BOOL Shared
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the address that condition variable waiters can be
+    requeued onto for the given mutex. Only normal mutexes support this, since
+    their waiters can be woken one at a time by the release path.
+
+Arguments:
+
+    Mutex - Supplies a pointer to the mutex.
+
+    Shared - Supplies a boolean indicating whether or not the condition
+        variable is shared between processes. The mutex must match.
+
+Return Value:
+
+    Returns a pointer to the mutex state to requeue onto.
+
+    NULL if waiters cannot be requeued onto this mutex.
+
+--*/
+
+int
+ClpAcquireMutexAfterConditionWait (
+    pthread_mutex_t *Mutex
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reacquires a mutex after a condition variable wait. Other
+    waiters may have been requeued from the condition variable onto the mutex
+    without the mutex state reflecting it, so normal mutexes are acquired in
+    the contended state to make sure the eventual release wakes them.
+
+Arguments:
+
+    Mutex - Supplies a pointer to the mutex to acquire.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
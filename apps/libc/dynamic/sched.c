@@ -32,6 +32,7 @@ Module Name:
 #include "libcp.h"
 #include <sched.h>
 #include <errno.h>
+#include <unistd.h>
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -45,6 +46,14 @@ Module Name:
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+int
+ClpGetSetSchedulingPolicy (
+    BOOL Set,
+    pid_t ProcessId,
+    int *Policy,
+    int *Priority
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -53,6 +62,312 @@ Module Name:
 // ------------------------------------------------------------------ Functions
 //
 
+LIBC_API
+int
+sched_get_priority_max (
+    int Policy
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the maximum priority value for the given scheduling
+    policy.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+Return Value:
+
+    Returns the maximum priority on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    switch (Policy) {
+    case SCHED_OTHER:
+        return 0;
+
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHEDULER_REAL_TIME_PRIORITY_MAXIMUM;
+
+    default:
+        break;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+LIBC_API
+int
+sched_get_priority_min (
+    int Policy
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the minimum priority value for the given scheduling
+    policy.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+Return Value:
+
+    Returns the minimum priority on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    switch (Policy) {
+    case SCHED_OTHER:
+        return 0;
+
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHEDULER_REAL_TIME_PRIORITY_MINIMUM;
+
+    default:
+        break;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+LIBC_API
+int
+sched_getparam (
+    pid_t ProcessId,
+    struct sched_param *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the scheduling parameters of the given process. Only
+    the calling process is supported, in which case the parameters of the
+    calling thread are returned.
+
+Arguments:
+
+    ProcessId - Supplies the process to query, or 0 for the calling process.
+
+    Parameter - Supplies a pointer where the scheduling parameters will be
+        returned.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    int Policy;
+    int Priority;
+
+    if (ClpGetSetSchedulingPolicy(FALSE, ProcessId, &Policy, &Priority) != 0) {
+        return -1;
+    }
+
+    Parameter->sched_priority = Priority;
+    return 0;
+}
+
+LIBC_API
+int
+sched_getscheduler (
+    pid_t ProcessId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the scheduling policy of the given process. Only the
+    calling process is supported, in which case the policy of the calling
+    thread is returned.
+
+Arguments:
+
+    ProcessId - Supplies the process to query, or 0 for the calling process.
+
+Return Value:
+
+    Returns the scheduling policy on success. See SCHED_* definitions.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    int Policy;
+    int Priority;
+
+    if (ClpGetSetSchedulingPolicy(FALSE, ProcessId, &Policy, &Priority) != 0) {
+        return -1;
+    }
+
+    return Policy;
+}
+
+LIBC_API
+int
+sched_rr_get_interval (
+    pid_t ProcessId,
+    struct timespec *Interval
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the time slice given to round-robin threads.
+
+Arguments:
+
+    ProcessId - Supplies the process to query, or 0 for the calling process.
+
+    Interval - Supplies a pointer where the time slice will be returned.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    if ((ProcessId != 0) && (ProcessId != getpid())) {
+        errno = ESRCH;
+        return -1;
+    }
+
+    Interval->tv_sec = SCHEDULER_ROUND_ROBIN_INTERVAL / MICROSECONDS_PER_SECOND;
+    Interval->tv_nsec = (SCHEDULER_ROUND_ROBIN_INTERVAL %
+                         MICROSECONDS_PER_SECOND) * NANOSECONDS_PER_MICROSECOND;
+
+    return 0;
+}
+
+LIBC_API
+int
+sched_setparam (
+    pid_t ProcessId,
+    const struct sched_param *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling priority of the given process, leaving
+    its policy unchanged. Only the calling process is supported, in which case
+    the calling thread is changed.
+
+Arguments:
+
+    ProcessId - Supplies the process to change, or 0 for the calling process.
+
+    Parameter - Supplies a pointer to the new scheduling parameters.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    int Policy;
+    int Priority;
+
+    if (ClpGetSetSchedulingPolicy(FALSE, ProcessId, &Policy, &Priority) != 0) {
+        return -1;
+    }
+
+    Priority = Parameter->sched_priority;
+    if (ClpGetSetSchedulingPolicy(TRUE, ProcessId, &Policy, &Priority) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+LIBC_API
+int
+sched_setscheduler (
+    pid_t ProcessId,
+    int Policy,
+    const struct sched_param *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling policy and priority of the given process.
+    Only the calling process is supported, in which case the calling thread is
+    changed. Threads the caller creates afterwards inherit the new policy.
+
+Arguments:
+
+    ProcessId - Supplies the process to change, or 0 for the calling process.
+
+    Policy - Supplies the new scheduling policy. See SCHED_* definitions.
+
+    Parameter - Supplies a pointer to the new scheduling parameters. The
+        priority must be 0 for SCHED_OTHER.
+
+Return Value:
+
+    Returns the previous scheduling policy on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    int OldPolicy;
+    int Priority;
+
+    if (ClpGetSetSchedulingPolicy(FALSE, ProcessId, &OldPolicy, &Priority) !=
+        0) {
+
+        return -1;
+    }
+
+    Priority = Parameter->sched_priority;
+    if (ClpGetSetSchedulingPolicy(TRUE, ProcessId, &Policy, &Priority) != 0) {
+        return -1;
+    }
+
+    return OldPolicy;
+}
+
 LIBC_API
 int
 sched_yield (
@@ -98,3 +413,109 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+int
+ClpGetSetSchedulingPolicy (
+    BOOL Set,
+    pid_t ProcessId,
+    int *Policy,
+    int *Priority
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the scheduling policy of the calling thread,
+    converting between C library and kernel policy values.
+
+Arguments:
+
+    Set - Supplies a boolean indicating whether to set (TRUE) or get (FALSE)
+        the policy.
+
+    ProcessId - Supplies the process ID the caller asked about. This must be
+        zero or the calling process.
+
+    Policy - Supplies a pointer that on input contains the policy to set, and
+        on output for get operations receives the current policy. See SCHED_*
+        definitions.
+
+    Priority - Supplies a pointer that on input contains the priority to set,
+        and on output for get operations receives the current priority.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+{
+
+    SCHEDULER_POLICY KernelPolicy;
+    ULONG KernelPriority;
+    KSTATUS Status;
+
+    if ((ProcessId != 0) && (ProcessId != getpid())) {
+        errno = ESRCH;
+        return -1;
+    }
+
+    KernelPolicy = SchedulerPolicyNormal;
+    KernelPriority = 0;
+    if (Set != FALSE) {
+        switch (*Policy) {
+        case SCHED_OTHER:
+            KernelPolicy = SchedulerPolicyNormal;
+            break;
+
+        case SCHED_FIFO:
+            KernelPolicy = SchedulerPolicyFifo;
+            break;
+
+        case SCHED_RR:
+            KernelPolicy = SchedulerPolicyRoundRobin;
+            break;
+
+        default:
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (*Priority < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        KernelPriority = *Priority;
+    }
+
+    Status = OsGetSetSchedulingPolicy(Set, &KernelPolicy, &KernelPriority);
+    if (!KSUCCESS(Status)) {
+        errno = ClConvertKstatusToErrorNumber(Status);
+        return -1;
+    }
+
+    if (Set == FALSE) {
+        switch (KernelPolicy) {
+        case SchedulerPolicyFifo:
+            *Policy = SCHED_FIFO;
+            break;
+
+        case SchedulerPolicyRoundRobin:
+            *Policy = SCHED_RR;
+            break;
+
+        case SchedulerPolicyNormal:
+        default:
+            *Policy = SCHED_OTHER;
+            break;
+        }
+
+        *Priority = KernelPriority;
+    }
+
+    return 0;
+}
+
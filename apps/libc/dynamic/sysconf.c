@@ -538,6 +538,18 @@ Return Value:
         Value = _XOPEN_VERSION;
         break;
 
+    case _SC_ASYNCHRONOUS_IO:
+        Value = _POSIX_ASYNCHRONOUS_IO;
+        break;
+
+    case _SC_AIO_MAX:
+        Value = AIO_MAX;
+        break;
+
+    case _SC_AIO_LISTIO_MAX:
+        Value = AIO_LISTIO_MAX;
+        break;
+
     default:
         fprintf(stderr, "SYSCONF called with unknown variable %d.\n", Variable);
 
@@ -0,0 +1,374 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    aio.h
+
+Abstract:
+
+    This header contains definitions for asynchronous I/O.
+
+Author:
+
+    Evan Green 14-Mar-2017
+
+--*/
+
+#ifndef _AIO_H
+#define _AIO_H
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <libcbase.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <time.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifdef __cplusplus
+
+extern "C" {
+
+#endif
+
+//
+// These values are returned by aio_cancel. All operations have already
+// completed, the requested operations were canceled, or some operations could
+// not be canceled because they were in progress.
+//
+
+#define AIO_ALLDONE 1
+#define AIO_CANCELED 2
+#define AIO_NOTCANCELED 3
+
+//
+// These values define the operation codes for lio_listio.
+//
+
+#define LIO_NOP 0
+#define LIO_READ 1
+#define LIO_WRITE 2
+
+//
+// These values define the modes for lio_listio. LIO_WAIT blocks until all
+// operations are complete, and LIO_NOWAIT returns as soon as they are queued.
+//
+
+#define LIO_WAIT 1
+#define LIO_NOWAIT 2
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an asynchronous I/O control block.
+
+Members:
+
+    aio_fildes - Stores the file descriptor to operate on.
+
+    aio_offset - Stores the file offset to perform the I/O at.
+
+    aio_buf - Stores a pointer to the data buffer.
+
+    aio_nbytes - Stores the number of bytes to transfer.
+
+    aio_reqprio - Stores the request priority offset. This is currently
+        ignored.
+
+    aio_sigevent - Stores the notification to deliver when the operation
+        completes. Only SIGEV_NONE and SIGEV_SIGNAL are supported.
+
+    aio_lio_opcode - Stores the operation to perform when the control block
+        is passed to lio_listio. See LIO_* definitions.
+
+    __aio_error - Stores the error status of the operation. This is private
+        to the C library; use aio_error to read it.
+
+    __aio_return - Stores the return value of the operation. This is private
+        to the C library; use aio_return to read it.
+
+--*/
+
+struct aiocb {
+    int aio_fildes;
+    off_t aio_offset;
+    volatile void *aio_buf;
+    size_t aio_nbytes;
+    int aio_reqprio;
+    struct sigevent aio_sigevent;
+    int aio_lio_opcode;
+    volatile int __aio_error;
+    ssize_t __aio_return;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+LIBC_API
+int
+aio_read (
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous read. The read is equivalent to a
+    pread call with the descriptor, buffer, size, and offset in the given
+    control block.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block describing the read.
+        This memory and the buffer it points to must remain valid until the
+        operation completes.
+
+Return Value:
+
+    0 if the operation was queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+aio_write (
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous write. The write is equivalent to a
+    pwrite call with the descriptor, buffer, size, and offset in the given
+    control block.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block describing the write.
+        This memory and the buffer it points to must remain valid until the
+        operation completes.
+
+Return Value:
+
+    0 if the operation was queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+aio_fsync (
+    int Operation,
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues an asynchronous flush of the descriptor in the given
+    control block.
+
+Arguments:
+
+    Operation - Supplies either O_SYNC or O_DSYNC.
+
+    Control - Supplies a pointer to the control block. Only the descriptor
+        and signal event members are used.
+
+Return Value:
+
+    0 if the operation was queued.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+aio_error (
+    const struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the error status of an asynchronous operation.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block.
+
+Return Value:
+
+    0 if the operation completed successfully.
+
+    EINPROGRESS if the operation has not yet completed.
+
+    Otherwise, returns the error number the operation failed with.
+
+--*/
+
+LIBC_API
+ssize_t
+aio_return (
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the final return value of an asynchronous operation.
+    It should only be called once per operation, after aio_error reports that
+    the operation is no longer in progress.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block.
+
+Return Value:
+
+    Returns the value the equivalent synchronous call would have returned.
+
+--*/
+
+LIBC_API
+int
+aio_suspend (
+    const struct aiocb *const List[],
+    int Count,
+    const struct timespec *Timeout
+    );
+
+/*++
+
+Routine Description:
+
+    This routine blocks until at least one of the given asynchronous
+    operations has completed.
+
+Arguments:
+
+    List - Supplies an array of control block pointers. NULL entries are
+        ignored.
+
+    Count - Supplies the number of elements in the array.
+
+    Timeout - Supplies an optional pointer to the maximum relative time to
+        wait. Supply NULL to wait indefinitely.
+
+Return Value:
+
+    0 if at least one operation completed.
+
+    -1 on failure, and errno will be set to contain more information. EAGAIN
+    is returned if the timeout expired.
+
+--*/
+
+LIBC_API
+int
+aio_cancel (
+    int FileDescriptor,
+    struct aiocb *Control
+    );
+
+/*++
+
+Routine Description:
+
+    This routine attempts to cancel asynchronous operations. Operations that
+    have been handed to the kernel run to completion, so this never actually
+    cancels anything.
+
+Arguments:
+
+    FileDescriptor - Supplies the descriptor whose operations should be
+        canceled.
+
+    Control - Supplies an optional pointer to a specific operation to cancel.
+
+Return Value:
+
+    AIO_ALLDONE if all operations have already completed.
+
+    AIO_NOTCANCELED if operations are still in progress.
+
+    -1 on failure, and errno will be set to contain more information.
+
+--*/
+
+LIBC_API
+int
+lio_listio (
+    int Mode,
+    struct aiocb *const List[],
+    int Count,
+    struct sigevent *Event
+    );
+
+/*++
+
+Routine Description:
+
+    This routine submits a list of asynchronous operations with a single
+    call into the kernel.
+
+Arguments:
+
+    Mode - Supplies whether to wait for all operations to complete
+        (LIO_WAIT) or return once they are queued (LIO_NOWAIT).
+
+    List - Supplies an array of control block pointers. NULL entries and
+        entries with an opcode of LIO_NOP are ignored.
+
+    Count - Supplies the number of elements in the array.
+
+    Event - Supplies an optional pointer to the notification to deliver when
+        all operations complete. Only SIGEV_NONE is supported.
+
+Return Value:
+
+    0 on success.
+
+    -1 on failure, and errno will be set to contain more information. EIO is
+    returned if any of the operations failed in LIO_WAIT mode.
+
+--*/
+
+#ifdef __cplusplus
+
+}
+
+#endif
+#endif
+
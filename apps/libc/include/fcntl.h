@@ -258,6 +258,14 @@ extern "C" {
 #define O_ASYNC 0x00010000
 #define FASYNC O_ASYNC
 
+//
+// Set this flag to have reads and writes bypass the file system cache and go
+// directly to the underlying device. The file offset, transfer size, and
+// buffer address must be aligned to the device's block size.
+//
+
+#define O_DIRECT 0x00020000
+
 //
 // Set this flag to enable opening files whose offsets cannot be described in
 // off_t types but can be described in off64_t. Since off_t is always 64-bits,
@@ -213,6 +213,15 @@ extern "C" {
 
 #define IOV_MAX 1024
 
+//
+// Define the maximum number of asynchronous I/O operations that can be
+// outstanding at once, and the maximum number that can be passed to a single
+// list I/O call.
+//
+
+#define AIO_MAX 256
+#define AIO_LISTIO_MAX AIO_MAX
+
 //
 // Define POSIX minimum requirements.
 //
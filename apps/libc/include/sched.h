@@ -41,6 +41,24 @@ extern "C" {
 
 #endif
 
+//
+// Define scheduling policies. Normal threads are time-shared fairly. FIFO
+// threads run until they block or yield, and round-robin threads are
+// additionally time-sliced among others of the same priority. Both
+// real-time policies preempt all normal threads.
+//
+
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+
+//
+// Define the standard name for the priority member of the scheduler
+// parameter.
+//
+
+#define sched_priority __sched_priority
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -94,6 +112,201 @@ Return Value:
 
 --*/
 
+LIBC_API
+int
+sched_get_priority_max (
+    int Policy
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the maximum priority value for the given scheduling
+    policy.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+Return Value:
+
+    Returns the maximum priority on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_get_priority_min (
+    int Policy
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the minimum priority value for the given scheduling
+    policy.
+
+Arguments:
+
+    Policy - Supplies the scheduling policy. See SCHED_* definitions.
+
+Return Value:
+
+    Returns the minimum priority on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_getparam (
+    pid_t ProcessId,
+    struct sched_param *Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets the scheduling parameters of the given process. Only
+    the calling process is supported, in which case the parameters of the
+    calling thread are returned.
+
+Arguments:
+
+    ProcessId - Supplies the process to query, or 0 for the calling process.
+
+    Parameter - Supplies a pointer where the scheduling parameters will be
+        returned.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_getscheduler (
+    pid_t ProcessId
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets the scheduling policy of the given process. Only the
+    calling process is supported, in which case the policy of the calling
+    thread is returned.
+
+Arguments:
+
+    ProcessId - Supplies the process to query, or 0 for the calling process.
+
+Return Value:
+
+    Returns the scheduling policy on success. See SCHED_* definitions.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_rr_get_interval (
+    pid_t ProcessId,
+    struct timespec *Interval
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the time slice given to round-robin threads.
+
+Arguments:
+
+    ProcessId - Supplies the process to query, or 0 for the calling process.
+
+    Interval - Supplies a pointer where the time slice will be returned.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_setparam (
+    pid_t ProcessId,
+    const struct sched_param *Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling priority of the given process, leaving
+    its policy unchanged. Only the calling process is supported, in which case
+    the calling thread is changed.
+
+Arguments:
+
+    ProcessId - Supplies the process to change, or 0 for the calling process.
+
+    Parameter - Supplies a pointer to the new scheduling parameters.
+
+Return Value:
+
+    0 on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
+LIBC_API
+int
+sched_setscheduler (
+    pid_t ProcessId,
+    int Policy,
+    const struct sched_param *Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the scheduling policy and priority of the given process.
+    Only the calling process is supported, in which case the calling thread is
+    changed. Threads the caller creates afterwards inherit the new policy.
+
+Arguments:
+
+    ProcessId - Supplies the process to change, or 0 for the calling process.
+
+    Policy - Supplies the new scheduling policy. See SCHED_* definitions.
+
+    Parameter - Supplies a pointer to the new scheduling parameters. The
+        priority must be 0 for SCHED_OTHER.
+
+Return Value:
+
+    Returns the previous scheduling policy on success.
+
+    -1 on error, and the errno variable will contain more information.
+
+--*/
+
 #ifdef __cplusplus
 
 }
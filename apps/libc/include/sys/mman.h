@@ -132,10 +132,82 @@ extern "C" {
 
 #define MAP_FAILED ((void *)-1)
 
+//
+// Define the path of the device that reports system memory pressure.
+//
+
+#define MEMPRESSURE_PATH "/dev/mempressure"
+
+//
+// Define memory pressure levels. A memory pressure descriptor polls as
+// readable (POLLIN) while the level is at least low, and additionally as
+// priority readable (POLLPRI) while the level is critical.
+//
+
+//
+// There is no shortage of memory.
+//
+
+#define MEMPRESSURE_NONE 0
+
+//
+// Memory is getting low. Caches should trim what they can cheaply release.
+//
+
+#define MEMPRESSURE_LOW 1
+
+//
+// Memory is critically low. Caches should release everything they can.
+//
+
+#define MEMPRESSURE_CRITICAL 2
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure describes the current system memory pressure.
+
+Members:
+
+    level - Stores the overall memory pressure level, the worse of the
+        physical and virtual levels. See MEMPRESSURE_* definitions.
+
+    physical_level - Stores the physical memory pressure level.
+
+    virtual_level - Stores the kernel virtual memory pressure level.
+
+    change_count - Stores the number of times the overall level has changed
+        since boot. Callers can compare this against a previous value to
+        detect transitions they did not observe.
+
+    total_physical_pages - Stores the total number of physical pages.
+
+    free_physical_pages - Stores the number of free physical pages.
+
+    total_virtual_bytes - Stores the size of the kernel virtual address space,
+        in bytes.
+
+    free_virtual_bytes - Stores the amount of free kernel virtual address
+        space, in bytes.
+
+--*/
+
+struct mempressure_status {
+    int level;
+    int physical_level;
+    int virtual_level;
+    unsigned long long change_count;
+    unsigned long long total_physical_pages;
+    unsigned long long free_physical_pages;
+    unsigned long long total_virtual_bytes;
+    unsigned long long free_virtual_bytes;
+};
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -341,6 +413,97 @@ Return Value:
 
 --*/
 
+LIBC_API
+int
+mempressure_open (
+    void
+    );
+
+/*++
+
+Routine Description:
+
+    This routine opens a descriptor that reports system memory pressure. The
+    descriptor can be passed to poll, select, or mempressure_wait to be
+    notified when memory gets low.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a file descriptor on success.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
+LIBC_API
+int
+mempressure_read (
+    int Descriptor,
+    struct mempressure_status *Status
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads the current memory pressure status.
+
+Arguments:
+
+    Descriptor - Supplies a descriptor returned by mempressure_open.
+
+    Status - Supplies a pointer where the current memory pressure status will
+        be returned.
+
+Return Value:
+
+    Returns the current overall memory pressure level on success. See
+    MEMPRESSURE_* definitions.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
+LIBC_API
+int
+mempressure_wait (
+    int Descriptor,
+    int Level,
+    int Timeout
+    );
+
+/*++
+
+Routine Description:
+
+    This routine waits for the memory pressure to reach at least the given
+    level.
+
+Arguments:
+
+    Descriptor - Supplies a descriptor returned by mempressure_open.
+
+    Level - Supplies the level to wait for, either MEMPRESSURE_LOW or
+        MEMPRESSURE_CRITICAL.
+
+    Timeout - Supplies the number of milliseconds to wait. Supply -1 to wait
+        indefinitely, or 0 to simply check the current state.
+
+Return Value:
+
+    Returns the current memory pressure level if it is at least the given
+    level.
+
+    0 if the timeout expired before the pressure reached the given level.
+
+    -1 on failure. The errno variable will be set to indicate the error.
+
+--*/
+
 #ifdef __cplusplus
 
 }
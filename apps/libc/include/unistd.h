@@ -54,6 +54,7 @@ extern "C" {
 // Define the POSIX constants for options and option groups.
 //
 
+#define _POSIX_ASYNCHRONOUS_IO 200809L
 #define _POSIX_BARRIERS 200809L
 #define _POSIX_CHOWN_RESTRICTED 1
 #define _POSIX_CLOCK_SELECTION 200809L
@@ -845,6 +846,25 @@ extern "C" {
 
 #define _SC_XOPEN_VERSION 104
 
+//
+// Determine whether the Asynchronous Input and Output option is supported.
+//
+
+#define _SC_ASYNCHRONOUS_IO 105
+
+//
+// Determine the maximum number of outstanding asynchronous I/O operations.
+//
+
+#define _SC_AIO_MAX 106
+
+//
+// Determine the maximum number of operations that can be passed to a single
+// list I/O call.
+//
+
+#define _SC_AIO_LISTIO_MAX 107
+
 //
 // Define pathconf and fpathconf constants.
 //
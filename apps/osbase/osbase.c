@@ -526,6 +526,129 @@ Return Value:
     return OsSystemCall(SystemCallFlush, &Parameters);
 }
 
+OS_API
+KSTATUS
+OsIoRingControl (
+    IO_RING_CONTROL_OPERATION Operation,
+    PLONG RingNumber,
+    PVOID Ring,
+    PULONG SubmissionCount,
+    ULONG CompletionCount,
+    ULONG TimeoutInMilliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates, destroys, or submits work to an I/O ring. An I/O
+    ring is a region of user mode memory shared with the kernel containing a
+    submission queue and a completion queue, which allows many I/O operations
+    to be started and reaped with a single system call.
+
+Arguments:
+
+    Operation - Supplies the operation to perform.
+
+    RingNumber - Supplies a pointer that on input contains the ring to operate
+        on. For create operations, returns the new ring number.
+
+    Ring - Supplies a pointer to the page aligned ring memory for create
+        operations. This must be IO_RING_SIZE bytes large.
+
+    SubmissionCount - Supplies a pointer that on input contains the number of
+        submission entries for create operations, or the maximum number of
+        entries to submit for enter operations. On output for enter
+        operations, returns the number of entries consumed.
+
+    CompletionCount - Supplies the number of completion entries for create
+        operations, or the minimum number of completions to wait for during
+        enter operations.
+
+    TimeoutInMilliseconds - Supplies the maximum time to wait for completions
+        during enter operations. Use SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    SYSTEM_CALL_IO_RING_CONTROL Parameters;
+    KSTATUS Status;
+
+    Parameters.Operation = Operation;
+    Parameters.RingNumber = *RingNumber;
+    Parameters.Ring = Ring;
+    Parameters.SubmissionCount = 0;
+    if (SubmissionCount != NULL) {
+        Parameters.SubmissionCount = *SubmissionCount;
+    }
+
+    Parameters.CompletionCount = CompletionCount;
+    Parameters.TimeoutInMilliseconds = TimeoutInMilliseconds;
+    Status = OsSystemCall(SystemCallIoRingControl, &Parameters);
+    *RingNumber = Parameters.RingNumber;
+    if (SubmissionCount != NULL) {
+        *SubmissionCount = Parameters.SubmissionCount;
+    }
+
+    return Status;
+}
+
+OS_API
+KSTATUS
+OsGetSetSchedulingPolicy (
+    BOOL Set,
+    PSCHEDULER_POLICY Policy,
+    PULONG Priority
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the scheduling policy and real-time priority of
+    the calling thread. Moving into a real-time policy or raising a real-time
+    priority requires the scheduling permission.
+
+Arguments:
+
+    Set - Supplies a boolean indicating whether to set (TRUE) or get (FALSE)
+        the scheduling policy.
+
+    Policy - Supplies a pointer that on input contains the new policy for set
+        operations. Returns the current policy for get operations.
+
+    Priority - Supplies a pointer that on input contains the new real-time
+        priority for set operations, which must be zero for the normal policy.
+        Returns the current priority for get operations.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    SYSTEM_CALL_GET_SET_SCHEDULING_POLICY Parameters;
+    KSTATUS Status;
+
+    Parameters.Set = Set;
+    Parameters.Policy = *Policy;
+    Parameters.Priority = *Priority;
+    Status = OsSystemCall(SystemCallGetSetSchedulingPolicy, &Parameters);
+    if ((KSUCCESS(Status)) && (Set == FALSE)) {
+        *Policy = Parameters.Policy;
+        *Priority = Parameters.Priority;
+    }
+
+    return Status;
+}
+
 OS_API
 KSTATUS
 OsCreatePipe (
@@ -229,6 +229,29 @@ Return Value:
 
 --*/
 
+ULONGLONG
+OspReadTimeCounter (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads the raw time counter hardware directly from user mode.
+    This is only valid if the kernel has indicated that the time counter is
+    user readable in the user shared data page.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the raw hardware counter value.
+
+--*/
+
 VOID
 OspInitializeMemory (
     VOID
@@ -299,11 +299,156 @@ Return Value:
     Parameters.Value = *Value;
     Parameters.Operation = Operation;
     Parameters.TimeoutInMilliseconds = TimeoutInMilliseconds;
+    Parameters.Address2 = NULL;
+    Parameters.Value2 = 0;
+    Parameters.Argument = 0;
     Status = OsSystemCall(SystemCallUserLock, &Parameters);
     *Value = Parameters.Value;
     return Status;
 }
 
+OS_API
+KSTATUS
+OsUserLockRequeue (
+    PVOID Address,
+    ULONG Flags,
+    ULONG CompareValue,
+    PULONG WakeCount,
+    PVOID TargetAddress,
+    PULONG RequeueCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes some of the threads waiting on one user mode lock
+    address and moves the remaining waiters over to wait on another address
+    without waking them. This avoids the thundering herd when broadcasting a
+    condition variable whose waiters will all immediately contend on the same
+    mutex.
+
+Arguments:
+
+    Address - Supplies a pointer to the 32-bit value the threads are waiting
+        on.
+
+    Flags - Supplies a bitfield of USER_LOCK_* flags. Both addresses must
+        agree on whether or not they are private.
+
+    CompareValue - Supplies the value the first address is expected to
+        contain. If it does not, nothing is woken or moved.
+
+    WakeCount - Supplies a pointer that on input contains the maximum number
+        of threads to wake. On output, contains the number of threads woken.
+
+    TargetAddress - Supplies a pointer to the 32-bit value that the remaining
+        waiters should be moved to.
+
+    RequeueCount - Supplies a pointer that on input contains the maximum
+        number of threads to move. On output, contains the number of threads
+        moved. If the two addresses are not backed by the same object, the
+        threads are woken instead of moved, and count as woken.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_OPERATION_WOULD_BLOCK if the first address did not contain the
+    compare value.
+
+    STATUS_ACCESS_VIOLATION if either address is invalid.
+
+--*/
+
+{
+
+    SYSTEM_CALL_USER_LOCK Parameters;
+    KSTATUS Status;
+
+    Parameters.Address = Address;
+    Parameters.Value = *WakeCount;
+    Parameters.Operation = UserLockRequeue | Flags;
+    Parameters.TimeoutInMilliseconds = 0;
+    Parameters.Address2 = TargetAddress;
+    Parameters.Value2 = *RequeueCount;
+    Parameters.Argument = CompareValue;
+    Status = OsSystemCall(SystemCallUserLock, &Parameters);
+    *WakeCount = Parameters.Value;
+    *RequeueCount = Parameters.Value2;
+    return Status;
+}
+
+OS_API
+KSTATUS
+OsUserLockWakeOperation (
+    PVOID Address,
+    PVOID SecondAddress,
+    ULONG Flags,
+    ULONG Operation,
+    PULONG WakeCount,
+    PULONG SecondWakeCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine atomically modifies the value at the second address, wakes
+    threads waiting on the first address, and then wakes threads waiting on
+    the second address if the original value at the second address passes the
+    given comparison. This lets a caller update one lock and release waiters
+    on two in a single trip to the kernel.
+
+Arguments:
+
+    Address - Supplies a pointer to the first 32-bit lock value.
+
+    SecondAddress - Supplies a pointer to the second 32-bit lock value, which
+        is modified.
+
+    Flags - Supplies a bitfield of USER_LOCK_* flags.
+
+    Operation - Supplies the encoded operation and comparison. See
+        USER_LOCK_WAKE_ARGUMENT.
+
+    WakeCount - Supplies a pointer that on input contains the maximum number
+        of threads to wake on the first address. On output, contains the
+        number woken.
+
+    SecondWakeCount - Supplies a pointer that on input contains the maximum
+        number of threads to wake on the second address if the comparison
+        passes. On output, contains the number woken.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the encoded operation is invalid or the
+    second address is not aligned.
+
+    STATUS_ACCESS_VIOLATION if either address is invalid.
+
+--*/
+
+{
+
+    SYSTEM_CALL_USER_LOCK Parameters;
+    KSTATUS Status;
+
+    Parameters.Address = Address;
+    Parameters.Value = *WakeCount;
+    Parameters.Operation = UserLockWakeOperation | Flags;
+    Parameters.TimeoutInMilliseconds = 0;
+    Parameters.Address2 = SecondAddress;
+    Parameters.Value2 = *SecondWakeCount;
+    Parameters.Argument = Operation;
+    Status = OsSystemCall(SystemCallUserLock, &Parameters);
+    *WakeCount = Parameters.Value;
+    *SecondWakeCount = Parameters.Value2;
+    return Status;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -153,7 +153,39 @@ Return Value:
 
 {
 
+    ULONG Flags;
+    ULONGLONG Offset;
     SYSTEM_CALL_QUERY_TIME_COUNTER Parameters;
+    ULONG Sequence;
+    ULONGLONG TimeCounter;
+    PUSER_SHARED_DATA UserSharedData;
+
+    //
+    // If the kernel says the time counter hardware can be read from user mode,
+    // read it directly and add the kernel's offset, avoiding a system call.
+    // The sequence number protects against a torn read of the offset. It is
+    // odd while the kernel is updating it.
+    //
+
+    UserSharedData = OspGetUserSharedData();
+    do {
+        Sequence = UserSharedData->TimeCounterSequence;
+        RtlMemoryBarrier();
+        Flags = UserSharedData->TimeCounterFlags;
+        if ((Flags & USER_TIME_COUNTER_FLAG_USER_READABLE) == 0) {
+            break;
+        }
+
+        Offset = UserSharedData->TimeCounterOffset;
+        TimeCounter = OspReadTimeCounter();
+        RtlMemoryBarrier();
+        if (((Sequence & 0x1) == 0) &&
+            (Sequence == UserSharedData->TimeCounterSequence)) {
+
+            return TimeCounter + Offset;
+        }
+
+    } while (TRUE);
 
     OsSystemCall(SystemCallQueryTimeCounter, &Parameters);
     return Parameters.Value;
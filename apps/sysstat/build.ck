@@ -0,0 +1,52 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    sysstat
+
+Abstract:
+
+    This executable implements the sysstat application, which prints system
+    call counts and latencies.
+
+Author:
+
+    Evan Green 27-Mar-2017
+
+Environment:
+
+    User
+
+--*/
+
+function build() {
+    sources = [
+        "sysstat.c"
+    ];
+
+    dynlibs = [
+        "//apps/osbase:libminocaos"
+    ];
+
+    includes = [
+        "$//apps/libc/include"
+    ];
+
+    app = {
+        "label": "sysstat",
+        "inputs": sources + dynlibs,
+        "includes": includes
+    };
+
+    entries = application(app);
+    return entries;
+}
+
+return build();
@@ -0,0 +1,910 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    sysstat.c
+
+Abstract:
+
+    This module implements the sysstat application, which prints how often
+    each system call is made and how long it takes.
+
+Author:
+
+    Evan Green 27-Mar-2017
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/minocaos.h>
+#include <minoca/lib/mlibc.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define SYSSTAT_VERSION_MAJOR 1
+#define SYSSTAT_VERSION_MINOR 0
+
+#define SYSSTAT_USAGE                                                      \
+    "usage: sysstat [options]\n\n"                                         \
+    "The sysstat utility prints how many times each system call has \n"    \
+    "been made and how long the calls took. Options are:\n"                \
+    "  -t, --time -- Sort by total time spent rather than call count.\n"   \
+    "  -H, --histogram -- Also print a latency histogram for each call.\n" \
+    "  -i, --interval=seconds -- Take a snapshot every interval and \n"    \
+    "      print only the calls made during that interval.\n"              \
+    "  -c, --count=count -- With -i, stop after this many intervals.\n"    \
+    "  -r, --reset -- Reset all system call counters and exit.\n"          \
+    "  --help -- Display this help text.\n"                                \
+    "  --version -- Display the application version and exit.\n\n"
+
+#define SYSSTAT_OPTIONS_STRING "c:Hhi:rtV"
+
+//
+// Define application options.
+//
+
+//
+// Set this option to sort by total time rather than count.
+//
+
+#define SYSSTAT_OPTION_SORT_BY_TIME 0x00000001
+
+//
+// Set this option to print the latency histogram for each call.
+//
+
+#define SYSSTAT_OPTION_HISTOGRAM 0x00000002
+
+//
+// Define the width of the widest histogram bar.
+//
+
+#define SYSSTAT_HISTOGRAM_WIDTH 40
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure describes one row of the system call table.
+
+Members:
+
+    Number - Stores the system call number.
+
+    Statistic - Stores a pointer to the counters for the call.
+
+--*/
+
+typedef struct _SYSSTAT_ENTRY {
+    ULONG Number;
+    PSYSTEM_CALL_STATISTIC Statistic;
+} SYSSTAT_ENTRY, *PSYSSTAT_ENTRY;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PSYSTEM_CALL_STATISTICS
+SysstatGetSnapshot (
+    VOID
+    );
+
+VOID
+SysstatSubtractSnapshot (
+    PSYSTEM_CALL_STATISTICS Current,
+    PSYSTEM_CALL_STATISTICS Previous
+    );
+
+VOID
+SysstatPrintSnapshot (
+    PSYSTEM_CALL_STATISTICS Snapshot,
+    ULONG Options
+    );
+
+VOID
+SysstatPrintHistogram (
+    PSYSTEM_CALL_STATISTIC Statistic,
+    ULONGLONG Frequency
+    );
+
+double
+SysstatTicksToMicroseconds (
+    ULONGLONG Ticks,
+    ULONGLONG Frequency
+    );
+
+int
+SysstatCompareByCount (
+    const void *Left,
+    const void *Right
+    );
+
+int
+SysstatCompareByTime (
+    const void *Left,
+    const void *Right
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+struct option SysstatLongOptions[] = {
+    {"count", required_argument, 0, 'c'},
+    {"histogram", no_argument, 0, 'H'},
+    {"interval", required_argument, 0, 'i'},
+    {"reset", no_argument, 0, 'r'},
+    {"time", no_argument, 0, 't'},
+    {"help", no_argument, 0, 'h'},
+    {"version", no_argument, 0, 'V'},
+    {NULL, 0, 0, 0}
+};
+
+//
+// Store the system call names, indexed by system call number. This must be
+// kept in sync with the SYSTEM_CALL_NUMBER enum.
+//
+
+PSTR SysstatCallNames[SystemCallCount] = {
+    "Invalid",
+    "RestoreContext",
+    "ExitThread",
+    "Open",
+    "Close",
+    "PerformIo",
+    "CreatePipe",
+    "CreateThread",
+    "ForkProcess",
+    "ExecuteImage",
+    "ChangeDirectory",
+    "SetSignalHandler",
+    "SendSignal",
+    "GetSetProcessId",
+    "SetSignalBehavior",
+    "WaitForChildProcess",
+    "SuspendExecution",
+    "ExitProcess",
+    "Poll",
+    "SocketCreate",
+    "SocketBind",
+    "SocketListen",
+    "SocketAccept",
+    "SocketConnect",
+    "SocketPerformIo",
+    "FileControl",
+    "GetSetFileInformation",
+    "Debug",
+    "Seek",
+    "CreateSymbolicLink",
+    "ReadSymbolicLink",
+    "Delete",
+    "Rename",
+    "TimeZoneControl",
+    "MountOrUnmount",
+    "QueryTimeCounter",
+    "TimerControl",
+    "GetEffectiveAccess",
+    "DelayExecution",
+    "UserControl",
+    "Flush",
+    "GetResourceUsage",
+    "LoadDriver",
+    "FlushCache",
+    "GetCurrentDirectory",
+    "SocketGetSetInformation",
+    "SocketShutdown",
+    "CreateHardLink",
+    "MapOrUnmapMemory",
+    "FlushMemory",
+    "LocateDeviceInformation",
+    "GetSetDeviceInformation",
+    "OpenDevice",
+    "GetSetSystemInformation",
+    "ResetSystem",
+    "SetSystemTime",
+    "SetMemoryProtection",
+    "SetThreadIdentity",
+    "SetThreadPermissions",
+    "SetSupplementaryGroups",
+    "SocketCreatePair",
+    "CreateTerminal",
+    "SocketPerformVectoredIo",
+    "SetThreadPointer",
+    "UserLock",
+    "SetThreadIdPointer",
+    "SetUmask",
+    "DuplicateHandle",
+    "PerformVectoredIo",
+    "SetITimer",
+    "SetResourceLimit",
+    "SetBreak",
+    "IoRingControl",
+    "GetSetSchedulingPolicy",
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the sysstat user mode program.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings. The array count is bounded by the
+        previous parameter, and the strings are null-terminated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PSTR AfterScan;
+    ULONG ArgumentIndex;
+    ULONG Count;
+    PSYSTEM_CALL_STATISTICS Current;
+    ULONG Interval;
+    ULONG IntervalIndex;
+    INT Option;
+    ULONG Options;
+    PSYSTEM_CALL_STATISTICS Previous;
+    BOOL Reset;
+    INT ReturnValue;
+    UINTN Size;
+    KSTATUS Status;
+    ULONG Value;
+
+    Count = 0;
+    Current = NULL;
+    Interval = 0;
+    Options = 0;
+    Previous = NULL;
+    Reset = FALSE;
+    ReturnValue = 0;
+
+    //
+    // Process the control arguments.
+    //
+
+    while (TRUE) {
+        Option = getopt_long(ArgumentCount,
+                             Arguments,
+                             SYSSTAT_OPTIONS_STRING,
+                             SysstatLongOptions,
+                             NULL);
+
+        if (Option == -1) {
+            break;
+        }
+
+        if ((Option == '?') || (Option == ':')) {
+            ReturnValue = 1;
+            goto mainEnd;
+        }
+
+        switch (Option) {
+        case 'c':
+        case 'i':
+            Value = strtoul(optarg, &AfterScan, 10);
+            if ((AfterScan == optarg) || (*AfterScan != '\0')) {
+                fprintf(stderr, "sysstat: Invalid number %s\n", optarg);
+                ReturnValue = 1;
+                goto mainEnd;
+            }
+
+            if (Option == 'c') {
+                Count = Value;
+
+            } else {
+                Interval = Value;
+            }
+
+            break;
+
+        case 'H':
+            Options |= SYSSTAT_OPTION_HISTOGRAM;
+            break;
+
+        case 'r':
+            Reset = TRUE;
+            break;
+
+        case 't':
+            Options |= SYSSTAT_OPTION_SORT_BY_TIME;
+            break;
+
+        case 'V':
+            printf("sysstat version %d.%02d\n",
+                   SYSSTAT_VERSION_MAJOR,
+                   SYSSTAT_VERSION_MINOR);
+
+            ReturnValue = 1;
+            goto mainEnd;
+
+        case 'h':
+            printf(SYSSTAT_USAGE);
+            return 1;
+
+        default:
+
+            assert(FALSE);
+
+            ReturnValue = 1;
+            goto mainEnd;
+        }
+    }
+
+    ArgumentIndex = optind;
+    if (ArgumentIndex > ArgumentCount) {
+        ArgumentIndex = ArgumentCount;
+    }
+
+    if (ArgumentIndex < ArgumentCount) {
+        fprintf(stderr,
+                "sysstat: Unexpected argument %s\n",
+                Arguments[ArgumentIndex]);
+    }
+
+    if (Reset != FALSE) {
+        Size = 0;
+        Status = OsGetSetSystemInformation(SystemInformationKe,
+                                           KeInformationSystemCallStatistics,
+                                           NULL,
+                                           &Size,
+                                           TRUE);
+
+        if (!KSUCCESS(Status)) {
+            ReturnValue = ClConvertKstatusToErrorNumber(Status);
+            fprintf(stderr,
+                    "sysstat: Failed to reset counters: status %d: %s.\n",
+                    Status,
+                    strerror(ReturnValue));
+        }
+
+        goto mainEnd;
+    }
+
+    Previous = SysstatGetSnapshot();
+    if (Previous == NULL) {
+        ReturnValue = errno;
+        goto mainEnd;
+    }
+
+    //
+    // Without an interval, just print everything since boot (or the last
+    // reset).
+    //
+
+    if (Interval == 0) {
+        SysstatPrintSnapshot(Previous, Options);
+        goto mainEnd;
+    }
+
+    IntervalIndex = 0;
+    while ((Count == 0) || (IntervalIndex < Count)) {
+        sleep(Interval);
+        Current = SysstatGetSnapshot();
+        if (Current == NULL) {
+            ReturnValue = errno;
+            goto mainEnd;
+        }
+
+        SysstatSubtractSnapshot(Current, Previous);
+        printf("\n");
+        SysstatPrintSnapshot(Previous, Options);
+        fflush(stdout);
+        free(Previous);
+        Previous = Current;
+        Current = NULL;
+        IntervalIndex += 1;
+    }
+
+mainEnd:
+    if (Current != NULL) {
+        free(Current);
+    }
+
+    if (Previous != NULL) {
+        free(Previous);
+    }
+
+    return ReturnValue;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PSYSTEM_CALL_STATISTICS
+SysstatGetSnapshot (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a snapshot of the kernel's system call counters.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the snapshot on success. The caller is responsible
+    for freeing this memory.
+
+    NULL on failure, with errno set.
+
+--*/
+
+{
+
+    UINTN Size;
+    PSYSTEM_CALL_STATISTICS Snapshot;
+    KSTATUS Status;
+
+    Size = sizeof(SYSTEM_CALL_STATISTICS);
+    while (TRUE) {
+        Snapshot = malloc(Size);
+        if (Snapshot == NULL) {
+            return NULL;
+        }
+
+        memset(Snapshot, 0, sizeof(SYSTEM_CALL_STATISTICS));
+        Snapshot->Version = SYSTEM_CALL_STATISTICS_VERSION;
+        Status = OsGetSetSystemInformation(SystemInformationKe,
+                                           KeInformationSystemCallStatistics,
+                                           Snapshot,
+                                           &Size,
+                                           FALSE);
+
+        if (KSUCCESS(Status)) {
+            break;
+        }
+
+        free(Snapshot);
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            errno = ClConvertKstatusToErrorNumber(Status);
+            fprintf(stderr,
+                    "Error: failed to get system call statistics: "
+                    "status %d: %s.\n",
+                    Status,
+                    strerror(errno));
+
+            return NULL;
+        }
+    }
+
+    return Snapshot;
+}
+
+VOID
+SysstatSubtractSnapshot (
+    PSYSTEM_CALL_STATISTICS Current,
+    PSYSTEM_CALL_STATISTICS Previous
+    )
+
+/*++
+
+Routine Description:
+
+    This routine turns the previous snapshot into the difference between the
+    two snapshots. Maximums can't be subtracted, so the maximum since the
+    counters were last reset is left in place.
+
+Arguments:
+
+    Current - Supplies a pointer to the newer snapshot.
+
+    Previous - Supplies a pointer to the older snapshot, which is replaced with
+        the difference.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    ULONG Index;
+    PSYSTEM_CALL_STATISTIC New;
+    PSYSTEM_CALL_STATISTIC Old;
+
+    assert(Current->SystemCallCount == Previous->SystemCallCount);
+
+    New = (PSYSTEM_CALL_STATISTIC)(Current + 1);
+    Old = (PSYSTEM_CALL_STATISTIC)(Previous + 1);
+    for (Index = 0; Index < Current->SystemCallCount; Index += 1) {
+
+        //
+        // If the counters were reset in the middle, just report what's been
+        // counted since.
+        //
+
+        if (New[Index].Count < Old[Index].Count) {
+            memcpy(&(Old[Index]), &(New[Index]), sizeof(SYSTEM_CALL_STATISTIC));
+            continue;
+        }
+
+        Old[Index].Count = New[Index].Count - Old[Index].Count;
+        Old[Index].TotalTicks = New[Index].TotalTicks -
+                                Old[Index].TotalTicks;
+
+        Old[Index].MaxTicks = New[Index].MaxTicks;
+        for (Bucket = 0; Bucket < SYSTEM_CALL_HISTOGRAM_BUCKETS; Bucket += 1) {
+            Old[Index].Histogram[Bucket] = New[Index].Histogram[Bucket] -
+                                           Old[Index].Histogram[Bucket];
+        }
+    }
+
+    return;
+}
+
+VOID
+SysstatPrintSnapshot (
+    PSYSTEM_CALL_STATISTICS Snapshot,
+    ULONG Options
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the system calls in the given snapshot that were made
+    at least once.
+
+Arguments:
+
+    Snapshot - Supplies a pointer to the snapshot to print.
+
+    Options - Supplies a bitfield of application options. See
+        SYSSTAT_OPTION_* definitions.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    double Average;
+    PSYSTEM_CALL_STATISTIC Array;
+    ULONG EntryCount;
+    PSYSSTAT_ENTRY Entries;
+    ULONGLONG Frequency;
+    ULONG Index;
+    PSTR Name;
+    CHAR NameBuffer[16];
+    PSYSTEM_CALL_STATISTIC Statistic;
+    ULONGLONG TotalCalls;
+
+    Array = (PSYSTEM_CALL_STATISTIC)(Snapshot + 1);
+    Frequency = Snapshot->TimeCounterFrequency;
+    Entries = malloc(Snapshot->SystemCallCount * sizeof(SYSSTAT_ENTRY));
+    if (Entries == NULL) {
+        return;
+    }
+
+    EntryCount = 0;
+    TotalCalls = 0;
+    for (Index = 0; Index < Snapshot->SystemCallCount; Index += 1) {
+        if (Array[Index].Count != 0) {
+            Entries[EntryCount].Number = Index;
+            Entries[EntryCount].Statistic = &(Array[Index]);
+            EntryCount += 1;
+            TotalCalls += Array[Index].Count;
+        }
+    }
+
+    if ((Options & SYSSTAT_OPTION_SORT_BY_TIME) != 0) {
+        qsort(Entries, EntryCount, sizeof(SYSSTAT_ENTRY), SysstatCompareByTime);
+
+    } else {
+        qsort(Entries,
+              EntryCount,
+              sizeof(SYSSTAT_ENTRY),
+              SysstatCompareByCount);
+    }
+
+    printf("%-24s %12s %12s %12s %12s\n",
+           "System Call",
+           "Count",
+           "Total ms",
+           "Avg us",
+           "Max us");
+
+    for (Index = 0; Index < EntryCount; Index += 1) {
+        Statistic = Entries[Index].Statistic;
+        if (Entries[Index].Number < SystemCallCount) {
+            Name = SysstatCallNames[Entries[Index].Number];
+
+        } else {
+            snprintf(NameBuffer,
+                     sizeof(NameBuffer),
+                     "#%u",
+                     Entries[Index].Number);
+
+            Name = NameBuffer;
+        }
+
+        Average = SysstatTicksToMicroseconds(Statistic->TotalTicks,
+                                             Frequency) /
+                  Statistic->Count;
+
+        printf("%-24s %12llu %12.3f %12.2f %12.2f\n",
+               Name,
+               Statistic->Count,
+               SysstatTicksToMicroseconds(Statistic->TotalTicks,
+                                          Frequency) / 1000.0,
+               Average,
+               SysstatTicksToMicroseconds(Statistic->MaxTicks, Frequency));
+
+        if ((Options & SYSSTAT_OPTION_HISTOGRAM) != 0) {
+            SysstatPrintHistogram(Statistic, Frequency);
+        }
+    }
+
+    printf("%-24s %12llu\n", "Total", TotalCalls);
+    free(Entries);
+    return;
+}
+
+VOID
+SysstatPrintHistogram (
+    PSYSTEM_CALL_STATISTIC Statistic,
+    ULONGLONG Frequency
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the latency histogram for a system call. Empty buckets
+    at either end are skipped.
+
+Arguments:
+
+    Statistic - Supplies a pointer to the system call's counters.
+
+    Frequency - Supplies the frequency of the time counter, in Hertz.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bar;
+    ULONG Bucket;
+    ULONG First;
+    ULONG Last;
+    ULONG Largest;
+
+    First = SYSTEM_CALL_HISTOGRAM_BUCKETS;
+    Last = 0;
+    Largest = 0;
+    for (Bucket = 0; Bucket < SYSTEM_CALL_HISTOGRAM_BUCKETS; Bucket += 1) {
+        if (Statistic->Histogram[Bucket] != 0) {
+            if (First == SYSTEM_CALL_HISTOGRAM_BUCKETS) {
+                First = Bucket;
+            }
+
+            Last = Bucket;
+            if (Statistic->Histogram[Bucket] > Largest) {
+                Largest = Statistic->Histogram[Bucket];
+            }
+        }
+    }
+
+    if (Largest == 0) {
+        return;
+    }
+
+    for (Bucket = First; Bucket <= Last; Bucket += 1) {
+        Bar = ((ULONGLONG)(Statistic->Histogram[Bucket]) *
+               SYSSTAT_HISTOGRAM_WIDTH) / Largest;
+
+        if ((Bar == 0) && (Statistic->Histogram[Bucket] != 0)) {
+            Bar = 1;
+        }
+
+        if (Bucket == SYSTEM_CALL_HISTOGRAM_BUCKETS - 1) {
+            printf("    %10s %10.2f us %10u ",
+                   "",
+                   SysstatTicksToMicroseconds(1ULL << Bucket, Frequency),
+                   Statistic->Histogram[Bucket]);
+
+        } else {
+            printf("    < %10.2f us %10u ",
+                   SysstatTicksToMicroseconds(1ULL << (Bucket + 1),
+                                              Frequency),
+                   Statistic->Histogram[Bucket]);
+        }
+
+        while (Bar != 0) {
+            putchar('*');
+            Bar -= 1;
+        }
+
+        putchar('\n');
+    }
+
+    return;
+}
+
+double
+SysstatTicksToMicroseconds (
+    ULONGLONG Ticks,
+    ULONGLONG Frequency
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a time counter tick count into microseconds.
+
+Arguments:
+
+    Ticks - Supplies the number of time counter ticks.
+
+    Frequency - Supplies the frequency of the time counter, in Hertz.
+
+Return Value:
+
+    Returns the number of microseconds, or the raw tick count if the
+    frequency is unknown.
+
+--*/
+
+{
+
+    if (Frequency == 0) {
+        return (double)Ticks;
+    }
+
+    return ((double)Ticks * 1000000.0) / (double)Frequency;
+}
+
+int
+SysstatCompareByCount (
+    const void *Left,
+    const void *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two system call entries by call count, putting the
+    most frequent calls first.
+
+Arguments:
+
+    Left - Supplies a pointer to the left entry.
+
+    Right - Supplies a pointer to the right entry.
+
+Return Value:
+
+    Less than zero if the left entry belongs first.
+
+    Zero if the entries are equal.
+
+    Greater than zero if the right entry belongs first.
+
+--*/
+
+{
+
+    PSYSTEM_CALL_STATISTIC LeftStatistic;
+    PSYSTEM_CALL_STATISTIC RightStatistic;
+
+    LeftStatistic = ((PSYSSTAT_ENTRY)Left)->Statistic;
+    RightStatistic = ((PSYSSTAT_ENTRY)Right)->Statistic;
+    if (LeftStatistic->Count > RightStatistic->Count) {
+        return -1;
+
+    } else if (LeftStatistic->Count < RightStatistic->Count) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+SysstatCompareByTime (
+    const void *Left,
+    const void *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two system call entries by total time spent,
+    putting the most expensive calls first.
+
+Arguments:
+
+    Left - Supplies a pointer to the left entry.
+
+    Right - Supplies a pointer to the right entry.
+
+Return Value:
+
+    Less than zero if the left entry belongs first.
+
+    Zero if the entries are equal.
+
+    Greater than zero if the right entry belongs first.
+
+--*/
+
+{
+
+    PSYSTEM_CALL_STATISTIC LeftStatistic;
+    PSYSTEM_CALL_STATISTIC RightStatistic;
+
+    LeftStatistic = ((PSYSSTAT_ENTRY)Left)->Statistic;
+    RightStatistic = ((PSYSSTAT_ENTRY)Right)->Statistic;
+    if (LeftStatistic->TotalTicks > RightStatistic->TotalTicks) {
+        return -1;
+
+    } else if (LeftStatistic->TotalTicks < RightStatistic->TotalTicks) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -29,6 +29,7 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <aio.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -36,9 +37,11 @@ Module Name:
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <minoca/lib/types.h>
 
@@ -52,6 +55,10 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+#define TEST_AIO_FILE "aiotest.tmp"
+#define TEST_AIO_BLOCK_COUNT 8
+#define TEST_AIO_BLOCK_SIZE 4096
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -70,6 +77,17 @@ TestAioExecute (
     int Pipe[2]
     );
 
+ULONG
+TestPosixAio (
+    VOID
+    );
+
+ULONG
+TestPosixAioWait (
+    struct aiocb *Control,
+    ssize_t ExpectedResult
+    );
+
 void
 TestAioSigioHandler (
     int Signal,
@@ -77,11 +95,17 @@ TestAioSigioHandler (
     void *Context
     );
 
+void
+TestAioSigusrHandler (
+    int Signal
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 ULONG TestAioSignalCount;
+volatile ULONG TestAioCompletionSignalCount;
 
 //
 // ------------------------------------------------------------------ Functions
@@ -184,6 +208,7 @@ Return Value:
     }
 
     Failures += TestAioExecute(Pipe);
+    Failures += TestPosixAio();
 
 TestAioRunEnd:
     sigaction(SIGIO, &OldAction, NULL);
@@ -436,3 +461,335 @@ Return Value:
     return;
 }
 
+ULONG
+TestPosixAio (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests the POSIX asynchronous I/O functions against a regular
+    file.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    0 on success.
+
+    Returns the number of errors on failure.
+
+--*/
+
+{
+
+    struct sigaction Action;
+    UCHAR *Buffer;
+    ULONG BlockIndex;
+    ULONG ByteIndex;
+    struct aiocb Controls[TEST_AIO_BLOCK_COUNT];
+    struct aiocb *List[TEST_AIO_BLOCK_COUNT];
+    ULONG Failures;
+    int File;
+    struct sigaction OldAction;
+    int Status;
+    const struct aiocb *SuspendList[1];
+    struct timespec Timeout;
+
+    Failures = 0;
+    File = -1;
+    Buffer = malloc(TEST_AIO_BLOCK_COUNT * TEST_AIO_BLOCK_SIZE);
+    if (Buffer == NULL) {
+        ERROR("Failed to allocate AIO buffer.\n");
+        return 1;
+    }
+
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = TestAioSigusrHandler;
+    sigaction(SIGUSR1, &Action, &OldAction);
+    File = open(TEST_AIO_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (File < 0) {
+        ERROR("Failed to open %s.\n", TEST_AIO_FILE);
+        Failures += 1;
+        goto TestPosixAioEnd;
+    }
+
+    //
+    // Write every block with a single list I/O call, and wait for them all.
+    //
+
+    for (BlockIndex = 0; BlockIndex < TEST_AIO_BLOCK_COUNT; BlockIndex += 1) {
+        for (ByteIndex = 0; ByteIndex < TEST_AIO_BLOCK_SIZE; ByteIndex += 1) {
+            Buffer[(BlockIndex * TEST_AIO_BLOCK_SIZE) + ByteIndex] =
+                                                 (UCHAR)(BlockIndex + ByteIndex);
+        }
+
+        memset(&(Controls[BlockIndex]), 0, sizeof(struct aiocb));
+        Controls[BlockIndex].aio_fildes = File;
+        Controls[BlockIndex].aio_offset = BlockIndex * TEST_AIO_BLOCK_SIZE;
+        Controls[BlockIndex].aio_buf =
+                                      Buffer + (BlockIndex * TEST_AIO_BLOCK_SIZE);
+
+        Controls[BlockIndex].aio_nbytes = TEST_AIO_BLOCK_SIZE;
+        Controls[BlockIndex].aio_lio_opcode = LIO_WRITE;
+        Controls[BlockIndex].aio_sigevent.sigev_notify = SIGEV_NONE;
+        List[BlockIndex] = &(Controls[BlockIndex]);
+    }
+
+    Status = lio_listio(LIO_WAIT, List, TEST_AIO_BLOCK_COUNT, NULL);
+    if (Status != 0) {
+        ERROR("lio_listio write failed: %s.\n", strerror(errno));
+        Failures += 1;
+        goto TestPosixAioEnd;
+    }
+
+    for (BlockIndex = 0; BlockIndex < TEST_AIO_BLOCK_COUNT; BlockIndex += 1) {
+        if ((aio_error(&(Controls[BlockIndex])) != 0) ||
+            (aio_return(&(Controls[BlockIndex])) != TEST_AIO_BLOCK_SIZE)) {
+
+            ERROR("AIO write %d did not complete properly.\n", BlockIndex);
+            Failures += 1;
+        }
+    }
+
+    //
+    // Flush asynchronously.
+    //
+
+    memset(&(Controls[0]), 0, sizeof(struct aiocb));
+    Controls[0].aio_fildes = File;
+    Controls[0].aio_sigevent.sigev_notify = SIGEV_NONE;
+    if (aio_fsync(O_SYNC, &(Controls[0])) != 0) {
+        ERROR("aio_fsync failed: %s.\n", strerror(errno));
+        Failures += 1;
+
+    } else {
+        Failures += TestPosixAioWait(&(Controls[0]), 0);
+    }
+
+    //
+    // Read the blocks back in reverse with individual calls, asking for a
+    // signal on each completion.
+    //
+
+    memset(Buffer, 0, TEST_AIO_BLOCK_COUNT * TEST_AIO_BLOCK_SIZE);
+    TestAioCompletionSignalCount = 0;
+    BlockIndex = TEST_AIO_BLOCK_COUNT;
+    while (BlockIndex != 0) {
+        BlockIndex -= 1;
+        memset(&(Controls[BlockIndex]), 0, sizeof(struct aiocb));
+        Controls[BlockIndex].aio_fildes = File;
+        Controls[BlockIndex].aio_offset = BlockIndex * TEST_AIO_BLOCK_SIZE;
+        Controls[BlockIndex].aio_buf =
+                                      Buffer + (BlockIndex * TEST_AIO_BLOCK_SIZE);
+
+        Controls[BlockIndex].aio_nbytes = TEST_AIO_BLOCK_SIZE;
+        Controls[BlockIndex].aio_sigevent.sigev_notify = SIGEV_SIGNAL;
+        Controls[BlockIndex].aio_sigevent.sigev_signo = SIGUSR1;
+        if (aio_read(&(Controls[BlockIndex])) != 0) {
+            ERROR("aio_read %d failed: %s.\n", BlockIndex, strerror(errno));
+            Failures += 1;
+            Controls[BlockIndex].aio_nbytes = 0;
+        }
+    }
+
+    for (BlockIndex = 0; BlockIndex < TEST_AIO_BLOCK_COUNT; BlockIndex += 1) {
+        if (Controls[BlockIndex].aio_nbytes != 0) {
+            Failures += TestPosixAioWait(&(Controls[BlockIndex]),
+                                         TEST_AIO_BLOCK_SIZE);
+        }
+    }
+
+    for (BlockIndex = 0; BlockIndex < TEST_AIO_BLOCK_COUNT; BlockIndex += 1) {
+        for (ByteIndex = 0; ByteIndex < TEST_AIO_BLOCK_SIZE; ByteIndex += 1) {
+            if (Buffer[(BlockIndex * TEST_AIO_BLOCK_SIZE) + ByteIndex] !=
+                (UCHAR)(BlockIndex + ByteIndex)) {
+
+                ERROR("AIO read block %d byte %d mismatch: %x.\n",
+                      BlockIndex,
+                      ByteIndex,
+                      Buffer[(BlockIndex * TEST_AIO_BLOCK_SIZE) + ByteIndex]);
+
+                Failures += 1;
+                break;
+            }
+        }
+    }
+
+    //
+    // Standard signals don't queue, so several completions may collapse into
+    // one signal, but at least one must arrive. It may trail the completions
+    // slightly.
+    //
+
+    for (BlockIndex = 0; BlockIndex < 10; BlockIndex += 1) {
+        if (TestAioCompletionSignalCount != 0) {
+            break;
+        }
+
+        usleep(10000);
+    }
+
+    if (TestAioCompletionSignalCount == 0) {
+        ERROR("Got no AIO completion signals.\n");
+        Failures += 1;
+    }
+
+    //
+    // A read at the end of the file completes with zero bytes.
+    //
+
+    memset(&(Controls[0]), 0, sizeof(struct aiocb));
+    Controls[0].aio_fildes = File;
+    Controls[0].aio_offset = TEST_AIO_BLOCK_COUNT * TEST_AIO_BLOCK_SIZE;
+    Controls[0].aio_buf = Buffer;
+    Controls[0].aio_nbytes = TEST_AIO_BLOCK_SIZE;
+    Controls[0].aio_sigevent.sigev_notify = SIGEV_NONE;
+    if (aio_read(&(Controls[0])) != 0) {
+        ERROR("aio_read at EOF failed: %s.\n", strerror(errno));
+        Failures += 1;
+
+    } else {
+        Failures += TestPosixAioWait(&(Controls[0]), 0);
+    }
+
+    //
+    // An operation on a bad descriptor completes with EBADF.
+    //
+
+    memset(&(Controls[0]), 0, sizeof(struct aiocb));
+    Controls[0].aio_fildes = 9999;
+    Controls[0].aio_buf = Buffer;
+    Controls[0].aio_nbytes = 1;
+    Controls[0].aio_sigevent.sigev_notify = SIGEV_NONE;
+    if (aio_read(&(Controls[0])) == 0) {
+        SuspendList[0] = &(Controls[0]);
+        Timeout.tv_sec = 5;
+        Timeout.tv_nsec = 0;
+        while (aio_error(&(Controls[0])) == EINPROGRESS) {
+            if ((aio_suspend(SuspendList, 1, &Timeout) != 0) &&
+                (errno != EINTR)) {
+
+                break;
+            }
+        }
+
+        if (aio_error(&(Controls[0])) != EBADF) {
+            ERROR("Expected EBADF, got %d.\n", aio_error(&(Controls[0])));
+            Failures += 1;
+        }
+
+    } else if (errno != EBADF) {
+        ERROR("aio_read on bad descriptor failed: %s.\n", strerror(errno));
+        Failures += 1;
+    }
+
+TestPosixAioEnd:
+    if (File >= 0) {
+        close(File);
+        unlink(TEST_AIO_FILE);
+    }
+
+    sigaction(SIGUSR1, &OldAction, NULL);
+    free(Buffer);
+    return Failures;
+}
+
+ULONG
+TestPosixAioWait (
+    struct aiocb *Control,
+    ssize_t ExpectedResult
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for an asynchronous operation to finish and validates
+    its result.
+
+Arguments:
+
+    Control - Supplies a pointer to the control block to wait for.
+
+    ExpectedResult - Supplies the expected return value of the operation.
+
+Return Value:
+
+    0 on success.
+
+    1 on failure.
+
+--*/
+
+{
+
+    const struct aiocb *List[1];
+    ssize_t Result;
+    struct timespec Timeout;
+
+    List[0] = Control;
+    Timeout.tv_sec = 5;
+    Timeout.tv_nsec = 0;
+    while (aio_error(Control) == EINPROGRESS) {
+        if (aio_suspend(List, 1, &Timeout) != 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            ERROR("aio_suspend failed: %s.\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    if (aio_error(Control) != 0) {
+        ERROR("AIO operation failed: %s.\n", strerror(aio_error(Control)));
+        return 1;
+    }
+
+    Result = aio_return(Control);
+    if (Result != ExpectedResult) {
+        ERROR("AIO returned %ld, expected %ld.\n",
+              (long)Result,
+              (long)ExpectedResult);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+TestAioSigusrHandler (
+    int Signal
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when an asynchronous I/O completion signal comes
+    in.
+
+Arguments:
+
+    Signal - Supplies the signal that occurred. This should always be SIGUSR1.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    assert(Signal == SIGUSR1);
+
+    TestAioCompletionSignalCount += 1;
+    return;
+}
+
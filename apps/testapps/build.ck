@@ -35,8 +35,10 @@ function build() {
         "mnttest",
         "pathtest",
         "perftest",
+        "rttest",
         "sigtest",
         "socktest",
+        "ulcktest",
         "utmrtest"
     ];
 
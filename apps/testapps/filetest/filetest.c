@@ -77,8 +77,8 @@ Module Name:
     "  -p, --threads <count> -- Set the number of threads to spin up.\n"       \
     "  -r, --seed=int -- Set the random seed for deterministic results.\n"     \
     "  -t, --test -- Set the test to perform. Valid values are all, \n"        \
-    "      consistency, concurrency, seek, streamseek, append, and \n"         \
-    "      uninitialized.\n"                                                   \
+    "      consistency, concurrency, seek, streamseek, append, \n"            \
+    "      uninitialized, and direct.\n"                                       \
     "  --debug -- Print lots of information about what's happening.\n"         \
     "  --quiet -- Print only errors.\n"                                        \
     "  --no-cleanup -- Leave test files around for debugging.\n"               \
@@ -122,7 +122,8 @@ typedef enum _FILE_TEST_TYPE {
     FileTestStreamSeek,
     FileTestConcurrency,
     FileTestAppend,
-    FileTestUninitializedData
+    FileTestUninitializedData,
+    FileTestDirectIo
 } FILE_TEST_TYPE, *PFILE_TEST_TYPE;
 
 //
@@ -171,6 +172,13 @@ RunFileUninitializedDataTest (
     INT Iterations
     );
 
+ULONG
+RunFileDirectIoTest (
+    INT FileCount,
+    INT FileSize,
+    INT Iterations
+    );
+
 ULONG
 PrintTestTime (
     struct timeval *StartTime
@@ -364,6 +372,9 @@ Return Value:
             } else if (strcasecmp(optarg, "uninitialized") == 0) {
                 Test = FileTestUninitializedData;
 
+            } else if (strcasecmp(optarg, "direct") == 0) {
+                Test = FileTestDirectIo;
+
             } else {
                 PRINT_ERROR("Invalid test: %s.\n", optarg);
                 Status = 1;
@@ -458,6 +469,10 @@ Return Value:
                                                  Iterations);
     }
 
+    if ((Test == FileTestAll) || (Test == FileTestDirectIo)) {
+        Failures += RunFileDirectIoTest(FileCount, FileSize, Iterations);
+    }
+
     //
     // Wait for any children.
     //
@@ -2684,6 +2699,275 @@ Return Value:
     return Failures;
 }
 
+ULONG
+RunFileDirectIoTest (
+    INT FileCount,
+    INT FileSize,
+    INT Iterations
+    )
+
+/*++
+
+Routine Description:
+
+    This routine executes the direct I/O test. It mixes O_DIRECT reads and
+    writes with regular cached reads and writes on the same file and makes
+    sure each side always sees the other's data.
+
+Arguments:
+
+    FileCount - Supplies the number of files to work with. The direct I/O
+        test only uses one file, but this is used to scale its size.
+
+    FileSize - Supplies the size of each file.
+
+    Iterations - Supplies the number of iterations to perform.
+
+Return Value:
+
+    Returns the number of failures in the test suite.
+
+--*/
+
+{
+
+    INT Action;
+    INT Block;
+    INT BlockCount;
+    PBYTE BlockState;
+    PUCHAR Buffer;
+    ssize_t BytesComplete;
+    INT CachedFile;
+    INT DirectFile;
+    ULONG Failures;
+    CHAR FileName[16];
+    INT Index;
+    INT Iteration;
+    off_t Offset;
+    long PageSize;
+    INT Percent;
+    pid_t Process;
+    INT Result;
+    struct timeval StartTime;
+    UCHAR Value;
+
+    BlockState = NULL;
+    Buffer = NULL;
+    CachedFile = -1;
+    DirectFile = -1;
+    Failures = 0;
+    Process = getpid();
+    snprintf(FileName, sizeof(FileName), "fdio%x", Process & 0xFFFF);
+
+    //
+    // Record the test start time.
+    //
+
+    Result = gettimeofday(&StartTime, NULL);
+    if (Result != 0) {
+        PRINT_ERROR("Failed to get time of day: %s.\n", strerror(errno));
+        Failures += 1;
+        goto RunFileDirectIoTestEnd;
+    }
+
+    //
+    // Direct I/O works in whole pages, so size the file in pages.
+    //
+
+    PageSize = sysconf(_SC_PAGESIZE);
+    BlockCount = ((LONGLONG)FileCount * FileSize) / PageSize;
+    if (BlockCount == 0) {
+        BlockCount = 1;
+    }
+
+    PRINT("Process %d Running direct I/O test with a file of %d %ld byte "
+          "blocks. %d iterations.\n",
+          Process,
+          BlockCount,
+          PageSize,
+          Iterations);
+
+    Percent = Iterations / 100;
+    if (Percent == 0) {
+        Percent = 1;
+    }
+
+    BlockState = calloc(BlockCount, sizeof(BYTE));
+    Result = posix_memalign((void **)&Buffer, PageSize, PageSize);
+    if ((BlockState == NULL) || (Result != 0)) {
+        Buffer = NULL;
+        Failures += 1;
+        goto RunFileDirectIoTestEnd;
+    }
+
+    CachedFile = open(FileName,
+                      O_RDWR | O_CREAT | O_TRUNC,
+                      FILE_TEST_CREATE_PERMISSIONS);
+
+    if (CachedFile < 0) {
+        PRINT_ERROR("Failed to open %s: %s.\n", FileName, strerror(errno));
+        Failures += 1;
+        goto RunFileDirectIoTestEnd;
+    }
+
+    DirectFile = open(FileName, O_RDWR | O_DIRECT);
+    if (DirectFile < 0) {
+        PRINT_ERROR("Failed to open %s with O_DIRECT: %s.\n",
+                    FileName,
+                    strerror(errno));
+
+        Failures += 1;
+        goto RunFileDirectIoTestEnd;
+    }
+
+    //
+    // Fill the file with zeros through the cache.
+    //
+
+    memset(Buffer, 0, PageSize);
+    for (Block = 0; Block < BlockCount; Block += 1) {
+        BytesComplete = pwrite(CachedFile,
+                               Buffer,
+                               PageSize,
+                               (off_t)Block * PageSize);
+
+        if (BytesComplete != PageSize) {
+            PRINT_ERROR("Failed to write block %d: %s.\n",
+                        Block,
+                        strerror(errno));
+
+            Failures += 1;
+            goto RunFileDirectIoTestEnd;
+        }
+    }
+
+    //
+    // Unaligned direct I/O is not allowed.
+    //
+
+    BytesComplete = pread(DirectFile, Buffer, PageSize, 1);
+    if ((BytesComplete >= 0) || (errno != EINVAL)) {
+        PRINT_ERROR("Unaligned direct read returned %d, errno %d.\n",
+                    (INT)BytesComplete,
+                    errno);
+
+        Failures += 1;
+    }
+
+    for (Iteration = 0; Iteration < Iterations; Iteration += 1) {
+        Block = rand() % BlockCount;
+        Offset = (off_t)Block * PageSize;
+        Action = rand() % 4;
+        switch (Action) {
+
+        //
+        // Write a new value through either handle.
+        //
+
+        case 0:
+        case 1:
+            Value = (UCHAR)rand();
+            memset(Buffer, Value, PageSize);
+            if (Action == 0) {
+                DEBUG_PRINT("Cached write block %d: %x\n", Block, Value);
+                BytesComplete = pwrite(CachedFile, Buffer, PageSize, Offset);
+
+            } else {
+                DEBUG_PRINT("Direct write block %d: %x\n", Block, Value);
+                BytesComplete = pwrite(DirectFile, Buffer, PageSize, Offset);
+            }
+
+            if (BytesComplete != PageSize) {
+                PRINT_ERROR("Write of block %d failed: %s.\n",
+                            Block,
+                            strerror(errno));
+
+                Failures += 1;
+                break;
+            }
+
+            BlockState[Block] = Value;
+            break;
+
+        //
+        // Read the block back through either handle and make sure it has the
+        // most recently written value.
+        //
+
+        case 2:
+        case 3:
+            memset(Buffer, ~BlockState[Block], PageSize);
+            if (Action == 2) {
+                BytesComplete = pread(CachedFile, Buffer, PageSize, Offset);
+
+            } else {
+                BytesComplete = pread(DirectFile, Buffer, PageSize, Offset);
+            }
+
+            if (BytesComplete != PageSize) {
+                PRINT_ERROR("Read of block %d failed: %s.\n",
+                            Block,
+                            strerror(errno));
+
+                Failures += 1;
+                break;
+            }
+
+            for (Index = 0; Index < PageSize; Index += 1) {
+                if (Buffer[Index] != BlockState[Block]) {
+                    PRINT_ERROR("%s read of block %d offset %d got %x, "
+                                "expected %x.\n",
+                                (Action == 2) ? "Cached" : "Direct",
+                                Block,
+                                Index,
+                                Buffer[Index],
+                                BlockState[Block]);
+
+                    Failures += 1;
+                    break;
+                }
+            }
+
+            break;
+
+        default:
+
+            assert(FALSE);
+
+            break;
+        }
+
+        if ((Iteration % Percent) == 0) {
+            PRINT("o");
+        }
+    }
+
+    PRINT("\n");
+    Failures += PrintTestTime(&StartTime);
+
+RunFileDirectIoTestEnd:
+    if (DirectFile >= 0) {
+        close(DirectFile);
+    }
+
+    if (CachedFile >= 0) {
+        close(CachedFile);
+        if (FileTestNoCleanup == FALSE) {
+            unlink(FileName);
+        }
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    if (BlockState != NULL) {
+        free(BlockState);
+    }
+
+    return Failures;
+}
+
 ULONG
 PrintTestTime (
     struct timeval *StartTime
@@ -78,7 +78,7 @@ Module Name:
     "  -i, --iterations <count> -- Set the number of operations to perform.\n" \
     "  -p, --threads <count> -- Set the number of threads to spin up.\n"       \
     "  -t, --test -- Set the test to perform. Valid values are all, \n"        \
-    "      basic, private, shared, shmprivate, and shmshared.\n"               \
+    "      basic, private, shared, shmprivate, shmshared, and tlb.\n"          \
     "  --debug -- Print lots of information about what's happening.\n"         \
     "  --quiet -- Print only errors.\n"                                        \
     "  --no-cleanup -- Leave test files around for debugging.\n"               \
@@ -94,6 +94,15 @@ Module Name:
 #define DEFAULT_OPERATION_COUNT (DEFAULT_FILE_COUNT * 50)
 #define DEFAULT_THREAD_COUNT 1
 
+//
+// Define the size of the anonymous region used by the TLB test. It is big
+// enough to contain several fully aligned 4MB regions wherever it lands.
+//
+
+#define TLB_TEST_REGION_SIZE (16 * 1024 * 1024)
+#define TLB_TEST_PAGE_SIZE 4096
+#define TLB_TEST_PASSES 8
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -121,7 +130,8 @@ typedef enum _MEMORY_MAP_TEST_TYPE {
     MemoryMapTestPrivate,
     MemoryMapTestShared,
     MemoryMapTestShmPrivate,
-    MemoryMapTestShmShared
+    MemoryMapTestShmShared,
+    MemoryMapTestTlb
 } MEMORY_MAP_TEST_TYPE, *PMEMORY_MAP_TEST_TYPE;
 
 typedef
@@ -198,6 +208,26 @@ RunMemoryMapShmSharedTest (
     INT Iterations
     );
 
+ULONG
+RunMemoryMapTlbTest (
+    INT Iterations
+    );
+
+ULONG
+MemoryMapTlbTestVerify (
+    PULONG Region,
+    UINTN PageCount,
+    UINTN SkipPage
+    );
+
+ULONG
+MemoryMapTlbTestStride (
+    PULONG Region,
+    UINTN PageCount,
+    INT Passes,
+    PCSTR Description
+    );
+
 static
 VOID
 MemoryMapTestExpectedSignalHandler (
@@ -437,6 +467,9 @@ Return Value:
             } else if (strcasecmp(optarg, "shmshared") == 0) {
                 Test = MemoryMapTestShmShared;
 
+            } else if (strcasecmp(optarg, "tlb") == 0) {
+                Test = MemoryMapTestTlb;
+
             } else {
                 PRINT_ERROR("Invalid test: %s.\n", optarg);
                 Status = 1;
@@ -533,6 +566,10 @@ Return Value:
         Failures += RunMemoryMapShmSharedTest(FileCount, FileSize, Iterations);
     }
 
+    if ((Test == MemoryMapTestAll) || (Test == MemoryMapTestTlb)) {
+        Failures += RunMemoryMapTlbTest(Iterations);
+    }
+
     //
     // Wait for any children.
     //
@@ -3018,6 +3055,287 @@ Return Value:
     return Failures;
 }
 
+ULONG
+RunMemoryMapTlbTest (
+    INT Iterations
+    )
+
+/*++
+
+Routine Description:
+
+    This routine measures TLB-sensitive access throughput over a large
+    anonymous mapping, which the kernel may back with large pages. It touches
+    one word per page in a strided pattern, then splits the mapping by
+    changing the protection of and unmapping single pages in the middle,
+    validating the contents and measuring throughput again after each step.
+
+Arguments:
+
+    Iterations - Supplies the number of operations to perform. This is scaled
+        down to a number of strided passes over the region.
+
+Return Value:
+
+    Returns the number of failures in the test.
+
+--*/
+
+{
+
+    ULONG Failures;
+    UINTN PageCount;
+    UINTN PageIndex;
+    INT Passes;
+    pid_t Process;
+    PULONG Region;
+    INT Result;
+    UINTN SplitPage;
+    struct timeval StartTime;
+
+    Failures = 0;
+    PageCount = TLB_TEST_REGION_SIZE / TLB_TEST_PAGE_SIZE;
+    Passes = Iterations / 100;
+    if (Passes < TLB_TEST_PASSES) {
+        Passes = TLB_TEST_PASSES;
+    }
+
+    Process = getpid();
+    PRINT("Process %d Running memory map TLB test with %d passes over "
+          "%d MB.\n",
+          Process,
+          Passes,
+          TLB_TEST_REGION_SIZE / (1024 * 1024));
+
+    Result = gettimeofday(&StartTime, NULL);
+    if (Result != 0) {
+        PRINT_ERROR("Failed to get time of day: %s.\n", strerror(errno));
+        Failures += 1;
+        return Failures;
+    }
+
+    Region = mmap(0,
+                  TLB_TEST_REGION_SIZE,
+                  PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE,
+                  -1,
+                  0);
+
+    if (Region == MAP_FAILED) {
+        PRINT_ERROR("Failed to create anonymous mapping of size 0x%x: %s.\n",
+                    TLB_TEST_REGION_SIZE,
+                    strerror(errno));
+
+        Failures += 1;
+        return Failures;
+    }
+
+    //
+    // Touch every page, tagging each with its index. The first touch of an
+    // eligible aligned region may fault in the whole region at once.
+    //
+
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        Region[PageIndex * (TLB_TEST_PAGE_SIZE / sizeof(ULONG))] = PageIndex;
+    }
+
+    Failures += MemoryMapTlbTestVerify(Region, PageCount, PageCount);
+    Failures += MemoryMapTlbTestStride(Region, PageCount, Passes, "initial");
+
+    //
+    // Change the protection on a single page in the middle of the region.
+    // This forces any large page under it to be split, and the rest of the
+    // region must be unaffected.
+    //
+
+    SplitPage = PageCount / 2;
+    Result = mprotect(
+                    &(Region[SplitPage * (TLB_TEST_PAGE_SIZE / sizeof(ULONG))]),
+                    TLB_TEST_PAGE_SIZE,
+                    PROT_READ);
+
+    if (Result != 0) {
+        PRINT_ERROR("Failed to protect page %d: %s.\n",
+                    SplitPage,
+                    strerror(errno));
+
+        Failures += 1;
+    }
+
+    Failures += MemoryMapTlbTestVerify(Region, PageCount, PageCount);
+    Failures += MemoryMapTlbTestStride(Region, PageCount, Passes, "protected");
+
+    //
+    // Unmap a single page in another part of the region and make sure the
+    // neighbors survive.
+    //
+
+    SplitPage = PageCount / 4 + 1;
+    Result = munmap(&(Region[SplitPage * (TLB_TEST_PAGE_SIZE / sizeof(ULONG))]),
+                    TLB_TEST_PAGE_SIZE);
+
+    if (Result != 0) {
+        PRINT_ERROR("Failed to unmap page %d: %s.\n",
+                    SplitPage,
+                    strerror(errno));
+
+        Failures += 1;
+    }
+
+    Failures += MemoryMapTlbTestVerify(Region, PageCount, SplitPage);
+    Result = munmap(Region, TLB_TEST_REGION_SIZE);
+    if (Result != 0) {
+        PRINT_ERROR("Failed to unmap TLB test region %p: %s.\n",
+                    Region,
+                    strerror(errno));
+
+        Failures += 1;
+    }
+
+    Failures += PrintTestTime(&StartTime);
+    return Failures;
+}
+
+ULONG
+MemoryMapTlbTestVerify (
+    PULONG Region,
+    UINTN PageCount,
+    UINTN SkipPage
+    )
+
+/*++
+
+Routine Description:
+
+    This routine validates that every page in the TLB test region still holds
+    its index.
+
+Arguments:
+
+    Region - Supplies a pointer to the test region.
+
+    PageCount - Supplies the number of pages in the region.
+
+    SkipPage - Supplies the index of a page that has been unmapped and should
+        not be touched. Supply the page count to check every page.
+
+Return Value:
+
+    Returns the number of failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+    UINTN PageIndex;
+    ULONG Value;
+
+    Failures = 0;
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        if (PageIndex == SkipPage) {
+            continue;
+        }
+
+        Value = Region[PageIndex * (TLB_TEST_PAGE_SIZE / sizeof(ULONG))];
+        if (Value != PageIndex) {
+            PRINT_ERROR("TLB test page %d read %x, expected %x.\n",
+                        PageIndex,
+                        Value,
+                        PageIndex);
+
+            Failures += 1;
+        }
+    }
+
+    return Failures;
+}
+
+ULONG
+MemoryMapTlbTestStride (
+    PULONG Region,
+    UINTN PageCount,
+    INT Passes,
+    PCSTR Description
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads one word from every page of the region for the given
+    number of passes and prints the access throughput. Touching a new page on
+    every access makes the run time dominated by TLB misses.
+
+Arguments:
+
+    Region - Supplies a pointer to the test region.
+
+    PageCount - Supplies the number of pages in the region.
+
+    Passes - Supplies the number of passes to make over the region.
+
+    Description - Supplies a short description of the region's state to
+        print with the results.
+
+Return Value:
+
+    Returns the number of failures.
+
+--*/
+
+{
+
+    ULONGLONG Accesses;
+    struct timeval EndTime;
+    ULONG Failures;
+    UINTN PageIndex;
+    INT Pass;
+    INT Result;
+    struct timeval StartTime;
+    volatile ULONG Sum;
+    ULONGLONG TotalMicroseconds;
+
+    Failures = 0;
+    Result = gettimeofday(&StartTime, NULL);
+    if (Result != 0) {
+        PRINT_ERROR("Failed to get time of day: %s.\n", strerror(errno));
+        Failures += 1;
+        return Failures;
+    }
+
+    Sum = 0;
+    for (Pass = 0; Pass < Passes; Pass += 1) {
+        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+            Sum += Region[PageIndex * (TLB_TEST_PAGE_SIZE / sizeof(ULONG))];
+        }
+    }
+
+    Result = gettimeofday(&EndTime, NULL);
+    if (Result != 0) {
+        PRINT_ERROR("Failed to get time of day: %s.\n", strerror(errno));
+        Failures += 1;
+        return Failures;
+    }
+
+    TotalMicroseconds = ((ULONGLONG)(EndTime.tv_sec - StartTime.tv_sec) *
+                         1000000ULL) +
+                        EndTime.tv_usec - StartTime.tv_usec;
+
+    if (TotalMicroseconds == 0) {
+        TotalMicroseconds = 1;
+    }
+
+    Accesses = (ULONGLONG)PageCount * Passes;
+    PRINT("TLB %s: %llu page-strided reads in %llu us, %llu reads/ms.\n",
+          Description,
+          Accesses,
+          TotalMicroseconds,
+          (Accesses * 1000ULL) / TotalMicroseconds);
+
+    return Failures;
+}
+
 static
 VOID
 MemoryMapTestExpectedSignalHandler (
@@ -27,6 +27,7 @@ Module Name:
 
 function build() {
     sources = [
+        "clock.c",
         "copy.c",
         "create.c",
         "dlopen.c",
@@ -32,7 +32,9 @@ Module Name:
 
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 
 #include "perftest.h"
@@ -41,6 +43,9 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+#define PT_FORK_16M_RESIDENT_SIZE (16 * 1024 * 1024)
+#define PT_FORK_64M_RESIDENT_SIZE (64 * 1024 * 1024)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -67,7 +72,7 @@ ForkMain (
 
 Routine Description:
 
-    This routine performs the fork performance benchmark test.
+    This routine performs the fork performance benchmark tests.
 
 Arguments:
 
@@ -86,11 +91,50 @@ Return Value:
 
     pid_t Child;
     unsigned long long Iterations;
+    void *Resident;
+    size_t ResidentSize;
     int Status;
 
     Iterations = 0;
+    Resident = MAP_FAILED;
     Result->Type = PtResultIterations;
     Result->Status = 0;
+    switch (Test->TestType) {
+    case PtTestFork16M:
+        ResidentSize = PT_FORK_16M_RESIDENT_SIZE;
+        break;
+
+    case PtTestFork64M:
+        ResidentSize = PT_FORK_64M_RESIDENT_SIZE;
+        break;
+
+    case PtTestFork:
+    default:
+        ResidentSize = 0;
+        break;
+    }
+
+    //
+    // Grow the resident set by dirtying a private anonymous region, so that
+    // the cost of fork() can be measured as a function of how much memory
+    // the parent has mapped.
+    //
+
+    if (ResidentSize != 0) {
+        Resident = mmap(NULL,
+                        ResidentSize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_ANON | MAP_PRIVATE,
+                        -1,
+                        0);
+
+        if (Resident == MAP_FAILED) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        memset(Resident, 1, ResidentSize);
+    }
 
     //
     // Start the test. This snaps resource usage and starts the clock ticking.
@@ -143,6 +187,10 @@ Return Value:
     }
 
 MainEnd:
+    if (Resident != MAP_FAILED) {
+        munmap(Resident, ResidentSize);
+    }
+
     Result->Data.Iterations = Iterations;
     return;
 }
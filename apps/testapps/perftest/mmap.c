@@ -47,6 +47,7 @@ Module Name:
 
 #define PT_MMAP_TEST_FILE_NAME_LENGTH 48
 #define PT_MMAP_TEST_REGION_SIZE (2 * 1024 * 1024)
+#define PT_MMAP_SHM_BIG_TEST_REGION_SIZE (64 * 1024 * 1024)
 #define PT_MMAP_TEST_BLOCK_SIZE 4096
 
 //
@@ -107,6 +108,8 @@ Return Value:
     int PerformIo;
     pid_t ProcessId;
     int ProtectionFlags;
+    size_t RegionSize;
+    int SharedMemory;
     int Status;
     int Write;
 
@@ -115,6 +118,8 @@ Return Value:
     FileCreated = 0;
     Iterations = 0;
     PerformIo = 0;
+    RegionSize = PT_MMAP_TEST_REGION_SIZE;
+    SharedMemory = 0;
     Result->Type = PtResultIterations;
     Result->Status = 0;
     Write = 0;
@@ -150,6 +155,14 @@ Return Value:
         MmapFlags = MAP_ANON | MAP_PRIVATE;
         break;
 
+    case PtTestMmapShmBig:
+        MmapFlags = MAP_SHARED;
+        CreateFile = 1;
+        PerformIo = 1;
+        RegionSize = PT_MMAP_SHM_BIG_TEST_REGION_SIZE;
+        SharedMemory = 1;
+        break;
+
     default:
 
         assert(0);
@@ -162,7 +175,8 @@ Return Value:
         ProcessId = getpid();
         Status = snprintf(FileName,
                           PT_MMAP_TEST_FILE_NAME_LENGTH,
-                          "mmap_%d.txt",
+                          "%smmap_%d.txt",
+                          (SharedMemory != 0) ? "/" : "",
                           ProcessId);
 
         if (Status < 0) {
@@ -175,9 +189,16 @@ Return Value:
         // be extended.
         //
 
-        FileDescriptor = open(FileName,
-                              O_RDWR | O_CREAT | O_TRUNC,
-                              S_IRUSR | S_IWUSR);
+        if (SharedMemory != 0) {
+            FileDescriptor = shm_open(FileName,
+                                      O_RDWR | O_CREAT | O_TRUNC,
+                                      S_IRUSR | S_IWUSR);
+
+        } else {
+            FileDescriptor = open(FileName,
+                                  O_RDWR | O_CREAT | O_TRUNC,
+                                  S_IRUSR | S_IWUSR);
+        }
 
         if (FileDescriptor < 0) {
             Result->Status = errno;
@@ -186,11 +207,24 @@ Return Value:
 
         FileCreated = 1;
 
+        //
+        // A shared memory object reads back as zeros once it is sized, so it
+        // does not need priming.
+        //
+
+        if (SharedMemory != 0) {
+            Status = ftruncate(FileDescriptor, RegionSize);
+            if (Status != 0) {
+                Result->Status = errno;
+                goto MainEnd;
+            }
+        }
+
         //
         // If a file is going to be used for I/O, then prime the page cache.
         //
 
-        if (PerformIo != 0) {
+        if ((PerformIo != 0) && (SharedMemory == 0)) {
             Buffer = malloc(PT_MMAP_TEST_BLOCK_SIZE);
             if (Buffer == NULL) {
                 Result->Status = ENOMEM;
@@ -252,7 +286,7 @@ Return Value:
 
     while (PtIsTimedTestRunning() != 0) {
         Address = mmap(NULL,
-                       PT_MMAP_TEST_REGION_SIZE,
+                       RegionSize,
                        ProtectionFlags,
                        MmapFlags,
                        FileDescriptor,
@@ -270,7 +304,7 @@ Return Value:
 
         if (PerformIo != 0) {
             CurrentAddress = (char *)Address;
-            EndAddress = CurrentAddress + PT_MMAP_TEST_REGION_SIZE;
+            EndAddress = CurrentAddress + RegionSize;
             while (CurrentAddress < EndAddress) {
                 if (Write == 0) {
                     if (*CurrentAddress != 0) {
@@ -288,7 +322,7 @@ Return Value:
             }
         }
 
-        Status = munmap(Address, PT_MMAP_TEST_REGION_SIZE);
+        Status = munmap(Address, RegionSize);
         if (Status != 0) {
             Result->Status = errno;
             break;
@@ -309,7 +343,12 @@ Return Value:
 
     if (FileCreated != 0) {
         close(FileDescriptor);
-        remove(FileName);
+        if (SharedMemory != 0) {
+            shm_unlink(FileName);
+
+        } else {
+            remove(FileName);
+        }
     }
 
     Result->Data.Iterations = Iterations;
@@ -43,24 +43,78 @@ Module Name:
 
 #define PT_MUTEXT_TEST_THREAD_COUNT 8
 
+//
+// Define the number of unrelated mutexes the sharded test spreads its threads
+// across.
+//
+
+#define PT_MUTEX_TEST_SHARD_COUNT 4
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure stores the state shared between the threads of the
+    condition variable broadcast test.
+
+Members:
+
+    Mutex - Stores the mutex protecting the rest of the structure.
+
+    WorkCondition - Stores the condition variable the worker threads wait on
+        for a new generation.
+
+    DoneCondition - Stores the condition variable the main thread waits on
+        for all workers to acknowledge a generation.
+
+    Generation - Stores the current generation number.
+
+    Acknowledged - Stores the number of workers that have seen the current
+        generation.
+
+    Stop - Stores a boolean indicating whether the workers should exit.
+
+--*/
+
+typedef struct _PT_CONDITION_TEST {
+    pthread_mutex_t Mutex;
+    pthread_cond_t WorkCondition;
+    pthread_cond_t DoneCondition;
+    unsigned long Generation;
+    int Acknowledged;
+    int Stop;
+} PT_CONDITION_TEST, *PPT_CONDITION_TEST;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+void
+MutexConditionBroadcastTest (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
 void *
 MutexStartRoutine (
     void *Parameter
     );
 
+void *
+MutexConditionStartRoutine (
+    void *Parameter
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 volatile int MutexReadyThreadCount;
+pthread_mutex_t MutexReadyLock = PTHREAD_MUTEX_INITIALIZER;
 
 //
 // ------------------------------------------------------------------ Functions
@@ -94,31 +148,47 @@ Return Value:
 {
 
     unsigned long long Iterations;
-    pthread_mutex_t Mutex;
-    int MutexInitialized;
+    int MutexCount;
+    int MutexIndex;
+    pthread_mutex_t Mutexes[PT_MUTEX_TEST_SHARD_COUNT];
+    int ShardCount;
     int Status;
     int ThreadCount;
     int ThreadIndex;
     pthread_t *Threads;
 
+    if (Test->TestType == PtTestCondBroadcast) {
+        MutexConditionBroadcastTest(Test, Result);
+        return;
+    }
+
     Iterations = 0;
-    MutexInitialized = 0;
+    MutexCount = 0;
+    MutexReadyThreadCount = 0;
     Threads = NULL;
     Result->Type = PtResultIterations;
     Result->Status = 0;
     ThreadIndex = 0;
 
     //
-    // Initialize a mutex for use by the main thread and any additional threads.
+    // Initialize the mutexes for use by the main thread and any additional
+    // threads. The main thread always uses the first one.
     //
 
-    Status = pthread_mutex_init(&Mutex, NULL);
-    if (Status != 0) {
-        Result->Status = Status;
-        goto MainEnd;
+    ShardCount = 1;
+    if (Test->TestType == PtTestMutexSharded) {
+        ShardCount = PT_MUTEX_TEST_SHARD_COUNT;
     }
 
-    MutexInitialized = 1;
+    for (MutexIndex = 0; MutexIndex < ShardCount; MutexIndex += 1) {
+        Status = pthread_mutex_init(&(Mutexes[MutexIndex]), NULL);
+        if (Status != 0) {
+            Result->Status = Status;
+            goto MainEnd;
+        }
+
+        MutexCount += 1;
+    }
 
     //
     // Initialize the given test state.
@@ -129,20 +199,27 @@ Return Value:
         break;
 
     case PtTestMutexContended:
+    case PtTestMutexSharded:
         Threads = malloc(sizeof(pthread_t) * PT_MUTEXT_TEST_THREAD_COUNT);
         if (Threads == NULL) {
             Result->Status = ENOMEM;
             goto MainEnd;
         }
 
+        //
+        // For the sharded test, the threads are spread across unrelated
+        // mutexes, each of which is still contended by a few threads.
+        //
+
         for (ThreadIndex = 0;
              ThreadIndex < PT_MUTEXT_TEST_THREAD_COUNT;
              ThreadIndex += 1) {
 
+            MutexIndex = ThreadIndex % ShardCount;
             Status = pthread_create(&(Threads[ThreadIndex]),
                                     NULL,
                                     MutexStartRoutine,
-                                    &Mutex);
+                                    &(Mutexes[MutexIndex]));
 
             if (Status != 0) {
                 Result->Status = Status;
@@ -184,8 +261,8 @@ Return Value:
     //
 
     while (PtIsTimedTestRunning() != 0) {
-        pthread_mutex_lock(&Mutex);
-        pthread_mutex_unlock(&Mutex);
+        pthread_mutex_lock(&(Mutexes[0]));
+        pthread_mutex_unlock(&(Mutexes[0]));
         Iterations += 1;
     }
 
@@ -202,6 +279,7 @@ Return Value:
 
     switch (Test->TestType) {
     case PtTestMutexContended:
+    case PtTestMutexSharded:
         if (Threads != NULL) {
             ThreadCount = ThreadIndex;
             for (ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex += 1) {
@@ -219,8 +297,8 @@ Return Value:
         break;
     }
 
-    if (MutexInitialized != 0) {
-        pthread_mutex_destroy(&Mutex);
+    for (MutexIndex = 0; MutexIndex < MutexCount; MutexIndex += 1) {
+        pthread_mutex_destroy(&(Mutexes[MutexIndex]));
     }
 
     Result->Data.Iterations = Iterations;
@@ -231,6 +309,130 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+void
+MutexConditionBroadcastTest (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the condition variable broadcast benchmark. The main
+    thread repeatedly broadcasts a new generation to a set of waiting threads
+    and waits for all of them to acknowledge it. Every woken thread must
+    reacquire the same mutex, so this measures how well broadcasts avoid the
+    thundering herd.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PT_CONDITION_TEST Condition;
+    unsigned long long Iterations;
+    int Status;
+    int ThreadCount;
+    int ThreadIndex;
+    pthread_t *Threads;
+
+    Iterations = 0;
+    Result->Type = PtResultIterations;
+    Result->Status = 0;
+    ThreadIndex = 0;
+    MutexReadyThreadCount = 0;
+    pthread_mutex_init(&(Condition.Mutex), NULL);
+    pthread_cond_init(&(Condition.WorkCondition), NULL);
+    pthread_cond_init(&(Condition.DoneCondition), NULL);
+    Condition.Generation = 0;
+    Condition.Acknowledged = 0;
+    Condition.Stop = 0;
+    Threads = malloc(sizeof(pthread_t) * PT_MUTEXT_TEST_THREAD_COUNT);
+    if (Threads == NULL) {
+        Result->Status = ENOMEM;
+        goto ConditionBroadcastTestEnd;
+    }
+
+    for (ThreadIndex = 0;
+         ThreadIndex < PT_MUTEXT_TEST_THREAD_COUNT;
+         ThreadIndex += 1) {
+
+        Status = pthread_create(&(Threads[ThreadIndex]),
+                                NULL,
+                                MutexConditionStartRoutine,
+                                &Condition);
+
+        if (Status != 0) {
+            Result->Status = Status;
+            goto ConditionBroadcastTestEnd;
+        }
+    }
+
+    //
+    // Wait until all threads are spun up and have snapped the initial
+    // generation.
+    //
+
+    while (MutexReadyThreadCount != PT_MUTEXT_TEST_THREAD_COUNT) {
+        sleep(1);
+    }
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto ConditionBroadcastTestEnd;
+    }
+
+    while (PtIsTimedTestRunning() != 0) {
+        pthread_mutex_lock(&(Condition.Mutex));
+        Condition.Generation += 1;
+        Condition.Acknowledged = 0;
+        pthread_cond_broadcast(&(Condition.WorkCondition));
+        while (Condition.Acknowledged != PT_MUTEXT_TEST_THREAD_COUNT) {
+            pthread_cond_wait(&(Condition.DoneCondition), &(Condition.Mutex));
+        }
+
+        pthread_mutex_unlock(&(Condition.Mutex));
+        Iterations += 1;
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+ConditionBroadcastTestEnd:
+    if (Threads != NULL) {
+        pthread_mutex_lock(&(Condition.Mutex));
+        Condition.Stop = 1;
+        pthread_cond_broadcast(&(Condition.WorkCondition));
+        pthread_mutex_unlock(&(Condition.Mutex));
+        ThreadCount = ThreadIndex;
+        for (ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex += 1) {
+            pthread_join(Threads[ThreadIndex], NULL);
+        }
+
+        free(Threads);
+    }
+
+    pthread_cond_destroy(&(Condition.DoneCondition));
+    pthread_cond_destroy(&(Condition.WorkCondition));
+    pthread_mutex_destroy(&(Condition.Mutex));
+    Result->Data.Iterations = Iterations;
+    return;
+}
+
 void *
 MutexStartRoutine (
     void *Parameter
@@ -264,9 +466,9 @@ Return Value:
     // Announce that the thread is ready.
     //
 
-    pthread_mutex_lock(Mutex);
+    pthread_mutex_lock(&MutexReadyLock);
     MutexReadyThreadCount += 1;
-    pthread_mutex_unlock(Mutex);
+    pthread_mutex_unlock(&MutexReadyLock);
 
     //
     // Busy spin waiting for the test to start.
@@ -288,3 +490,53 @@ Return Value:
     return NULL;
 }
 
+void *
+MutexConditionStartRoutine (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the start routine for a condition variable
+    broadcast test thread. It waits for each new generation and acknowledges
+    it until told to stop.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the shared condition test state.
+
+Return Value:
+
+    Returns the NULL pointer.
+
+--*/
+
+{
+
+    PPT_CONDITION_TEST Condition;
+    unsigned long Generation;
+
+    Condition = (PPT_CONDITION_TEST)Parameter;
+    pthread_mutex_lock(&(Condition->Mutex));
+    Generation = Condition->Generation;
+    MutexReadyThreadCount += 1;
+    while (Condition->Stop == 0) {
+        while ((Condition->Generation == Generation) &&
+               (Condition->Stop == 0)) {
+
+            pthread_cond_wait(&(Condition->WorkCondition),
+                              &(Condition->Mutex));
+        }
+
+        Generation = Condition->Generation;
+        Condition->Acknowledged += 1;
+        if (Condition->Acknowledged == PT_MUTEXT_TEST_THREAD_COUNT) {
+            pthread_cond_signal(&(Condition->DoneCondition));
+        }
+    }
+
+    pthread_mutex_unlock(&(Condition->Mutex));
+    return NULL;
+}
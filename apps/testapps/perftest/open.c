@@ -30,10 +30,14 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -49,14 +53,48 @@ Module Name:
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines the context for a contended open test thread.
+
+Members:
+
+    Thread - Stores the thread identifier.
+
+    Path - Stores a pointer to the path to open.
+
+    Iterations - Stores the number of open and close pairs the thread
+        completed.
+
+    Status - Stores the first error the thread encountered, if any.
+
+--*/
+
+typedef struct _PT_OPEN_THREAD {
+    pthread_t Thread;
+    const char *Path;
+    unsigned long long Iterations;
+    int Status;
+} PT_OPEN_THREAD, *PPT_OPEN_THREAD;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+void *
+OpenStartRoutine (
+    void *Parameter
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
+volatile long OpenReadyThreadCount;
+pthread_mutex_t OpenReadyMutex = PTHREAD_MUTEX_INITIALIZER;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -71,7 +109,7 @@ OpenMain (
 
 Routine Description:
 
-    This routine performs the open performance benchmark test.
+    This routine performs the open performance benchmark tests.
 
 Arguments:
 
@@ -92,13 +130,20 @@ Return Value:
     int FileDescriptor;
     char FileName[PT_OPEN_TEST_FILE_NAME_LENGTH];
     unsigned long long Iterations;
+    char *Path;
     pid_t ProcessId;
     int Status;
+    long ThreadCount;
+    long ThreadIndex;
+    PPT_OPEN_THREAD Threads;
 
     FileCreated = 0;
     Iterations = 0;
+    Path = FileName;
     Result->Type = PtResultIterations;
     Result->Status = 0;
+    ThreadIndex = 0;
+    Threads = NULL;
 
     //
     // Get the process ID and create a process safe file to open and close.
@@ -124,6 +169,78 @@ Return Value:
     close(FileDescriptor);
     FileCreated = 1;
 
+    //
+    // Initialize the given test state.
+    //
+
+    switch (Test->TestType) {
+    case PtTestOpen:
+        break;
+
+    //
+    // The contended test has several threads all opening the file by its
+    // absolute path, so that every thread walks the same directory prefix.
+    //
+
+    case PtTestOpenContended:
+        Path = malloc(PATH_MAX);
+        if (Path == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        if (getcwd(Path, PATH_MAX) == NULL) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        if (strlen(Path) + strlen(FileName) + 2 > PATH_MAX) {
+            Result->Status = ENAMETOOLONG;
+            goto MainEnd;
+        }
+
+        strcat(Path, "/");
+        strcat(Path, FileName);
+        Threads = calloc(Test->ThreadCount, sizeof(PT_OPEN_THREAD));
+        if (Threads == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        for (ThreadIndex = 0;
+             ThreadIndex < Test->ThreadCount;
+             ThreadIndex += 1) {
+
+            Threads[ThreadIndex].Path = Path;
+            Status = pthread_create(&(Threads[ThreadIndex].Thread),
+                                    NULL,
+                                    OpenStartRoutine,
+                                    &(Threads[ThreadIndex]));
+
+            if (Status != 0) {
+                Result->Status = Status;
+                goto MainEnd;
+            }
+        }
+
+        //
+        // Wait until all threads are spun up.
+        //
+
+        while (OpenReadyThreadCount != Test->ThreadCount) {
+            sleep(1);
+        }
+
+        break;
+
+    default:
+
+        assert(0);
+
+        Result->Status = EINVAL;
+        goto MainEnd;
+    }
+
     //
     // Start the test. This snaps resource usage and starts the clock ticking.
     //
@@ -140,7 +257,7 @@ Return Value:
     //
 
     while (PtIsTimedTestRunning() != 0) {
-        FileDescriptor = open(FileName, O_RDWR);
+        FileDescriptor = open(Path, O_RDWR);
         if (FileDescriptor < 0) {
             Result->Status = errno;
             break;
@@ -161,6 +278,30 @@ Return Value:
     }
 
 MainEnd:
+
+    //
+    // Tear down the test state, adding in the work the other threads did.
+    //
+
+    if (Threads != NULL) {
+        ThreadCount = ThreadIndex;
+        for (ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex += 1) {
+            pthread_cancel(Threads[ThreadIndex].Thread);
+            pthread_join(Threads[ThreadIndex].Thread, NULL);
+            Iterations += Threads[ThreadIndex].Iterations;
+            if ((Threads[ThreadIndex].Status != 0) && (Result->Status == 0)) {
+                Result->Status = Threads[ThreadIndex].Status;
+            }
+        }
+
+        free(Threads);
+    }
+
+    OpenReadyThreadCount = 0;
+    if ((Path != NULL) && (Path != FileName)) {
+        free(Path);
+    }
+
     if (FileCreated != 0) {
         remove(FileName);
     }
@@ -173,3 +314,66 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+void *
+OpenStartRoutine (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the start routine for a contended open test
+    thread. It waits for the test to start and then loops opening and closing
+    the shared test file.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread's context.
+
+Return Value:
+
+    Returns the NULL pointer.
+
+--*/
+
+{
+
+    int FileDescriptor;
+    PPT_OPEN_THREAD Thread;
+
+    Thread = (PPT_OPEN_THREAD)Parameter;
+
+    //
+    // Announce that the thread is ready.
+    //
+
+    pthread_mutex_lock(&OpenReadyMutex);
+    OpenReadyThreadCount += 1;
+    pthread_mutex_unlock(&OpenReadyMutex);
+
+    //
+    // Busy spin waiting for the test to start.
+    //
+
+    while (PtIsTimedTestRunning() == 0) {
+        pthread_testcancel();
+    }
+
+    while (PtIsTimedTestRunning() != 0) {
+        FileDescriptor = open(Thread->Path, O_RDWR);
+        if (FileDescriptor < 0) {
+            Thread->Status = errno;
+            break;
+        }
+
+        if (close(FileDescriptor) != 0) {
+            Thread->Status = errno;
+            break;
+        }
+
+        Thread->Iterations += 1;
+    }
+
+    return NULL;
+}
@@ -312,6 +312,12 @@ Return Value:
              &(ChildrenUsage.ru_stime),
              &(PtStartResourceUsage.SystemTime));
 
+    PtStartResourceUsage.MinorFaults = SelfUsage.ru_minflt +
+                                       ChildrenUsage.ru_minflt;
+
+    PtStartResourceUsage.MajorFaults = SelfUsage.ru_majflt +
+                                       ChildrenUsage.ru_majflt;
+
     PtResourceUsageBusy = 1;
     return 0;
 }
@@ -400,6 +406,14 @@ Return Value:
              &(PtStartResourceUsage.RealTime),
              &(Result->ResourceUsage.RealTime));
 
+    Result->ResourceUsage.MinorFaults = SelfUsage.ru_minflt +
+                                        ChildrenUsage.ru_minflt -
+                                        PtStartResourceUsage.MinorFaults;
+
+    Result->ResourceUsage.MajorFaults = SelfUsage.ru_majflt +
+                                        ChildrenUsage.ru_majflt -
+                                        PtStartResourceUsage.MajorFaults;
+
     Result->ResourceUsageValid = 1;
     return 0;
 }
@@ -204,6 +204,20 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultIterations,
      FORK_TEST_DEFAULT_DURATION},
 
+    {FORK_16M_TEST_NAME,
+     FORK_16M_TEST_DESCRIPTION,
+     ForkMain,
+     PtTestFork16M,
+     PtResultIterations,
+     FORK_16M_TEST_DEFAULT_DURATION},
+
+    {FORK_64M_TEST_NAME,
+     FORK_64M_TEST_DESCRIPTION,
+     ForkMain,
+     PtTestFork64M,
+     PtResultIterations,
+     FORK_64M_TEST_DEFAULT_DURATION},
+
     {EXEC_TEST_NAME,
      EXEC_TEST_DESCRIPTION,
      ExecMain,
@@ -323,6 +337,13 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultIterations,
      MMAP_IO_ANON_TEST_DEFAULT_DURATION},
 
+    {MMAP_SHM_BIG_TEST_NAME,
+     MMAP_SHM_BIG_TEST_DESCRIPTION,
+     MmapMain,
+     PtTestMmapShmBig,
+     PtResultIterations,
+     MMAP_SHM_BIG_TEST_DEFAULT_DURATION},
+
     {MALLOC_SMALL_TEST_NAME,
      MALLOC_SMALL_TEST_DESCRIPTION,
      MallocMain,
@@ -379,6 +400,20 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtResultIterations,
      MUTEX_CONTENDED_TEST_DEFAULT_DURATION},
 
+    {MUTEX_SHARDED_TEST_NAME,
+     MUTEX_SHARDED_TEST_DESCRIPTION,
+     MutexMain,
+     PtTestMutexSharded,
+     PtResultIterations,
+     MUTEX_SHARDED_TEST_DEFAULT_DURATION},
+
+    {COND_BROADCAST_TEST_NAME,
+     COND_BROADCAST_TEST_DESCRIPTION,
+     MutexMain,
+     PtTestCondBroadcast,
+     PtResultIterations,
+     COND_BROADCAST_TEST_DEFAULT_DURATION},
+
     {STAT_TEST_NAME,
      STAT_TEST_DESCRIPTION,
      StatMain,
@@ -392,6 +427,29 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtTestFstat,
      PtResultIterations,
      FSTAT_TEST_DEFAULT_DURATION},
+
+    {OPEN_CONTENDED_TEST_NAME,
+     OPEN_CONTENDED_TEST_DESCRIPTION,
+     OpenMain,
+     PtTestOpenContended,
+     PtResultIterations,
+     OPEN_CONTENDED_TEST_DEFAULT_DURATION,
+     OPEN_CONTENDED_TEST_THREAD_COUNT},
+
+    {STAT_CONTENDED_TEST_NAME,
+     STAT_CONTENDED_TEST_DESCRIPTION,
+     StatMain,
+     PtTestStatContended,
+     PtResultIterations,
+     STAT_CONTENDED_TEST_DEFAULT_DURATION,
+     STAT_CONTENDED_TEST_THREAD_COUNT},
+
+    {CLOCK_GETTIME_TEST_NAME,
+     CLOCK_GETTIME_TEST_DESCRIPTION,
+     ClockGettimeMain,
+     PtTestClockGettime,
+     PtResultIterations,
+     CLOCK_GETTIME_TEST_DEFAULT_DURATION},
 };
 
 //
@@ -1035,6 +1093,12 @@ Return Value:
             timeradd(&(TotalResult.ResourceUsage.SystemTime),
                      &(Process->Result.ResourceUsage.SystemTime),
                      &(TotalResult.ResourceUsage.SystemTime));
+
+            TotalResult.ResourceUsage.MinorFaults +=
+                                   Process->Result.ResourceUsage.MinorFaults;
+
+            TotalResult.ResourceUsage.MajorFaults +=
+                                   Process->Result.ResourceUsage.MajorFaults;
         }
 
         assert((TotalResult.ResourceUsage.RealTime.tv_sec >= 0) &&
@@ -1079,6 +1143,24 @@ Return Value:
                         ProcessCount,
                         Average);
 
+        //
+        // Report the page faults taken per iteration, which shows how well
+        // the memory manager avoids taking faults one page at a time.
+        //
+
+        if ((Test->ResultType == PtResultIterations) &&
+            (TotalResult.Data.Iterations != 0)) {
+
+            Average = (double)(TotalResult.ResourceUsage.MinorFaults +
+                               TotalResult.ResourceUsage.MajorFaults);
+
+            Average /= (double)TotalResult.Data.Iterations;
+            PT_PRINT_RESULT("%s (%ldp) Page Faults/Iteration:decimal:%.02f\n",
+                            Test->Name,
+                            ProcessCount,
+                            Average);
+        }
+
         break;
 
     //
@@ -1170,13 +1252,16 @@ Return Value:
         RealTime = &(Result->ResourceUsage.RealTime);
         UserTime = &(Result->ResourceUsage.UserTime);
         SystemTime = &(Result->ResourceUsage.SystemTime);
-        PT_PRINT_RESULT(" - real %lld.%06ld, user %lld.%06ld, sys %lld.%06ld\n",
+        PT_PRINT_RESULT(" - real %lld.%06ld, user %lld.%06ld, sys %lld.%06ld, "
+                        "faults %ld minor %ld major\n",
                         (signed long long)RealTime->tv_sec,
                         RealTime->tv_usec,
                         (signed long long)UserTime->tv_sec,
                         UserTime->tv_usec,
                         (signed long long)SystemTime->tv_sec,
-                        SystemTime->tv_usec);
+                        SystemTime->tv_usec,
+                        Result->ResourceUsage.MinorFaults,
+                        Result->ResourceUsage.MajorFaults);
 
     } else {
         PT_PRINT_RESULT("\n");
@@ -39,6 +39,14 @@ Module Name:
 #define ALL_TEST_DESCRIPTION "Runs all of the performance tests in sequence."
 #define FORK_TEST_NAME "fork"
 #define FORK_TEST_DESCRIPTION "Benchmarks the fork() C library routine."
+#define FORK_16M_TEST_NAME "fork_16m"
+#define FORK_16M_TEST_DESCRIPTION \
+    "Benchmarks fork() from a process with 16MB of resident private memory."
+
+#define FORK_64M_TEST_NAME "fork_64m"
+#define FORK_64M_TEST_DESCRIPTION \
+    "Benchmarks fork() from a process with 64MB of resident private memory."
+
 #define EXEC_TEST_NAME "exec"
 #define EXEC_TEST_DESCRIPTION "Benchmarks the exec() C library routine."
 #define OPEN_TEST_NAME "open"
@@ -93,6 +101,10 @@ Module Name:
 #define MMAP_IO_ANON_TEST_DESCRIPTION \
     "Benchmarks the I/O throughput on anonymous memory mapped regions."
 
+#define MMAP_SHM_BIG_TEST_NAME "mmap_shm_big"
+#define MMAP_SHM_BIG_TEST_DESCRIPTION \
+    "Benchmarks mapping and touching a large shared memory object."
+
 #define MALLOC_SMALL_TEST_NAME "malloc_small"
 #define MALLOC_SMALL_TEST_DESCRIPTION \
     "Benchmarks malloc() and free() using a small allocation size."
@@ -125,6 +137,14 @@ Module Name:
 #define MUTEX_CONTENDED_TEST_DESCRIPTION \
     "Benchmarks pthread mutex lock and unlock routines under contention."
 
+#define MUTEX_SHARDED_TEST_NAME "mutex_sharded"
+#define MUTEX_SHARDED_TEST_DESCRIPTION \
+    "Benchmarks contended pthread mutexes spread across unrelated locks."
+
+#define COND_BROADCAST_TEST_NAME "cond_broadcast"
+#define COND_BROADCAST_TEST_DESCRIPTION \
+    "Benchmarks pthread condition variable broadcast round trips."
+
 #define STAT_TEST_NAME "stat"
 #define STAT_TEST_DESCRIPTION \
     "Benchmarks the stat() C library routine."
@@ -133,11 +153,25 @@ Module Name:
 #define FSTAT_TEST_DESCRIPTION \
     "Benchmarks the fstat() C library routine."
 
+#define OPEN_CONTENDED_TEST_NAME "open_contended"
+#define OPEN_CONTENDED_TEST_DESCRIPTION \
+    "Benchmarks open() and close() on a shared path with multiple threads."
+
+#define STAT_CONTENDED_TEST_NAME "stat_contended"
+#define STAT_CONTENDED_TEST_DESCRIPTION \
+    "Benchmarks stat() on a shared path with multiple threads."
+
+#define CLOCK_GETTIME_TEST_NAME "clock_gettime"
+#define CLOCK_GETTIME_TEST_DESCRIPTION \
+    "Benchmarks the clock_gettime() C library routine."
+
 //
 // Default test durations, in seconds.
 //
 
 #define FORK_TEST_DEFAULT_DURATION 60
+#define FORK_16M_TEST_DEFAULT_DURATION 30
+#define FORK_64M_TEST_DEFAULT_DURATION 30
 #define EXEC_TEST_DEFAULT_DURATION 60
 #define OPEN_TEST_DEFAULT_DURATION 30
 #define CREATE_TEST_DEFAULT_DURATION 30
@@ -155,6 +189,7 @@ Module Name:
 #define MMAP_IO_PRIVATE_TEST_DEFAULT_DURATION 30
 #define MMAP_IO_SHARED_TEST_DEFAULT_DURATION 30
 #define MMAP_IO_ANON_TEST_DEFAULT_DURATION 30
+#define MMAP_SHM_BIG_TEST_DEFAULT_DURATION 30
 #define MALLOC_SMALL_TEST_DEFAULT_DURATION 30
 #define MALLOC_LARGE_TEST_DEFAULT_DURATION 30
 #define MALLOC_RANDOM_TEST_DEFAULT_DURATION 30
@@ -163,8 +198,21 @@ Module Name:
 #define PTHREAD_DETACH_TEST_DEFAULT_DURATION 30
 #define MUTEX_TEST_DEFAULT_DURATION 30
 #define MUTEX_CONTENDED_TEST_DEFAULT_DURATION 30
+#define MUTEX_SHARDED_TEST_DEFAULT_DURATION 30
+#define COND_BROADCAST_TEST_DEFAULT_DURATION 30
 #define STAT_TEST_DEFAULT_DURATION 30
 #define FSTAT_TEST_DEFAULT_DURATION 30
+#define OPEN_CONTENDED_TEST_DEFAULT_DURATION 30
+#define STAT_CONTENDED_TEST_DEFAULT_DURATION 30
+#define CLOCK_GETTIME_TEST_DEFAULT_DURATION 10
+
+//
+// Define the number of threads to spin up for the tests that benchmark
+// contention on a shared path.
+//
+
+#define OPEN_CONTENDED_TEST_THREAD_COUNT 8
+#define STAT_CONTENDED_TEST_THREAD_COUNT 8
 
 //
 // Define the number of variables supplied to an iteration of the execute test
@@ -180,6 +228,8 @@ Module Name:
 typedef enum _PT_TEST_TYPE {
     PtTestAll,
     PtTestFork,
+    PtTestFork16M,
+    PtTestFork64M,
     PtTestExec,
     PtTestOpen,
     PtTestCreate,
@@ -197,6 +247,7 @@ typedef enum _PT_TEST_TYPE {
     PtTestMmapIoPrivate,
     PtTestMmapIoShared,
     PtTestMmapIoAnon,
+    PtTestMmapShmBig,
     PtTestMallocSmall,
     PtTestMallocLarge,
     PtTestMallocRandom,
@@ -205,8 +256,13 @@ typedef enum _PT_TEST_TYPE {
     PtTestPthreadDetach,
     PtTestMutex,
     PtTestMutexContended,
+    PtTestMutexSharded,
+    PtTestCondBroadcast,
     PtTestStat,
     PtTestFstat,
+    PtTestOpenContended,
+    PtTestStatContended,
+    PtTestClockGettime,
     PtTestTypeCount
 } PT_TEST_TYPE, *PPT_TEST_TYPE;
 
@@ -252,12 +308,20 @@ Structure Description:
 
     SystemTime - Stores the system time used by the test.
 
+    MinorFaults - Stores the number of page faults taken by the test that did
+        not require I/O.
+
+    MajorFaults - Stores the number of page faults taken by the test that
+        required I/O.
+
 --*/
 
 typedef struct _PT_TEST_RESOURCE_USAGE {
     struct timeval RealTime;
     struct timeval UserTime;
     struct timeval SystemTime;
+    long MinorFaults;
+    long MajorFaults;
 } PT_TEST_RESOURCE_USAGE, *PPT_TEST_RESOURCE_USAGE;
 
 /*++
@@ -978,3 +1042,28 @@ Return Value:
 
 --*/
 
+void
+ClockGettimeMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the clock_gettime performance benchmark test.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
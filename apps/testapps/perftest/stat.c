@@ -30,7 +30,12 @@ Module Name:
 // ------------------------------------------------------------------- Includes
 //
 
+#include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <stdio.h>
@@ -48,14 +53,47 @@ Module Name:
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines the context for a contended stat test thread.
+
+Members:
+
+    Thread - Stores the thread identifier.
+
+    Path - Stores a pointer to the path to stat.
+
+    Iterations - Stores the number of stat calls the thread completed.
+
+    Status - Stores the first error the thread encountered, if any.
+
+--*/
+
+typedef struct _PT_STAT_THREAD {
+    pthread_t Thread;
+    const char *Path;
+    unsigned long long Iterations;
+    int Status;
+} PT_STAT_THREAD, *PPT_STAT_THREAD;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+void *
+StatStartRoutine (
+    void *Parameter
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
+volatile long StatReadyThreadCount;
+pthread_mutex_t StatReadyMutex = PTHREAD_MUTEX_INITIALIZER;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -70,7 +108,7 @@ StatMain (
 
 Routine Description:
 
-    This routine performs the stat performance benchmark test.
+    This routine performs the stat performance benchmark tests.
 
 Arguments:
 
@@ -91,14 +129,21 @@ Return Value:
     int FileDescriptor;
     char FileName[PT_STAT_TEST_FILE_NAME_LENGTH];
     unsigned long long Iterations;
+    char *Path;
     pid_t ProcessId;
     struct stat Stat;
     int Status;
+    long ThreadCount;
+    long ThreadIndex;
+    PPT_STAT_THREAD Threads;
 
     FileCreated = 0;
     Iterations = 0;
+    Path = FileName;
     Result->Type = PtResultIterations;
     Result->Status = 0;
+    ThreadIndex = 0;
+    Threads = NULL;
 
     //
     // Get the process ID and create a process safe file to stat.
@@ -124,6 +169,78 @@ Return Value:
     close(FileDescriptor);
     FileCreated = 1;
 
+    //
+    // Initialize the given test state.
+    //
+
+    switch (Test->TestType) {
+    case PtTestStat:
+        break;
+
+    //
+    // The contended test has several threads all stat'ing the file by its
+    // absolute path, so that every thread walks the same directory prefix.
+    //
+
+    case PtTestStatContended:
+        Path = malloc(PATH_MAX);
+        if (Path == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        if (getcwd(Path, PATH_MAX) == NULL) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        if (strlen(Path) + strlen(FileName) + 2 > PATH_MAX) {
+            Result->Status = ENAMETOOLONG;
+            goto MainEnd;
+        }
+
+        strcat(Path, "/");
+        strcat(Path, FileName);
+        Threads = calloc(Test->ThreadCount, sizeof(PT_STAT_THREAD));
+        if (Threads == NULL) {
+            Result->Status = ENOMEM;
+            goto MainEnd;
+        }
+
+        for (ThreadIndex = 0;
+             ThreadIndex < Test->ThreadCount;
+             ThreadIndex += 1) {
+
+            Threads[ThreadIndex].Path = Path;
+            Status = pthread_create(&(Threads[ThreadIndex].Thread),
+                                    NULL,
+                                    StatStartRoutine,
+                                    &(Threads[ThreadIndex]));
+
+            if (Status != 0) {
+                Result->Status = Status;
+                goto MainEnd;
+            }
+        }
+
+        //
+        // Wait until all threads are spun up.
+        //
+
+        while (StatReadyThreadCount != Test->ThreadCount) {
+            sleep(1);
+        }
+
+        break;
+
+    default:
+
+        assert(0);
+
+        Result->Status = EINVAL;
+        goto MainEnd;
+    }
+
     //
     // Start the test. This snaps resource usage and starts the clock ticking.
     //
@@ -140,7 +257,7 @@ Return Value:
     //
 
     while (PtIsTimedTestRunning() != 0) {
-        Status = stat(FileName, &Stat);
+        Status = stat(Path, &Stat);
         if (Status != 0) {
             Result->Status = errno;
             break;
@@ -155,6 +272,30 @@ Return Value:
     }
 
 MainEnd:
+
+    //
+    // Tear down the test state, adding in the work the other threads did.
+    //
+
+    if (Threads != NULL) {
+        ThreadCount = ThreadIndex;
+        for (ThreadIndex = 0; ThreadIndex < ThreadCount; ThreadIndex += 1) {
+            pthread_cancel(Threads[ThreadIndex].Thread);
+            pthread_join(Threads[ThreadIndex].Thread, NULL);
+            Iterations += Threads[ThreadIndex].Iterations;
+            if ((Threads[ThreadIndex].Status != 0) && (Result->Status == 0)) {
+                Result->Status = Threads[ThreadIndex].Status;
+            }
+        }
+
+        free(Threads);
+    }
+
+    StatReadyThreadCount = 0;
+    if ((Path != NULL) && (Path != FileName)) {
+        free(Path);
+    }
+
     if (FileCreated != 0) {
         remove(FileName);
     }
@@ -270,3 +411,61 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+void *
+StatStartRoutine (
+    void *Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the start routine for a contended stat test
+    thread. It waits for the test to start and then loops calling stat on the
+    shared test file.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread's context.
+
+Return Value:
+
+    Returns the NULL pointer.
+
+--*/
+
+{
+
+    struct stat Stat;
+    PPT_STAT_THREAD Thread;
+
+    Thread = (PPT_STAT_THREAD)Parameter;
+
+    //
+    // Announce that the thread is ready.
+    //
+
+    pthread_mutex_lock(&StatReadyMutex);
+    StatReadyThreadCount += 1;
+    pthread_mutex_unlock(&StatReadyMutex);
+
+    //
+    // Busy spin waiting for the test to start.
+    //
+
+    while (PtIsTimedTestRunning() == 0) {
+        pthread_testcancel();
+    }
+
+    while (PtIsTimedTestRunning() != 0) {
+        if (stat(Thread->Path, &Stat) != 0) {
+            Thread->Status = errno;
+            break;
+        }
+
+        Thread->Iterations += 1;
+    }
+
+    return NULL;
+}
+
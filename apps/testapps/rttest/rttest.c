@@ -0,0 +1,472 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    rttest.c
+
+Abstract:
+
+    This module implements the real-time scheduling latency test. Each test
+    thread sleeps until an absolute deadline over and over, and measures how
+    late it actually woke up.
+
+Author:
+
+    Evan Green 29-Mar-2017
+
+Environment:
+
+    User Mode
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/minocaos.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define RTTEST_VERSION_MAJOR 1
+#define RTTEST_VERSION_MINOR 0
+
+#define RTTEST_USAGE                                                       \
+    "usage: rttest [options]\n\n"                                          \
+    "The rttest utility measures how late real-time threads wake up \n"    \
+    "from periodic absolute sleeps, and prints the minimum, average, \n"   \
+    "and maximum wake latency of each thread in microseconds. \n"          \
+    "Options are:\n"                                                       \
+    "  -t, --threads=count -- Run the given number of test threads. \n"    \
+    "      The default is one per processor.\n"                            \
+    "  -p, --priority=value -- Run at the given real-time priority. \n"    \
+    "      The default is 80.\n"                                           \
+    "  -i, --interval=us -- Wake every given number of microseconds. \n"   \
+    "      The default is 1000.\n"                                         \
+    "  -l, --loops=count -- Wake the given number of times per thread. \n" \
+    "      The default is 10000.\n"                                        \
+    "  -r, --round-robin -- Use SCHED_RR instead of SCHED_FIFO.\n"         \
+    "  -n, --normal -- Stay in the normal scheduling class, for \n"        \
+    "      comparison.\n"                                                  \
+    "  --help -- Display this help text.\n"                                \
+    "  --version -- Display the application version and exit.\n\n"
+
+#define RTTEST_OPTIONS_STRING "hi:l:np:rt:V"
+
+#define RTTEST_DEFAULT_PRIORITY 80
+#define RTTEST_DEFAULT_INTERVAL 1000
+#define RTTEST_DEFAULT_LOOPS 10000
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores the state and results of a single test thread.
+
+Members:
+
+    Thread - Stores the thread handle.
+
+    Index - Stores the zero-based index of this thread.
+
+    Error - Stores the error number the thread failed with, or 0 on success.
+
+    Count - Stores the number of wakeups measured.
+
+    Minimum - Stores the smallest wake latency seen, in nanoseconds.
+
+    Maximum - Stores the largest wake latency seen, in nanoseconds.
+
+    Total - Stores the sum of all wake latencies, in nanoseconds.
+
+--*/
+
+typedef struct _RTTEST_THREAD {
+    pthread_t Thread;
+    ULONG Index;
+    INT Error;
+    ULONG Count;
+    ULONGLONG Minimum;
+    ULONGLONG Maximum;
+    ULONGLONG Total;
+} RTTEST_THREAD, *PRTTEST_THREAD;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PVOID
+RttestThread (
+    PVOID Parameter
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+struct option RttestLongOptions[] = {
+    {"interval", required_argument, 0, 'i'},
+    {"loops", required_argument, 0, 'l'},
+    {"normal", no_argument, 0, 'n'},
+    {"priority", required_argument, 0, 'p'},
+    {"round-robin", no_argument, 0, 'r'},
+    {"threads", required_argument, 0, 't'},
+    {"help", no_argument, 0, 'h'},
+    {"version", no_argument, 0, 'V'},
+    {NULL, 0, 0, 0}
+};
+
+//
+// Store the test parameters shared by all threads.
+//
+
+ULONG RttestInterval = RTTEST_DEFAULT_INTERVAL;
+ULONG RttestLoops = RTTEST_DEFAULT_LOOPS;
+INT RttestPolicy = SCHED_FIFO;
+INT RttestPriority = RTTEST_DEFAULT_PRIORITY;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the real-time latency test program.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings. The array count is bounded by the
+        previous parameter, and the strings are null-terminated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    PSTR AfterScan;
+    ULONGLONG Average;
+    ULONG Index;
+    INT Option;
+    INT ReturnValue;
+    PRTTEST_THREAD Thread;
+    ULONG ThreadCount;
+    PRTTEST_THREAD Threads;
+    ULONG Value;
+
+    ReturnValue = 0;
+    Threads = NULL;
+    ThreadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((LONG)ThreadCount <= 0) {
+        ThreadCount = 1;
+    }
+
+    //
+    // Process the control arguments.
+    //
+
+    while (TRUE) {
+        Option = getopt_long(ArgumentCount,
+                             Arguments,
+                             RTTEST_OPTIONS_STRING,
+                             RttestLongOptions,
+                             NULL);
+
+        if (Option == -1) {
+            break;
+        }
+
+        if ((Option == '?') || (Option == ':')) {
+            ReturnValue = 1;
+            goto mainEnd;
+        }
+
+        switch (Option) {
+        case 'i':
+        case 'l':
+        case 'p':
+        case 't':
+            Value = strtoul(optarg, &AfterScan, 10);
+            if ((AfterScan == optarg) || (*AfterScan != '\0') ||
+                (Value == 0)) {
+
+                fprintf(stderr, "rttest: Invalid number %s\n", optarg);
+                ReturnValue = 1;
+                goto mainEnd;
+            }
+
+            if (Option == 'i') {
+                RttestInterval = Value;
+
+            } else if (Option == 'l') {
+                RttestLoops = Value;
+
+            } else if (Option == 'p') {
+                RttestPriority = Value;
+
+            } else {
+                ThreadCount = Value;
+            }
+
+            break;
+
+        case 'n':
+            RttestPolicy = SCHED_OTHER;
+            break;
+
+        case 'r':
+            RttestPolicy = SCHED_RR;
+            break;
+
+        case 'V':
+            printf("rttest version %d.%02d\n",
+                   RTTEST_VERSION_MAJOR,
+                   RTTEST_VERSION_MINOR);
+
+            ReturnValue = 1;
+            goto mainEnd;
+
+        case 'h':
+            printf(RTTEST_USAGE);
+            return 1;
+
+        default:
+
+            assert(FALSE);
+
+            ReturnValue = 1;
+            goto mainEnd;
+        }
+    }
+
+    if (optind < ArgumentCount) {
+        fprintf(stderr, "rttest: Unexpected argument %s\n", Arguments[optind]);
+        ReturnValue = 1;
+        goto mainEnd;
+    }
+
+    if (RttestPolicy == SCHED_OTHER) {
+        RttestPriority = 0;
+
+    } else if ((RttestPriority < sched_get_priority_min(RttestPolicy)) ||
+               (RttestPriority > sched_get_priority_max(RttestPolicy))) {
+
+        fprintf(stderr,
+                "rttest: Priority must be between %d and %d.\n",
+                sched_get_priority_min(RttestPolicy),
+                sched_get_priority_max(RttestPolicy));
+
+        ReturnValue = 1;
+        goto mainEnd;
+    }
+
+    Threads = calloc(ThreadCount, sizeof(RTTEST_THREAD));
+    if (Threads == NULL) {
+        ReturnValue = ENOMEM;
+        goto mainEnd;
+    }
+
+    printf("rttest: %d threads, %s priority %d, interval %dus, %d loops\n",
+           ThreadCount,
+           (RttestPolicy == SCHED_FIFO) ? "SCHED_FIFO" :
+           (RttestPolicy == SCHED_RR) ? "SCHED_RR" : "SCHED_OTHER",
+           RttestPriority,
+           RttestInterval,
+           RttestLoops);
+
+    for (Index = 0; Index < ThreadCount; Index += 1) {
+        Thread = &(Threads[Index]);
+        Thread->Index = Index;
+        Thread->Minimum = -1ULL;
+        ReturnValue = pthread_create(&(Thread->Thread),
+                                     NULL,
+                                     RttestThread,
+                                     Thread);
+
+        if (ReturnValue != 0) {
+            fprintf(stderr,
+                    "rttest: Failed to create thread: %s.\n",
+                    strerror(ReturnValue));
+
+            ThreadCount = Index;
+            break;
+        }
+    }
+
+    for (Index = 0; Index < ThreadCount; Index += 1) {
+        pthread_join(Threads[Index].Thread, NULL);
+    }
+
+    //
+    // Print the results for each thread.
+    //
+
+    for (Index = 0; Index < ThreadCount; Index += 1) {
+        Thread = &(Threads[Index]);
+        if (Thread->Error != 0) {
+            fprintf(stderr,
+                    "rttest: Thread %d failed: %s.\n",
+                    Index,
+                    strerror(Thread->Error));
+
+            ReturnValue = Thread->Error;
+            continue;
+        }
+
+        if (Thread->Count == 0) {
+            continue;
+        }
+
+        Average = Thread->Total / Thread->Count;
+        printf("T:%2d Count:%8d Min:%8lld Avg:%8lld Max:%8lld\n",
+               Index,
+               Thread->Count,
+               Thread->Minimum / NANOSECONDS_PER_MICROSECOND,
+               Average / NANOSECONDS_PER_MICROSECOND,
+               Thread->Maximum / NANOSECONDS_PER_MICROSECOND);
+    }
+
+mainEnd:
+    if (Threads != NULL) {
+        free(Threads);
+    }
+
+    return ReturnValue;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PVOID
+RttestThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements a single latency test thread. It switches itself
+    into the requested scheduling class, then repeatedly sleeps until the next
+    absolute deadline and records how late it woke.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the thread's test structure.
+
+Return Value:
+
+    NULL always.
+
+--*/
+
+{
+
+    ULONGLONG Latency;
+    ULONG Loop;
+    struct timespec Next;
+    struct timespec Now;
+    LONGLONG Nanoseconds;
+    struct sched_param SchedulerParameter;
+    PRTTEST_THREAD Thread;
+
+    Thread = Parameter;
+    memset(&SchedulerParameter, 0, sizeof(SchedulerParameter));
+    SchedulerParameter.sched_priority = RttestPriority;
+    if (sched_setscheduler(0, RttestPolicy, &SchedulerParameter) < 0) {
+        Thread->Error = errno;
+        return NULL;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &Next) != 0) {
+        Thread->Error = errno;
+        return NULL;
+    }
+
+    for (Loop = 0; Loop < RttestLoops; Loop += 1) {
+        Next.tv_nsec += RttestInterval * NANOSECONDS_PER_MICROSECOND;
+        while (Next.tv_nsec >= NANOSECONDS_PER_SECOND) {
+            Next.tv_sec += 1;
+            Next.tv_nsec -= NANOSECONDS_PER_SECOND;
+        }
+
+        Thread->Error = clock_nanosleep(CLOCK_MONOTONIC,
+                                        TIMER_ABSTIME,
+                                        &Next,
+                                        NULL);
+
+        if (Thread->Error != 0) {
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        Nanoseconds = ((LONGLONG)(Now.tv_sec - Next.tv_sec) *
+                       NANOSECONDS_PER_SECOND) +
+                      (Now.tv_nsec - Next.tv_nsec);
+
+        Latency = 0;
+        if (Nanoseconds > 0) {
+            Latency = Nanoseconds;
+        }
+
+        if (Latency < Thread->Minimum) {
+            Thread->Minimum = Latency;
+        }
+
+        if (Latency > Thread->Maximum) {
+            Thread->Maximum = Latency;
+        }
+
+        Thread->Total += Latency;
+        Thread->Count += 1;
+    }
+
+    //
+    // Drop back to the normal class before exiting so the results get
+    // printed without hogging a processor.
+    //
+
+    SchedulerParameter.sched_priority = 0;
+    sched_setscheduler(0, SCHED_OTHER, &SchedulerParameter);
+    return NULL;
+}
+
@@ -0,0 +1,51 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    User Lock Test
+
+Abstract:
+
+    This executable implements the user lock system call test.
+
+Author:
+
+    Evan Green 29-Mar-2017
+
+Environment:
+
+    User
+
+--*/
+
+function build() {
+    sources = [
+        "ulcktest.c"
+    ];
+
+    dynlibs = [
+        "//apps/osbase:libminocaos"
+    ];
+
+    includes = [
+        "$//apps/libc/include"
+    ];
+
+    app = {
+        "label": "ulcktest",
+        "inputs": sources + dynlibs,
+        "includes": includes
+    };
+
+    entries = application(app);
+    return entries;
+}
+
+return build();
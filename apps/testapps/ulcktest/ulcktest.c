@@ -0,0 +1,314 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ulcktest.c
+
+Abstract:
+
+    This module implements tests for the user lock system call, making sure
+    that lock operations can't be aimed at kernel memory.
+
+Author:
+
+    Evan Green 29-Mar-2017
+
+Environment:
+
+    User Mode
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/minocaos.h>
+
+#include <stdio.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+#define PRINT_ERROR(...) fprintf(stderr, "ulcktest: " __VA_ARGS__)
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define a kernel address the tests try to operate on. This is an aligned
+// word right at the start of kernel space.
+//
+
+#define TEST_KERNEL_ADDRESS KERNEL_VA_START
+
+//
+// Define the last user mode address that doesn't leave a full lock word in
+// user space.
+//
+
+#define TEST_STRADDLE_ADDRESS ((PVOID)((UINTN)KERNEL_VA_START - 2))
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+ULONG
+TestUserLockKernelAddress (
+    PVOID Address,
+    ULONG Flags
+    );
+
+ULONG
+TestUserLockWakeOperation (
+    ULONG Flags
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INT
+main (
+    INT ArgumentCount,
+    CHAR **Arguments
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the user lock test program.
+
+Arguments:
+
+    ArgumentCount - Supplies the number of elements in the arguments array.
+
+    Arguments - Supplies an array of strings. The array count is bounded by the
+        previous parameter, and the strings are null-terminated.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    ULONG Failures;
+
+    Failures = TestUserLockKernelAddress(TEST_KERNEL_ADDRESS,
+                                         USER_LOCK_PRIVATE);
+
+    Failures += TestUserLockKernelAddress(TEST_KERNEL_ADDRESS, 0);
+    Failures += TestUserLockKernelAddress(TEST_STRADDLE_ADDRESS,
+                                          USER_LOCK_PRIVATE);
+
+    Failures += TestUserLockWakeOperation(USER_LOCK_PRIVATE);
+    Failures += TestUserLockWakeOperation(0);
+    if (Failures != 0) {
+        PRINT_ERROR("*** %d failures in user lock test. ***\n", Failures);
+        return 1;
+    }
+
+    printf("All user lock tests pass.\n");
+    return 0;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONG
+TestUserLockKernelAddress (
+    PVOID Address,
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes sure every user lock operation refuses the given
+    address, whether it is the first or second lock address.
+
+Arguments:
+
+    Address - Supplies the address that should be rejected.
+
+    Flags - Supplies the USER_LOCK_* flags to use.
+
+Return Value:
+
+    Returns the number of failures.
+
+--*/
+
+{
+
+    ULONG Count;
+    ULONG Failures;
+    ULONG Operation;
+    ULONG SecondCount;
+    KSTATUS Status;
+    ULONG UserValue;
+
+    Failures = 0;
+    UserValue = 0;
+    Count = 0;
+    Status = OsUserLock(Address, UserLockWait | Flags, &Count, 0);
+    if (Status != STATUS_ACCESS_VIOLATION) {
+        PRINT_ERROR("Wait on %p returned %d.\n", Address, Status);
+        Failures += 1;
+    }
+
+    Count = 1;
+    Status = OsUserLock(Address, UserLockWake | Flags, &Count, 0);
+    if (Status != STATUS_ACCESS_VIOLATION) {
+        PRINT_ERROR("Wake on %p returned %d.\n", Address, Status);
+        Failures += 1;
+    }
+
+    Count = 1;
+    SecondCount = 1;
+    Status = OsUserLockRequeue(&UserValue,
+                               Flags,
+                               UserValue,
+                               &Count,
+                               Address,
+                               &SecondCount);
+
+    if (Status != STATUS_ACCESS_VIOLATION) {
+        PRINT_ERROR("Requeue to %p returned %d.\n", Address, Status);
+        Failures += 1;
+    }
+
+    //
+    // Try to set the kernel word. This must fail without touching it.
+    //
+
+    Operation = USER_LOCK_WAKE_ARGUMENT(USER_LOCK_WAKE_OPERATION_SET,
+                                        0,
+                                        USER_LOCK_WAKE_COMPARE_EQUAL,
+                                        0);
+
+    Count = 1;
+    SecondCount = 1;
+    Status = OsUserLockWakeOperation(&UserValue,
+                                     Address,
+                                     Flags,
+                                     Operation,
+                                     &Count,
+                                     &SecondCount);
+
+    if (Status != STATUS_ACCESS_VIOLATION) {
+        PRINT_ERROR("Wake operation on %p returned %d.\n", Address, Status);
+        Failures += 1;
+    }
+
+    Count = 1;
+    SecondCount = 1;
+    Status = OsUserLockWakeOperation(Address,
+                                     &UserValue,
+                                     Flags,
+                                     Operation,
+                                     &Count,
+                                     &SecondCount);
+
+    if (Status != STATUS_ACCESS_VIOLATION) {
+        PRINT_ERROR("Wake operation from %p returned %d.\n", Address, Status);
+        Failures += 1;
+    }
+
+    return Failures;
+}
+
+ULONG
+TestUserLockWakeOperation (
+    ULONG Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes sure a wake operation on valid user addresses still
+    modifies the second word.
+
+Arguments:
+
+    Flags - Supplies the USER_LOCK_* flags to use.
+
+Return Value:
+
+    Returns the number of failures.
+
+--*/
+
+{
+
+    ULONG Count;
+    ULONG Failures;
+    ULONG First;
+    ULONG Operation;
+    ULONG Second;
+    ULONG SecondCount;
+    KSTATUS Status;
+
+    Failures = 0;
+    First = 0;
+    Second = 5;
+    Operation = USER_LOCK_WAKE_ARGUMENT(USER_LOCK_WAKE_OPERATION_ADD,
+                                        3,
+                                        USER_LOCK_WAKE_COMPARE_EQUAL,
+                                        5);
+
+    Count = 1;
+    SecondCount = 1;
+    Status = OsUserLockWakeOperation(&First,
+                                     &Second,
+                                     Flags,
+                                     Operation,
+                                     &Count,
+                                     &SecondCount);
+
+    if (!KSUCCESS(Status)) {
+        PRINT_ERROR("Wake operation failed: %d.\n", Status);
+        Failures += 1;
+    }
+
+    if (Second != 8) {
+        PRINT_ERROR("Wake operation left %d, expected 8.\n", Second);
+        Failures += 1;
+    }
+
+    if ((Count != 0) || (SecondCount != 0)) {
+        PRINT_ERROR("Wake operation woke %d and %d with no waiters.\n",
+                    Count,
+                    SecondCount);
+
+        Failures += 1;
+    }
+
+    return Failures;
+}
+
@@ -51,15 +51,53 @@ Module Name:
     "usage: vmstat\n\n"                                                    \
     "The vmstat utility prints information about current system memory \n" \
     "usage. Options are:\n"                                                \
+    "  -p, --processes -- Also print the resident set size of each \n"     \
+    "      process.\n"                                                     \
+    "  -t, --tags -- Print live kernel pool usage and a size histogram \n" \
+    "      for each allocation tag instead.\n"                             \
+    "  -i, --interval=seconds -- With -t, take a new snapshot every \n"    \
+    "      interval and print how each tag changed, to find leaks and \n"  \
+    "      busy allocators.\n"                                             \
+    "  -w, --wakeups -- Print clock wakeups and timer expirations \n"      \
+    "      per second for each processor every interval.\n"                \
+    "  -q, --queues -- Print DPC and system work item rates and queue \n"  \
+    "      times every interval.\n"                                        \
+    "  -c, --count=count -- With -i, stop after this many intervals.\n"    \
     "  --help -- Display this help text.\n"                                \
     "  --version -- Display the application version and exit.\n\n"
 
-#define VMSTAT_OPTIONS_STRING "hV"
+#define VMSTAT_OPTIONS_STRING "c:hi:pqtwV"
 
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure describes how one pool tag changed between snapshots.
+
+Members:
+
+    Tag - Stores a pointer to the tag's statistics in the latest snapshot.
+
+    Growth - Stores the change in live bytes since the first snapshot.
+
+    Allocations - Stores the number of allocations made during the last
+        interval.
+
+    Bytes - Stores the number of bytes allocated during the last interval.
+
+--*/
+
+typedef struct _VMSTAT_TAG_DELTA {
+    PMM_POOL_TAG_STATISTIC Tag;
+    LONGLONG Growth;
+    ULONGLONG Allocations;
+    ULONGLONG Bytes;
+} VMSTAT_TAG_DELTA, *PVMSTAT_TAG_DELTA;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -69,16 +107,102 @@ VmstatPrintInformation (
     VOID
     );
 
+INT
+VmstatPrintProcesses (
+    VOID
+    );
+
+PPROCESS_INFORMATION
+VmstatGetProcessInformation (
+    PROCESS_ID ProcessId
+    );
+
+INT
+VmstatPrintPoolTags (
+    ULONG Interval,
+    ULONG Count
+    );
+
+PMM_POOL_TAG_STATISTICS
+VmstatGetPoolTagSnapshot (
+    VOID
+    );
+
+PMM_POOL_TAG_STATISTIC
+VmstatFindPoolTag (
+    PMM_POOL_TAG_STATISTICS Snapshot,
+    PMM_POOL_TAG_STATISTIC Tag
+    );
+
+VOID
+VmstatFormatTag (
+    ULONG Tag,
+    PSTR Buffer
+    );
+
+INT
+VmstatPrintWakeups (
+    ULONG Interval,
+    ULONG Count
+    );
+
+INT
+VmstatGetProcessorUsage (
+    UINTN ProcessorNumber,
+    PPROCESSOR_USAGE_INFORMATION Usage
+    );
+
+INT
+VmstatPrintQueues (
+    ULONG Interval,
+    ULONG Count
+    );
+
+INT
+VmstatGetWorkQueueStatistics (
+    PWORK_QUEUE_STATISTICS Statistics
+    );
+
+ULONGLONG
+VmstatTicksToMicroseconds (
+    ULONGLONG Ticks,
+    ULONGLONG Frequency
+    );
+
+int
+VmstatCompareTagsBySize (
+    const void *Left,
+    const void *Right
+    );
+
+int
+VmstatCompareTagDeltas (
+    const void *Left,
+    const void *Right
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 struct option VmstatLongOptions[] = {
+    {"count", required_argument, 0, 'c'},
+    {"interval", required_argument, 0, 'i'},
+    {"processes", no_argument, 0, 'p'},
+    {"queues", no_argument, 0, 'q'},
+    {"tags", no_argument, 0, 't'},
+    {"wakeups", no_argument, 0, 'w'},
     {"help", no_argument, 0, 'h'},
     {"version", no_argument, 0, 'V'},
     {NULL, 0, 0, 0}
 };
 
+PSTR VmstatZoneNames[PhysicalMemoryZoneCount] = {
+    "Normal",
+    "Fast",
+    "DMA"
+};
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -113,9 +237,23 @@ Return Value:
 {
 
     ULONG ArgumentIndex;
+    PSTR AfterScan;
+    ULONG Count;
+    ULONG Interval;
     INT Option;
+    BOOL PrintProcesses;
+    BOOL PrintQueues;
+    BOOL PrintTags;
+    BOOL PrintWakeups;
     INT ReturnValue;
-
+    ULONG Value;
+
+    Count = 0;
+    Interval = 0;
+    PrintProcesses = FALSE;
+    PrintQueues = FALSE;
+    PrintTags = FALSE;
+    PrintWakeups = FALSE;
     ReturnValue = 0;
 
     //
@@ -148,6 +286,40 @@ Return Value:
         }
 
         switch (Option) {
+        case 'c':
+        case 'i':
+            Value = strtoul(optarg, &AfterScan, 10);
+            if ((AfterScan == optarg) || (*AfterScan != '\0')) {
+                fprintf(stderr, "vmstat: Invalid number %s\n", optarg);
+                ReturnValue = 1;
+                goto mainEnd;
+            }
+
+            if (Option == 'c') {
+                Count = Value;
+
+            } else {
+                Interval = Value;
+            }
+
+            break;
+
+        case 'p':
+            PrintProcesses = TRUE;
+            break;
+
+        case 'q':
+            PrintQueues = TRUE;
+            break;
+
+        case 't':
+            PrintTags = TRUE;
+            break;
+
+        case 'w':
+            PrintWakeups = TRUE;
+            break;
+
         case 'V':
             printf("vmstat version %d.%02d\n",
                    VMSTAT_VERSION_MAJOR,
@@ -180,7 +352,25 @@ Return Value:
                 Arguments[ArgumentIndex]);
     }
 
-    ReturnValue = 0;
+    if (PrintTags != FALSE) {
+        ReturnValue = VmstatPrintPoolTags(Interval, Count);
+        goto mainEnd;
+    }
+
+    if (PrintWakeups != FALSE) {
+        ReturnValue = VmstatPrintWakeups(Interval, Count);
+        goto mainEnd;
+    }
+
+    if (PrintQueues != FALSE) {
+        ReturnValue = VmstatPrintQueues(Interval, Count);
+        goto mainEnd;
+    }
+
+    ReturnValue = VmstatPrintInformation();
+    if ((ReturnValue == 0) && (PrintProcesses != FALSE)) {
+        ReturnValue = VmstatPrintProcesses();
+    }
 
 mainEnd:
     return ReturnValue;
@@ -215,13 +405,18 @@ Return Value:
 
 {
 
+    PMM_COMPRESSED_SWAP_STATISTICS Compressed;
     IO_CACHE_STATISTICS IoCache;
     ULONGLONG Megabytes;
     MM_STATISTICS MmStatistics;
+    ULONGLONG Ratio;
     INT ReturnValue;
     UINTN Size;
     KSTATUS Status;
+    MM_TLB_STATISTICS TlbStatistics;
     UINTN Value;
+    PMM_PHYSICAL_ZONE_STATISTICS Zone;
+    ULONG ZoneIndex;
 
     ReturnValue = 0;
     Size = sizeof(MM_STATISTICS);
@@ -252,6 +447,58 @@ Return Value:
                  MmStatistics.PageSize) / _1MB;
 
     printf("Non-Paged Physical Memory: %I64dMB\n", Megabytes);
+    printf("Pager: %ld pages scanned, %ld referenced\n",
+           MmStatistics.PagerScannedPages,
+           MmStatistics.PagerReferencedPages);
+
+    for (ZoneIndex = 0; ZoneIndex < PhysicalMemoryZoneCount; ZoneIndex += 1) {
+        Zone = &(MmStatistics.Zones[ZoneIndex]);
+        if (Zone->TotalPages == 0) {
+            continue;
+        }
+
+        printf("Zone %s: %ld of %ld pages free, %I64d allocations, "
+               "%I64d fallbacks\n",
+               VmstatZoneNames[ZoneIndex],
+               Zone->FreePages,
+               Zone->TotalPages,
+               Zone->Allocations,
+               Zone->Fallbacks);
+    }
+
+    Compressed = &(MmStatistics.CompressedSwap);
+    if (Compressed->MaxPoolPages != 0) {
+        printf("Compressed Swap:\n");
+        printf("    Pool: %ld of %ld pages\n",
+               Compressed->PoolPages,
+               Compressed->MaxPoolPages);
+
+        printf("    Stored: %ld pages in %I64d bytes\n",
+               Compressed->StoredPages,
+               Compressed->CompressedBytes);
+
+        Ratio = 0;
+        if (Compressed->PoolPages != 0) {
+            Ratio = (Compressed->StoredPages * 100ULL) / Compressed->PoolPages;
+        }
+
+        printf("    Ratio: %I64d.%02I64d\n", Ratio / 100, Ratio % 100);
+        printf("    Stores: %I64d, rejected %I64d\n",
+               Compressed->Stores,
+               Compressed->Rejects);
+
+        Ratio = 0;
+        if (Compressed->Loads + Compressed->Misses != 0) {
+            Ratio = (Compressed->Loads * 100ULL) /
+                    (Compressed->Loads + Compressed->Misses);
+        }
+
+        printf("    Loads: %I64d, missed %I64d (%I64d%% hit)\n",
+               Compressed->Loads,
+               Compressed->Misses,
+               Ratio);
+    }
+
     printf("Non Paged Pool:\n");
     printf("    Size: %ld\n", MmStatistics.NonPagedPool.TotalHeapSize);
     printf("    Maximum Size: %ld\n", MmStatistics.NonPagedPool.MaxHeapSize);
@@ -303,6 +550,1110 @@ Return Value:
     printf("Page Cache Size: %lldMB\n", Megabytes);
     Megabytes = (IoCache.DirtyPageCount * MmStatistics.PageSize) / _1MB;
     printf("Dirty Page Cache Size: %lldMB\n", Megabytes);
+    Size = sizeof(MM_TLB_STATISTICS);
+    memset(&TlbStatistics, 0, Size);
+    TlbStatistics.Version = MM_TLB_STATISTICS_VERSION;
+    Status = OsGetSetSystemInformation(SystemInformationMm,
+                                       MmInformationTlbStatistics,
+                                       &TlbStatistics,
+                                       &Size,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get TLB statistics: status %d: %s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        return ReturnValue;
+    }
+
+    printf("TLB Shootdowns: %lld (%lld local)\n",
+           TlbStatistics.Shootdowns,
+           TlbStatistics.LocalShootdowns);
+
+    printf("    Pages Invalidated: %lld\n", TlbStatistics.PagesInvalidated);
+    printf("    Full Flushes: %lld\n", TlbStatistics.FullFlushes);
+    printf("    IPIs Sent: %lld (%lld avoided)\n",
+           TlbStatistics.IpisSent,
+           TlbStatistics.IpisAvoided);
+
+    return ReturnValue;
+}
+
+INT
+VmstatPrintProcesses (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the current and peak resident set size of every
+    process in the system.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    ULONGLONG Kilobytes;
+    ULONGLONG MaxKilobytes;
+    PSTR Name;
+    UINTN PageSize;
+    PPROCESS_INFORMATION Process;
+    UINTN ProcessCount;
+    PPROCESS_ID ProcessIdList;
+    UINTN ProcessIndex;
+    INT ReturnValue;
+    UINTN Size;
+    KSTATUS Status;
+
+    PageSize = sysconf(_SC_PAGE_SIZE);
+    ProcessIdList = NULL;
+    ReturnValue = 0;
+
+    //
+    // Loop in case processes are created between the size query and the
+    // actual request.
+    //
+
+    Size = 0;
+    while (TRUE) {
+        Status = OsGetSetSystemInformation(SystemInformationPs,
+                                           PsInformationProcessIdList,
+                                           ProcessIdList,
+                                           &Size,
+                                           FALSE);
+
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            break;
+        }
+
+        if (ProcessIdList != NULL) {
+            free(ProcessIdList);
+        }
+
+        Size += sizeof(PROCESS_ID) * 16;
+        ProcessIdList = malloc(Size);
+        if (ProcessIdList == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+    }
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get process list: status %d: %s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        goto PrintProcessesEnd;
+    }
+
+    printf("\n%8s %12s %12s  %s\n", "PID", "RSS(KB)", "MaxRSS(KB)", "Name");
+    ProcessCount = Size / sizeof(PROCESS_ID);
+    for (ProcessIndex = 0; ProcessIndex < ProcessCount; ProcessIndex += 1) {
+        Process = VmstatGetProcessInformation(ProcessIdList[ProcessIndex]);
+
+        //
+        // The process may have exited since the list was collected.
+        //
+
+        if (Process == NULL) {
+            continue;
+        }
+
+        Name = "";
+        if ((Process->NameOffset != 0) && (Process->NameLength != 0)) {
+            Name = (PSTR)((PVOID)Process + Process->NameOffset);
+        }
+
+        Kilobytes = ((ULONGLONG)Process->ResidentSet * PageSize) / _1KB;
+        MaxKilobytes = ((ULONGLONG)Process->ResourceUsage.MaxResidentSet *
+                        PageSize) / _1KB;
+
+        printf("%8d %12lld %12lld  %s\n",
+               Process->ProcessId,
+               Kilobytes,
+               MaxKilobytes,
+               Name);
+
+        free(Process);
+    }
+
+PrintProcessesEnd:
+    if (ProcessIdList != NULL) {
+        free(ProcessIdList);
+    }
+
+    return ReturnValue;
+}
+
+PPROCESS_INFORMATION
+VmstatGetProcessInformation (
+    PROCESS_ID ProcessId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the process information for the given process.
+
+Arguments:
+
+    ProcessId - Supplies the ID of the process to query.
+
+Return Value:
+
+    Returns a pointer to the process information on success. The caller is
+    responsible for freeing this memory.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    PPROCESS_INFORMATION Process;
+    UINTN Size;
+    KSTATUS Status;
+
+    Size = sizeof(PROCESS_INFORMATION);
+    while (TRUE) {
+        Process = malloc(Size);
+        if (Process == NULL) {
+            return NULL;
+        }
+
+        Process->Version = PROCESS_INFORMATION_VERSION;
+        Process->ProcessId = ProcessId;
+        Status = OsGetSetSystemInformation(SystemInformationPs,
+                                           PsInformationProcess,
+                                           Process,
+                                           &Size,
+                                           FALSE);
+
+        if (KSUCCESS(Status)) {
+            break;
+        }
+
+        free(Process);
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            return NULL;
+        }
+    }
+
+    return Process;
+}
+
+INT
+VmstatPrintPoolTags (
+    ULONG Interval,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the per-tag kernel pool statistics. With no interval,
+    it prints the live usage and size histogram of each tag. Otherwise it
+    takes a snapshot every interval and prints how each tag has grown since
+    the first snapshot and how fast it allocated during the last interval.
+
+Arguments:
+
+    Interval - Supplies the number of seconds between snapshots, or zero to
+        print a single snapshot.
+
+    Count - Supplies the number of intervals to print, or zero to keep going
+        until interrupted.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    PMM_POOL_TAG_STATISTICS Current;
+    PVMSTAT_TAG_DELTA Deltas;
+    ULONGLONG Elapsed;
+    PMM_POOL_TAG_STATISTICS First;
+    ULONG Iteration;
+    PMM_POOL_TAG_STATISTIC Old;
+    PMM_POOL_TAG_STATISTICS Previous;
+    INT ReturnValue;
+    ULONG Size;
+    PMM_POOL_TAG_STATISTIC Tag;
+    ULONG TagIndex;
+    CHAR TagName[5];
+    PMM_POOL_TAG_STATISTIC Tags;
+
+    Current = NULL;
+    Deltas = NULL;
+    Previous = NULL;
+    ReturnValue = 0;
+    First = VmstatGetPoolTagSnapshot();
+    if (First == NULL) {
+        ReturnValue = errno;
+        goto PrintPoolTagsEnd;
+    }
+
+    if (Interval == 0) {
+        Tags = (PMM_POOL_TAG_STATISTIC)(First + 1);
+        qsort(Tags,
+              First->TagCount,
+              sizeof(MM_POOL_TAG_STATISTIC),
+              VmstatCompareTagsBySize);
+
+        printf("%-4s %-4s %12s %10s %12s %10s\n",
+               "Tag",
+               "Pool",
+               "Live",
+               "LiveCount",
+               "MaxLive",
+               "Largest");
+
+        for (TagIndex = 0; TagIndex < First->TagCount; TagIndex += 1) {
+            Tag = &(Tags[TagIndex]);
+            VmstatFormatTag(Tag->Tag, TagName);
+            printf("%-4s %-4s %12lld %10d %12lld %10d\n",
+                   TagName,
+                   (Tag->PoolType == PoolTypePaged) ? "PP" : "NP",
+                   Tag->ActiveSize,
+                   Tag->ActiveAllocationCount,
+                   Tag->LargestActiveSize,
+                   Tag->LargestAllocation);
+
+            if (Tag->ActiveAllocationCount == 0) {
+                continue;
+            }
+
+            //
+            // Print the non-empty size buckets, labeled by their upper bound.
+            // The last bucket holds everything larger than the one before it.
+            //
+
+            printf("    ");
+            for (Bucket = 0;
+                 Bucket < MEMORY_HEAP_TAG_HISTOGRAM_BUCKETS;
+                 Bucket += 1) {
+
+                if (Tag->Histogram[Bucket] == 0) {
+                    continue;
+                }
+
+                Size = 1 << (MEMORY_HEAP_TAG_HISTOGRAM_SHIFT + Bucket);
+                if (Bucket == MEMORY_HEAP_TAG_HISTOGRAM_BUCKETS - 1) {
+                    printf(" >%d:%d", Size >> 1, Tag->Histogram[Bucket]);
+
+                } else {
+                    printf(" %d:%d", Size, Tag->Histogram[Bucket]);
+                }
+            }
+
+            printf("\n");
+        }
+
+        goto PrintPoolTagsEnd;
+    }
+
+    Previous = First;
+    Iteration = 0;
+    while ((Count == 0) || (Iteration < Count)) {
+        sleep(Interval);
+        Current = VmstatGetPoolTagSnapshot();
+        if (Current == NULL) {
+            ReturnValue = errno;
+            goto PrintPoolTagsEnd;
+        }
+
+        Deltas = malloc(Current->TagCount * sizeof(VMSTAT_TAG_DELTA));
+        if ((Deltas == NULL) && (Current->TagCount != 0)) {
+            ReturnValue = ENOMEM;
+            goto PrintPoolTagsEnd;
+        }
+
+        Tags = (PMM_POOL_TAG_STATISTIC)(Current + 1);
+        for (TagIndex = 0; TagIndex < Current->TagCount; TagIndex += 1) {
+            Tag = &(Tags[TagIndex]);
+            Deltas[TagIndex].Tag = Tag;
+            Deltas[TagIndex].Growth = Tag->ActiveSize;
+            Old = VmstatFindPoolTag(First, Tag);
+            if (Old != NULL) {
+                Deltas[TagIndex].Growth -= Old->ActiveSize;
+            }
+
+            Deltas[TagIndex].Allocations = Tag->LifetimeAllocationCount;
+            Deltas[TagIndex].Bytes = Tag->LifetimeAllocationSize;
+            Old = VmstatFindPoolTag(Previous, Tag);
+            if (Old != NULL) {
+                Deltas[TagIndex].Allocations -= Old->LifetimeAllocationCount;
+                Deltas[TagIndex].Bytes -= Old->LifetimeAllocationSize;
+            }
+        }
+
+        qsort(Deltas,
+              Current->TagCount,
+              sizeof(VMSTAT_TAG_DELTA),
+              VmstatCompareTagDeltas);
+
+        //
+        // Convert the interval counts into per-second rates using the time
+        // counter, since sleep may not have been exact.
+        //
+
+        Elapsed = Current->TimeCounter - Previous->TimeCounter;
+        if (Elapsed == 0) {
+            Elapsed = 1;
+        }
+
+        printf("\n%-4s %-4s %12s %12s %10s %12s\n",
+               "Tag",
+               "Pool",
+               "Live",
+               "Growth",
+               "Allocs/s",
+               "Bytes/s");
+
+        for (TagIndex = 0; TagIndex < Current->TagCount; TagIndex += 1) {
+            Tag = Deltas[TagIndex].Tag;
+            if ((Deltas[TagIndex].Growth == 0) &&
+                (Deltas[TagIndex].Allocations == 0)) {
+
+                continue;
+            }
+
+            VmstatFormatTag(Tag->Tag, TagName);
+            printf("%-4s %-4s %12lld %+12lld %10lld %12lld\n",
+                   TagName,
+                   (Tag->PoolType == PoolTypePaged) ? "PP" : "NP",
+                   Tag->ActiveSize,
+                   Deltas[TagIndex].Growth,
+                   (Deltas[TagIndex].Allocations *
+                    Current->TimeCounterFrequency) / Elapsed,
+                   (Deltas[TagIndex].Bytes *
+                    Current->TimeCounterFrequency) / Elapsed);
+        }
+
+        fflush(stdout);
+        free(Deltas);
+        Deltas = NULL;
+        if (Previous != First) {
+            free(Previous);
+        }
+
+        Previous = Current;
+        Current = NULL;
+        Iteration += 1;
+    }
+
+PrintPoolTagsEnd:
+    if (Deltas != NULL) {
+        free(Deltas);
+    }
+
+    if (Current != NULL) {
+        free(Current);
+    }
+
+    if ((Previous != NULL) && (Previous != First)) {
+        free(Previous);
+    }
+
+    if (First != NULL) {
+        free(First);
+    }
+
     return ReturnValue;
 }
 
+INT
+VmstatPrintWakeups (
+    ULONG Interval,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints how many times per second each processor was woken
+    up by the clock and how often it serviced expired timers, sampled over
+    each interval.
+
+Arguments:
+
+    Interval - Supplies the number of seconds between samples. Zero means one
+        second.
+
+    Count - Supplies the number of intervals to print, or zero to keep going
+        until interrupted.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    ULONGLONG Coalesced;
+    ULONGLONG CurrentTime;
+    ULONGLONG Elapsed;
+    ULONGLONG Frequency;
+    ULONG Iteration;
+    PPROCESSOR_USAGE_INFORMATION Previous;
+    ULONGLONG PreviousTime;
+    PROCESSOR_COUNT_INFORMATION ProcessorCount;
+    UINTN ProcessorIndex;
+    INT ReturnValue;
+    UINTN Size;
+    KSTATUS Status;
+    ULONGLONG Timers;
+    PROCESSOR_USAGE_INFORMATION Usage;
+    ULONGLONG Wakeups;
+
+    Previous = NULL;
+    if (Interval == 0) {
+        Interval = 1;
+    }
+
+    Size = sizeof(PROCESSOR_COUNT_INFORMATION);
+    Status = OsGetSetSystemInformation(SystemInformationKe,
+                                       KeInformationProcessorCount,
+                                       &ProcessorCount,
+                                       &Size,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        ReturnValue = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get processor count: status %d: %s.\n",
+                Status,
+                strerror(ReturnValue));
+
+        goto PrintWakeupsEnd;
+    }
+
+    Previous = malloc(ProcessorCount.ActiveProcessorCount *
+                      sizeof(PROCESSOR_USAGE_INFORMATION));
+
+    if (Previous == NULL) {
+        ReturnValue = ENOMEM;
+        goto PrintWakeupsEnd;
+    }
+
+    Frequency = OsGetTimeCounterFrequency();
+    PreviousTime = OsQueryTimeCounter();
+    for (ProcessorIndex = 0;
+         ProcessorIndex < ProcessorCount.ActiveProcessorCount;
+         ProcessorIndex += 1) {
+
+        ReturnValue = VmstatGetProcessorUsage(ProcessorIndex,
+                                              &(Previous[ProcessorIndex]));
+
+        if (ReturnValue != 0) {
+            goto PrintWakeupsEnd;
+        }
+    }
+
+    Iteration = 0;
+    while ((Count == 0) || (Iteration < Count)) {
+        sleep(Interval);
+        CurrentTime = OsQueryTimeCounter();
+        Elapsed = CurrentTime - PreviousTime;
+        if (Elapsed == 0) {
+            Elapsed = 1;
+        }
+
+        printf("\n%-4s %10s %10s %12s\n",
+               "CPU",
+               "Wakeups/s",
+               "Timers/s",
+               "Coalesced/s");
+
+        for (ProcessorIndex = 0;
+             ProcessorIndex < ProcessorCount.ActiveProcessorCount;
+             ProcessorIndex += 1) {
+
+            ReturnValue = VmstatGetProcessorUsage(ProcessorIndex, &Usage);
+            if (ReturnValue != 0) {
+                goto PrintWakeupsEnd;
+            }
+
+            Wakeups = Usage.ClockInterruptCount -
+                      Previous[ProcessorIndex].ClockInterruptCount;
+
+            Timers = Usage.TimerInterruptCount -
+                     Previous[ProcessorIndex].TimerInterruptCount;
+
+            Coalesced = Usage.CoalescedTimerCount -
+                        Previous[ProcessorIndex].CoalescedTimerCount;
+
+            printf("%-4d %10lld %10lld %12lld\n",
+                   (INT)ProcessorIndex,
+                   (Wakeups * Frequency) / Elapsed,
+                   (Timers * Frequency) / Elapsed,
+                   (Coalesced * Frequency) / Elapsed);
+
+            Previous[ProcessorIndex] = Usage;
+        }
+
+        fflush(stdout);
+        PreviousTime = CurrentTime;
+        Iteration += 1;
+    }
+
+    ReturnValue = 0;
+
+PrintWakeupsEnd:
+    if (Previous != NULL) {
+        free(Previous);
+    }
+
+    return ReturnValue;
+}
+
+INT
+VmstatGetProcessorUsage (
+    UINTN ProcessorNumber,
+    PPROCESSOR_USAGE_INFORMATION Usage
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the usage information for a single processor.
+
+Arguments:
+
+    ProcessorNumber - Supplies the number of the processor to query.
+
+    Usage - Supplies a pointer where the usage information will be returned.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    INT Error;
+    UINTN Size;
+    KSTATUS Status;
+
+    memset(Usage, 0, sizeof(PROCESSOR_USAGE_INFORMATION));
+    Usage->ProcessorNumber = ProcessorNumber;
+    Size = sizeof(PROCESSOR_USAGE_INFORMATION);
+    Status = OsGetSetSystemInformation(SystemInformationKe,
+                                       KeInformationProcessorUsage,
+                                       Usage,
+                                       &Size,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        Error = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get processor %d usage: status %d: %s.\n",
+                (INT)ProcessorNumber,
+                Status,
+                strerror(Error));
+
+        return Error;
+    }
+
+    return 0;
+}
+
+INT
+VmstatPrintQueues (
+    ULONG Interval,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints how many DPCs and system work items ran per second
+    and how long they waited to run, sampled over each interval. Maximum
+    waits are since boot.
+
+Arguments:
+
+    Interval - Supplies the number of seconds between samples. Zero means one
+        second.
+
+    Count - Supplies the number of intervals to print, or zero to keep going
+        until interrupted.
+
+Return Value:
+
+    0 on success.
+
+    Non-zero on failure.
+
+--*/
+
+{
+
+    ULONGLONG Allocations;
+    ULONGLONG CurrentTime;
+    ULONGLONG Dpcs;
+    ULONGLONG DpcWait;
+    ULONGLONG Elapsed;
+    ULONGLONG Frequency;
+    ULONG Iteration;
+    ULONGLONG Items;
+    ULONGLONG ItemWait;
+    WORK_QUEUE_STATISTICS Previous;
+    ULONGLONG PreviousTime;
+    INT ReturnValue;
+    WORK_QUEUE_STATISTICS Statistics;
+
+    if (Interval == 0) {
+        Interval = 1;
+    }
+
+    Frequency = OsGetTimeCounterFrequency();
+    PreviousTime = OsQueryTimeCounter();
+    ReturnValue = VmstatGetWorkQueueStatistics(&Previous);
+    if (ReturnValue != 0) {
+        return ReturnValue;
+    }
+
+    Iteration = 0;
+    while ((Count == 0) || (Iteration < Count)) {
+        if ((Iteration % 20) == 0) {
+            printf("%8s %8s %8s %8s %8s %8s %7s %7s\n",
+                   "DPCs/s",
+                   "Wait us",
+                   "Max us",
+                   "Items/s",
+                   "Wait us",
+                   "Max us",
+                   "Workers",
+                   "Allocs");
+        }
+
+        sleep(Interval);
+        CurrentTime = OsQueryTimeCounter();
+        Elapsed = CurrentTime - PreviousTime;
+        if (Elapsed == 0) {
+            Elapsed = 1;
+        }
+
+        ReturnValue = VmstatGetWorkQueueStatistics(&Statistics);
+        if (ReturnValue != 0) {
+            return ReturnValue;
+        }
+
+        Dpcs = Statistics.DpcCount - Previous.DpcCount;
+        DpcWait = 0;
+        if (Dpcs != 0) {
+            DpcWait = (Statistics.DpcQueueTicks - Previous.DpcQueueTicks) /
+                      Dpcs;
+        }
+
+        Items = Statistics.WorkItemCount - Previous.WorkItemCount;
+        ItemWait = 0;
+        if (Items != 0) {
+            ItemWait = (Statistics.WorkItemQueueTicks -
+                        Previous.WorkItemQueueTicks) / Items;
+        }
+
+        Allocations = Statistics.WorkItemAllocations -
+                      Previous.WorkItemAllocations;
+
+        printf("%8lld %8lld %8lld %8lld %8lld %8lld %3d/%-3d %7lld\n",
+               (Dpcs * Frequency) / Elapsed,
+               VmstatTicksToMicroseconds(DpcWait,
+                                         Statistics.TimeCounterFrequency),
+               VmstatTicksToMicroseconds(Statistics.DpcMaxQueueTicks,
+                                         Statistics.TimeCounterFrequency),
+               (Items * Frequency) / Elapsed,
+               VmstatTicksToMicroseconds(ItemWait,
+                                         Statistics.TimeCounterFrequency),
+               VmstatTicksToMicroseconds(Statistics.WorkItemMaxQueueTicks,
+                                         Statistics.TimeCounterFrequency),
+               Statistics.WorkerThreadCount,
+               Statistics.MaxWorkerThreadCount,
+               Allocations);
+
+        fflush(stdout);
+        Previous = Statistics;
+        PreviousTime = CurrentTime;
+        Iteration += 1;
+    }
+
+    return 0;
+}
+
+INT
+VmstatGetWorkQueueStatistics (
+    PWORK_QUEUE_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets the DPC and system work queue statistics.
+
+Arguments:
+
+    Statistics - Supplies a pointer where the statistics will be returned.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    INT Error;
+    UINTN Size;
+    KSTATUS Status;
+
+    memset(Statistics, 0, sizeof(WORK_QUEUE_STATISTICS));
+    Statistics->Version = WORK_QUEUE_STATISTICS_VERSION;
+    Size = sizeof(WORK_QUEUE_STATISTICS);
+    Status = OsGetSetSystemInformation(SystemInformationKe,
+                                       KeInformationWorkQueueStatistics,
+                                       Statistics,
+                                       &Size,
+                                       FALSE);
+
+    if (!KSUCCESS(Status)) {
+        Error = ClConvertKstatusToErrorNumber(Status);
+        fprintf(stderr,
+                "Error: failed to get work queue statistics: status %d: "
+                "%s.\n",
+                Status,
+                strerror(Error));
+
+        return Error;
+    }
+
+    return 0;
+}
+
+ULONGLONG
+VmstatTicksToMicroseconds (
+    ULONGLONG Ticks,
+    ULONGLONG Frequency
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a time counter tick count into microseconds.
+
+Arguments:
+
+    Ticks - Supplies the number of time counter ticks.
+
+    Frequency - Supplies the time counter frequency in Hertz.
+
+Return Value:
+
+    Returns the number of microseconds, or the raw tick count if the
+    frequency is unknown.
+
+--*/
+
+{
+
+    if (Frequency == 0) {
+        return Ticks;
+    }
+
+    return ((Ticks / Frequency) * MICROSECONDS_PER_SECOND) +
+           (((Ticks % Frequency) * MICROSECONDS_PER_SECOND) / Frequency);
+}
+
+PMM_POOL_TAG_STATISTICS
+VmstatGetPoolTagSnapshot (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a snapshot of the kernel pool tag statistics.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the snapshot on success. The caller is responsible
+    for freeing this memory.
+
+    NULL on failure, with errno set.
+
+--*/
+
+{
+
+    UINTN Size;
+    PMM_POOL_TAG_STATISTICS Snapshot;
+    KSTATUS Status;
+
+    Size = sizeof(MM_POOL_TAG_STATISTICS);
+    while (TRUE) {
+        Snapshot = malloc(Size);
+        if (Snapshot == NULL) {
+            return NULL;
+        }
+
+        memset(Snapshot, 0, sizeof(MM_POOL_TAG_STATISTICS));
+        Snapshot->Version = MM_POOL_TAG_STATISTICS_VERSION;
+        Status = OsGetSetSystemInformation(SystemInformationMm,
+                                           MmInformationPoolTagStatistics,
+                                           Snapshot,
+                                           &Size,
+                                           FALSE);
+
+        if (KSUCCESS(Status)) {
+            break;
+        }
+
+        free(Snapshot);
+        if (Status != STATUS_BUFFER_TOO_SMALL) {
+            errno = ClConvertKstatusToErrorNumber(Status);
+            fprintf(stderr,
+                    "Error: failed to get pool tag statistics: status %d: "
+                    "%s.\n",
+                    Status,
+                    strerror(errno));
+
+            return NULL;
+        }
+    }
+
+    return Snapshot;
+}
+
+PMM_POOL_TAG_STATISTIC
+VmstatFindPoolTag (
+    PMM_POOL_TAG_STATISTICS Snapshot,
+    PMM_POOL_TAG_STATISTIC Tag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the entry for the same tag and pool in another
+    snapshot.
+
+Arguments:
+
+    Snapshot - Supplies a pointer to the snapshot to search.
+
+    Tag - Supplies a pointer to the tag statistics to look for.
+
+Return Value:
+
+    Returns a pointer to the matching entry on success.
+
+    NULL if the tag was not in use when the snapshot was taken.
+
+--*/
+
+{
+
+    ULONG TagIndex;
+    PMM_POOL_TAG_STATISTIC Tags;
+
+    Tags = (PMM_POOL_TAG_STATISTIC)(Snapshot + 1);
+    for (TagIndex = 0; TagIndex < Snapshot->TagCount; TagIndex += 1) {
+        if ((Tags[TagIndex].Tag == Tag->Tag) &&
+            (Tags[TagIndex].PoolType == Tag->PoolType)) {
+
+            return &(Tags[TagIndex]);
+        }
+    }
+
+    return NULL;
+}
+
+VOID
+VmstatFormatTag (
+    ULONG Tag,
+    PSTR Buffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a pool tag into its four character form.
+
+Arguments:
+
+    Tag - Supplies the tag to convert.
+
+    Buffer - Supplies a pointer to a buffer of at least five characters where
+        the null terminated tag name is returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    CHAR Character;
+    ULONG Index;
+
+    for (Index = 0; Index < sizeof(ULONG); Index += 1) {
+        Character = (Tag >> (Index * BITS_PER_BYTE)) & 0xFF;
+        if ((Character < ' ') || (Character > '~')) {
+            Character = '.';
+        }
+
+        Buffer[Index] = Character;
+    }
+
+    Buffer[Index] = '\0';
+    return;
+}
+
+int
+VmstatCompareTagsBySize (
+    const void *Left,
+    const void *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two pool tag statistics by live size, largest
+    first, for the qsort function.
+
+Arguments:
+
+    Left - Supplies a pointer to the left tag statistics.
+
+    Right - Supplies a pointer to the right tag statistics.
+
+Return Value:
+
+    Less than zero if the left tag should come first.
+
+    Zero if the two are equal.
+
+    Greater than zero if the right tag should come first.
+
+--*/
+
+{
+
+    const MM_POOL_TAG_STATISTIC *LeftTag;
+    const MM_POOL_TAG_STATISTIC *RightTag;
+
+    LeftTag = Left;
+    RightTag = Right;
+    if (LeftTag->ActiveSize > RightTag->ActiveSize) {
+        return -1;
+    }
+
+    if (LeftTag->ActiveSize < RightTag->ActiveSize) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+VmstatCompareTagDeltas (
+    const void *Left,
+    const void *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two pool tag deltas by growth, largest first, for
+    the qsort function. Tags that grew the same amount are ordered by how
+    many bytes they allocated during the last interval.
+
+Arguments:
+
+    Left - Supplies a pointer to the left tag delta.
+
+    Right - Supplies a pointer to the right tag delta.
+
+Return Value:
+
+    Less than zero if the left tag should come first.
+
+    Zero if the two are equal.
+
+    Greater than zero if the right tag should come first.
+
+--*/
+
+{
+
+    const VMSTAT_TAG_DELTA *LeftDelta;
+    const VMSTAT_TAG_DELTA *RightDelta;
+
+    LeftDelta = Left;
+    RightDelta = Right;
+    if (LeftDelta->Growth > RightDelta->Growth) {
+        return -1;
+    }
+
+    if (LeftDelta->Growth < RightDelta->Growth) {
+        return 1;
+    }
+
+    if (LeftDelta->Bytes > RightDelta->Bytes) {
+        return -1;
+    }
+
+    if (LeftDelta->Bytes < RightDelta->Bytes) {
+        return 1;
+    }
+
+    return 0;
+}
+
@@ -55,6 +55,13 @@ Module Name:
 
 #define FAT_ZERO_BUFFER_SIZE (512 * 1024)
 
+//
+// Define the number of FAT windows to add to the free cluster map at a time
+// while it is built in the background.
+//
+
+#define FAT_FREE_MAP_BATCH_SIZE 8
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -236,6 +243,11 @@ FatpDestroyVolume (
     PFATFS_VOLUME Volume
     );
 
+VOID
+FatpBuildFreeMapWorker (
+    PVOID Parameter
+    );
+
 VOID
 FatpVolumeAddReference (
     PFATFS_VOLUME Volume
@@ -578,6 +590,23 @@ Return Value:
     FatVolume->ReferenceCount = 1;
     FatVolume->Attached = TRUE;
 
+    //
+    // Build the free cluster map in the background. Until it's done,
+    // allocations fall back to scanning the FAT. The work item holds a
+    // reference on the volume.
+    //
+
+    FatpVolumeAddReference(FatVolume);
+    Status = KeCreateAndQueueWorkItem(NULL,
+                                      WorkPriorityNormal,
+                                      FatpBuildFreeMapWorker,
+                                      FatVolume);
+
+    if (!KSUCCESS(Status)) {
+        FatpVolumeReleaseReference(FatVolume);
+        Status = STATUS_SUCCESS;
+    }
+
 AddDeviceEnd:
     if (!KSUCCESS(Status)) {
         if (FatVolume != NULL) {
@@ -1673,6 +1702,54 @@ Return Value:
     return;
 }
 
+VOID
+FatpBuildFreeMapWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds the free cluster map for a newly mounted volume a few
+    windows at a time, stopping early if the volume is removed.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the FAT FS volume. The work item owns a
+        reference on the volume.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    KSTATUS Status;
+    PFATFS_VOLUME Volume;
+
+    Volume = (PFATFS_VOLUME)Parameter;
+    Status = STATUS_MORE_PROCESSING_REQUIRED;
+    while ((Status == STATUS_MORE_PROCESSING_REQUIRED) &&
+           (Volume->Attached != FALSE)) {
+
+        Status = FatBuildFreeClusterMap(Volume->VolumeToken,
+                                        FAT_FREE_MAP_BATCH_SIZE);
+    }
+
+    if ((!KSUCCESS(Status)) &&
+        (Status != STATUS_MORE_PROCESSING_REQUIRED) &&
+        (Status != STATUS_NOT_SUPPORTED)) {
+
+        RtlDebugPrint("Fat: failed to build free cluster map: %d\n", Status);
+    }
+
+    FatpVolumeReleaseReference(Volume);
+    return;
+}
+
 VOID
 FatpVolumeAddReference (
     PFATFS_VOLUME Volume
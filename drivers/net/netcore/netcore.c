@@ -30,6 +30,7 @@ Module Name:
 //
 
 #include <minoca/kernel/driver.h>
+#include <minoca/kernel/sp.h>
 #include "netcore.h"
 #include "ethernet.h"
 
@@ -1196,6 +1197,13 @@ Return Value:
 
 {
 
+    SpTraceEvent(SP_TRACE_FLAG_NETWORK,
+                 SpTraceEventNetworkReceive,
+                 Packet->FooterOffset - Packet->DataOffset,
+                 (UINTN)Link,
+                 0,
+                 0);
+
     //
     // Call the data link layer to process the packet.
     //
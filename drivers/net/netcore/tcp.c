@@ -635,6 +635,8 @@ Return Value:
     }
 
     NetTcpTimerPeriod = KeConvertMicrosecondsToTimeTicks(TCP_TIMER_PERIOD);
+    KeSetTimerSlack(NetTcpTimer,
+                    KeConvertMicrosecondsToTimeTicks(TCP_TIMER_SLACK));
 
     ASSERT(NetTcpKeepAliveTimer == NULL);
 
@@ -644,6 +646,9 @@ Return Value:
         goto TcpInitializeEnd;
     }
 
+    KeSetTimerSlack(NetTcpKeepAliveTimer,
+                    KeConvertMicrosecondsToTimeTicks(TCP_KEEP_ALIVE_SLACK));
+
     //
     // Create the worker thread.
     //
@@ -132,6 +132,14 @@ Module Name:
 
 #define TCP_TIMER_PERIOD (250 * MICROSECONDS_PER_MILLISECOND)
 
+//
+// Define how late TCP's periodic timer and the keep alive timer may expire so
+// that they can be batched with other timers, in microseconds.
+//
+
+#define TCP_TIMER_SLACK (50 * MICROSECONDS_PER_MILLISECOND)
+#define TCP_KEEP_ALIVE_SLACK (1 * MICROSECONDS_PER_SECOND)
+
 //
 // Define the length in seconds of the default timeout. This is used as a
 // timeout in the time-wait state and when waiting for a SYN or FIN to be
@@ -45,9 +45,17 @@ Module Name:
 #define SPECIAL_DEVICE_RANDOM_NAME "random"
 #define SPECIAL_DEVICE_URANDOM_NAME "urandom"
 #define SPECIAL_DEVICE_CURRENT_TERMINAL_NAME "tty"
+#define SPECIAL_DEVICE_MEMORY_PRESSURE_NAME "mempressure"
 
 #define SPECIAL_URANDOM_BUFFER_SIZE 2048
 
+//
+// Define how often the memory pressure thread rechecks the warning levels in
+// case it missed a pulse of the memory manager's warning events.
+//
+
+#define SPECIAL_MEMORY_PRESSURE_REFRESH_INTERVAL 1000
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -59,6 +67,7 @@ typedef enum _SPECIAL_DEVICE_TYPE {
     SpecialDeviceFull,
     SpecialDevicePseudoRandom,
     SpecialDeviceCurrentTerminal,
+    SpecialDeviceMemoryPressure,
 } SPECIAL_DEVICE_TYPE, *PSPECIAL_DEVICE_TYPE;
 
 /*++
@@ -89,6 +98,44 @@ typedef struct _SPECIAL_PSEUDO_RANDOM_DEVICE {
 
 /*++
 
+Structure Description:
+
+    This structure defines the context for the memory pressure device.
+
+Members:
+
+    Lock - Stores a pointer to the lock protecting the level, change count,
+        open count, and I/O state.
+
+    IoState - Stores a pointer to the I/O object state shared by all opens of
+        the device, or NULL if the device is not currently open.
+
+    OpenCount - Stores the number of open handles to the device.
+
+    Level - Stores the current overall memory pressure level. See
+        MEMORY_PRESSURE_* definitions.
+
+    ChangeCount - Stores the number of times the level has changed.
+
+    ThreadStarted - Stores a boolean indicating whether or not the thread that
+        watches the memory manager's warning events has been launched.
+
+    Stop - Stores a boolean indicating that the watching thread should exit.
+
+--*/
+
+typedef struct _SPECIAL_MEMORY_PRESSURE_DEVICE {
+    PQUEUED_LOCK Lock;
+    PIO_OBJECT_STATE IoState;
+    ULONG OpenCount;
+    ULONG Level;
+    ULONGLONG ChangeCount;
+    BOOL ThreadStarted;
+    volatile BOOL Stop;
+} SPECIAL_MEMORY_PRESSURE_DEVICE, *PSPECIAL_MEMORY_PRESSURE_DEVICE;
+
+/*++
+
 Structure Description:
 
     This structure defines the context for a special device.
@@ -111,6 +158,7 @@ typedef struct _SPECIAL_DEVICE {
     volatile ULONG ReferenceCount;
     union {
         PSPECIAL_PSEUDO_RANDOM_DEVICE PseudoRandom;
+        PSPECIAL_MEMORY_PRESSURE_DEVICE MemoryPressure;
     } U;
 
 } SPECIAL_DEVICE, *PSPECIAL_DEVICE;
@@ -212,6 +260,44 @@ SpecialPseudoRandomGetBytes (
     UINTN Length
     );
 
+KSTATUS
+SpecialMemoryPressureStartDevice (
+    PSPECIAL_DEVICE Device
+    );
+
+KSTATUS
+SpecialMemoryPressureOpen (
+    PSPECIAL_DEVICE Device,
+    PIO_OBJECT_STATE IoState
+    );
+
+VOID
+SpecialMemoryPressureClose (
+    PSPECIAL_DEVICE Device
+    );
+
+KSTATUS
+SpecialPerformMemoryPressureIo (
+    PSPECIAL_DEVICE Device,
+    PIRP Irp
+    );
+
+VOID
+SpecialMemoryPressureThread (
+    PVOID Parameter
+    );
+
+VOID
+SpecialMemoryPressureUpdate (
+    PSPECIAL_DEVICE Device,
+    PMEMORY_PRESSURE_STATUS Status
+    );
+
+ULONG
+SpecialConvertMemoryWarningLevel (
+    MEMORY_WARNING_LEVEL WarningLevel
+    );
+
 VOID
 SpecialDeviceAddReference (
     PSPECIAL_DEVICE Device
@@ -372,6 +458,12 @@ Return Value:
 
         DeviceType = SpecialDeviceCurrentTerminal;
 
+    } else if (IoAreDeviceIdsEqual(DeviceId,
+                                   SPECIAL_DEVICE_MEMORY_PRESSURE_NAME) !=
+               FALSE) {
+
+        DeviceType = SpecialDeviceMemoryPressure;
+
     } else {
         RtlDebugPrint("Special device %s not recognized.\n", DeviceId);
         Status = STATUS_NOT_SUPPORTED;
@@ -409,6 +501,35 @@ Return Value:
 
         PseudoRandom->Interface.DeviceToken = Context;
 
+    //
+    // The memory pressure device is consulted when memory is tight, so keep
+    // it out of paged pool.
+    //
+
+    } else if (DeviceType == SpecialDeviceMemoryPressure) {
+        AllocationSize = sizeof(SPECIAL_DEVICE) +
+                         sizeof(SPECIAL_MEMORY_PRESSURE_DEVICE);
+
+        Context = MmAllocateNonPagedPool(AllocationSize,
+                                         SPECIAL_DEVICE_ALLOCATION_TAG);
+
+        if (Context == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto AddDeviceEnd;
+        }
+
+        RtlZeroMemory(Context, AllocationSize);
+        Context->U.MemoryPressure =
+                               (PSPECIAL_MEMORY_PRESSURE_DEVICE)(Context + 1);
+
+        Context->U.MemoryPressure->Lock = KeCreateQueuedLock();
+        if (Context->U.MemoryPressure->Lock == NULL) {
+            MmFreeNonPagedPool(Context);
+            Context = NULL;
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto AddDeviceEnd;
+        }
+
     //
     // Create a regular special device.
     //
@@ -495,6 +616,9 @@ Return Value:
             if (Device->Type == SpecialDevicePseudoRandom) {
                 Status = SpecialPseudoRandomStartDevice(Device, Irp);
 
+            } else if (Device->Type == SpecialDeviceMemoryPressure) {
+                Status = SpecialMemoryPressureStartDevice(Device);
+
             } else {
                 Status = STATUS_SUCCESS;
             }
@@ -513,6 +637,10 @@ Return Value:
             if (Device->Type == SpecialDevicePseudoRandom) {
                 Status = SpecialPseudoRandomRemoveDevice(Device, Irp);
 
+            } else if (Device->Type == SpecialDeviceMemoryPressure) {
+                Device->U.MemoryPressure->Stop = TRUE;
+                Status = STATUS_SUCCESS;
+
             } else {
                 Status = STATUS_SUCCESS;
             }
@@ -583,6 +711,22 @@ Return Value:
         Status = IoOpenControllingTerminal(Irp->U.Open.IoHandle);
         IoCompleteIrp(SpecialDriver, Irp, Status);
 
+    //
+    // The memory pressure device reports the pressure level through its I/O
+    // state.
+    //
+
+    } else if (Device->Type == SpecialDeviceMemoryPressure) {
+
+        ASSERT(Irp->U.Open.IoState != NULL);
+
+        Status = SpecialMemoryPressureOpen(Device, Irp->U.Open.IoState);
+        if (KSUCCESS(Status)) {
+            SpecialDeviceAddReference(Device);
+        }
+
+        IoCompleteIrp(SpecialDriver, Irp, Status);
+
     //
     // Open a data sink device.
     //
@@ -644,6 +788,10 @@ Return Value:
 
     ASSERT(Device->Type != SpecialDeviceCurrentTerminal);
 
+    if (Device->Type == SpecialDeviceMemoryPressure) {
+        SpecialMemoryPressureClose(Device);
+    }
+
     SpecialDeviceReleaseReference(Device);
     IoCompleteIrp(SpecialDriver, Irp, STATUS_SUCCESS);
     return;
@@ -754,6 +902,15 @@ Return Value:
         Status = SpecialPerformPseudoRandomIo(Device, Irp);
         break;
 
+    //
+    // The memory pressure device produces a status structure when read, and
+    // does not accept input.
+    //
+
+    case SpecialDeviceMemoryPressure:
+        Status = SpecialPerformMemoryPressureIo(Device, Irp);
+        break;
+
     default:
 
         ASSERT(FALSE);
@@ -1291,6 +1448,418 @@ Return Value:
     return;
 }
 
+KSTATUS
+SpecialMemoryPressureStartDevice (
+    PSPECIAL_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts the memory pressure device by launching the thread
+    that watches the memory manager's warning levels.
+
+Arguments:
+
+    Device - Supplies a pointer to the special device context.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PSPECIAL_MEMORY_PRESSURE_DEVICE Pressure;
+    KSTATUS Status;
+
+    ASSERT(Device->Type == SpecialDeviceMemoryPressure);
+
+    Pressure = Device->U.MemoryPressure;
+    if (Pressure->ThreadStarted != FALSE) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // The thread holds a reference on the device until it exits.
+    //
+
+    Pressure->Stop = FALSE;
+    SpecialDeviceAddReference(Device);
+    Status = PsCreateKernelThread(SpecialMemoryPressureThread,
+                                  Device,
+                                  "SpecialMemoryPressureThread");
+
+    if (!KSUCCESS(Status)) {
+        SpecialDeviceReleaseReference(Device);
+        return Status;
+    }
+
+    Pressure->ThreadStarted = TRUE;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+SpecialMemoryPressureOpen (
+    PSPECIAL_DEVICE Device,
+    PIO_OBJECT_STATE IoState
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles an open of the memory pressure device, adopting the
+    I/O object state so that it reflects the current pressure level.
+
+Arguments:
+
+    Device - Supplies a pointer to the special device context.
+
+    IoState - Supplies a pointer to the I/O object state for the open.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PSPECIAL_MEMORY_PRESSURE_DEVICE Pressure;
+    KSTATUS Status;
+
+    Pressure = Device->U.MemoryPressure;
+    Status = STATUS_SUCCESS;
+    KeAcquireQueuedLock(Pressure->Lock);
+
+    //
+    // The first open of a file object sets up its I/O state. Device file
+    // objects are not created with a high priority read event, but critical
+    // pressure is reported through it, so create one now before anyone can
+    // wait on the state.
+    //
+
+    if (Pressure->IoState != IoState) {
+
+        ASSERT(Pressure->OpenCount == 0);
+
+        if (IoState->ReadHighPriorityEvent == NULL) {
+            IoState->ReadHighPriorityEvent = KeCreateEvent(NULL);
+            if (IoState->ReadHighPriorityEvent == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto MemoryPressureOpenEnd;
+            }
+        }
+
+        Pressure->IoState = IoState;
+        IoSetIoObjectState(IoState,
+                           POLL_EVENT_IN | POLL_EVENT_IN_HIGH_PRIORITY,
+                           FALSE);
+
+        if (Pressure->Level >= MEMORY_PRESSURE_LOW) {
+            IoSetIoObjectState(IoState, POLL_EVENT_IN, TRUE);
+        }
+
+        if (Pressure->Level >= MEMORY_PRESSURE_CRITICAL) {
+            IoSetIoObjectState(IoState, POLL_EVENT_IN_HIGH_PRIORITY, TRUE);
+        }
+    }
+
+    Pressure->OpenCount += 1;
+
+MemoryPressureOpenEnd:
+    KeReleaseQueuedLock(Pressure->Lock);
+    return Status;
+}
+
+VOID
+SpecialMemoryPressureClose (
+    PSPECIAL_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles a close of the memory pressure device. Once the last
+    handle is closed, the file object and its I/O state may be destroyed, so
+    the device stops updating it.
+
+Arguments:
+
+    Device - Supplies a pointer to the special device context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PSPECIAL_MEMORY_PRESSURE_DEVICE Pressure;
+
+    Pressure = Device->U.MemoryPressure;
+    KeAcquireQueuedLock(Pressure->Lock);
+
+    ASSERT(Pressure->OpenCount != 0);
+
+    Pressure->OpenCount -= 1;
+    if (Pressure->OpenCount == 0) {
+        Pressure->IoState = NULL;
+    }
+
+    KeReleaseQueuedLock(Pressure->Lock);
+    return;
+}
+
+KSTATUS
+SpecialPerformMemoryPressureIo (
+    PSPECIAL_DEVICE Device,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs I/O on the memory pressure device. Reads return a
+    memory pressure status structure. Writes are not supported.
+
+Arguments:
+
+    Device - Supplies a pointer to the special device context.
+
+    Irp - Supplies a pointer to the I/O request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    MEMORY_PRESSURE_STATUS PressureStatus;
+    KSTATUS Status;
+
+    ASSERT(Device->Type == SpecialDeviceMemoryPressure);
+
+    Irp->U.ReadWrite.IoBytesCompleted = 0;
+    if (Irp->MinorCode != IrpMinorIoRead) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (Irp->U.ReadWrite.IoSizeInBytes < sizeof(MEMORY_PRESSURE_STATUS)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    SpecialMemoryPressureUpdate(Device, &PressureStatus);
+    Status = MmCopyIoBufferData(Irp->U.ReadWrite.IoBuffer,
+                                &PressureStatus,
+                                0,
+                                sizeof(MEMORY_PRESSURE_STATUS),
+                                TRUE);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Irp->U.ReadWrite.IoBytesCompleted = sizeof(MEMORY_PRESSURE_STATUS);
+    return STATUS_SUCCESS;
+}
+
+VOID
+SpecialMemoryPressureThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the thread that keeps the memory pressure device's
+    I/O state in sync with the memory manager's warning levels.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the memory pressure special device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PSPECIAL_DEVICE Device;
+    PSPECIAL_MEMORY_PRESSURE_DEVICE Pressure;
+    PVOID WaitObjectArray[2];
+
+    Device = Parameter;
+    Pressure = Device->U.MemoryPressure;
+    WaitObjectArray[0] = MmGetPhysicalMemoryWarningEvent();
+    WaitObjectArray[1] = MmGetVirtualMemoryWarningEvent();
+
+    //
+    // The warning events are pulsed, so a change that happens while the
+    // levels are being evaluated would be missed. Wake up periodically to
+    // catch those.
+    //
+
+    while (Pressure->Stop == FALSE) {
+        SpecialMemoryPressureUpdate(Device, NULL);
+        ObWaitOnObjects(WaitObjectArray,
+                        2,
+                        0,
+                        SPECIAL_MEMORY_PRESSURE_REFRESH_INTERVAL,
+                        NULL,
+                        NULL);
+    }
+
+    Pressure->ThreadStarted = FALSE;
+    SpecialDeviceReleaseReference(Device);
+    return;
+}
+
+VOID
+SpecialMemoryPressureUpdate (
+    PSPECIAL_DEVICE Device,
+    PMEMORY_PRESSURE_STATUS Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine samples the memory manager's warning levels, updates the
+    memory pressure device's I/O state if the overall level changed, and
+    optionally returns the full status.
+
+Arguments:
+
+    Device - Supplies a pointer to the memory pressure special device.
+
+    Status - Supplies an optional pointer where the current memory pressure
+        status will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG ClearEvents;
+    ULONG Level;
+    ULONG PhysicalLevel;
+    PSPECIAL_MEMORY_PRESSURE_DEVICE Pressure;
+    ULONG SetEvents;
+    ULONG VirtualLevel;
+
+    Pressure = Device->U.MemoryPressure;
+    PhysicalLevel = SpecialConvertMemoryWarningLevel(
+                                           MmGetPhysicalMemoryWarningLevel());
+
+    VirtualLevel = SpecialConvertMemoryWarningLevel(
+                                            MmGetVirtualMemoryWarningLevel());
+
+    Level = PhysicalLevel;
+    if (VirtualLevel > Level) {
+        Level = VirtualLevel;
+    }
+
+    KeAcquireQueuedLock(Pressure->Lock);
+    if (Level != Pressure->Level) {
+        Pressure->Level = Level;
+        Pressure->ChangeCount += 1;
+        if (Pressure->IoState != NULL) {
+            SetEvents = 0;
+            if (Level >= MEMORY_PRESSURE_LOW) {
+                SetEvents |= POLL_EVENT_IN;
+            }
+
+            if (Level >= MEMORY_PRESSURE_CRITICAL) {
+                SetEvents |= POLL_EVENT_IN_HIGH_PRIORITY;
+            }
+
+            ClearEvents = (POLL_EVENT_IN | POLL_EVENT_IN_HIGH_PRIORITY) &
+                          ~SetEvents;
+
+            if (ClearEvents != 0) {
+                IoSetIoObjectState(Pressure->IoState, ClearEvents, FALSE);
+            }
+
+            if (SetEvents != 0) {
+                IoSetIoObjectState(Pressure->IoState, SetEvents, TRUE);
+            }
+        }
+    }
+
+    if (Status != NULL) {
+        RtlZeroMemory(Status, sizeof(MEMORY_PRESSURE_STATUS));
+        Status->Version = MEMORY_PRESSURE_STATUS_VERSION;
+        Status->Level = Level;
+        Status->PhysicalLevel = PhysicalLevel;
+        Status->VirtualLevel = VirtualLevel;
+        Status->ChangeCount = Pressure->ChangeCount;
+    }
+
+    KeReleaseQueuedLock(Pressure->Lock);
+    if (Status != NULL) {
+        Status->TotalPhysicalPages = MmGetTotalPhysicalPages();
+        Status->FreePhysicalPages = MmGetTotalFreePhysicalPages();
+        Status->TotalVirtualBytes = MmGetTotalVirtualMemory();
+        Status->FreeVirtualBytes = MmGetFreeVirtualMemory();
+    }
+
+    return;
+}
+
+ULONG
+SpecialConvertMemoryWarningLevel (
+    MEMORY_WARNING_LEVEL WarningLevel
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts a memory manager warning level into a memory
+    pressure level. Warning level 1 is the most severe.
+
+Arguments:
+
+    WarningLevel - Supplies the memory warning level to convert.
+
+Return Value:
+
+    Returns the corresponding memory pressure level. See MEMORY_PRESSURE_*
+    definitions.
+
+--*/
+
+{
+
+    switch (WarningLevel) {
+    case MemoryWarningLevel1:
+        return MEMORY_PRESSURE_CRITICAL;
+
+    case MemoryWarningLevel2:
+        return MEMORY_PRESSURE_LOW;
+
+    default:
+        break;
+    }
+
+    return MEMORY_PRESSURE_NONE;
+}
+
 VOID
 SpecialDeviceAddReference (
     PSPECIAL_DEVICE Device
@@ -1382,9 +1951,20 @@ Return Value:
 
 {
 
-    ASSERT(Device->U.PseudoRandom->InterfaceRegistered == FALSE);
-
     if (Device->Type == SpecialDevicePseudoRandom) {
+
+        ASSERT(Device->U.PseudoRandom->InterfaceRegistered == FALSE);
+
+        MmFreeNonPagedPool(Device);
+
+    } else if (Device->Type == SpecialDeviceMemoryPressure) {
+
+        ASSERT(Device->U.MemoryPressure->OpenCount == 0);
+
+        if (Device->U.MemoryPressure->Lock != NULL) {
+            KeDestroyQueuedLock(Device->U.MemoryPressure->Lock);
+        }
+
         MmFreeNonPagedPool(Device);
 
     } else {
@@ -186,6 +186,15 @@ Module Name:
 
 #define TIMER_FEATURE_ABSOLUTE 0x00000100
 
+//
+// Set this flag if the timer's counter can be read directly from user mode
+// with an architectural instruction (such as rdtsc on x86 or the virtual count
+// register on ARM). Only 64-bit timers whose counts agree across processors
+// should set this flag.
+//
+
+#define TIMER_FEATURE_USER_READABLE 0x00000200
+
 //
 // Define calendar timer features.
 //
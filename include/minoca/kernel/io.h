@@ -244,6 +244,15 @@ Module Name:
 
 #define OPEN_FLAG_ASYNCHRONOUS 0x00000800
 
+//
+// Set this flag to have reads and writes on a regular file bypass the page
+// cache and go directly between the caller's buffer and the backing device.
+// The file offset, transfer size, and buffer must be aligned to the device's
+// block size.
+//
+
+#define OPEN_FLAG_DIRECT 0x00001000
+
 //
 // Set this flag if a file should be atomically unlinked after creation so that
 // it never appears in the namespace. The call will fail if the file already
@@ -5542,6 +5551,32 @@ Return Value:
 
 --*/
 
+INTN
+IoSysIoRingControl (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the I/O ring system call, which creates and
+    destroys I/O rings and submits batches of operations to them.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
 INTN
 IoSysCreatePipe (
     PVOID SystemCallParameter
@@ -6466,6 +6501,29 @@ Return Value:
 
 --*/
 
+VOID
+IoDestroyProcessIoRings (
+    PKPROCESS Process
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys all I/O rings owned by the given process, waiting
+    for any operations still in flight to finish.
+
+Arguments:
+
+    Process - Supplies a pointer to the process whose rings should be
+        destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 IoCopyProcessHandles (
     PKPROCESS SourceProcess,
@@ -171,6 +171,41 @@ Module Name:
 
 #define DPC_FLAG_QUEUED_ON_PROCESSOR 0x00000001
 
+//
+// Define the number of distinct call sites spin lock statistics can track.
+// This must be a power of two.
+//
+
+#define SPIN_LOCK_STATISTICS_SITE_COUNT 256
+
+//
+// Define user shared data time counter flags.
+//
+
+//
+// This flag is set if user mode can read the time counter hardware directly.
+// The time counter value is then the hardware counter plus the time counter
+// offset in the user shared data page.
+//
+
+#define USER_TIME_COUNTER_FLAG_USER_READABLE 0x00000001
+
+//
+// Define the system call statistics version and the number of buckets in each
+// system call's latency histogram. Bucket N counts calls that took between
+// 2^N and 2^(N+1) time counter ticks, and the last bucket counts everything
+// longer.
+//
+
+#define SYSTEM_CALL_STATISTICS_VERSION 2
+#define SYSTEM_CALL_HISTOGRAM_BUCKETS 32
+
+//
+// Define the current version of the work queue statistics structure.
+//
+
+#define WORK_QUEUE_STATISTICS_VERSION 2
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -246,6 +281,8 @@ typedef enum _KE_INFORMATION_TYPE {
     KeInformationProcessorUsage,
     KeInformationProcessorCount,
     KeInformationKernelCommandLine,
+    KeInformationSystemCallStatistics,
+    KeInformationWorkQueueStatistics,
 } KE_INFORMATION_TYPE, *PKE_INFORMATION_TYPE;
 
 typedef enum _SYSTEM_RESET_TYPE {
@@ -449,13 +486,40 @@ Structure Description:
 
     Lock - Stores the spin lock serializing access to the scheduling data.
 
-    Group - Stores the fixed head scheduling group for this processor.
+    Group - Stores the fixed head scheduling group for this processor. Its
+        ready thread count includes ready real-time threads.
+
+    RealTimeList - Stores the head of the list of ready real-time threads,
+        sorted from highest to lowest priority. Threads of equal priority are
+        in the order they should run.
+
+    RealTimeReadyCount - Stores the number of threads on the real-time list.
+
+    RealTimePeriodStart - Stores the processor counter value when the current
+        real-time throttling period began.
+
+    RealTimeUsed - Stores the number of processor counter ticks real-time
+        threads have run for during the current throttling period.
+
+    RealTimeRunStart - Stores the processor counter value when the running
+        real-time thread was last charged, or zero if a normal thread is
+        running.
+
+    RealTimeThrottled - Stores a boolean indicating whether real-time threads
+        have used up their runtime for this period, and must let normal
+        threads run until the period ends.
 
 --*/
 
 struct _SCHEDULER_DATA {
     KSPIN_LOCK Lock;
     SCHEDULER_GROUP_ENTRY Group;
+    LIST_ENTRY RealTimeList;
+    UINTN RealTimeReadyCount;
+    ULONGLONG RealTimePeriodStart;
+    ULONGLONG RealTimeUsed;
+    ULONGLONG RealTimeRunStart;
+    BOOL RealTimeThrottled;
 };
 
 /*++
@@ -557,6 +621,33 @@ typedef struct _PROCESSOR_IDENTIFICATION {
 
 /*++
 
+Structure Description:
+
+    This structure contains the counters for a single system call.
+
+Members:
+
+    Count - Stores the number of times the system call was made.
+
+    TotalTicks - Stores the total number of time counter ticks spent in the
+        system call, including time spent blocked.
+
+    MaxTicks - Stores the longest a single call took, in time counter ticks.
+
+    Histogram - Stores the latency histogram. See
+        SYSTEM_CALL_HISTOGRAM_BUCKETS.
+
+--*/
+
+typedef struct _SYSTEM_CALL_STATISTIC {
+    ULONGLONG Count;
+    ULONGLONG TotalTicks;
+    ULONGLONG MaxTicks;
+    ULONG Histogram[SYSTEM_CALL_HISTOGRAM_BUCKETS];
+} SYSTEM_CALL_STATISTIC, *PSYSTEM_CALL_STATISTIC;
+
+/*++
+
 Structure Description:
 
     This structure stores the current running state of a processor.
@@ -612,9 +703,12 @@ Structure Description:
 
     DpcInProgress - Stores a pointer to the currently executing DPC.
 
-    DpcLock - Stores the spin lock protecting the DPC list.
+    DpcLock - Stores the spin lock protecting the DPC list. It serializes
+        draining the list against cancellation; queuing a DPC does not acquire
+        it.
 
-    DpcList - Stores the list head of DPCs pending on this processor.
+    DpcList - Stores the list head of DPCs collected from the pending stack
+        but not yet run.
 
     DpcCount - Stores the total number of DPCS that have occurred on this
         processor.
@@ -651,6 +745,20 @@ Structure Description:
 
     CpuVersion - Stores the processor identification information for this CPU.
 
+    SystemCallStatistics - Stores a pointer to the array of system call
+        counters for system calls that completed on this processor, indexed by
+        system call number.
+
+    PendingDpcs - Stores the most recently queued DPC on the lock-free stack
+        of DPCs queued to this processor. Any processor may push onto it, and
+        the whole stack is taken at once when DPCs are collected.
+
+    DpcQueueTicks - Stores the total number of time counter ticks DPCs run
+        on this processor spent queued.
+
+    DpcMaxQueueTicks - Stores the longest time a DPC run on this processor
+        spent queued, in time counter ticks.
+
 --*/
 
 typedef struct _PROCESSOR_BLOCK PROCESSOR_BLOCK, *PPROCESSOR_BLOCK;
@@ -686,6 +794,10 @@ struct _PROCESSOR_BLOCK {
     PVOID SwapPage;
     UINTN NmiCount;
     PROCESSOR_IDENTIFICATION CpuVersion;
+    PSYSTEM_CALL_STATISTIC SystemCallStatistics;
+    volatile PDPC PendingDpcs;
+    ULONGLONG DpcQueueTicks;
+    ULONGLONG DpcMaxQueueTicks;
 };
 
 /*++
@@ -705,12 +817,24 @@ Structure Description:
 
     Usage - Stores the cycle counter usage information.
 
+    ClockInterruptCount - Stores the number of clock interrupts taken, which
+        is the number of times the processor was woken up by the clock.
+
+    TimerInterruptCount - Stores the number of times expired timers were
+        serviced on the processor.
+
+    CoalescedTimerCount - Stores the number of timers that were expired
+        before their deadline together with another timer, saving a wakeup.
+
 --*/
 
 typedef struct _PROCESSOR_USAGE_INFORMATION {
     UINTN ProcessorNumber;
     ULONGLONG CycleCounterFrequency;
     PROCESSOR_CYCLE_ACCOUNTING Usage;
+    ULONGLONG ClockInterruptCount;
+    ULONGLONG TimerInterruptCount;
+    ULONGLONG CoalescedTimerCount;
 } PROCESSOR_USAGE_INFORMATION, *PPROCESSOR_USAGE_INFORMATION;
 
 /*++
@@ -736,6 +860,96 @@ typedef struct _PROCESSOR_COUNT_INFORMATION {
 
 /*++
 
+Structure Description:
+
+    This structure defines a snapshot of the system call statistics, summed
+    across all processors. It is immediately followed in memory by an array
+    of SYSTEM_CALL_STATISTIC structures indexed by system call number.
+
+Members:
+
+    Version - Stores the structure version number. Set this to
+        SYSTEM_CALL_STATISTICS_VERSION.
+
+    SystemCallCount - Stores the number of system call statistics following
+        the structure.
+
+    TimeCounterFrequency - Stores the frequency of the time counter used to
+        measure latencies, in Hertz.
+
+--*/
+
+typedef struct _SYSTEM_CALL_STATISTICS {
+    ULONG Version;
+    ULONG SystemCallCount;
+    ULONGLONG TimeCounterFrequency;
+} SYSTEM_CALL_STATISTICS, *PSYSTEM_CALL_STATISTICS;
+
+/*++
+
+Structure Description:
+
+    This structure defines statistics for deferred work: DPCs summed across
+    all processors, and work items on the system work queue. Queue times are
+    measured from when the DPC or work item was queued to when it started
+    running.
+
+Members:
+
+    Version - Stores the structure version number. Set this to
+        WORK_QUEUE_STATISTICS_VERSION.
+
+    WorkerThreadCount - Stores the number of threads currently serving the
+        system work queue.
+
+    IdleWorkerThreadCount - Stores the number of system work queue threads
+        waiting for work.
+
+    MaxWorkerThreadCount - Stores the maximum number of threads the system
+        work queue will grow to.
+
+    TimeCounterFrequency - Stores the frequency of the time counter used to
+        measure queue times, in Hertz.
+
+    DpcCount - Stores the number of DPCs that were queued and later run.
+
+    DpcQueueTicks - Stores the total number of time counter ticks those DPCs
+        spent queued.
+
+    DpcMaxQueueTicks - Stores the longest time a DPC spent queued, in time
+        counter ticks.
+
+    WorkItemCount - Stores the number of work items the system work queue has
+        run.
+
+    WorkItemQueueTicks - Stores the total number of time counter ticks those
+        work items spent queued.
+
+    WorkItemMaxQueueTicks - Stores the longest time a work item spent queued,
+        in time counter ticks.
+
+    WorkItemAllocations - Stores the number of times creating and queuing a
+        work item had to allocate one because none were cached for reuse.
+
+--*/
+
+typedef struct _WORK_QUEUE_STATISTICS {
+    ULONG Version;
+    ULONG WorkerThreadCount;
+    ULONG IdleWorkerThreadCount;
+    ULONG MaxWorkerThreadCount;
+    ULONGLONG TimeCounterFrequency;
+    ULONGLONG DpcCount;
+    ULONGLONG DpcQueueTicks;
+    ULONGLONG DpcMaxQueueTicks;
+    ULONGLONG WorkItemCount;
+    ULONGLONG WorkItemQueueTicks;
+    ULONGLONG WorkItemMaxQueueTicks;
+    ULONGLONG WorkItemAllocations;
+} WORK_QUEUE_STATISTICS, *PWORK_QUEUE_STATISTICS;
+
+/*++
+
 Structure Description:
 
     This structure defines a queued lock. These locks can be used at or below
@@ -747,11 +961,16 @@ Structure Description:
 
     OwningThread - Stores a pointer to the thread that is holding the lock.
 
+    OwnerProcessor - Stores the number of the processor the owning thread
+        acquired the lock on. Waiters spin rather than block while the owner
+        is still running there.
+
 --*/
 
 typedef struct _QUEUED_LOCK {
     OBJECT_HEADER Header;
     PKTHREAD OwningThread;
+    volatile ULONG OwnerProcessor;
 } QUEUED_LOCK, *PQUEUED_LOCK;
 
 /*++
@@ -781,7 +1000,10 @@ Structure Description:
     State - Stores the current state of the shared-exclusive lock. See
         SHARED_EXCLUSIVE_LOCK_* definitions.
 
-    Event - Stores a pointer to the event that allows for blocking.
+    Event - Stores a pointer to the event that shared waiters block on.
+
+    ExclusiveEvent - Stores a pointer to the event that exclusive waiters
+        block on.
 
     ExclusiveWaiters - Stores the number of thread trying to acquire the lock
         exclusively.
@@ -789,13 +1011,22 @@ Structure Description:
     SharedWaiters - Stores the number of threads trying to acquire the lock
         shared.
 
+    ExclusiveOwner - Stores a pointer to the thread holding the lock
+        exclusively, if any.
+
+    OwnerProcessor - Stores the number of the processor the exclusive owner
+        acquired the lock on.
+
 --*/
 
 typedef struct _SHARED_EXCLUSIVE_LOCK {
     volatile ULONG State;
     PKEVENT Event;
+    PKEVENT ExclusiveEvent;
     volatile ULONG ExclusiveWaiters;
     volatile ULONG SharedWaiters;
+    PKTHREAD volatile ExclusiveOwner;
+    volatile ULONG OwnerProcessor;
 } SHARED_EXCLUSIVE_LOCK, *PSHARED_EXCLUSIVE_LOCK;
 
 /*++
@@ -922,6 +1153,11 @@ Structure Description:
     Flags - Stores a bitmask of flags for the DPC. See DPC_FLAG_* for
         definitions.
 
+    NextPending - Stores a pointer to the next older DPC while this DPC is on
+        a processor's pending stack.
+
+    QueueTime - Stores the time counter value when the DPC was queued.
+
 --*/
 
 struct _DPC {
@@ -930,7 +1166,9 @@ struct _DPC {
     PVOID UserData;
     ULONG Processor;
     volatile ULONG UseCount;
-    ULONG Flags;
+    volatile ULONG Flags;
+    PDPC NextPending;
+    ULONGLONG QueueTime;
 };
 
 /*++
@@ -981,6 +1219,17 @@ Structure Description:
     ProcessorFeatures - Stores a bitfield of architecture-specific feature
         flags.
 
+    TimeCounterSequence - Stores a sequence number protecting the time counter
+        flags and offset. It is odd while an update is in progress, and is
+        incremented again once the update is complete. Readers must retry if
+        it was odd or changed across their read.
+
+    TimeCounterFlags - Stores a bitfield of flags describing how user mode can
+        read the time counter. See USER_TIME_COUNTER_FLAG_* definitions.
+
+    TimeCounterOffset - Stores the value to add to the raw hardware counter to
+        get the time counter value, if the time counter is user readable.
+
 --*/
 
 typedef struct _USER_SHARED_DATA {
@@ -996,8 +1245,45 @@ typedef struct _USER_SHARED_DATA {
     volatile ULONGLONG TickCount2;
     volatile ULONG CurrentTimeZoneDataSize;
     ULONG ProcessorFeatures;
+    volatile ULONG TimeCounterSequence;
+    volatile ULONG TimeCounterFlags;
+    volatile ULONGLONG TimeCounterOffset;
 } USER_SHARED_DATA, *PUSER_SHARED_DATA;
 
+/*++
+
+Structure Description:
+
+    This structure stores spin lock statistics for a single call site. These
+    are only collected while KeSpinLockStatisticsEnabled is set, and are meant
+    to be viewed from the kernel debugger.
+
+Members:
+
+    Site - Stores the return address of the call to acquire the spin lock.
+
+    AcquireCount - Stores the number of times the lock was acquired from this
+        site.
+
+    ContendedCount - Stores the number of acquisitions that had to wait for
+        another owner.
+
+    SpinCycles - Stores the total number of processor counter cycles spent
+        waiting for the lock.
+
+    MaxHoldCycles - Stores the longest time the lock was held after being
+        acquired from this site, in processor counter cycles.
+
+--*/
+
+typedef struct _SPIN_LOCK_STATISTICS {
+    PVOID Site;
+    ULONGLONG AcquireCount;
+    ULONGLONG ContendedCount;
+    ULONGLONG SpinCycles;
+    ULONGLONG MaxHoldCycles;
+} SPIN_LOCK_STATISTICS, *PSPIN_LOCK_STATISTICS;
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -2017,6 +2303,36 @@ Return Value:
 
 --*/
 
+KERNEL_API
+VOID
+KeSetTimerSlack (
+    PKTIMER Timer,
+    ULONGLONG Slack
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets how late a timer is allowed to expire so that its
+    expiration can be batched with other timers. Without an explicit slack,
+    timers queued from a thread use the owning process' default timer slack.
+    This takes effect the next time the timer is queued, and must not be
+    called while the timer is queued.
+
+Arguments:
+
+    Timer - Supplies a pointer to the timer.
+
+    Slack - Supplies the number of time counter ticks past its due time the
+        timer may expire.
+
+Return Value:
+
+    None.
+
+--*/
+
 KERNEL_API
 ULONGLONG
 KeConvertMicrosecondsToTimeTicks (
@@ -2954,6 +3270,32 @@ Return Value:
 
 --*/
 
+INTN
+KeSysGetSetSchedulingPolicy (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for getting or setting the
+    scheduling policy and real-time priority of the current thread.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
 VOID
 KeClockInterrupt (
     VOID
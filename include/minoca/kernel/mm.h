@@ -74,6 +74,31 @@ Module Name:
 #define USER_STACK_MAX (((UINTN)MAX_USER_ADDRESS + 1) * 3 / 4)
 #define MM_STATISTICS_VERSION 1
 #define MM_STATISTICS_MAX_VERSION 0x10000000
+#define MM_TLB_STATISTICS_VERSION 1
+#define MM_POOL_TAG_STATISTICS_VERSION 1
+
+#define MEMORY_PRESSURE_STATUS_VERSION 1
+
+//
+// Define the memory pressure levels reported to user mode. Unlike the memory
+// warning levels, these increase with severity. The memory pressure device
+// asserts the "in" poll event at the low level and above, and the high
+// priority "in" poll event at the critical level.
+//
+
+#define MEMORY_PRESSURE_NONE 0
+#define MEMORY_PRESSURE_LOW 1
+#define MEMORY_PRESSURE_CRITICAL 2
+
+//
+// Define the physical zone policy bits. The low bits hold the preferred
+// PHYSICAL_MEMORY_ZONE. If the strict flag is set, allocations do not fall
+// back to other zones when the preferred zone is out of free pages.
+//
+
+#define PHYSICAL_ZONE_POLICY_ZONE_MASK 0x0000000F
+#define PHYSICAL_ZONE_POLICY_STRICT 0x00000010
+#define PHYSICAL_ZONE_POLICY_DEFAULT PhysicalMemoryZoneNormal
 
 //
 // Define flags for memory accounting systems.
@@ -337,9 +362,18 @@ typedef enum _MEMORY_WARNING_LEVEL {
     MaxMemoryWarningLevels
 } MEMORY_WARNING_LEVEL, *PMEMORY_WARNING_LEVEL;
 
+typedef enum _PHYSICAL_MEMORY_ZONE {
+    PhysicalMemoryZoneNormal,
+    PhysicalMemoryZoneFast,
+    PhysicalMemoryZoneDma,
+    PhysicalMemoryZoneCount
+} PHYSICAL_MEMORY_ZONE, *PPHYSICAL_MEMORY_ZONE;
+
 typedef enum _MM_INFORMATION_TYPE {
     MmInformationInvalid,
     MmInformationSystemMemory,
+    MmInformationTlbStatistics,
+    MmInformationPoolTagStatistics,
 } MM_INFORMATION_TYPE, *PMM_INFORMATION_TYPE;
 
 /*++
@@ -614,6 +648,121 @@ typedef struct _BLOCK_ALLOCATOR BLOCK_ALLOCATOR, *PBLOCK_ALLOCATOR;
 
 /*++
 
+Structure Description:
+
+    This structure defines the statistics for the compressed swap tier.
+
+Members:
+
+    PoolPages - Stores the number of physical pages currently holding
+        compressed data.
+
+    MaxPoolPages - Stores the maximum number of physical pages the compressed
+        pool may use, or zero if the compressed swap tier is disabled.
+
+    StoredPages - Stores the number of pages currently held in compressed
+        form.
+
+    CompressedBytes - Stores the total size of the compressed data.
+
+    Stores - Stores the number of pages that were kept in the compressed pool
+        rather than written to the page file.
+
+    Rejects - Stores the number of pages that went to the page file because
+        they did not compress well or the pool was full.
+
+    Loads - Stores the number of page file reads satisfied from the
+        compressed pool.
+
+    Misses - Stores the number of page file reads that had to go to disk.
+
+--*/
+
+typedef struct _MM_COMPRESSED_SWAP_STATISTICS {
+    UINTN PoolPages;
+    UINTN MaxPoolPages;
+    UINTN StoredPages;
+    ULONGLONG CompressedBytes;
+    ULONGLONG Stores;
+    ULONGLONG Rejects;
+    ULONGLONG Loads;
+    ULONGLONG Misses;
+} MM_COMPRESSED_SWAP_STATISTICS, *PMM_COMPRESSED_SWAP_STATISTICS;
+
+/*++
+
+Structure Description:
+
+    This structure defines the statistics for one physical memory zone.
+
+Members:
+
+    TotalPages - Stores the number of physical pages in the zone.
+
+    FreePages - Stores the number of unallocated physical pages in the zone.
+
+    Allocations - Stores the number of allocations satisfied from the zone.
+
+    Fallbacks - Stores the number of those allocations that wanted a different
+        zone but had to settle for this one.
+
+--*/
+
+typedef struct _MM_PHYSICAL_ZONE_STATISTICS {
+    UINTN TotalPages;
+    UINTN FreePages;
+    ULONGLONG Allocations;
+    ULONGLONG Fallbacks;
+} MM_PHYSICAL_ZONE_STATISTICS, *PMM_PHYSICAL_ZONE_STATISTICS;
+
+/*++
+
+Structure Description:
+
+    This structure defines the memory pressure status reported by reading the
+    memory pressure device.
+
+Members:
+
+    Version - Stores the structure version number. This is set to
+        MEMORY_PRESSURE_STATUS_VERSION.
+
+    Level - Stores the overall memory pressure level, which is the more severe
+        of the physical and virtual levels. See MEMORY_PRESSURE_* definitions.
+
+    PhysicalLevel - Stores the physical memory pressure level.
+
+    VirtualLevel - Stores the system virtual memory pressure level.
+
+    ChangeCount - Stores the number of times the overall level has changed
+        since boot. Comparing this against a previous read tells whether a
+        transition was missed.
+
+    TotalPhysicalPages - Stores the number of physical pages in the system.
+
+    FreePhysicalPages - Stores the number of free physical pages.
+
+    TotalVirtualBytes - Stores the size of system virtual memory, in bytes.
+
+    FreeVirtualBytes - Stores the amount of free system virtual memory, in
+        bytes.
+
+--*/
+
+typedef struct _MEMORY_PRESSURE_STATUS {
+    ULONG Version;
+    ULONG Level;
+    ULONG PhysicalLevel;
+    ULONG VirtualLevel;
+    ULONGLONG ChangeCount;
+    ULONGLONG TotalPhysicalPages;
+    ULONGLONG FreePhysicalPages;
+    ULONGLONG TotalVirtualBytes;
+    ULONGLONG FreeVirtualBytes;
+} MEMORY_PRESSURE_STATUS, *PMEMORY_PRESSURE_STATUS;
+
+/*++
+
 Structure Description:
 
     This structure defines an I/O buffer.
@@ -637,6 +786,16 @@ Structure Description:
     NonPagedPhysicalPages - Stores the number of physical pages that are
         pinned in memory and cannot be paged out to disk.
 
+    PagerScannedPages - Stores the number of pages the pager has considered
+        for eviction.
+
+    PagerReferencedPages - Stores the number of scanned pages the pager left
+        resident because they had been accessed since it last passed them.
+
+    CompressedSwap - Stores the compressed swap tier statistics.
+
+    Zones - Stores the physical page statistics for each memory zone.
+
 --*/
 
 typedef struct _MM_STATISTICS {
@@ -647,10 +806,86 @@ typedef struct _MM_STATISTICS {
     UINTN PhysicalPages;
     UINTN AllocatedPhysicalPages;
     UINTN NonPagedPhysicalPages;
+    UINTN PagerScannedPages;
+    UINTN PagerReferencedPages;
+    MM_COMPRESSED_SWAP_STATISTICS CompressedSwap;
+    MM_PHYSICAL_ZONE_STATISTICS Zones[PhysicalMemoryZoneCount];
 } MM_STATISTICS, *PMM_STATISTICS;
 
 /*++
 
+Structure Description:
+
+    This structure defines the live statistics for one pool allocation tag.
+
+Members:
+
+    Tag - Stores the allocation tag.
+
+    PoolType - Stores the pool the allocations came from. See POOL_TYPE.
+
+    ActiveSize - Stores the number of bytes currently allocated under the tag.
+
+    LargestActiveSize - Stores the largest the active size has ever been.
+
+    LifetimeAllocationSize - Stores the total number of bytes ever allocated
+        under the tag.
+
+    LifetimeAllocationCount - Stores the total number of allocations ever
+        made under the tag. Sample this twice to compute an allocation rate.
+
+    ActiveAllocationCount - Stores the number of outstanding allocations.
+
+    LargestAllocation - Stores the size of the largest single allocation made
+        under the tag.
+
+    Histogram - Stores the number of outstanding allocations in each power of
+        two size bucket. See MEMORY_HEAP_TAG_HISTOGRAM_SHIFT.
+
+--*/
+
+typedef struct _MM_POOL_TAG_STATISTIC {
+    ULONG Tag;
+    ULONG PoolType;
+    ULONGLONG ActiveSize;
+    ULONGLONG LargestActiveSize;
+    ULONGLONG LifetimeAllocationSize;
+    ULONGLONG LifetimeAllocationCount;
+    ULONG ActiveAllocationCount;
+    ULONG LargestAllocation;
+    ULONG Histogram[MEMORY_HEAP_TAG_HISTOGRAM_BUCKETS];
+} MM_POOL_TAG_STATISTIC, *PMM_POOL_TAG_STATISTIC;
+
+/*++
+
+Structure Description:
+
+    This structure defines a snapshot of the pool tag statistics. It is
+    immediately followed in memory by an array of MM_POOL_TAG_STATISTIC
+    structures.
+
+Members:
+
+    Version - Stores the structure version number. Set this to
+        MM_POOL_TAG_STATISTICS_VERSION.
+
+    TagCount - Stores the number of tag statistics following the structure.
+
+    TimeCounter - Stores the time counter value when the snapshot was taken.
+
+    TimeCounterFrequency - Stores the frequency of the time counter, in Hertz.
+
+--*/
+
+typedef struct _MM_POOL_TAG_STATISTICS {
+    ULONG Version;
+    ULONG TagCount;
+    ULONGLONG TimeCounter;
+    ULONGLONG TimeCounterFrequency;
+} MM_POOL_TAG_STATISTICS, *PMM_POOL_TAG_STATISTICS;
+
+/*++
+
 Structure Description:
 
     This structure defines an I/O vector, a structure used in kernel mode that
@@ -671,6 +906,47 @@ typedef struct _IO_VECTOR {
 
 /*++
 
+Structure Description:
+
+    This structure defines the TLB shootdown statistics.
+
+Members:
+
+    Version - Stores the structure version number. Set this to
+        MM_TLB_STATISTICS_VERSION.
+
+    Shootdowns - Stores the number of TLB invalidation requests made.
+
+    LocalShootdowns - Stores the number of invalidation requests that were
+        satisfied without interrupting any other processor, because no other
+        processor was running the address space.
+
+    IpisSent - Stores the number of invalidation IPIs delivered to other
+        processors.
+
+    IpisAvoided - Stores the number of processors that were skipped because
+        they were not running the address space being invalidated.
+
+    PagesInvalidated - Stores the total number of pages requested for
+        invalidation.
+
+    FullFlushes - Stores the number of requests that were large enough to
+        flush the entire TLB rather than invalidating each page.
+
+--*/
+
+typedef struct _MM_TLB_STATISTICS {
+    ULONG Version;
+    ULONGLONG Shootdowns;
+    ULONGLONG LocalShootdowns;
+    ULONGLONG IpisSent;
+    ULONGLONG IpisAvoided;
+    ULONGLONG PagesInvalidated;
+    ULONGLONG FullFlushes;
+} MM_TLB_STATISTICS, *PMM_TLB_STATISTICS;
+
+/*++
+
 Structure Description:
 
     This structure defines an address space context.
@@ -698,6 +974,10 @@ Structure Description:
 
     BreakEnd - Stores the end address of the program break.
 
+    ActiveProcessors - Stores a mask of the processors that currently have
+        this address space loaded. Processors numbered beyond the width of
+        the mask are not tracked and are always assumed to be active.
+
 --*/
 
 typedef struct _ADDRESS_SPACE {
@@ -709,6 +989,7 @@ typedef struct _ADDRESS_SPACE {
     PVOID MaxMemoryMap;
     PVOID BreakStart;
     PVOID BreakEnd;
+    volatile ULONG ActiveProcessors;
 } ADDRESS_SPACE, *PADDRESS_SPACE;
 
 /*++
@@ -890,6 +1171,41 @@ Return Value:
 
 --*/
 
+KSTATUS
+MmGetPoolTagStatistics (
+    PMM_POOL_TAG_STATISTICS Statistics,
+    PUINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine takes a snapshot of the per-tag statistics of both kernel
+    pools. This routine must be called at low level.
+
+Arguments:
+
+    Statistics - Supplies a pointer to the buffer where the snapshot is
+        returned. The caller should set the version member to
+        MM_POOL_TAG_STATISTICS_VERSION.
+
+    Size - Supplies a pointer that on input contains the size of the buffer,
+        in bytes. On output, returns the size of the snapshot, or the size
+        needed if the buffer is too small.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the buffer cannot hold all the tags.
+
+    STATUS_VERSION_MISMATCH if the structure version is too old.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
 KERNEL_API
 VOID
 MmDebugPrintPoolStatistics (
@@ -1710,6 +2026,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 UINTN
 MmGetTotalVirtualMemory (
     VOID
@@ -1731,6 +2048,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 UINTN
 MmGetFreeVirtualMemory (
     VOID
@@ -2043,6 +2361,29 @@ Return Value:
 
 --*/
 
+KSTATUS
+MmGetTlbStatistics (
+    PMM_TLB_STATISTICS Statistics
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the TLB shootdown statistics.
+
+Arguments:
+
+    Statistics - Supplies a pointer where the statistics will be returned on
+        success. The caller should set the version member to
+        MM_TLB_STATISTICS_VERSION.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 PVOID
 MmAllocateKernelStack (
     UINTN Size
@@ -2874,6 +3215,42 @@ Return Value:
 
 --*/
 
+BOOL
+MmUserCompareExchange32 (
+    PVOID Buffer,
+    ULONG ExchangeValue,
+    ULONG CompareValue,
+    PULONG OriginalValue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine atomically compares a 32-bit value in user mode with the given
+    value, and exchanges it with another value if they are equal. The address
+    is assumed to be naturally aligned.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the user mode value.
+
+    ExchangeValue - Supplies the value to write if the comparison succeeds.
+
+    CompareValue - Supplies the value to compare against.
+
+    OriginalValue - Supplies a pointer where the value originally in the user
+        mode buffer will be returned.
+
+Return Value:
+
+    TRUE if the user mode access succeeded, regardless of whether or not the
+    exchange happened.
+
+    FALSE if the user mode access faulted.
+
+--*/
+
 PMEMORY_RESERVATION
 MmCreateMemoryReservation (
     PVOID PreferredVirtualAddress,
@@ -3252,6 +3629,30 @@ Return Value:
 
 --*/
 
+BOOL
+MmIsPagingEnabled (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not a page file is currently available
+    to page memory out to.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE if paging to disk is enabled.
+
+    FALSE if paging is disabled or no page file has been found.
+
+--*/
+
 BOOL
 MmRequestPagingOut (
     UINTN FreePageTarget
@@ -3830,6 +4231,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 UINTN
 MmGetTotalPhysicalPages (
     VOID
@@ -3851,6 +4253,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 UINTN
 MmGetTotalFreePhysicalPages (
     VOID
@@ -3872,6 +4275,32 @@ Return Value:
 
 --*/
 
+KERNEL_API
+ULONG
+MmSetPhysicalZonePolicy (
+    ULONG Policy
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the physical memory zone policy for the current thread.
+    Physical pages allocated on behalf of the thread come from the preferred
+    zone when it has room, and otherwise from the other zones in the system's
+    fallback order unless the policy is strict.
+
+Arguments:
+
+    Policy - Supplies the new policy. The low bits hold the preferred
+        PHYSICAL_MEMORY_ZONE. See PHYSICAL_ZONE_POLICY_* for flags.
+
+Return Value:
+
+    Returns the previous policy, which the caller should restore when done.
+
+--*/
+
 VOID
 MmFreePhysicalPages (
     PHYSICAL_ADDRESS PhysicalAddress,
@@ -483,6 +483,37 @@ Module Name:
 
 #define USER_LOCK_PRIVATE 0x00000080
 
+//
+// Define the encoding of the operation argument for UserLockWakeOperation.
+// The operation is applied atomically to the second address, and the
+// comparison decides whether or not waiters on the second address are woken.
+// Both arguments are 12-bit values. If the shift flag is set, the operation
+// argument is used as a shift count (1 << Argument) instead.
+//
+
+#define USER_LOCK_WAKE_OPERATION_SET 0
+#define USER_LOCK_WAKE_OPERATION_ADD 1
+#define USER_LOCK_WAKE_OPERATION_OR 2
+#define USER_LOCK_WAKE_OPERATION_AND_NOT 3
+#define USER_LOCK_WAKE_OPERATION_XOR 4
+#define USER_LOCK_WAKE_OPERATION_SHIFT 8
+
+#define USER_LOCK_WAKE_COMPARE_EQUAL 0
+#define USER_LOCK_WAKE_COMPARE_NOT_EQUAL 1
+#define USER_LOCK_WAKE_COMPARE_LESS 2
+#define USER_LOCK_WAKE_COMPARE_LESS_EQUAL 3
+#define USER_LOCK_WAKE_COMPARE_GREATER 4
+#define USER_LOCK_WAKE_COMPARE_GREATER_EQUAL 5
+
+#define USER_LOCK_WAKE_ARGUMENT(_Operation, _Argument, _Compare, _Value) \
+    ((((_Operation) & 0xF) << 28) | (((_Compare) & 0xF) << 24) |          \
+     (((_Argument) & 0xFFF) << 12) | ((_Value) & 0xFFF))
+
+#define USER_LOCK_WAKE_ARGUMENT_OPERATION(_Encoded) (((_Encoded) >> 28) & 0xF)
+#define USER_LOCK_WAKE_ARGUMENT_COMPARE(_Encoded) (((_Encoded) >> 24) & 0xF)
+#define USER_LOCK_WAKE_ARGUMENT_ARGUMENT(_Encoded) (((_Encoded) >> 12) & 0xFFF)
+#define USER_LOCK_WAKE_ARGUMENT_VALUE(_Encoded) ((_Encoded) & 0xFFF)
+
 //
 // Define the current version of the process start data structure.
 //
@@ -507,6 +538,21 @@ Module Name:
 
 #define MAX_USER_ADDRESS ((PVOID)0x7FFFFFFF)
 
+//
+// Define the range of priorities for the real-time scheduling policies.
+// Higher values preempt lower ones.
+//
+
+#define SCHEDULER_REAL_TIME_PRIORITY_MINIMUM 1
+#define SCHEDULER_REAL_TIME_PRIORITY_MAXIMUM 99
+
+//
+// Define the time slice given to round-robin real-time threads before they
+// move behind other threads of the same priority, in microseconds.
+//
+
+#define SCHEDULER_ROUND_ROBIN_INTERVAL 10000
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -581,10 +627,39 @@ typedef enum _SCHEDULER_ENTRY_TYPE {
     SchedulerEntryGroup,
 } SCHEDULER_ENTRY_TYPE, *PSCHEDULER_ENTRY_TYPE;
 
+/*++
+
+Enumeration Description:
+
+    This enumeration describes the scheduling policies a thread can run under.
+
+Values:
+
+    SchedulerPolicyNormal - Indicates the thread shares the processor fairly
+        with other normal threads.
+
+    SchedulerPolicyFifo - Indicates a real-time thread that runs until it
+        blocks, yields, or is preempted by a higher priority real-time thread.
+
+    SchedulerPolicyRoundRobin - Indicates a real-time thread that behaves like
+        a FIFO thread, except that it goes behind other threads of the same
+        priority after each time slice.
+
+--*/
+
+typedef enum _SCHEDULER_POLICY {
+    SchedulerPolicyNormal,
+    SchedulerPolicyFifo,
+    SchedulerPolicyRoundRobin,
+    SchedulerPolicyCount
+} SCHEDULER_POLICY, *PSCHEDULER_POLICY;
+
 typedef enum _USER_LOCK_OPERATION {
     UserLockInvalid,
     UserLockWait,
     UserLockWake,
+    UserLockRequeue,
+    UserLockWakeOperation,
 } USER_LOCK_OPERATION, *PUSER_LOCK_OPERATION;
 
 //
@@ -1374,6 +1449,9 @@ Structure Description:
 
     Umask - Stores the user file creation permission bit mask for the process.
 
+    TimerSlack - Stores the default number of time counter ticks that timers
+        queued by this process may expire late, allowing them to be batched.
+
     ControllingTerminal - Stores an opaque pointer to the process' controlling
         terminal. This is a file object, but it's a file object that this
         process doesn't necessarily have a reference to. This pointer should
@@ -1423,6 +1501,7 @@ struct _KPROCESS {
     RESOURCE_USAGE ResourceUsage;
     RESOURCE_USAGE ChildResourceUsage;
     ULONG Umask;
+    ULONGLONG TimerSlack;
     PVOID ControllingTerminal;
 };
 
@@ -1570,6 +1649,16 @@ Structure Description:
 
     SchedulerEntry - Stores the scheduler information for this thread.
 
+    SchedulingPolicy - Stores the scheduling policy the thread runs under.
+        This is protected by the scheduler lock of the processor the thread
+        is queued on.
+
+    SchedulingPriority - Stores the real-time priority of the thread. This is
+        zero for normal threads.
+
+    TimeSliceEnd - Stores the processor counter value at which a round-robin
+        thread's time slice ends, or zero if it has no slice in progress.
+
     BuiltinTimer - Stores a pointer to the thread's default timeout timer.
 
     BuiltinWaitBlock - Stores a pointer to the built-in wait block that comes
@@ -1641,6 +1730,10 @@ Structure Description:
 
     Limits - Stores the resource limits associated with the thread.
 
+    PhysicalZonePolicy - Stores the physical memory zone policy to use for
+        pages allocated on behalf of the thread. See
+        PHYSICAL_ZONE_POLICY_* definitions.
+
 --*/
 
 struct _KTHREAD {
@@ -1653,6 +1746,9 @@ struct _KTHREAD {
     USHORT Flags;
     USHORT FpuFlags;
     SCHEDULER_ENTRY SchedulerEntry;
+    SCHEDULER_POLICY SchedulingPolicy;
+    ULONG SchedulingPriority;
+    ULONGLONG TimeSliceEnd;
     PVOID BuiltinTimer;
     PWAIT_BLOCK BuiltinWaitBlock;
     PWAIT_BLOCK WaitBlock;
@@ -1679,6 +1775,7 @@ struct _KTHREAD {
     RUNTIME_TIMER UserTimer;
     RUNTIME_TIMER ProfileTimer;
     RESOURCE_LIMIT Limits[ResourceLimitCount];
+    ULONG PhysicalZonePolicy;
 };
 
 /*++
@@ -1743,6 +1840,9 @@ Structure Description:
 
     ArgumentsBufferSize - Stores the size of the arguments buffer in bytes.
 
+    ResidentSet - Stores the number of pages currently mapped into the
+        process's address space.
+
 --*/
 
 typedef struct _PROCESS_INFORMATION {
@@ -1769,6 +1869,7 @@ typedef struct _PROCESS_INFORMATION {
     ULONG NameLength;
     UINTN ArgumentsBufferOffset;
     ULONG ArgumentsBufferSize;
+    UINTN ResidentSet;
 } PROCESS_INFORMATION, *PPROCESS_INFORMATION;
 
 /*++
@@ -3410,6 +3511,34 @@ Return Value:
 
 --*/
 
+KERNEL_API
+ULONGLONG
+PsSetProcessTimerSlack (
+    PKPROCESS Process,
+    ULONGLONG Slack
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the default timer slack for the given process. Timers
+    queued by threads in the process that don't have their own slack may
+    expire this much later than requested so that expirations can be batched
+    together. Child processes inherit the timer slack.
+
+Arguments:
+
+    Process - Supplies a pointer to the process.
+
+    Slack - Supplies the new default slack, in time counter ticks.
+
+Return Value:
+
+    Returns the previous default timer slack.
+
+--*/
+
 VOID
 PsIterateProcess (
     PROCESS_ID_TYPE Type,
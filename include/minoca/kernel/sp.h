@@ -53,10 +53,49 @@ Module Name:
         SpProcessNewThreadRoutine(_ProcessId, _ThreadId);  \
     }
 
+//
+// This macro determines whether or not any of the given trace categories are
+// enabled.
+//
+
+#define SpIsTraceEnabled(_Flags) ((SpTraceFlags & (_Flags)) != 0)
+
+//
+// This macro records a trace event if its category is enabled. When tracing
+// is off this costs a single load and branch.
+//
+
+#define SpTraceEvent(_Flags, _Type, _Detail, _Arg0, _Arg1, _Arg2) \
+    do {                                                          \
+        if (SpIsTraceEnabled(_Flags)) {                           \
+            SpRecordTraceEvent((_Type),                           \
+                               (_Detail),                         \
+                               (ULONGLONG)(_Arg0),                \
+                               (ULONGLONG)(_Arg1),                \
+                               (ULONGLONG)(_Arg2));               \
+        }                                                         \
+                                                                  \
+    } while (0)
+
 //
 // ---------------------------------------------------------------- Definitions
 //
 
+#define SP_TRACE_DATA_VERSION 2
+
+//
+// Define the event tracing categories.
+//
+
+#define SP_TRACE_FLAG_SCHEDULER 0x00000001
+#define SP_TRACE_FLAG_IO        0x00000002
+#define SP_TRACE_FLAG_MEMORY    0x00000004
+#define SP_TRACE_FLAG_NETWORK   0x00000008
+
+#define SP_TRACE_FLAG_ALL   \
+    (SP_TRACE_FLAG_SCHEDULER | SP_TRACE_FLAG_IO | SP_TRACE_FLAG_MEMORY | \
+     SP_TRACE_FLAG_NETWORK)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -64,6 +103,8 @@ Module Name:
 typedef enum _SP_INFORMATION_TYPE {
     SpInformationInvalid,
     SpInformationGetSetState,
+    SpInformationTraceControl,
+    SpInformationTraceData,
 } SP_INFORMATION_TYPE, *PSP_INFORMATION_TYPE;
 
 /*++
@@ -121,6 +162,144 @@ typedef struct _SP_GET_SET_STATE_INFORMATION {
     ULONG ProfilerTypeFlags;
 } SP_GET_SET_STATE_INFORMATION, *PSP_GET_SET_STATE_INFORMATION;
 
+/*++
+
+Enumeration Description:
+
+    This enumeration describes the types of events recorded by the kernel
+    event tracer.
+
+Values:
+
+    SpTraceEventInvalid - Indicates an invalid event.
+
+    SpTraceEventContextSwitch - Indicates the current thread is being switched
+        out. The detail holds the scheduler reason, and the arguments hold the
+        thread ID and process ID of the thread being switched in.
+
+    SpTraceEventIrpSend - Indicates an I/O IRP is being sent. The detail holds
+        the IRP minor code, and the arguments hold the IRP, the device offset,
+        and the size of the I/O in bytes.
+
+    SpTraceEventIrpComplete - Indicates an IRP was completed. The detail holds
+        the completion status, and the arguments hold the IRP, the major code,
+        and the minor code.
+
+    SpTraceEventPageFault - Indicates a page fault was handled. The detail
+        holds the fault flags, and the arguments hold the faulting address,
+        the faulting instruction pointer, and the time counter value when the
+        fault began.
+
+    SpTraceEventNetworkReceive - Indicates a packet was received by a network
+        link. The detail holds the packet size, and the first argument holds
+        the link.
+
+    SpTraceEventCount - Indicates the number of event types.
+
+--*/
+
+typedef enum _SP_TRACE_EVENT_TYPE {
+    SpTraceEventInvalid,
+    SpTraceEventContextSwitch,
+    SpTraceEventIrpSend,
+    SpTraceEventIrpComplete,
+    SpTraceEventPageFault,
+    SpTraceEventNetworkReceive,
+    SpTraceEventCount
+} SP_TRACE_EVENT_TYPE, *PSP_TRACE_EVENT_TYPE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single kernel trace event record.
+
+Members:
+
+    Time - Stores the time counter value when the event was recorded.
+
+    Type - Stores the event type. See SP_TRACE_EVENT_TYPE.
+
+    Processor - Stores the number of the processor that recorded the event.
+
+    Detail - Stores an event specific detail value.
+
+    ThreadId - Stores the ID of the thread running when the event was
+        recorded.
+
+    ProcessId - Stores the ID of the process that owns the running thread.
+
+    Arguments - Stores event specific arguments.
+
+--*/
+
+typedef struct _SP_TRACE_EVENT {
+    ULONGLONG Time;
+    USHORT Type;
+    USHORT Processor;
+    ULONG Detail;
+    THREAD_ID ThreadId;
+    PROCESS_ID ProcessId;
+    ULONGLONG Arguments[3];
+} SP_TRACE_EVENT, *PSP_TRACE_EVENT;
+
+/*++
+
+Structure Description:
+
+    This structure defines the kernel event tracing state to get or set.
+
+Members:
+
+    Flags - Stores the bitmask of enabled trace categories. See
+        SP_TRACE_FLAG_* for definitions. On a set call, this replaces the
+        currently enabled categories.
+
+    EventsPerProcessor - Stores the number of events each processor's trace
+        buffer holds. This is ignored on set.
+
+--*/
+
+typedef struct _SP_TRACE_CONTROL {
+    ULONG Flags;
+    ULONG EventsPerProcessor;
+} SP_TRACE_CONTROL, *PSP_TRACE_CONTROL;
+
+/*++
+
+Structure Description:
+
+    This structure defines the header returned when reading trace events.
+    Reading consumes the returned events. The events for each processor are
+    in order, but events from different processors are not merged. Event
+    times come from the time counter, so they can be compared across
+    processors when merging.
+
+Members:
+
+    Version - Stores the structure version. The caller sets this to
+        SP_TRACE_DATA_VERSION.
+
+    EventCount - Stores the number of events that follow this header.
+
+    LostEventCount - Stores the number of events that were overwritten before
+        they could be read.
+
+    TimeCounterFrequency - Stores the frequency of the time counter used to
+        timestamp events, in Hertz.
+
+    Events - Stores the array of trace events.
+
+--*/
+
+typedef struct _SP_TRACE_DATA {
+    ULONG Version;
+    ULONG EventCount;
+    ULONGLONG LostEventCount;
+    ULONGLONG TimeCounterFrequency;
+    SP_TRACE_EVENT Events[ANYSIZE_ARRAY];
+} SP_TRACE_DATA, *PSP_TRACE_DATA;
+
 typedef
 VOID
 (*PSP_COLLECT_THREAD_STATISTIC) (
@@ -211,6 +390,13 @@ extern PSP_COLLECT_THREAD_STATISTIC SpCollectThreadStatisticRoutine;
 extern PSP_PROCESS_NEW_PROCESS SpProcessNewProcessRoutine;
 extern PSP_PROCESS_NEW_THREAD SpProcessNewThreadRoutine;
 
+//
+// Store the mask of enabled event tracing categories. Callers should use the
+// trace macros rather than accessing this directly.
+//
+
+extern volatile ULONG SpTraceFlags;
+
 //
 // -------------------------------------------------------- Function Prototypes
 //
@@ -253,6 +439,42 @@ Return Value:
 
 --*/
 
+KERNEL_API
+VOID
+SpRecordTraceEvent (
+    ULONG Type,
+    ULONG Detail,
+    ULONGLONG Argument0,
+    ULONGLONG Argument1,
+    ULONGLONG Argument2
+    );
+
+/*++
+
+Routine Description:
+
+    This routine records an event in the current processor's trace buffer.
+    It can be called at any run level. Callers should use the SpTraceEvent
+    macro, which skips the call when the category is disabled.
+
+Arguments:
+
+    Type - Supplies the event type. See SP_TRACE_EVENT_TYPE.
+
+    Detail - Supplies the event specific detail value.
+
+    Argument0 - Supplies the first event specific argument.
+
+    Argument1 - Supplies the second event specific argument.
+
+    Argument2 - Supplies the third event specific argument.
+
+Return Value:
+
+    None.
+
+--*/
+
 VOID
 SpProfilerInterrupt (
     PTRAP_FRAME TrapFrame
@@ -93,6 +93,7 @@ Module Name:
 #define SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL 0x00000200
 #define SYS_OPEN_FLAG_NO_ACCESS_TIME          0x00000400
 #define SYS_OPEN_FLAG_ASYNCHRONOUS            0x00000800
+#define SYS_OPEN_FLAG_DIRECT                  0x00001000
 
 #define SYS_OPEN_ACCESS_SHIFT 29
 #define SYS_OPEN_FLAG_READ    (IO_ACCESS_READ << SYS_OPEN_ACCESS_SHIFT)
@@ -118,14 +119,16 @@ Module Name:
      SYS_OPEN_FLAG_SYNCHRONIZED |               \
      SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL |    \
      SYS_OPEN_FLAG_NO_ACCESS_TIME |             \
-     SYS_OPEN_FLAG_ASYNCHRONOUS)
+     SYS_OPEN_FLAG_ASYNCHRONOUS |               \
+     SYS_OPEN_FLAG_DIRECT)
 
 #define SYS_FILE_CONTROL_EDITABLE_STATUS_FLAGS \
     (SYS_OPEN_FLAG_APPEND |                    \
      SYS_OPEN_FLAG_NON_BLOCKING |              \
      SYS_OPEN_FLAG_SYNCHRONIZED |              \
      SYS_OPEN_FLAG_NO_ACCESS_TIME |            \
-     SYS_OPEN_FLAG_ASYNCHRONOUS)
+     SYS_OPEN_FLAG_ASYNCHRONOUS |              \
+     SYS_OPEN_FLAG_DIRECT)
 
 //
 // Define delete flags.
@@ -274,6 +277,54 @@ Module Name:
 #define TIMER_CONTROL_FLAG_USE_TIMER_NUMBER 0x00000001
 #define TIMER_CONTROL_FLAG_SIGNAL_THREAD    0x00000002
 
+//
+// Define the I/O ring operations that can be posted in a submission entry.
+//
+
+#define IO_RING_OPERATION_NOP   0
+#define IO_RING_OPERATION_READ  1
+#define IO_RING_OPERATION_WRITE 2
+#define IO_RING_OPERATION_FLUSH 3
+#define IO_RING_OPERATION_POLL  4
+
+//
+// Set this submission flag to have the kernel send the signal number in the
+// submission to the process when the operation completes.
+//
+
+#define IO_RING_SUBMISSION_FLAG_SIGNAL 0x0001
+
+//
+// Define the maximum number of entries in either queue of an I/O ring.
+//
+
+#define IO_RING_MAX_ENTRIES 4096
+
+//
+// These macros compute the layout of an I/O ring. The header comes first,
+// followed by the submission array, followed by the completion array. Both
+// counts must be powers of two.
+//
+
+#define IO_RING_SUBMISSION_OFFSET \
+    ALIGN_RANGE_UP(sizeof(IO_RING_HEADER), sizeof(ULONGLONG))
+
+#define IO_RING_COMPLETION_OFFSET(_SubmissionCount)             \
+    (IO_RING_SUBMISSION_OFFSET +                                 \
+     ((_SubmissionCount) * sizeof(IO_RING_SUBMISSION)))
+
+#define IO_RING_SIZE(_SubmissionCount, _CompletionCount)         \
+    (IO_RING_COMPLETION_OFFSET(_SubmissionCount) +               \
+     ((_CompletionCount) * sizeof(IO_RING_COMPLETION)))
+
+#define IO_RING_SUBMISSIONS(_Header) \
+    ((PIO_RING_SUBMISSION)((PUCHAR)(_Header) + IO_RING_SUBMISSION_OFFSET))
+
+#define IO_RING_COMPLETIONS(_Header)                                    \
+    ((PIO_RING_COMPLETION)((PUCHAR)(_Header) +                          \
+                           IO_RING_COMPLETION_OFFSET(                   \
+                                           (_Header)->SubmissionCount)))
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -351,6 +402,8 @@ typedef enum _SYSTEM_CALL_NUMBER {
     SystemCallSetITimer,
     SystemCallSetResourceLimit,
     SystemCallSetBreak,
+    SystemCallIoRingControl,
+    SystemCallGetSetSchedulingPolicy,
     SystemCallCount
 } SYSTEM_CALL_NUMBER, *PSYSTEM_CALL_NUMBER;
 
@@ -430,6 +483,13 @@ typedef enum _ITIMER_TYPE {
     ITimerTypeCount
 } ITIMER_TYPE, *PITIMER_TYPE;
 
+typedef enum _IO_RING_CONTROL_OPERATION {
+    IoRingControlInvalid,
+    IoRingControlCreate,
+    IoRingControlDestroy,
+    IoRingControlEnter
+} IO_RING_CONTROL_OPERATION, *PIO_RING_CONTROL_OPERATION;
+
 typedef enum _RESOURCE_USAGE_REQUEST {
     ResourceUsageRequestInvalid,
     ResourceUsageRequestProcess,
@@ -2389,6 +2449,20 @@ Structure Description:
     TimeoutInMilliseconds - Stores the timeout in milliseconds the caller
         should wait. Set to SYS_WAIT_TIME_INDEFINITE to wait forever.
 
+    Address2 - Stores a pointer to the second lock address, used by the
+        requeue and wake operation operations.
+
+    Value2 - Stores the second value. For requeue operations, this contains
+        the maximum number of waiters to move to the second address on input,
+        and the number moved on output. For wake operation operations, this
+        contains the maximum number of waiters to wake on the second address
+        on input, and the number woken on output.
+
+    Argument - Stores the extra argument. For requeue operations, this is the
+        value the first address is expected to contain. For wake operation
+        operations, this is the encoded operation and comparison. See
+        USER_LOCK_WAKE_ARGUMENT.
+
 --*/
 
 typedef struct _SYSTEM_CALL_USER_LOCK {
@@ -2396,6 +2470,9 @@ typedef struct _SYSTEM_CALL_USER_LOCK {
     ULONG Value;
     ULONG Operation;
     ULONG TimeoutInMilliseconds;
+    PULONG Address2;
+    ULONG Value2;
+    ULONG Argument;
 } SYSCALL_STRUCT SYSTEM_CALL_USER_LOCK, *PSYSTEM_CALL_USER_LOCK;
 
 /*++
@@ -2531,6 +2608,192 @@ typedef struct _SYSTEM_CALL_SET_RESOURCE_LIMIT {
 
 /*++
 
+Structure Description:
+
+    This structure defines the shared header at the start of an I/O ring. The
+    submission queue is produced by user mode and consumed by the kernel; the
+    completion queue is produced by the kernel and consumed by user mode. The
+    head and tail indices run freely and are masked by the queue size when
+    used to index an array.
+
+Members:
+
+    SubmissionHead - Stores the index of the next submission the kernel will
+        consume. This is written only by the kernel.
+
+    SubmissionTail - Stores the index one beyond the last valid submission.
+        This is written only by user mode.
+
+    CompletionHead - Stores the index of the next completion user mode will
+        consume. This is written only by user mode.
+
+    CompletionTail - Stores the index one beyond the last valid completion.
+        This is written only by the kernel.
+
+    SubmissionCount - Stores the number of entries in the submission array.
+        This is filled in by the kernel when the ring is created.
+
+    CompletionCount - Stores the number of entries in the completion array.
+        This is filled in by the kernel when the ring is created.
+
+--*/
+
+typedef struct _IO_RING_HEADER {
+    volatile ULONG SubmissionHead;
+    volatile ULONG SubmissionTail;
+    volatile ULONG CompletionHead;
+    volatile ULONG CompletionTail;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+} IO_RING_HEADER, *PIO_RING_HEADER;
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring submission entry.
+
+Members:
+
+    UserData - Stores an opaque value that is copied into the completion
+        entry for this operation.
+
+    Offset - Stores the file offset for read and write operations. Supply -1
+        to use and update the handle's current file position.
+
+    Buffer - Stores the user mode buffer for read and write operations.
+
+    Size - Stores the size of the buffer in bytes.
+
+    Handle - Stores the I/O handle to operate on.
+
+    Operation - Stores the operation to perform. See IO_RING_OPERATION_*
+        definitions.
+
+    Flags - Stores a bitmask of flags. See IO_RING_SUBMISSION_FLAG_*
+        definitions.
+
+    Events - Stores the poll events to wait for on poll operations, or the
+        SYS_FLUSH_FLAG_* flags for flush operations.
+
+    TimeoutInMilliseconds - Stores the timeout for the operation. Supply
+        SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+    SignalNumber - Stores the signal to send on completion if the signal flag
+        is set.
+
+--*/
+
+typedef struct _IO_RING_SUBMISSION {
+    ULONGLONG UserData;
+    IO_OFFSET Offset;
+    PVOID Buffer;
+    UINTN Size;
+    HANDLE Handle;
+    USHORT Operation;
+    USHORT Flags;
+    ULONG Events;
+    ULONG TimeoutInMilliseconds;
+    ULONG SignalNumber;
+} IO_RING_SUBMISSION, *PIO_RING_SUBMISSION;
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring completion entry.
+
+Members:
+
+    UserData - Stores the user data value from the submission.
+
+    Status - Stores the final status of the operation.
+
+    Events - Stores the returned events for poll operations.
+
+    BytesCompleted - Stores the number of bytes transferred for read and
+        write operations.
+
+--*/
+
+typedef struct _IO_RING_COMPLETION {
+    ULONGLONG UserData;
+    KSTATUS Status;
+    ULONG Events;
+    UINTN BytesCompleted;
+} IO_RING_COMPLETION, *PIO_RING_COMPLETION;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for the I/O ring control
+    operations.
+
+Members:
+
+    Operation - Stores the operation to perform.
+
+    RingNumber - Stores the ring to operate on, or returns the new ring number
+        for create operations.
+
+    Ring - Stores a pointer to the user mode ring memory for create operations.
+        This must be IO_RING_SIZE bytes large.
+
+    SubmissionCount - Stores the number of submission entries for create
+        operations, or the maximum number of entries to submit for enter
+        operations. On return from an enter operation, contains the number of
+        entries actually consumed from the submission queue.
+
+    CompletionCount - Stores the number of completion entries for create
+        operations, or the minimum number of completions to wait for before
+        returning from an enter operation.
+
+    TimeoutInMilliseconds - Stores the maximum time an enter operation should
+        wait for completions.
+
+--*/
+
+typedef struct _SYSTEM_CALL_IO_RING_CONTROL {
+    IO_RING_CONTROL_OPERATION Operation;
+    LONG RingNumber;
+    PVOID Ring;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG TimeoutInMilliseconds;
+} SYSCALL_STRUCT SYSTEM_CALL_IO_RING_CONTROL, *PSYSTEM_CALL_IO_RING_CONTROL;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for getting or setting
+    the scheduling policy of the current thread.
+
+Members:
+
+    Set - Stores a boolean indicating whether to set the policy (TRUE) or just
+        get it (FALSE).
+
+    Policy - Stores the scheduling policy to set, and returns the current
+        scheduling policy.
+
+    Priority - Stores the real-time priority to set, and returns the current
+        real-time priority. This must be zero for the normal policy, and
+        between SCHEDULER_REAL_TIME_PRIORITY_MINIMUM and
+        SCHEDULER_REAL_TIME_PRIORITY_MAXIMUM for the real-time policies.
+
+--*/
+
+typedef struct _SYSTEM_CALL_GET_SET_SCHEDULING_POLICY {
+    BOOL Set;
+    SCHEDULER_POLICY Policy;
+    ULONG Priority;
+} SYSCALL_STRUCT SYSTEM_CALL_GET_SET_SCHEDULING_POLICY,
+    *PSYSTEM_CALL_GET_SET_SCHEDULING_POLICY;
+
+/*++
+
 Structure Description:
 
     This structure defines a union of all possible system call parameter
@@ -2608,6 +2871,8 @@ typedef union _SYSTEM_CALL_PARAMETER_UNION {
     SYSTEM_CALL_SET_ITIMER SetITimer;
     SYSTEM_CALL_SET_RESOURCE_LIMIT SetResourceLimit;
     SYSTEM_CALL_SET_BREAK SetBreak;
+    SYSTEM_CALL_IO_RING_CONTROL IoRingControl;
+    SYSTEM_CALL_GET_SET_SCHEDULING_POLICY GetSetSchedulingPolicy;
 } SYSCALL_STRUCT SYSTEM_CALL_PARAMETER_UNION, *PSYSTEM_CALL_PARAMETER_UNION;
 
 typedef
@@ -124,6 +124,7 @@ Module Name:
 #define CR4_OS_XMM_EXCEPTIONS 0x00000400
 #define CR4_OS_FX_SAVE_RESTORE 0x00000200
 #define CR4_PAGE_GLOBAL_ENABLE 0x00000080
+#define CR4_PAGE_SIZE_EXTENSION 0x00000010
 
 #define PAGE_SIZE 4096
 #define PAGE_MASK 0x00000FFF
@@ -132,6 +133,21 @@ Module Name:
 #define PDE_INDEX_MASK 0xFFC00000
 #define PTE_INDEX_MASK 0x003FF000
 
+//
+// Define the bit the processor sets in a page table or directory entry when
+// the mapping is used.
+//
+
+#define PTE_ACCESSED 0x00000020
+
+//
+// Define the size of a large page mapped directly by a page directory entry
+// when page size extensions are enabled.
+//
+
+#define LARGE_PAGE_SIZE 0x00400000
+#define LARGE_PAGE_MASK 0x003FFFFF
+
 #define X86_FAULT_FLAG_PROTECTION_VIOLATION 0x00000001
 #define X86_FAULT_ERROR_CODE_WRITE          0x00000002
 
@@ -170,6 +186,7 @@ Module Name:
 #define X86_CPUID_BASIC_EAX_EXTENDED_FAMILY_SHIFT 20
 
 #define X86_CPUID_BASIC_ECX_MONITOR (1 << 3)
+#define X86_CPUID_BASIC_EDX_PAGE_SIZE_EXTENSION (1 << 3)
 #define X86_CPUID_BASIC_EDX_SYSENTER (1 << 11)
 #define X86_CPUID_BASIC_EDX_CMOV (1 << 15)
 #define X86_CPUID_BASIC_EDX_FX_SAVE_RESTORE (1 << 24)
@@ -800,6 +817,11 @@ Structure Description:
     PageTableCount - Stores the number of page tables that were allocated on
         behalf of this process (user mode only).
 
+    LargePageTables - Stores an optional pointer to an array of physical
+        addresses, indexed by user mode page directory index. Each large page
+        mapping has a pre-filled page table set aside here so that it can be
+        split back into small pages without allocating memory.
+
 --*/
 
 typedef struct _ADDRESS_SPACE_X86 {
@@ -807,6 +829,7 @@ typedef struct _ADDRESS_SPACE_X86 {
     PPTE PageDirectory;
     ULONG PageDirectoryPhysical;
     ULONG PageTableCount;
+    PULONG LargePageTables;
 } ADDRESS_SPACE_X86, *PADDRESS_SPACE_X86;
 
 //
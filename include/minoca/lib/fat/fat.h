@@ -855,6 +855,41 @@ Return Value:
 
 --*/
 
+KSTATUS
+FatBuildFreeClusterMap (
+    PVOID Volume,
+    ULONG WindowCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine builds part of the in-memory free cluster map for a mounted
+    volume. Once the map is complete, cluster allocations search it for
+    contiguous runs instead of scanning the File Allocation Table. Callers
+    typically invoke this repeatedly from a background context shortly after
+    mounting, until it stops returning STATUS_MORE_PROCESSING_REQUIRED.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    WindowCount - Supplies the maximum number of FAT cache windows to scan
+        during this call. The volume lock is dropped between windows.
+
+Return Value:
+
+    STATUS_SUCCESS if the free cluster map is complete.
+
+    STATUS_MORE_PROCESSING_REQUIRED if more of the map remains to be built.
+
+    STATUS_NOT_SUPPORTED if the volume is FAT12.
+
+    Other error codes on allocation or device I/O failures.
+
+--*/
+
 //
 // Prototypes of routines that support the FAT library.
 //
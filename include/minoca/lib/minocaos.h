@@ -532,6 +532,88 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsIoRingControl (
+    IO_RING_CONTROL_OPERATION Operation,
+    PLONG RingNumber,
+    PVOID Ring,
+    PULONG SubmissionCount,
+    ULONG CompletionCount,
+    ULONG TimeoutInMilliseconds
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates, destroys, or submits work to an I/O ring. An I/O
+    ring is a region of user mode memory shared with the kernel containing a
+    submission queue and a completion queue, which allows many I/O operations
+    to be started and reaped with a single system call.
+
+Arguments:
+
+    Operation - Supplies the operation to perform.
+
+    RingNumber - Supplies a pointer that on input contains the ring to operate
+        on. For create operations, returns the new ring number.
+
+    Ring - Supplies a pointer to the page aligned ring memory for create
+        operations. This must be IO_RING_SIZE bytes large.
+
+    SubmissionCount - Supplies a pointer that on input contains the number of
+        submission entries for create operations, or the maximum number of
+        entries to submit for enter operations. On output for enter
+        operations, returns the number of entries consumed.
+
+    CompletionCount - Supplies the number of completion entries for create
+        operations, or the minimum number of completions to wait for during
+        enter operations.
+
+    TimeoutInMilliseconds - Supplies the maximum time to wait for completions
+        during enter operations. Use SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+OS_API
+KSTATUS
+OsGetSetSchedulingPolicy (
+    BOOL Set,
+    PSCHEDULER_POLICY Policy,
+    PULONG Priority
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the scheduling policy and real-time priority of
+    the calling thread. Moving into a real-time policy or raising a real-time
+    priority requires the scheduling permission.
+
+Arguments:
+
+    Set - Supplies a boolean indicating whether to set (TRUE) or get (FALSE)
+        the scheduling policy.
+
+    Policy - Supplies a pointer that on input contains the new policy for set
+        operations. Returns the current policy for get operations.
+
+    Priority - Supplies a pointer that on input contains the new real-time
+        priority for set operations, which must be zero for the normal policy.
+        Returns the current priority for get operations.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 OS_API
 KSTATUS
 OsCreatePipe (
@@ -4205,6 +4287,112 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsUserLockRequeue (
+    PVOID Address,
+    ULONG Flags,
+    ULONG CompareValue,
+    PULONG WakeCount,
+    PVOID TargetAddress,
+    PULONG RequeueCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine wakes some of the threads waiting on one user mode lock
+    address and moves the remaining waiters over to wait on another address
+    without waking them. This avoids the thundering herd when broadcasting a
+    condition variable whose waiters will all immediately contend on the same
+    mutex.
+
+Arguments:
+
+    Address - Supplies a pointer to the 32-bit value the threads are waiting
+        on.
+
+    Flags - Supplies a bitfield of USER_LOCK_* flags. Both addresses must
+        agree on whether or not they are private.
+
+    CompareValue - Supplies the value the first address is expected to
+        contain. If it does not, nothing is woken or moved.
+
+    WakeCount - Supplies a pointer that on input contains the maximum number
+        of threads to wake. On output, contains the number of threads woken.
+
+    TargetAddress - Supplies a pointer to the 32-bit value that the remaining
+        waiters should be moved to.
+
+    RequeueCount - Supplies a pointer that on input contains the maximum
+        number of threads to move. On output, contains the number of threads
+        moved. If the two addresses are not backed by the same object, the
+        threads are woken instead of moved, and count as woken.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_OPERATION_WOULD_BLOCK if the first address did not contain the
+    compare value.
+
+    STATUS_ACCESS_VIOLATION if either address is invalid.
+
+--*/
+
+OS_API
+KSTATUS
+OsUserLockWakeOperation (
+    PVOID Address,
+    PVOID SecondAddress,
+    ULONG Flags,
+    ULONG Operation,
+    PULONG WakeCount,
+    PULONG SecondWakeCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine atomically modifies the value at the second address, wakes
+    threads waiting on the first address, and then wakes threads waiting on
+    the second address if the original value at the second address passes the
+    given comparison. This lets a caller update one lock and release waiters
+    on two in a single trip to the kernel.
+
+Arguments:
+
+    Address - Supplies a pointer to the first 32-bit lock value.
+
+    SecondAddress - Supplies a pointer to the second 32-bit lock value, which
+        is modified.
+
+    Flags - Supplies a bitfield of USER_LOCK_* flags.
+
+    Operation - Supplies the encoded operation and comparison. See
+        USER_LOCK_WAKE_ARGUMENT.
+
+    WakeCount - Supplies a pointer that on input contains the maximum number
+        of threads to wake on the first address. On output, contains the
+        number woken.
+
+    SecondWakeCount - Supplies a pointer that on input contains the maximum
+        number of threads to wake on the second address if the comparison
+        passes. On output, contains the number woken.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the encoded operation is invalid or the
+    second address is not aligned.
+
+    STATUS_ACCESS_VIOLATION if either address is invalid.
+
+--*/
+
 OS_API
 PVOID
 OsGetTlsAddress (
@@ -504,6 +504,16 @@ Module Name:
 
 #define HEAP_TREE_BIN_COUNT 32U
 
+//
+// Define the number of power of two size buckets kept for each allocation tag.
+// The first bucket holds chunks of up to 1 << MEMORY_HEAP_TAG_HISTOGRAM_SHIFT
+// bytes, each following bucket doubles that, and the last bucket holds
+// anything larger.
+//
+
+#define MEMORY_HEAP_TAG_HISTOGRAM_BUCKETS 12
+#define MEMORY_HEAP_TAG_HISTOGRAM_SHIFT 5
+
 //
 // Define Red-Black tree flags.
 //
@@ -1227,6 +1237,12 @@ Structure Description:
     LargestActiveAllocationCount - Stores the largest number the active
         allocation count has ever been for this tag.
 
+    LifetimeAllocationCount - Stores the total number of allocations that
+        have been made under this tag.
+
+    Histogram - Stores the number of active allocations under this tag in
+        each power of two size bucket.
+
 --*/
 
 typedef struct _MEMORY_HEAP_TAG_STATISTIC {
@@ -1238,6 +1254,8 @@ typedef struct _MEMORY_HEAP_TAG_STATISTIC {
     ULONGLONG LifetimeAllocationSize;
     ULONG ActiveAllocationCount;
     ULONG LargestActiveAllocationCount;
+    ULONGLONG LifetimeAllocationCount;
+    ULONG Histogram[MEMORY_HEAP_TAG_HISTOGRAM_BUCKETS];
 } MEMORY_HEAP_TAG_STATISTIC, *PMEMORY_HEAP_TAG_STATISTIC;
 
 /*++
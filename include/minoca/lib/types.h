@@ -188,21 +188,32 @@ typedef struct _UUID {
 
 Structure Description:
 
-    This structure defines a spin lock.
+    This structure defines a spin lock. Spin locks are ticket locks, so
+    waiters acquire the lock in the order they arrived.
 
 Members:
 
-    LockHeld - Stores TRUE if the lock is acquired by someone, or FALSE if the
-        lock is free.
+    Tickets - Stores the ticket state. The high 16 bits hold the next ticket
+        to hand out, and the low 16 bits hold the ticket currently allowed to
+        own the lock. The lock is free when the two are equal.
 
     OwningThread - Stores a pointer to the KTHREAD that holds the lock if the
         lock is held.
 
+    AcquireTime - Stores the low 32 bits of the processor counter when the
+        lock was acquired. This is only valid if the statistics member is set.
+
+    Statistics - Stores a pointer to the spin lock statistics entry for the
+        site that acquired the lock, or NULL if lock statistics were not
+        collected for this acquisition.
+
 --*/
 
 typedef struct _KSPIN_LOCK {
-    volatile ULONG LockHeld;
+    volatile ULONG Tickets;
     volatile PVOID OwningThread;
+    ULONG AcquireTime;
+    PVOID Statistics;
 } KSPIN_LOCK, *PKSPIN_LOCK;
 
 //
@@ -55,6 +55,12 @@ Module Name:
 #define GT_CONTROL_INTERRUPT_MASKED          0x00000002
 #define GT_CONTROL_TIMER_ENABLE              0x00000001
 
+//
+// Define the bits for the generic timer kernel control register.
+//
+
+#define GT_KERNEL_CONTROL_USER_VIRTUAL_COUNT 0x00000002
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -100,6 +106,11 @@ HlpGtSetVirtualTimerControl (
     ULONG Control
     );
 
+VOID
+HlpGtSetKernelControl (
+    ULONG Control
+    );
+
 ULONGLONG
 HlpGtGetVirtualCount (
     VOID
@@ -198,6 +209,7 @@ Return Value:
     Gt.Features = TIMER_FEATURE_ABSOLUTE |
                   TIMER_FEATURE_ONE_SHOT |
                   TIMER_FEATURE_READABLE |
+                  TIMER_FEATURE_USER_READABLE |
                   TIMER_FEATURE_PER_PROCESSOR;
 
     Gt.CounterBitWidth = 64;
@@ -258,10 +270,13 @@ Return Value:
 {
 
     //
-    // The timer is already running, just make sure interrupts are off.
+    // The timer is already running, just make sure interrupts are off. Allow
+    // user mode to read the virtual count so it can get the time without a
+    // system call.
     //
 
     HlpGtSetVirtualTimerControl(0);
+    HlpGtSetKernelControl(GT_KERNEL_CONTROL_USER_VIRTUAL_COUNT);
     return STATUS_SUCCESS;
 }
 
@@ -54,6 +54,11 @@ HlpClockInterruptHandler (
     PVOID Context
     );
 
+VOID
+HlpClockForwardInterrupt (
+    VOID
+    );
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -62,6 +67,7 @@ typedef struct _CLOCK_REQUEST {
     CLOCK_TIMER_MODE Mode;
     ULONGLONG DueTime;
     BOOL Hard;
+    BOOL Signal;
 } CLOCK_REQUEST, *PCLOCK_REQUEST;
 
 //
@@ -82,6 +88,13 @@ ULONGLONG HlClockRate;
 
 ULONGLONG HlClockRateInTimeCounterTicks;
 
+//
+// Store the amount of time counter ticks a one-shot clock interrupt may fire
+// ahead of its due time due to rounding down to clock timer ticks.
+//
+
+ULONGLONG HlClockDeadlineSlack;
+
 //
 // Store a variable indicating whether clock interrupts are broadcast.
 //
@@ -458,6 +471,9 @@ Return Value:
         HlClockRateInTimeCounterTicks = HlpTimerTimeToTicks(HlTimeCounter,
                                                             DEFAULT_CLOCK_RATE);
 
+        HlClockDeadlineSlack = (HlTimeCounter->CounterFrequency /
+                                HlClockTimer->CounterFrequency) + 1;
+
         //
         // Fire up the clock timer.
         //
@@ -639,7 +655,6 @@ Return Value:
 
     ULONGLONG ClockTicks;
     ULONGLONG CurrentTime;
-    PROCESSOR_SET Processors;
     TIMER_MODE SupportedMode;
 
     //
@@ -713,12 +728,11 @@ Return Value:
         }
 
         //
-        // Broadcast the clock interrupt if needed.
+        // Forward the clock interrupt to the processors that want it.
         //
 
         if (HlBroadcastClockInterrupts != FALSE) {
-            Processors.Target = ProcessorTargetAllExcludingSelf;
-            HlSendIpi(IpiTypeClock, &Processors);
+            HlpClockForwardInterrupt();
         }
     }
 
@@ -761,3 +775,86 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+VOID
+HlpClockForwardInterrupt (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine forwards a real clock interrupt from processor zero to the
+    other processors sharing the clock timer. Only processors in periodic mode
+    and processors whose one-shot deadline has arrived are interrupted, so
+    that idle processors with nothing due can stay in deep idle states. This
+    routine must be called at clock level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG CurrentTime;
+    ULONG Index;
+    ULONG ProcessorCount;
+    PROCESSOR_SET Processors;
+    PCLOCK_REQUEST Request;
+    ULONG Self;
+    ULONG SignalCount;
+
+    ProcessorCount = KeGetActiveProcessorCount();
+    Self = KeGetCurrentProcessorNumber();
+    SignalCount = 0;
+    KeAcquireSpinLock(&HlClockDataLock);
+    CurrentTime = HlQueryTimeCounter() + HlClockDeadlineSlack;
+    for (Index = 0; Index < ProcessorCount; Index += 1) {
+        Request = &(HlClockRequests[Index]);
+        Request->Signal = FALSE;
+        if (Index == Self) {
+            continue;
+        }
+
+        if ((Request->Mode == ClockTimerPeriodic) ||
+            ((Request->Mode == ClockTimerOneShot) &&
+             (Request->DueTime <= CurrentTime))) {
+
+            Request->Signal = TRUE;
+            SignalCount += 1;
+        }
+    }
+
+    KeReleaseSpinLock(&HlClockDataLock);
+
+    //
+    // A single broadcast is cheaper when everyone wants the interrupt.
+    //
+
+    if ((SignalCount != 0) && (SignalCount == ProcessorCount - 1)) {
+        Processors.Target = ProcessorTargetAllExcludingSelf;
+        HlSendIpi(IpiTypeClock, &Processors);
+        return;
+    }
+
+    Processors.Target = ProcessorTargetSingleProcessor;
+    for (Index = 0;
+         (Index < ProcessorCount) && (SignalCount != 0);
+         Index += 1) {
+
+        if (HlClockRequests[Index].Signal != FALSE) {
+            Processors.U.Number = Index;
+            HlSendIpi(IpiTypeClock, &Processors);
+            SignalCount -= 1;
+        }
+    }
+
+    return;
+}
+
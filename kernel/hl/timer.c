@@ -129,6 +129,11 @@ HlpTimerCreateSoftUpdateTimer (
     PHARDWARE_TIMER Timer
     );
 
+VOID
+HlpTimerPublishTimeCounter (
+    PHARDWARE_TIMER Timer
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -2195,6 +2200,68 @@ Return Value:
 
     NewOffset = NewValue - Counter;
     WRITE_INT64_SYNC(&(Timer->SoftwareOffset), NewOffset);
+    if (Timer == HlTimeCounter) {
+        HlpTimerPublishTimeCounter(Timer);
+    }
+
+    return;
+}
+
+VOID
+HlpTimerPublishTimeCounter (
+    PHARDWARE_TIMER Timer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine publishes the time counter's software offset in the user
+    shared data page so that user mode can read the time counter without a
+    system call, if the hardware allows it.
+
+Arguments:
+
+    Timer - Supplies a pointer to the time counter.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Flags;
+    ULONGLONG Offset;
+    ULONG Sequence;
+    PUSER_SHARED_DATA UserSharedData;
+
+    Flags = 0;
+
+    //
+    // Timers narrower than 64 bits need the kernel's rollover tracking, so
+    // they cannot be read directly.
+    //
+
+    if (((Timer->Features & TIMER_FEATURE_USER_READABLE) != 0) &&
+        (Timer->CounterBitWidth >= 64)) {
+
+        Flags |= USER_TIME_COUNTER_FLAG_USER_READABLE;
+    }
+
+    READ_INT64_SYNC(&(Timer->SoftwareOffset), &Offset);
+    UserSharedData = MmGetUserSharedData();
+    Sequence = UserSharedData->TimeCounterSequence;
+
+    ASSERT((Sequence & 0x1) == 0);
+
+    UserSharedData->TimeCounterSequence = Sequence + 1;
+    RtlMemoryBarrier();
+    UserSharedData->TimeCounterOffset = Offset;
+    UserSharedData->TimeCounterFlags = Flags;
+    RtlMemoryBarrier();
+    UserSharedData->TimeCounterSequence = Sequence + 2;
     return;
 }
 
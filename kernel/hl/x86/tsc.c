@@ -124,6 +124,15 @@ Return Value:
 
     TscTimer.Features |= HlpTscDetermineCharacteristics();
 
+    //
+    // An invariant TSC is a good enough time source to hand to user mode.
+    // The kernel leaves rdtsc enabled at all privilege levels.
+    //
+
+    if ((TscTimer.Features & TIMER_FEATURE_VARIANT) == 0) {
+        TscTimer.Features |= TIMER_FEATURE_USER_READABLE;
+    }
+
     //
     // The timer's frequency is not hardcoded, as it runs at the main CPU speed,
     // which must be measured.
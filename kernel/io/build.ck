@@ -47,6 +47,7 @@ function build() {
         "intrupt.c",
         "iobase.c",
         "iohandle.c",
+        "ioring.c",
         "irp.c",
         "mount.c",
         "obfs.c",
@@ -161,6 +161,26 @@ IopPerformDefaultPartialWrite (
     UINTN IoBufferOffset
     );
 
+KSTATUS
+IopPerformDirectRead (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    );
+
+KSTATUS
+IopPerformDirectWrite (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    );
+
+VOID
+IopUpdateCachedPagesForDirectWrite (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -198,6 +218,7 @@ Return Value:
 
 {
 
+    BOOL Direct;
     PFILE_OBJECT FileObject;
     UINTN FlushCount;
     BOOL LockHeldExclusive;
@@ -232,6 +253,20 @@ Return Value:
 
     IopTrimPageCache(TimidTrim);
 
+    //
+    // Direct I/O bypasses the page cache for regular files. It is ignored for
+    // everything else (block devices, shared memory objects, etc.) as those
+    // either have no backing store or are the backing store for the cache.
+    //
+
+    Direct = FALSE;
+    if (((Handle->OpenFlags & OPEN_FLAG_DIRECT) != 0) &&
+        (FileObject->Properties.Type == IoObjectRegularFile) &&
+        (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE)) {
+
+        Direct = TRUE;
+    }
+
     //
     // If this is a write operation, then acquire the file object's lock
     // exclusively and perform the cached write.
@@ -250,7 +285,7 @@ Return Value:
         // 3) Otherwise go clean some entries.
         //
 
-        if (IopIsPageCacheTooDirty() != FALSE) {
+        if ((Direct == FALSE) && (IopIsPageCacheTooDirty() != FALSE)) {
             if (FileObject->Properties.Type == IoObjectBlockDevice) {
                 IoContext->Flags |= IO_FLAG_DATA_SYNCHRONIZED;
 
@@ -286,7 +321,12 @@ Return Value:
                             &(IoContext->Offset));
         }
 
-        if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+        if (Direct != FALSE) {
+            Status = IopPerformDirectWrite(FileObject,
+                                           IoContext,
+                                           Handle->DeviceContext);
+
+        } else if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
             Status = IopPerformCachedWrite(FileObject, IoContext);
 
         } else {
@@ -312,7 +352,12 @@ Return Value:
         }
 
         LockHeldExclusive = FALSE;
-        if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+        if (Direct != FALSE) {
+            Status = IopPerformDirectRead(FileObject,
+                                          IoContext,
+                                          Handle->DeviceContext);
+
+        } else if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
             Status = IopPerformCachedRead(FileObject,
                                           IoContext,
                                           &LockHeldExclusive);
@@ -1180,7 +1225,8 @@ Return Value:
     // are if this is a page aligned write that goes up to or beyond the end
     // of the file or this is a non-aligned write and the entire page is beyond
     // the end of the file. Nothing need be read in and those are handled in
-    // the "else" clause.
+    // the "else" clause. Shared memory objects kept in memory always read, as
+    // the read hands back a page of the object's own memory to write into.
     //
 
     if (((WriteContext->PageByteOffset != 0) &&
@@ -1188,7 +1234,8 @@ Return Value:
         ((WriteContext->PageByteOffset == 0) &&
          (WriteContext->BytesRemaining < PageSize) &&
          ((WriteContext->FileOffset + WriteContext->BytesRemaining) <
-          WriteContext->FileSize))) {
+          WriteContext->FileSize)) ||
+        (IopIsSharedMemoryObjectInMemory(FileObject) != FALSE)) {
 
         //
         // Prepare a one page I/O buffer to collect the missing page cache
@@ -2424,3 +2471,262 @@ Return Value:
     return Status;
 }
 
+
+KSTATUS
+IopPerformDirectRead (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a direct read from a cacheable file object on behalf
+    of a handle opened with OPEN_FLAG_DIRECT. The data travels straight from
+    the backing device into the caller's buffer. Any dirty page cache data in
+    the range is written out first so that the read observes it. It is assumed
+    that the file object lock is held shared.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a cacheable file object.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+    DeviceContext - Supplies a pointer to the device context to use when
+        reading from the backing device.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if the offset or size is not page aligned.
+
+    Otherwise returns the status of the non-cached read.
+
+--*/
+
+{
+
+    ULONG PageSize;
+    KSTATUS Status;
+
+    ASSERT(IoContext->Write == FALSE);
+    ASSERT(KeIsSharedExclusiveLockHeldShared(FileObject->Lock) != FALSE);
+
+    IoContext->BytesCompleted = 0;
+    PageSize = MmPageSize();
+    if ((IS_ALIGNED(IoContext->Offset, PageSize) == FALSE) ||
+        (IS_ALIGNED(IoContext->SizeInBytes, PageSize) == FALSE)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (IoContext->SizeInBytes == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Dirty page cache entries hold data newer than what is on the device.
+    // Get it out to the device before reading around the cache.
+    //
+
+    if ((FileObject->Flags & FILE_OBJECT_FLAG_DIRTY_DATA) != 0) {
+        Status = IopFlushPageCacheEntries(FileObject,
+                                          IoContext->Offset,
+                                          IoContext->SizeInBytes,
+                                          0,
+                                          NULL);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    Status = IopPerformNonCachedRead(FileObject, IoContext, DeviceContext);
+    return Status;
+}
+
+KSTATUS
+IopPerformDirectWrite (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a direct write to a cacheable file object on behalf
+    of a handle opened with OPEN_FLAG_DIRECT. The data travels straight from
+    the caller's buffer to the backing device, and any pages of the range that
+    happen to be in the page cache are refreshed afterwards so that cached
+    readers and mappings stay coherent. It is assumed that the file object lock
+    is held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a cacheable file object.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+    DeviceContext - Supplies a pointer to the device context to use when
+        writing to the backing device.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if the offset or size is not page aligned.
+
+    Otherwise returns the status of the non-cached write.
+
+--*/
+
+{
+
+    ULONG PageSize;
+    KSTATUS Status;
+
+    ASSERT(IoContext->Write != FALSE);
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
+
+    IoContext->BytesCompleted = 0;
+    PageSize = MmPageSize();
+    if ((IS_ALIGNED(IoContext->Offset, PageSize) == FALSE) ||
+        (IS_ALIGNED(IoContext->SizeInBytes, PageSize) == FALSE)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (IoContext->SizeInBytes == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // The lower layers (e.g. a file system writing through the block device's
+    // cache) must not hold on to the data either.
+    //
+
+    IoContext->Flags |= IO_FLAG_DATA_SYNCHRONIZED;
+    Status = IopPerformNonCachedWrite(FileObject, IoContext, DeviceContext);
+    if (IoContext->BytesCompleted != 0) {
+        IopUpdateCachedPagesForDirectWrite(FileObject, IoContext);
+    }
+
+    return Status;
+}
+
+VOID
+IopUpdateCachedPagesForDirectWrite (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies freshly written direct I/O data into any page cache
+    entries that cover the written range. The entries are then marked clean,
+    as their contents now match the device. Since direct writes are page
+    aligned, each cached page is overwritten in its entirety, so any dirty
+    data it held is superseded rather than lost. Entries that cannot be
+    updated are evicted. The file object lock must be held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object that was written.
+
+    IoContext - Supplies a pointer to the completed I/O context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BytesThisRound;
+    PPAGE_CACHE_ENTRY CacheEntry;
+    IO_OFFSET EndOffset;
+    IO_OFFSET Offset;
+    IO_BUFFER PageCacheBuffer;
+    ULONG PageSize;
+    UINTN SourceOffset;
+    KSTATUS Status;
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
+
+    if (RED_BLACK_TREE_EMPTY(&(FileObject->PageCacheTree)) != FALSE) {
+        return;
+    }
+
+    PageSize = MmPageSize();
+    Offset = IoContext->Offset;
+    EndOffset = Offset + IoContext->BytesCompleted;
+    SourceOffset = 0;
+    while (Offset < EndOffset) {
+        BytesThisRound = PageSize;
+        if ((EndOffset - Offset) < BytesThisRound) {
+            BytesThisRound = EndOffset - Offset;
+        }
+
+        CacheEntry = IopLookupPageCacheEntry(FileObject, Offset);
+        if (CacheEntry != NULL) {
+            Status = MmInitializeIoBuffer(&PageCacheBuffer,
+                                          NULL,
+                                          INVALID_PHYSICAL_ADDRESS,
+                                          0,
+                                          IO_BUFFER_FLAG_KERNEL_MODE_DATA);
+
+            if (KSUCCESS(Status)) {
+                MmIoBufferAppendPage(&PageCacheBuffer,
+                                     CacheEntry,
+                                     NULL,
+                                     INVALID_PHYSICAL_ADDRESS);
+
+                Status = MmCopyIoBuffer(&PageCacheBuffer,
+                                        0,
+                                        IoContext->IoBuffer,
+                                        SourceOffset,
+                                        BytesThisRound);
+
+                MmFreeIoBuffer(&PageCacheBuffer);
+            }
+
+            //
+            // Mark the page clean whether or not the copy worked, as writing
+            // a page back that was already dirty would clobber the data just
+            // written to the device.
+            //
+
+            IopMarkPageCacheEntryClean(CacheEntry, TRUE);
+            IoPageCacheEntryReleaseReference(CacheEntry);
+
+            //
+            // If the copy failed, the page still holds the old contents.
+            // Evict it so readers and mappings pick up the new data from the
+            // device instead.
+            //
+
+            if (!KSUCCESS(Status)) {
+                if (FileObject->ImageSectionList != NULL) {
+                    MmUnmapImageSectionList(
+                                      FileObject->ImageSectionList,
+                                      Offset,
+                                      PageSize,
+                                      IMAGE_SECTION_UNMAP_FLAG_PAGE_CACHE_ONLY);
+                }
+
+                IopEvictPageCacheEntries(FileObject, Offset, PageSize, 0);
+            }
+        }
+
+        Offset += BytesThisRound;
+        SourceOffset += BytesThisRound;
+    }
+
+    return;
+}
+
@@ -1736,7 +1736,7 @@ Return Value:
     // Evict the page cache entries for the file object.
     //
 
-    IopEvictPageCacheEntries(FileObject, Offset, Flags);
+    IopEvictPageCacheEntries(FileObject, Offset, -1ULL, Flags);
     return;
 }
 
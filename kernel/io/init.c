@@ -343,6 +343,15 @@ Return Value:
         goto InitializeEnd;
     }
 
+    //
+    // Initialize I/O ring support.
+    //
+
+    Status = IopInitializeIoRingSupport();
+    if (!KSUCCESS(Status)) {
+        goto InitializeEnd;
+    }
+
     //
     // Initialize the device database.
     //
@@ -2299,10 +2299,16 @@ Return Value:
                                        SourceFileObject);
 
             if (NewPathEntry != NULL) {
+                IO_PATH_ENTRY_BEGIN_CHILD_UPDATE(
+                                      DestinationDirectoryPathPoint.PathEntry);
+
                 INSERT_BEFORE(
                         &(NewPathEntry->SiblingListEntry),
                         &(DestinationDirectoryPathPoint.PathEntry->ChildList));
 
+                IO_PATH_ENTRY_END_CHILD_UPDATE(
+                                      DestinationDirectoryPathPoint.PathEntry);
+
                 IopFileObjectAddReference(SourceFileObject);
             }
         }
@@ -63,6 +63,7 @@ Module Name:
 #define FILE_LOCK_ALLOCATION_TAG 0x6B434C46 // 'kcLF'
 #define SOCKET_INFORMATION_ALLOCATION_TAG 0x666E4953 // 'fnIS'
 #define UNIX_SOCKET_ALLOCATION_TAG 0x6F536E55 // 'oSnU'
+#define IO_RING_ALLOCATION_TAG 0x67526F49 // 'gRoI'
 
 #define IRP_MAGIC_VALUE (USHORT)IRP_ALLOCATION_TAG
 
@@ -290,6 +291,21 @@ Module Name:
 #define IO_IS_MOUNT_POINT(_PathPoint) \
     ((_PathPoint)->PathEntry == (_PathPoint)->MountPoint->TargetEntry)
 
+//
+// These macros bracket any change to a path entry's list of children (or to
+// the identity of one of those children) so that lockless path walkers can
+// detect that they raced with the change. The caller must hold the path
+// entry's file object lock exclusively.
+//
+
+#define IO_PATH_ENTRY_BEGIN_CHILD_UPDATE(_PathEntry)   \
+    (_PathEntry)->ChildSequence += 1;                  \
+    RtlMemoryBarrier();
+
+#define IO_PATH_ENTRY_END_CHILD_UPDATE(_PathEntry)     \
+    RtlMemoryBarrier();                                \
+    (_PathEntry)->ChildSequence += 1;
+
 //
 // This macro determines whether this is a cacheable file-ish object. It
 // excludes block and character devices.
@@ -456,6 +472,11 @@ Structure Description:
 
     ChildList - Stores the list of children for this node.
 
+    ChildSequence - Stores the sequence counter for the child list. It is odd
+        while the child list is being modified and is incremented again when
+        the modification is complete. Lockless path walkers use it to validate
+        what they found.
+
     FileObject - Stores a pointer to the file object backing this path entry.
 
 --*/
@@ -472,6 +493,7 @@ struct _PATH_ENTRY {
     ULONG Hash;
     PPATH_ENTRY Parent;
     LIST_ENTRY ChildList;
+    volatile ULONG ChildSequence;
     PFILE_OBJECT FileObject;
 };
 
@@ -3748,6 +3770,31 @@ Return Value:
 
 --*/
 
+BOOL
+IopIsSharedMemoryObjectInMemory (
+    PFILE_OBJECT FileObject
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given file object is a shared memory
+    object whose contents live in memory chunks rather than a backing image.
+    Page cache entries for such an object borrow the chunks' physical pages.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a file object.
+
+Return Value:
+
+    TRUE if the file object is a shared memory object kept in memory.
+
+    FALSE otherwise.
+
+--*/
+
 KSTATUS
 IopUnlinkSharedMemoryObject (
     PFILE_OBJECT FileObject,
@@ -4900,3 +4947,24 @@ Return Value:
 
 --*/
 
+KSTATUS
+IopInitializeIoRingSupport (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes support for I/O rings.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
@@ -0,0 +1,1656 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements I/O rings, which allow user mode to post batches of
+    read, write, flush, and poll operations into memory shared with the kernel
+    and reap their completions from that same memory, without a system call
+    per operation.
+
+Author:
+
+    Evan Green 14-Mar-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the maximum number of worker threads each ring may have. Every
+// blocking request parks a worker, so a ring grows workers on demand until
+// each queued request has one. Workers belong to a single ring, so requests
+// blocked on one ring never hold up another.
+//
+
+#define IO_RING_MAX_WORKERS 32
+
+//
+// Define the longest time in milliseconds a worker will block in one go
+// before checking whether the ring it is working for is being torn down.
+//
+
+#define IO_RING_WAIT_SLICE 100
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines the kernel's view of an I/O ring.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous rings in the global
+        list.
+
+    Process - Stores a pointer to the process that owns the ring.
+
+    RingNumber - Stores the identifier user mode uses to refer to the ring.
+
+    ReferenceCount - Stores the reference count on the ring.
+
+    Closing - Stores a boolean indicating that the ring is being destroyed.
+
+    SubmitLock - Stores a pointer to the lock serializing submissions.
+
+    CompletionLock - Stores a pointer to the lock serializing completions.
+
+    CompletionEvent - Stores a pointer to an event signaled whenever a
+        completion is posted.
+
+    UserBuffer - Stores a pointer to the I/O buffer describing the user mode
+        ring memory.
+
+    LockedBuffer - Stores a pointer to the locked and kernel mapped copy of
+        the user buffer.
+
+    Header - Stores the kernel mapping of the shared ring header.
+
+    Submissions - Stores the kernel mapping of the submission array.
+
+    Completions - Stores the kernel mapping of the completion array.
+
+    SubmissionCount - Stores the number of submission entries.
+
+    CompletionCount - Stores the number of completion entries.
+
+    SubmissionHead - Stores the kernel's private copy of the submission head.
+
+    CompletionTail - Stores the kernel's private copy of the completion tail.
+
+    InFlightCount - Stores the number of requests that have been consumed
+        from the submission queue but not yet posted as completions.
+
+    RequestLock - Stores a pointer to the lock protecting the request queue
+        and worker counts.
+
+    RequestList - Stores the head of the list of requests waiting for a
+        worker.
+
+    RequestEvent - Stores a pointer to the event the ring's workers wait on.
+        It is signaled while requests are queued or the ring is closing.
+
+    DrainEvent - Stores a pointer to the event signaled when a closing ring
+        is down to the destroyer's reference.
+
+    QueuedCount - Stores the number of requests on the request list.
+
+    WorkerCount - Stores the number of worker threads serving this ring.
+
+    IdleWorkerCount - Stores the number of workers waiting for requests.
+
+--*/
+
+typedef struct _IO_RING {
+    LIST_ENTRY ListEntry;
+    PKPROCESS Process;
+    LONG RingNumber;
+    volatile ULONG ReferenceCount;
+    volatile BOOL Closing;
+    PQUEUED_LOCK SubmitLock;
+    PQUEUED_LOCK CompletionLock;
+    PKEVENT CompletionEvent;
+    PIO_BUFFER UserBuffer;
+    PIO_BUFFER LockedBuffer;
+    PIO_RING_HEADER Header;
+    PIO_RING_SUBMISSION Submissions;
+    PIO_RING_COMPLETION Completions;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG SubmissionHead;
+    ULONG CompletionTail;
+    volatile ULONG InFlightCount;
+    PQUEUED_LOCK RequestLock;
+    LIST_ENTRY RequestList;
+    PKEVENT RequestEvent;
+    PKEVENT DrainEvent;
+    ULONG QueuedCount;
+    ULONG WorkerCount;
+    ULONG IdleWorkerCount;
+} IO_RING, *PIO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single I/O ring operation in flight.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous requests in the
+        worker queue.
+
+    Ring - Stores a pointer to the ring the request came from. The request
+        holds a reference on the ring.
+
+    Submission - Stores a kernel copy of the submission entry.
+
+    Handle - Stores a pointer to the I/O handle being operated on.
+
+    UserBuffer - Stores a pointer to the I/O buffer describing the user's
+        data buffer.
+
+    LockedBuffer - Stores a pointer to the locked copy of the user buffer,
+        which can be accessed from any process context.
+
+--*/
+
+typedef struct _IO_RING_REQUEST {
+    LIST_ENTRY ListEntry;
+    PIO_RING Ring;
+    IO_RING_SUBMISSION Submission;
+    PIO_HANDLE Handle;
+    PIO_BUFFER UserBuffer;
+    PIO_BUFFER LockedBuffer;
+} IO_RING_REQUEST, *PIO_RING_REQUEST;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+IopCreateIoRing (
+    PSYSTEM_CALL_IO_RING_CONTROL Parameters
+    );
+
+VOID
+IopDestroyIoRing (
+    PIO_RING Ring
+    );
+
+KSTATUS
+IopEnterIoRing (
+    PIO_RING Ring,
+    PULONG SubmitCount,
+    ULONG MinimumCompletions,
+    ULONG TimeoutInMilliseconds
+    );
+
+PIO_RING
+IopLookupIoRing (
+    PKPROCESS Process,
+    LONG RingNumber,
+    BOOL Remove
+    );
+
+VOID
+IopIoRingAddReference (
+    PIO_RING Ring
+    );
+
+VOID
+IopIoRingReleaseReference (
+    PIO_RING Ring
+    );
+
+KSTATUS
+IopPrepareIoRingRequest (
+    PIO_RING Ring,
+    PIO_RING_SUBMISSION Submission,
+    PIO_RING_REQUEST *NewRequest
+    );
+
+VOID
+IopDestroyIoRingRequest (
+    PIO_RING_REQUEST Request
+    );
+
+VOID
+IopPostIoRingCompletion (
+    PIO_RING Ring,
+    PIO_RING_SUBMISSION Submission,
+    KSTATUS Status,
+    ULONG Events,
+    UINTN BytesCompleted
+    );
+
+VOID
+IopQueueIoRingRequests (
+    PIO_RING Ring,
+    PLIST_ENTRY Requests,
+    ULONG Count
+    );
+
+VOID
+IopIoRingWorkerThread (
+    PVOID Parameter
+    );
+
+VOID
+IopPerformIoRingRequest (
+    PIO_RING_REQUEST Request
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the list of all I/O rings in the system, and the lock protecting it.
+//
+
+PQUEUED_LOCK IoRingListLock;
+LIST_ENTRY IoRingList;
+LONG IoNextRingNumber;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INTN
+IoSysIoRingControl (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the I/O ring system call, which creates and
+    destroys I/O rings and submits batches of operations to them.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PSYSTEM_CALL_IO_RING_CONTROL Parameters;
+    PKPROCESS Process;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    Parameters = (PSYSTEM_CALL_IO_RING_CONTROL)SystemCallParameter;
+    Process = PsGetCurrentProcess();
+
+    ASSERT(Process != PsGetKernelProcess());
+
+    switch (Parameters->Operation) {
+    case IoRingControlCreate:
+        Status = IopCreateIoRing(Parameters);
+        break;
+
+    case IoRingControlDestroy:
+        Ring = IopLookupIoRing(Process, Parameters->RingNumber, TRUE);
+        if (Ring == NULL) {
+            Status = STATUS_INVALID_HANDLE;
+            break;
+        }
+
+        IopDestroyIoRing(Ring);
+        Status = STATUS_SUCCESS;
+        break;
+
+    case IoRingControlEnter:
+        Ring = IopLookupIoRing(Process, Parameters->RingNumber, FALSE);
+        if (Ring == NULL) {
+            Status = STATUS_INVALID_HANDLE;
+            break;
+        }
+
+        Status = IopEnterIoRing(Ring,
+                                &(Parameters->SubmissionCount),
+                                Parameters->CompletionCount,
+                                Parameters->TimeoutInMilliseconds);
+
+        IopIoRingReleaseReference(Ring);
+        break;
+
+    default:
+        Status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+    return Status;
+}
+
+VOID
+IoDestroyProcessIoRings (
+    PKPROCESS Process
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys all I/O rings owned by the given process, waiting
+    for any operations still in flight to finish.
+
+Arguments:
+
+    Process - Supplies a pointer to the process whose rings should be
+        destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PIO_RING Ring;
+
+    if (IoRingListLock == NULL) {
+        return;
+    }
+
+    while (TRUE) {
+        Ring = NULL;
+        KeAcquireQueuedLock(IoRingListLock);
+        CurrentEntry = IoRingList.Next;
+        while (CurrentEntry != &IoRingList) {
+            Ring = LIST_VALUE(CurrentEntry, IO_RING, ListEntry);
+            if (Ring->Process == Process) {
+                IopIoRingAddReference(Ring);
+                LIST_REMOVE(&(Ring->ListEntry));
+                Ring->ListEntry.Next = NULL;
+                break;
+            }
+
+            Ring = NULL;
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        KeReleaseQueuedLock(IoRingListLock);
+        if (Ring == NULL) {
+            break;
+        }
+
+        IopDestroyIoRing(Ring);
+    }
+
+    return;
+}
+
+KSTATUS
+IopInitializeIoRingSupport (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes support for I/O rings.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    INITIALIZE_LIST_HEAD(&IoRingList);
+    IoRingListLock = KeCreateQueuedLock();
+    if (IoRingListLock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+IopCreateIoRing (
+    PSYSTEM_CALL_IO_RING_CONTROL Parameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new I/O ring on top of the user mode memory
+    described in the parameters. The memory is locked down and mapped into
+    kernel space so that completions can be posted from any context.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the system call parameters. On success,
+        the ring number is returned here.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_BUFFER LockedBuffer;
+    BOOL LockedCopy;
+    PIO_RING Ring;
+    UINTN Size;
+    KSTATUS Status;
+
+    Ring = NULL;
+    if ((Parameters->SubmissionCount == 0) ||
+        (Parameters->SubmissionCount > IO_RING_MAX_ENTRIES) ||
+        (POWER_OF_2(Parameters->SubmissionCount) == FALSE) ||
+        (Parameters->CompletionCount == 0) ||
+        (Parameters->CompletionCount > IO_RING_MAX_ENTRIES) ||
+        (POWER_OF_2(Parameters->CompletionCount) == FALSE) ||
+        (IS_POINTER_ALIGNED(Parameters->Ring, MmPageSize()) == FALSE)) {
+
+        Status = STATUS_INVALID_PARAMETER;
+        goto CreateIoRingEnd;
+    }
+
+    Size = IO_RING_SIZE(Parameters->SubmissionCount,
+                        Parameters->CompletionCount);
+
+    if ((Parameters->Ring + Size > KERNEL_VA_START) ||
+        (Parameters->Ring + Size < Parameters->Ring)) {
+
+        Status = STATUS_ACCESS_VIOLATION;
+        goto CreateIoRingEnd;
+    }
+
+    Ring = MmAllocateNonPagedPool(sizeof(IO_RING), IO_RING_ALLOCATION_TAG);
+    if (Ring == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    RtlZeroMemory(Ring, sizeof(IO_RING));
+    Ring->ReferenceCount = 1;
+    Ring->Process = PsGetCurrentProcess();
+    Ring->SubmissionCount = Parameters->SubmissionCount;
+    Ring->CompletionCount = Parameters->CompletionCount;
+    INITIALIZE_LIST_HEAD(&(Ring->RequestList));
+    Ring->SubmitLock = KeCreateQueuedLock();
+    Ring->CompletionLock = KeCreateQueuedLock();
+    Ring->CompletionEvent = KeCreateEvent(NULL);
+    Ring->RequestLock = KeCreateQueuedLock();
+    Ring->RequestEvent = KeCreateEvent(NULL);
+    Ring->DrainEvent = KeCreateEvent(NULL);
+    if ((Ring->SubmitLock == NULL) ||
+        (Ring->CompletionLock == NULL) ||
+        (Ring->CompletionEvent == NULL) ||
+        (Ring->RequestLock == NULL) ||
+        (Ring->RequestEvent == NULL) ||
+        (Ring->DrainEvent == NULL)) {
+
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    //
+    // The kernel writes into the ring, so make sure user mode is actually
+    // allowed to write there before pinning it down.
+    //
+
+    Status = MmTouchUserModeBuffer(Parameters->Ring, Size, TRUE);
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    Status = MmCreateIoBuffer(Parameters->Ring, Size, 0, &(Ring->UserBuffer));
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    LockedBuffer = Ring->UserBuffer;
+    Status = MmValidateIoBuffer(0,
+                                MAX_ULONGLONG,
+                                0,
+                                Size,
+                                FALSE,
+                                &LockedBuffer,
+                                &LockedCopy);
+
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    Ring->LockedBuffer = LockedBuffer;
+    if (LockedCopy == FALSE) {
+        Status = STATUS_INVALID_PARAMETER;
+        goto CreateIoRingEnd;
+    }
+
+    Status = MmMapIoBuffer(Ring->LockedBuffer, FALSE, FALSE, TRUE);
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    Ring->Header = Ring->LockedBuffer->Fragment[0].VirtualAddress;
+    Ring->Submissions = (PVOID)Ring->Header + IO_RING_SUBMISSION_OFFSET;
+    Ring->Completions = (PVOID)Ring->Header +
+                        IO_RING_COMPLETION_OFFSET(Ring->SubmissionCount);
+
+    Ring->Header->SubmissionHead = 0;
+    Ring->Header->SubmissionTail = 0;
+    Ring->Header->CompletionHead = 0;
+    Ring->Header->CompletionTail = 0;
+    Ring->Header->SubmissionCount = Ring->SubmissionCount;
+    Ring->Header->CompletionCount = Ring->CompletionCount;
+    KeSignalEvent(Ring->CompletionEvent, SignalOptionUnsignal);
+    KeSignalEvent(Ring->RequestEvent, SignalOptionUnsignal);
+    KeSignalEvent(Ring->DrainEvent, SignalOptionUnsignal);
+    KeAcquireQueuedLock(IoRingListLock);
+    IoNextRingNumber += 1;
+    if (IoNextRingNumber <= 0) {
+        IoNextRingNumber = 1;
+    }
+
+    Ring->RingNumber = IoNextRingNumber;
+    INSERT_BEFORE(&(Ring->ListEntry), &IoRingList);
+    KeReleaseQueuedLock(IoRingListLock);
+    Parameters->RingNumber = Ring->RingNumber;
+    Status = STATUS_SUCCESS;
+
+CreateIoRingEnd:
+    if (!KSUCCESS(Status)) {
+        if (Ring != NULL) {
+            IopIoRingReleaseReference(Ring);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+IopDestroyIoRing (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down an I/O ring that has already been removed from
+    the global list. It waits for every request, worker, and waiter to let go
+    of the ring, and then frees it in the owning process's context.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring to destroy. The caller's reference
+        (from the lookup) is consumed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Ring->ListEntry.Next == NULL);
+
+    //
+    // Mark the ring closing under the submit lock so that no new requests
+    // get queued after this point. Workers blocked on the ring's behalf
+    // notice within a wait slice and give up.
+    //
+
+    KeAcquireQueuedLock(Ring->SubmitLock);
+    Ring->Closing = TRUE;
+    KeReleaseQueuedLock(Ring->SubmitLock);
+
+    //
+    // Wake anyone blocked in enter so they see the ring is closing, and wake
+    // idle workers so they exit. The request event is signaled under the
+    // request lock so a worker emptying the queue can't unsignal it after
+    // missing the closing flag.
+    //
+
+    KeSignalEvent(Ring->CompletionEvent, SignalOptionSignalAll);
+    KeAcquireQueuedLock(Ring->RequestLock);
+    KeSignalEvent(Ring->RequestEvent, SignalOptionSignalAll);
+    KeReleaseQueuedLock(Ring->RequestLock);
+
+    //
+    // Drop the list's reference, then wait for every request, worker, and
+    // enter caller to drop theirs. The releaser that leaves only this
+    // routine's reference signals the drain event, which is safe since that
+    // reference keeps the ring alive.
+    //
+
+    IopIoRingReleaseReference(Ring);
+    while (Ring->ReferenceCount != 1) {
+        KeWaitForEvent(Ring->DrainEvent, FALSE, WAIT_TIME_INDEFINITE);
+    }
+
+    //
+    // Release the reference the lookup took, freeing the ring.
+    //
+
+    IopIoRingReleaseReference(Ring);
+    return;
+}
+
+KSTATUS
+IopEnterIoRing (
+    PIO_RING Ring,
+    PULONG SubmitCount,
+    ULONG MinimumCompletions,
+    ULONG TimeoutInMilliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine consumes entries from the submission queue of the given
+    ring, hands them to the workers, and then optionally waits for
+    completions to show up.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    SubmitCount - Supplies a pointer that on input contains the maximum number
+        of submissions to consume. On output, returns the number consumed.
+
+    MinimumCompletions - Supplies the number of unreaped completions that
+        must be in the completion queue before this routine returns.
+
+    TimeoutInMilliseconds - Supplies the maximum time to wait for
+        completions.
+
+Return Value:
+
+    STATUS_SUCCESS if the submissions were consumed and the requested number
+    of completions are available.
+
+    STATUS_TIMEOUT if the completions did not show up in time.
+
+    STATUS_INTERRUPTED if the wait was interrupted by a signal.
+
+    Other errors if the submission queue is corrupt.
+
+--*/
+
+{
+
+    ULONG Available;
+    ULONG Consumed;
+    ULONGLONG CurrentTime;
+    ULONGLONG EndTime;
+    ULONGLONG Frequency;
+    ULONG Index;
+    ULONG Outstanding;
+    PIO_RING_REQUEST Request;
+    ULONG RequestCount;
+    LIST_ENTRY Requests;
+    KSTATUS Status;
+    IO_RING_SUBMISSION Submission;
+    ULONG Tail;
+    ULONG Unreaped;
+    ULONG WaitTime;
+
+    Consumed = 0;
+    RequestCount = 0;
+    INITIALIZE_LIST_HEAD(&Requests);
+    Status = STATUS_SUCCESS;
+    KeAcquireQueuedLock(Ring->SubmitLock);
+    if (Ring->Closing != FALSE) {
+        KeReleaseQueuedLock(Ring->SubmitLock);
+        *SubmitCount = 0;
+        return STATUS_INVALID_HANDLE;
+    }
+
+    Tail = Ring->Header->SubmissionTail;
+    RtlMemoryBarrier();
+    Available = Tail - Ring->SubmissionHead;
+    if (Available > Ring->SubmissionCount) {
+        KeReleaseQueuedLock(Ring->SubmitLock);
+        *SubmitCount = 0;
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    if (Available > *SubmitCount) {
+        Available = *SubmitCount;
+    }
+
+    while (Consumed < Available) {
+
+        //
+        // Reserve a completion slot for this request. Never hand out more
+        // than the completion queue can hold, or completions would be lost.
+        //
+
+        KeAcquireQueuedLock(Ring->CompletionLock);
+        Unreaped = Ring->CompletionTail - Ring->Header->CompletionHead;
+        if (Unreaped > Ring->CompletionCount) {
+            Unreaped = Ring->CompletionCount;
+        }
+
+        Outstanding = Ring->InFlightCount + Unreaped;
+        if (Outstanding >= Ring->CompletionCount) {
+            KeReleaseQueuedLock(Ring->CompletionLock);
+            break;
+        }
+
+        Ring->InFlightCount += 1;
+        KeReleaseQueuedLock(Ring->CompletionLock);
+
+        //
+        // Snapshot the entry, as user mode can scribble on it at any time.
+        //
+
+        Index = Ring->SubmissionHead & (Ring->SubmissionCount - 1);
+        RtlCopyMemory(&Submission,
+                      &(Ring->Submissions[Index]),
+                      sizeof(IO_RING_SUBMISSION));
+
+        Ring->SubmissionHead += 1;
+        Consumed += 1;
+        Status = IopPrepareIoRingRequest(Ring, &Submission, &Request);
+        if (Request == NULL) {
+            IopPostIoRingCompletion(Ring, &Submission, Status, 0, 0);
+
+        } else {
+            INSERT_BEFORE(&(Request->ListEntry), &Requests);
+            RequestCount += 1;
+        }
+    }
+
+    //
+    // Hand the whole batch to the workers at once. This is done under the
+    // submit lock so that destroy can't miss it.
+    //
+
+    if (RequestCount != 0) {
+        IopQueueIoRingRequests(Ring, &Requests, RequestCount);
+    }
+
+    Ring->Header->SubmissionHead = Ring->SubmissionHead;
+    KeReleaseQueuedLock(Ring->SubmitLock);
+    *SubmitCount = Consumed;
+
+    //
+    // Wait for the requested number of completions.
+    //
+
+    Status = STATUS_SUCCESS;
+    if (MinimumCompletions == 0) {
+        return Status;
+    }
+
+    if (MinimumCompletions > Ring->CompletionCount) {
+        MinimumCompletions = Ring->CompletionCount;
+    }
+
+    Frequency = HlQueryTimeCounterFrequency();
+    EndTime = 0;
+    if (TimeoutInMilliseconds != WAIT_TIME_INDEFINITE) {
+        EndTime = HlQueryTimeCounter() +
+                  ((TimeoutInMilliseconds * Frequency) /
+                   MILLISECONDS_PER_SECOND);
+    }
+
+    WaitTime = TimeoutInMilliseconds;
+    while (TRUE) {
+        KeSignalEvent(Ring->CompletionEvent, SignalOptionUnsignal);
+        Unreaped = Ring->CompletionTail - Ring->Header->CompletionHead;
+        if (Unreaped >= MinimumCompletions) {
+            break;
+        }
+
+        if (Ring->Closing != FALSE) {
+            Status = STATUS_INVALID_HANDLE;
+            break;
+        }
+
+        if (TimeoutInMilliseconds != WAIT_TIME_INDEFINITE) {
+            CurrentTime = HlQueryTimeCounter();
+            if (CurrentTime >= EndTime) {
+                Status = STATUS_TIMEOUT;
+                break;
+            }
+
+            WaitTime = ((EndTime - CurrentTime) * MILLISECONDS_PER_SECOND) /
+                       Frequency;
+        }
+
+        Status = KeWaitForEvent(Ring->CompletionEvent, TRUE, WaitTime);
+        if (Status == STATUS_INTERRUPTED) {
+            break;
+        }
+
+        Status = STATUS_SUCCESS;
+    }
+
+    return Status;
+}
+
+PIO_RING
+IopLookupIoRing (
+    PKPROCESS Process,
+    LONG RingNumber,
+    BOOL Remove
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds an I/O ring by number and takes a reference on it.
+
+Arguments:
+
+    Process - Supplies a pointer to the process that owns the ring.
+
+    RingNumber - Supplies the ring number.
+
+    Remove - Supplies a boolean indicating whether the ring should also be
+        pulled out of the global list, in preparation for destroying it.
+
+Return Value:
+
+    Returns a pointer to the ring on success, or NULL if no such ring exists.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PIO_RING Ring;
+
+    KeAcquireQueuedLock(IoRingListLock);
+    CurrentEntry = IoRingList.Next;
+    while (CurrentEntry != &IoRingList) {
+        Ring = LIST_VALUE(CurrentEntry, IO_RING, ListEntry);
+        if ((Ring->RingNumber == RingNumber) && (Ring->Process == Process)) {
+            IopIoRingAddReference(Ring);
+            if (Remove != FALSE) {
+                LIST_REMOVE(&(Ring->ListEntry));
+                Ring->ListEntry.Next = NULL;
+            }
+
+            KeReleaseQueuedLock(IoRingListLock);
+            return Ring;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    KeReleaseQueuedLock(IoRingListLock);
+    return NULL;
+}
+
+VOID
+IopIoRingAddReference (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a reference to an I/O ring.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldCount;
+
+    OldCount = RtlAtomicAdd32(&(Ring->ReferenceCount), 1);
+
+    ASSERT((OldCount != 0) && (OldCount < 0x10000000));
+
+    return;
+}
+
+VOID
+IopIoRingReleaseReference (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on an I/O ring, destroying it if this
+    was the last reference.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldCount;
+
+    OldCount = RtlAtomicAdd32(&(Ring->ReferenceCount), -1);
+
+    ASSERT((OldCount != 0) && (OldCount < 0x10000000));
+
+    //
+    // Let the destroyer know when it holds the last reference.
+    //
+
+    if ((OldCount == 2) && (Ring->Closing != FALSE)) {
+        KeSignalEvent(Ring->DrainEvent, SignalOptionSignalAll);
+    }
+
+    if (OldCount != 1) {
+        return;
+    }
+
+    ASSERT((Ring->InFlightCount == 0) && (Ring->WorkerCount == 0) &&
+           (LIST_EMPTY(&(Ring->RequestList)) != FALSE));
+
+    if ((Ring->LockedBuffer != NULL) &&
+        (Ring->LockedBuffer != Ring->UserBuffer)) {
+
+        MmFreeIoBuffer(Ring->LockedBuffer);
+    }
+
+    if (Ring->UserBuffer != NULL) {
+        MmFreeIoBuffer(Ring->UserBuffer);
+    }
+
+    if (Ring->CompletionEvent != NULL) {
+        KeDestroyEvent(Ring->CompletionEvent);
+    }
+
+    if (Ring->RequestEvent != NULL) {
+        KeDestroyEvent(Ring->RequestEvent);
+    }
+
+    if (Ring->DrainEvent != NULL) {
+        KeDestroyEvent(Ring->DrainEvent);
+    }
+
+    if (Ring->RequestLock != NULL) {
+        KeDestroyQueuedLock(Ring->RequestLock);
+    }
+
+    if (Ring->CompletionLock != NULL) {
+        KeDestroyQueuedLock(Ring->CompletionLock);
+    }
+
+    if (Ring->SubmitLock != NULL) {
+        KeDestroyQueuedLock(Ring->SubmitLock);
+    }
+
+    MmFreeNonPagedPool(Ring);
+    return;
+}
+
+KSTATUS
+IopPrepareIoRingRequest (
+    PIO_RING Ring,
+    PIO_RING_SUBMISSION Submission,
+    PIO_RING_REQUEST *NewRequest
+    )
+
+/*++
+
+Routine Description:
+
+    This routine validates a submission and builds a request for it. This
+    runs in the context of the submitting process, so it is where the handle
+    is looked up and the user's buffer is pinned.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Submission - Supplies a pointer to the kernel copy of the submission.
+
+    NewRequest - Supplies a pointer where the request is returned. If no
+        request is returned, the submission should be completed immediately
+        with the returned status.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_BUFFER LockedBuffer;
+    BOOL LockedCopy;
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+    BOOL Write;
+
+    *NewRequest = NULL;
+    Request = NULL;
+    if (Submission->Operation == IO_RING_OPERATION_NOP) {
+        Status = STATUS_SUCCESS;
+        goto PrepareIoRingRequestEnd;
+    }
+
+    if ((Submission->Operation > IO_RING_OPERATION_POLL) ||
+        ((Submission->Flags & ~IO_RING_SUBMISSION_FLAG_SIGNAL) != 0)) {
+
+        Status = STATUS_INVALID_PARAMETER;
+        goto PrepareIoRingRequestEnd;
+    }
+
+    if (((Submission->Flags & IO_RING_SUBMISSION_FLAG_SIGNAL) != 0) &&
+        ((Submission->SignalNumber == 0) ||
+         (Submission->SignalNumber >= SIGNAL_COUNT))) {
+
+        Status = STATUS_INVALID_PARAMETER;
+        goto PrepareIoRingRequestEnd;
+    }
+
+    Request = MmAllocatePagedPool(sizeof(IO_RING_REQUEST),
+                                  IO_RING_ALLOCATION_TAG);
+
+    if (Request == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto PrepareIoRingRequestEnd;
+    }
+
+    RtlZeroMemory(Request, sizeof(IO_RING_REQUEST));
+    IopIoRingAddReference(Ring);
+    Request->Ring = Ring;
+    RtlCopyMemory(&(Request->Submission),
+                  Submission,
+                  sizeof(IO_RING_SUBMISSION));
+
+    Request->Handle = ObGetHandleValue(Ring->Process->HandleTable,
+                                       Submission->Handle,
+                                       NULL);
+
+    if (Request->Handle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto PrepareIoRingRequestEnd;
+    }
+
+    //
+    // Reads and writes need the user's buffer pinned so that a worker running
+    // in another process context can get at it.
+    //
+
+    if (((Submission->Operation == IO_RING_OPERATION_READ) ||
+         (Submission->Operation == IO_RING_OPERATION_WRITE)) &&
+        (Submission->Size != 0)) {
+
+        if ((Submission->Buffer + Submission->Size > KERNEL_VA_START) ||
+            (Submission->Buffer + Submission->Size < Submission->Buffer)) {
+
+            Status = STATUS_ACCESS_VIOLATION;
+            goto PrepareIoRingRequestEnd;
+        }
+
+        //
+        // A read deposits data in the buffer, so make sure user mode could
+        // have written there itself. This also breaks any copy-on-write
+        // sharing before the pages get locked.
+        //
+
+        Write = FALSE;
+        if (Submission->Operation == IO_RING_OPERATION_READ) {
+            Write = TRUE;
+        }
+
+        Status = MmTouchUserModeBuffer(Submission->Buffer,
+                                       Submission->Size,
+                                       Write);
+
+        if (!KSUCCESS(Status)) {
+            goto PrepareIoRingRequestEnd;
+        }
+
+        Status = MmCreateIoBuffer(Submission->Buffer,
+                                  Submission->Size,
+                                  0,
+                                  &(Request->UserBuffer));
+
+        if (!KSUCCESS(Status)) {
+            goto PrepareIoRingRequestEnd;
+        }
+
+        LockedBuffer = Request->UserBuffer;
+        Status = MmValidateIoBuffer(0,
+                                    MAX_ULONGLONG,
+                                    0,
+                                    Submission->Size,
+                                    FALSE,
+                                    &LockedBuffer,
+                                    &LockedCopy);
+
+        if (!KSUCCESS(Status)) {
+            goto PrepareIoRingRequestEnd;
+        }
+
+        Request->LockedBuffer = LockedBuffer;
+        if (LockedCopy == FALSE) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto PrepareIoRingRequestEnd;
+        }
+    }
+
+    *NewRequest = Request;
+    Status = STATUS_SUCCESS;
+
+PrepareIoRingRequestEnd:
+    if ((*NewRequest == NULL) && (Request != NULL)) {
+        IopDestroyIoRingRequest(Request);
+    }
+
+    return Status;
+}
+
+VOID
+IopDestroyIoRingRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the resources held by an I/O ring request.
+
+Arguments:
+
+    Request - Supplies a pointer to the request to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if ((Request->LockedBuffer != NULL) &&
+        (Request->LockedBuffer != Request->UserBuffer)) {
+
+        MmFreeIoBuffer(Request->LockedBuffer);
+    }
+
+    if (Request->UserBuffer != NULL) {
+        MmFreeIoBuffer(Request->UserBuffer);
+    }
+
+    if (Request->Handle != NULL) {
+        IoIoHandleReleaseReference(Request->Handle);
+    }
+
+    //
+    // Release the ring last, since the completion for this request may have
+    // just been posted and the ring must stay alive until that's done.
+    //
+
+    if (Request->Ring != NULL) {
+        IopIoRingReleaseReference(Request->Ring);
+    }
+
+    MmFreePagedPool(Request);
+    return;
+}
+
+VOID
+IopPostIoRingCompletion (
+    PIO_RING Ring,
+    PIO_RING_SUBMISSION Submission,
+    KSTATUS Status,
+    ULONG Events,
+    UINTN BytesCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine posts a completion entry to the ring's completion queue and
+    retires the in-flight slot reserved for it.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Submission - Supplies a pointer to the submission being completed.
+
+    Status - Supplies the final status of the operation.
+
+    Events - Supplies the returned poll events, if any.
+
+    BytesCompleted - Supplies the number of bytes transferred.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_COMPLETION Completion;
+    ULONG Index;
+
+    KeAcquireQueuedLock(Ring->CompletionLock);
+
+    ASSERT(Ring->InFlightCount != 0);
+
+    Index = Ring->CompletionTail & (Ring->CompletionCount - 1);
+    Completion = &(Ring->Completions[Index]);
+    Completion->UserData = Submission->UserData;
+    Completion->Status = Status;
+    Completion->Events = Events;
+    Completion->BytesCompleted = BytesCompleted;
+    RtlMemoryBarrier();
+    Ring->CompletionTail += 1;
+    Ring->Header->CompletionTail = Ring->CompletionTail;
+    Ring->InFlightCount -= 1;
+    KeReleaseQueuedLock(Ring->CompletionLock);
+    KeSignalEvent(Ring->CompletionEvent, SignalOptionSignalAll);
+    if ((Submission->Flags & IO_RING_SUBMISSION_FLAG_SIGNAL) != 0) {
+        PsSignalProcess(Ring->Process, Submission->SignalNumber, NULL);
+    }
+
+    return;
+}
+
+VOID
+IopQueueIoRingRequests (
+    PIO_RING Ring,
+    PLIST_ENTRY Requests,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands a batch of prepared requests to the ring's workers,
+    starting new workers so that each queued request has one, up to the
+    per-ring limit. This routine assumes the submit lock is held.
+
+Arguments:
+
+    Ring - Supplies a pointer to the I/O ring.
+
+    Requests - Supplies a pointer to the head of the list of requests to
+        queue. This list is emptied.
+
+    Count - Supplies the number of requests on the list.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    LIST_ENTRY Failed;
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+
+    INITIALIZE_LIST_HEAD(&Failed);
+    KeAcquireQueuedLock(Ring->RequestLock);
+    APPEND_LIST(Requests, &(Ring->RequestList));
+    Ring->QueuedCount += Count;
+
+    //
+    // New workers start out counted as idle, and each takes a reference on
+    // the ring that it releases when it exits.
+    //
+
+    Status = STATUS_SUCCESS;
+    while ((Ring->QueuedCount > Ring->IdleWorkerCount) &&
+           (Ring->WorkerCount < IO_RING_MAX_WORKERS)) {
+
+        IopIoRingAddReference(Ring);
+        Ring->WorkerCount += 1;
+        Ring->IdleWorkerCount += 1;
+        Status = PsCreateKernelThread(IopIoRingWorkerThread,
+                                      Ring,
+                                      "IopIoRingWorkerThread");
+
+        if (!KSUCCESS(Status)) {
+            Ring->WorkerCount -= 1;
+            Ring->IdleWorkerCount -= 1;
+            IopIoRingReleaseReference(Ring);
+            break;
+        }
+    }
+
+    //
+    // If there are no workers at all, nobody will ever get to these
+    // requests, so fail them all. Otherwise the existing workers will get
+    // through the queue eventually.
+    //
+
+    if (Ring->WorkerCount == 0) {
+        APPEND_LIST(&(Ring->RequestList), &Failed);
+        Ring->QueuedCount = 0;
+
+    } else {
+        KeSignalEvent(Ring->RequestEvent, SignalOptionSignalAll);
+    }
+
+    KeReleaseQueuedLock(Ring->RequestLock);
+    while (LIST_EMPTY(&Failed) == FALSE) {
+        Request = LIST_VALUE(Failed.Next, IO_RING_REQUEST, ListEntry);
+        LIST_REMOVE(&(Request->ListEntry));
+        IopPostIoRingCompletion(Ring, &(Request->Submission), Status, 0, 0);
+        IopDestroyIoRingRequest(Request);
+    }
+
+    return;
+}
+
+VOID
+IopIoRingWorkerThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements an I/O ring worker thread, which pulls requests
+    off its ring's queue and performs them. The worker exits once the ring
+    is closing and the queue is empty.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the I/O ring. The worker owns a
+        reference on it.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_REQUEST Request;
+    PIO_RING Ring;
+
+    Ring = Parameter;
+    KeAcquireQueuedLock(Ring->RequestLock);
+    Ring->IdleWorkerCount -= 1;
+    while (TRUE) {
+        if (LIST_EMPTY(&(Ring->RequestList)) == FALSE) {
+            Request = LIST_VALUE(Ring->RequestList.Next,
+                                 IO_RING_REQUEST,
+                                 ListEntry);
+
+            LIST_REMOVE(&(Request->ListEntry));
+            Ring->QueuedCount -= 1;
+            if ((LIST_EMPTY(&(Ring->RequestList)) != FALSE) &&
+                (Ring->Closing == FALSE)) {
+
+                KeSignalEvent(Ring->RequestEvent, SignalOptionUnsignal);
+            }
+
+            KeReleaseQueuedLock(Ring->RequestLock);
+            IopPerformIoRingRequest(Request);
+            KeAcquireQueuedLock(Ring->RequestLock);
+            continue;
+        }
+
+        if (Ring->Closing != FALSE) {
+            break;
+        }
+
+        Ring->IdleWorkerCount += 1;
+        KeReleaseQueuedLock(Ring->RequestLock);
+        KeWaitForEvent(Ring->RequestEvent, FALSE, WAIT_TIME_INDEFINITE);
+        KeAcquireQueuedLock(Ring->RequestLock);
+        Ring->IdleWorkerCount -= 1;
+    }
+
+    Ring->WorkerCount -= 1;
+    KeReleaseQueuedLock(Ring->RequestLock);
+    IopIoRingReleaseReference(Ring);
+    return;
+}
+
+VOID
+IopPerformIoRingRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a single I/O ring request and posts its completion.
+    Blocking operations wait in slices so that a ring being torn down is
+    noticed promptly.
+
+Arguments:
+
+    Request - Supplies a pointer to the request. This routine destroys it.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    ULONG Events;
+    PFILE_OBJECT FileObject;
+    ULONG FlushFlags;
+    PIO_OBJECT_STATE IoState;
+    ULONG Remaining;
+    PIO_RING Ring;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+    ULONG WaitTime;
+
+    BytesCompleted = 0;
+    Events = 0;
+    Ring = Request->Ring;
+    Submission = &(Request->Submission);
+    Remaining = Submission->TimeoutInMilliseconds;
+    switch (Submission->Operation) {
+    case IO_RING_OPERATION_READ:
+    case IO_RING_OPERATION_WRITE:
+        Status = STATUS_SUCCESS;
+        if (Submission->Size == 0) {
+            break;
+        }
+
+        while (TRUE) {
+            WaitTime = IO_RING_WAIT_SLICE;
+            if (Remaining < WaitTime) {
+                WaitTime = Remaining;
+            }
+
+            if (Submission->Operation == IO_RING_OPERATION_READ) {
+                Status = IoReadAtOffset(Request->Handle,
+                                        Request->LockedBuffer,
+                                        Submission->Offset,
+                                        Submission->Size,
+                                        0,
+                                        WaitTime,
+                                        &BytesCompleted,
+                                        NULL);
+
+            } else {
+                Status = IoWriteAtOffset(Request->Handle,
+                                         Request->LockedBuffer,
+                                         Submission->Offset,
+                                         Submission->Size,
+                                         0,
+                                         WaitTime,
+                                         &BytesCompleted,
+                                         NULL);
+            }
+
+            if ((Status != STATUS_TIMEOUT) || (BytesCompleted != 0) ||
+                (Ring->Closing != FALSE)) {
+
+                break;
+            }
+
+            if (Remaining != WAIT_TIME_INDEFINITE) {
+                Remaining -= WaitTime;
+                if (Remaining == 0) {
+                    break;
+                }
+            }
+        }
+
+        if ((Status == STATUS_TIMEOUT) && (BytesCompleted != 0)) {
+            Status = STATUS_SUCCESS;
+        }
+
+        break;
+
+    case IO_RING_OPERATION_FLUSH:
+        FlushFlags = 0;
+        if ((Submission->Events & SYS_FLUSH_FLAG_READ) != 0) {
+            FlushFlags |= FLUSH_FLAG_READ;
+        }
+
+        if ((Submission->Events & SYS_FLUSH_FLAG_WRITE) != 0) {
+            FlushFlags |= FLUSH_FLAG_WRITE;
+        }
+
+        if ((Submission->Events & SYS_FLUSH_FLAG_DISCARD) != 0) {
+            FlushFlags |= FLUSH_FLAG_DISCARD;
+        }
+
+        Status = IoFlush(Request->Handle, 0, -1, FlushFlags);
+        break;
+
+    case IO_RING_OPERATION_POLL:
+        FileObject = Request->Handle->FileObject;
+        IoState = FileObject->IoState;
+
+        //
+        // Objects without I/O state (regular files and such) are always
+        // ready.
+        //
+
+        if (IoState == NULL) {
+            Events = Submission->Events & POLL_NONMASKABLE_FILE_EVENTS;
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        while (TRUE) {
+            WaitTime = IO_RING_WAIT_SLICE;
+            if (Remaining < WaitTime) {
+                WaitTime = Remaining;
+            }
+
+            Status = IoWaitForIoObjectState(IoState,
+                                            Submission->Events,
+                                            FALSE,
+                                            WaitTime,
+                                            &Events);
+
+            if ((Status != STATUS_TIMEOUT) || (Ring->Closing != FALSE)) {
+                break;
+            }
+
+            if (Remaining != WAIT_TIME_INDEFINITE) {
+                Remaining -= WaitTime;
+                if (Remaining == 0) {
+                    break;
+                }
+            }
+        }
+
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        Status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+    if ((Status == STATUS_TIMEOUT) && (Ring->Closing != FALSE)) {
+        Status = STATUS_OPERATION_CANCELLED;
+    }
+
+    IopPostIoRingCompletion(Ring, Submission, Status, Events, BytesCompleted);
+    IopDestroyIoRingRequest(Request);
+    return;
+}
+
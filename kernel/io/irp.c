@@ -264,6 +264,12 @@ Return Value:
         InternalIrp->Flags |= IRP_COMPLETE;
         Irp->Direction = IrpUp;
         Irp->Status = StatusCode;
+        SpTraceEvent(SP_TRACE_FLAG_IO,
+                     SpTraceEventIrpComplete,
+                     StatusCode,
+                     (UINTN)Irp,
+                     Irp->MajorCode,
+                     Irp->MinorCode);
 
         //
         // If the IRP is pending, nothing else is driving it. Signal the IRP to
@@ -1430,6 +1436,13 @@ Return Value:
     IoIrp->MinorCode = MinorCodeNumber;
     RtlCopyMemory(&(IoIrp->U.ReadWrite), Request, sizeof(IRP_READ_WRITE));
     IoIrp->U.ReadWrite.IoBufferState.IoBuffer = NULL;
+    SpTraceEvent(SP_TRACE_FLAG_IO,
+                 SpTraceEventIrpSend,
+                 MinorCodeNumber,
+                 (UINTN)IoIrp,
+                 Request->IoOffset,
+                 Request->IoSizeInBytes);
+
     Status = IoSendSynchronousIrp(IoIrp);
     if (!KSUCCESS(Status)) {
         goto SendIoIrpEnd;
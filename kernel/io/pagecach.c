@@ -104,6 +104,14 @@ Module Name:
 
 #define PAGE_CACHE_ENTRY_FLAG_MAPPED 0x00000008
 
+//
+// Set this flag if the page owner borrowed its physical page from the object
+// it caches rather than allocating it. The page is not freed when the entry
+// goes away and does not count towards the size of the page cache.
+//
+
+#define PAGE_CACHE_ENTRY_FLAG_BORROWED 0x00000010
+
 //
 // If any of the dirty mask bits are set, then the page cache entry needs to
 // be cleaned and flushed.
@@ -2195,6 +2203,7 @@ VOID
 IopEvictPageCacheEntries (
     PFILE_OBJECT FileObject,
     IO_OFFSET Offset,
+    ULONGLONG Size,
     ULONG Flags
     )
 
@@ -2206,7 +2215,7 @@ Routine Description:
     device, as specified by the file object. The flags specify how aggressive
     this routine should be. The file object lock must already be held
     exclusively and this routine assumes that the file object has been unmapped
-    from all image sections starting at the offset.
+    from all image sections in the given region.
 
 Arguments:
 
@@ -2215,6 +2224,9 @@ Routine Description:
     Offset - Supplies the starting offset into the file or device after which
         all page cache entries should be evicted.
 
+    Size - Supplies the size, in bytes, of the region to evict. Supply a value
+        of -1 to evict from the given offset to the end of the file.
+
     Flags - Supplies a bitmask of eviction flags. See EVICTION_FLAG_* for
         definitions.
 
@@ -2246,12 +2258,13 @@ Return Value:
     if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_EVICTION) != 0) {
         RtlDebugPrint("PAGE CACHE: Evicting entries for file object "
                       "(0x%08x): type %d, reference count %d, path count "
-                      "%d, offset 0x%I64x.\n",
+                      "%d, offset 0x%I64x, size 0x%I64x.\n",
                       FileObject,
                       FileObject->Properties.Type,
                       FileObject->ReferenceCount,
                       FileObject->PathEntryCount,
-                      Offset);
+                      Offset,
+                      Size);
     }
 
     //
@@ -2287,11 +2300,16 @@ Return Value:
                                           Node);
 
         //
-        // Assert this is a cache entry after the eviction offset.
+        // Assert this is a cache entry after the eviction offset, and stop
+        // once past the end of the region.
         //
 
         ASSERT(CacheEntry->Offset >= Offset);
 
+        if ((Size != -1ULL) && (CacheEntry->Offset - Offset >= Size)) {
+            break;
+        }
+
         //
         // Remove the node from the page cache tree. It should not be found on
         // look-up again.
@@ -2862,6 +2880,15 @@ Return Value:
         return FALSE;
     }
 
+    //
+    // A borrowed page belongs to the object that lent it, so ownership can't
+    // be handed to another entry.
+    //
+
+    if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_BORROWED) != 0) {
+        return FALSE;
+    }
+
     if (FileObject->Properties.Type == PageCacheType) {
         return FALSE;
     }
@@ -3520,7 +3547,8 @@ Return Value:
     ASSERT(Entry->Node.Parent == NULL);
 
     //
-    // If this is the page owner, then free the physical page.
+    // If this is the page owner, then free the physical page, unless it was
+    // borrowed.
     //
 
     if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_OWNER) != 0) {
@@ -3535,8 +3563,11 @@ Return Value:
             Entry->VirtualAddress = NULL;
         }
 
-        MmFreePhysicalPage(Entry->PhysicalAddress);
-        RtlAtomicAdd(&IoPageCachePhysicalPageCount, (UINTN)-1);
+        if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_BORROWED) == 0) {
+            MmFreePhysicalPage(Entry->PhysicalAddress);
+            RtlAtomicAdd(&IoPageCachePhysicalPageCount, (UINTN)-1);
+        }
+
         Entry->PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
 
     //
@@ -3703,7 +3734,18 @@ Return Value:
             RtlAtomicAdd(&IoPageCacheMappedPageCount, 1);
         }
 
-        RtlAtomicAdd(&IoPageCachePhysicalPageCount, 1);
+        //
+        // Shared memory objects kept in memory lend the page cache the pages
+        // of their chunks, so that the data isn't held twice.
+        //
+
+        if (IopIsSharedMemoryObjectInMemory(NewEntry->FileObject) != FALSE) {
+            NewEntry->Flags |= PAGE_CACHE_ENTRY_FLAG_BORROWED;
+
+        } else {
+            RtlAtomicAdd(&IoPageCachePhysicalPageCount, 1);
+        }
+
         NewEntry->Flags |= PAGE_CACHE_ENTRY_FLAG_OWNER;
         MmSetPageCacheEntryForPhysicalAddress(NewEntry->PhysicalAddress,
                                               NewEntry);
@@ -4357,11 +4399,15 @@ Return Value:
 
             //
             // If this page cache entry owns its physical page, then it counts
-            // towards the removal count.
+            // towards the removal count. Borrowed pages aren't freed, so
+            // they don't.
             //
 
             if ((PageTakenDown != FALSE) &&
-                ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_OWNER) != 0)) {
+                ((CacheEntry->Flags &
+                  (PAGE_CACHE_ENTRY_FLAG_OWNER |
+                   PAGE_CACHE_ENTRY_FLAG_BORROWED)) ==
+                 PAGE_CACHE_ENTRY_FLAG_OWNER)) {
 
                 if (TargetRemoveCount != NULL) {
                     *TargetRemoveCount -= 1;
@@ -5031,6 +5077,14 @@ Return Value:
     if (Entry->BackingEntry != NULL) {
         MmSetPageCacheEntryForPhysicalAddress(Entry->PhysicalAddress,
                                               Entry->BackingEntry);
+
+    //
+    // A borrowed page stays with its lender after the entry is destroyed, so
+    // disconnect it from the entry now while the file object lock is held.
+    //
+
+    } else if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_BORROWED) != 0) {
+        MmSetPageCacheEntryForPhysicalAddress(Entry->PhysicalAddress, NULL);
     }
 
     RtlRedBlackTreeRemove(&(Entry->FileObject->PageCacheTree), &(Entry->Node));
@@ -280,6 +280,7 @@ VOID
 IopEvictPageCacheEntries (
     PFILE_OBJECT FileObject,
     IO_OFFSET Offset,
+    ULONGLONG Size,
     ULONG Flags
     );
 
@@ -291,7 +292,7 @@ Routine Description:
     device, as specified by the file object. The flags specify how aggressive
     this routine should be. The file object lock must already be held
     exclusively and this routine assumes that the file object has been unmapped
-    from all image sections starting at the offset.
+    from all image sections in the given region.
 
 Arguments:
 
@@ -300,6 +301,9 @@ Routine Description:
     Offset - Supplies the starting offset into the file or device after which
         all page cache entries should be evicted.
 
+    Size - Supplies the size, in bytes, of the region to evict. Supply a value
+        of -1 to evict from the given offset to the end of the file.
+
     Flags - Supplies a bitmask of eviction flags. See EVICTION_FLAG_* for
         definitions.
 
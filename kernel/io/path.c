@@ -58,10 +58,44 @@ Module Name:
 
 #define PATH_UNREACHABLE_PATH_PREFIX "(unreachable)/"
 
+//
+// Define the size of each processor's slot of lockless path walker counts.
+// Walkers on different processors never write to the same cache line.
+//
+
+#define PATH_WALKER_SLOT_SIZE 64
+
+//
+// Define how often the retired path entry reclaimer checks whether the
+// walkers it is waiting on have left, in microseconds.
+//
+
+#define PATH_WALKER_POLL_INTERVAL 1000
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines one processor's counts of lockless path walkers.
+
+Members:
+
+    Count - Stores the number of walkers that registered in this slot, indexed
+        by the parity of the path walk epoch they saw when they started.
+
+    Padding - Stores padding that keeps each slot in its own cache line.
+
+--*/
+
+typedef struct _PATH_WALKER_SLOT {
+    volatile ULONG Count[2];
+    UCHAR Padding[PATH_WALKER_SLOT_SIZE - (2 * sizeof(ULONG))];
+} PATH_WALKER_SLOT, *PPATH_WALKER_SLOT;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -138,6 +172,55 @@ IopGetPathEntryCacheTargetSize (
     VOID
     );
 
+VOID
+IopPathWalkLockless (
+    BOOL FromKernelMode,
+    PPATH_POINT Root,
+    PPATH_POINT Entry,
+    PCSTR *Path,
+    PULONG PathSize,
+    ULONG OpenFlags,
+    BOOL Create
+    );
+
+PPATH_ENTRY
+IopFindPathEntryLockless (
+    PPATH_ENTRY Directory,
+    PCSTR Name,
+    ULONG NameSize,
+    ULONG Hash
+    );
+
+BOOL
+IopPathEntryAddReferenceIfActive (
+    PPATH_ENTRY Entry
+    );
+
+VOID
+IopRetirePathEntry (
+    PPATH_ENTRY Entry
+    );
+
+VOID
+IopReclaimRetiredPathEntries (
+    PVOID Parameter
+    );
+
+VOID
+IopWaitForPathWalkers (
+    ULONG Parity
+    );
+
+ULONG
+IopCountPathWalkers (
+    ULONG Parity
+    );
+
+VOID
+IopFreePathEntry (
+    PPATH_ENTRY Entry
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -163,6 +246,27 @@ LIST_ENTRY IoPathEntryList;
 UINTN IoPathEntryListSize;
 UINTN IoPathEntryListMaxSize;
 
+//
+// Set this to FALSE to send every path walk through the locked path.
+//
+
+BOOL IoLocklessPathWalkEnabled = TRUE;
+
+//
+// Store the per-processor counts of threads walking the path entry tree
+// without locks, and the epoch that decides which count new walkers use.
+// Store the list of destroyed path entries that cannot be freed until the
+// walkers that might see them have left, and whether a work item is already
+// on its way to reclaim them.
+//
+
+PPATH_WALKER_SLOT IoPathWalkerSlots;
+ULONG IoPathWalkerSlotCount;
+volatile ULONG IoPathWalkEpoch;
+PQUEUED_LOCK IoRetiredPathEntryLock;
+LIST_ENTRY IoRetiredPathEntryList;
+BOOL IoRetiredPathEntryReclaimQueued;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -468,6 +572,26 @@ Return Value:
 
     INITIALIZE_LIST_HEAD(&IoPathEntryList);
     IoPathEntryListSize = 0;
+    IoRetiredPathEntryLock = KeCreateQueuedLock();
+    if (IoRetiredPathEntryLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializePathSupportEnd;
+    }
+
+    INITIALIZE_LIST_HEAD(&IoRetiredPathEntryList);
+    IoPathWalkerSlotCount = KeGetActiveProcessorCount();
+    IoPathWalkerSlots = MmAllocateNonPagedPool(
+                             IoPathWalkerSlotCount * sizeof(PATH_WALKER_SLOT),
+                             PATH_ALLOCATION_TAG);
+
+    if (IoPathWalkerSlots == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializePathSupportEnd;
+    }
+
+    RtlZeroMemory(IoPathWalkerSlots,
+                  IoPathWalkerSlotCount * sizeof(PATH_WALKER_SLOT));
+
     MaxMemory = MmGetTotalPhysicalPages() * MmPageSize();
     if (MaxMemory > (MAX_UINTN - (UINTN)KERNEL_VA_START + 1)) {
         MaxMemory = MAX_UINTN - (UINTN)KERNEL_VA_START + 1;
@@ -507,6 +631,16 @@ Return Value:
             IoPathEntryListLock = NULL;
         }
 
+        if (IoRetiredPathEntryLock != NULL) {
+            KeDestroyQueuedLock(IoRetiredPathEntryLock);
+            IoRetiredPathEntryLock = NULL;
+        }
+
+        if (IoPathWalkerSlots != NULL) {
+            MmFreeNonPagedPool(IoPathWalkerSlots);
+            IoPathWalkerSlots = NULL;
+        }
+
         if (RootObject != NULL) {
             ObReleaseReference(RootObject);
         }
@@ -1075,8 +1209,10 @@ Return Value:
     //
 
     if (Entry->SiblingListEntry.Next != NULL) {
+        IO_PATH_ENTRY_BEGIN_CHILD_UPDATE(Entry->Parent);
         LIST_REMOVE(&(Entry->SiblingListEntry));
         Entry->SiblingListEntry.Next = NULL;
+        IO_PATH_ENTRY_END_CHILD_UPDATE(Entry->Parent);
     }
 
     return;
@@ -2039,6 +2175,20 @@ Return Value:
 
     while (CurrentPathSize != 0) {
 
+        //
+        // Get through as much of the path as possible without acquiring any
+        // locks. This stops at anything it cannot handle, leaving the rest
+        // of the components to the locked walk below.
+        //
+
+        IopPathWalkLockless(FromKernelMode,
+                            Root,
+                            &Entry,
+                            &CurrentPath,
+                            &CurrentPathSize,
+                            OpenFlags,
+                            Create);
+
         //
         // Get past any separators.
         //
@@ -2946,12 +3096,12 @@ Return Value:
                (FileObject->Device == PathRoot) &&
                (Result->MountPoint == Directory->MountPoint));
 
-        Result->PathEntry->Negative = FALSE;
-        Result->PathEntry->DoNotCache = DoNotCache;
-
         ASSERT(FileObject != NULL);
         ASSERT(FileObject->ReferenceCount >= 2);
 
+        IO_PATH_ENTRY_BEGIN_CHILD_UPDATE(DirectoryEntry);
+        Result->PathEntry->Negative = FALSE;
+        Result->PathEntry->DoNotCache = DoNotCache;
         Result->PathEntry->FileObject = FileObject;
         IopFileObjectAddPathEntryReference(Result->PathEntry->FileObject);
         if ((OpenFlags & OPEN_FLAG_UNLINK_ON_CREATE) != 0) {
@@ -2961,6 +3111,8 @@ Return Value:
             }
         }
 
+        IO_PATH_ENTRY_END_CHILD_UPDATE(DirectoryEntry);
+
     //
     // Create and insert a new path entry.
     //
@@ -2993,8 +3145,11 @@ Return Value:
             ASSERT((FileObject == NULL) ||
                    (FileObject->Properties.HardLinkCount != 0));
 
+            IO_PATH_ENTRY_BEGIN_CHILD_UPDATE(DirectoryEntry);
             INSERT_BEFORE(&(PathEntry->SiblingListEntry),
                           &(DirectoryEntry->ChildList));
+
+            IO_PATH_ENTRY_END_CHILD_UPDATE(DirectoryEntry);
         }
 
         Result->PathEntry = PathEntry;
@@ -3590,8 +3745,10 @@ Return Value:
         //
 
         if (Entry->SiblingListEntry.Next != NULL) {
+            IO_PATH_ENTRY_BEGIN_CHILD_UPDATE(Parent);
             LIST_REMOVE(&(Entry->SiblingListEntry));
             Entry->SiblingListEntry.Next = NULL;
+            IO_PATH_ENTRY_END_CHILD_UPDATE(Parent);
         }
 
         ASSERT(ParentFileObject != NULL);
@@ -3607,21 +3764,11 @@ Return Value:
     ASSERT(Entry->MountCount == 0);
 
     //
-    // Release the file object and then the path root object. If they exist.
+    // Lockless path walkers may still be looking at this entry, so it cannot
+    // necessarily be freed right away.
     //
 
-    ASSERT((Entry->Negative != FALSE) || (Entry->FileObject != NULL));
-
-    //
-    // Decrement the count of path entries that own the file object.
-    //
-
-    if (Entry->Negative == FALSE) {
-        IopFileObjectReleasePathEntryReference(Entry->FileObject);
-        IopFileObjectReleaseReference(Entry->FileObject);
-    }
-
-    MmFreePagedPool(Entry);
+    IopRetirePathEntry(Entry);
     return Parent;
 }
 
@@ -3679,3 +3826,654 @@ Return Value:
     return 0;
 }
 
+
+VOID
+IopPathWalkLockless (
+    BOOL FromKernelMode,
+    PPATH_POINT Root,
+    PPATH_POINT Entry,
+    PCSTR *Path,
+    PULONG PathSize,
+    ULONG OpenFlags,
+    BOOL Create
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to walk as much of the given path as possible
+    without acquiring any directory locks or touching the reference counts of
+    the intermediate path entries. It only walks through cached, positive path
+    entries within the current mount point, and stops at the first component
+    it cannot handle (a cache miss, mount point, symbolic link, "..", a
+    permission failure, or a race with a modification). The caller is expected
+    to continue the walk from wherever this routine left off using the locked
+    path.
+
+Arguments:
+
+    FromKernelMode - Supplies a boolean indicating whether or not this request
+        is coming directly from kernel mode.
+
+    Root - Supplies a pointer to the caller's root path point.
+
+    Entry - Supplies a pointer to the path point to start from. The caller
+        must hold a reference on it. On return, this will contain the path
+        point the walk ended at, and the reference will have been transferred
+        to it.
+
+    Path - Supplies a pointer that on input contains a pointer to the
+        remaining path string to walk. On output, this will be advanced beyond
+        the components that were walked.
+
+    PathSize - Supplies a pointer that on input contains the size of the
+        remaining path string, not including the null terminator. This is
+        updated along with the path.
+
+    OpenFlags - Supplies the open flags governing the final component of the
+        walk. See OPEN_FLAG_* definitions.
+
+    Create - Supplies a boolean indicating whether or not the final component
+        is to be created. Creates are always left to the locked path.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG ComponentSize;
+    PPATH_ENTRY Current;
+    PCSTR CurrentPath;
+    ULONG CurrentPathSize;
+    IO_OBJECT_TYPE CurrentType;
+    BOOL FinalComponent;
+    ULONG Hash;
+    PPATH_ENTRY Next;
+    IO_OBJECT_TYPE NextType;
+    PPATH_ENTRY OriginalEntry;
+    ULONG OldWalkerCount;
+    ULONG Parity;
+    PPATH_ENTRY Previous;
+    PCSTR PreviousPath;
+    ULONG PreviousPathSize;
+    PATH_POINT SearchPoint;
+    PPATH_WALKER_SLOT Slot;
+    KSTATUS Status;
+
+    if (IoLocklessPathWalkEnabled == FALSE) {
+        return;
+    }
+
+    OriginalEntry = Entry->PathEntry;
+    Current = OriginalEntry;
+    CurrentPath = *Path;
+    CurrentPathSize = *PathSize;
+    Previous = Current;
+    PreviousPath = CurrentPath;
+    PreviousPathSize = CurrentPathSize;
+    SearchPoint.MountPoint = Entry->MountPoint;
+
+    //
+    // Announce this walker in the current processor's slot so that path
+    // entries destroyed from here on out stick around until it leaves. The
+    // thread may migrate, but it always leaves through the same count.
+    //
+
+    Slot = &(IoPathWalkerSlots[KeGetCurrentProcessorNumber() %
+                               IoPathWalkerSlotCount]);
+
+    Parity = IoPathWalkEpoch & 0x1;
+    RtlAtomicAdd32(&(Slot->Count[Parity]), 1);
+    while (TRUE) {
+        while ((CurrentPathSize != 0) && (*CurrentPath == PATH_SEPARATOR)) {
+            CurrentPath += 1;
+            CurrentPathSize -= 1;
+        }
+
+        if ((CurrentPathSize == 0) || (*CurrentPath == '\0')) {
+            break;
+        }
+
+        ComponentSize = 0;
+        while ((ComponentSize < CurrentPathSize) &&
+               (CurrentPath[ComponentSize] != PATH_SEPARATOR) &&
+               (CurrentPath[ComponentSize] != '\0')) {
+
+            ComponentSize += 1;
+        }
+
+        FinalComponent = FALSE;
+        if ((ComponentSize == CurrentPathSize) ||
+            (CurrentPath[ComponentSize] == '\0')) {
+
+            FinalComponent = TRUE;
+            if (Create != FALSE) {
+                break;
+            }
+        }
+
+        //
+        // Let the locked walk produce any failures, including the search
+        // permission check on the directory.
+        //
+
+        CurrentType = Current->FileObject->Properties.Type;
+        if ((CurrentType != IoObjectRegularDirectory) &&
+            (CurrentType != IoObjectObjectDirectory)) {
+
+            break;
+        }
+
+        if (FromKernelMode == FALSE) {
+            SearchPoint.PathEntry = Current;
+            Status = IopCheckPermissions(FromKernelMode,
+                                         &SearchPoint,
+                                         IO_ACCESS_EXECUTE);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+        }
+
+        //
+        // Handle the dot entries. Dot-dot is only handled when it cannot
+        // escape the caller's root or cross out of a mount point.
+        //
+
+        if (IopArePathsEqual(".", CurrentPath, ComponentSize + 1) != FALSE) {
+            Next = Current;
+
+        } else if (IopArePathsEqual("..", CurrentPath, ComponentSize + 1) !=
+                   FALSE) {
+
+            SearchPoint.PathEntry = Current;
+            if ((IO_ARE_PATH_POINTS_EQUAL(&SearchPoint, Root) != FALSE) ||
+                (IO_IS_MOUNT_POINT(&SearchPoint) != FALSE) ||
+                (Current->Parent == NULL)) {
+
+                break;
+            }
+
+            Next = Current->Parent;
+
+        } else {
+            Hash = IopHashPathString(CurrentPath, ComponentSize + 1);
+            Next = IopFindPathEntryLockless(Current,
+                                            CurrentPath,
+                                            ComponentSize + 1,
+                                            Hash);
+
+            if (Next == NULL) {
+                break;
+            }
+        }
+
+        //
+        // Leave symbolic links to the locked walk. Anything that is not the
+        // last component (or has a trailing slash) must be a directory.
+        //
+
+        NextType = Next->FileObject->Properties.Type;
+        if (NextType == IoObjectSymbolicLink) {
+            break;
+        }
+
+        if (((FinalComponent == FALSE) ||
+             ((OpenFlags & OPEN_FLAG_DIRECTORY) != 0)) &&
+            (NextType != IoObjectRegularDirectory) &&
+            (NextType != IoObjectObjectDirectory)) {
+
+            break;
+        }
+
+        Previous = Current;
+        PreviousPath = CurrentPath;
+        PreviousPathSize = CurrentPathSize;
+        Current = Next;
+        CurrentPath += ComponentSize;
+        CurrentPathSize -= ComponentSize;
+        if (FinalComponent != FALSE) {
+            break;
+        }
+    }
+
+    //
+    // Try to pin down where the walk ended up. Cached but unreferenced entries
+    // cannot be resurrected from here, as that requires the cache list lock.
+    // Back off one component if the final entry is such an entry, as its
+    // parent directory is pinned by the child's reference.
+    //
+
+    if (Current != OriginalEntry) {
+        if (IopPathEntryAddReferenceIfActive(Current) == FALSE) {
+            Current = Previous;
+            CurrentPath = PreviousPath;
+            CurrentPathSize = PreviousPathSize;
+            if ((Current != OriginalEntry) &&
+                (IopPathEntryAddReferenceIfActive(Current) == FALSE)) {
+
+                Current = OriginalEntry;
+            }
+        }
+    }
+
+    OldWalkerCount = RtlAtomicAdd32(&(Slot->Count[Parity]), (ULONG)-1);
+
+    ASSERT(OldWalkerCount != 0);
+
+    if (Current == OriginalEntry) {
+        return;
+    }
+
+    //
+    // The walk never left the starting mount point, so the mount point
+    // reference carries over to the new path point.
+    //
+
+    Entry->PathEntry = Current;
+    *Path = CurrentPath;
+    *PathSize = CurrentPathSize;
+    IoPathEntryReleaseReference(OriginalEntry);
+    return;
+}
+
+PPATH_ENTRY
+IopFindPathEntryLockless (
+    PPATH_ENTRY Directory,
+    PCSTR Name,
+    ULONG NameSize,
+    ULONG Hash
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches a directory's cached children for a positive,
+    unmounted path entry with the given name without acquiring the directory
+    lock. The caller must be registered as a lockless path walker.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory path entry to search.
+
+    Name - Supplies a pointer the query string, which may not be null
+        terminated.
+
+    NameSize - Supplies the size of the string including the assumed null
+        terminator that is never checked.
+
+    Hash - Supplies the hash of the name query string.
+
+Return Value:
+
+    Returns a pointer to the found path entry on success. No reference is
+    taken on it.
+
+    NULL if no suitable entry was found or the directory changed during the
+    search.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPATH_ENTRY Entry;
+    PPATH_ENTRY Found;
+    ULONG Sequence;
+
+    Found = NULL;
+    Sequence = Directory->ChildSequence;
+    if ((Sequence & 0x1) != 0) {
+        return NULL;
+    }
+
+    RtlMemoryBarrier();
+    CurrentEntry = Directory->ChildList.Next;
+    while (CurrentEntry != &(Directory->ChildList)) {
+
+        //
+        // Revalidate before every dereference, as an entry that was unlinked
+        // out from under this walk may point anywhere.
+        //
+
+        RtlMemoryBarrier();
+        if ((CurrentEntry == NULL) || (Directory->ChildSequence != Sequence)) {
+            return NULL;
+        }
+
+        Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Entry->Hash != Hash) || (Entry->Name == NULL)) {
+            continue;
+        }
+
+        if (IopArePathsEqual(Entry->Name, Name, NameSize) == FALSE) {
+            continue;
+        }
+
+        //
+        // Negative entries and mount points need the locked walk.
+        //
+
+        if ((Entry->Negative == FALSE) &&
+            (Entry->FileObject != NULL) &&
+            (Entry->MountCount == 0)) {
+
+            Found = Entry;
+        }
+
+        break;
+    }
+
+    RtlMemoryBarrier();
+    if (Directory->ChildSequence != Sequence) {
+        return NULL;
+    }
+
+    return Found;
+}
+
+BOOL
+IopPathEntryAddReferenceIfActive (
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a reference to the given path entry only if it already
+    has at least one reference. This is used by lockless path walkers, which
+    cannot pull an entry back out of the path entry cache.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry.
+
+Return Value:
+
+    TRUE if a reference was added.
+
+    FALSE if the path entry had no references.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+    ULONG ReferenceCount;
+
+    ReferenceCount = Entry->ReferenceCount;
+    while (ReferenceCount != 0) {
+
+        ASSERT(ReferenceCount < 0x10000000);
+
+        OldReferenceCount = RtlAtomicCompareExchange32(
+                                                    &(Entry->ReferenceCount),
+                                                    ReferenceCount + 1,
+                                                    ReferenceCount);
+
+        if (OldReferenceCount == ReferenceCount) {
+            return TRUE;
+        }
+
+        ReferenceCount = OldReferenceCount;
+    }
+
+    return FALSE;
+}
+
+VOID
+IopRetirePathEntry (
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the resources of a destroyed path entry, or defers
+    that until no lockless path walkers can still be looking at it. The entry
+    must already be unlinked from its parent.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry to retire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL QueueWorkItem;
+    KSTATUS Status;
+
+    //
+    // Walkers that arrive after this point cannot find the entry, so if there
+    // are none right now, it can go immediately.
+    //
+
+    RtlMemoryBarrier();
+    if ((IopCountPathWalkers(0) == 0) && (IopCountPathWalkers(1) == 0)) {
+        IopFreePathEntry(Entry);
+        return;
+    }
+
+    ASSERT(Entry->CacheListEntry.Next == NULL);
+
+    QueueWorkItem = FALSE;
+    KeAcquireQueuedLock(IoRetiredPathEntryLock);
+    INSERT_BEFORE(&(Entry->CacheListEntry), &IoRetiredPathEntryList);
+    if (IoRetiredPathEntryReclaimQueued == FALSE) {
+        IoRetiredPathEntryReclaimQueued = TRUE;
+        QueueWorkItem = TRUE;
+    }
+
+    KeReleaseQueuedLock(IoRetiredPathEntryLock);
+
+    //
+    // Waiting for the walkers to leave is left to a work item. If it cannot
+    // be queued, the entry stays on the list and the next retirement tries
+    // again.
+    //
+
+    if (QueueWorkItem != FALSE) {
+        Status = KeCreateAndQueueWorkItem(NULL,
+                                          WorkPriorityNormal,
+                                          IopReclaimRetiredPathEntries,
+                                          NULL);
+
+        if (!KSUCCESS(Status)) {
+            KeAcquireQueuedLock(IoRetiredPathEntryLock);
+            IoRetiredPathEntryReclaimQueued = FALSE;
+            KeReleaseQueuedLock(IoRetiredPathEntryLock);
+        }
+    }
+
+    return;
+}
+
+VOID
+IopReclaimRetiredPathEntries (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the work item that frees retired path entries. It
+    takes the current batch of retired entries, waits out a grace period in
+    which every lockless path walker that might have seen them leaves, and
+    then frees them, repeating until no retired entries are left.
+
+Arguments:
+
+    Parameter - Supplies an unused parameter.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPATH_ENTRY Entry;
+    ULONG Parity;
+    LIST_ENTRY ReclaimList;
+
+    while (TRUE) {
+        INITIALIZE_LIST_HEAD(&ReclaimList);
+        KeAcquireQueuedLock(IoRetiredPathEntryLock);
+        if (LIST_EMPTY(&IoRetiredPathEntryList) != FALSE) {
+            IoRetiredPathEntryReclaimQueued = FALSE;
+            KeReleaseQueuedLock(IoRetiredPathEntryLock);
+            break;
+        }
+
+        MOVE_LIST(&IoRetiredPathEntryList, &ReclaimList);
+        INITIALIZE_LIST_HEAD(&IoRetiredPathEntryList);
+        KeReleaseQueuedLock(IoRetiredPathEntryLock);
+
+        //
+        // Everything in the batch was unlinked before it was retired. First
+        // wait out any walkers that read the epoch before the last flip but
+        // registered after it. Then flip the epoch so new walkers use the
+        // other count, and wait for the count they used to drain. New walkers
+        // never add to the count being waited on, so this always finishes.
+        //
+
+        Parity = IoPathWalkEpoch & 0x1;
+        IopWaitForPathWalkers(Parity ^ 0x1);
+        RtlAtomicAdd32(&IoPathWalkEpoch, 1);
+        IopWaitForPathWalkers(Parity);
+        CurrentEntry = ReclaimList.Next;
+        while (CurrentEntry != &ReclaimList) {
+            Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, CacheListEntry);
+            CurrentEntry = CurrentEntry->Next;
+            Entry->CacheListEntry.Next = NULL;
+            IopFreePathEntry(Entry);
+        }
+    }
+
+    return;
+}
+
+VOID
+IopWaitForPathWalkers (
+    ULONG Parity
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until no lockless path walkers are registered under
+    the given epoch parity.
+
+Arguments:
+
+    Parity - Supplies the epoch parity whose walkers to wait for.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    while (IopCountPathWalkers(Parity) != 0) {
+        KeDelayExecution(FALSE, FALSE, PATH_WALKER_POLL_INTERVAL);
+    }
+
+    return;
+}
+
+ULONG
+IopCountPathWalkers (
+    ULONG Parity
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sums the lockless path walkers registered under the given
+    epoch parity across all processors. A walker always leaves through the
+    slot it registered in, so each slot's count is exact.
+
+Arguments:
+
+    Parity - Supplies the epoch parity whose walkers to count.
+
+Return Value:
+
+    Returns the number of walkers registered under the given parity.
+
+--*/
+
+{
+
+    ULONG Count;
+    ULONG Index;
+
+    Count = 0;
+    for (Index = 0; Index < IoPathWalkerSlotCount; Index += 1) {
+        Count += IoPathWalkerSlots[Index].Count[Parity];
+    }
+
+    RtlMemoryBarrier();
+    return Count;
+}
+
+VOID
+IopFreePathEntry (
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the file object of a destroyed path entry and frees
+    the path entry itself.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Entry->ReferenceCount == 0);
+    ASSERT((Entry->Negative != FALSE) || (Entry->FileObject != NULL));
+
+    //
+    // Decrement the count of path entries that own the file object, and
+    // release the file object.
+    //
+
+    if (Entry->Negative == FALSE) {
+        IopFileObjectReleasePathEntryReference(Entry->FileObject);
+        IopFileObjectReleaseReference(Entry->FileObject);
+    }
+
+    MmFreePagedPool(Entry);
+    return;
+}
@@ -38,8 +38,9 @@ Module Name:
 
 //
 // TODO: This doesn't work, as Volume0 is usually a small 10MB boot partition.
-// Make shared memory objects work in this case and when the file system is
-// all read-only.
+// Shared memory objects only use a backing image when paging is enabled;
+// otherwise they are stored in memory chunks. Make the backing image work
+// when the file system is all read-only.
 //
 
 #define SHARED_MEMORY_OBJECT_DIRECTORY "/Volume/Volume0/temp"
@@ -50,6 +51,14 @@ Module Name:
 
 #define MAX_SHARED_MEMORY_OBJECT_CREATE_RETRIES 10
 
+//
+// Define the granularity of the in-memory store used when paging is disabled.
+// Each chunk is a single physically contiguous run when memory allows.
+//
+
+#define SHARED_MEMORY_CHUNK_SHIFT 20
+#define SHARED_MEMORY_CHUNK_SIZE (1UL << SHARED_MEMORY_CHUNK_SHIFT)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -68,7 +77,18 @@ Structure Description:
         memory object.
 
     BackingImage - Stores a handle to the file that backs the shared memory
-        object.
+        object. This is only used when paging is enabled, otherwise the
+        object's contents live in the chunk array.
+
+    ChunkLock - Stores a pointer to the lock that protects the chunk array.
+
+    Chunks - Stores an array of I/O buffers, each describing one chunk of
+        the shared memory object's contents. Chunks are allocated on first
+        write or cache miss; a NULL entry reads as zeros. The page cache
+        entries for the object borrow the chunks' physical pages rather than
+        holding copies of them.
+
+    ChunkCount - Stores the number of elements in the chunk array.
 
 --*/
 
@@ -76,6 +96,9 @@ typedef struct _SHARED_MEMORY_OBJECT {
     OBJECT_HEADER Header;
     PFILE_OBJECT FileObject;
     PIO_HANDLE BackingImage;
+    PQUEUED_LOCK ChunkLock;
+    PIO_BUFFER *Chunks;
+    UINTN ChunkCount;
 } SHARED_MEMORY_OBJECT, *PSHARED_MEMORY_OBJECT;
 
 //
@@ -95,6 +118,43 @@ IopAddSharedMemoryObjectPathPrefix (
     PULONG NewPathLength
     );
 
+KSTATUS
+IopCreateSharedMemoryBackingImage (
+    PSHARED_MEMORY_OBJECT SharedMemoryObject
+    );
+
+KSTATUS
+IopPerformSharedMemoryChunkIo (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext
+    );
+
+KSTATUS
+IopCopyToSharedMemoryChunk (
+    PIO_BUFFER Chunk,
+    UINTN ChunkOffset,
+    PIO_BUFFER Source,
+    UINTN SourceOffset,
+    UINTN Size
+    );
+
+PIO_BUFFER
+IopAllocateSharedMemoryChunk (
+    VOID
+    );
+
+KSTATUS
+IopGrowSharedMemoryChunkArray (
+    PSHARED_MEMORY_OBJECT SharedMemoryObject,
+    ULONGLONG Size
+    );
+
+VOID
+IopTrimSharedMemoryChunks (
+    PSHARED_MEMORY_OBJECT SharedMemoryObject,
+    ULONGLONG NewSize
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -304,32 +364,17 @@ Return Value:
 {
 
     BOOL Created;
-    ULONG DirectoryAccess;
-    PIO_HANDLE DirectoryHandle;
-    ULONG DirectoryOpenFlags;
     PSHARED_MEMORY_OBJECT ExistingObject;
-    ULONG FileAccess;
     FILE_ID FileId;
-    PSTR FileName;
-    ULONG FileNameLength;
-    ULONG FileOpenFlags;
     FILE_PROPERTIES FileProperties;
-    PIO_HANDLE Handle;
-    ULONG MaxFileNameLength;
     PFILE_OBJECT NewFileObject;
     PSHARED_MEMORY_OBJECT NewSharedMemoryObject;
     POBJECT_HEADER ObjectDirectory;
-    PSTR Path;
-    ULONG PathLength;
-    ULONG RetryCount;
     PPATH_POINT SharedMemoryDirectory;
     KSTATUS Status;
 
-    DirectoryHandle = INVALID_HANDLE;
-    FileName = NULL;
     NewFileObject = NULL;
     NewSharedMemoryObject = NULL;
-    Path = NULL;
 
     //
     // Create an object manager object. If it is to be immediately unlinked, do
@@ -423,120 +468,26 @@ Return Value:
     }
 
     //
-    // Allocate a buffer that will be used to create the shared memory object's
-    // backing image's file name.
-    //
-
-    MaxFileNameLength = RtlPrintToString(
-                                      NULL,
-                                      0,
-                                      CharacterEncodingDefault,
-                                      SHARED_MEMORY_OBJECT_FORMAT_STRING,
-                                      NewSharedMemoryObject,
-                                      MAX_SHARED_MEMORY_OBJECT_CREATE_RETRIES);
-
-    FileName = MmAllocatePagedPool(MaxFileNameLength, IO_ALLOCATION_TAG);
-    if (FileName == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-        goto CreateSharedMemoryObjectEnd;
-    }
-
-    //
-    // Loop trying to create the backing image.
+    // With no page file to fall back on, there is nowhere better than memory
+    // to keep the object's contents. Store them in large chunks rather than
+    // in a file on the boot volume. Otherwise create a backing image so the
+    // contents can be written out under memory pressure.
     //
 
-    DirectoryOpenFlags = OPEN_FLAG_CREATE | OPEN_FLAG_DIRECTORY;
-    DirectoryAccess = IO_ACCESS_READ | IO_ACCESS_WRITE;
-    FileOpenFlags = OPEN_FLAG_NON_CACHED |
-                    OPEN_FLAG_CREATE |
-                    OPEN_FLAG_FAIL_IF_EXISTS |
-                    OPEN_FLAG_UNLINK_ON_CREATE;
-
-    FileAccess = IO_ACCESS_READ | IO_ACCESS_WRITE;
-    RetryCount = 0;
-    while (RetryCount < MAX_SHARED_MEMORY_OBJECT_CREATE_RETRIES) {
-
-        //
-        // Make sure that the shared memory object directory exists.
-        //
-
-        Status = IoOpen(TRUE,
-                        NULL,
-                        SHARED_MEMORY_OBJECT_DIRECTORY,
-                        SHARED_MEMORY_OBJECT_DIRECTORY_LENGTH,
-                        DirectoryAccess,
-                        DirectoryOpenFlags,
-                        FILE_PERMISSION_NONE,
-                        &DirectoryHandle);
-
-        if (!KSUCCESS(Status) && (Status != STATUS_FILE_EXISTS)) {
-            goto CreateSharedMemoryObjectEnd;
-        }
-
-        if (DirectoryHandle != INVALID_HANDLE) {
-            IoClose(DirectoryHandle);
-        }
-
-        //
-        // Create the path to the shared memory object's backing image.
-        //
-
-        FileNameLength = RtlPrintToString(FileName,
-                                          MaxFileNameLength,
-                                          CharacterEncodingDefault,
-                                          SHARED_MEMORY_OBJECT_FORMAT_STRING,
-                                          NewSharedMemoryObject,
-                                          RetryCount);
-
-        if (Path != NULL) {
-            MmFreePagedPool(Path);
-            Path = NULL;
-        }
-
-        Status = IoPathAppend(SHARED_MEMORY_OBJECT_DIRECTORY,
-                              SHARED_MEMORY_OBJECT_DIRECTORY_LENGTH,
-                              FileName,
-                              FileNameLength,
-                              IO_ALLOCATION_TAG,
-                              &Path,
-                              &PathLength);
-
-        if (!KSUCCESS(Status)) {
+    if (MmIsPagingEnabled() == FALSE) {
+        NewSharedMemoryObject->ChunkLock = KeCreateQueuedLock();
+        if (NewSharedMemoryObject->ChunkLock == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
             goto CreateSharedMemoryObjectEnd;
         }
 
-        Status = IoOpen(TRUE,
-                        NULL,
-                        Path,
-                        PathLength,
-                        FileAccess,
-                        FileOpenFlags,
-                        FILE_PERMISSION_NONE,
-                        &Handle);
-
-        //
-        // If the file already exists or the directroy got removed since it
-        // was created above, try again.
-        //
-
-        if ((Status == STATUS_FILE_EXISTS) ||
-            (Status == STATUS_PATH_NOT_FOUND)) {
-
-            RetryCount += 1;
-            continue;
-        }
-
+    } else {
+        Status = IopCreateSharedMemoryBackingImage(NewSharedMemoryObject);
         if (!KSUCCESS(Status)) {
             goto CreateSharedMemoryObjectEnd;
         }
-
-        break;
     }
 
-    ASSERT(Handle != INVALID_HANDLE);
-
-    NewSharedMemoryObject->BackingImage = Handle;
-
     //
     // If the shared memory object is named, then it is valid until it is
     // unlinked. So, add a reference to the file object to make sure the create
@@ -577,14 +528,6 @@ Return Value:
         }
     }
 
-    if (Path != NULL) {
-        MmFreePagedPool(Path);
-    }
-
-    if (FileName != NULL) {
-        MmFreePagedPool(FileName);
-    }
-
     return Status;
 }
 
@@ -618,6 +561,8 @@ Return Value:
 
     PIO_HANDLE BackingImage;
     PFILE_OBJECT BackingImageObject;
+    ULONGLONG FileSize;
+    IO_OFFSET Offset;
     PSHARED_MEMORY_OBJECT SharedMemoryObject;
     KSTATUS Status;
 
@@ -627,21 +572,38 @@ Return Value:
     SharedMemoryObject = FileObject->SpecialIo;
 
     //
-    // There must be a backing image as long as the shared object is alive.
+    // Objects without a backing image just need their chunk array sized to
+    // match. Release any chunks that fell off the end. The page cache entries
+    // past the end are using those chunks' pages, so evict them first.
     //
 
-    ASSERT(SharedMemoryObject->BackingImage != INVALID_HANDLE);
+    if (SharedMemoryObject->BackingImage == INVALID_HANDLE) {
+        READ_INT64_SYNC(&(FileObject->Properties.FileSize), &FileSize);
+        if (NewSize < FileSize) {
+            Offset = ALIGN_RANGE_UP(NewSize, IoGetCacheEntryDataSize());
+            IopEvictFileObject(FileObject, Offset, EVICTION_FLAG_TRUNCATE);
+        }
+
+        KeAcquireQueuedLock(SharedMemoryObject->ChunkLock);
+        Status = IopGrowSharedMemoryChunkArray(SharedMemoryObject, NewSize);
+        if (KSUCCESS(Status)) {
+            IopTrimSharedMemoryChunks(SharedMemoryObject, NewSize);
+        }
+
+        KeReleaseQueuedLock(SharedMemoryObject->ChunkLock);
 
     //
     // Otherwise modify the backing image's file size to be the same as the
     // shared memory object's file size.
     //
 
-    BackingImage = SharedMemoryObject->BackingImage;
-    BackingImageObject = BackingImage->FileObject;
-    Status = IopModifyFileObjectSize(BackingImageObject,
-                                     BackingImage->DeviceContext,
-                                     NewSize);
+    } else {
+        BackingImage = SharedMemoryObject->BackingImage;
+        BackingImageObject = BackingImage->FileObject;
+        Status = IopModifyFileObjectSize(BackingImageObject,
+                                         BackingImage->DeviceContext,
+                                         NewSize);
+    }
 
     if (KSUCCESS(Status)) {
         WRITE_INT64_SYNC(&(FileObject->Properties.FileSize), NewSize);
@@ -650,6 +612,49 @@ Return Value:
     return Status;
 }
 
+BOOL
+IopIsSharedMemoryObjectInMemory (
+    PFILE_OBJECT FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given file object is a shared memory
+    object whose contents live in memory chunks rather than a backing image.
+    Page cache entries for such an object borrow the chunks' physical pages.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a file object.
+
+Return Value:
+
+    TRUE if the file object is a shared memory object kept in memory.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    PSHARED_MEMORY_OBJECT SharedMemoryObject;
+
+    if (FileObject->Properties.Type != IoObjectSharedMemoryObject) {
+        return FALSE;
+    }
+
+    SharedMemoryObject = FileObject->SpecialIo;
+    if ((SharedMemoryObject == NULL) ||
+        (SharedMemoryObject->BackingImage != INVALID_HANDLE)) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 KSTATUS
 IopUnlinkSharedMemoryObject (
     PFILE_OBJECT FileObject,
@@ -736,13 +741,10 @@ Return Value:
     ASSERT(KeIsSharedExclusiveLockHeld(FileObject->Lock) != FALSE);
 
     SharedMemoryObject = FileObject->SpecialIo;
-
-    //
-    // There must be a backing image as long as the shared memory object is
-    // alive.
-    //
-
-    ASSERT(SharedMemoryObject->BackingImage != INVALID_HANDLE);
+    if (SharedMemoryObject->BackingImage == INVALID_HANDLE) {
+        Status = IopPerformSharedMemoryChunkIo(FileObject, IoContext);
+        goto PerformSharedMemoryIoOperationEnd;
+    }
 
     //
     // If this is a read operation then read from the backing image.
@@ -831,8 +833,636 @@ Return Value:
         SharedMemoryObject->BackingImage = INVALID_HANDLE;
     }
 
+    if (SharedMemoryObject->Chunks != NULL) {
+        IopTrimSharedMemoryChunks(SharedMemoryObject, 0);
+        MmFreeNonPagedPool(SharedMemoryObject->Chunks);
+        SharedMemoryObject->Chunks = NULL;
+        SharedMemoryObject->ChunkCount = 0;
+    }
+
+    if (SharedMemoryObject->ChunkLock != NULL) {
+        KeDestroyQueuedLock(SharedMemoryObject->ChunkLock);
+        SharedMemoryObject->ChunkLock = NULL;
+    }
+
     ASSERT(SharedMemoryObject->FileObject == NULL);
 
     return;
 }
 
+KSTATUS
+IopCreateSharedMemoryBackingImage (
+    PSHARED_MEMORY_OBJECT SharedMemoryObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the unlinked temporary file that backs a shared
+    memory object when paging is enabled.
+
+Arguments:
+
+    SharedMemoryObject - Supplies a pointer to the shared memory object.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG DirectoryAccess;
+    PIO_HANDLE DirectoryHandle;
+    ULONG DirectoryOpenFlags;
+    ULONG FileAccess;
+    PSTR FileName;
+    ULONG FileNameLength;
+    ULONG FileOpenFlags;
+    PIO_HANDLE Handle;
+    ULONG MaxFileNameLength;
+    PSTR Path;
+    ULONG PathLength;
+    ULONG RetryCount;
+    KSTATUS Status;
+
+    DirectoryHandle = INVALID_HANDLE;
+    FileName = NULL;
+    Path = NULL;
+
+    //
+    // Allocate a buffer that will be used to create the shared memory object's
+    // backing image's file name.
+    //
+
+    MaxFileNameLength = RtlPrintToString(
+                                      NULL,
+                                      0,
+                                      CharacterEncodingDefault,
+                                      SHARED_MEMORY_OBJECT_FORMAT_STRING,
+                                      SharedMemoryObject,
+                                      MAX_SHARED_MEMORY_OBJECT_CREATE_RETRIES);
+
+    FileName = MmAllocatePagedPool(MaxFileNameLength, IO_ALLOCATION_TAG);
+    if (FileName == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateSharedMemoryBackingImageEnd;
+    }
+
+    //
+    // Loop trying to create the backing image.
+    //
+
+    DirectoryOpenFlags = OPEN_FLAG_CREATE | OPEN_FLAG_DIRECTORY;
+    DirectoryAccess = IO_ACCESS_READ | IO_ACCESS_WRITE;
+    Handle = INVALID_HANDLE;
+    FileOpenFlags = OPEN_FLAG_NON_CACHED |
+                    OPEN_FLAG_CREATE |
+                    OPEN_FLAG_FAIL_IF_EXISTS |
+                    OPEN_FLAG_UNLINK_ON_CREATE;
+
+    FileAccess = IO_ACCESS_READ | IO_ACCESS_WRITE;
+    RetryCount = 0;
+    while (RetryCount < MAX_SHARED_MEMORY_OBJECT_CREATE_RETRIES) {
+
+        //
+        // Make sure that the shared memory object directory exists.
+        //
+
+        Status = IoOpen(TRUE,
+                        NULL,
+                        SHARED_MEMORY_OBJECT_DIRECTORY,
+                        SHARED_MEMORY_OBJECT_DIRECTORY_LENGTH,
+                        DirectoryAccess,
+                        DirectoryOpenFlags,
+                        FILE_PERMISSION_NONE,
+                        &DirectoryHandle);
+
+        if (!KSUCCESS(Status) && (Status != STATUS_FILE_EXISTS)) {
+            goto CreateSharedMemoryBackingImageEnd;
+        }
+
+        if (DirectoryHandle != INVALID_HANDLE) {
+            IoClose(DirectoryHandle);
+            DirectoryHandle = INVALID_HANDLE;
+        }
+
+        //
+        // Create the path to the shared memory object's backing image.
+        //
+
+        FileNameLength = RtlPrintToString(FileName,
+                                          MaxFileNameLength,
+                                          CharacterEncodingDefault,
+                                          SHARED_MEMORY_OBJECT_FORMAT_STRING,
+                                          SharedMemoryObject,
+                                          RetryCount);
+
+        if (Path != NULL) {
+            MmFreePagedPool(Path);
+            Path = NULL;
+        }
+
+        Status = IoPathAppend(SHARED_MEMORY_OBJECT_DIRECTORY,
+                              SHARED_MEMORY_OBJECT_DIRECTORY_LENGTH,
+                              FileName,
+                              FileNameLength,
+                              IO_ALLOCATION_TAG,
+                              &Path,
+                              &PathLength);
+
+        if (!KSUCCESS(Status)) {
+            goto CreateSharedMemoryBackingImageEnd;
+        }
+
+        Status = IoOpen(TRUE,
+                        NULL,
+                        Path,
+                        PathLength,
+                        FileAccess,
+                        FileOpenFlags,
+                        FILE_PERMISSION_NONE,
+                        &Handle);
+
+        //
+        // If the file already exists or the directroy got removed since it
+        // was created above, try again.
+        //
+
+        if ((Status == STATUS_FILE_EXISTS) ||
+            (Status == STATUS_PATH_NOT_FOUND)) {
+
+            RetryCount += 1;
+            continue;
+        }
+
+        if (!KSUCCESS(Status)) {
+            goto CreateSharedMemoryBackingImageEnd;
+        }
+
+        break;
+    }
+
+    if (!KSUCCESS(Status)) {
+        goto CreateSharedMemoryBackingImageEnd;
+    }
+
+    ASSERT(Handle != INVALID_HANDLE);
+
+    SharedMemoryObject->BackingImage = Handle;
+    Status = STATUS_SUCCESS;
+
+CreateSharedMemoryBackingImageEnd:
+    if (Path != NULL) {
+        MmFreePagedPool(Path);
+    }
+
+    if (FileName != NULL) {
+        MmFreePagedPool(FileName);
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopPerformSharedMemoryChunkIo (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a non-cached I/O operation on a shared memory object
+    whose contents are stored in memory chunks rather than a backing image.
+    Reads of regions that were never written return zeros. A read into an
+    empty I/O buffer, which is how the page cache handles a miss, fills the
+    buffer with the chunks' own pages so that the page cache shares them
+    instead of copying them.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object for the shared memory
+        object.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN BufferOffset;
+    UINTN BytesThisRound;
+    PIO_BUFFER Chunk;
+    UINTN ChunkIndex;
+    UINTN ChunkOffset;
+    ULONGLONG FileSize;
+    IO_OFFSET Offset;
+    UINTN PageOffset;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    BOOL SharePages;
+    PSHARED_MEMORY_OBJECT SharedMemoryObject;
+    UINTN Size;
+    KSTATUS Status;
+
+    SharedMemoryObject = FileObject->SpecialIo;
+    BufferOffset = 0;
+    Offset = IoContext->Offset;
+    PageSize = MmPageSize();
+    Size = IoContext->SizeInBytes;
+    SharePages = FALSE;
+    if ((IoContext->Write == FALSE) &&
+        (MmGetIoBufferSize(IoContext->IoBuffer) == 0)) {
+
+        ASSERT(IS_ALIGNED(Offset, PageSize) != FALSE);
+        ASSERT(IS_ALIGNED(Size, PageSize) != FALSE);
+
+        SharePages = TRUE;
+    }
+
+    KeAcquireQueuedLock(SharedMemoryObject->ChunkLock);
+
+    //
+    // Reads stop at the end of the object. Writes may extend it, so make sure
+    // there is a chunk slot for every byte about to be written. Shared pages
+    // must fill the whole buffer, as a write miss beyond the end of the
+    // object gets its page this way too.
+    //
+
+    if ((IoContext->Write == FALSE) && (SharePages == FALSE)) {
+        READ_INT64_SYNC(&(FileObject->Properties.FileSize), &FileSize);
+        if (Offset >= FileSize) {
+            Status = STATUS_END_OF_FILE;
+            goto PerformSharedMemoryChunkIoEnd;
+        }
+
+        if ((FileSize - Offset) < Size) {
+            Size = FileSize - Offset;
+        }
+
+    } else {
+        Status = IopGrowSharedMemoryChunkArray(SharedMemoryObject,
+                                               Offset + Size);
+
+        if (!KSUCCESS(Status)) {
+            goto PerformSharedMemoryChunkIoEnd;
+        }
+    }
+
+    while (BufferOffset < Size) {
+        ChunkIndex = (UINTN)(Offset >> SHARED_MEMORY_CHUNK_SHIFT);
+        ChunkOffset = REMAINDER(Offset, SHARED_MEMORY_CHUNK_SIZE);
+        BytesThisRound = SHARED_MEMORY_CHUNK_SIZE - ChunkOffset;
+        if (BytesThisRound > (Size - BufferOffset)) {
+            BytesThisRound = Size - BufferOffset;
+        }
+
+        Chunk = NULL;
+        if (ChunkIndex < SharedMemoryObject->ChunkCount) {
+            Chunk = SharedMemoryObject->Chunks[ChunkIndex];
+        }
+
+        if ((Chunk == NULL) &&
+            ((IoContext->Write != FALSE) || (SharePages != FALSE))) {
+
+            ASSERT(ChunkIndex < SharedMemoryObject->ChunkCount);
+
+            Chunk = IopAllocateSharedMemoryChunk();
+            if (Chunk == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto PerformSharedMemoryChunkIoEnd;
+            }
+
+            SharedMemoryObject->Chunks[ChunkIndex] = Chunk;
+        }
+
+        if (SharePages != FALSE) {
+            for (PageOffset = 0;
+                 PageOffset < BytesThisRound;
+                 PageOffset += PageSize) {
+
+                PhysicalAddress = MmGetIoBufferPhysicalAddress(
+                                                      Chunk,
+                                                      ChunkOffset + PageOffset);
+
+                MmIoBufferAppendPage(IoContext->IoBuffer,
+                                     NULL,
+                                     NULL,
+                                     PhysicalAddress);
+            }
+
+            Status = STATUS_SUCCESS;
+
+        } else if (IoContext->Write == FALSE) {
+            if (Chunk == NULL) {
+                Status = MmZeroIoBuffer(IoContext->IoBuffer,
+                                        BufferOffset,
+                                        BytesThisRound);
+
+            } else {
+                Status = MmCopyIoBuffer(IoContext->IoBuffer,
+                                        BufferOffset,
+                                        Chunk,
+                                        ChunkOffset,
+                                        BytesThisRound);
+            }
+
+        } else {
+            Status = IopCopyToSharedMemoryChunk(Chunk,
+                                                ChunkOffset,
+                                                IoContext->IoBuffer,
+                                                BufferOffset,
+                                                BytesThisRound);
+        }
+
+        if (!KSUCCESS(Status)) {
+            goto PerformSharedMemoryChunkIoEnd;
+        }
+
+        BufferOffset += BytesThisRound;
+        Offset += BytesThisRound;
+    }
+
+    Status = STATUS_SUCCESS;
+
+PerformSharedMemoryChunkIoEnd:
+    KeReleaseQueuedLock(SharedMemoryObject->ChunkLock);
+    IoContext->BytesCompleted = BufferOffset;
+    if ((IoContext->Write != FALSE) && (BufferOffset != 0)) {
+        IopUpdateFileObjectFileSize(FileObject,
+                                    IoContext->Offset + BufferOffset);
+    }
+
+    return Status;
+}
+
+KSTATUS
+IopCopyToSharedMemoryChunk (
+    PIO_BUFFER Chunk,
+    UINTN ChunkOffset,
+    PIO_BUFFER Source,
+    UINTN SourceOffset,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies data into a shared memory chunk. Source pages that
+    are already the chunk's own pages, as is the case when the page cache
+    flushes an entry that borrows the chunk's page, are skipped.
+
+Arguments:
+
+    Chunk - Supplies a pointer to the chunk to copy into.
+
+    ChunkOffset - Supplies the byte offset into the chunk to copy to.
+
+    Source - Supplies a pointer to the source I/O buffer.
+
+    SourceOffset - Supplies the byte offset into the source to copy from.
+
+    Size - Supplies the number of bytes to copy.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN BytesThisRound;
+    PPAGE_CACHE_ENTRY Entry;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    KSTATUS Status;
+
+    PageSize = MmPageSize();
+    while (Size != 0) {
+        BytesThisRound = PageSize - REMAINDER(ChunkOffset, PageSize);
+        if (BytesThisRound > Size) {
+            BytesThisRound = Size;
+        }
+
+        Entry = NULL;
+        if ((BytesThisRound == PageSize) &&
+            (IS_ALIGNED(SourceOffset, PageSize) != FALSE)) {
+
+            Entry = MmGetIoBufferPageCacheEntry(Source, SourceOffset);
+        }
+
+        PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+        if (Entry != NULL) {
+            PhysicalAddress = IoGetPageCacheEntryPhysicalAddress(Entry);
+        }
+
+        if (PhysicalAddress != MmGetIoBufferPhysicalAddress(Chunk,
+                                                            ChunkOffset)) {
+
+            Status = MmCopyIoBuffer(Chunk,
+                                    ChunkOffset,
+                                    Source,
+                                    SourceOffset,
+                                    BytesThisRound);
+
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+        ChunkOffset += BytesThisRound;
+        SourceOffset += BytesThisRound;
+        Size -= BytesThisRound;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+PIO_BUFFER
+IopAllocateSharedMemoryChunk (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates and zeroes a chunk for a shared memory object's
+    in-memory store. A physically contiguous, chunk-aligned run is preferred,
+    but scattered pages are used if memory is too fragmented.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the chunk's I/O buffer on success, or NULL on failure.
+
+--*/
+
+{
+
+    PIO_BUFFER Chunk;
+    KSTATUS Status;
+
+    Chunk = MmAllocateNonPagedIoBuffer(0,
+                                       MAX_ULONGLONG,
+                                       SHARED_MEMORY_CHUNK_SIZE,
+                                       SHARED_MEMORY_CHUNK_SIZE,
+                                       IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS);
+
+    if (Chunk == NULL) {
+        Chunk = MmAllocateNonPagedIoBuffer(0,
+                                           MAX_ULONGLONG,
+                                           0,
+                                           SHARED_MEMORY_CHUNK_SIZE,
+                                           0);
+
+        if (Chunk == NULL) {
+            return NULL;
+        }
+    }
+
+    Status = MmZeroIoBuffer(Chunk, 0, SHARED_MEMORY_CHUNK_SIZE);
+    if (!KSUCCESS(Status)) {
+        MmFreeIoBuffer(Chunk);
+        return NULL;
+    }
+
+    return Chunk;
+}
+
+KSTATUS
+IopGrowSharedMemoryChunkArray (
+    PSHARED_MEMORY_OBJECT SharedMemoryObject,
+    ULONGLONG Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes sure the given shared memory object's chunk array has
+    a slot for every chunk needed to hold the given size. It never shrinks the
+    array. The chunk lock must be held.
+
+Arguments:
+
+    SharedMemoryObject - Supplies a pointer to the shared memory object.
+
+    Size - Supplies the size in bytes the chunk array must be able to cover.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    ULONGLONG ChunkCount;
+    PIO_BUFFER *NewChunks;
+
+    ChunkCount = Size >> SHARED_MEMORY_CHUNK_SHIFT;
+    if (REMAINDER(Size, SHARED_MEMORY_CHUNK_SIZE) != 0) {
+        ChunkCount += 1;
+    }
+
+    if (ChunkCount <= SharedMemoryObject->ChunkCount) {
+        return STATUS_SUCCESS;
+    }
+
+    if (ChunkCount > (MAX_UINTN / sizeof(PIO_BUFFER))) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    AllocationSize = (UINTN)ChunkCount * sizeof(PIO_BUFFER);
+    NewChunks = MmAllocateNonPagedPool(AllocationSize, IO_ALLOCATION_TAG);
+    if (NewChunks == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(NewChunks, AllocationSize);
+    if (SharedMemoryObject->Chunks != NULL) {
+        RtlCopyMemory(NewChunks,
+                      SharedMemoryObject->Chunks,
+                      SharedMemoryObject->ChunkCount * sizeof(PIO_BUFFER));
+
+        MmFreeNonPagedPool(SharedMemoryObject->Chunks);
+    }
+
+    SharedMemoryObject->Chunks = NewChunks;
+    SharedMemoryObject->ChunkCount = (UINTN)ChunkCount;
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopTrimSharedMemoryChunks (
+    PSHARED_MEMORY_OBJECT SharedMemoryObject,
+    ULONGLONG NewSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the chunks that lie entirely beyond the given size and
+    zeroes the tail of the chunk the size lands in, so that growing the object
+    again reads back zeros. The chunk lock must be held unless the object is
+    being destroyed.
+
+Arguments:
+
+    SharedMemoryObject - Supplies a pointer to the shared memory object.
+
+    NewSize - Supplies the new size of the object, in bytes.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_BUFFER Chunk;
+    UINTN ChunkIndex;
+    UINTN ChunkOffset;
+
+    ChunkIndex = (UINTN)(NewSize >> SHARED_MEMORY_CHUNK_SHIFT);
+    ChunkOffset = REMAINDER(NewSize, SHARED_MEMORY_CHUNK_SIZE);
+    if ((ChunkOffset != 0) && (ChunkIndex < SharedMemoryObject->ChunkCount)) {
+        Chunk = SharedMemoryObject->Chunks[ChunkIndex];
+        if (Chunk != NULL) {
+            MmZeroIoBuffer(Chunk,
+                           ChunkOffset,
+                           SHARED_MEMORY_CHUNK_SIZE - ChunkOffset);
+        }
+
+        ChunkIndex += 1;
+    }
+
+    while (ChunkIndex < SharedMemoryObject->ChunkCount) {
+        Chunk = SharedMemoryObject->Chunks[ChunkIndex];
+        if (Chunk != NULL) {
+            MmFreeIoBuffer(Chunk);
+            SharedMemoryObject->Chunks[ChunkIndex] = NULL;
+        }
+
+        ChunkIndex += 1;
+    }
+
+    return;
+}
@@ -50,7 +50,8 @@ Module Name:
            (SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL == \
             OPEN_FLAG_NO_CONTROLLING_TERMINAL) && \
            (SYS_OPEN_FLAG_NO_ACCESS_TIME == OPEN_FLAG_NO_ACCESS_TIME)  && \
-           (SYS_OPEN_FLAG_ASYNCHRONOUS == OPEN_FLAG_ASYNCHRONOUS))
+           (SYS_OPEN_FLAG_ASYNCHRONOUS == OPEN_FLAG_ASYNCHRONOUS) && \
+           (SYS_OPEN_FLAG_DIRECT == OPEN_FLAG_DIRECT))
 
 //
 // ---------------------------------------------------------------- Definitions
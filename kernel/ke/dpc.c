@@ -58,6 +58,11 @@ KepQueueDpc (
     PPROCESSOR_BLOCK Processor
     );
 
+VOID
+KepCollectPendingDpcs (
+    PPROCESSOR_BLOCK Processor
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -267,22 +272,26 @@ Return Value:
         }
 
         //
-        // Grab the DPC lock for the processor the DPC is on. If the DPC is
-        // still active for that same processor and is still on the queue, pull
-        // it off the queue. It may have been pulled off the processor's DPC
-        // list and be on a local list for execution. If that's the case, then
-        // it is too late to cancel the DPC.
+        // Grab the DPC lock for the processor the DPC is on and collect its
+        // pending stack onto the DPC list. If the DPC is still active for
+        // that same processor and is on the list, pull it off. It may have
+        // been pulled off the processor's DPC list and be on a local list for
+        // execution. If that's the case, then it is too late to cancel the
+        // DPC. If it's marked queued but isn't on the list yet, the queuing
+        // processor is just about to push it, so go around again.
         //
 
         ProcessorBlock = KeProcessorBlocks[Processor];
         Enabled = ArDisableInterrupts();
         KeAcquireSpinLock(&(ProcessorBlock->DpcLock));
+        KepCollectPendingDpcs(ProcessorBlock);
         if ((Dpc->UseCount != 0) &&
             (Dpc->Processor == Processor) &&
-            ((Dpc->Flags & DPC_FLAG_QUEUED_ON_PROCESSOR) != 0)) {
+            ((Dpc->Flags & DPC_FLAG_QUEUED_ON_PROCESSOR) != 0) &&
+            (Dpc->ListEntry.Next != NULL)) {
 
             LIST_REMOVE(&(Dpc->ListEntry));
-            Dpc->Flags &= ~DPC_FLAG_QUEUED_ON_PROCESSOR;
+            RtlAtomicAnd32(&(Dpc->Flags), ~DPC_FLAG_QUEUED_ON_PROCESSOR);
             Dpc->ListEntry.Next = NULL;
             Status = STATUS_SUCCESS;
         }
@@ -377,20 +386,24 @@ Return Value:
 {
 
     PLIST_ENTRY CurrentEntry;
+    ULONGLONG CurrentTime;
     PDPC Dpc;
     LIST_ENTRY LocalList;
     CYCLE_ACCOUNT PreviousPeriod;
     PPROCESSOR_BLOCK ProcessorBlock;
+    ULONGLONG QueueTicks;
 
     ASSERT(KeGetRunLevel() == RunLevelDispatch);
 
     ProcessorBlock = KeGetCurrentProcessorBlock();
 
     //
-    // Return immediately if the list is empty.
+    // Return immediately if nothing is pending.
     //
 
-    if (LIST_EMPTY(&(ProcessorBlock->DpcList)) != FALSE) {
+    if ((ProcessorBlock->PendingDpcs == NULL) &&
+        (LIST_EMPTY(&(ProcessorBlock->DpcList)) != FALSE)) {
+
         ArEnableInterrupts();
         return;
     }
@@ -399,24 +412,27 @@ Return Value:
     INITIALIZE_LIST_HEAD(&LocalList);
 
     //
-    // Acquire the lock long enough to move the list off of the processor block
-    // list and mark that each entry is no longer queued on said list.
+    // Acquire the lock long enough to collect the pending stack, move the list
+    // off of the processor block list, and mark that each entry is no longer
+    // queued on said list. The lock is only contended by cancellation.
     //
 
     KeAcquireSpinLock(&(ProcessorBlock->DpcLock));
+    KepCollectPendingDpcs(ProcessorBlock);
     if (LIST_EMPTY(&(ProcessorBlock->DpcList)) == FALSE) {
         MOVE_LIST(&(ProcessorBlock->DpcList), &LocalList);
         INITIALIZE_LIST_HEAD(&(ProcessorBlock->DpcList));
         CurrentEntry = LocalList.Next;
         while (CurrentEntry != &LocalList) {
             Dpc = LIST_VALUE(CurrentEntry, DPC, ListEntry);
-            Dpc->Flags &= ~DPC_FLAG_QUEUED_ON_PROCESSOR;
+            RtlAtomicAnd32(&(Dpc->Flags), ~DPC_FLAG_QUEUED_ON_PROCESSOR);
             CurrentEntry = CurrentEntry->Next;
         }
     }
 
     KeReleaseSpinLock(&(ProcessorBlock->DpcLock));
     ArEnableInterrupts();
+    CurrentTime = HlQueryTimeCounter();
 
     //
     // Set the clock to periodic mode before executing the DPCs. A DPC may
@@ -448,6 +464,19 @@ Return Value:
         LIST_REMOVE(CurrentEntry);
         Dpc->ListEntry.Next = NULL;
 
+        //
+        // Account for how long the DPC waited. The whole batch is measured
+        // against the same time. The time counter is consistent across
+        // processors, so DPCs queued from elsewhere are measured correctly.
+        //
+
+        QueueTicks = CurrentTime - Dpc->QueueTime;
+
+        ProcessorBlock->DpcQueueTicks += QueueTicks;
+        if (QueueTicks > ProcessorBlock->DpcMaxQueueTicks) {
+            ProcessorBlock->DpcMaxQueueTicks = QueueTicks;
+        }
+
         //
         // Call the DPC routine.
         //
@@ -511,6 +540,8 @@ Return Value:
 
     PPROCESSOR_BLOCK CurrentProcessor;
     BOOL Enabled;
+    PDPC Head;
+    ULONG OldFlags;
     RUNLEVEL OldRunLevel;
 
     Enabled = ArDisableInterrupts();
@@ -527,8 +558,6 @@ Return Value:
                       0);
     }
 
-    ASSERT((Dpc->Flags & DPC_FLAG_QUEUED_ON_PROCESSOR) == 0);
-
     if (Dpc->DpcRoutine == NULL) {
         KeCrashSystem(CRASH_DPC_FAILURE,
                       DpcCrashReasonNullRoutine,
@@ -563,10 +592,29 @@ Return Value:
     } else {
         RtlAtomicAdd32(&(Dpc->UseCount), 1);
         Dpc->Processor = Processor->ProcessorNumber;
-        KeAcquireSpinLock(&(Processor->DpcLock));
-        INSERT_BEFORE(&(Dpc->ListEntry), &(Processor->DpcList));
-        Dpc->Flags |= DPC_FLAG_QUEUED_ON_PROCESSOR;
-        KeReleaseSpinLock(&(Processor->DpcLock));
+        Dpc->QueueTime = HlQueryTimeCounter();
+        OldFlags = RtlAtomicOr32(&(Dpc->Flags), DPC_FLAG_QUEUED_ON_PROCESSOR);
+        if ((OldFlags & DPC_FLAG_QUEUED_ON_PROCESSOR) != 0) {
+            KeCrashSystem(CRASH_DPC_FAILURE,
+                          DpcCrashReasonDoubleQueueDpc,
+                          (UINTN)Dpc,
+                          1,
+                          0);
+        }
+
+        //
+        // Push the DPC onto the destination processor's pending stack without
+        // taking any lock.
+        //
+
+        do {
+            Head = Processor->PendingDpcs;
+            Dpc->NextPending = Head;
+
+        } while (RtlAtomicCompareExchange((PUINTN)&(Processor->PendingDpcs),
+                                          (UINTN)Dpc,
+                                          (UINTN)Head) != (UINTN)Head);
+
         Processor->PendingDispatchInterrupt = TRUE;
 
         //
@@ -599,3 +647,62 @@ Return Value:
     return;
 }
 
+VOID
+KepCollectPendingDpcs (
+    PPROCESSOR_BLOCK Processor
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes everything on the given processor's pending DPC stack
+    and appends it to the processor's DPC list in the order it was queued. The
+    caller must hold the processor's DPC lock with interrupts disabled.
+
+Arguments:
+
+    Processor - Supplies a pointer to the processor block.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PDPC Dpc;
+    PLIST_ENTRY InsertPoint;
+    PDPC Next;
+
+    if (Processor->PendingDpcs == NULL) {
+        return;
+    }
+
+    //
+    // Take the whole stack at once. Taking everything rather than popping one
+    // at a time means a DPC can never be pulled out from under a concurrent
+    // push, so there is no ABA problem.
+    //
+
+    Dpc = (PDPC)RtlAtomicExchange((PUINTN)&(Processor->PendingDpcs),
+                                  (UINTN)NULL);
+
+    //
+    // The stack is newest first. Insert each DPC in front of the one inserted
+    // before it so that the list ends up oldest first, after anything already
+    // on it.
+    //
+
+    InsertPoint = &(Processor->DpcList);
+    while (Dpc != NULL) {
+        Next = Dpc->NextPending;
+        Dpc->NextPending = NULL;
+        INSERT_BEFORE(&(Dpc->ListEntry), InsertPoint);
+        InsertPoint = &(Dpc->ListEntry);
+        Dpc = Next;
+    }
+
+    return;
+}
@@ -568,6 +568,14 @@ Return Value:
         Status = KepGetKernelCommandLine(Data, DataSize, Set);
         break;
 
+    case KeInformationSystemCallStatistics:
+        Status = KepGetSetSystemCallStatistics(Data, DataSize, Set);
+        break;
+
+    case KeInformationWorkQueueStatistics:
+        Status = KepGetWorkQueueStatistics(Data, DataSize, Set);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         *DataSize = 0;
@@ -823,8 +831,11 @@ Return Value:
 
 {
 
+    ULONGLONG CoalescedCount;
     PPROCESSOR_USAGE_INFORMATION Information;
+    ULONGLONG InterruptCount;
     UINTN ProcessorCount;
+    UINTN ProcessorIndex;
     KSTATUS Status;
 
     if (Set != FALSE) {
@@ -843,11 +854,28 @@ Return Value:
 
     Information = Data;
     Information->CycleCounterFrequency = HlQueryProcessorCounterFrequency();
+    ProcessorCount = KeGetActiveProcessorCount();
     if (Information->ProcessorNumber == (UINTN)-1) {
         KeGetTotalProcessorCycleAccounting(&(Information->Usage));
+        Information->ClockInterruptCount = 0;
+        Information->TimerInterruptCount = 0;
+        Information->CoalescedTimerCount = 0;
+        for (ProcessorIndex = 0;
+             ProcessorIndex < ProcessorCount;
+             ProcessorIndex += 1) {
+
+            Information->ClockInterruptCount +=
+                                     KeGetClockInterruptCount(ProcessorIndex);
+
+            KepGetTimerStatistics(KeProcessorBlocks[ProcessorIndex],
+                                  &InterruptCount,
+                                  &CoalescedCount);
+
+            Information->TimerInterruptCount += InterruptCount;
+            Information->CoalescedTimerCount += CoalescedCount;
+        }
 
     } else {
-        ProcessorCount = KeGetActiveProcessorCount();
         if (Information->ProcessorNumber > ProcessorCount) {
             Information->ProcessorNumber = ProcessorCount;
             return STATUS_OUT_OF_BOUNDS;
@@ -856,7 +884,16 @@ Return Value:
         Status = KeGetProcessorCycleAccounting(Information->ProcessorNumber,
                                                &(Information->Usage));
 
-        return Status;
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        Information->ClockInterruptCount =
+                       KeGetClockInterruptCount(Information->ProcessorNumber);
+
+        KepGetTimerStatistics(KeProcessorBlocks[Information->ProcessorNumber],
+                              &(Information->TimerInterruptCount),
+                              &(Information->CoalescedTimerCount));
     }
 
     return STATUS_SUCCESS;
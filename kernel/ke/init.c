@@ -142,6 +142,7 @@ Return Value:
         INITIALIZE_LIST_HEAD(&(ProcessorBlock->IpiListHead));
         INITIALIZE_LIST_HEAD(&(ProcessorBlock->DpcList));
         KeInitializeSpinLock(&(ProcessorBlock->DpcLock));
+        ProcessorBlock->PendingDpcs = NULL;
         ProcessorBlock->CyclePeriodAccount = CycleAccountKernel;
         KepInitializeScheduler(ProcessorBlock);
 
@@ -274,6 +275,16 @@ Return Value:
             goto InitializeEnd;
         }
 
+        //
+        // Create the system call counters for the processor.
+        //
+
+        ProcessorBlock->SystemCallStatistics = KepCreateSystemCallStatistics();
+        if (ProcessorBlock->SystemCallStatistics == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializeEnd;
+        }
+
         //
         // Perform architecture-specific setup for the user shared data page.
         //
@@ -183,6 +183,36 @@ Return Value:
 
 --*/
 
+KSTATUS
+KepGetWorkQueueStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets statistics about DPCs and the system work queue.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 KepInitializeTimeZoneSupport (
     PVOID TimeZoneData,
@@ -303,6 +333,36 @@ Return Value:
 
 --*/
 
+VOID
+KepGetTimerStatistics (
+    PPROCESSOR_BLOCK Processor,
+    PULONGLONG InterruptCount,
+    PULONGLONG CoalescedCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the timer expiration statistics for the given
+    processor.
+
+Arguments:
+
+    Processor - Supplies a pointer to the processor.
+
+    InterruptCount - Supplies a pointer where the number of times expired
+        timers were serviced on the processor will be returned.
+
+    CoalescedCount - Supplies a pointer where the number of timers expired
+        ahead of their deadline alongside another timer will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
 ULONGLONG
 KepGetNextTimerDeadline (
     PPROCESSOR_BLOCK Processor,
@@ -545,3 +605,60 @@ Return Value:
     Status code.
 
 --*/
+
+PSYSTEM_CALL_STATISTIC
+KepCreateSystemCallStatistics (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates the system call counters for a new processor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the zeroed array of system call counters on success.
+
+    NULL on allocation failure.
+
+--*/
+
+KSTATUS
+KepGetSetSystemCallStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets a snapshot of the system call statistics summed across
+    all processors, or resets them.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation. For a get
+        operation this is a SYSTEM_CALL_STATISTICS structure followed by room
+        for the array of per-call statistics. A set operation resets all
+        counters and ignores the data.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
@@ -44,12 +44,80 @@ Module Name:
 
 #define SHARED_EXCLUSIVE_LOCK_FREE 0
 #define SHARED_EXCLUSIVE_LOCK_EXCLUSIVE ((ULONG)-1)
+#define SHARED_EXCLUSIVE_LOCK_HANDOFF ((ULONG)-2)
 #define SHARED_EXCLUSIVE_LOCK_MAX_WAITERS ((ULONG)-2)
 
+//
+// Define the number of times a waiter polls a blocking lock whose owner is
+// running on another processor before giving up and going to sleep. This is
+// meant to cover locks held for a few hundred cycles, well under the cost of
+// a pair of context switches.
+//
+
+#define LOCK_MAX_SPIN_COUNT 1000
+
+//
+// Define the layout of the spin lock ticket word. The low half holds the
+// ticket being served and the high half holds the next ticket to hand out.
+//
+
+#define SPIN_LOCK_TICKET_SHIFT 16
+#define SPIN_LOCK_TICKET_MASK 0x0000FFFF
+#define SPIN_LOCK_TICKET_INCREMENT (1 << SPIN_LOCK_TICKET_SHIFT)
+
+#define SPIN_LOCK_OWNER_TICKET(_Tickets) ((_Tickets) & SPIN_LOCK_TICKET_MASK)
+#define SPIN_LOCK_NEXT_TICKET(_Tickets) \
+    (((_Tickets) >> SPIN_LOCK_TICKET_SHIFT) & SPIN_LOCK_TICKET_MASK)
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+BOOL
+KepSpinOnQueuedLock (
+    PQUEUED_LOCK Lock
+    );
+
+BOOL
+KepSpinOnSharedExclusiveLock (
+    PSHARED_EXCLUSIVE_LOCK SharedExclusiveLock,
+    BOOL Exclusive
+    );
+
+BOOL
+KepCanSpinOnLock (
+    VOID
+    );
+
+BOOL
+KepIsLockOwnerRunning (
+    PKTHREAD Owner,
+    ULONG Processor
+    );
+
+ULONGLONG
+KepQuerySpinLockCounter (
+    VOID
+    );
+
+VOID
+KepRecordSpinLockAcquire (
+    PKSPIN_LOCK Lock,
+    PVOID Site,
+    BOOL Contended,
+    ULONGLONG SpinStart
+    );
+
+VOID
+KepRecordSpinLockRelease (
+    PKSPIN_LOCK Lock
+    );
+
+PSPIN_LOCK_STATISTICS
+KepGetSpinLockStatistics (
+    PVOID Site
+    );
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -65,6 +133,16 @@ Module Name:
 
 POBJECT_HEADER KeQueuedLockDirectory = NULL;
 
+//
+// Set this boolean to collect per call site spin lock statistics. This is off
+// by default since it adds a counter read to every acquire and release. It
+// can be flipped from the kernel debugger, and the results viewed there with
+// the !spinlocks extension.
+//
+
+BOOL KeSpinLockStatisticsEnabled = FALSE;
+SPIN_LOCK_STATISTICS KeSpinLockStatistics[SPIN_LOCK_STATISTICS_SITE_COUNT];
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -225,8 +303,20 @@ Return Value:
     ASSERT(KeGetRunLevel() <= RunLevelDispatch);
     ASSERT((Lock->OwningThread != Thread) || (Thread == NULL));
 
-    Status = ObWaitOnObject(&(Lock->Header), 0, TimeoutInMilliseconds);
+    //
+    // If the owner is running on another processor it is likely to release
+    // the lock soon, so spin for a bit before paying for a context switch.
+    //
+
+    if ((TimeoutInMilliseconds != 0) && (KepSpinOnQueuedLock(Lock) != FALSE)) {
+        Status = STATUS_SUCCESS;
+
+    } else {
+        Status = ObWaitOnObject(&(Lock->Header), 0, TimeoutInMilliseconds);
+    }
+
     if (KSUCCESS(Status)) {
+        Lock->OwnerProcessor = KeGetCurrentProcessorNumber();
         Lock->OwningThread = Thread;
     }
 
@@ -298,6 +388,7 @@ Return Value:
         return FALSE;
     }
 
+    Lock->OwnerProcessor = KeGetCurrentProcessorNumber();
     Lock->OwningThread = KeGetCurrentThread();
     return TRUE;
 }
@@ -359,15 +450,17 @@ Return Value:
 
 {
 
-    Lock->LockHeld = 0;
+    Lock->Tickets = 0;
     Lock->OwningThread = NULL;
+    Lock->AcquireTime = 0;
+    Lock->Statistics = NULL;
 
     //
     // This atomic exchange serves as a memory barrier and serializing
     // instruction.
     //
 
-    RtlAtomicExchange32(&(Lock->LockHeld), 0);
+    RtlAtomicExchange32(&(Lock->Tickets), 0);
     return;
 }
 
@@ -396,18 +489,42 @@ Return Value:
 
 {
 
-    ULONG LockValue;
+    BOOL Contended;
+    ULONGLONG SpinStart;
+    ULONG Ticket;
+    ULONG Tickets;
 
-    while (TRUE) {
-        LockValue = RtlAtomicCompareExchange32(&(Lock->LockHeld), 1, 0);
-        if (LockValue == 0) {
-            break;
+    //
+    // Take a ticket, and then wait for that ticket to be served. Waiters only
+    // read the lock while spinning, and are granted the lock in the order
+    // they arrived.
+    //
+
+    Tickets = RtlAtomicAdd32(&(Lock->Tickets), SPIN_LOCK_TICKET_INCREMENT);
+    Ticket = SPIN_LOCK_NEXT_TICKET(Tickets);
+    Contended = FALSE;
+    SpinStart = 0;
+    if (SPIN_LOCK_OWNER_TICKET(Tickets) != Ticket) {
+        Contended = TRUE;
+        if (KeSpinLockStatisticsEnabled != FALSE) {
+            SpinStart = KepQuerySpinLockCounter();
         }
 
-        ArProcessorYield();
+        while (SPIN_LOCK_OWNER_TICKET(Lock->Tickets) != Ticket) {
+            ArProcessorYield();
+        }
+
+        RtlMemoryBarrier();
     }
 
     Lock->OwningThread = KeGetCurrentThread();
+    if (KeSpinLockStatisticsEnabled != FALSE) {
+        KepRecordSpinLockAcquire(Lock,
+                                 __builtin_return_address(0),
+                                 Contended,
+                                 SpinStart);
+    }
+
     return;
 }
 
@@ -435,21 +552,43 @@ Return Value:
 
 {
 
-    ULONG LockValue;
+    ULONG NewTickets;
+    ULONG OldTickets;
+    ULONG Tickets;
+
+    if (Lock->Statistics != NULL) {
+        KepRecordSpinLockRelease(Lock);
+    }
 
     //
-    // The interlocked version is a serializing instruction, so this avoids
-    // unsafe processor and compiler reordering. Simply setting the lock to
-    // FALSE is not safe.
+    // Assert if the lock was not held.
     //
 
-    LockValue = RtlAtomicExchange32(&(Lock->LockHeld), 0);
+    ASSERT(SPIN_LOCK_OWNER_TICKET(Lock->Tickets) !=
+           SPIN_LOCK_NEXT_TICKET(Lock->Tickets));
 
     //
-    // Assert if the lock was not held.
+    // Serve the next ticket. Only the owner changes the low half, but new
+    // waiters may be bumping the high half concurrently, so the increment
+    // must not carry into it. The interlocked operation is a serializing
+    // instruction, so this avoids unsafe processor and compiler reordering.
     //
 
-    ASSERT(LockValue != 0);
+    Tickets = Lock->Tickets;
+    while (TRUE) {
+        NewTickets = (Tickets & ~SPIN_LOCK_TICKET_MASK) |
+                     ((Tickets + 1) & SPIN_LOCK_TICKET_MASK);
+
+        OldTickets = RtlAtomicCompareExchange32(&(Lock->Tickets),
+                                                NewTickets,
+                                                Tickets);
+
+        if (OldTickets == Tickets) {
+            break;
+        }
+
+        Tickets = OldTickets;
+    }
 
     return;
 }
@@ -480,10 +619,24 @@ Return Value:
 
 {
 
-    ULONG LockValue;
+    ULONG OldTickets;
+    ULONG Tickets;
+
+    //
+    // The lock can only be taken without waiting if nobody holds a ticket.
+    //
 
-    LockValue = RtlAtomicCompareExchange32(&(Lock->LockHeld), 1, 0);
-    if (LockValue == 0) {
+    Tickets = Lock->Tickets;
+    if (SPIN_LOCK_OWNER_TICKET(Tickets) != SPIN_LOCK_NEXT_TICKET(Tickets)) {
+        return FALSE;
+    }
+
+    OldTickets = RtlAtomicCompareExchange32(
+                                       &(Lock->Tickets),
+                                       Tickets + SPIN_LOCK_TICKET_INCREMENT,
+                                       Tickets);
+
+    if (OldTickets == Tickets) {
         Lock->OwningThread = KeGetCurrentThread();
         return TRUE;
     }
@@ -517,10 +670,10 @@ Return Value:
 
 {
 
-    ULONG Held;
+    ULONG Tickets;
 
-    Held = RtlAtomicOr32(&(Lock->LockHeld), 0);
-    if (Held != 0) {
+    Tickets = RtlAtomicOr32(&(Lock->Tickets), 0);
+    if (SPIN_LOCK_OWNER_TICKET(Tickets) != SPIN_LOCK_NEXT_TICKET(Tickets)) {
         return TRUE;
     }
 
@@ -570,6 +723,12 @@ Return Value:
     }
 
     KeSignalEvent(SharedExclusiveLock->Event, SignalOptionSignalOne);
+    SharedExclusiveLock->ExclusiveEvent = KeCreateEvent(NULL);
+    if (SharedExclusiveLock->ExclusiveEvent == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateSharedExclusiveLockEnd;
+    }
+
     Status = STATUS_SUCCESS;
 
 CreateSharedExclusiveLockEnd:
@@ -611,6 +770,10 @@ Return Value:
         KeDestroyEvent(SharedExclusiveLock->Event);
     }
 
+    if (SharedExclusiveLock->ExclusiveEvent != NULL) {
+        KeDestroyEvent(SharedExclusiveLock->ExclusiveEvent);
+    }
+
     MmFreeNonPagedPool(SharedExclusiveLock);
     return;
 }
@@ -661,7 +824,7 @@ Return Value:
         //
 
         if (((ExclusiveWaiters == 0) || (IsWaiter != FALSE)) &&
-            (State < SHARED_EXCLUSIVE_LOCK_EXCLUSIVE - 1)) {
+            (State < SHARED_EXCLUSIVE_LOCK_HANDOFF - 1)) {
 
             PreviousState = State;
             State = RtlAtomicCompareExchange32(&(SharedExclusiveLock->State),
@@ -723,8 +886,12 @@ Return Value:
         //
 
         if ((SharedExclusiveLock->ExclusiveWaiters == 0) &&
-            (SharedExclusiveLock->State != SHARED_EXCLUSIVE_LOCK_EXCLUSIVE)) {
+            (SharedExclusiveLock->State < SHARED_EXCLUSIVE_LOCK_HANDOFF)) {
+
+            continue;
+        }
 
+        if (KepSpinOnSharedExclusiveLock(SharedExclusiveLock, FALSE) != FALSE) {
             continue;
         }
 
@@ -779,7 +946,7 @@ Return Value:
     State = SharedExclusiveLock->State;
     ExclusiveWaiters = SharedExclusiveLock->ExclusiveWaiters;
     if ((ExclusiveWaiters == 0) &&
-        (State < SHARED_EXCLUSIVE_LOCK_EXCLUSIVE - 1)) {
+        (State < SHARED_EXCLUSIVE_LOCK_HANDOFF - 1)) {
 
         PreviousState = State;
         State = RtlAtomicCompareExchange32(&(SharedExclusiveLock->State),
@@ -830,23 +997,60 @@ Return Value:
 {
 
     ULONG PreviousState;
+    ULONG State;
 
     PreviousState = RtlAtomicAdd32(&(SharedExclusiveLock->State), -1);
 
-    ASSERT((PreviousState < SHARED_EXCLUSIVE_LOCK_EXCLUSIVE) &&
+    ASSERT((PreviousState < SHARED_EXCLUSIVE_LOCK_HANDOFF) &&
            (PreviousState != SHARED_EXCLUSIVE_LOCK_FREE));
 
     //
-    // If this was the last reader and there are writers waiting, signal the
-    // event.
+    // If this was the last reader and there are writers waiting, hand the
+    // lock to one of them so that a newly arriving writer cannot barge in
+    // ahead of it. If someone else already grabbed the free lock, their
+    // release will do the handoff instead.
     //
 
-    if ((PreviousState - 1 == SHARED_EXCLUSIVE_LOCK_FREE) &&
-        (SharedExclusiveLock->ExclusiveWaiters != 0)) {
+    if ((PreviousState - 1 != SHARED_EXCLUSIVE_LOCK_FREE) ||
+        (SharedExclusiveLock->ExclusiveWaiters == 0)) {
 
-        KeSignalEvent(SharedExclusiveLock->Event, SignalOptionSignalOne);
+        return;
+    }
+
+    State = RtlAtomicCompareExchange32(&(SharedExclusiveLock->State),
+                                       SHARED_EXCLUSIVE_LOCK_HANDOFF,
+                                       SHARED_EXCLUSIVE_LOCK_FREE);
+
+    if (State != SHARED_EXCLUSIVE_LOCK_FREE) {
+        return;
     }
 
+    //
+    // The waiting writers seen above may have come and gone between the
+    // release and the handoff, as the lock was free in between. Waiters only
+    // leave after acquiring the lock, so if none are counted now, nobody is
+    // left to claim the handoff. Put the lock back to free in that case, or
+    // new readers would defer to a handoff that never gets picked up, and
+    // let any readers that blocked on it go. If a writer got in line and
+    // claimed the handoff in the meantime, it is already running and needs
+    // no signal.
+    //
+
+    if (SharedExclusiveLock->ExclusiveWaiters == 0) {
+        State = RtlAtomicCompareExchange32(&(SharedExclusiveLock->State),
+                                           SHARED_EXCLUSIVE_LOCK_FREE,
+                                           SHARED_EXCLUSIVE_LOCK_HANDOFF);
+
+        if ((State == SHARED_EXCLUSIVE_LOCK_HANDOFF) &&
+            (SharedExclusiveLock->SharedWaiters != 0)) {
+
+            KeSignalEvent(SharedExclusiveLock->Event, SignalOptionSignalOne);
+        }
+
+        return;
+    }
+
+    KeSignalEvent(SharedExclusiveLock->ExclusiveEvent, SignalOptionSignalOne);
     return;
 }
 
@@ -890,6 +1094,24 @@ Return Value:
             break;
         }
 
+        //
+        // A releasing thread may have handed the lock directly to the
+        // exclusive waiters. Only threads already waiting can take it, which
+        // keeps new arrivals from starving them.
+        //
+
+        if ((State == SHARED_EXCLUSIVE_LOCK_HANDOFF) && (IsWaiting != FALSE)) {
+            State = RtlAtomicCompareExchange32(&(SharedExclusiveLock->State),
+                                               SHARED_EXCLUSIVE_LOCK_EXCLUSIVE,
+                                               SHARED_EXCLUSIVE_LOCK_HANDOFF);
+
+            if (State == SHARED_EXCLUSIVE_LOCK_HANDOFF) {
+                break;
+            }
+
+            continue;
+        }
+
         //
         // Increment the exclusive waiters count to indicate to readers that
         // the event needs to be signaled. Use compare-exchange to avoid
@@ -921,11 +1143,19 @@ Return Value:
         //
 
         CurrentState = SharedExclusiveLock->State;
-        if (CurrentState == SHARED_EXCLUSIVE_LOCK_FREE) {
+        if ((CurrentState == SHARED_EXCLUSIVE_LOCK_FREE) ||
+            (CurrentState == SHARED_EXCLUSIVE_LOCK_HANDOFF)) {
+
             continue;
         }
 
-        KeWaitForEvent(SharedExclusiveLock->Event, FALSE, WAIT_TIME_INDEFINITE);
+        if (KepSpinOnSharedExclusiveLock(SharedExclusiveLock, TRUE) != FALSE) {
+            continue;
+        }
+
+        KeWaitForEvent(SharedExclusiveLock->ExclusiveEvent,
+                       FALSE,
+                       WAIT_TIME_INDEFINITE);
     }
 
     //
@@ -939,6 +1169,8 @@ Return Value:
         ASSERT(PreviousWaiters != 0);
     }
 
+    SharedExclusiveLock->OwnerProcessor = KeGetCurrentProcessorNumber();
+    SharedExclusiveLock->ExclusiveOwner = KeGetCurrentThread();
     return;
 }
 
@@ -976,6 +1208,8 @@ Return Value:
                                        SHARED_EXCLUSIVE_LOCK_FREE);
 
     if (State == SHARED_EXCLUSIVE_LOCK_FREE) {
+        SharedExclusiveLock->OwnerProcessor = KeGetCurrentProcessorNumber();
+        SharedExclusiveLock->ExclusiveOwner = KeGetCurrentThread();
         return TRUE;
     }
 
@@ -1008,13 +1242,37 @@ Return Value:
 
     ASSERT(SharedExclusiveLock->State == SHARED_EXCLUSIVE_LOCK_EXCLUSIVE);
 
-    RtlAtomicExchange32(&(SharedExclusiveLock->State),
-                        SHARED_EXCLUSIVE_LOCK_FREE);
+    SharedExclusiveLock->ExclusiveOwner = NULL;
 
-    if ((SharedExclusiveLock->SharedWaiters != 0) ||
+    //
+    // Readers that are already waiting go next, so that a steady stream of
+    // writers cannot starve them. New readers defer to waiting writers, so
+    // the two alternate under contention. If only writers are waiting, hand
+    // the lock straight to one of them. Since waiters never leave without
+    // acquiring the lock, the handoff is guaranteed to be picked up.
+    //
+
+    if ((SharedExclusiveLock->SharedWaiters == 0) &&
         (SharedExclusiveLock->ExclusiveWaiters != 0)) {
 
+        RtlAtomicExchange32(&(SharedExclusiveLock->State),
+                            SHARED_EXCLUSIVE_LOCK_HANDOFF);
+
+        KeSignalEvent(SharedExclusiveLock->ExclusiveEvent,
+                      SignalOptionSignalOne);
+
+        return;
+    }
+
+    RtlAtomicExchange32(&(SharedExclusiveLock->State),
+                        SHARED_EXCLUSIVE_LOCK_FREE);
+
+    if (SharedExclusiveLock->SharedWaiters != 0) {
         KeSignalEvent(SharedExclusiveLock->Event, SignalOptionSignalOne);
+
+    } else if (SharedExclusiveLock->ExclusiveWaiters != 0) {
+        KeSignalEvent(SharedExclusiveLock->ExclusiveEvent,
+                      SignalOptionSignalOne);
     }
 
     return;
@@ -1057,7 +1315,7 @@ Return Value:
                                        SHARED_EXCLUSIVE_LOCK_EXCLUSIVE,
                                        1);
 
-    ASSERT((State >= 1) && (State < SHARED_EXCLUSIVE_LOCK_EXCLUSIVE));
+    ASSERT((State >= 1) && (State < SHARED_EXCLUSIVE_LOCK_HANDOFF));
 
     //
     // If the fast conversion failed, get in line like everybody else.
@@ -1066,6 +1324,10 @@ Return Value:
     if (State != 1) {
         KeReleaseSharedExclusiveLockShared(SharedExclusiveLock);
         KeAcquireSharedExclusiveLockExclusive(SharedExclusiveLock);
+
+    } else {
+        SharedExclusiveLock->OwnerProcessor = KeGetCurrentProcessorNumber();
+        SharedExclusiveLock->ExclusiveOwner = KeGetCurrentThread();
     }
 
     return;
@@ -1162,7 +1424,7 @@ Return Value:
 {
 
     if ((SharedExclusiveLock->State != SHARED_EXCLUSIVE_LOCK_FREE) &&
-        (SharedExclusiveLock->State < SHARED_EXCLUSIVE_LOCK_EXCLUSIVE)) {
+        (SharedExclusiveLock->State < SHARED_EXCLUSIVE_LOCK_HANDOFF)) {
 
         return TRUE;
     }
@@ -1209,3 +1471,445 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+BOOL
+KepSpinOnQueuedLock (
+    PQUEUED_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine spins briefly trying to acquire a queued lock whose owner is
+    running on another processor.
+
+Arguments:
+
+    Lock - Supplies a pointer to the queued lock to acquire.
+
+Return Value:
+
+    TRUE if the lock was acquired.
+
+    FALSE if the caller should block on the lock instead.
+
+--*/
+
+{
+
+    PKTHREAD Owner;
+    ULONG SpinCount;
+    SIGNAL_STATE State;
+    KSTATUS Status;
+
+    if (KepCanSpinOnLock() == FALSE) {
+        return FALSE;
+    }
+
+    for (SpinCount = 0; SpinCount < LOCK_MAX_SPIN_COUNT; SpinCount += 1) {
+        State = Lock->Header.WaitQueue.State;
+        if (State == SignaledForOne) {
+            Status = ObWaitOnObject(&(Lock->Header), 0, 0);
+            if (KSUCCESS(Status)) {
+                return TRUE;
+            }
+
+        //
+        // If other threads are already blocked on the lock, get in line
+        // behind them rather than stealing the lock out from under them.
+        //
+
+        } else if (State == NotSignaledWithWaiters) {
+            break;
+
+        //
+        // Stop spinning if the owner got switched out, as it may be a long
+        // while before it gets around to releasing the lock. The owner may
+        // momentarily be NULL while the lock is changing hands.
+        //
+
+        } else {
+            Owner = Lock->OwningThread;
+            if ((Owner != NULL) &&
+                (KepIsLockOwnerRunning(Owner, Lock->OwnerProcessor) == FALSE)) {
+
+                break;
+            }
+        }
+
+        ArProcessorYield();
+    }
+
+    return FALSE;
+}
+
+BOOL
+KepSpinOnSharedExclusiveLock (
+    PSHARED_EXCLUSIVE_LOCK SharedExclusiveLock,
+    BOOL Exclusive
+    )
+
+/*++
+
+Routine Description:
+
+    This routine spins briefly waiting for a shared-exclusive lock held
+    exclusively by a thread running on another processor to be released.
+
+Arguments:
+
+    SharedExclusiveLock - Supplies a pointer to the shared-exclusive lock.
+
+    Exclusive - Supplies a boolean indicating whether the caller is trying to
+        acquire the lock exclusively (TRUE) or shared (FALSE).
+
+Return Value:
+
+    TRUE if the exclusive owner released the lock and the caller should try
+    again to acquire it.
+
+    FALSE if the caller should block on the lock instead.
+
+--*/
+
+{
+
+    PKTHREAD Owner;
+    ULONG SpinCount;
+
+    if (KepCanSpinOnLock() == FALSE) {
+        return FALSE;
+    }
+
+    //
+    // Readers holding the lock cannot be tracked, so only spin on an
+    // exclusive owner.
+    //
+
+    for (SpinCount = 0; SpinCount < LOCK_MAX_SPIN_COUNT; SpinCount += 1) {
+        if (SharedExclusiveLock->State != SHARED_EXCLUSIVE_LOCK_EXCLUSIVE) {
+            if (SpinCount == 0) {
+                return FALSE;
+            }
+
+            return TRUE;
+        }
+
+        //
+        // Readers defer to waiting writers, so a reader should not spin once
+        // a writer is in line. It would just end up waiting anyway.
+        //
+
+        if ((Exclusive == FALSE) &&
+            (SharedExclusiveLock->ExclusiveWaiters != 0)) {
+
+            break;
+        }
+
+        Owner = SharedExclusiveLock->ExclusiveOwner;
+        if ((Owner != NULL) &&
+            (KepIsLockOwnerRunning(Owner,
+                                   SharedExclusiveLock->OwnerProcessor) ==
+             FALSE)) {
+
+            break;
+        }
+
+        ArProcessorYield();
+    }
+
+    return FALSE;
+}
+
+BOOL
+KepCanSpinOnLock (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the current thread may spin on a blocking
+    lock before waiting on it.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE if spinning is allowed.
+
+    FALSE if the thread should go straight to blocking.
+
+--*/
+
+{
+
+    //
+    // Spinning is pointless on a uniprocessor system, as the owner cannot
+    // make progress while this thread spins. Above low level the caller
+    // might be holding up the owner, so don't spin there either.
+    //
+
+    if ((KeGetActiveProcessorCount() <= 1) ||
+        (KeGetRunLevel() != RunLevelLow) ||
+        (KeGetCurrentThread() == NULL)) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL
+KepIsLockOwnerRunning (
+    PKTHREAD Owner,
+    ULONG Processor
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given lock owner is currently running
+    on the processor it acquired the lock on. The owner is only compared
+    against, never dereferenced, since it may exit at any time.
+
+Arguments:
+
+    Owner - Supplies a pointer to the thread that owns the lock.
+
+    Processor - Supplies the processor number the owner acquired the lock on.
+
+Return Value:
+
+    TRUE if the owner is still running on that processor.
+
+    FALSE if the owner has been switched out or has migrated.
+
+--*/
+
+{
+
+    PPROCESSOR_BLOCK ProcessorBlock;
+
+    ProcessorBlock = KeGetProcessorBlock(Processor);
+    if ((ProcessorBlock == NULL) || (ProcessorBlock->RunningThread != Owner)) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+ULONGLONG
+KepQuerySpinLockCounter (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the processor counter for spin lock statistics, if it
+    can safely be read at the current run level.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the current processor counter value, or 0 if it cannot be read.
+
+--*/
+
+{
+
+    if (KeGetRunLevel() < RunLevelDispatch) {
+        return 0;
+    }
+
+    return HlQueryProcessorCounter();
+}
+
+VOID
+KepRecordSpinLockAcquire (
+    PKSPIN_LOCK Lock,
+    PVOID Site,
+    BOOL Contended,
+    ULONGLONG SpinStart
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records statistics for a spin lock acquisition. The lock
+    must be held.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock that was just acquired.
+
+    Site - Supplies the return address of the acquire call.
+
+    Contended - Supplies a boolean indicating whether or not the acquire had
+        to wait.
+
+    SpinStart - Supplies the processor counter value when waiting began, or 0
+        if it was not read.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Now;
+    PSPIN_LOCK_STATISTICS Statistics;
+
+    //
+    // The processor counter can only be read at dispatch or above, where the
+    // thread cannot migrate.
+    //
+
+    Now = KepQuerySpinLockCounter();
+    if (Now == 0) {
+        return;
+    }
+
+    Statistics = KepGetSpinLockStatistics(Site);
+    if (Statistics == NULL) {
+        return;
+    }
+
+    RtlAtomicAdd64(&(Statistics->AcquireCount), 1);
+    if (Contended != FALSE) {
+        RtlAtomicAdd64(&(Statistics->ContendedCount), 1);
+        if ((SpinStart != 0) && (Now > SpinStart)) {
+            RtlAtomicAdd64(&(Statistics->SpinCycles), Now - SpinStart);
+        }
+    }
+
+    Lock->AcquireTime = (ULONG)Now;
+    Lock->Statistics = Statistics;
+    return;
+}
+
+VOID
+KepRecordSpinLockRelease (
+    PKSPIN_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records the hold time for a spin lock that is about to be
+    released. The lock must still be held.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock being released.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG HoldCycles;
+    ULONGLONG Maximum;
+    ULONGLONG Now;
+    ULONGLONG OldMaximum;
+    PSPIN_LOCK_STATISTICS Statistics;
+
+    Statistics = Lock->Statistics;
+    Lock->Statistics = NULL;
+    Now = KepQuerySpinLockCounter();
+    if (Now == 0) {
+        return;
+    }
+
+    //
+    // Only the low 32 bits of the acquire time are kept, which is plenty for
+    // the length of time a spin lock should be held.
+    //
+
+    HoldCycles = (ULONG)Now - Lock->AcquireTime;
+    Maximum = Statistics->MaxHoldCycles;
+    while (HoldCycles > Maximum) {
+        OldMaximum = RtlAtomicCompareExchange64(&(Statistics->MaxHoldCycles),
+                                                HoldCycles,
+                                                Maximum);
+
+        if (OldMaximum == Maximum) {
+            break;
+        }
+
+        Maximum = OldMaximum;
+    }
+
+    return;
+}
+
+PSPIN_LOCK_STATISTICS
+KepGetSpinLockStatistics (
+    PVOID Site
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds or creates the statistics entry for the given call
+    site.
+
+Arguments:
+
+    Site - Supplies the return address of the acquire call.
+
+Return Value:
+
+    Returns a pointer to the statistics entry for the site.
+
+    NULL if the table is full.
+
+--*/
+
+{
+
+    PSPIN_LOCK_STATISTICS Entry;
+    ULONG Index;
+    ULONG Probe;
+    PVOID Previous;
+
+    Index = (ULONG)((UINTN)Site * 0x9E3779B1);
+    for (Probe = 0; Probe < SPIN_LOCK_STATISTICS_SITE_COUNT; Probe += 1) {
+        Index &= SPIN_LOCK_STATISTICS_SITE_COUNT - 1;
+        Entry = &(KeSpinLockStatistics[Index]);
+        if (Entry->Site == Site) {
+            return Entry;
+        }
+
+        if (Entry->Site == NULL) {
+            Previous = (PVOID)RtlAtomicCompareExchange((PUINTN)&(Entry->Site),
+                                                       (UINTN)Site,
+                                                       (UINTN)NULL);
+
+            if ((Previous == NULL) || (Previous == Site)) {
+                return Entry;
+            }
+        }
+
+        Index += 1;
+    }
+
+    return NULL;
+}
@@ -43,6 +43,14 @@ Module Name:
 
 #define SCHEDULER_REBALANCE_MINIMUM_THREADS 2
 
+//
+// Define the default real-time throttling period and the portion of each
+// period real-time threads may use, in microseconds.
+//
+
+#define SCHEDULER_REAL_TIME_PERIOD 1000000
+#define SCHEDULER_REAL_TIME_RUNTIME 950000
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -97,6 +105,24 @@ KepInitializeSchedulerGroupEntry (
     PSCHEDULER_GROUP_ENTRY ParentEntry
     );
 
+ULONGLONG
+KepChargeRealTime (
+    PSCHEDULER_DATA Scheduler,
+    PKTHREAD Thread
+    );
+
+BOOL
+KepCanPreemptThread (
+    PKTHREAD RunningThread,
+    PKTHREAD Thread
+    );
+
+VOID
+KepPreemptForRealTimeThread (
+    PPROCESSOR_BLOCK Processor,
+    PKTHREAD Thread
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -111,6 +137,25 @@ KSPIN_LOCK KeSchedulerGroupLock;
 
 BOOL KeSchedulerStealReadyThreads = FALSE;
 
+//
+// Store the real-time throttling period and the amount of each period that
+// real-time threads may run before normal threads get a turn, in
+// microseconds. Set the runtime equal to the period to disable throttling.
+//
+
+ULONG KeRealTimePeriod = SCHEDULER_REAL_TIME_PERIOD;
+ULONG KeRealTimeRuntime = SCHEDULER_REAL_TIME_RUNTIME;
+
+//
+// Store the throttling period, runtime, and round-robin time slice in
+// processor counter ticks. These are computed the first time a real-time
+// thread is scheduled.
+//
+
+ULONGLONG KeRealTimePeriodCycles;
+ULONGLONG KeRealTimeRuntimeCycles;
+ULONGLONG KeRoundRobinCycles;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -176,15 +221,19 @@ Return Value:
 
     BOOL Enabled;
     BOOL FirstTime;
+    BOOL KeepPosition;
     PKTHREAD NextThread;
     PVOID NextThreadStack;
     THREAD_STATE NextThreadState;
+    ULONGLONG Now;
     PKTHREAD OldThread;
     PPROCESSOR_BLOCK Processor;
+    BOOL RealTime;
     PVOID *SaveLocation;
 
     Enabled = FALSE;
     FirstTime = FALSE;
+    Now = 0;
     Processor = KeGetCurrentProcessorBlock();
 
     //
@@ -209,18 +258,52 @@ Return Value:
     OldThread = Processor->RunningThread;
     KeAcquireSpinLock(&(Processor->Scheduler.Lock));
 
+    //
+    // Charge real-time threads for the time they have run, which may throttle
+    // them. Skip this entirely when no real-time threads are involved.
+    //
+
+    RealTime = FALSE;
+    if ((OldThread->SchedulingPolicy != SchedulerPolicyNormal) ||
+        (Processor->Scheduler.RealTimeReadyCount != 0)) {
+
+        RealTime = TRUE;
+        Now = KepChargeRealTime(&(Processor->Scheduler), OldThread);
+    }
+
     //
     // Remove the old thread from the scheduler. Immediately put it back if
-    // it's not blocking.
+    // it's not blocking. A preempted FIFO thread, or a round-robin thread
+    // with time left in its slice, keeps its place at the head of its
+    // priority.
     //
 
     if (OldThread != Processor->IdleThread) {
-        KepDequeueSchedulerEntry(&(OldThread->SchedulerEntry), TRUE);
-        if ((Reason != SchedulerReasonThreadBlocking) &&
-            (Reason != SchedulerReasonThreadSuspending) &&
-            (Reason != SchedulerReasonThreadExiting)) {
+        KeepPosition = FALSE;
+        if (Reason == SchedulerReasonDispatchInterrupt) {
+            if (OldThread->SchedulingPolicy == SchedulerPolicyFifo) {
+                KeepPosition = TRUE;
+
+            } else if (OldThread->SchedulingPolicy ==
+                       SchedulerPolicyRoundRobin) {
+
+                if (Now < OldThread->TimeSliceEnd) {
+                    KeepPosition = TRUE;
+
+                } else {
+                    OldThread->TimeSliceEnd = 0;
+                }
+            }
+        }
 
-            KepEnqueueSchedulerEntry(&(OldThread->SchedulerEntry), TRUE);
+        if (KeepPosition == FALSE) {
+            KepDequeueSchedulerEntry(&(OldThread->SchedulerEntry), TRUE);
+            if ((Reason != SchedulerReasonThreadBlocking) &&
+                (Reason != SchedulerReasonThreadSuspending) &&
+                (Reason != SchedulerReasonThreadExiting)) {
+
+                KepEnqueueSchedulerEntry(&(OldThread->SchedulerEntry), TRUE);
+            }
         }
     }
 
@@ -248,6 +331,23 @@ Return Value:
                 (Reason != SchedulerReasonThreadExiting)));
     }
 
+    //
+    // Start the clock on a real-time thread's runtime, and give round-robin
+    // threads a fresh slice if they need one.
+    //
+
+    if (RealTime != FALSE) {
+        Processor->Scheduler.RealTimeRunStart = 0;
+        if (NextThread->SchedulingPolicy != SchedulerPolicyNormal) {
+            Processor->Scheduler.RealTimeRunStart = Now;
+            if ((NextThread->SchedulingPolicy == SchedulerPolicyRoundRobin) &&
+                (NextThread->TimeSliceEnd == 0)) {
+
+                NextThread->TimeSliceEnd = Now + KeRoundRobinCycles;
+            }
+        }
+    }
+
     //
     // Set the thread to running before releasing the scheduler lock to prevent
     // others from trying to steal this thread.
@@ -281,6 +381,12 @@ Return Value:
     //
 
     SpCollectThreadStatistic(OldThread, Processor, Reason);
+    SpTraceEvent(SP_TRACE_FLAG_SCHEDULER,
+                 SpTraceEventContextSwitch,
+                 Reason,
+                 NextThread->ThreadId,
+                 NextThread->OwningProcess->Identifiers.ProcessId,
+                 0);
 
     ASSERT((NextThreadState == ThreadStateReady) ||
            (NextThreadState == ThreadStateFirstTime));
@@ -456,12 +562,14 @@ Return Value:
 
 {
 
-    BOOL FirstThread;
     PSCHEDULER_GROUP Group;
     PSCHEDULER_GROUP_ENTRY GroupEntry;
     PSCHEDULER_GROUP_ENTRY NewGroupEntry;
     RUNLEVEL OldRunLevel;
+    PPROCESSOR_BLOCK PreviousProcessor;
     PPROCESSOR_BLOCK ProcessorBlock;
+    BOOL StartClock;
+    BOOL Steal;
 
     ASSERT((Thread->State == ThreadStateWaking) ||
            (Thread->State == ThreadStateFirstTime));
@@ -478,14 +586,39 @@ Return Value:
         Thread->State = ThreadStateReady;
     }
 
+    //
+    // A real-time thread should not wait behind another real-time thread on
+    // its previous processor if it could run right away here. This peeks at
+    // the other processor's running thread without its lock, which is fine
+    // for a placement hint.
+    //
+
+    ProcessorBlock = KeGetCurrentProcessorBlock();
+    Steal = KeSchedulerStealReadyThreads;
+    if ((Steal == FALSE) &&
+        (Thread->SchedulingPolicy != SchedulerPolicyNormal)) {
+
+        PreviousProcessor = PARENT_STRUCTURE(GroupEntry->Scheduler,
+                                             PROCESSOR_BLOCK,
+                                             Scheduler);
+
+        if ((PreviousProcessor != ProcessorBlock) &&
+            (KepCanPreemptThread(PreviousProcessor->RunningThread,
+                                 Thread) == FALSE) &&
+            (KepCanPreemptThread(ProcessorBlock->RunningThread,
+                                 Thread) != FALSE)) {
+
+            Steal = TRUE;
+        }
+    }
+
     //
     // If the configuration option is set, steal the thread to run on the
     // current processor. This is bad for cache locality, but doesn't need an
     // IPI.
     //
 
-    if (KeSchedulerStealReadyThreads != FALSE) {
-        ProcessorBlock = KeGetCurrentProcessorBlock();
+    if (Steal != FALSE) {
         Group = GroupEntry->Group;
         if (Group == &KeRootSchedulerGroup) {
             NewGroupEntry = &(ProcessorBlock->Scheduler.Group);
@@ -498,7 +631,16 @@ Return Value:
         }
 
         Thread->SchedulerEntry.Parent = &(NewGroupEntry->Entry);
-        KepEnqueueSchedulerEntry(&(Thread->SchedulerEntry), FALSE);
+        StartClock = KepEnqueueSchedulerEntry(&(Thread->SchedulerEntry),
+                                              FALSE);
+
+        if (StartClock != FALSE) {
+            KepSetClockToPeriodic(ProcessorBlock);
+        }
+
+        if (Thread->SchedulingPolicy != SchedulerPolicyNormal) {
+            KepPreemptForRealTimeThread(ProcessorBlock, Thread);
+        }
 
     //
     // Enqueue the thread on the processor it was previously on. This may
@@ -506,21 +648,27 @@ Return Value:
     //
 
     } else {
-        FirstThread = KepEnqueueSchedulerEntry(&(Thread->SchedulerEntry),
-                                               FALSE);
+        StartClock = KepEnqueueSchedulerEntry(&(Thread->SchedulerEntry),
+                                              FALSE);
 
         //
-        // If this is the first thread being scheduled on the processor, then
-        // make sure the clock is running (or wake it up).
+        // If the processor was idle or running its only thread, it may have
+        // stopped its periodic tick, so make sure the clock is running (or
+        // wake it up). Kick the processor if a real-time thread should
+        // preempt what it's running.
         //
 
-        if (FirstThread != FALSE) {
-            ProcessorBlock = PARENT_STRUCTURE(GroupEntry->Scheduler,
-                                              PROCESSOR_BLOCK,
-                                              Scheduler);
+        ProcessorBlock = PARENT_STRUCTURE(GroupEntry->Scheduler,
+                                          PROCESSOR_BLOCK,
+                                          Scheduler);
 
+        if (StartClock != FALSE) {
             KepSetClockToPeriodic(ProcessorBlock);
         }
+
+        if (Thread->SchedulingPolicy != SchedulerPolicyNormal) {
+            KepPreemptForRealTimeThread(ProcessorBlock, Thread);
+        }
     }
 
     KeLowerRunLevel(OldRunLevel);
@@ -702,6 +850,120 @@ Return Value:
     return;
 }
 
+INTN
+KeSysGetSetSchedulingPolicy (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for getting or setting the
+    scheduling policy and real-time priority of the current thread.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PSCHEDULER_GROUP_ENTRY GroupEntry;
+    RUNLEVEL OldRunLevel;
+    PSYSTEM_CALL_GET_SET_SCHEDULING_POLICY Parameters;
+    PPROCESSOR_BLOCK Processor;
+    KSTATUS Status;
+    PKTHREAD Thread;
+
+    Parameters = (PSYSTEM_CALL_GET_SET_SCHEDULING_POLICY)SystemCallParameter;
+    Thread = KeGetCurrentThread();
+    if (Parameters->Set == FALSE) {
+        Parameters->Policy = Thread->SchedulingPolicy;
+        Parameters->Priority = Thread->SchedulingPriority;
+        Status = STATUS_SUCCESS;
+        goto SysGetSetSchedulingPolicyEnd;
+    }
+
+    Status = STATUS_INVALID_PARAMETER;
+    if (Parameters->Policy >= SchedulerPolicyCount) {
+        goto SysGetSetSchedulingPolicyEnd;
+    }
+
+    if (Parameters->Policy == SchedulerPolicyNormal) {
+        if (Parameters->Priority != 0) {
+            goto SysGetSetSchedulingPolicyEnd;
+        }
+
+    } else if ((Parameters->Priority < SCHEDULER_REAL_TIME_PRIORITY_MINIMUM) ||
+               (Parameters->Priority > SCHEDULER_REAL_TIME_PRIORITY_MAXIMUM)) {
+
+        goto SysGetSetSchedulingPolicyEnd;
+    }
+
+    //
+    // Becoming real-time or raising a real-time priority requires permission.
+    // Any thread can lower itself.
+    //
+
+    if ((Parameters->Policy != SchedulerPolicyNormal) &&
+        ((Thread->SchedulingPolicy == SchedulerPolicyNormal) ||
+         (Parameters->Priority > Thread->SchedulingPriority))) {
+
+        Status = PsCheckPermission(PERMISSION_SCHEDULING);
+        if (!KSUCCESS(Status)) {
+            goto SysGetSetSchedulingPolicyEnd;
+        }
+    }
+
+    //
+    // The running thread sits in the current processor's ready queue. Pull it
+    // out, charge any real-time it has used, and put it back in its new class.
+    //
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Processor = KeGetCurrentProcessorBlock();
+    KeAcquireSpinLock(&(Processor->Scheduler.Lock));
+    GroupEntry = PARENT_STRUCTURE(Thread->SchedulerEntry.Parent,
+                                  SCHEDULER_GROUP_ENTRY,
+                                  Entry);
+
+    ASSERT(GroupEntry->Scheduler == &(Processor->Scheduler));
+
+    KepDequeueSchedulerEntry(&(Thread->SchedulerEntry), TRUE);
+    if (Thread->SchedulingPolicy != SchedulerPolicyNormal) {
+        KepChargeRealTime(&(Processor->Scheduler), Thread);
+    }
+
+    Processor->Scheduler.RealTimeRunStart = 0;
+    Thread->SchedulingPolicy = Parameters->Policy;
+    Thread->SchedulingPriority = Parameters->Priority;
+    Thread->TimeSliceEnd = 0;
+    KepEnqueueSchedulerEntry(&(Thread->SchedulerEntry), TRUE);
+    KeReleaseSpinLock(&(Processor->Scheduler.Lock));
+
+    //
+    // Let the scheduler pick again, since a higher priority thread may now be
+    // ready, or this thread may now outrank the one behind it.
+    //
+
+    KeSchedulerEntry(SchedulerReasonThreadYielding);
+    KeLowerRunLevel(OldRunLevel);
+    Status = STATUS_SUCCESS;
+
+SysGetSetSchedulingPolicyEnd:
+    return Status;
+}
+
 VOID
 KepInitializeScheduler (
     PPROCESSOR_BLOCK ProcessorBlock
@@ -728,6 +990,7 @@ Return Value:
     KeInitializeSpinLock(&KeSchedulerGroupLock);
     INITIALIZE_LIST_HEAD(&(KeRootSchedulerGroup.Children));
     KeInitializeSpinLock(&(ProcessorBlock->Scheduler.Lock));
+    INITIALIZE_LIST_HEAD(&(ProcessorBlock->Scheduler.RealTimeList));
     KepInitializeSchedulerGroupEntry(&(ProcessorBlock->Scheduler.Group),
                                      &(ProcessorBlock->Scheduler),
                                      &KeRootSchedulerGroup,
@@ -805,12 +1068,12 @@ Return Value:
     ULONG ActiveCount;
     ULONG CurrentNumber;
     PSCHEDULER_GROUP_ENTRY DestinationGroupEntry;
-    BOOL FirstThread;
     PSCHEDULER_GROUP Group;
     ULONG Number;
     RUNLEVEL OldRunLevel;
     PPROCESSOR_BLOCK ProcessorBlock;
     PSCHEDULER_GROUP_ENTRY SourceGroupEntry;
+    BOOL StartClock;
     PSCHEDULER_DATA VictimScheduler;
     PKTHREAD VictimThread;
 
@@ -890,11 +1153,11 @@ Return Value:
                 // Enqueue the thread on this processor.
                 //
 
-                FirstThread =
+                StartClock =
                       KepEnqueueSchedulerEntry(&(VictimThread->SchedulerEntry),
                                                FALSE);
 
-                if (FirstThread != FALSE) {
+                if (StartClock != FALSE) {
                     KepSetClockToPeriodic(KeProcessorBlocks[CurrentNumber]);
                 }
 
@@ -931,24 +1194,29 @@ Routine Description:
 
 Return Value:
 
-    TRUE if this was the first thread scheduled on the top level group. This
-    may indicate to callers that the processor may be out and idle.
+    TRUE if this was the first or second thread scheduled on the top level
+    group. The thread running on a processor stays scheduled, so this
+    indicates to callers that the processor may be idle or running its only
+    thread without a periodic clock, and needs its clock restarted.
 
-    FALSE if this was not the first thread scheduled, or the entry being
-    scheduled was not a thread.
+    FALSE if there were already at least two threads scheduled, or the entry
+    being scheduled was not a thread.
 
 --*/
 
 {
 
-    BOOL FirstThread;
+    PLIST_ENTRY CurrentEntry;
     PSCHEDULER_GROUP_ENTRY GroupEntry;
+    PKTHREAD ReadyThread;
     PSCHEDULER_DATA Scheduler;
+    BOOL StartClock;
+    PKTHREAD Thread;
 
     ASSERT((KeGetRunLevel() == RunLevelDispatch) ||
            (ArAreInterruptsEnabled() == FALSE));
 
-    FirstThread = FALSE;
+    StartClock = FALSE;
     if (LockHeld != FALSE) {
         GroupEntry = PARENT_STRUCTURE(Entry->Parent,
                                       SCHEDULER_GROUP_ENTRY,
@@ -978,38 +1246,72 @@ Return Value:
         }
     }
 
+    ASSERT(Entry->ListEntry.Next == NULL);
+
     //
-    // Add the entry to the list.
+    // Real-time threads skip the group hierarchy and go on the processor's
+    // real-time list, behind any other threads of the same priority. They
+    // only count towards the top level group.
     //
 
-    ASSERT(Entry->ListEntry.Next == NULL);
+    Thread = NULL;
+    if (Entry->Type == SchedulerEntryThread) {
+        Thread = PARENT_STRUCTURE(Entry, KTHREAD, SchedulerEntry);
+    }
+
+    if ((Thread != NULL) &&
+        (Thread->SchedulingPolicy != SchedulerPolicyNormal)) {
+
+        CurrentEntry = Scheduler->RealTimeList.Next;
+        while (CurrentEntry != &(Scheduler->RealTimeList)) {
+            ReadyThread = PARENT_STRUCTURE(LIST_VALUE(CurrentEntry,
+                                                      SCHEDULER_ENTRY,
+                                                      ListEntry),
+                                           KTHREAD,
+                                           SchedulerEntry);
 
-    INSERT_BEFORE(&(Entry->ListEntry), &(GroupEntry->Children));
+            if (ReadyThread->SchedulingPriority < Thread->SchedulingPriority) {
+                break;
+            }
+
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        INSERT_BEFORE(&(Entry->ListEntry), CurrentEntry);
+        Scheduler->RealTimeReadyCount += 1;
+        Scheduler->Group.ReadyThreadCount += 1;
+        if (Scheduler->Group.ReadyThreadCount <= 2) {
+            StartClock = TRUE;
+        }
 
     //
-    // Propagate the ready thread up through all levels.
+    // Add the entry to the list, and propagate the ready thread up through
+    // all levels.
     //
 
-    if (Entry->Type == SchedulerEntryThread) {
-        while (TRUE) {
-            GroupEntry->ReadyThreadCount += 1;
-            if (GroupEntry->Entry.Parent == NULL) {
+    } else {
+        INSERT_BEFORE(&(Entry->ListEntry), &(GroupEntry->Children));
+        if (Thread != NULL) {
+            while (TRUE) {
+                GroupEntry->ReadyThreadCount += 1;
+                if (GroupEntry->Entry.Parent == NULL) {
 
-                //
-                // Remember if this is the first thread to become ready on the
-                // top level group.
-                //
+                    //
+                    // Remember if this is the first or second thread to
+                    // become ready on the top level group.
+                    //
+
+                    if (GroupEntry->ReadyThreadCount <= 2) {
+                        StartClock = TRUE;
+                    }
 
-                if (GroupEntry->ReadyThreadCount == 1) {
-                    FirstThread = TRUE;
+                    break;
                 }
 
-                break;
+                GroupEntry = PARENT_STRUCTURE(GroupEntry->Entry.Parent,
+                                              SCHEDULER_GROUP_ENTRY,
+                                              Entry);
             }
-
-            GroupEntry = PARENT_STRUCTURE(GroupEntry->Entry.Parent,
-                                          SCHEDULER_GROUP_ENTRY,
-                                          Entry);
         }
     }
 
@@ -1017,7 +1319,7 @@ Return Value:
         KeReleaseSpinLock(&(Scheduler->Lock));
     }
 
-    return FirstThread;
+    return StartClock;
 }
 
 VOID
@@ -1051,6 +1353,7 @@ Return Value:
     PSCHEDULER_GROUP_ENTRY GroupEntry;
     PSCHEDULER_GROUP_ENTRY ParentGroupEntry;
     PSCHEDULER_DATA Scheduler;
+    PKTHREAD Thread;
 
     ASSERT((KeGetRunLevel() == RunLevelDispatch) ||
            (ArAreInterruptsEnabled() == FALSE));
@@ -1094,10 +1397,29 @@ Return Value:
     Entry->ListEntry.Next = NULL;
 
     //
-    // Propagate the no-longer-ready thread up through all levels.
+    // Real-time threads only count towards the top level group, and don't
+    // rotate any groups.
     //
 
+    Thread = NULL;
     if (Entry->Type == SchedulerEntryThread) {
+        Thread = PARENT_STRUCTURE(Entry, KTHREAD, SchedulerEntry);
+    }
+
+    if ((Thread != NULL) &&
+        (Thread->SchedulingPolicy != SchedulerPolicyNormal)) {
+
+        ASSERT((Scheduler->RealTimeReadyCount != 0) &&
+               (Scheduler->Group.ReadyThreadCount != 0));
+
+        Scheduler->RealTimeReadyCount -= 1;
+        Scheduler->Group.ReadyThreadCount -= 1;
+
+    //
+    // Propagate the no-longer-ready thread up through all levels.
+    //
+
+    } else if (Thread != NULL) {
         while (TRUE) {
             GroupEntry->ReadyThreadCount -= 1;
             if (GroupEntry->Entry.Parent == NULL) {
@@ -1174,6 +1496,34 @@ Return Value:
         return NULL;
     }
 
+    //
+    // Real-time threads run ahead of everything else, highest priority first,
+    // unless they've used up their share of the throttling period and there
+    // are normal threads waiting.
+    //
+
+    if ((Scheduler->RealTimeReadyCount != 0) &&
+        ((Scheduler->RealTimeThrottled == FALSE) ||
+         (GroupEntry->ReadyThreadCount == Scheduler->RealTimeReadyCount))) {
+
+        CurrentEntry = Scheduler->RealTimeList.Next;
+        while (CurrentEntry != &(Scheduler->RealTimeList)) {
+            Entry = LIST_VALUE(CurrentEntry, SCHEDULER_ENTRY, ListEntry);
+            Thread = PARENT_STRUCTURE(Entry, KTHREAD, SchedulerEntry);
+            if ((SkipRunning == FALSE) ||
+                (Thread->State != ThreadStateRunning)) {
+
+                return Thread;
+            }
+
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        if (GroupEntry->ReadyThreadCount == Scheduler->RealTimeReadyCount) {
+            return NULL;
+        }
+    }
+
     CurrentEntry = GroupEntry->Children.Next;
     while (CurrentEntry != &(GroupEntry->Children)) {
 
@@ -1450,3 +1800,173 @@ Return Value:
     return;
 }
 
+ULONGLONG
+KepChargeRealTime (
+    PSCHEDULER_DATA Scheduler,
+    PKTHREAD Thread
+    )
+
+/*++
+
+Routine Description:
+
+    This routine charges the time the given thread has spent running against
+    the processor's real-time budget, starting a new throttling period if the
+    last one has elapsed. This routine assumes the scheduler lock is held.
+
+Arguments:
+
+    Scheduler - Supplies a pointer to the scheduler to charge.
+
+    Thread - Supplies a pointer to the thread that has been running.
+
+Return Value:
+
+    Returns the current processor counter value.
+
+--*/
+
+{
+
+    ULONGLONG Frequency;
+    ULONGLONG Now;
+
+    //
+    // Convert the tunables into processor counter ticks the first time
+    // through.
+    //
+
+    if (KeRealTimePeriodCycles == 0) {
+        Frequency = HlQueryProcessorCounterFrequency();
+        KeRoundRobinCycles = (Frequency * SCHEDULER_ROUND_ROBIN_INTERVAL) /
+                             MICROSECONDS_PER_SECOND;
+
+        KeRealTimeRuntimeCycles = (Frequency * KeRealTimeRuntime) /
+                                  MICROSECONDS_PER_SECOND;
+
+        KeRealTimePeriodCycles = (Frequency * KeRealTimePeriod) /
+                                 MICROSECONDS_PER_SECOND;
+    }
+
+    Now = HlQueryProcessorCounter();
+    if ((Now - Scheduler->RealTimePeriodStart) >= KeRealTimePeriodCycles) {
+        Scheduler->RealTimePeriodStart = Now;
+        Scheduler->RealTimeUsed = 0;
+        Scheduler->RealTimeThrottled = FALSE;
+    }
+
+    if ((Thread->SchedulingPolicy != SchedulerPolicyNormal) &&
+        (Scheduler->RealTimeRunStart != 0)) {
+
+        if (Scheduler->RealTimeRunStart < Scheduler->RealTimePeriodStart) {
+            Scheduler->RealTimeRunStart = Scheduler->RealTimePeriodStart;
+        }
+
+        Scheduler->RealTimeUsed += Now - Scheduler->RealTimeRunStart;
+        Scheduler->RealTimeRunStart = Now;
+        if ((KeRealTimeRuntimeCycles < KeRealTimePeriodCycles) &&
+            (Scheduler->RealTimeUsed >= KeRealTimeRuntimeCycles)) {
+
+            Scheduler->RealTimeThrottled = TRUE;
+        }
+    }
+
+    return Now;
+}
+
+BOOL
+KepCanPreemptThread (
+    PKTHREAD RunningThread,
+    PKTHREAD Thread
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not a ready real-time thread should
+    preempt the given running thread.
+
+Arguments:
+
+    RunningThread - Supplies a pointer to the thread currently running on a
+        processor.
+
+    Thread - Supplies a pointer to the real-time thread that became ready.
+
+Return Value:
+
+    TRUE if the running thread is in the normal class or is real-time with a
+    lower priority.
+
+    FALSE if the running thread should keep the processor.
+
+--*/
+
+{
+
+    if (RunningThread->SchedulingPolicy == SchedulerPolicyNormal) {
+        return TRUE;
+    }
+
+    if (RunningThread->SchedulingPriority < Thread->SchedulingPriority) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+VOID
+KepPreemptForRealTimeThread (
+    PPROCESSOR_BLOCK Processor,
+    PKTHREAD Thread
+    )
+
+/*++
+
+Routine Description:
+
+    This routine forces the given processor through the scheduler as soon as
+    possible if the real-time thread just made ready on it outranks what it's
+    running. This routine must be called at or above dispatch level.
+
+Arguments:
+
+    Processor - Supplies a pointer to the processor the thread was queued on.
+
+    Thread - Supplies a pointer to the real-time thread that became ready.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PROCESSOR_SET ProcessorTarget;
+
+    ASSERT(KeGetRunLevel() >= RunLevelDispatch);
+
+    if (KepCanPreemptThread(Processor->RunningThread, Thread) == FALSE) {
+        return;
+    }
+
+    //
+    // The current processor reschedules on its way back down from dispatch.
+    // Other processors get a clock IPI, whose handler requests a dispatch
+    // interrupt.
+    //
+
+    if (Processor == KeGetCurrentProcessorBlock()) {
+        Processor->PendingDispatchInterrupt = TRUE;
+
+    } else {
+        ProcessorTarget.Target = ProcessorTargetSingleProcessor;
+        ProcessorTarget.U.Number = Processor->ProcessorNumber;
+        HlSendIpi(IpiTypeClock, &ProcessorTarget);
+    }
+
+    return;
+}
+
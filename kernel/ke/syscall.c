@@ -30,6 +30,7 @@ Module Name:
 //
 
 #include <minoca/kernel/kernel.h>
+#include "kep.h"
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -77,6 +78,12 @@ KepTestSystemCall (
     PVOID SystemCallParameter
     );
 
+VOID
+KepRecordSystemCall (
+    ULONG SystemCallNumber,
+    ULONGLONG StartTime
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -224,6 +231,12 @@ SYSTEM_CALL_TABLE_ENTRY KeSystemCallTable[SystemCallCount] = {
     {MmSysSetBreak,
         sizeof(SYSTEM_CALL_SET_BREAK),
         sizeof(SYSTEM_CALL_SET_BREAK)},
+    {IoSysIoRingControl,
+        sizeof(SYSTEM_CALL_IO_RING_CONTROL),
+        sizeof(SYSTEM_CALL_IO_RING_CONTROL)},
+    {KeSysGetSetSchedulingPolicy,
+        sizeof(SYSTEM_CALL_GET_SET_SCHEDULING_POLICY),
+        sizeof(SYSTEM_CALL_GET_SET_SCHEDULING_POLICY)},
 };
 
 //
@@ -269,13 +282,17 @@ Return Value:
     PSYSTEM_CALL_TABLE_ENTRY Handler;
     SYSTEM_CALL_PARAMETER_UNION LocalParameters;
     INTN Result;
+    ULONGLONG StartTime;
     KSTATUS Status;
     PKTHREAD Thread;
 
     //
-    // Begin charging kernel mode for cycles.
+    // Begin charging kernel mode for cycles. The call's latency is measured
+    // with the time counter, which unlike the cycle counter can be read at
+    // low level and agrees across processors.
     //
 
+    StartTime = HlQueryTimeCounter();
     Status = STATUS_SUCCESS;
     KeBeginCycleAccounting(CycleAccountKernel);
     Thread = KeGetCurrentThread();
@@ -351,6 +368,9 @@ Return Value:
     }
 
     PsCheckRuntimeTimers(Thread);
+    if (SystemCallNumber < SystemCallCount) {
+        KepRecordSystemCall(SystemCallNumber, StartTime);
+    }
 
     //
     // Return to the previous thread state and cycle account.
@@ -361,6 +381,158 @@ Return Value:
     return Result;
 }
 
+PSYSTEM_CALL_STATISTIC
+KepCreateSystemCallStatistics (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the system call counters for a new processor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns a pointer to the zeroed array of system call counters on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    PSYSTEM_CALL_STATISTIC Statistics;
+
+    AllocationSize = SystemCallCount * sizeof(SYSTEM_CALL_STATISTIC);
+    Statistics = MmAllocateNonPagedPool(AllocationSize, KE_ALLOCATION_TAG);
+    if (Statistics != NULL) {
+        RtlZeroMemory(Statistics, AllocationSize);
+    }
+
+    return Statistics;
+}
+
+KSTATUS
+KepGetSetSystemCallStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets a snapshot of the system call statistics summed across
+    all processors, or resets them.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation. For a get
+        operation this is a SYSTEM_CALL_STATISTICS structure followed by room
+        for the array of per-call statistics. A set operation resets all
+        counters and ignores the data.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    ULONG CallIndex;
+    PSYSTEM_CALL_STATISTIC Destination;
+    ULONG ProcessorCount;
+    ULONG ProcessorIndex;
+    UINTN RequiredSize;
+    PSYSTEM_CALL_STATISTIC Source;
+    PSYSTEM_CALL_STATISTICS Statistics;
+    KSTATUS Status;
+
+    ProcessorCount = KeGetActiveProcessorCount();
+
+    //
+    // A set resets the counters. Updates racing with the reset on other
+    // processors may survive it, which is fine for statistics.
+    //
+
+    if (Set != FALSE) {
+        Status = PsCheckPermission(PERMISSION_RESOURCES);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        for (ProcessorIndex = 0;
+             ProcessorIndex < ProcessorCount;
+             ProcessorIndex += 1) {
+
+            RtlZeroMemory(KeProcessorBlocks[ProcessorIndex]->
+                                                          SystemCallStatistics,
+                          SystemCallCount * sizeof(SYSTEM_CALL_STATISTIC));
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    RequiredSize = sizeof(SYSTEM_CALL_STATISTICS) +
+                   (SystemCallCount * sizeof(SYSTEM_CALL_STATISTIC));
+
+    if (*DataSize < RequiredSize) {
+        *DataSize = RequiredSize;
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    Statistics = Data;
+    if (Statistics->Version < SYSTEM_CALL_STATISTICS_VERSION) {
+        return STATUS_VERSION_MISMATCH;
+    }
+
+    Statistics->Version = SYSTEM_CALL_STATISTICS_VERSION;
+    Statistics->SystemCallCount = SystemCallCount;
+    Statistics->TimeCounterFrequency = HlQueryTimeCounterFrequency();
+    Destination = (PSYSTEM_CALL_STATISTIC)(Statistics + 1);
+    RtlZeroMemory(Destination, SystemCallCount * sizeof(SYSTEM_CALL_STATISTIC));
+    for (ProcessorIndex = 0;
+         ProcessorIndex < ProcessorCount;
+         ProcessorIndex += 1) {
+
+        Source = KeProcessorBlocks[ProcessorIndex]->SystemCallStatistics;
+        for (CallIndex = 0; CallIndex < SystemCallCount; CallIndex += 1) {
+            Destination[CallIndex].Count += Source[CallIndex].Count;
+            Destination[CallIndex].TotalTicks += Source[CallIndex].TotalTicks;
+            if (Source[CallIndex].MaxTicks > Destination[CallIndex].MaxTicks) {
+                Destination[CallIndex].MaxTicks = Source[CallIndex].MaxTicks;
+            }
+
+            for (Bucket = 0;
+                 Bucket < SYSTEM_CALL_HISTOGRAM_BUCKETS;
+                 Bucket += 1) {
+
+                Destination[CallIndex].Histogram[Bucket] +=
+                                            Source[CallIndex].Histogram[Bucket];
+            }
+        }
+    }
+
+    *DataSize = RequiredSize;
+    return STATUS_SUCCESS;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -396,3 +568,68 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+VOID
+KepRecordSystemCall (
+    ULONG SystemCallNumber,
+    ULONGLONG StartTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a completed system call to the current processor's
+    system call counters. The counters are per-processor so that updating
+    them never bounces cache lines between processors.
+
+Arguments:
+
+    SystemCallNumber - Supplies the system call number, which must be valid.
+
+    StartTime - Supplies the time counter value when the system call was
+        entered.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    BOOL Enabled;
+    PSYSTEM_CALL_STATISTIC Statistic;
+    ULONGLONG Ticks;
+
+    Ticks = HlQueryTimeCounter() - StartTime;
+    Bucket = 0;
+    if (Ticks != 0) {
+        Bucket = 63 - RtlCountLeadingZeros64(Ticks);
+        if (Bucket >= SYSTEM_CALL_HISTOGRAM_BUCKETS) {
+            Bucket = SYSTEM_CALL_HISTOGRAM_BUCKETS - 1;
+        }
+    }
+
+    //
+    // Disable interrupts rather than raising to dispatch, since it's cheaper
+    // and only needs to keep another thread from interleaving on this
+    // processor.
+    //
+
+    Enabled = ArDisableInterrupts();
+    Statistic = KeGetCurrentProcessorBlock()->SystemCallStatistics;
+    Statistic += SystemCallNumber;
+    Statistic->Count += 1;
+    Statistic->TotalTicks += Ticks;
+    if (Ticks > Statistic->MaxTicks) {
+        Statistic->MaxTicks = Ticks;
+    }
+
+    Statistic->Histogram[Bucket] += 1;
+    if (Enabled != FALSE) {
+        ArEnableInterrupts();
+    }
+
+    return;
+}
@@ -54,6 +54,11 @@ KepMaintainClock (
     PPROCESSOR_BLOCK Processor
     );
 
+VOID
+KepAbandonClock (
+    PPROCESSOR_BLOCK Processor
+    );
+
 VOID
 KepUpdateSystemTime (
     PPROCESSOR_BLOCK Processor
@@ -153,6 +158,18 @@ Return Value:
     ASSERT(KeGetRunLevel() <= RunLevelClock);
 
     RecentTimestamp = ProcessorBlock->Clock.CurrentTime;
+
+    //
+    // A processor without a periodic tick doesn't refresh its snapshot, so
+    // take a new one. Otherwise callers polling for a deadline would spin
+    // forever.
+    //
+
+    if (ProcessorBlock->Clock.Mode != ClockTimerPeriodic) {
+        RecentTimestamp = HlQueryTimeCounter();
+        ProcessorBlock->Clock.CurrentTime = RecentTimestamp;
+    }
+
     if (Enabled != FALSE) {
         ArEnableInterrupts();
     }
@@ -1644,8 +1661,11 @@ Return Value:
 
 {
 
+    BOOL Busy;
+    ULONG ClockOwner;
     ULONGLONG CurrentTime;
     ULONGLONG NextDeadline;
+    UINTN ReadyThreadCount;
 
     //
     // If already in one-shot mode, set the current mode to off, as this
@@ -1658,9 +1678,31 @@ Return Value:
 
     //
     // If there are threads ready, the clock must be set to periodic mode.
+    // The running thread stays in the ready count, so a busy processor with
+    // a count of one has nothing else to run and doesn't need a tick to
+    // preempt anything. Readying a second thread switches the clock back to
+    // periodic. The clock owner keeps ticking while busy so that system time
+    // stays current.
     //
 
-    if (Processor->Scheduler.Group.ReadyThreadCount != 0) {
+    Busy = FALSE;
+    ReadyThreadCount = Processor->Scheduler.Group.ReadyThreadCount;
+    if ((ReadyThreadCount == 1) &&
+        (Processor->RunningThread != Processor->IdleThread)) {
+
+        ClockOwner = KeClockOwner;
+        if ((KeDisableDynamicTick == FALSE) &&
+            (ClockOwner != (ULONG)-1) &&
+            (ClockOwner != Processor->ProcessorNumber)) {
+
+            Busy = TRUE;
+            Processor->Clock.NextMode = ClockTimerOneShot;
+
+        } else {
+            Processor->Clock.NextMode = ClockTimerPeriodic;
+        }
+
+    } else if (ReadyThreadCount != 0) {
         Processor->Clock.NextMode = ClockTimerPeriodic;
     }
 
@@ -1698,7 +1740,7 @@ Return Value:
         if ((Processor->Clock.Mode != ClockTimerPeriodic) &&
             (KeClockOwner == Processor->ProcessorNumber)) {
 
-            RtlAtomicExchange32(&KeClockOwner, -1);
+            KepAbandonClock(Processor);
         }
 
         //
@@ -1754,7 +1796,7 @@ Return Value:
         //
 
         if (KeClockOwner == Processor->ProcessorNumber) {
-            RtlAtomicExchange32(&KeClockOwner, -1);
+            KepAbandonClock(Processor);
         }
 
         break;
@@ -1769,6 +1811,81 @@ Return Value:
     }
 
     Processor->Clock.Mode = Processor->Clock.NextMode;
+
+    //
+    // If this processor stopped ticking while busy, make sure the clock owner
+    // didn't give up the clock in the meantime without seeing this processor
+    // go tickless. Otherwise nobody would be left to update system time. The
+    // owner clears ownership before scanning modes, so at least one side
+    // sees the other.
+    //
+
+    if ((Busy != FALSE) &&
+        (Processor->Clock.Mode != ClockTimerPeriodic)) {
+
+        RtlMemoryBarrier();
+        if (KeClockOwner == (ULONG)-1) {
+            HlSetClockTimer(ClockTimerPeriodic, 0, FALSE);
+            Processor->Clock.Mode = ClockTimerPeriodic;
+            Processor->Clock.NextMode = ClockTimerPeriodic;
+        }
+    }
+
+    return;
+}
+
+VOID
+KepAbandonClock (
+    PPROCESSOR_BLOCK Processor
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gives up clock ownership on the current processor. If another
+    processor is running a thread without a periodic tick, it is sent a clock
+    interrupt so that it claims the clock and keeps system time moving. This
+    routine must be called at clock level.
+
+Arguments:
+
+    Processor - Supplies a pointer to the current processor block, which must
+        be the clock owner.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    PPROCESSOR_BLOCK Other;
+    ULONG ProcessorCount;
+    PROCESSOR_SET Target;
+
+    ASSERT(KeGetRunLevel() == RunLevelClock);
+    ASSERT(KeClockOwner == Processor->ProcessorNumber);
+
+    RtlAtomicExchange32(&KeClockOwner, -1);
+    ProcessorCount = KeGetActiveProcessorCount();
+    for (Index = 0; Index < ProcessorCount; Index += 1) {
+        Other = KeProcessorBlocks[Index];
+        if ((Other == Processor) ||
+            (Other->Clock.Mode == ClockTimerPeriodic) ||
+            (Other->RunningThread == Other->IdleThread)) {
+
+            continue;
+        }
+
+        Target.Target = ProcessorTargetSingleProcessor;
+        Target.U.Number = Index;
+        HlSendIpi(IpiTypeClock, &Target);
+        break;
+    }
+
     return;
 }
 
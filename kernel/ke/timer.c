@@ -41,12 +41,14 @@ Module Name:
 //
 
 #define KTIMER_FLAG_INTERNAL_QUEUED 0x80000000
+#define KTIMER_FLAG_INTERNAL_SLACK 0x40000000
 
 //
 // Define the mask of internal flags.
 //
 
-#define KTIMER_FLAG_INTERNAL_MASK (KTIMER_FLAG_INTERNAL_QUEUED)
+#define KTIMER_FLAG_INTERNAL_MASK \
+    (KTIMER_FLAG_INTERNAL_QUEUED | KTIMER_FLAG_INTERNAL_SLACK)
 
 //
 // Define the threshold above which the microsecond to time tick calculation is
@@ -81,7 +83,14 @@ Structure Description:
     TreeNode - Stores the information about this timer's entry in the timer
         queue.
 
-    DueTime - Stores the time counter expiration time, in ticks.
+    DueTime - Stores the time counter expiration time, in ticks. The timer
+        will not expire before this time.
+
+    Deadline - Stores the latest time counter value the timer may expire at,
+        which is the due time plus the slack. Timers are sorted by deadline.
+
+    Slack - Stores the number of ticks the timer may expire late so that it
+        can be expired together with other timers.
 
     Period - Stores the period of the timer if it is periodic, or 0 if it is a
         one-shot timer.
@@ -103,6 +112,8 @@ struct _KTIMER {
     OBJECT_HEADER Header;
     RED_BLACK_TREE_NODE TreeNode;
     ULONGLONG DueTime;
+    ULONGLONG Deadline;
+    ULONGLONG Slack;
     ULONGLONG Period;
     TIMER_QUEUE_TYPE QueueType;
     PDPC Dpc;
@@ -123,7 +134,7 @@ Structure Description:
     NextTimer - Stores a pointer to the next timer that will expire, or NULL if
         the queue is empty.
 
-    NextDueTime - Stores the due time of the next timer.
+    NextDueTime - Stores the deadline of the next timer.
 
     QueuedTimerCount - Stores the number of times a timer has been added to
         this queue.
@@ -134,6 +145,9 @@ Structure Description:
     CancelledTimerCount - Stores the number of times a timer has come out of
         this queue because it was cancelled.
 
+    CoalescedTimerCount - Stores the number of times a timer was expired
+        before its deadline because another timer's deadline arrived first.
+
 --*/
 
 typedef struct _KTIMER_QUEUE {
@@ -143,6 +157,7 @@ typedef struct _KTIMER_QUEUE {
     UINTN QueuedTimerCount;
     UINTN ExpiredTimerCount;
     UINTN CancelledTimerCount;
+    UINTN CoalescedTimerCount;
 } KTIMER_QUEUE, *PKTIMER_QUEUE;
 
 /*++
@@ -158,7 +173,10 @@ Structure Description:
 
     NextTimer - Stores the next timer to expire across all queues.
 
-    NextDueTime - Stores the next due time across all timer queues.
+    NextDueTime - Stores the next deadline across all timer queues.
+
+    InterruptCount - Stores the number of times expired timers were serviced
+        on this processor.
 
     Queues - Stores the timer queues, except for the soft timer queue, which is
         global. Since the soft timer queue is not in this array, the array is
@@ -172,6 +190,7 @@ struct _KTIMER_DATA {
     ULONGLONG NextDueTime;
     PKTIMER NextWakingTimer;
     ULONGLONG NextWakeTime;
+    UINTN InterruptCount;
     KTIMER_QUEUE Queues[TimerQueueCount - 1];
 };
 
@@ -349,7 +368,8 @@ Routine Description:
     DueTime - Supplies the value of the time tick counter when this timer
         should expire (an absolute value in time counter ticks). If this value
         is 0, then an automatic due time of the current time plus the given
-        period will be computed.
+        period will be computed. The timer may expire up to its slack later
+        than this; see KeSetTimerSlack.
 
     Period - Supplies an optional period, in time counter ticks, for periodic
         timers. If this value is non-zero, the period will be added to the
@@ -373,6 +393,8 @@ Return Value:
     RUNLEVEL OldRunLevel;
     PPROCESSOR_BLOCK ProcessorBlock;
     PKTIMER_QUEUE Queue;
+    ULONGLONG Slack;
+    PKTHREAD Thread;
     PKTIMER_DATA TimerData;
 
     ASSERT(KeGetRunLevel() <= RunLevelDispatch);
@@ -406,6 +428,35 @@ Return Value:
                       (UINTN)Dpc);
     }
 
+    //
+    // Timers without their own slack take the default slack of the process
+    // queuing them. Code running at dispatch level isn't acting on behalf of
+    // whatever thread it interrupted, so it gets no slack. Real-time threads
+    // get no default slack either, and their wake timers are promoted to hard
+    // timers so a sleeping processor can't make them late.
+    //
+
+    Thread = NULL;
+    if (OldRunLevel < RunLevelDispatch) {
+        Thread = ProcessorBlock->RunningThread;
+    }
+
+    Slack = Timer->Slack;
+    if ((Timer->Flags & KTIMER_FLAG_INTERNAL_SLACK) == 0) {
+        Slack = 0;
+        if ((Thread != NULL) && (Thread->OwningProcess != NULL) &&
+            (Thread->SchedulingPolicy == SchedulerPolicyNormal)) {
+
+            Slack = Thread->OwningProcess->TimerSlack;
+        }
+    }
+
+    if ((QueueType == TimerQueueSoftWake) && (Thread != NULL) &&
+        (Thread->SchedulingPolicy != SchedulerPolicyNormal)) {
+
+        QueueType = TimerQueueHard;
+    }
+
     TimerData = ProcessorBlock->TimerData;
     if (QueueType == TimerQueueSoft) {
         Timer->Processor = -1;
@@ -435,6 +486,11 @@ Return Value:
     ObSignalObject(Timer, SignalOptionUnsignal);
     Timer->QueueType = QueueType;
     Timer->DueTime = DueTime;
+    Timer->Deadline = DueTime + Slack;
+    if (Timer->Deadline < DueTime) {
+        Timer->Deadline = -1ULL;
+    }
+
     Timer->Period = Period;
     Timer->Flags &= ~KTIMER_FLAG_PUBLIC_MASK;
     Timer->Flags |= Flags & KTIMER_FLAG_PUBLIC_MASK;
@@ -712,6 +768,45 @@ Return Value:
     return DueTime;
 }
 
+KERNEL_API
+VOID
+KeSetTimerSlack (
+    PKTIMER Timer,
+    ULONGLONG Slack
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets how late a timer is allowed to expire so that its
+    expiration can be batched with other timers. Without an explicit slack,
+    timers queued from a thread use the owning process' default timer slack.
+    This takes effect the next time the timer is queued, and must not be
+    called while the timer is queued.
+
+Arguments:
+
+    Timer - Supplies a pointer to the timer.
+
+    Slack - Supplies the number of time counter ticks past its due time the
+        timer may expire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT((Timer->Flags & KTIMER_FLAG_INTERNAL_QUEUED) == 0);
+
+    Timer->Slack = Slack;
+    Timer->Flags |= KTIMER_FLAG_INTERNAL_SLACK;
+    return;
+}
+
 KERNEL_API
 ULONGLONG
 KeConvertMicrosecondsToTimeTicks (
@@ -889,6 +984,7 @@ Return Value:
 
 {
 
+    BOOL Expired;
     ULONGLONG MissedCycles;
     PPROCESSOR_BLOCK ProcessorBlock;
     PKTIMER_QUEUE Queue;
@@ -915,6 +1011,7 @@ Return Value:
         return;
     }
 
+    Expired = FALSE;
     KeAcquireSpinLock(&(TimerData->Lock));
 
     //
@@ -944,10 +1041,25 @@ Return Value:
             Queue = &(TimerData->Queues[QueueIndex - 1]);
         }
 
-        while (CurrentTime >= Queue->NextDueTime) {
+        //
+        // Expire timers in deadline order. Once one timer's deadline has
+        // woken the processor, also expire the timers after it whose due
+        // time has passed, even though their deadlines haven't. This batches
+        // timers with slack into a single wakeup. Stop at the first timer
+        // that isn't due yet.
+        //
+
+        while ((Queue->NextTimer != NULL) &&
+               (CurrentTime >= Queue->NextTimer->DueTime)) {
+
             Timer = Queue->NextTimer;
             KepRemoveTimer(ProcessorBlock, Queue, Timer);
             Queue->ExpiredTimerCount += 1;
+            if (CurrentTime < Timer->Deadline) {
+                Queue->CoalescedTimerCount += 1;
+            }
+
+            Expired = TRUE;
 
             //
             // If the timer is periodic, adjust the due time and reinsert.
@@ -963,12 +1075,14 @@ Return Value:
 
                 if (Timer->DueTime + Timer->Period > CurrentTime) {
                     Timer->DueTime += Timer->Period;
+                    Timer->Deadline += Timer->Period;
 
                 } else {
                     MissedCycles = (CurrentTime - Timer->DueTime) /
                                    Timer->Period;
 
                     Timer->DueTime += (MissedCycles + 1) * Timer->Period;
+                    Timer->Deadline += (MissedCycles + 1) * Timer->Period;
                 }
 
                 KepInsertTimer(ProcessorBlock, Queue, Timer);
@@ -1002,10 +1116,64 @@ Return Value:
         }
     }
 
+    if (Expired != FALSE) {
+        TimerData->InterruptCount += 1;
+    }
+
     KeReleaseSpinLock(&(TimerData->Lock));
     return;
 }
 
+VOID
+KepGetTimerStatistics (
+    PPROCESSOR_BLOCK Processor,
+    PULONGLONG InterruptCount,
+    PULONGLONG CoalescedCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the timer expiration statistics for the given
+    processor.
+
+Arguments:
+
+    Processor - Supplies a pointer to the processor.
+
+    InterruptCount - Supplies a pointer where the number of times expired
+        timers were serviced on the processor will be returned.
+
+    CoalescedCount - Supplies a pointer where the number of timers expired
+        ahead of their deadline alongside another timer will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG QueueIndex;
+    PKTIMER_DATA TimerData;
+
+    //
+    // These are statistics, so don't bother synchronizing with the timer
+    // lock.
+    //
+
+    TimerData = Processor->TimerData;
+    *InterruptCount = TimerData->InterruptCount;
+    *CoalescedCount = 0;
+    for (QueueIndex = 0; QueueIndex < TimerQueueCount - 1; QueueIndex += 1) {
+        *CoalescedCount += TimerData->Queues[QueueIndex].CoalescedTimerCount;
+    }
+
+    return;
+}
+
 ULONGLONG
 KepGetNextTimerDeadline (
     PPROCESSOR_BLOCK Processor,
@@ -1141,10 +1309,10 @@ Return Value:
     //
 
     if ((Queue->NextTimer == NULL) ||
-        (Timer->DueTime < Queue->NextTimer->DueTime)) {
+        (Timer->Deadline < Queue->NextTimer->Deadline)) {
 
         Queue->NextTimer = Timer;
-        Queue->NextDueTime = Timer->DueTime;
+        Queue->NextDueTime = Timer->Deadline;
         if (Timer->QueueType != TimerQueueSoft) {
 
             //
@@ -1152,10 +1320,10 @@ Return Value:
             //
 
             if ((TimerData->NextTimer == NULL) ||
-                (Timer->DueTime < TimerData->NextDueTime)) {
+                (Timer->Deadline < TimerData->NextDueTime)) {
 
                 TimerData->NextTimer = Timer;
-                TimerData->NextDueTime = Timer->DueTime;
+                TimerData->NextDueTime = Timer->Deadline;
             }
 
             //
@@ -1228,7 +1396,7 @@ Return Value:
 
         if (NextNode != NULL) {
             NextTimer = RED_BLACK_TREE_VALUE(NextNode, KTIMER, TreeNode);
-            Queue->NextDueTime = NextTimer->DueTime;
+            Queue->NextDueTime = NextTimer->Deadline;
 
             //
             // Tell the clock scheduler about the next hard or soft-wake timer.
@@ -1330,14 +1498,14 @@ Return Value:
 
     FirstTimer = RED_BLACK_TREE_VALUE(FirstNode, KTIMER, TreeNode);
     SecondTimer = RED_BLACK_TREE_VALUE(SecondNode, KTIMER, TreeNode);
-    if (FirstTimer->DueTime < SecondTimer->DueTime) {
+    if (FirstTimer->Deadline < SecondTimer->Deadline) {
         return ComparisonResultAscending;
 
-    } else if (FirstTimer->DueTime > SecondTimer->DueTime) {
+    } else if (FirstTimer->Deadline > SecondTimer->Deadline) {
         return ComparisonResultDescending;
     }
 
-    ASSERT(FirstTimer->DueTime == SecondTimer->DueTime);
+    ASSERT(FirstTimer->Deadline == SecondTimer->Deadline);
 
     return ComparisonResultSame;
 }
@@ -63,6 +63,32 @@ Module Name:
 
 #define WORK_ITEM_FLAG_SUPPORT_DISPATCH_LEVEL 0x00000002
 
+//
+// This bit is set if the work item belongs to the work queue rather than a
+// caller, and should be returned to the queue's free list for reuse rather
+// than freed when its last reference is released.
+//
+
+#define WORK_ITEM_FLAG_RECYCLE 0x00000004
+
+//
+// Define the maximum number of free work items a work queue keeps for reuse,
+// and how many the system work queue allocates up front.
+//
+
+#define WORK_QUEUE_MAX_FREE_ITEMS 64
+#define SYSTEM_WORK_QUEUE_PREALLOCATED_ITEMS 16
+
+//
+// Define how many worker threads per processor the system work queue grows
+// to, how long extra worker threads sit idle before exiting, and how long
+// work has to wait behind busy workers before another worker is added.
+//
+
+#define SYSTEM_WORK_QUEUE_THREADS_PER_PROCESSOR 4
+#define WORK_QUEUE_IDLE_TIMEOUT (10 * MILLISECONDS_PER_SECOND)
+#define WORK_QUEUE_GROW_DELAY (10 * MICROSECONDS_PER_MILLISECOND)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -97,6 +123,31 @@ Structure Description:
     Name - Stores a pointer to a string containing the name of the worker
         threads.
 
+    IdleThreadCount - Stores the number of worker threads waiting for work.
+
+    MaxThreadCount - Stores the maximum number of worker threads the queue
+        may have. This is one unless the queue has a worker pool.
+
+    ManagerEvent - Stores an optional pointer to the event that wakes the
+        thread that grows the worker pool. This is NULL if the queue does not
+        have a worker pool.
+
+    FreeItemListHead - Stores the head of the list of work items kept for
+        reuse by KeCreateAndQueueWorkItem.
+
+    FreeItemCount - Stores the number of work items on the free list.
+
+    RunCount - Stores the number of work items taken off the queue to run.
+
+    QueueTicks - Stores the total number of time counter ticks work items
+        spent on the queue before being run.
+
+    MaxQueueTicks - Stores the longest time a work item spent on the queue,
+        in time counter ticks.
+
+    Allocations - Stores the number of times KeCreateAndQueueWorkItem had to
+        allocate a work item because the free list was empty.
+
 --*/
 
 struct _WORK_QUEUE {
@@ -112,6 +163,15 @@ struct _WORK_QUEUE {
     ULONG Flags;
     volatile ULONG CurrentThreadCount;
     PSTR Name;
+    volatile ULONG IdleThreadCount;
+    volatile ULONG MaxThreadCount;
+    PKEVENT ManagerEvent;
+    LIST_ENTRY FreeItemListHead;
+    ULONG FreeItemCount;
+    ULONGLONG RunCount;
+    ULONGLONG QueueTicks;
+    ULONGLONG MaxQueueTicks;
+    ULONGLONG Allocations;
 };
 
 /*++
@@ -143,6 +203,9 @@ Structure Description:
     Flags - Stores a pointer to internal flags used by the operating system.
         Do not modify these directly. See WORK_ITEM_FLAG_* definitions.
 
+    QueueTime - Stores the time counter value when the work item was last
+        queued.
+
 --*/
 
 struct _WORK_ITEM {
@@ -154,6 +217,7 @@ struct _WORK_ITEM {
     PVOID Parameter;
     WORK_PRIORITY Priority;
     ULONG Flags;
+    ULONGLONG QueueTime;
 };
 
 //
@@ -164,11 +228,64 @@ VOID
 KepWorkerThread (
     );
 
+VOID
+KepWorkQueueManagerThread (
+    PVOID Parameter
+    );
+
+KSTATUS
+KepCreateWorkerThread (
+    PWORK_QUEUE Queue
+    );
+
+BOOL
+KepRetireWorkerThread (
+    PWORK_QUEUE Queue
+    );
+
+KSTATUS
+KepEnableWorkQueuePool (
+    PWORK_QUEUE Queue,
+    ULONG PreallocatedItemCount
+    );
+
 VOID
 KepDestroyWorkQueue (
     PWORK_QUEUE Queue
     );
 
+RUNLEVEL
+KepAcquireWorkQueueLock (
+    PWORK_QUEUE Queue
+    );
+
+VOID
+KepReleaseWorkQueueLock (
+    PWORK_QUEUE Queue,
+    RUNLEVEL OldRunLevel
+    );
+
+PWORK_ITEM
+KepAllocateWorkItem (
+    PWORK_QUEUE WorkQueue,
+    ULONG AllocationTag
+    );
+
+PWORK_ITEM
+KepGetFreeWorkItem (
+    PWORK_QUEUE Queue
+    );
+
+BOOL
+KepRecycleWorkItem (
+    PWORK_ITEM WorkItem
+    );
+
+VOID
+KepFreeWorkItem (
+    PWORK_ITEM WorkItem
+    );
+
 VOID
 KepWorkItemAddReference (
     PWORK_ITEM WorkItem
@@ -285,6 +402,7 @@ Return Value:
     }
 
     INITIALIZE_LIST_HEAD(&(Queue->WorkItemListHead));
+    INITIALIZE_LIST_HEAD(&(Queue->FreeItemListHead));
     Queue->Event = KeCreateEvent(NULL);
     if (Queue->Event == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -292,13 +410,14 @@ Return Value:
     }
 
     Queue->Flags = Flags;
+    Queue->MaxThreadCount = 1;
     Queue->State = WorkQueueStateOpen;
 
     //
     // Create a worker thread.
     //
 
-    Status = PsCreateKernelThread(KepWorkerThread, Queue, Name);
+    Status = KepCreateWorkerThread(Queue);
     if (!KSUCCESS(Status)) {
         goto CreateWorkQueueEnd;
     }
@@ -370,6 +489,13 @@ Return Value:
            (WorkQueue->State != WorkQueueStateDestroying) &&
            (WorkQueue->State != WorkQueueStateDestroyed));
 
+    //
+    // The pool manager thread never exits, so queues with a worker pool can't
+    // be destroyed.
+    //
+
+    ASSERT(WorkQueue->ManagerEvent == NULL);
+
     DispatchLevel = FALSE;
     if ((WorkQueue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
         DispatchLevel = TRUE;
@@ -551,17 +677,13 @@ Return Value:
 {
 
     PWORK_ITEM NewWorkItem;
-    BOOL NonPaged;
-    KSTATUS Status;
 
     ASSERT(KeGetRunLevel() <= RunLevelDispatch);
 
-    NewWorkItem = NULL;
     if ((Priority < WorkPriorityNormal) || (Priority > WorkPriorityHigh) ||
         (WorkRoutine == NULL)) {
 
-        Status = STATUS_INVALID_PARAMETER;
-        goto CreateWorkItemEnd;
+        return NULL;
     }
 
     //
@@ -572,63 +694,12 @@ Return Value:
         WorkQueue = KeSystemWorkQueue;
     }
 
-    NonPaged = FALSE;
-    if ((WorkQueue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-        NonPaged = TRUE;
-    }
-
-    //
-    // Allocate space for a work item.
-    //
-
-    if (NonPaged != FALSE) {
-        NewWorkItem = MmAllocateNonPagedPool(sizeof(WORK_ITEM), AllocationTag);
-
-    } else {
-        NewWorkItem = MmAllocatePagedPool(sizeof(WORK_ITEM), AllocationTag);
-    }
-
+    NewWorkItem = KepAllocateWorkItem(WorkQueue, AllocationTag);
     if (NewWorkItem == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-        goto CreateWorkItemEnd;
-    }
-
-    RtlZeroMemory(NewWorkItem, sizeof(WORK_ITEM));
-    NewWorkItem->ReferenceCount = 1;
-
-    //
-    // If the work queue has to support dispatch level, then the work item
-    // needs to as well.
-    //
-
-    if (NonPaged != FALSE) {
-        NewWorkItem->Flags |= WORK_ITEM_FLAG_SUPPORT_DISPATCH_LEVEL;
+        return NULL;
     }
 
-    //
-    // Initialize the rest of the work item. With the above flag set the
-    // destroy routine can be used if things do not work out.
-    //
-
     KeSetWorkItemParameters(NewWorkItem, Priority, WorkRoutine, Parameter);
-    NewWorkItem->Queue = WorkQueue;
-    NewWorkItem->Event = KeCreateEvent(NULL);
-    if (NewWorkItem->Event == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-        goto CreateWorkItemEnd;
-    }
-
-    KeSignalEvent(NewWorkItem->Event, SignalOptionSignalAll);
-    Status = STATUS_SUCCESS;
-
-CreateWorkItemEnd:
-    if (!KSUCCESS(Status)) {
-        if (NewWorkItem != NULL) {
-            KeDestroyWorkItem(NewWorkItem);
-            NewWorkItem = NULL;
-        }
-    }
-
     return NewWorkItem;
 }
 
@@ -899,6 +970,7 @@ Return Value:
     BOOL DispatchLevel;
     RUNLEVEL OldRunLevel;
     PWORK_QUEUE Queue;
+    BOOL SignalWorkers;
     KSTATUS Status;
 
     OldRunLevel = RunLevelCount;
@@ -959,6 +1031,7 @@ Return Value:
     //
 
     WorkItem->Flags |= WORK_ITEM_FLAG_QUEUED;
+    WorkItem->QueueTime = HlQueryTimeCounter();
     KeSignalEvent(WorkItem->Event, SignalOptionUnsignal);
 
     //
@@ -973,6 +1046,17 @@ Return Value:
         INSERT_BEFORE(&(WorkItem->ListEntry), &(Queue->WorkItemListHead));
     }
 
+    //
+    // The queue event stays signaled until a worker finds the list empty
+    // while holding the lock, so only the first item onto an empty queue
+    // needs to signal it. Later items are picked up by the same wake.
+    //
+
+    SignalWorkers = FALSE;
+    if (Queue->WorkItemCount == 0) {
+        SignalWorkers = TRUE;
+    }
+
     Queue->WorkItemCount += 1;
     WorkItem = NULL;
     Status = STATUS_SUCCESS;
@@ -992,7 +1076,18 @@ Return Value:
         // Signal the event to kick off the worker threads.
         //
 
-        KeSignalEvent(Queue->Event, SignalOptionSignalAll);
+        if (SignalWorkers != FALSE) {
+            KeSignalEvent(Queue->Event, SignalOptionSignalAll);
+        }
+
+        //
+        // If every worker is busy, let the pool manager know it may need to
+        // add another.
+        //
+
+        if ((Queue->ManagerEvent != NULL) && (Queue->IdleThreadCount == 0)) {
+            KeSignalEvent(Queue->ManagerEvent, SignalOptionSignalAll);
+        }
     }
 
     if (WorkItem != NULL) {
@@ -1044,28 +1139,41 @@ Return Value:
     KSTATUS Status;
     PWORK_ITEM WorkItem;
 
+    ASSERT(KeGetRunLevel() <= RunLevelDispatch);
+
+    if ((Priority < WorkPriorityNormal) || (Priority > WorkPriorityHigh) ||
+        (WorkRoutine == NULL)) {
+
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    if (WorkQueue == NULL) {
+        WorkQueue = KeSystemWorkQueue;
+    }
+
     //
-    // Create the new work item, and set the flag to automatically free it.
+    // Reuse a work item from the queue's free list if there is one, and only
+    // allocate a new one if not. Either way the work item goes back on the
+    // free list after it runs.
     //
 
-    WorkItem = KeCreateWorkItem(WorkQueue,
-                                Priority,
-                                WorkRoutine,
-                                Parameter,
-                                KE_WORK_ITEM_ALLOCATION_TAG);
-
+    WorkItem = KepGetFreeWorkItem(WorkQueue);
     if (WorkItem == NULL) {
-        return STATUS_UNSUCCESSFUL;
+        WorkItem = KepAllocateWorkItem(WorkQueue, KE_WORK_ITEM_ALLOCATION_TAG);
+        if (WorkItem == NULL) {
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        WorkItem->Flags |= WORK_ITEM_FLAG_RECYCLE;
     }
 
+    KeSetWorkItemParameters(WorkItem, Priority, WorkRoutine, Parameter);
     Status = KeQueueWorkItem(WorkItem);
-    if (!KSUCCESS(Status)) {
-        return Status;
-    }
 
     //
     // Release the reference on the work item from when it was created, so that
-    // after it runs it will automatically destroy itself.
+    // after it runs it will automatically be recycled. If it failed to queue,
+    // this recycles it now.
     //
 
     KepWorkItemReleaseReference(WorkItem);
@@ -1104,6 +1212,91 @@ Return Value:
         return STATUS_UNSUCCESSFUL;
     }
 
+    return KepEnableWorkQueuePool(KeSystemWorkQueue,
+                                  SYSTEM_WORK_QUEUE_PREALLOCATED_ITEMS);
+}
+
+KSTATUS
+KepGetWorkQueueStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets statistics about DPCs and the system work queue.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+    PPROCESSOR_BLOCK ProcessorBlock;
+    ULONG ProcessorCount;
+    ULONG ProcessorIndex;
+    PWORK_QUEUE Queue;
+    PWORK_QUEUE_STATISTICS Statistics;
+
+    if (Set != FALSE) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    if (*DataSize != sizeof(WORK_QUEUE_STATISTICS)) {
+        *DataSize = sizeof(WORK_QUEUE_STATISTICS);
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    Statistics = Data;
+    if (Statistics->Version < WORK_QUEUE_STATISTICS_VERSION) {
+        return STATUS_VERSION_MISMATCH;
+    }
+
+    RtlZeroMemory(Statistics, sizeof(WORK_QUEUE_STATISTICS));
+    Statistics->Version = WORK_QUEUE_STATISTICS_VERSION;
+    Statistics->TimeCounterFrequency = HlQueryTimeCounterFrequency();
+    ProcessorCount = KeGetActiveProcessorCount();
+    for (ProcessorIndex = 0;
+         ProcessorIndex < ProcessorCount;
+         ProcessorIndex += 1) {
+
+        ProcessorBlock = KeProcessorBlocks[ProcessorIndex];
+        Statistics->DpcCount += ProcessorBlock->DpcCount;
+        Statistics->DpcQueueTicks += ProcessorBlock->DpcQueueTicks;
+        if (ProcessorBlock->DpcMaxQueueTicks >
+            Statistics->DpcMaxQueueTicks) {
+
+            Statistics->DpcMaxQueueTicks = ProcessorBlock->DpcMaxQueueTicks;
+        }
+    }
+
+    Queue = KeSystemWorkQueue;
+    OldRunLevel = KepAcquireWorkQueueLock(Queue);
+    Statistics->WorkerThreadCount = Queue->CurrentThreadCount;
+    Statistics->IdleWorkerThreadCount = Queue->IdleThreadCount;
+    Statistics->MaxWorkerThreadCount = Queue->MaxThreadCount;
+    Statistics->WorkItemCount = Queue->RunCount;
+    Statistics->WorkItemQueueTicks = Queue->QueueTicks;
+    Statistics->WorkItemMaxQueueTicks = Queue->MaxQueueTicks;
+    Statistics->WorkItemAllocations = Queue->Allocations;
+    KepReleaseWorkQueueLock(Queue, OldRunLevel);
     return STATUS_SUCCESS;
 }
 
@@ -1137,35 +1330,38 @@ Return Value:
 
     RUNLEVEL OldRunLevel;
     PWORK_QUEUE Queue;
-    BOOL RaiseToDispatch;
+    ULONGLONG QueueTicks;
     ULONG RemainingThreads;
+    KSTATUS Status;
+    ULONG Timeout;
     PWORK_ITEM WorkItem;
 
-    OldRunLevel = RunLevelCount;
     Queue = (PWORK_QUEUE)Parameter;
-    RtlAtomicAdd32(&(Queue->CurrentThreadCount), 1);
-    RaiseToDispatch = FALSE;
-    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-        RaiseToDispatch = TRUE;
-    }
-
     while (TRUE) {
 
         //
         // Wait for the event, then process work items until none are left.
+        // Threads in a worker pool give up after sitting idle for a while, as
+        // long as they're not the last one.
         //
 
-        KeWaitForEvent(Queue->Event, FALSE, WAIT_TIME_INDEFINITE);
-        while (TRUE) {
-            WorkItem = NULL;
-            if (RaiseToDispatch != FALSE) {
-                OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-                KeAcquireSpinLock(&(Queue->Lock.SpinLock));
+        Timeout = WAIT_TIME_INDEFINITE;
+        if (Queue->MaxThreadCount > 1) {
+            Timeout = WORK_QUEUE_IDLE_TIMEOUT;
+        }
 
-            } else {
-                KeAcquireQueuedLock(Queue->Lock.QueuedLock);
-            }
+        RtlAtomicAdd32(&(Queue->IdleThreadCount), 1);
+        Status = KeWaitForEvent(Queue->Event, FALSE, Timeout);
+        RtlAtomicAdd32(&(Queue->IdleThreadCount), -1);
+        if ((Status == STATUS_TIMEOUT) &&
+            (KepRetireWorkerThread(Queue) != FALSE)) {
+
+            break;
+        }
 
+        while (TRUE) {
+            WorkItem = NULL;
+            OldRunLevel = KepAcquireWorkQueueLock(Queue);
             if (LIST_EMPTY(&(Queue->WorkItemListHead)) == FALSE) {
                 WorkItem = LIST_VALUE(Queue->WorkItemListHead.Next,
                                       WORK_ITEM,
@@ -1175,18 +1371,18 @@ Return Value:
                 WorkItem->ListEntry.Next = NULL;
                 Queue->WorkItemCount -= 1;
                 WorkItem->Flags &= ~WORK_ITEM_FLAG_QUEUED;
+                QueueTicks = HlQueryTimeCounter() - WorkItem->QueueTime;
+                Queue->RunCount += 1;
+                Queue->QueueTicks += QueueTicks;
+                if (QueueTicks > Queue->MaxQueueTicks) {
+                    Queue->MaxQueueTicks = QueueTicks;
+                }
 
             } else {
                 KeSignalEvent(Queue->Event, SignalOptionUnsignal);
             }
 
-            if (RaiseToDispatch != FALSE) {
-                KeReleaseSpinLock(&(Queue->Lock.SpinLock));
-                KeLowerRunLevel(OldRunLevel);
-
-            } else {
-                KeReleaseQueuedLock(Queue->Lock.QueuedLock);
-            }
+            KepReleaseWorkQueueLock(Queue, OldRunLevel);
 
             //
             // If there is a work item, execute it.
@@ -1244,96 +1440,331 @@ Return Value:
 }
 
 VOID
-KepDestroyWorkQueue (
-    PWORK_QUEUE Queue
+KepWorkQueueManagerThread (
+    PVOID Parameter
     )
 
 /*++
 
 Routine Description:
 
-    This routine destroys and frees a work queue. This routine will be
-    called automatically by the last worker thread to exit.
+    This routine grows a work queue's worker pool. It is woken when work is
+    queued while no worker is idle. If the work is still waiting a short
+    while later, the workers are blocked or running long, so another worker
+    is added.
 
 Arguments:
 
-    Queue - Supplies a pointer to the queue to destroy.
+    Parameter - Supplies a pointer to the work queue to manage.
 
 Return Value:
 
-    None.
+    None. Does not return.
 
 --*/
 
 {
 
-    BOOL NonPaged;
-
-    ASSERT(Queue->CurrentThreadCount == 0);
+    ULONG MaxThreadCount;
+    PWORK_QUEUE Queue;
+    KSTATUS Status;
 
-    NonPaged = FALSE;
-    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-        NonPaged = TRUE;
-    }
+    Queue = (PWORK_QUEUE)Parameter;
+    while (TRUE) {
+        KeWaitForEvent(Queue->ManagerEvent, FALSE, WAIT_TIME_INDEFINITE);
+        KeSignalEvent(Queue->ManagerEvent, SignalOptionUnsignal);
 
-    if (Queue->Name != NULL) {
-        MmFreePagedPool(Queue->Name);
-    }
+        //
+        // Pick up any processors that have come online since last time.
+        //
 
-    if ((NonPaged != FALSE) && (Queue->Lock.QueuedLock != NULL)) {
-        KeDestroyQueuedLock(Queue->Lock.QueuedLock);
-    }
+        MaxThreadCount = KeGetActiveProcessorCount() *
+                         SYSTEM_WORK_QUEUE_THREADS_PER_PROCESSOR;
 
-    if (Queue->Event != NULL) {
-        KeDestroyEvent(Queue->Event);
-    }
+        if (MaxThreadCount > Queue->MaxThreadCount) {
+            Queue->MaxThreadCount = MaxThreadCount;
+        }
 
-    if (NonPaged != FALSE) {
-        MmFreeNonPagedPool(Queue);
+        while (TRUE) {
+            KeDelayExecution(FALSE, FALSE, WORK_QUEUE_GROW_DELAY);
+            if ((Queue->WorkItemCount == 0) || (Queue->IdleThreadCount != 0)) {
+                break;
+            }
 
-    } else {
-        MmFreePagedPool(Queue);
+            Status = KepCreateWorkerThread(Queue);
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+        }
     }
 
     return;
 }
 
-VOID
-KepWorkItemAddReference (
-    PWORK_ITEM WorkItem
+KSTATUS
+KepCreateWorkerThread (
+    PWORK_QUEUE Queue
     )
 
 /*++
 
 Routine Description:
 
-    This routine adds a reference to the given work item.
+    This routine adds a worker thread to the given work queue, unless the
+    queue already has as many as it's allowed.
 
 Arguments:
 
-    WorkItem - Supplies a pointer to the work item to add a reference to.
+    Queue - Supplies a pointer to the work queue.
 
 Return Value:
 
-    None.
+    Status code.
 
 --*/
 
 {
 
-    UINTN OldReferenceCount;
+    ULONG Count;
+    KSTATUS Status;
 
-    OldReferenceCount = RtlAtomicAdd(&(WorkItem->ReferenceCount), 1);
+    //
+    // Reserve a spot for the thread first so that racing callers can't push
+    // the queue over its limit.
+    //
 
-    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+    do {
+        Count = Queue->CurrentThreadCount;
+        if (Count >= Queue->MaxThreadCount) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
 
-    return;
-}
+    } while (RtlAtomicCompareExchange32(&(Queue->CurrentThreadCount),
+                                        Count + 1,
+                                        Count) != Count);
 
-VOID
-KepWorkItemReleaseReference (
-    PWORK_ITEM WorkItem
-    )
+    Status = PsCreateKernelThread(KepWorkerThread, Queue, Queue->Name);
+    if (!KSUCCESS(Status)) {
+        RtlAtomicAdd32(&(Queue->CurrentThreadCount), -1);
+    }
+
+    return Status;
+}
+
+BOOL
+KepRetireWorkerThread (
+    PWORK_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not an idle worker thread should exit,
+    and accounts for it leaving if so.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+Return Value:
+
+    TRUE if the worker thread should exit.
+
+    FALSE if the worker thread should keep waiting for work.
+
+--*/
+
+{
+
+    ULONG Count;
+
+    //
+    // Leave destruction to the usual path.
+    //
+
+    if (Queue->State != WorkQueueStateOpen) {
+        return FALSE;
+    }
+
+    do {
+        Count = Queue->CurrentThreadCount;
+        if (Count <= 1) {
+            return FALSE;
+        }
+
+    } while (RtlAtomicCompareExchange32(&(Queue->CurrentThreadCount),
+                                        Count - 1,
+                                        Count) != Count);
+
+    //
+    // Work may have been queued while this thread was still counted as idle.
+    // Make sure it doesn't get stuck behind busy workers.
+    //
+
+    if ((Queue->WorkItemCount != 0) && (Queue->ManagerEvent != NULL)) {
+        KeSignalEvent(Queue->ManagerEvent, SignalOptionSignalAll);
+    }
+
+    return TRUE;
+}
+
+KSTATUS
+KepEnableWorkQueuePool (
+    PWORK_QUEUE Queue,
+    ULONG PreallocatedItemCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gives a work queue a worker pool that grows when its workers
+    block and shrinks when they sit idle, and fills its free list of work
+    items. A queue with a worker pool cannot be destroyed.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+    PreallocatedItemCount - Supplies the number of work items to put on the
+        queue's free list up front.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG ItemIndex;
+    KSTATUS Status;
+    PWORK_ITEM WorkItem;
+
+    Queue->ManagerEvent = KeCreateEvent(NULL);
+    if (Queue->ManagerEvent == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    for (ItemIndex = 0; ItemIndex < PreallocatedItemCount; ItemIndex += 1) {
+        WorkItem = KepAllocateWorkItem(Queue, KE_WORK_ITEM_ALLOCATION_TAG);
+        if (WorkItem == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        WorkItem->Flags |= WORK_ITEM_FLAG_RECYCLE;
+        KepWorkItemReleaseReference(WorkItem);
+    }
+
+    Status = PsCreateKernelThread(KepWorkQueueManagerThread,
+                                  Queue,
+                                  "KeWorkerPool");
+
+    return Status;
+}
+
+VOID
+KepDestroyWorkQueue (
+    PWORK_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys and frees a work queue. This routine will be
+    called automatically by the last worker thread to exit.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL NonPaged;
+    PWORK_ITEM WorkItem;
+
+    ASSERT(Queue->CurrentThreadCount == 0);
+
+    NonPaged = FALSE;
+    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
+        NonPaged = TRUE;
+    }
+
+    while (LIST_EMPTY(&(Queue->FreeItemListHead)) == FALSE) {
+        WorkItem = LIST_VALUE(Queue->FreeItemListHead.Next,
+                              WORK_ITEM,
+                              ListEntry);
+
+        LIST_REMOVE(&(WorkItem->ListEntry));
+        KepFreeWorkItem(WorkItem);
+    }
+
+    if (Queue->Name != NULL) {
+        MmFreePagedPool(Queue->Name);
+    }
+
+    if ((NonPaged != FALSE) && (Queue->Lock.QueuedLock != NULL)) {
+        KeDestroyQueuedLock(Queue->Lock.QueuedLock);
+    }
+
+    if (Queue->Event != NULL) {
+        KeDestroyEvent(Queue->Event);
+    }
+
+    if (NonPaged != FALSE) {
+        MmFreeNonPagedPool(Queue);
+
+    } else {
+        MmFreePagedPool(Queue);
+    }
+
+    return;
+}
+
+VOID
+KepWorkItemAddReference (
+    PWORK_ITEM WorkItem
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a reference to the given work item.
+
+Arguments:
+
+    WorkItem - Supplies a pointer to the work item to add a reference to.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd(&(WorkItem->ReferenceCount), 1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    return;
+}
+
+VOID
+KepWorkItemReleaseReference (
+    PWORK_ITEM WorkItem
+    )
 
 /*++
 
@@ -1354,7 +1785,6 @@ Return Value:
 
 {
 
-    BOOL NonPaged;
     UINTN OldReferenceCount;
 
     OldReferenceCount = RtlAtomicAdd(&(WorkItem->ReferenceCount), -1);
@@ -1365,21 +1795,303 @@ Return Value:
 
         ASSERT((WorkItem->Flags & WORK_ITEM_FLAG_QUEUED) == 0);
 
-        if (WorkItem->Event != NULL) {
-            KeDestroyEvent(WorkItem->Event);
-        }
+        if (((WorkItem->Flags & WORK_ITEM_FLAG_RECYCLE) == 0) ||
+            (KepRecycleWorkItem(WorkItem) == FALSE)) {
 
-        NonPaged = FALSE;
-        if ((WorkItem->Flags & WORK_ITEM_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
-            NonPaged = TRUE;
+            KepFreeWorkItem(WorkItem);
         }
+    }
 
-        if (NonPaged != FALSE) {
-            MmFreeNonPagedPool(WorkItem);
+    return;
+}
 
-        } else {
-            MmFreePagedPool(WorkItem);
-        }
+RUNLEVEL
+KepAcquireWorkQueueLock (
+    PWORK_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine acquires a work queue's lock, raising to dispatch first if
+    the queue supports dispatch level.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+Return Value:
+
+    Returns the previous run level to pass to the release routine.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+
+    OldRunLevel = RunLevelCount;
+    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Queue->Lock.SpinLock));
+
+    } else {
+        KeAcquireQueuedLock(Queue->Lock.QueuedLock);
+    }
+
+    return OldRunLevel;
+}
+
+VOID
+KepReleaseWorkQueueLock (
+    PWORK_QUEUE Queue,
+    RUNLEVEL OldRunLevel
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a work queue's lock.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+    OldRunLevel - Supplies the run level returned when the lock was acquired.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if ((Queue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
+        KeReleaseSpinLock(&(Queue->Lock.SpinLock));
+        KeLowerRunLevel(OldRunLevel);
+
+    } else {
+        KeReleaseQueuedLock(Queue->Lock.QueuedLock);
+    }
+
+    return;
+}
+
+PWORK_ITEM
+KepAllocateWorkItem (
+    PWORK_QUEUE WorkQueue,
+    ULONG AllocationTag
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates and initializes a work item for the given queue,
+    without setting its routine or parameters.
+
+Arguments:
+
+    WorkQueue - Supplies a pointer to the queue this work item will
+        eventually be queued to.
+
+    AllocationTag - Supplies an allocation tag to associate with the work item.
+
+Return Value:
+
+    Returns a pointer to the new work item with one reference on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    PWORK_ITEM NewWorkItem;
+    BOOL NonPaged;
+
+    NonPaged = FALSE;
+    if ((WorkQueue->Flags & WORK_QUEUE_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
+        NonPaged = TRUE;
+    }
+
+    //
+    // Allocate space for a work item.
+    //
+
+    if (NonPaged != FALSE) {
+        NewWorkItem = MmAllocateNonPagedPool(sizeof(WORK_ITEM), AllocationTag);
+
+    } else {
+        NewWorkItem = MmAllocatePagedPool(sizeof(WORK_ITEM), AllocationTag);
+    }
+
+    if (NewWorkItem == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(NewWorkItem, sizeof(WORK_ITEM));
+    NewWorkItem->ReferenceCount = 1;
+
+    //
+    // If the work queue has to support dispatch level, then the work item
+    // needs to as well.
+    //
+
+    if (NonPaged != FALSE) {
+        NewWorkItem->Flags |= WORK_ITEM_FLAG_SUPPORT_DISPATCH_LEVEL;
+    }
+
+    NewWorkItem->Queue = WorkQueue;
+    NewWorkItem->Event = KeCreateEvent(NULL);
+    if (NewWorkItem->Event == NULL) {
+        KepFreeWorkItem(NewWorkItem);
+        return NULL;
+    }
+
+    KeSignalEvent(NewWorkItem->Event, SignalOptionSignalAll);
+    return NewWorkItem;
+}
+
+PWORK_ITEM
+KepGetFreeWorkItem (
+    PWORK_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a work item off of a work queue's free list.
+
+Arguments:
+
+    Queue - Supplies a pointer to the work queue.
+
+Return Value:
+
+    Returns a pointer to the work item with one reference on success.
+
+    NULL if the free list is empty.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+    PWORK_ITEM WorkItem;
+
+    WorkItem = NULL;
+    OldRunLevel = KepAcquireWorkQueueLock(Queue);
+    if (LIST_EMPTY(&(Queue->FreeItemListHead)) == FALSE) {
+        WorkItem = LIST_VALUE(Queue->FreeItemListHead.Next,
+                              WORK_ITEM,
+                              ListEntry);
+
+        LIST_REMOVE(&(WorkItem->ListEntry));
+        WorkItem->ListEntry.Next = NULL;
+        Queue->FreeItemCount -= 1;
+
+    } else {
+        Queue->Allocations += 1;
+    }
+
+    KepReleaseWorkQueueLock(Queue, OldRunLevel);
+    if (WorkItem != NULL) {
+
+        ASSERT(WorkItem->ReferenceCount == 0);
+
+        WorkItem->ReferenceCount = 1;
+    }
+
+    return WorkItem;
+}
+
+BOOL
+KepRecycleWorkItem (
+    PWORK_ITEM WorkItem
+    )
+
+/*++
+
+Routine Description:
+
+    This routine puts a work item whose last reference was just released back
+    on its queue's free list.
+
+Arguments:
+
+    WorkItem - Supplies a pointer to the work item.
+
+Return Value:
+
+    TRUE if the work item was put on the free list.
+
+    FALSE if the free list is full or the queue is going away, in which case
+    the caller should free the work item.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+    PWORK_QUEUE Queue;
+    BOOL Recycled;
+
+    Queue = WorkItem->Queue;
+    if ((Queue->State != WorkQueueStateOpen) &&
+        (Queue->State != WorkQueueStatePaused)) {
+
+        return FALSE;
+    }
+
+    Recycled = FALSE;
+    OldRunLevel = KepAcquireWorkQueueLock(Queue);
+    if (Queue->FreeItemCount < WORK_QUEUE_MAX_FREE_ITEMS) {
+        INSERT_AFTER(&(WorkItem->ListEntry), &(Queue->FreeItemListHead));
+        Queue->FreeItemCount += 1;
+        Recycled = TRUE;
+    }
+
+    KepReleaseWorkQueueLock(Queue, OldRunLevel);
+    return Recycled;
+}
+
+VOID
+KepFreeWorkItem (
+    PWORK_ITEM WorkItem
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a work item's resources and the work item itself.
+
+Arguments:
+
+    WorkItem - Supplies a pointer to the work item.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (WorkItem->Event != NULL) {
+        KeDestroyEvent(WorkItem->Event);
+    }
+
+    if ((WorkItem->Flags & WORK_ITEM_FLAG_SUPPORT_DISPATCH_LEVEL) != 0) {
+        MmFreeNonPagedPool(WorkItem);
+
+    } else {
+        MmFreePagedPool(WorkItem);
     }
 
     return;
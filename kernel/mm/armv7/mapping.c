@@ -152,6 +152,13 @@ BOOL MmMultiprocessingExtensions;
 
 PBLOCK_ALLOCATOR MmPageDirectoryBlockAllocator;
 
+//
+// Large page mappings are not currently supported on ARM, so the large page
+// size is always zero.
+//
+
+ULONG MmLargePageSize;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -819,6 +826,9 @@ Return Value:
 
     ULONG FirstIndex;
     PFIRST_LEVEL_TABLE FirstTable;
+    PADDRESS_SPACE OldAddressSpace;
+    PKTHREAD OldThread;
+    PPROCESSOR_BLOCK ProcessorBlock;
     PADDRESS_SPACE_ARM Space;
 
     Space = (PADDRESS_SPACE_ARM)AddressSpace;
@@ -835,7 +845,28 @@ Return Value:
         MmUpdatePageDirectory(AddressSpace, CurrentStack, PAGE_SIZE);
     }
 
+    ProcessorBlock = Processor;
+    OldThread = ProcessorBlock->RunningThread;
+    OldAddressSpace = OldThread->OwningProcess->AddressSpace;
+    if (OldAddressSpace != AddressSpace) {
+        MmpUpdateActiveProcessors(AddressSpace,
+                                  ProcessorBlock->ProcessorNumber,
+                                  TRUE);
+    }
+
     ArSwitchTtbr0(Space->PageDirectoryPhysical);
+
+    //
+    // Switching TTBR0 invalidated the TLB, so this processor no longer needs
+    // to hear about changes to the old address space.
+    //
+
+    if (OldAddressSpace != AddressSpace) {
+        MmpUpdateActiveProcessors(OldAddressSpace,
+                                  ProcessorBlock->ProcessorNumber,
+                                  FALSE);
+    }
+
     return;
 }
 
@@ -1494,6 +1525,7 @@ Return Value:
 {
 
     PADDRESS_SPACE_ARM AddressSpace;
+    MM_TLB_BATCH Batch;
     BOOL ChangedSomething;
     BOOL CleanInvalidate;
     PVOID CurrentVirtual;
@@ -1546,6 +1578,7 @@ Return Value:
 
     ASSERT(((ULONG)VirtualAddress & PAGE_MASK) == 0);
 
+    MmpInitializeTlbBatch(&Batch, &(AddressSpace->Common));
     CurrentVirtual = VirtualAddress;
 
     //
@@ -1577,6 +1610,7 @@ Return Value:
             if (SecondLevelTable[SecondIndex].Format != SLT_UNMAPPED) {
                 ChangedSomething = TRUE;
                 PageWasPresent = TRUE;
+                MmpAddToTlbBatch(&Batch, CurrentVirtual);
             }
 
             MappedCount += 1;
@@ -1613,16 +1647,15 @@ Return Value:
     }
 
     //
-    // Send the invalidate IPI if requested. Note that the TLB entry
-    // invalidation routine also serializes execution.
+    // Send the invalidate IPI if requested, covering only the pages that
+    // were actually mapped. Note that the TLB entry invalidation routine also
+    // serializes execution.
     //
 
     if ((ChangedSomething != FALSE) &&
         ((UnmapFlags & UNMAP_FLAG_SEND_INVALIDATE_IPI) != 0)) {
 
-        MmpSendTlbInvalidateIpi(&(AddressSpace->Common),
-                                VirtualAddress,
-                                PageCount);
+        MmpFlushTlbBatch(&Batch);
     }
 
     if (PageWasDirty != NULL) {
@@ -1897,6 +1930,48 @@ Return Value:
     return PhysicalAddress;
 }
 
+BOOL
+MmpTestAndClearPageAccessed (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given page has been accessed since the
+    last time this routine was called on it, and clears the accessed state. The
+    TLB is not flushed, so an access that hits a cached translation may go
+    unnoticed until the entry is evicted. Architectures without a hardware
+    accessed flag always return FALSE.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the page is mapped
+        in. This does not need to be the current address space.
+
+    VirtualAddress - Supplies the virtual address of the page to query.
+
+Return Value:
+
+    TRUE if the page is mapped and has been accessed.
+
+    FALSE if the page is not mapped, has not been accessed, or the
+    architecture does not track accesses.
+
+--*/
+
+{
+
+    //
+    // The short descriptor format has no hardware managed access flag, so
+    // every page looks idle and the pager falls back to plain round robin.
+    //
+
+    return FALSE;
+}
+
 VOID
 MmpUnmapPageInOtherProcess (
     PADDRESS_SPACE AddressSpace,
@@ -2291,6 +2366,7 @@ Return Value:
 
     PADDRESS_SPACE_ARM AddressSpace;
     BOOL AllowWrites;
+    MM_TLB_BATCH Batch;
     BOOL ChangedSomething;
     BOOL ChangedSomethingThisRound;
     PVOID CleanEnd;
@@ -2338,6 +2414,7 @@ Return Value:
         }
     }
 
+    MmpInitializeTlbBatch(&Batch, &(AddressSpace->Common));
     Format = SLT_UNMAPPED;
     if ((MapFlags & MAP_FLAG_PRESENT) != 0) {
         if ((MapFlags & MAP_FLAG_EXECUTE) != 0) {
@@ -2451,6 +2528,7 @@ Return Value:
 
             CleanEnd = &(SecondLevelTable[SecondIndex]) + 1;
             ChangedSomething = TRUE;
+            MmpAddToTlbBatch(&Batch, CurrentVirtual - PAGE_SIZE);
         }
     }
 
@@ -2474,9 +2552,7 @@ Return Value:
 
     if (ChangedSomething != FALSE) {
         if (SendInvalidateIpi != FALSE) {
-            MmpSendTlbInvalidateIpi(&(AddressSpace->Common),
-                                    VirtualAddress,
-                                    PageCount);
+            MmpFlushTlbBatch(&Batch);
 
         } else {
             CurrentVirtual = VirtualAddress;
@@ -2595,7 +2671,9 @@ Routine Description:
 
 Arguments:
 
-    Destination - Supplies a pointer to the destination address space.
+    Destination - Supplies an optional pointer to the destination address
+        space. If this is NULL, the source mappings are only converted to
+        read-only and nothing is copied.
 
     Source - Supplies a pointer to the source address space.
 
@@ -2640,7 +2718,11 @@ Return Value:
 
     DestinationSpace = (PADDRESS_SPACE_ARM)Destination;
     SourceSpace = (PADDRESS_SPACE_ARM)Source;
-    DestinationDirectory = DestinationSpace->PageDirectory;
+    DestinationDirectory = NULL;
+    if (DestinationSpace != NULL) {
+        DestinationDirectory = DestinationSpace->PageDirectory;
+    }
+
     SourceDirectory = SourceSpace->PageDirectory;
     VirtualEnd = VirtualAddress + Size;
 
@@ -2704,6 +2786,39 @@ Return Value:
             TableIndexEnd = (SLT_SIZE * 4) / sizeof(SECOND_LEVEL_TABLE);
         }
 
+        //
+        // Without a destination, just convert the source mappings to read-only
+        // as below.
+        //
+
+        if (DestinationDirectory == NULL) {
+            SourceTable = GET_PAGE_TABLE(FirstIndex);
+            for (TableIndex = TableIndexStart;
+                 TableIndex < TableIndexEnd;
+                 TableIndex += 1) {
+
+                if ((SourceTable[TableIndex].Entry != 0) &&
+                    (SourceTable[TableIndex].AccessExtension == 0)) {
+
+                    SourceTable[TableIndex].AccessExtension = 1;
+
+                    ASSERT(SourceTable[TableIndex].Access ==
+                           SLT_ACCESS_USER_FULL);
+
+                    SourceTable[TableIndex].Access =
+                                               SLT_XACCESS_READ_ONLY_ALL_MODES;
+
+                    if (CleanStart == NULL) {
+                        CleanStart = &(SourceTable[TableIndex]);
+                    }
+
+                    CleanEnd = &(SourceTable[TableIndex]);
+                }
+            }
+
+            continue;
+        }
+
         //
         // If the destination has not encountered this first level entry yet,
         // allocate a page table for the destination. Then proceed to copy the
@@ -2991,6 +3106,77 @@ Return Value:
     return;
 }
 
+KSTATUS
+MmpReserveLargePageTable (
+    PADDRESS_SPACE AddressSpace,
+    PPHYSICAL_ADDRESS PageTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the page table that a user mode large page mapping
+    will be split into should it ever need to be.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the large page will
+        be mapped in.
+
+    PageTable - Supplies a pointer where the physical address of the reserved
+        page table will be returned.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always, as large pages are not supported on ARM.
+
+--*/
+
+{
+
+    *PageTable = INVALID_PHYSICAL_ADDRESS;
+    return STATUS_NOT_SUPPORTED;
+}
+
+KSTATUS
+MmpMapLargePage (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PVOID VirtualAddress,
+    ULONG Flags,
+    PHYSICAL_ADDRESS PageTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps a physically contiguous, large page aligned run of
+    physical memory with a single large page mapping.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address to back the mapping with.
+
+    VirtualAddress - Supplies the virtual address to map.
+
+    Flags - Supplies a bitfield of flags governing the options of the mapping.
+        See MAP_FLAG_* definitions.
+
+    PageTable - Supplies the physical address of the page table reserved for
+        splitting this mapping.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED always, as large pages are not supported on ARM.
+
+--*/
+
+{
+
+    return STATUS_NOT_SUPPORTED;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -31,6 +31,7 @@ Module Name:
 function build() {
     base_sources = [
         "block.c",
+        "cswap.c",
         "imgsec.c",
         "info.c",
         "init.c",
@@ -0,0 +1,1344 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    cswap.c
+
+Abstract:
+
+    This module implements the compressed swap tier, an in-memory cache of
+    compressed pages that sits in front of the page files. Pages written out
+    by the pager are compressed into a pool of physical pages and only go to
+    the page file itself when they do not compress well or the pool is full.
+
+Author:
+
+    Evan Green 20-Mar-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "mmp.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define MM_COMPRESSED_SWAP_ALLOCATION_TAG 0x7773436D // 'mCsw'
+
+//
+// Define the kernel command line argument that enables the compressed swap
+// tier. The value is the maximum percentage of physical memory the pool of
+// compressed pages may occupy.
+//
+
+#define MM_KERNEL_ARGUMENT_COMPONENT "mm"
+#define MM_KERNEL_ARGUMENT_COMPRESSED_SWAP "cswap"
+
+#define COMPRESSED_SWAP_MAX_PERCENT 50
+
+//
+// Define the number of hash buckets used to look up stored pages.
+//
+
+#define COMPRESSED_SWAP_HASH_BUCKETS 1024
+
+//
+// Define the number of entry records to provision per pool page. Each pool
+// page holds at most two compressed pages, and the rest cover pages that are
+// filled with a single repeating value, which take no pool space.
+//
+
+#define COMPRESSED_SWAP_ENTRIES_PER_BLOCK 3
+
+//
+// Define how many partially filled pool pages are examined before giving up
+// and starting a new one.
+//
+
+#define COMPRESSED_SWAP_MAX_BLOCK_SEARCH 8
+
+//
+// Define the block index used by entries that do not occupy pool space.
+//
+
+#define COMPRESSED_SWAP_NO_BLOCK ((ULONG)-1)
+
+//
+// Define the parameters of the LZ compression format. The output is a series
+// of groups, each of which starts with a 16-bit little endian control word
+// followed by 16 items. A clear control bit denotes a literal byte, and a set
+// bit denotes a two byte back reference holding a 12-bit distance and a 4-bit
+// length.
+//
+
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_HASH_MULTIPLIER 0x9E3779B1
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 0xF)
+#define LZ_MAX_DISTANCE 0xFFF
+#define LZ_GROUP_SIZE 16
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+#define COMPRESSED_SWAP_HASH(_PageFile, _PageIndex)                     \
+    ((((UINTN)(_PageFile) >> 4) ^ (_PageIndex)) &                       \
+     (COMPRESSED_SWAP_HASH_BUCKETS - 1))
+
+#define COMPRESSED_SWAP_BLOCK_ADDRESS(_BlockIndex)                      \
+    (MmCompressedSwapPoolBase + ((UINTN)(_BlockIndex) << MmPageShift()))
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure describes one page of the compressed pool. A pool page
+    holds up to two compressed pages, one packed against the start and one
+    packed against the end.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous blocks on either the
+        free block list or the partially filled block list.
+
+    FirstSize - Stores the size of the compressed data at the start of the
+        page, or zero if that slot is free.
+
+    LastSize - Stores the size of the compressed data at the end of the page,
+        or zero if that slot is free.
+
+--*/
+
+typedef struct _COMPRESSED_SWAP_BLOCK {
+    LIST_ENTRY ListEntry;
+    USHORT FirstSize;
+    USHORT LastSize;
+} COMPRESSED_SWAP_BLOCK, *PCOMPRESSED_SWAP_BLOCK;
+
+/*++
+
+Structure Description:
+
+    This structure describes one page held by the compressed swap tier.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous entries in the hash
+        bucket, or in the free entry list.
+
+    PageFile - Stores the page file the page belongs to.
+
+    PageIndex - Stores the index of the page within the page file.
+
+    Block - Stores the index of the pool page holding the compressed data, or
+        COMPRESSED_SWAP_NO_BLOCK if the page is filled with a single value.
+
+    Size - Stores the size of the compressed data in bytes.
+
+    Last - Stores a boolean indicating whether the data occupies the slot at
+        the end of the pool page rather than the start.
+
+    FillValue - Stores the repeating value for pages that do not occupy a
+        block.
+
+--*/
+
+typedef struct _COMPRESSED_SWAP_ENTRY {
+    LIST_ENTRY ListEntry;
+    HANDLE PageFile;
+    UINTN PageIndex;
+    ULONG Block;
+    USHORT Size;
+    BOOL Last;
+    ULONG FillValue;
+} COMPRESSED_SWAP_ENTRY, *PCOMPRESSED_SWAP_ENTRY;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PCOMPRESSED_SWAP_ENTRY
+MmpFindCompressedPage (
+    HANDLE PageFile,
+    UINTN PageIndex
+    );
+
+VOID
+MmpReleaseCompressedPage (
+    PCOMPRESSED_SWAP_ENTRY Entry
+    );
+
+BOOL
+MmpPlaceCompressedData (
+    PCOMPRESSED_SWAP_ENTRY Entry,
+    PVOID Data,
+    ULONG Size
+    );
+
+BOOL
+MmpIsPageSameFilled (
+    PVOID Page,
+    PULONG FillValue
+    );
+
+ULONG
+MmpLzCompress (
+    PUCHAR Input,
+    ULONG InputSize,
+    PUCHAR Output,
+    ULONG OutputLimit,
+    PUSHORT HashTable
+    );
+
+BOOL
+MmpLzDecompress (
+    PUCHAR Input,
+    ULONG InputSize,
+    PUCHAR Output,
+    ULONG OutputSize
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the maximum percentage of physical memory the compressed pool may
+// use. Zero disables the compressed swap tier. This can be set from the
+// kernel command line with mm.cswap=<percent>.
+//
+
+ULONG MmCompressedSwapPercent = 0;
+
+//
+// Store the lock that protects all compressed swap state.
+//
+
+PQUEUED_LOCK MmCompressedSwapLock;
+
+//
+// Store the region of kernel VA the pool pages are mapped into, and the
+// bookkeeping for each page of it. Pool pages are only backed by physical
+// memory while they hold data.
+//
+
+PVOID MmCompressedSwapPoolBase;
+PCOMPRESSED_SWAP_BLOCK MmCompressedSwapBlocks;
+ULONG MmCompressedSwapBlockCount;
+LIST_ENTRY MmCompressedSwapFreeBlocks;
+LIST_ENTRY MmCompressedSwapPartialBlocks;
+
+//
+// Store the hash table of stored pages and the preallocated entry records.
+//
+
+PLIST_ENTRY MmCompressedSwapHash;
+PCOMPRESSED_SWAP_ENTRY MmCompressedSwapEntries;
+LIST_ENTRY MmCompressedSwapFreeEntries;
+
+//
+// Store the scratch space used for compressing a page. The pager is the only
+// thread that compresses, but the lock protects these anyway.
+//
+
+PUCHAR MmCompressedSwapScratch;
+PUSHORT MmCompressedSwapLzHash;
+
+//
+// Store the running statistics.
+//
+
+MM_COMPRESSED_SWAP_STATISTICS MmCompressedSwapStatistics;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+MmpInitializeCompressedSwap (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes the compressed swap tier if it has been enabled
+    and has not yet been initialized. It is called when a page file arrives.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    STATUS_SUCCESS if the tier was initialized, was already initialized, or
+    is not enabled.
+
+    Other error codes on failure, in which case the tier stays disabled.
+
+--*/
+
+{
+
+    PKERNEL_ARGUMENT Argument;
+    ULONG BlockCount;
+    ULONG BlockIndex;
+    ULONG EntryCount;
+    ULONG EntryIndex;
+    ULONG HashIndex;
+    ULONG PageSize;
+    UINTN PoolSize;
+    BOOL RangeAllocated;
+    UINTN Size;
+    KSTATUS Status;
+    PCSTR String;
+    ULONG StringSize;
+    LONGLONG Value;
+    VM_ALLOCATION_PARAMETERS VaRequest;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if (MmCompressedSwapBlockCount != 0) {
+        return STATUS_SUCCESS;
+    }
+
+    PageSize = MmPageSize();
+    RangeAllocated = FALSE;
+    Argument = KeGetKernelArgument(NULL,
+                                   MM_KERNEL_ARGUMENT_COMPONENT,
+                                   MM_KERNEL_ARGUMENT_COMPRESSED_SWAP);
+
+    if ((Argument != NULL) && (Argument->ValueCount != 0)) {
+        String = Argument->Values[0];
+        StringSize = RtlStringLength(String) + 1;
+        Status = RtlStringScanInteger(&String, &StringSize, 10, FALSE, &Value);
+        if ((KSUCCESS(Status)) && (Value >= 0)) {
+            MmCompressedSwapPercent = (ULONG)Value;
+        }
+    }
+
+    if (MmCompressedSwapPercent == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    if (MmCompressedSwapPercent > COMPRESSED_SWAP_MAX_PERCENT) {
+        MmCompressedSwapPercent = COMPRESSED_SWAP_MAX_PERCENT;
+    }
+
+    BlockCount = (MmGetTotalPhysicalPages() * MmCompressedSwapPercent) / 100;
+    if (BlockCount == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    EntryCount = BlockCount * COMPRESSED_SWAP_ENTRIES_PER_BLOCK;
+    MmCompressedSwapLock = KeCreateQueuedLock();
+    if (MmCompressedSwapLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializeCompressedSwapEnd;
+    }
+
+    Size = BlockCount * sizeof(COMPRESSED_SWAP_BLOCK);
+    MmCompressedSwapBlocks = MmAllocateNonPagedPool(Size,
+                                             MM_COMPRESSED_SWAP_ALLOCATION_TAG);
+
+    Size = EntryCount * sizeof(COMPRESSED_SWAP_ENTRY);
+    MmCompressedSwapEntries = MmAllocateNonPagedPool(
+                                             Size,
+                                             MM_COMPRESSED_SWAP_ALLOCATION_TAG);
+
+    Size = COMPRESSED_SWAP_HASH_BUCKETS * sizeof(LIST_ENTRY);
+    MmCompressedSwapHash = MmAllocateNonPagedPool(
+                                             Size,
+                                             MM_COMPRESSED_SWAP_ALLOCATION_TAG);
+
+    MmCompressedSwapScratch = MmAllocateNonPagedPool(
+                                             PageSize,
+                                             MM_COMPRESSED_SWAP_ALLOCATION_TAG);
+
+    Size = LZ_HASH_SIZE * sizeof(USHORT);
+    MmCompressedSwapLzHash = MmAllocateNonPagedPool(
+                                             Size,
+                                             MM_COMPRESSED_SWAP_ALLOCATION_TAG);
+
+    if ((MmCompressedSwapBlocks == NULL) ||
+        (MmCompressedSwapEntries == NULL) ||
+        (MmCompressedSwapHash == NULL) ||
+        (MmCompressedSwapScratch == NULL) ||
+        (MmCompressedSwapLzHash == NULL)) {
+
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializeCompressedSwapEnd;
+    }
+
+    //
+    // Reserve the VA for the whole pool up front and create its page tables
+    // now. The pager cannot wait for memory, so mapping a pool page later
+    // must not need to allocate anything.
+    //
+
+    PoolSize = (UINTN)BlockCount * PageSize;
+    VaRequest.Address = NULL;
+    VaRequest.Size = PoolSize;
+    VaRequest.Alignment = PageSize;
+    VaRequest.Min = 0;
+    VaRequest.Max = MAX_ADDRESS;
+    VaRequest.MemoryType = MemoryTypeReserved;
+    VaRequest.Strategy = AllocationStrategyAnyAddress;
+    Status = MmpAllocateAddressRange(&MmKernelVirtualSpace, &VaRequest, FALSE);
+    if (!KSUCCESS(Status)) {
+        goto InitializeCompressedSwapEnd;
+    }
+
+    RangeAllocated = TRUE;
+    MmCompressedSwapPoolBase = VaRequest.Address;
+    MmpCreatePageTables(MmCompressedSwapPoolBase, PoolSize);
+    INITIALIZE_LIST_HEAD(&MmCompressedSwapFreeBlocks);
+    INITIALIZE_LIST_HEAD(&MmCompressedSwapPartialBlocks);
+    for (BlockIndex = 0; BlockIndex < BlockCount; BlockIndex += 1) {
+        MmCompressedSwapBlocks[BlockIndex].FirstSize = 0;
+        MmCompressedSwapBlocks[BlockIndex].LastSize = 0;
+        INSERT_BEFORE(&(MmCompressedSwapBlocks[BlockIndex].ListEntry),
+                      &MmCompressedSwapFreeBlocks);
+    }
+
+    INITIALIZE_LIST_HEAD(&MmCompressedSwapFreeEntries);
+    for (EntryIndex = 0; EntryIndex < EntryCount; EntryIndex += 1) {
+        INSERT_BEFORE(&(MmCompressedSwapEntries[EntryIndex].ListEntry),
+                      &MmCompressedSwapFreeEntries);
+    }
+
+    for (HashIndex = 0;
+         HashIndex < COMPRESSED_SWAP_HASH_BUCKETS;
+         HashIndex += 1) {
+
+        INITIALIZE_LIST_HEAD(&(MmCompressedSwapHash[HashIndex]));
+    }
+
+    RtlZeroMemory(&MmCompressedSwapStatistics,
+                  sizeof(MM_COMPRESSED_SWAP_STATISTICS));
+
+    MmCompressedSwapStatistics.MaxPoolPages = BlockCount;
+
+    //
+    // Setting the block count is what turns the tier on.
+    //
+
+    RtlMemoryBarrier();
+    MmCompressedSwapBlockCount = BlockCount;
+    Status = STATUS_SUCCESS;
+
+InitializeCompressedSwapEnd:
+    if (!KSUCCESS(Status)) {
+        if (RangeAllocated != FALSE) {
+            MmpFreeAccountingRange(NULL,
+                                   MmCompressedSwapPoolBase,
+                                   PoolSize,
+                                   FALSE,
+                                   0);
+
+            MmCompressedSwapPoolBase = NULL;
+        }
+
+        if (MmCompressedSwapBlocks != NULL) {
+            MmFreeNonPagedPool(MmCompressedSwapBlocks);
+            MmCompressedSwapBlocks = NULL;
+        }
+
+        if (MmCompressedSwapEntries != NULL) {
+            MmFreeNonPagedPool(MmCompressedSwapEntries);
+            MmCompressedSwapEntries = NULL;
+        }
+
+        if (MmCompressedSwapHash != NULL) {
+            MmFreeNonPagedPool(MmCompressedSwapHash);
+            MmCompressedSwapHash = NULL;
+        }
+
+        if (MmCompressedSwapScratch != NULL) {
+            MmFreeNonPagedPool(MmCompressedSwapScratch);
+            MmCompressedSwapScratch = NULL;
+        }
+
+        if (MmCompressedSwapLzHash != NULL) {
+            MmFreeNonPagedPool(MmCompressedSwapLzHash);
+            MmCompressedSwapLzHash = NULL;
+        }
+
+        if (MmCompressedSwapLock != NULL) {
+            KeDestroyQueuedLock(MmCompressedSwapLock);
+            MmCompressedSwapLock = NULL;
+        }
+    }
+
+    return Status;
+}
+
+KSTATUS
+MmpStoreCompressedPage (
+    HANDLE PageFile,
+    UINTN PageIndex,
+    PVOID Page
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to store a page destined for the page file in the
+    compressed pool instead. Any previously stored copy of the same page file
+    page is discarded whether or not this succeeds, so on failure the caller
+    must write the page to the page file.
+
+Arguments:
+
+    PageFile - Supplies the page file the page is being written to.
+
+    PageIndex - Supplies the index of the page within the page file.
+
+    Page - Supplies a pointer to the mapped page contents.
+
+Return Value:
+
+    STATUS_SUCCESS if the page was stored.
+
+    STATUS_NOT_SUPPORTED if the compressed swap tier is disabled.
+
+    STATUS_INSUFFICIENT_RESOURCES if the page did not compress well enough or
+    the pool is full.
+
+--*/
+
+{
+
+    ULONG CompressedSize;
+    PCOMPRESSED_SWAP_ENTRY Entry;
+    ULONG FillValue;
+    ULONG Limit;
+    BOOL Placed;
+    ULONG PageSize;
+    BOOL SameFilled;
+    KSTATUS Status;
+
+    if (MmCompressedSwapBlockCount == 0) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    PageSize = MmPageSize();
+    KeAcquireQueuedLock(MmCompressedSwapLock);
+    Entry = MmpFindCompressedPage(PageFile, PageIndex);
+    if (Entry != NULL) {
+        MmpReleaseCompressedPage(Entry);
+    }
+
+    if (LIST_EMPTY(&MmCompressedSwapFreeEntries) != FALSE) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto StoreCompressedPageEnd;
+    }
+
+    Entry = LIST_VALUE(MmCompressedSwapFreeEntries.Next,
+                       COMPRESSED_SWAP_ENTRY,
+                       ListEntry);
+
+    Entry->PageFile = PageFile;
+    Entry->PageIndex = PageIndex;
+    Entry->Block = COMPRESSED_SWAP_NO_BLOCK;
+    Entry->Size = 0;
+    Entry->Last = FALSE;
+    Entry->FillValue = 0;
+
+    //
+    // Pages filled with a single value (most often zero) are common and are
+    // stored without using any pool space at all.
+    //
+
+    SameFilled = MmpIsPageSameFilled(Page, &FillValue);
+    if (SameFilled != FALSE) {
+        Entry->FillValue = FillValue;
+
+    } else {
+
+        //
+        // Only keep pages that save at least a quarter of their size. Pages
+        // that barely compress are better off in the page file.
+        //
+
+        Limit = PageSize - (PageSize / 4);
+        CompressedSize = MmpLzCompress(Page,
+                                       PageSize,
+                                       MmCompressedSwapScratch,
+                                       Limit,
+                                       MmCompressedSwapLzHash);
+
+        if (CompressedSize == 0) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto StoreCompressedPageEnd;
+        }
+
+        Placed = MmpPlaceCompressedData(Entry,
+                                        MmCompressedSwapScratch,
+                                        CompressedSize);
+
+        if (Placed == FALSE) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto StoreCompressedPageEnd;
+        }
+    }
+
+    LIST_REMOVE(&(Entry->ListEntry));
+    INSERT_AFTER(&(Entry->ListEntry),
+                 &(MmCompressedSwapHash[COMPRESSED_SWAP_HASH(PageFile,
+                                                             PageIndex)]));
+
+    MmCompressedSwapStatistics.StoredPages += 1;
+    MmCompressedSwapStatistics.CompressedBytes += Entry->Size;
+    MmCompressedSwapStatistics.Stores += 1;
+    Status = STATUS_SUCCESS;
+
+StoreCompressedPageEnd:
+    if (!KSUCCESS(Status)) {
+        MmCompressedSwapStatistics.Rejects += 1;
+    }
+
+    KeReleaseQueuedLock(MmCompressedSwapLock);
+    return Status;
+}
+
+KSTATUS
+MmpLoadCompressedPage (
+    HANDLE PageFile,
+    UINTN PageIndex,
+    PVOID Page
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to satisfy a page file read from the compressed
+    pool. The stored copy is kept, as the caller may still fail to map the
+    page. It is discarded once the page is mapped.
+
+Arguments:
+
+    PageFile - Supplies the page file being read.
+
+    PageIndex - Supplies the index of the page within the page file.
+
+    Page - Supplies a pointer to the mapped page to fill in.
+
+Return Value:
+
+    STATUS_SUCCESS if the page was filled in from the compressed pool.
+
+    STATUS_NOT_FOUND if the page is not held by the compressed pool and must
+    be read from the page file.
+
+    STATUS_DATA_LENGTH_MISMATCH if the stored data is corrupt.
+
+--*/
+
+{
+
+    PVOID Data;
+    BOOL Decompressed;
+    PCOMPRESSED_SWAP_ENTRY Entry;
+    ULONG Index;
+    ULONG PageSize;
+    KSTATUS Status;
+    PULONG Words;
+
+    if (MmCompressedSwapBlockCount == 0) {
+        return STATUS_NOT_FOUND;
+    }
+
+    PageSize = MmPageSize();
+    KeAcquireQueuedLock(MmCompressedSwapLock);
+    Entry = MmpFindCompressedPage(PageFile, PageIndex);
+    if (Entry == NULL) {
+        MmCompressedSwapStatistics.Misses += 1;
+        Status = STATUS_NOT_FOUND;
+        goto LoadCompressedPageEnd;
+    }
+
+    if (Entry->Block == COMPRESSED_SWAP_NO_BLOCK) {
+        Words = Page;
+        for (Index = 0; Index < PageSize / sizeof(ULONG); Index += 1) {
+            Words[Index] = Entry->FillValue;
+        }
+
+    } else {
+        Data = COMPRESSED_SWAP_BLOCK_ADDRESS(Entry->Block);
+        if (Entry->Last != FALSE) {
+            Data += PageSize - Entry->Size;
+        }
+
+        Decompressed = MmpLzDecompress(Data, Entry->Size, Page, PageSize);
+        if (Decompressed == FALSE) {
+
+            ASSERT(FALSE);
+
+            Status = STATUS_DATA_LENGTH_MISMATCH;
+            goto LoadCompressedPageEnd;
+        }
+    }
+
+    MmCompressedSwapStatistics.Loads += 1;
+    Status = STATUS_SUCCESS;
+
+LoadCompressedPageEnd:
+    KeReleaseQueuedLock(MmCompressedSwapLock);
+    return Status;
+}
+
+VOID
+MmpDiscardCompressedPages (
+    HANDLE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards any compressed copies of the given range of page
+    file pages.
+
+Arguments:
+
+    PageFile - Supplies the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to discard.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCOMPRESSED_SWAP_ENTRY Entry;
+    UINTN Index;
+
+    if ((MmCompressedSwapBlockCount == 0) ||
+        (MmCompressedSwapStatistics.StoredPages == 0)) {
+
+        return;
+    }
+
+    KeAcquireQueuedLock(MmCompressedSwapLock);
+    for (Index = PageIndex; Index < PageIndex + PageCount; Index += 1) {
+        if (MmCompressedSwapStatistics.StoredPages == 0) {
+            break;
+        }
+
+        Entry = MmpFindCompressedPage(PageFile, Index);
+        if (Entry != NULL) {
+            MmpReleaseCompressedPage(Entry);
+        }
+    }
+
+    KeReleaseQueuedLock(MmCompressedSwapLock);
+    return;
+}
+
+VOID
+MmpGetCompressedSwapStatistics (
+    PMM_COMPRESSED_SWAP_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the compressed swap tier statistics.
+
+Arguments:
+
+    Statistics - Supplies a pointer where the statistics will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (MmCompressedSwapBlockCount == 0) {
+        RtlZeroMemory(Statistics, sizeof(MM_COMPRESSED_SWAP_STATISTICS));
+        return;
+    }
+
+    KeAcquireQueuedLock(MmCompressedSwapLock);
+    RtlCopyMemory(Statistics,
+                  &MmCompressedSwapStatistics,
+                  sizeof(MM_COMPRESSED_SWAP_STATISTICS));
+
+    KeReleaseQueuedLock(MmCompressedSwapLock);
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PCOMPRESSED_SWAP_ENTRY
+MmpFindCompressedPage (
+    HANDLE PageFile,
+    UINTN PageIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up a stored page. The compressed swap lock must be
+    held.
+
+Arguments:
+
+    PageFile - Supplies the page file the page belongs to.
+
+    PageIndex - Supplies the index of the page within the page file.
+
+Return Value:
+
+    Returns a pointer to the entry on success.
+
+    NULL if the page is not stored.
+
+--*/
+
+{
+
+    PLIST_ENTRY Bucket;
+    PLIST_ENTRY CurrentEntry;
+    PCOMPRESSED_SWAP_ENTRY Entry;
+
+    ASSERT(KeIsQueuedLockHeld(MmCompressedSwapLock) != FALSE);
+
+    Bucket = &(MmCompressedSwapHash[COMPRESSED_SWAP_HASH(PageFile, PageIndex)]);
+    CurrentEntry = Bucket->Next;
+    while (CurrentEntry != Bucket) {
+        Entry = LIST_VALUE(CurrentEntry, COMPRESSED_SWAP_ENTRY, ListEntry);
+        if ((Entry->PageIndex == PageIndex) && (Entry->PageFile == PageFile)) {
+            return Entry;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
+VOID
+MmpReleaseCompressedPage (
+    PCOMPRESSED_SWAP_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a stored page, releasing its pool space. A pool page
+    that becomes empty is unmapped and its physical page freed. The compressed
+    swap lock must be held.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCOMPRESSED_SWAP_BLOCK Block;
+    BOOL WasFull;
+
+    ASSERT(KeIsQueuedLockHeld(MmCompressedSwapLock) != FALSE);
+
+    if (Entry->Block != COMPRESSED_SWAP_NO_BLOCK) {
+        Block = &(MmCompressedSwapBlocks[Entry->Block]);
+        WasFull = FALSE;
+        if ((Block->FirstSize != 0) && (Block->LastSize != 0)) {
+            WasFull = TRUE;
+        }
+
+        if (Entry->Last != FALSE) {
+            Block->LastSize = 0;
+
+        } else {
+            Block->FirstSize = 0;
+        }
+
+        if ((Block->FirstSize == 0) && (Block->LastSize == 0)) {
+            if (WasFull == FALSE) {
+                LIST_REMOVE(&(Block->ListEntry));
+            }
+
+            MmpUnmapPages(COMPRESSED_SWAP_BLOCK_ADDRESS(Entry->Block),
+                          1,
+                          (UNMAP_FLAG_FREE_PHYSICAL_PAGES |
+                           UNMAP_FLAG_SEND_INVALIDATE_IPI),
+                          NULL);
+
+            INSERT_BEFORE(&(Block->ListEntry), &MmCompressedSwapFreeBlocks);
+            MmCompressedSwapStatistics.PoolPages -= 1;
+
+        } else if (WasFull != FALSE) {
+            INSERT_AFTER(&(Block->ListEntry), &MmCompressedSwapPartialBlocks);
+        }
+    }
+
+    MmCompressedSwapStatistics.StoredPages -= 1;
+    MmCompressedSwapStatistics.CompressedBytes -= Entry->Size;
+    LIST_REMOVE(&(Entry->ListEntry));
+    INSERT_BEFORE(&(Entry->ListEntry), &MmCompressedSwapFreeEntries);
+    return;
+}
+
+BOOL
+MmpPlaceCompressedData (
+    PCOMPRESSED_SWAP_ENTRY Entry,
+    PVOID Data,
+    ULONG Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds room in the pool for compressed data and copies it
+    there. Partially filled pool pages are tried first, and a new pool page
+    is brought in if none of them fit. The compressed swap lock must be held.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry the data belongs to. The block,
+        size and slot are filled in on success.
+
+    Data - Supplies a pointer to the compressed data.
+
+    Size - Supplies the size of the compressed data in bytes.
+
+Return Value:
+
+    TRUE if the data was placed.
+
+    FALSE if the pool is full.
+
+--*/
+
+{
+
+    PCOMPRESSED_SWAP_BLOCK Block;
+    PVOID BlockAddress;
+    ULONG BlockIndex;
+    PLIST_ENTRY CurrentEntry;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG Searched;
+
+    ASSERT(KeIsQueuedLockHeld(MmCompressedSwapLock) != FALSE);
+
+    PageSize = MmPageSize();
+    Block = NULL;
+    Searched = 0;
+    CurrentEntry = MmCompressedSwapPartialBlocks.Next;
+    while ((CurrentEntry != &MmCompressedSwapPartialBlocks) &&
+           (Searched < COMPRESSED_SWAP_MAX_BLOCK_SEARCH)) {
+
+        Block = LIST_VALUE(CurrentEntry, COMPRESSED_SWAP_BLOCK, ListEntry);
+        if (PageSize - Block->FirstSize - Block->LastSize >= Size) {
+            break;
+        }
+
+        Block = NULL;
+        Searched += 1;
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    //
+    // Fill the empty slot of a partially used page, which makes it full.
+    //
+
+    if (Block != NULL) {
+        LIST_REMOVE(&(Block->ListEntry));
+        BlockIndex = Block - MmCompressedSwapBlocks;
+        BlockAddress = COMPRESSED_SWAP_BLOCK_ADDRESS(BlockIndex);
+        if (Block->FirstSize == 0) {
+            Block->FirstSize = Size;
+            Entry->Last = FALSE;
+
+        } else {
+
+            ASSERT(Block->LastSize == 0);
+
+            Block->LastSize = Size;
+            BlockAddress += PageSize - Size;
+            Entry->Last = TRUE;
+        }
+
+    //
+    // Otherwise bring in a new pool page. The pager is freeing more memory
+    // than this takes, so it is allowed to dip into the reserve.
+    //
+
+    } else {
+        if (LIST_EMPTY(&MmCompressedSwapFreeBlocks) != FALSE) {
+            return FALSE;
+        }
+
+        PhysicalAddress = MmpTryToAllocatePhysicalPages(1, 1, TRUE);
+        if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+            return FALSE;
+        }
+
+        Block = LIST_VALUE(MmCompressedSwapFreeBlocks.Next,
+                           COMPRESSED_SWAP_BLOCK,
+                           ListEntry);
+
+        LIST_REMOVE(&(Block->ListEntry));
+        BlockIndex = Block - MmCompressedSwapBlocks;
+        BlockAddress = COMPRESSED_SWAP_BLOCK_ADDRESS(BlockIndex);
+        MmpMapPage(PhysicalAddress,
+                   BlockAddress,
+                   MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL);
+
+        Block->FirstSize = Size;
+        Block->LastSize = 0;
+        INSERT_AFTER(&(Block->ListEntry), &MmCompressedSwapPartialBlocks);
+        Entry->Last = FALSE;
+        MmCompressedSwapStatistics.PoolPages += 1;
+    }
+
+    RtlCopyMemory(BlockAddress, Data, Size);
+    Entry->Block = BlockIndex;
+    Entry->Size = Size;
+    return TRUE;
+}
+
+BOOL
+MmpIsPageSameFilled (
+    PVOID Page,
+    PULONG FillValue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a page consists of a single repeating
+    32-bit value.
+
+Arguments:
+
+    Page - Supplies a pointer to the page.
+
+    FillValue - Supplies a pointer where the repeating value is returned.
+
+Return Value:
+
+    TRUE if the page is filled with a single value.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    ULONG Count;
+    ULONG Index;
+    PULONG Words;
+
+    Words = Page;
+    Count = MmPageSize() / sizeof(ULONG);
+    for (Index = 1; Index < Count; Index += 1) {
+        if (Words[Index] != Words[0]) {
+            return FALSE;
+        }
+    }
+
+    *FillValue = Words[0];
+    return TRUE;
+}
+
+ULONG
+MmpLzCompress (
+    PUCHAR Input,
+    ULONG InputSize,
+    PUCHAR Output,
+    ULONG OutputLimit,
+    PUSHORT HashTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compresses a buffer using a simple, fast LZ77 variant.
+    Three-byte sequences are hashed to find the most recent earlier
+    occurrence, which is extended into a back reference if it matches.
+
+Arguments:
+
+    Input - Supplies a pointer to the data to compress.
+
+    InputSize - Supplies the size of the input in bytes. This must not exceed
+        64kB.
+
+    Output - Supplies a pointer where the compressed data will be written.
+
+    OutputLimit - Supplies the size of the output buffer. Compression is
+        abandoned if the output would not fit.
+
+    HashTable - Supplies a pointer to scratch space for LZ_HASH_SIZE hash
+        entries.
+
+Return Value:
+
+    Returns the size of the compressed data in bytes.
+
+    0 if the data did not fit in the output buffer.
+
+--*/
+
+{
+
+    ULONG Candidate;
+    USHORT Control;
+    ULONG ControlCount;
+    PUCHAR ControlWord;
+    ULONG Distance;
+    ULONG Hash;
+    PUCHAR In;
+    PUCHAR InEnd;
+    ULONG Length;
+    PUCHAR Match;
+    ULONG MaxLength;
+    PUCHAR Out;
+    PUCHAR OutEnd;
+
+    ASSERT(InputSize <= MAX_USHORT);
+
+    RtlZeroMemory(HashTable, LZ_HASH_SIZE * sizeof(USHORT));
+    In = Input;
+    InEnd = Input + InputSize;
+    Out = Output;
+    OutEnd = Output + OutputLimit;
+    Control = 0;
+    ControlCount = 0;
+    if (Out + sizeof(USHORT) > OutEnd) {
+        return 0;
+    }
+
+    ControlWord = Out;
+    Out += sizeof(USHORT);
+    while (In < InEnd) {
+        if (ControlCount == LZ_GROUP_SIZE) {
+            ControlWord[0] = (UCHAR)Control;
+            ControlWord[1] = (UCHAR)(Control >> 8);
+            if (Out + sizeof(USHORT) > OutEnd) {
+                return 0;
+            }
+
+            ControlWord = Out;
+            Out += sizeof(USHORT);
+            Control = 0;
+            ControlCount = 0;
+        }
+
+        Length = 0;
+        Distance = 0;
+        if (InEnd - In >= LZ_MIN_MATCH) {
+            Hash = ((ULONG)In[0] << 16) | ((ULONG)In[1] << 8) | In[2];
+            Hash = (Hash * LZ_HASH_MULTIPLIER) >> (32 - LZ_HASH_BITS);
+
+            //
+            // Hash entries store the position plus one so that zero means
+            // empty.
+            //
+
+            Candidate = HashTable[Hash];
+            HashTable[Hash] = (USHORT)(In - Input + 1);
+            if (Candidate != 0) {
+                Match = Input + Candidate - 1;
+                Distance = In - Match;
+                if (Distance <= LZ_MAX_DISTANCE) {
+                    MaxLength = InEnd - In;
+                    if (MaxLength > LZ_MAX_MATCH) {
+                        MaxLength = LZ_MAX_MATCH;
+                    }
+
+                    while ((Length < MaxLength) &&
+                           (Match[Length] == In[Length])) {
+
+                        Length += 1;
+                    }
+                }
+            }
+        }
+
+        if (Length >= LZ_MIN_MATCH) {
+            if (Out + 2 > OutEnd) {
+                return 0;
+            }
+
+            Out[0] = (UCHAR)(Distance >> 4);
+            Out[1] = (UCHAR)(((Distance & 0xF) << 4) | (Length - LZ_MIN_MATCH));
+            Out += 2;
+            Control |= 1 << ControlCount;
+            In += Length;
+
+        } else {
+            if (Out >= OutEnd) {
+                return 0;
+            }
+
+            *Out = *In;
+            Out += 1;
+            In += 1;
+        }
+
+        ControlCount += 1;
+    }
+
+    ControlWord[0] = (UCHAR)Control;
+    ControlWord[1] = (UCHAR)(Control >> 8);
+    return Out - Output;
+}
+
+BOOL
+MmpLzDecompress (
+    PUCHAR Input,
+    ULONG InputSize,
+    PUCHAR Output,
+    ULONG OutputSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine decompresses data produced by the LZ compressor.
+
+Arguments:
+
+    Input - Supplies a pointer to the compressed data.
+
+    InputSize - Supplies the size of the compressed data in bytes.
+
+    Output - Supplies a pointer where the decompressed data will be written.
+
+    OutputSize - Supplies the expected size of the decompressed data.
+
+Return Value:
+
+    TRUE if the data decompressed to exactly the expected size.
+
+    FALSE if the compressed data is malformed.
+
+--*/
+
+{
+
+    USHORT Control;
+    ULONG ControlCount;
+    ULONG Distance;
+    PUCHAR In;
+    PUCHAR InEnd;
+    ULONG Length;
+    PUCHAR Out;
+    PUCHAR OutEnd;
+
+    In = Input;
+    InEnd = Input + InputSize;
+    Out = Output;
+    OutEnd = Output + OutputSize;
+    Control = 0;
+    ControlCount = 0;
+    while (Out < OutEnd) {
+        if (ControlCount == 0) {
+            if (In + sizeof(USHORT) > InEnd) {
+                return FALSE;
+            }
+
+            Control = In[0] | ((USHORT)In[1] << 8);
+            In += sizeof(USHORT);
+            ControlCount = LZ_GROUP_SIZE;
+        }
+
+        if ((Control & 0x1) != 0) {
+            if (In + 2 > InEnd) {
+                return FALSE;
+            }
+
+            Distance = ((ULONG)In[0] << 4) | (In[1] >> 4);
+            Length = (In[1] & 0xF) + LZ_MIN_MATCH;
+            In += 2;
+            if ((Distance == 0) ||
+                (Distance > (ULONG)(Out - Output)) ||
+                (Length > (ULONG)(OutEnd - Out))) {
+
+                return FALSE;
+            }
+
+            //
+            // Copy a byte at a time, as the source may overlap the
+            // destination for runs.
+            //
+
+            while (Length != 0) {
+                *Out = *(Out - Distance);
+                Out += 1;
+                Length -= 1;
+            }
+
+        } else {
+            if (In >= InEnd) {
+                return FALSE;
+            }
+
+            *Out = *In;
+            Out += 1;
+            In += 1;
+        }
+
+        Control >>= 1;
+        ControlCount -= 1;
+    }
+
+    return TRUE;
+}
+
@@ -98,6 +98,7 @@ Return Value:
     PKPROCESS KernelProcess;
     UINTN PageOffset;
     PKPROCESS Process;
+    ULONGLONG StartTime;
     KSTATUS Status;
     PKTHREAD Thread;
 
@@ -151,6 +152,11 @@ Return Value:
     ASSERT(Thread->OwningProcess != NULL);
 
     Thread->ResourceUsage.PageFaults += 1;
+    StartTime = 0;
+    if (SpIsTraceEnabled(SP_TRACE_FLAG_MEMORY)) {
+        StartTime = HlQueryTimeCounter();
+    }
+
     CurrentProcess = Thread->OwningProcess;
     KernelProcess = PsGetKernelProcess();
     if ((ArIsTrapFrameFromPrivilegedMode(TrapFrame) != FALSE) &&
@@ -326,6 +332,20 @@ Return Value:
         MmpImageSectionReleaseReference(ImageSection);
     }
 
+    //
+    // Skip the event if tracing was turned on partway through the fault, as
+    // there is no start time to report.
+    //
+
+    if (StartTime != 0) {
+        SpTraceEvent(SP_TRACE_FLAG_MEMORY,
+                     SpTraceEventPageFault,
+                     FaultFlags,
+                     (UINTN)FaultingAddress,
+                     (UINTN)ArGetInstructionPointer(TrapFrame),
+                     StartTime);
+    }
+
     //
     // Check for any signals that may have cropped up while handling the fault
     // (such as perhaps a segmentation fault signal).
@@ -126,13 +126,6 @@ MmpUnmapImageSection (
     ULONG Flags
     );
 
-BOOL
-MmpIsImageSectionMapped (
-    PIMAGE_SECTION Section,
-    ULONG PageOffset,
-    PPHYSICAL_ADDRESS PhysicalAddress
-    );
-
 VOID
 MmpDestroyImageSectionMappings (
     PIMAGE_SECTION Section
@@ -148,6 +141,15 @@ MmpDestroyImageSectionMappings (
 
 PADDRESS_SPACE MmKernelAddressSpace;
 
+//
+// Set this to populate the mappings of a forked child lazily. The parent's
+// mappings are only made read-only at fork, and the child shares the resident
+// pages it inherits as it faults on them. Clear it to copy every mapping into
+// the child up front.
+//
+
+BOOL MmLazyForkMappings = TRUE;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -1199,6 +1201,7 @@ Return Value:
     BOOL AddressLockHeld;
     ULONG AllocationSize;
     ULONG BitmapSize;
+    PADDRESS_SPACE CopyDestination;
     PLIST_ENTRY CurrentEntry;
     PIMAGE_SECTION CurrentSection;
     ULONG Flags;
@@ -1394,12 +1397,19 @@ Return Value:
 
     //
     // Convert the mapping to read-only and copy the mappings to the
-    // destination in one skillful maneuver.
+    // destination in one skillful maneuver. If the child is populating its
+    // mappings lazily, just convert the source to read-only. The child picks
+    // up resident pages from its owning section as it touches them.
     //
 
     if (SectionToCopy->MinTouched < SectionToCopy->MaxTouched) {
+        CopyDestination = DestinationAddressSpace;
+        if (MmLazyForkMappings != FALSE) {
+            CopyDestination = NULL;
+        }
+
         Status = MmpCopyAndChangeSectionMappings(
-                        DestinationAddressSpace,
+                        CopyDestination,
                         SectionToCopy->AddressSpace,
                         SectionToCopy->MinTouched,
                         SectionToCopy->MaxTouched - SectionToCopy->MinTouched);
@@ -3623,10 +3633,12 @@ Return Value:
 
 {
 
+    PADDRESS_SPACE AddressSpace;
     UINTN BitmapIndex;
     ULONG BitmapMask;
     UINTN Boundary;
     UINTN CurrentPageOffset;
+    PKPROCESS CurrentProcess;
     PULONG DirtyPageBitmap;
     BOOL FreePhysicalPage;
     PIMAGE_SECTION OwningSection;
@@ -3702,6 +3714,31 @@ Return Value:
 
     ASSERT(IS_ALIGNED((UINTN)Section->VirtualAddress, MmPageSize()) != FALSE);
 
+    //
+    // Unmapping page by page below would send a TLB invalidation for every
+    // page. If the whole range is going to be unmapped from the current
+    // process, mark it all not present first so that a single invalidation
+    // covers the whole operation. The per-page unmaps then find nothing
+    // present and skip their own invalidations. Page cache only unmaps may
+    // leave pages behind, so they cannot do this.
+    //
+
+    if ((PageCount > 1) &&
+        ((Flags & IMAGE_SECTION_UNMAP_FLAG_PAGE_CACHE_ONLY) == 0)) {
+
+        AddressSpace = Section->AddressSpace;
+        CurrentProcess = PsGetCurrentProcess();
+        if ((AddressSpace == CurrentProcess->AddressSpace) ||
+            (AddressSpace == MmKernelAddressSpace)) {
+
+            MmpChangeMemoryRegionAccess(
+                           Section->VirtualAddress + (PageOffset << PageShift),
+                           PageCount,
+                           0,
+                           MAP_FLAG_PRESENT);
+        }
+    }
+
     for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
         BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(PageOffset + PageIndex);
         BitmapMask = IMAGE_SECTION_BITMAP_MASK(PageOffset + PageIndex);
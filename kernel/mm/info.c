@@ -51,6 +51,20 @@ MmpGetSetSystemMemoryInformation (
     BOOL Set
     );
 
+KSTATUS
+MmpGetSetTlbStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+KSTATUS
+MmpGetSetPoolTagStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -106,6 +120,14 @@ Return Value:
         Status = MmpGetSetSystemMemoryInformation(Data, DataSize, Set);
         break;
 
+    case MmInformationTlbStatistics:
+        Status = MmpGetSetTlbStatistics(Data, DataSize, Set);
+        break;
+
+    case MmInformationPoolTagStatistics:
+        Status = MmpGetSetPoolTagStatistics(Data, DataSize, Set);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         *DataSize = 0;
@@ -167,3 +189,91 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+MmpGetSetTlbStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets TLB shootdown statistics.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (*DataSize != sizeof(MM_TLB_STATISTICS)) {
+        *DataSize = sizeof(MM_TLB_STATISTICS);
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    if (Set != FALSE) {
+        *DataSize = 0;
+        return STATUS_ACCESS_DENIED;
+    }
+
+    Status = MmGetTlbStatistics(Data);
+    return Status;
+}
+
+KSTATUS
+MmpGetSetPoolTagStatistics (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets a snapshot of the per-tag pool statistics.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    if (Set != FALSE) {
+        *DataSize = 0;
+        return STATUS_ACCESS_DENIED;
+    }
+
+    return MmGetPoolTagStatistics(Data, DataSize);
+}
+
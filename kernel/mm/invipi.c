@@ -13,7 +13,9 @@ Module Name:
 
 Abstract:
 
-    This module implements the TLB invalidation IPI.
+    This module implements the TLB invalidation IPI, along with the tracking
+    of which processors have each address space loaded and the batching of
+    deferred invalidations.
 
 Author:
 
@@ -44,6 +46,13 @@ Module Name:
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+VOID
+MmpInvalidateTlbRange (
+    PVOID VirtualAddress,
+    ULONG PageCount,
+    BOOL FullFlush
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -57,12 +66,57 @@ KSPIN_LOCK MmInvalidateIpiLock;
 volatile PADDRESS_SPACE MmInvalidateIpiAddressSpace = NULL;
 volatile PVOID MmInvalidateIpiAddress = NULL;
 volatile ULONG MmInvalidateIpiPageCount = 0;
+volatile BOOL MmInvalidateIpiFullFlush = FALSE;
 volatile ULONG MmInvalidateIpiProcessorsRemaining = 0;
 
+//
+// Store the TLB shootdown statistics.
+//
+
+MM_TLB_STATISTICS MmTlbStatistics;
+
 //
 // ------------------------------------------------------------------ Functions
 //
 
+KSTATUS
+MmGetTlbStatistics (
+    PMM_TLB_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the TLB shootdown statistics.
+
+Arguments:
+
+    Statistics - Supplies a pointer where the statistics will be returned on
+        success. The caller should set the version member to
+        MM_TLB_STATISTICS_VERSION.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    if (Statistics->Version < MM_TLB_STATISTICS_VERSION) {
+        return STATUS_VERSION_MISMATCH;
+    }
+
+    Statistics->Shootdowns = MmTlbStatistics.Shootdowns;
+    Statistics->LocalShootdowns = MmTlbStatistics.LocalShootdowns;
+    Statistics->IpisSent = MmTlbStatistics.IpisSent;
+    Statistics->IpisAvoided = MmTlbStatistics.IpisAvoided;
+    Statistics->PagesInvalidated = MmTlbStatistics.PagesInvalidated;
+    Statistics->FullFlushes = MmTlbStatistics.FullFlushes;
+    return STATUS_SUCCESS;
+}
+
 INTERRUPT_STATUS
 MmTlbInvalidateIpiServiceRoutine (
     PVOID Context
@@ -86,23 +140,23 @@ Return Value:
 
 {
 
-    PVOID Address;
-    ULONG Index;
     RUNLEVEL OldRunLevel;
-    ULONG PageSize;
     PKPROCESS Process;
 
     OldRunLevel = KeRaiseRunLevel(RunLevelIpi);
-    PageSize = MmPageSize();
     Process = PsGetCurrentProcess();
+
+    //
+    // If the processor has since switched away from the address space, then
+    // the switch already flushed the stale entries.
+    //
+
     if ((MmInvalidateIpiAddress >= KERNEL_VA_START) ||
         (Process->AddressSpace == MmInvalidateIpiAddressSpace)) {
 
-        Address = MmInvalidateIpiAddress;
-        for (Index = 0; Index < MmInvalidateIpiPageCount; Index += 1) {
-            ArInvalidateTlbEntry(Address);
-            Address = (PVOID)((UINTN)Address + PageSize);
-        }
+        MmpInvalidateTlbRange(MmInvalidateIpiAddress,
+                              MmInvalidateIpiPageCount,
+                              MmInvalidateIpiFullFlush);
     }
 
     RtlAtomicAdd32(&MmInvalidateIpiProcessorsRemaining, -1);
@@ -110,6 +164,204 @@ Return Value:
     return InterruptStatusClaimed;
 }
 
+VOID
+MmpInitializeTlbBatch (
+    PMM_TLB_BATCH Batch,
+    PADDRESS_SPACE AddressSpace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes a deferred TLB invalidation batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to initialize.
+
+    AddressSpace - Supplies a pointer to the address space the batched pages
+        belong to.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Batch->AddressSpace = AddressSpace;
+    Batch->Start = NULL;
+    Batch->End = NULL;
+    Batch->PageCount = 0;
+    return;
+}
+
+VOID
+MmpAddToTlbBatch (
+    PMM_TLB_BATCH Batch,
+    PVOID VirtualAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a page whose mapping was changed to a deferred TLB
+    invalidation batch. The page is coalesced with the pages already in the
+    batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch.
+
+    VirtualAddress - Supplies the page-aligned virtual address to add.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID End;
+
+    End = VirtualAddress + MmPageSize();
+
+    //
+    // Kernel and user addresses are invalidated under different rules, so
+    // they cannot share a batch.
+    //
+
+    ASSERT((Batch->PageCount == 0) ||
+           ((Batch->Start >= KERNEL_VA_START) ==
+            (VirtualAddress >= KERNEL_VA_START)));
+
+    if (Batch->PageCount == 0) {
+        Batch->Start = VirtualAddress;
+        Batch->End = End;
+
+    } else {
+        if (VirtualAddress < Batch->Start) {
+            Batch->Start = VirtualAddress;
+        }
+
+        if (End > Batch->End) {
+            Batch->End = End;
+        }
+    }
+
+    Batch->PageCount += 1;
+    return;
+}
+
+VOID
+MmpFlushTlbBatch (
+    PMM_TLB_BATCH Batch
+    )
+
+/*++
+
+Routine Description:
+
+    This routine invalidates all the pages in a deferred TLB invalidation
+    batch on every processor that may have them cached, and empties the batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to flush.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN PageCount;
+
+    if (Batch->PageCount == 0) {
+        return;
+    }
+
+    //
+    // Invalidating the whole covering range may touch pages that were never
+    // added, which is harmless. Once the range is large enough, the
+    // invalidation turns into a full flush anyway.
+    //
+
+    PageCount = (Batch->End - Batch->Start) >> MmPageShift();
+    if (PageCount > MAX_ULONG) {
+        PageCount = MAX_ULONG;
+    }
+
+    MmpSendTlbInvalidateIpi(Batch->AddressSpace, Batch->Start, PageCount);
+    Batch->Start = NULL;
+    Batch->End = NULL;
+    Batch->PageCount = 0;
+    return;
+}
+
+VOID
+MmpUpdateActiveProcessors (
+    PADDRESS_SPACE AddressSpace,
+    ULONG ProcessorNumber,
+    BOOL Active
+    )
+
+/*++
+
+Routine Description:
+
+    This routine marks the given processor as having loaded or unloaded the
+    given address space. When switching address spaces, the new space must be
+    marked active before it is loaded, and the old space marked inactive only
+    after the switch, since the switch is what flushes the processor's stale
+    user mode TLB entries.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space.
+
+    ProcessorNumber - Supplies the number of the current processor.
+
+    Active - Supplies a boolean indicating whether the address space is being
+        loaded (TRUE) or unloaded (FALSE).
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Mask;
+
+    if (ProcessorNumber >= MM_ACTIVE_PROCESSOR_LIMIT) {
+        return;
+    }
+
+    //
+    // The atomic operations are full barriers, so the bit is visible to
+    // anyone changing mappings before this processor can walk the new page
+    // tables.
+    //
+
+    Mask = 1 << ProcessorNumber;
+    if (Active != FALSE) {
+        RtlAtomicOr32(&(AddressSpace->ActiveProcessors), Mask);
+
+    } else {
+        RtlAtomicAnd32(&(AddressSpace->ActiveProcessors), ~Mask);
+    }
+
+    return;
+}
+
 VOID
 MmpSendTlbInvalidateIpi (
     PADDRESS_SPACE AddressSpace,
@@ -121,7 +373,10 @@ MmpSendTlbInvalidateIpi (
 
 Routine Description:
 
-    This routine invalidates the given TLB entry on all active processors.
+    This routine invalidates the given TLB entries on all processors that may
+    have them cached. Kernel addresses are invalidated everywhere, while user
+    mode addresses are only invalidated on processors currently running the
+    given address space.
 
 Arguments:
 
@@ -139,43 +394,137 @@ Return Value:
 
 {
 
+    ULONG ActiveMask;
+    BOOL FullFlush;
+    BOOL InvalidateLocally;
     RUNLEVEL OldRunLevel;
-    ULONG PageIndex;
-    ULONG PageSize;
+    ULONG OtherCount;
+    ULONG ProcessorCount;
+    ULONG ProcessorNumber;
     PROCESSOR_SET ProcessorSet;
     KSTATUS Status;
 
+    RtlAtomicAdd64(&(MmTlbStatistics.Shootdowns), 1);
+    RtlAtomicAdd64(&(MmTlbStatistics.PagesInvalidated), PageCount);
+
+    //
+    // Flushing the whole TLB is cheaper than invalidating a large range one
+    // page at a time. Kernel mappings are global on some architectures and
+    // survive a full flush, so they are always invalidated page by page.
+    //
+
+    FullFlush = FALSE;
+    if ((VirtualAddress < KERNEL_VA_START) &&
+        (PageCount > MM_TLB_FULL_FLUSH_THRESHOLD)) {
+
+        FullFlush = TRUE;
+        RtlAtomicAdd64(&(MmTlbStatistics.FullFlushes), 1);
+    }
+
     //
     // If there is only one processor in the system, do the invalidate
     // directly.
     //
 
-    if (KeGetActiveProcessorCount() == 1) {
-        PageSize = MmPageSize();
-        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
-            ArInvalidateTlbEntry(VirtualAddress);
-            VirtualAddress = (PVOID)((UINTN)VirtualAddress + PageSize);
+    ProcessorCount = KeGetActiveProcessorCount();
+    if (ProcessorCount == 1) {
+        RtlAtomicAdd64(&(MmTlbStatistics.LocalShootdowns), 1);
+        MmpInvalidateTlbRange(VirtualAddress, PageCount, FullFlush);
+        return;
+    }
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    ProcessorNumber = KeGetCurrentProcessorNumber();
+
+    //
+    // Make sure the page table changes are visible before sampling which
+    // processors have the address space loaded. A processor that loads it
+    // after this point will see the new page tables.
+    //
+
+    RtlMemoryBarrier();
+    if ((VirtualAddress >= KERNEL_VA_START) ||
+        (ProcessorCount > MM_ACTIVE_PROCESSOR_LIMIT)) {
+
+        ActiveMask = MAX_ULONG;
+        OtherCount = ProcessorCount - 1;
+        InvalidateLocally = FALSE;
+        if ((VirtualAddress >= KERNEL_VA_START) ||
+            (PsGetCurrentProcess()->AddressSpace == AddressSpace)) {
+
+            InvalidateLocally = TRUE;
         }
 
+    } else {
+        ActiveMask = AddressSpace->ActiveProcessors;
+        InvalidateLocally = FALSE;
+        if ((ActiveMask & (1 << ProcessorNumber)) != 0) {
+            InvalidateLocally = TRUE;
+            ActiveMask &= ~(1 << ProcessorNumber);
+        }
+
+        OtherCount = RtlCountSetBits32(ActiveMask);
+    }
+
+    RtlAtomicAdd64(&(MmTlbStatistics.IpisAvoided),
+                   ProcessorCount - 1 - OtherCount);
+
+    //
+    // If no other processor is running the address space, there is nobody
+    // to interrupt. Any processor that switches to it later will start with
+    // a clean TLB.
+    //
+
+    if (OtherCount == 0) {
+        RtlAtomicAdd64(&(MmTlbStatistics.LocalShootdowns), 1);
+        if (InvalidateLocally != FALSE) {
+            MmpInvalidateTlbRange(VirtualAddress, PageCount, FullFlush);
+        }
+
+        KeLowerRunLevel(OldRunLevel);
         return;
     }
 
-    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    RtlAtomicAdd64(&(MmTlbStatistics.IpisSent), OtherCount);
     KeAcquireSpinLock(&MmInvalidateIpiLock);
     MmInvalidateIpiAddressSpace = AddressSpace;
     MmInvalidateIpiAddress = VirtualAddress;
     MmInvalidateIpiPageCount = PageCount;
-    MmInvalidateIpiProcessorsRemaining = KeGetActiveProcessorCount();
+    MmInvalidateIpiFullFlush = FullFlush;
+    MmInvalidateIpiProcessorsRemaining = OtherCount;
     RtlMemoryBarrier();
 
     //
-    // Send out the IPI.
+    // Send out the IPI. There is no way to target an arbitrary set of
+    // processors, so either interrupt everyone else at once or interrupt each
+    // active processor individually.
     //
 
-    ProcessorSet.Target = ProcessorTargetAll;
-    Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
-    if (!KSUCCESS(Status)) {
-        KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
+    if (OtherCount == ProcessorCount - 1) {
+        ProcessorSet.Target = ProcessorTargetAllExcludingSelf;
+        Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
+        if (!KSUCCESS(Status)) {
+            KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
+        }
+
+    } else {
+        ProcessorSet.Target = ProcessorTargetSingleProcessor;
+        while (ActiveMask != 0) {
+            ProcessorSet.U.Number = RtlCountTrailingZeros32(ActiveMask);
+            ActiveMask &= ActiveMask - 1;
+            Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
+            if (!KSUCCESS(Status)) {
+                KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
+            }
+        }
+    }
+
+    //
+    // Do the local invalidation while the other processors are working.
+    //
+
+    if (InvalidateLocally != FALSE) {
+        MmpInvalidateTlbRange(VirtualAddress, PageCount, FullFlush);
     }
 
     //
@@ -195,3 +544,50 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+VOID
+MmpInvalidateTlbRange (
+    PVOID VirtualAddress,
+    ULONG PageCount,
+    BOOL FullFlush
+    )
+
+/*++
+
+Routine Description:
+
+    This routine invalidates a range of TLB entries on the current processor.
+
+Arguments:
+
+    VirtualAddress - Supplies the first virtual address to invalidate.
+
+    PageCount - Supplies the number of pages to invalidate.
+
+    FullFlush - Supplies a boolean indicating whether to flush the entire TLB
+        instead of invalidating each page.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG PageIndex;
+    ULONG PageSize;
+
+    if (FullFlush != FALSE) {
+        ArInvalidateEntireTlb();
+        return;
+    }
+
+    PageSize = MmPageSize();
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+        ArInvalidateTlbEntry(VirtualAddress);
+        VirtualAddress = (PVOID)((UINTN)VirtualAddress + PageSize);
+    }
+
+    return;
+}
+
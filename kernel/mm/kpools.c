@@ -46,6 +46,14 @@ Module Name:
 
 #define INITIAL_NON_PAGED_POOL_SIZE (512 * 1024)
 
+//
+// Define the maximum number of large pages a single non-paged pool expansion
+// will use. The physical runs are gathered on the stack before anything is
+// mapped, since pool cannot be allocated while expanding the pool.
+//
+
+#define MAX_NON_PAGED_POOL_LARGE_PAGES 16
+
 //
 // Define the number of default-sized kernel stacks to keep around.
 //
@@ -53,11 +61,10 @@ Module Name:
 #define KERNEL_STACK_CACHE_SIZE 10
 
 //
-// Do not collect pool tag statistics on non-debug builds.
+// Collect pool tag statistics on all builds so that leaks and heavy allocators
+// can be tracked down on systems without a debugger attached.
 //
 
-#if DEBUG
-
 #define DEFAULT_NON_PAGED_POOL_MEMORY_HEAP_FLAGS \
     (MEMORY_HEAP_FLAG_COLLECT_TAG_STATISTICS | \
      MEMORY_HEAP_FLAG_NO_PARTIAL_FREES)
@@ -66,15 +73,12 @@ Module Name:
     (MEMORY_HEAP_FLAG_COLLECT_TAG_STATISTICS | \
      MEMORY_HEAP_FLAG_NO_PARTIAL_FREES)
 
-#else
-
-#define DEFAULT_NON_PAGED_POOL_MEMORY_HEAP_FLAGS \
-    (MEMORY_HEAP_FLAG_NO_PARTIAL_FREES)
-
-#define DEFAULT_PAGED_POOL_MEMORY_HEAP_FLAGS \
-    (MEMORY_HEAP_FLAG_NO_PARTIAL_FREES)
+//
+// Define the number of extra tags to leave room for when snapshotting the
+// pool tag statistics, in case new tags show up while the locks are dropped.
+//
 
-#endif
+#define POOL_TAG_SNAPSHOT_SLACK 16
 
 //
 // ----------------------------------------------- Internal Function Prototypes
@@ -94,6 +98,12 @@ MmpContractNonPagedPool (
     UINTN Size
     );
 
+KSTATUS
+MmpMapNonPagedPoolRange (
+    PVOID RangeAddress,
+    UINTN RangeSize
+    );
+
 PVOID
 MmpExpandPagedPool (
     PMEMORY_HEAP Heap,
@@ -115,10 +125,44 @@ MmpHandlePoolCorruption (
     PVOID Parameter
     );
 
+VOID
+MmpCopyPoolTagStatistic (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE Node,
+    ULONG Level,
+    PVOID Context
+    );
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines the context used when copying pool tag statistics
+    out of a pool's tag tree.
+
+Members:
+
+    Tags - Stores a pointer to the array of tag statistics to fill in.
+
+    Capacity - Stores the number of elements the array can hold.
+
+    Count - Stores the number of elements filled in so far.
+
+    PoolType - Stores the type of pool being iterated over.
+
+--*/
+
+typedef struct _POOL_TAG_SNAPSHOT_CONTEXT {
+    PMM_POOL_TAG_STATISTIC Tags;
+    UINTN Capacity;
+    UINTN Count;
+    POOL_TYPE PoolType;
+} POOL_TAG_SNAPSHOT_CONTEXT, *PPOOL_TAG_SNAPSHOT_CONTEXT;
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -571,6 +615,129 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+MmGetPoolTagStatistics (
+    PMM_POOL_TAG_STATISTICS Statistics,
+    PUINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a snapshot of the per-tag statistics of both kernel
+    pools. This routine must be called at low level.
+
+Arguments:
+
+    Statistics - Supplies a pointer to the buffer where the snapshot is
+        returned. The caller should set the version member to
+        MM_POOL_TAG_STATISTICS_VERSION.
+
+    Size - Supplies a pointer that on input contains the size of the buffer,
+        in bytes. On output, returns the size of the snapshot, or the size
+        needed if the buffer is too small.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_BUFFER_TOO_SMALL if the buffer cannot hold all the tags.
+
+    STATUS_VERSION_MISMATCH if the structure version is too old.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+{
+
+    UINTN Capacity;
+    POOL_TAG_SNAPSHOT_CONTEXT Context;
+    RUNLEVEL OldRunLevel;
+    UINTN RequiredSize;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Context.Tags = NULL;
+
+    //
+    // Figure out how much room is needed. The tag counts may grow before the
+    // locks are acquired, so leave a little slack.
+    //
+
+    Capacity = MmNonPagedPool.TagStatistics.TagCount +
+               MmPagedPool.TagStatistics.TagCount +
+               POOL_TAG_SNAPSHOT_SLACK;
+
+    RequiredSize = sizeof(MM_POOL_TAG_STATISTICS) +
+                   (Capacity * sizeof(MM_POOL_TAG_STATISTIC));
+
+    if (*Size < RequiredSize) {
+        *Size = RequiredSize;
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto GetPoolTagStatisticsEnd;
+    }
+
+    if (Statistics->Version < MM_POOL_TAG_STATISTICS_VERSION) {
+        Status = STATUS_VERSION_MISMATCH;
+        goto GetPoolTagStatisticsEnd;
+    }
+
+    //
+    // The statistics are gathered into non-paged pool, since the non-paged
+    // pool lock is a spin lock and touching paged memory while holding the
+    // paged pool lock could recurse into the pool.
+    //
+
+    Context.Tags = MmAllocateNonPagedPool(
+                                    Capacity * sizeof(MM_POOL_TAG_STATISTIC),
+                                    MM_ALLOCATION_TAG);
+
+    if (Context.Tags == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto GetPoolTagStatisticsEnd;
+    }
+
+    Context.Capacity = Capacity;
+    Context.Count = 0;
+    Context.PoolType = PoolTypeNonPaged;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&MmNonPagedPoolLock);
+    RtlRedBlackTreeIterate(&(MmNonPagedPool.TagStatistics.Tree),
+                           MmpCopyPoolTagStatistic,
+                           &Context);
+
+    KeReleaseSpinLock(&MmNonPagedPoolLock);
+    KeLowerRunLevel(OldRunLevel);
+    Context.PoolType = PoolTypePaged;
+    KeAcquireQueuedLock(MmPagedPoolLock);
+    RtlRedBlackTreeIterate(&(MmPagedPool.TagStatistics.Tree),
+                           MmpCopyPoolTagStatistic,
+                           &Context);
+
+    KeReleaseQueuedLock(MmPagedPoolLock);
+    Statistics->TagCount = Context.Count;
+    Statistics->TimeCounter = HlQueryTimeCounter();
+    Statistics->TimeCounterFrequency = HlQueryTimeCounterFrequency();
+    RtlCopyMemory(Statistics + 1,
+                  Context.Tags,
+                  Context.Count * sizeof(MM_POOL_TAG_STATISTIC));
+
+    *Size = sizeof(MM_POOL_TAG_STATISTICS) +
+            (Context.Count * sizeof(MM_POOL_TAG_STATISTIC));
+
+    Status = STATUS_SUCCESS;
+
+GetPoolTagStatisticsEnd:
+    if (Context.Tags != NULL) {
+        MmFreeNonPagedPool(Context.Tags);
+    }
+
+    return Status;
+}
+
 KERNEL_API
 VOID
 MmDebugPrintPoolStatistics (
@@ -671,6 +838,7 @@ Return Value:
 
     KeReleaseQueuedLock(MmPagedPoolLock);
     MmpGetPhysicalPageStatistics(Statistics);
+    MmpGetCompressedSwapStatistics(&(Statistics->CompressedSwap));
     return STATUS_SUCCESS;
 }
 
@@ -1045,6 +1213,7 @@ Return Value:
 {
 
     BOOL LockHeld;
+    ULONG OldPolicy;
     RUNLEVEL OldRunLevel;
     ULONG PageSize;
     KSTATUS Status;
@@ -1080,18 +1249,29 @@ Return Value:
     VaRequest.Max = MAX_ADDRESS;
     VaRequest.MemoryType = MemoryTypeNonPagedPool;
     VaRequest.Strategy = AllocationStrategyAnyAddress;
+
+    //
+    // Align expansions big enough to hold a large page so that they can be
+    // backed by large pages.
+    //
+
+    if ((MmLargePageSize != 0) && (Size >= MmLargePageSize)) {
+        VaRequest.Alignment = MmLargePageSize;
+    }
+
     Status = MmpAllocateAddressRange(&MmKernelVirtualSpace, &VaRequest, FALSE);
     if (!KSUCCESS(Status)) {
         goto ExpandNonPagedPoolEnd;
     }
 
-    Status = MmpMapRange(VaRequest.Address,
-                         Size,
-                         PageSize,
-                         PageSize,
-                         FALSE,
-                         FALSE);
+    //
+    // Non-paged pool holds the kernel's hottest structures, so back it with
+    // fast memory when the platform has any.
+    //
 
+    OldPolicy = MmSetPhysicalZonePolicy(PhysicalMemoryZoneFast);
+    Status = MmpMapNonPagedPoolRange(VaRequest.Address, Size);
+    MmSetPhysicalZonePolicy(OldPolicy);
     if (!KSUCCESS(Status)) {
         goto ExpandNonPagedPoolEnd;
     }
@@ -1153,6 +1333,8 @@ Return Value:
 
 {
 
+    ULONG Attributes;
+    PVOID CurrentAddress;
     RUNLEVEL OldRunLevel;
     UINTN PageSize;
     KSTATUS Status;
@@ -1174,6 +1356,26 @@ Return Value:
         goto ContractNonPagedPoolEnd;
     }
 
+    //
+    // Large page mappings in the kernel are permanent, so hang on to any
+    // expansion that was backed by them.
+    //
+
+    if (MmLargePageSize != 0) {
+        CurrentAddress = Memory;
+        while (CurrentAddress < Memory + Size) {
+            MmpVirtualToPhysical(CurrentAddress, &Attributes);
+            if ((Attributes & MAP_FLAG_LARGE_PAGE) != 0) {
+                Status = STATUS_RESOURCE_IN_USE;
+                goto ContractNonPagedPoolEnd;
+            }
+
+            CurrentAddress = ALIGN_POINTER_DOWN(CurrentAddress,
+                                                MmLargePageSize) +
+                             MmLargePageSize;
+        }
+    }
+
     OldRunLevel = MmNonPagedPoolOldRunLevel;
     KeReleaseSpinLock(&MmNonPagedPoolLock);
     KeLowerRunLevel(OldRunLevel);
@@ -1201,6 +1403,135 @@ Return Value:
     return TRUE;
 }
 
+KSTATUS
+MmpMapNonPagedPoolRange (
+    PVOID RangeAddress,
+    UINTN RangeSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine backs a newly allocated range of non-paged pool with physical
+    memory. If the range is large page aligned and large pages are supported,
+    as much of it as possible is mapped with large pages, which cuts down on
+    TLB misses for big pool users. Large pool pages are never released.
+
+Arguments:
+
+    RangeAddress - Supplies the starting virtual address of the range.
+
+    RangeSize - Supplies the size of the range, in bytes.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN LargeCount;
+    UINTN LargeIndex;
+    UINTN LargePages;
+    PHYSICAL_ADDRESS LargeRuns[MAX_NON_PAGED_POOL_LARGE_PAGES];
+    UINTN LargeSize;
+    ULONG MapFlags;
+    UINTN PageIndex;
+    ULONG PageShift;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    KSTATUS Status;
+    PVOID VirtualAddress;
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    LargeCount = 0;
+    LargeSize = MmLargePageSize;
+    if ((LargeSize != 0) &&
+        (IS_POINTER_ALIGNED(RangeAddress, LargeSize) != FALSE)) {
+
+        //
+        // Gather the large physical runs up front without waiting. Any that
+        // cannot be found right now are simply mapped with small pages.
+        //
+
+        LargePages = LargeSize >> PageShift;
+        while ((LargeCount < MAX_NON_PAGED_POOL_LARGE_PAGES) &&
+               (((LargeCount + 1) * LargeSize) <= RangeSize)) {
+
+            PhysicalAddress = MmpTryToAllocatePhysicalPages(LargePages,
+                                                            LargePages,
+                                                            FALSE);
+
+            if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+                break;
+            }
+
+            LargeRuns[LargeCount] = PhysicalAddress;
+            LargeCount += 1;
+        }
+    }
+
+    //
+    // Map whatever is not covered by large pages with regular pages. This is
+    // the only step that can fail, so do it before committing any permanent
+    // large pages.
+    //
+
+    VirtualAddress = RangeAddress + (LargeCount * LargeSize);
+    if (VirtualAddress != RangeAddress + RangeSize) {
+        Status = MmpMapRange(VirtualAddress,
+                             RangeSize - (LargeCount * LargeSize),
+                             PageSize,
+                             PageSize,
+                             FALSE,
+                             FALSE);
+
+        if (!KSUCCESS(Status)) {
+            for (LargeIndex = 0; LargeIndex < LargeCount; LargeIndex += 1) {
+                MmFreePhysicalPages(LargeRuns[LargeIndex],
+                                    LargeSize >> PageShift);
+            }
+
+            return Status;
+        }
+    }
+
+    //
+    // Map the large runs. If a page table already exists where a large page
+    // was going to go, map the run with regular pages instead.
+    //
+
+    MapFlags = MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL;
+    VirtualAddress = RangeAddress;
+    for (LargeIndex = 0; LargeIndex < LargeCount; LargeIndex += 1) {
+        PhysicalAddress = LargeRuns[LargeIndex];
+        Status = MmpMapLargePage(PhysicalAddress,
+                                 VirtualAddress,
+                                 MapFlags,
+                                 INVALID_PHYSICAL_ADDRESS);
+
+        if (!KSUCCESS(Status)) {
+            for (PageIndex = 0;
+                 PageIndex < (LargeSize >> PageShift);
+                 PageIndex += 1) {
+
+                MmpMapPage(PhysicalAddress,
+                           VirtualAddress + (PageIndex << PageShift),
+                           MapFlags);
+
+                PhysicalAddress += PageSize;
+            }
+        }
+
+        VirtualAddress += LargeSize;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 PVOID
 MmpExpandPagedPool (
     PMEMORY_HEAP Heap,
@@ -1384,3 +1715,64 @@ Return Value:
     return;
 }
 
+VOID
+MmpCopyPoolTagStatistic (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE Node,
+    ULONG Level,
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called once for each node in a pool's tag statistics tree.
+    It copies the tag's statistics into the snapshot.
+
+Arguments:
+
+    Tree - Supplies a pointer to the tree being enumerated.
+
+    Node - Supplies a pointer to the node.
+
+    Level - Supplies the depth into the tree that this node exists at. 0 is
+        the root.
+
+    Context - Supplies a pointer to the snapshot context.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPOOL_TAG_SNAPSHOT_CONTEXT Snapshot;
+    PMEMORY_HEAP_TAG_STATISTIC Statistic;
+    PMM_POOL_TAG_STATISTIC Tag;
+
+    Snapshot = Context;
+    if (Snapshot->Count == Snapshot->Capacity) {
+        return;
+    }
+
+    Statistic = RED_BLACK_TREE_VALUE(Node, MEMORY_HEAP_TAG_STATISTIC, Node);
+    Tag = &(Snapshot->Tags[Snapshot->Count]);
+    Tag->Tag = Statistic->Tag;
+    Tag->PoolType = Snapshot->PoolType;
+    Tag->ActiveSize = Statistic->ActiveSize;
+    Tag->LargestActiveSize = Statistic->LargestActiveSize;
+    Tag->LifetimeAllocationSize = Statistic->LifetimeAllocationSize;
+    Tag->LifetimeAllocationCount = Statistic->LifetimeAllocationCount;
+    Tag->ActiveAllocationCount = Statistic->ActiveAllocationCount;
+    Tag->LargestAllocation = Statistic->LargestAllocation;
+    RtlCopyMemory(Tag->Histogram,
+                  Statistic->Histogram,
+                  sizeof(Tag->Histogram));
+
+    Snapshot->Count += 1;
+    return;
+}
+
@@ -58,6 +58,21 @@ Module Name:
 #define UNMAP_FLAG_SEND_INVALIDATE_IPI 0x00000001
 #define UNMAP_FLAG_FREE_PHYSICAL_PAGES 0x00000002
 
+//
+// Define the number of processors that can be tracked in an address space's
+// active processor mask. Processors beyond this are always sent invalidation
+// IPIs.
+//
+
+#define MM_ACTIVE_PROCESSOR_LIMIT (sizeof(ULONG) * BITS_PER_BYTE)
+
+//
+// Define the number of user mode pages above which a TLB invalidation flushes
+// the entire TLB rather than invalidating each page individually.
+//
+
+#define MM_TLB_FULL_FLUSH_THRESHOLD 32
+
 //
 // This flag indicates that the underlying physical memory being described was
 // created with this structure. When the structure is destroyed, the memory
@@ -288,6 +303,36 @@ typedef struct _PAGING_ENTRY {
 
 } PAGING_ENTRY, *PPAGING_ENTRY;
 
+/*++
+
+Structure Description:
+
+    This structure defines a batch of deferred TLB invalidations. Pages are
+    added to the batch as their mappings are changed, and the batch is
+    flushed once at the end of the operation with a single invalidation
+    request covering all of them.
+
+Members:
+
+    AddressSpace - Stores a pointer to the address space the pages belong to.
+
+    Start - Stores the lowest page address in the batch.
+
+    End - Stores the address just beyond the highest page in the batch.
+
+    PageCount - Stores the number of pages that were actually added to the
+        batch. This may be less than the number of pages between the start
+        and end.
+
+--*/
+
+typedef struct _MM_TLB_BATCH {
+    PADDRESS_SPACE AddressSpace;
+    PVOID Start;
+    PVOID End;
+    UINTN PageCount;
+} MM_TLB_BATCH, *PMM_TLB_BATCH;
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -394,6 +439,19 @@ extern ULONG MmDataCacheLineSize;
 extern ULONG MmInstructionCacheLineSize;
 extern BOOL MmVirtuallyIndexedInstructionCache;
 
+//
+// Store the size of a large page mapping, or 0 if the architecture does not
+// support large pages.
+//
+
+extern ULONG MmLargePageSize;
+
+//
+// Store whether or not forked children populate their mappings on demand.
+//
+
+extern BOOL MmLazyForkMappings;
+
 //
 // -------------------------------------------------------- Function Prototypes
 //
@@ -488,6 +546,43 @@ Return Value:
 
 --*/
 
+PHYSICAL_ADDRESS
+MmpTryToAllocatePhysicalPages (
+    UINTN PageCount,
+    UINTN Alignment,
+    BOOL UseReserve
+    );
+
+/*++
+
+Routine Description:
+
+    This routine attempts to allocate physical pages without waiting. Unlike
+    the regular allocation routine, it never pages out or blocks waiting for
+    memory, so it is suitable for opportunistic allocations that have a
+    fallback.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive physical pages required.
+
+    Alignment - Supplies the alignment requirement of the allocation, in pages.
+        Valid values are powers of 2. Values of 1 or 0 indicate no alignment
+        requirement.
+
+    UseReserve - Supplies a boolean indicating whether the allocation may dip
+        into the free pages the system keeps in reserve. This is only meant
+        for the paging thread, which cannot wait on itself, and only when it
+        is about to free more pages than it takes.
+
+Return Value:
+
+    Returns the physical address of the first page of allocated memory on
+    success, or INVALID_PHYSICAL_ADDRESS if no suitable free run exists right
+    now.
+
+--*/
+
 PHYSICAL_ADDRESS
 MmpAllocateIdentityMappablePhysicalPages (
     UINTN PageCount,
@@ -918,6 +1013,38 @@ Return Value:
 
 --*/
 
+BOOL
+MmpTestAndClearPageAccessed (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given page has been accessed since the
+    last time this routine was called on it, and clears the accessed state. The
+    TLB is not flushed, so an access that hits a cached translation may go
+    unnoticed until the entry is evicted. Architectures without a hardware
+    accessed flag always return FALSE.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the page is mapped
+        in. This does not need to be the current address space.
+
+    VirtualAddress - Supplies the virtual address of the page to query.
+
+Return Value:
+
+    TRUE if the page is mapped and has been accessed.
+
+    FALSE if the page is not mapped, has not been accessed, or the
+    architecture does not track accesses.
+
+--*/
+
 VOID
 MmpUnmapPageInOtherProcess (
     PADDRESS_SPACE AddressSpace,
@@ -1071,7 +1198,9 @@ Routine Description:
 
 Arguments:
 
-    Destination - Supplies a pointer to the destination address space.
+    Destination - Supplies an optional pointer to the destination address
+        space. If this is NULL, the source mappings are only converted to
+        read-only and nothing is copied.
 
     Source - Supplies a pointer to the source address space.
 
@@ -1110,6 +1239,85 @@ Return Value:
 
 --*/
 
+KSTATUS
+MmpReserveLargePageTable (
+    PADDRESS_SPACE AddressSpace,
+    PPHYSICAL_ADDRESS PageTable
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates the page table that a user mode large page mapping
+    will be split into should it ever need to be. Splitting a large page can
+    happen while an image section lock is held or on the paging thread, where
+    allocations are not allowed, so the table is set aside up front. This
+    routine must be called at low level without any image section locks held.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the large page will
+        be mapped in.
+
+    PageTable - Supplies a pointer where the physical address of the reserved
+        page table will be returned. The caller passes this to the large page
+        map routine, or frees it if the large page is never mapped.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if large pages are not supported.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+KSTATUS
+MmpMapLargePage (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PVOID VirtualAddress,
+    ULONG Flags,
+    PHYSICAL_ADDRESS PageTable
+    );
+
+/*++
+
+Routine Description:
+
+    This routine maps a physically contiguous, large page aligned run of
+    physical memory with a single large page mapping. User mode mappings are
+    made in the current address space. Kernel mode large pages are permanent;
+    they are never split or unmapped.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address to back the mapping with.
+        This must be aligned to the large page size.
+
+    VirtualAddress - Supplies the virtual address to map. This must be aligned
+        to the large page size.
+
+    Flags - Supplies a bitfield of flags governing the options of the mapping.
+        See MAP_FLAG_* definitions.
+
+    PageTable - Supplies the physical address of the page table reserved for
+        splitting this mapping. This is required for user mode mappings and
+        must be INVALID_PHYSICAL_ADDRESS for kernel mode mappings. On success,
+        the address space takes ownership of the page table.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if large pages are not supported.
+
+    STATUS_RESOURCE_IN_USE if a page table or mapping already exists somewhere
+    in the region.
+
+--*/
+
 KSTATUS
 MmpAddAccountingDescriptor (
     PMEMORY_ACCOUNTING Accountant,
@@ -1798,6 +2006,36 @@ Return Value:
 
 --*/
 
+BOOL
+MmpIsImageSectionMapped (
+    PIMAGE_SECTION Section,
+    ULONG PageOffset,
+    PPHYSICAL_ADDRESS PhysicalAddress
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not an image section is mapped at the
+    given page offset.
+
+Arguments:
+
+    Section - Supplies a pointer to an image section.
+
+    PageOffset - Supplies an offset, in pages, into the image section.
+
+    PhysicalAddress - Supplies an optional pointer that receives the physical
+        address mapped at the given section offset.
+
+Return Value:
+
+    Returns TRUE if the image section is mapped at the current offset or FALSE
+    otherwise.
+
+--*/
+
 KSTATUS
 MmpIsolateImageSection (
     PIMAGE_SECTION Section,
@@ -2061,7 +2299,10 @@ MmpSendTlbInvalidateIpi (
 
 Routine Description:
 
-    This routine invalidates the given TLB entry on all active processors.
+    This routine invalidates the given TLB entries on all processors that may
+    have them cached. Kernel addresses are invalidated everywhere, while user
+    mode addresses are only invalidated on processors currently running the
+    given address space.
 
 Arguments:
 
@@ -2077,6 +2318,111 @@ Return Value:
 
 --*/
 
+VOID
+MmpInitializeTlbBatch (
+    PMM_TLB_BATCH Batch,
+    PADDRESS_SPACE AddressSpace
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes a deferred TLB invalidation batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to initialize.
+
+    AddressSpace - Supplies a pointer to the address space the batched pages
+        belong to.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpAddToTlbBatch (
+    PMM_TLB_BATCH Batch,
+    PVOID VirtualAddress
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds a page whose mapping was changed to a deferred TLB
+    invalidation batch. The page is coalesced with the pages already in the
+    batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch.
+
+    VirtualAddress - Supplies the page-aligned virtual address to add.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpFlushTlbBatch (
+    PMM_TLB_BATCH Batch
+    );
+
+/*++
+
+Routine Description:
+
+    This routine invalidates all the pages in a deferred TLB invalidation
+    batch on every processor that may have them cached, and empties the batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to flush.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpUpdateActiveProcessors (
+    PADDRESS_SPACE AddressSpace,
+    ULONG ProcessorNumber,
+    BOOL Active
+    );
+
+/*++
+
+Routine Description:
+
+    This routine marks the given processor as having loaded or unloaded the
+    given address space. When switching address spaces, the new space must be
+    marked active before it is loaded, and the old space marked inactive only
+    after the switch, since the switch is what flushes the processor's stale
+    user mode TLB entries.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space.
+
+    ProcessorNumber - Supplies the number of the current processor.
+
+    Active - Supplies a boolean indicating whether the address space is being
+        loaded (TRUE) or unloaded (FALSE).
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 MmpInitializePaging (
     VOID
@@ -2174,6 +2520,7 @@ MmpPageOut (
     PHYSICAL_ADDRESS PhysicalAddress,
     PIO_BUFFER IoBuffer,
     PMEMORY_RESERVATION SwapRegion,
+    BOOL SecondChance,
     PUINTN PagesPaged
     );
 
@@ -2204,12 +2551,19 @@ Routine Description:
     SwapRegion - Supplies a pointer to a region of VA space to use during
         paging.
 
+    SecondChance - Supplies a boolean indicating whether pages that have been
+        accessed since they were last scanned should be spared. If set, the
+        accessed state of such pages is cleared and they are left resident.
+
     PagesPaged - Supplies a pointer where the count of pages removed will
         be returned.
 
 Return Value:
 
-    Status code.
+    STATUS_TRY_AGAIN if the selected page was recently accessed and was given
+    a second chance.
+
+    Other status codes.
 
 --*/
 
@@ -2366,6 +2720,149 @@ Return Value:
 
 --*/
 
+KSTATUS
+MmpInitializeCompressedSwap (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes the compressed swap tier if it has been enabled
+    and has not yet been initialized. It is called when a page file arrives.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    STATUS_SUCCESS if the tier was initialized, was already initialized, or
+    is not enabled.
+
+    Other error codes on failure, in which case the tier stays disabled.
+
+--*/
+
+KSTATUS
+MmpStoreCompressedPage (
+    HANDLE PageFile,
+    UINTN PageIndex,
+    PVOID Page
+    );
+
+/*++
+
+Routine Description:
+
+    This routine attempts to store a page destined for the page file in the
+    compressed pool instead. Any previously stored copy of the same page file
+    page is discarded whether or not this succeeds, so on failure the caller
+    must write the page to the page file.
+
+Arguments:
+
+    PageFile - Supplies the page file the page is being written to.
+
+    PageIndex - Supplies the index of the page within the page file.
+
+    Page - Supplies a pointer to the mapped page contents.
+
+Return Value:
+
+    STATUS_SUCCESS if the page was stored.
+
+    STATUS_NOT_SUPPORTED if the compressed swap tier is disabled.
+
+    STATUS_INSUFFICIENT_RESOURCES if the page did not compress well enough or
+    the pool is full.
+
+--*/
+
+KSTATUS
+MmpLoadCompressedPage (
+    HANDLE PageFile,
+    UINTN PageIndex,
+    PVOID Page
+    );
+
+/*++
+
+Routine Description:
+
+    This routine attempts to satisfy a page file read from the compressed
+    pool. The stored copy is kept, as the caller may still fail to map the
+    page. It is discarded once the page is mapped.
+
+Arguments:
+
+    PageFile - Supplies the page file being read.
+
+    PageIndex - Supplies the index of the page within the page file.
+
+    Page - Supplies a pointer to the mapped page to fill in.
+
+Return Value:
+
+    STATUS_SUCCESS if the page was filled in from the compressed pool.
+
+    STATUS_NOT_FOUND if the page is not held by the compressed pool and must
+    be read from the page file.
+
+    STATUS_DATA_LENGTH_MISMATCH if the stored data is corrupt.
+
+--*/
+
+VOID
+MmpDiscardCompressedPages (
+    HANDLE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine discards any compressed copies of the given range of page
+    file pages.
+
+Arguments:
+
+    PageFile - Supplies the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to discard.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpGetCompressedSwapStatistics (
+    PMM_COMPRESSED_SWAP_STATISTICS Statistics
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the compressed swap tier statistics.
+
+Arguments:
+
+    Statistics - Supplies a pointer where the statistics will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
 BOOL
 MmpCheckUserModeCopyRoutines (
     PTRAP_FRAME TrapFrame
@@ -59,6 +59,13 @@ Module Name:
 
 #define PAGE_OUT_MAX_CLEAN_STREAK 4
 
+//
+// Define the default number of pages around a page cache backed fault that
+// are read and mapped along with the faulting page.
+//
+
+#define PAGE_IN_FAULT_AROUND_DEFAULT 16
+
 //
 // Define the alignment and initial capacity for the paging entry block
 // allocator.
@@ -204,6 +211,18 @@ MmpPageInAnonymousSection (
     PIO_BUFFER LockedIoBuffer
     );
 
+KSTATUS
+MmpPageInLargeAnonymousRegion (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    );
+
+BOOL
+MmpCanMapLargeAnonymousRegion (
+    PIMAGE_SECTION ImageSection,
+    UINTN RegionOffset
+    );
+
 KSTATUS
 MmpPageInSharedSection (
     PIMAGE_SECTION ImageSection,
@@ -249,6 +268,15 @@ MmpReadPageFile (
     PPAGE_IN_CONTEXT Context
     );
 
+KSTATUS
+MmpWritePageFile (
+    PPAGE_FILE PageFile,
+    PIO_BUFFER IoBuffer,
+    PVOID Pages,
+    IO_OFFSET Offset,
+    UINTN PageCount
+    );
+
 KSTATUS
 MmpReadBackingImage (
     PIMAGE_SECTION Section,
@@ -256,6 +284,29 @@ MmpReadBackingImage (
     PIO_BUFFER IoBuffer
     );
 
+UINTN
+MmpReadBackingImageWindow (
+    PIMAGE_SECTION Section,
+    UINTN PageOffset,
+    PIO_BUFFER IoBuffer,
+    PUINTN WindowStart
+    );
+
+VOID
+MmpMapFaultAroundPages (
+    PIMAGE_SECTION Section,
+    PIO_BUFFER IoBuffer,
+    UINTN WindowStart,
+    UINTN WindowPages,
+    UINTN FaultingOffset
+    );
+
+BOOL
+MmpMapInheritedPage (
+    PIMAGE_SECTION Section,
+    UINTN PageOffset
+    );
+
 VOID
 MmpMapPageInSection (
     PIMAGE_SECTION OwningSection,
@@ -330,10 +381,51 @@ volatile UINTN MmPagingFreeTarget;
 
 PBLOCK_ALLOCATOR MmPagingEntryBlockAllocator;
 
+//
+// Store the number of pages read and mapped around a fault on a page cache
+// backed section. The window is aligned to this size. Set to 0 or 1 to map
+// only the faulting page.
+//
+
+ULONG MmFaultAroundPages = PAGE_IN_FAULT_AROUND_DEFAULT;
+
 //
 // ------------------------------------------------------------------ Functions
 //
 
+BOOL
+MmIsPagingEnabled (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not a page file is currently available
+    to page memory out to.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE if paging to disk is enabled.
+
+    FALSE if paging is disabled or no page file has been found.
+
+--*/
+
+{
+
+    if ((MmPagingForceDisable != FALSE) || (MmPagingEnabled == FALSE)) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 BOOL
 MmRequestPagingOut (
     UINTN FreePageTarget
@@ -519,6 +611,13 @@ Return Value:
 
     FileHandle = INVALID_HANDLE;
 
+    //
+    // With a page file to fall back on, the compressed swap tier can be
+    // brought up if it has been enabled. Failure here just leaves it off.
+    //
+
+    MmpInitializeCompressedSwap();
+
 VolumeArrivalEnd:
     if (AppendedPath != NULL) {
         MmFreePagedPool(AppendedPath);
@@ -1001,8 +1100,23 @@ Return Value:
 
 {
 
+    BOOL Mapped;
     KSTATUS Status;
 
+    //
+    // Sections copied by fork populate their mappings on demand. If the page
+    // is resident in the section it is inherited from, just share that page.
+    // Callers that need the page locked still go through the full path below,
+    // which finds the new mapping.
+    //
+
+    if (ImageSection->Parent != NULL) {
+        Mapped = MmpMapInheritedPage(ImageSection, PageOffset);
+        if ((Mapped != FALSE) && (LockedIoBuffer == NULL)) {
+            return STATUS_SUCCESS;
+        }
+    }
+
     //
     // Handle image sections that do not belong to a backing image.
     //
@@ -1134,6 +1248,7 @@ MmpPageOut (
     PHYSICAL_ADDRESS PhysicalAddress,
     PIO_BUFFER IoBuffer,
     PMEMORY_RESERVATION SwapRegion,
+    BOOL SecondChance,
     PUINTN PagesPaged
     )
 
@@ -1164,20 +1279,27 @@ Routine Description:
     SwapRegion - Supplies a pointer to a region of VA space to use during
         paging.
 
+    SecondChance - Supplies a boolean indicating whether pages that have been
+        accessed since they were last scanned should be spared. If set, the
+        accessed state of such pages is cleared and they are left resident.
+
     PagesPaged - Supplies a pointer where the count of pages removed will
         be returned.
 
 Return Value:
 
-    Status code.
+    STATUS_TRY_AGAIN if the selected page was recently accessed and was given
+    a second chance.
+
+    Other status codes.
 
 --*/
 
 {
 
+    BOOL Accessed;
     UINTN BitmapIndex;
     ULONG BitmapMask;
-    UINTN BytesCompleted;
     UINTN CleanStreak;
     BOOL Dirty;
     UINTN Offset;
@@ -1250,6 +1372,24 @@ Return Value:
         goto PageOutEnd;
     }
 
+    //
+    // If the page has been used since the pager last came around, clear its
+    // accessed state and leave it be this time. Only the owning section's
+    // mapping is consulted, children inheriting the page do not keep it
+    // resident on their own.
+    //
+
+    if (SecondChance != FALSE) {
+        VirtualAddress = Section->VirtualAddress + (SectionOffset << PageShift);
+        Accessed = MmpTestAndClearPageAccessed(Section->AddressSpace,
+                                               VirtualAddress);
+
+        if (Accessed != FALSE) {
+            Status = STATUS_TRY_AGAIN;
+            goto PageOutEnd;
+        }
+    }
+
     //
     // If this section has a chance of being dirty, make sure the page file
     // space is allocated before it gets unmapped. There is a chance that the
@@ -1343,6 +1483,20 @@ Return Value:
             if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
                 break;
             }
+
+            //
+            // Also stop rather than drag a recently used neighbor out with
+            // this batch.
+            //
+
+            if (SecondChance != FALSE) {
+                Accessed = MmpTestAndClearPageAccessed(Section->AddressSpace,
+                                                       VirtualAddress);
+
+                if (Accessed != FALSE) {
+                    break;
+                }
+            }
         }
 
         //
@@ -1443,23 +1597,17 @@ Return Value:
     }
 
     //
-    // Acquire the page file's lock in order to use its paging out IRP, and
-    // perform the write.
+    // Write the batch out, either to the compressed pool or the page file.
     //
 
     PageCount = Offset >> PageShift;
     if (PageCount != 0) {
-        KeAcquireQueuedLock(PageFile->Lock);
-        Status = IoWriteAtOffset(PageFile->Handle,
-                                 IoBuffer,
-                                 TotalOffset,
-                                 Offset,
-                                 IO_FLAG_NO_ALLOCATE | IO_FLAG_SERVICING_FAULT,
-                                 WAIT_TIME_INDEFINITE,
-                                 &BytesCompleted,
-                                 PageFile->PagingOutIrp);
+        Status = MmpWritePageFile(PageFile,
+                                  IoBuffer,
+                                  SwapRegion->VirtualBase,
+                                  TotalOffset,
+                                  PageCount);
 
-        KeReleaseQueuedLock(PageFile->Lock);
         if (PagingEntry != NULL) {
             PagingEntry->U.Flags &= ~PAGING_ENTRY_FLAG_PAGING_OUT;
             PagingEntry = NULL;
@@ -1478,8 +1626,6 @@ Return Value:
 
             goto PageOutEnd;
         }
-
-        ASSERT(BytesCompleted == Offset);
     }
 
     *PagesPaged += PageCount;
@@ -2393,6 +2539,7 @@ Return Value:
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    MmpDiscardCompressedPages((HANDLE)PageFile, Allocation, PageCount);
     KeAcquireQueuedLock(PageFile->Lock);
     for (CurrentIndex = Allocation;
          CurrentIndex < Allocation + PageCount;
@@ -2620,6 +2767,19 @@ Return Value:
     RootSection = NULL;
     VirtualAddress = ImageSection->VirtualAddress + (PageOffset << PageShift);
 
+    //
+    // Try to back the whole surrounding region with a single large page. This
+    // fails quickly if the section or the region does not qualify, in which
+    // case the regular small page path is used.
+    //
+
+    if ((LockedIoBuffer == NULL) && (MmLargePageSize != 0)) {
+        Status = MmpPageInLargeAnonymousRegion(ImageSection, PageOffset);
+        if (KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
     //
     // Loop trying to page into the section.
     //
@@ -2929,18 +3089,21 @@ Return Value:
 }
 
 KSTATUS
-MmpPageInSharedSection (
+MmpPageInLargeAnonymousRegion (
     PIMAGE_SECTION ImageSection,
-    UINTN PageOffset,
-    PIO_BUFFER LockedIoBuffer
+    UINTN PageOffset
     )
 
 /*++
 
 Routine Description:
 
-    This routine pages a physical page in from the page cache. This routine
-    must be called at low level.
+    This routine attempts to page in the entire large page aligned region
+    surrounding the given page of an anonymous section, backing it with a
+    single physically contiguous large page. Only private, writable sections
+    with no copy-on-write relatives qualify, and only if nothing in the region
+    has been mapped or paged out yet. This routine must be called at low
+    level.
 
 Arguments:
 
@@ -2948,147 +3111,444 @@ Routine Description:
         to page in.
 
     PageOffset - Supplies the offset, in pages, from the beginning of the
-        section.
-
-    LockedIoBuffer - Supplies an optional pointer to an uninitialized I/O
-        buffer that will be initialized with the the paged in page, effectively
-        locking the page until the I/O buffer is released.
+        section of the page that faulted.
 
 Return Value:
 
-    Status code.
+    STATUS_SUCCESS if the region was mapped with a large page.
+
+    STATUS_NOT_SUPPORTED if the region does not qualify for a large page.
+
+    Other error codes if the resources for a large page could not be acquired.
+    The caller should fall back to mapping a small page in all failure cases.
 
 --*/
 
 {
 
-    ULONG Attributes;
-    PHYSICAL_ADDRESS ExistingPhysicalAddress;
-    PIO_BUFFER IoBuffer;
-    IO_BUFFER IoBufferData;
+    PKPROCESS CurrentProcess;
+    UINTN LargePageCount;
     BOOL LockHeld;
     ULONG MapFlags;
-    PPAGE_CACHE_ENTRY PageCacheEntry;
+    PPAGING_ENTRY *PagingEntries;
+    UINTN PageIndex;
     ULONG PageShift;
+    PHYSICAL_ADDRESS PageTable;
     PHYSICAL_ADDRESS PhysicalAddress;
+    PVOID RegionEnd;
+    UINTN RegionOffset;
+    PVOID RegionStart;
     KSTATUS Status;
-    ULONG TruncateCount;
     PVOID VirtualAddress;
 
-    ExistingPhysicalAddress = INVALID_PHYSICAL_ADDRESS;
-    IoBuffer = NULL;
-    PageCacheEntry = NULL;
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    LockHeld = FALSE;
     PageShift = MmPageShift();
+    PagingEntries = NULL;
+    PageTable = INVALID_PHYSICAL_ADDRESS;
     PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+    LargePageCount = MmLargePageSize >> PageShift;
     VirtualAddress = ImageSection->VirtualAddress + (PageOffset << PageShift);
+    RegionStart = ALIGN_POINTER_DOWN(VirtualAddress, MmLargePageSize);
+    RegionEnd = RegionStart + MmLargePageSize;
+    RegionOffset = (RegionStart - ImageSection->VirtualAddress) >> PageShift;
 
-    ASSERT((ImageSection->Flags & IMAGE_SECTION_SHARED) != 0);
-    ASSERT((ImageSection->Flags & IMAGE_SECTION_PAGE_CACHE_BACKED) != 0);
-    ASSERT(ImageSection->Parent == NULL);
-    ASSERT(LIST_EMPTY(&(ImageSection->ChildList)) != FALSE);
+    //
+    // Large pages are only created in the current process for user mode
+    // sections that fully contain the aligned region.
+    //
+
+    CurrentProcess = PsGetCurrentProcess();
+    if ((MmLargePageSize == 0) ||
+        (VirtualAddress >= KERNEL_VA_START) ||
+        (ImageSection->AddressSpace != CurrentProcess->AddressSpace) ||
+        (RegionStart < ImageSection->VirtualAddress) ||
+        (RegionEnd > ImageSection->VirtualAddress + ImageSection->Size) ||
+        (RegionEnd > KERNEL_VA_START) ||
+        (RegionEnd < RegionStart) ||
+        (MmpCanMapLargeAnonymousRegion(ImageSection, RegionOffset) == FALSE)) {
+
+        Status = STATUS_NOT_SUPPORTED;
+        goto PageInLargeAnonymousRegionEnd;
+    }
 
     //
-    // Acquire the image section lock to freeze all mappings and unmappings in
-    // this section.
+    // Acquire everything the large page needs before taking the section lock,
+    // as allocations are not allowed with it held. The physical run is only
+    // taken if it is available right now; there is no sense paging out small
+    // pages to make room for a large one.
+    //
+
+    Status = MmpReserveLargePageTable(ImageSection->AddressSpace, &PageTable);
+    if (!KSUCCESS(Status)) {
+        goto PageInLargeAnonymousRegionEnd;
+    }
+
+    PhysicalAddress = MmpTryToAllocatePhysicalPages(LargePageCount,
+                                                    LargePageCount,
+                                                    FALSE);
+
+    if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+        Status = STATUS_NO_MEMORY;
+        goto PageInLargeAnonymousRegionEnd;
+    }
+
+    if ((ImageSection->Flags & IMAGE_SECTION_NON_PAGED) == 0) {
+        PagingEntries = MmAllocateNonPagedPool(
+                                      LargePageCount * sizeof(PPAGING_ENTRY),
+                                      MM_ALLOCATION_TAG);
+
+        if (PagingEntries == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto PageInLargeAnonymousRegionEnd;
+        }
+
+        RtlZeroMemory(PagingEntries, LargePageCount * sizeof(PPAGING_ENTRY));
+        for (PageIndex = 0; PageIndex < LargePageCount; PageIndex += 1) {
+            PagingEntries[PageIndex] = MmpCreatePagingEntry(NULL, 0);
+            if (PagingEntries[PageIndex] == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto PageInLargeAnonymousRegionEnd;
+            }
+        }
+    }
+
+    for (PageIndex = 0; PageIndex < LargePageCount; PageIndex += 1) {
+        MmpZeroPage(PhysicalAddress + (PageIndex << PageShift));
+    }
+
+    //
+    // Take the section lock and make sure nothing changed while the lock was
+    // released.
     //
 
     KeAcquireQueuedLock(ImageSection->Lock);
     LockHeld = TRUE;
+    if (((ImageSection->Flags &
+          (IMAGE_SECTION_DESTROYING | IMAGE_SECTION_DESTROYED)) != 0) ||
+        (RegionEnd > ImageSection->VirtualAddress + ImageSection->Size) ||
+        (MmpCanMapLargeAnonymousRegion(ImageSection, RegionOffset) == FALSE)) {
+
+        Status = STATUS_NOT_SUPPORTED;
+        goto PageInLargeAnonymousRegionEnd;
+    }
 
     //
-    // Take a reference on the image backing handle to ensure it doesn't go
-    // away during the paging operation.
+    // Large pages are always mapped dirty. This keeps a split from ever
+    // losing a dirty bit that a processor sets in the large entry while the
+    // split is in progress.
     //
 
-    MmpImageSectionAddImageBackingReference(ImageSection);
+    MapFlags = MAP_FLAG_PRESENT | MAP_FLAG_USER_MODE | MAP_FLAG_DIRTY;
+    if ((ImageSection->Flags & IMAGE_SECTION_EXECUTABLE) != 0) {
+        MapFlags |= MAP_FLAG_EXECUTE;
+    }
 
     //
-    // While the lock was released, another thread may have paged in this page
-    // so check for an existing mapping. Skip this if the page needs to be
-    // locked as the page cache entry needs to be retrieved via read in order
-    // to lock the page.
+    // This fails if any page in the region is already mapped, or ever had
+    // a page table created for it.
     //
 
-    if (LockedIoBuffer == NULL) {
-        ExistingPhysicalAddress = MmpVirtualToPhysical(VirtualAddress,
-                                                       &Attributes);
-
-        if (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+    Status = MmpMapLargePage(PhysicalAddress, RegionStart, MapFlags, PageTable);
+    if (!KSUCCESS(Status)) {
+        goto PageInLargeAnonymousRegionEnd;
+    }
 
-            ASSERT((Attributes & MAP_FLAG_PRESENT) != 0);
+    PageTable = INVALID_PHYSICAL_ADDRESS;
+    if (ImageSection->MinTouched > RegionStart) {
+        ImageSection->MinTouched = RegionStart;
+    }
 
-            Status = STATUS_SUCCESS;
-            goto PageInSharedSectionEnd;
-        }
+    if (ImageSection->MaxTouched < RegionEnd) {
+        ImageSection->MaxTouched = RegionEnd;
     }
 
     //
-    // Loop trying to read the backing image.
+    // Make every page in the run pageable on its own. If one is ever paged
+    // out, the large page is split first.
     //
 
-    while (TRUE) {
-        if ((ImageSection->Flags & IMAGE_SECTION_DESTROYED) != 0) {
-            Status = STATUS_TOO_LATE;
-            goto PageInSharedSectionEnd;
+    if (PagingEntries != NULL) {
+        for (PageIndex = 0; PageIndex < LargePageCount; PageIndex += 1) {
+            MmpInitializePagingEntry(PagingEntries[PageIndex],
+                                     ImageSection,
+                                     RegionOffset + PageIndex);
         }
 
-        ASSERT(ImageSection->ImageBacking.DeviceHandle != INVALID_HANDLE);
+        MmpEnablePagingOnPhysicalAddress(PhysicalAddress,
+                                         LargePageCount,
+                                         PagingEntries,
+                                         FALSE);
 
-        //
-        // Record the current truncation count for this image section and then
-        // release the lock to perform the read.
-        //
+        MmFreeNonPagedPool(PagingEntries);
+        PagingEntries = NULL;
+    }
 
-        TruncateCount = ImageSection->TruncateCount;
+    PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+
+PageInLargeAnonymousRegionEnd:
+    if (LockHeld != FALSE) {
         KeReleaseQueuedLock(ImageSection->Lock);
-        LockHeld = FALSE;
+    }
 
-        //
-        // Reset the I/O buffer if it was previously used or initialize it.
-        //
+    if (PagingEntries != NULL) {
+        for (PageIndex = 0; PageIndex < LargePageCount; PageIndex += 1) {
+            if (PagingEntries[PageIndex] != NULL) {
+                MmpDestroyPagingEntry(PagingEntries[PageIndex]);
+            }
+        }
 
-        if (IoBuffer != NULL) {
-            MmResetIoBuffer(IoBuffer);
+        MmFreeNonPagedPool(PagingEntries);
+    }
 
-        } else {
-            IoBuffer = &IoBufferData;
-            Status = MmInitializeIoBuffer(IoBuffer,
-                                          NULL,
-                                          INVALID_PHYSICAL_ADDRESS,
-                                          0,
-                                          IO_BUFFER_FLAG_KERNEL_MODE_DATA);
+    if (PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+        MmFreePhysicalPages(PhysicalAddress, LargePageCount);
+    }
 
-            if (!KSUCCESS(Status)) {
-                goto PageInSharedSectionEnd;
-            }
-        }
+    if (PageTable != INVALID_PHYSICAL_ADDRESS) {
+        MmFreePhysicalPage(PageTable);
+    }
 
-        //
-        // Read from the backing image at the faulting page's offset.
-        //
+    return Status;
+}
 
-        Status = MmpReadBackingImage(ImageSection, PageOffset, IoBuffer);
-        if (!KSUCCESS(Status)) {
+BOOL
+MmpCanMapLargeAnonymousRegion (
+    PIMAGE_SECTION ImageSection,
+    UINTN RegionOffset
+    )
 
-            ASSERT(MmGetIoBufferPageCacheEntry(IoBuffer, 0) == NULL);
+/*++
 
-            goto PageInSharedSectionEnd;
-        }
+Routine Description:
 
-        //
-        // Get the physical address from the I/O buffer. It comes directly from
-        // the page cache.
-        //
+    This routine determines whether the given section is eligible to have the
+    large page region at the given offset mapped with a large page.
 
-        ASSERT(IoBuffer->FragmentCount == 1);
-        ASSERT(IoBuffer->Fragment[0].Size == MmPageSize());
+Arguments:
 
-        PageCacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer, 0);
-        PhysicalAddress = IoBuffer->Fragment[0].PhysicalAddress;
+    ImageSection - Supplies a pointer to the anonymous image section.
 
-        ASSERT(PageCacheEntry != NULL);
-        ASSERT(PhysicalAddress ==
-               IoGetPageCacheEntryPhysicalAddress(PageCacheEntry));
+    RegionOffset - Supplies the offset, in pages, from the beginning of the
+        section to the start of the large page region.
+
+Return Value:
+
+    TRUE if the region can be backed by a large page.
+
+    FALSE if the region must be mapped with small pages.
+
+--*/
+
+{
+
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    ULONG Flags;
+    UINTN LargePageCount;
+    UINTN PageOffset;
+
+    //
+    // Only private writable sections qualify. Any copy-on-write relatives
+    // mean pages in the region may need different protections.
+    //
+
+    Flags = ImageSection->Flags;
+    if (((Flags & IMAGE_SECTION_WRITABLE) == 0) ||
+        ((Flags & (IMAGE_SECTION_SHARED |
+                   IMAGE_SECTION_PAGE_CACHE_BACKED)) != 0) ||
+        (ImageSection->Parent != NULL) ||
+        (LIST_EMPTY(&(ImageSection->ChildList)) == FALSE)) {
+
+        return FALSE;
+    }
+
+    //
+    // A page in the region that was ever paged out has contents in the page
+    // file that must be read back in.
+    //
+
+    if (ImageSection->DirtyPageBitmap != NULL) {
+        LargePageCount = MmLargePageSize >> MmPageShift();
+        for (PageOffset = RegionOffset;
+             PageOffset < RegionOffset + LargePageCount;
+             PageOffset += 1) {
+
+            BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(PageOffset);
+            BitmapMask = IMAGE_SECTION_BITMAP_MASK(PageOffset);
+            if ((ImageSection->DirtyPageBitmap[BitmapIndex] &
+                 BitmapMask) != 0) {
+
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+KSTATUS
+MmpPageInSharedSection (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset,
+    PIO_BUFFER LockedIoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pages a physical page in from the page cache. This routine
+    must be called at low level.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section within the process
+        to page in.
+
+    PageOffset - Supplies the offset, in pages, from the beginning of the
+        section.
+
+    LockedIoBuffer - Supplies an optional pointer to an uninitialized I/O
+        buffer that will be initialized with the the paged in page, effectively
+        locking the page until the I/O buffer is released.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Attributes;
+    PHYSICAL_ADDRESS ExistingPhysicalAddress;
+    PIO_BUFFER IoBuffer;
+    IO_BUFFER IoBufferData;
+    BOOL LockHeld;
+    ULONG MapFlags;
+    PPAGE_CACHE_ENTRY PageCacheEntry;
+    ULONG PageShift;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    KSTATUS Status;
+    ULONG TruncateCount;
+    PVOID VirtualAddress;
+
+    ExistingPhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+    IoBuffer = NULL;
+    PageCacheEntry = NULL;
+    PageShift = MmPageShift();
+    PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+    VirtualAddress = ImageSection->VirtualAddress + (PageOffset << PageShift);
+
+    ASSERT((ImageSection->Flags & IMAGE_SECTION_SHARED) != 0);
+    ASSERT((ImageSection->Flags & IMAGE_SECTION_PAGE_CACHE_BACKED) != 0);
+    ASSERT(ImageSection->Parent == NULL);
+    ASSERT(LIST_EMPTY(&(ImageSection->ChildList)) != FALSE);
+
+    //
+    // Acquire the image section lock to freeze all mappings and unmappings in
+    // this section.
+    //
+
+    KeAcquireQueuedLock(ImageSection->Lock);
+    LockHeld = TRUE;
+
+    //
+    // Take a reference on the image backing handle to ensure it doesn't go
+    // away during the paging operation.
+    //
+
+    MmpImageSectionAddImageBackingReference(ImageSection);
+
+    //
+    // While the lock was released, another thread may have paged in this page
+    // so check for an existing mapping. Skip this if the page needs to be
+    // locked as the page cache entry needs to be retrieved via read in order
+    // to lock the page.
+    //
+
+    if (LockedIoBuffer == NULL) {
+        ExistingPhysicalAddress = MmpVirtualToPhysical(VirtualAddress,
+                                                       &Attributes);
+
+        if (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+
+            ASSERT((Attributes & MAP_FLAG_PRESENT) != 0);
+
+            Status = STATUS_SUCCESS;
+            goto PageInSharedSectionEnd;
+        }
+    }
+
+    //
+    // Loop trying to read the backing image.
+    //
+
+    while (TRUE) {
+        if ((ImageSection->Flags & IMAGE_SECTION_DESTROYED) != 0) {
+            Status = STATUS_TOO_LATE;
+            goto PageInSharedSectionEnd;
+        }
+
+        ASSERT(ImageSection->ImageBacking.DeviceHandle != INVALID_HANDLE);
+
+        //
+        // Record the current truncation count for this image section and then
+        // release the lock to perform the read.
+        //
+
+        TruncateCount = ImageSection->TruncateCount;
+        KeReleaseQueuedLock(ImageSection->Lock);
+        LockHeld = FALSE;
+
+        //
+        // Reset the I/O buffer if it was previously used or initialize it.
+        //
+
+        if (IoBuffer != NULL) {
+            MmResetIoBuffer(IoBuffer);
+
+        } else {
+            IoBuffer = &IoBufferData;
+            Status = MmInitializeIoBuffer(IoBuffer,
+                                          NULL,
+                                          INVALID_PHYSICAL_ADDRESS,
+                                          0,
+                                          IO_BUFFER_FLAG_KERNEL_MODE_DATA);
+
+            if (!KSUCCESS(Status)) {
+                goto PageInSharedSectionEnd;
+            }
+        }
+
+        //
+        // Read from the backing image at the faulting page's offset.
+        //
+
+        Status = MmpReadBackingImage(ImageSection, PageOffset, IoBuffer);
+        if (!KSUCCESS(Status)) {
+
+            ASSERT(MmGetIoBufferPageCacheEntry(IoBuffer, 0) == NULL);
+
+            goto PageInSharedSectionEnd;
+        }
+
+        //
+        // Get the physical address from the I/O buffer. It comes directly from
+        // the page cache.
+        //
+
+        ASSERT(IoBuffer->FragmentCount == 1);
+        ASSERT(IoBuffer->Fragment[0].Size == MmPageSize());
+
+        PageCacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer, 0);
+        PhysicalAddress = IoBuffer->Fragment[0].PhysicalAddress;
+
+        ASSERT(PageCacheEntry != NULL);
+        ASSERT(PhysicalAddress ==
+               IoGetPageCacheEntryPhysicalAddress(PageCacheEntry));
 
         //
         // Acquire the image section lock.
@@ -3314,9 +3774,12 @@ Return Value:
 
     UINTN BitmapIndex;
     ULONG BitmapMask;
+    UINTN BufferOffset;
     PAGE_IN_CONTEXT Context;
     PULONG DirtyPageBitmap;
     PHYSICAL_ADDRESS ExistingPhysicalAddress;
+    UINTN FaultAroundPages;
+    UINTN FaultAroundStart;
     PIO_BUFFER IoBuffer;
     IO_BUFFER IoBufferData;
     ULONG IoBufferFlags;
@@ -3344,6 +3807,8 @@ Return Value:
     ASSERT(Context.PhysicalAddress == INVALID_PHYSICAL_ADDRESS);
 
     ExistingPhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+    FaultAroundPages = 0;
+    FaultAroundStart = PageOffset;
     IoBuffer = NULL;
     LockHeld = FALSE;
     LockPageCacheEntry = FALSE;
@@ -3607,10 +4072,25 @@ Return Value:
         }
 
         //
-        // Read from the backing image at the faulting page's offset.
+        // Unless the page needs to be locked, read a window of pages around
+        // the fault in one request so that neighboring pages can be mapped
+        // too. Fall back to reading just the faulting page's offset.
         //
 
-        Status = MmpReadBackingImage(ImageSection, PageOffset, IoBuffer);
+        FaultAroundPages = 0;
+        FaultAroundStart = PageOffset;
+        if (LockPage == FALSE) {
+            FaultAroundPages = MmpReadBackingImageWindow(ImageSection,
+                                                         PageOffset,
+                                                         IoBuffer,
+                                                         &FaultAroundStart);
+        }
+
+        Status = STATUS_SUCCESS;
+        if (FaultAroundPages == 0) {
+            Status = MmpReadBackingImage(ImageSection, PageOffset, IoBuffer);
+        }
+
         MmpImageSectionReleaseImageBackingReference(ImageSection);
         if (!KSUCCESS(Status)) {
 
@@ -3623,11 +4103,13 @@ Return Value:
         // Get the page cache entry and physical address that were just read.
         //
 
-        ASSERT(IoBuffer->FragmentCount == 1);
-        ASSERT(IoBuffer->Fragment[0].Size == MmPageSize());
+        ASSERT((FaultAroundPages != 0) || (IoBuffer->FragmentCount == 1));
+        ASSERT((FaultAroundPages != 0) ||
+               (IoBuffer->Fragment[0].Size == MmPageSize()));
 
-        PageCacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer, 0);
-        PageCacheAddress = IoBuffer->Fragment[0].PhysicalAddress;
+        BufferOffset = (PageOffset - FaultAroundStart) << PageShift;
+        PageCacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer, BufferOffset);
+        PageCacheAddress = MmGetIoBufferPhysicalAddress(IoBuffer, BufferOffset);
 
         ASSERT(PageCacheAddress ==
                IoGetPageCacheEntryPhysicalAddress(PageCacheEntry));
@@ -3888,6 +4370,22 @@ Return Value:
                                     PagingEntry,
                                     LockPage);
 
+                //
+                // Map in the rest of the window that was read along with a
+                // page cache page. The I/O buffer still holds references on
+                // those page cache entries.
+                //
+
+                if ((FaultAroundPages != 0) &&
+                    (Context.PhysicalAddress == PageCacheAddress)) {
+
+                    MmpMapFaultAroundPages(ImageSection,
+                                           IoBuffer,
+                                           FaultAroundStart,
+                                           FaultAroundPages,
+                                           PageOffset);
+                }
+
                 Context.PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
             }
         }
@@ -4787,6 +5285,23 @@ Return Value:
                SwapSpace,
                MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL);
 
+    //
+    // Read the page in from the backing store of the owning section. Note that
+    // the root section may page in from a different file and device. The
+    // compressed pool may be holding the page instead of the page file.
+    //
+
+    ReadOffset = OwningSection->PageFileBacking.Offset +
+                 (PageOffset << PageShift);
+
+    Status = MmpLoadCompressedPage((HANDLE)PageFile,
+                                   ReadOffset >> PageShift,
+                                   SwapSpace);
+
+    if (KSUCCESS(Status)) {
+        goto ReadPageFileSync;
+    }
+
     IoBuffer = &IoBufferData;
     IoBufferFlags = IO_BUFFER_FLAG_KERNEL_MODE_DATA |
                     IO_BUFFER_FLAG_MEMORY_LOCKED;
@@ -4801,14 +5316,6 @@ Return Value:
         goto ReadPageFileEnd;
     }
 
-    //
-    // Read the page in from the backing store of the owning section. Note that
-    // the root section may page in from a different file and device.
-    //
-
-    ReadOffset = OwningSection->PageFileBacking.Offset +
-                 (PageOffset << PageShift);
-
     Status = IoReadAtOffset(PageFile->Handle,
                             IoBuffer,
                             ReadOffset,
@@ -4830,6 +5337,7 @@ Return Value:
     // Unmap the page from the temporary space.
     //
 
+ReadPageFileSync:
     if ((OwningSection->Flags & IMAGE_SECTION_EXECUTABLE) != 0) {
         MmpSyncSwapPage(SwapSpace, PageSize);
     }
@@ -4839,6 +5347,97 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+MmpWritePageFile (
+    PPAGE_FILE PageFile,
+    PIO_BUFFER IoBuffer,
+    PVOID Pages,
+    IO_OFFSET Offset,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes a batch of pages out to the page file. Each page is
+    first offered to the compressed pool, and only the runs of pages it did
+    not take are written to disk.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file to write to.
+
+    IoBuffer - Supplies a pointer to the I/O buffer describing the pages.
+
+    Pages - Supplies the virtual address the pages are mapped at.
+
+    Offset - Supplies the page file offset of the first page.
+
+    PageCount - Supplies the number of pages to write.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    UINTN Index;
+    ULONG PageShift;
+    UINTN RunSize;
+    UINTN RunStart;
+    KSTATUS Status;
+
+    PageShift = MmPageShift();
+    RunStart = 0;
+    for (Index = 0; Index <= PageCount; Index += 1) {
+        if (Index < PageCount) {
+            Status = MmpStoreCompressedPage((HANDLE)PageFile,
+                                            (Offset >> PageShift) + Index,
+                                            Pages + (Index << PageShift));
+
+            if (!KSUCCESS(Status)) {
+                continue;
+            }
+        }
+
+        //
+        // This page was kept in memory (or the end was reached), so write out
+        // the run of pages before it that were not. Acquire the page file's
+        // lock in order to use its paging out IRP.
+        //
+
+        if (Index != RunStart) {
+            RunSize = (Index - RunStart) << PageShift;
+            MmSetIoBufferCurrentOffset(IoBuffer, RunStart << PageShift);
+            KeAcquireQueuedLock(PageFile->Lock);
+            Status = IoWriteAtOffset(PageFile->Handle,
+                                     IoBuffer,
+                                     Offset + (RunStart << PageShift),
+                                     RunSize,
+                                     IO_FLAG_NO_ALLOCATE |
+                                     IO_FLAG_SERVICING_FAULT,
+                                     WAIT_TIME_INDEFINITE,
+                                     &BytesCompleted,
+                                     PageFile->PagingOutIrp);
+
+            KeReleaseQueuedLock(PageFile->Lock);
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+
+            ASSERT(BytesCompleted == RunSize);
+        }
+
+        RunStart = Index + 1;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 KSTATUS
 MmpReadBackingImage (
     PIMAGE_SECTION Section,
@@ -4918,6 +5517,328 @@ Return Value:
     return Status;
 }
 
+UINTN
+MmpReadBackingImageWindow (
+    PIMAGE_SECTION Section,
+    UINTN PageOffset,
+    PIO_BUFFER IoBuffer,
+    PUINTN WindowStart
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads an aligned window of pages containing the given page
+    from a page cache backed section's image. Pages missing from the page
+    cache are read from the device together.
+
+Arguments:
+
+    Section - Supplies a pointer to a page cache backed image section.
+
+    PageOffset - Supplies the offset, in pages, of the page that must be
+        included in the window.
+
+    IoBuffer - Supplies a pointer to an empty I/O buffer that will receive the
+        page cache entries of the window.
+
+    WindowStart - Supplies a pointer where the offset, in pages, of the first
+        page in the window will be returned.
+
+Return Value:
+
+    Returns the number of pages in the I/O buffer on success.
+
+    0 if fault-around is disabled, the window would only contain the one page,
+    or the read did not cover the requested page. The I/O buffer is empty in
+    this case.
+
+--*/
+
+{
+
+    UINTN BytesRead;
+    UINTN End;
+    ULONG PageShift;
+    ULONG PageSize;
+    IO_OFFSET ReadOffset;
+    UINTN SectionPages;
+    UINTN Start;
+    KSTATUS Status;
+
+    ASSERT(Section->ImageBacking.DeviceHandle != INVALID_HANDLE);
+    ASSERT((Section->Flags & IMAGE_SECTION_PAGE_CACHE_BACKED) != 0);
+
+    if (MmFaultAroundPages <= 1) {
+        return 0;
+    }
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    SectionPages = Section->Size >> PageShift;
+    Start = PageOffset - (PageOffset % MmFaultAroundPages);
+    End = Start + MmFaultAroundPages;
+    if (End > SectionPages) {
+        End = SectionPages;
+    }
+
+    if ((End <= PageOffset) || ((End - Start) <= 1)) {
+        return 0;
+    }
+
+    ReadOffset = Section->ImageBacking.Offset + (Start << PageShift);
+    Status = IoReadAtOffset(Section->ImageBacking.DeviceHandle,
+                            IoBuffer,
+                            ReadOffset,
+                            (End - Start) << PageShift,
+                            IO_FLAG_SERVICING_FAULT,
+                            WAIT_TIME_INDEFINITE,
+                            &BytesRead,
+                            NULL);
+
+    //
+    // A window running past the end of the file comes back short. That's
+    // fine as long as the faulting page made it.
+    //
+
+    End = Start + (ALIGN_RANGE_UP(BytesRead, PageSize) >> PageShift);
+    if ((!KSUCCESS(Status)) || (End <= PageOffset)) {
+        MmResetIoBuffer(IoBuffer);
+        return 0;
+    }
+
+    *WindowStart = Start;
+    return End - Start;
+}
+
+VOID
+MmpMapFaultAroundPages (
+    PIMAGE_SECTION Section,
+    PIO_BUFFER IoBuffer,
+    UINTN WindowStart,
+    UINTN WindowPages,
+    UINTN FaultingOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps the page cache pages read around a fault into the
+    section, saving the faults that would otherwise be taken on them. Pages
+    that are already mapped or that no longer come from the page cache are
+    skipped. The pages get the same mapping a fault would have given them, so
+    private sections map them read-only. The section lock must be held.
+
+Arguments:
+
+    Section - Supplies a pointer to the faulting image section.
+
+    IoBuffer - Supplies a pointer to the I/O buffer holding the page cache
+        entries of the window.
+
+    WindowStart - Supplies the offset, in pages, of the first page in the
+        window.
+
+    WindowPages - Supplies the number of pages in the window.
+
+    FaultingOffset - Supplies the offset, in pages, of the page that was
+        faulted in, which has already been mapped.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    UINTN Index;
+    PIMAGE_SECTION OwningSection;
+    UINTN PageOffset;
+    ULONG PageShift;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN SectionPages;
+    PVOID VirtualAddress;
+
+    ASSERT(KeIsQueuedLockHeld(Section->Lock) != FALSE);
+
+    PageShift = MmPageShift();
+    SectionPages = Section->Size >> PageShift;
+    for (Index = 0; Index < WindowPages; Index += 1) {
+        PageOffset = WindowStart + Index;
+        if (PageOffset == FaultingOffset) {
+            continue;
+        }
+
+        if (PageOffset >= SectionPages) {
+            break;
+        }
+
+        VirtualAddress = Section->VirtualAddress + (PageOffset << PageShift);
+        PhysicalAddress = MmpVirtualToPhysical(VirtualAddress, NULL);
+        if (PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+            continue;
+        }
+
+        //
+        // Skip pages whose owner has its own dirty copy, as those come from
+        // the page file and not the page cache.
+        //
+
+        OwningSection = MmpGetOwningSection(Section, PageOffset);
+        BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(PageOffset);
+        BitmapMask = IMAGE_SECTION_BITMAP_MASK(PageOffset);
+        if (((OwningSection->Flags & IMAGE_SECTION_DESTROYED) == 0) &&
+            ((OwningSection->DirtyPageBitmap[BitmapIndex] & BitmapMask) == 0)) {
+
+            PhysicalAddress = MmGetIoBufferPhysicalAddress(IoBuffer,
+                                                           Index << PageShift);
+
+            MmpMapPageInSection(OwningSection,
+                                PageOffset,
+                                PhysicalAddress,
+                                NULL,
+                                FALSE);
+        }
+
+        MmpImageSectionReleaseReference(OwningSection);
+    }
+
+    return;
+}
+
+BOOL
+MmpMapInheritedPage (
+    PIMAGE_SECTION Section,
+    UINTN PageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps a page that the given section inherits from another
+    section, if that page is already resident in the owning section. Sections
+    created by fork do not get their parent's mappings copied, so this is how
+    they pick up the pages they share.
+
+Arguments:
+
+    Section - Supplies a pointer to the faulting image section, which must
+        belong to the current process.
+
+    PageOffset - Supplies the offset in pages from the beginning of the section
+        of the page to map.
+
+Return Value:
+
+    TRUE if the page is now mapped in the given section.
+
+    FALSE if the page is not resident in its owning section, or the section
+    owns the page itself. The caller must page it in the usual way.
+
+--*/
+
+{
+
+    BOOL CanWrite;
+    PHYSICAL_ADDRESS ExistingPhysicalAddress;
+    ULONG MapFlags;
+    BOOL Mapped;
+    PIMAGE_SECTION OwningSection;
+    ULONG PageShift;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PVOID VirtualAddress;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    VirtualAddress = Section->VirtualAddress + (PageOffset << PageShift);
+    if ((Section->AddressSpace != PsGetCurrentProcess()->AddressSpace) ||
+        ((Section->Flags & IMAGE_SECTION_ACCESS_MASK) == 0)) {
+
+        return FALSE;
+    }
+
+    ASSERT(VirtualAddress < KERNEL_VA_START);
+    ASSERT((Section->Flags & IMAGE_SECTION_SHARED) == 0);
+
+    //
+    // Make sure the page table is there before acquiring the section lock so
+    // that no physical page allocation happens while holding it.
+    //
+
+    MmpCreatePageTables(VirtualAddress, PageSize);
+    Mapped = FALSE;
+    OwningSection = NULL;
+    KeAcquireQueuedLock(Section->Lock);
+    if (((Section->Flags & IMAGE_SECTION_DESTROYED) != 0) ||
+        ((Section->Size >> PageShift) <= PageOffset)) {
+
+        goto MapInheritedPageEnd;
+    }
+
+    ExistingPhysicalAddress = MmpVirtualToPhysical(VirtualAddress, NULL);
+    if (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+        Mapped = TRUE;
+        goto MapInheritedPageEnd;
+    }
+
+    OwningSection = MmpGetOwningSection(Section, PageOffset);
+    if ((OwningSection == Section) ||
+        ((OwningSection->Flags & IMAGE_SECTION_DESTROYED) != 0)) {
+
+        goto MapInheritedPageEnd;
+    }
+
+    //
+    // The owning section maps its page whenever it is resident, and the
+    // section lock keeps it from being paged out from under this routine.
+    //
+
+    if (MmpIsImageSectionMapped(OwningSection,
+                                PageOffset,
+                                &PhysicalAddress) == FALSE) {
+
+        goto MapInheritedPageEnd;
+    }
+
+    MapFlags = MAP_FLAG_PAGABLE | MAP_FLAG_USER_MODE | MAP_FLAG_PRESENT;
+    if ((Section->Flags & IMAGE_SECTION_EXECUTABLE) != 0) {
+        MapFlags |= MAP_FLAG_EXECUTE;
+    }
+
+    CanWrite = MmpCanWriteToSection(OwningSection, Section, PageOffset);
+    if (CanWrite == FALSE) {
+        MapFlags |= MAP_FLAG_READ_ONLY;
+    }
+
+    if (Section->MinTouched > VirtualAddress) {
+        Section->MinTouched = VirtualAddress;
+    }
+
+    if (Section->MaxTouched < VirtualAddress + PageSize) {
+        Section->MaxTouched = VirtualAddress + PageSize;
+    }
+
+    MmpMapPage(PhysicalAddress, VirtualAddress, MapFlags);
+    Mapped = TRUE;
+
+MapInheritedPageEnd:
+    KeReleaseQueuedLock(Section->Lock);
+    if (OwningSection != NULL) {
+        MmpImageSectionReleaseReference(OwningSection);
+    }
+
+    return Mapped;
+}
+
 VOID
 MmpMapPageInSection (
     PIMAGE_SECTION OwningSection,
@@ -4961,8 +5882,36 @@ Return Value:
 
 {
 
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    HANDLE PageFile;
+    UINTN PageIndex;
+    ULONG PageShift;
+
     ASSERT(PhysicalAddress != INVALID_PHYSICAL_ADDRESS);
 
+    //
+    // Once a page that came from the page file is resident again, any
+    // compressed copy of it is stale. Pages in the dirty bitmap are always
+    // written again when paged out, so drop the copy now rather than letting
+    // it hold onto pool space.
+    //
+
+    if ((OwningSection->DirtyPageBitmap != NULL) &&
+        (OwningSection->PageFileBacking.DeviceHandle != INVALID_HANDLE)) {
+
+        BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(PageOffset);
+        BitmapMask = IMAGE_SECTION_BITMAP_MASK(PageOffset);
+        if ((OwningSection->DirtyPageBitmap[BitmapIndex] & BitmapMask) != 0) {
+            PageShift = MmPageShift();
+            PageIndex = (OwningSection->PageFileBacking.Offset >> PageShift) +
+                        PageOffset;
+
+            PageFile = OwningSection->PageFileBacking.DeviceHandle;
+            MmpDiscardCompressedPages(PageFile, PageIndex, 1);
+        }
+    }
+
     //
     // Map the page in the owning section and all its inheriting children.
     //
@@ -101,6 +101,20 @@ Module Name:
 
 #define PAGING_EVENT_SIGNAL_PAGE_COUNT 0x10
 
+//
+// Define the maximum number of physical address ranges that can be assigned
+// to a zone other than the normal zone.
+//
+
+#define MAX_PHYSICAL_ZONE_RANGES 8
+
+//
+// Define the end of the default DMA zone. Legacy DMA engines can only reach
+// the first 16MB of physical memory.
+//
+
+#define PHYSICAL_ZONE_DMA_END (16 * _1MB)
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -177,6 +191,9 @@ Structure Description:
 
     FreePages - Stores the number of unallocated pages in the segment.
 
+    Zone - Stores the physical memory zone the segment belongs to. Segments
+        never straddle zones.
+
 --*/
 
 typedef struct _PHYSICAL_MEMORY_SEGMENT {
@@ -184,10 +201,34 @@ typedef struct _PHYSICAL_MEMORY_SEGMENT {
     PHYSICAL_ADDRESS StartAddress;
     PHYSICAL_ADDRESS EndAddress;
     UINTN FreePages;
+    PHYSICAL_MEMORY_ZONE Zone;
 } PHYSICAL_MEMORY_SEGMENT, *PPHYSICAL_MEMORY_SEGMENT;
 
 /*++
 
+Structure Description:
+
+    This structure describes a range of physical memory that belongs to a
+    particular zone.
+
+Members:
+
+    StartAddress - Stores the first physical address in the range.
+
+    EndAddress - Stores the first physical address after the range.
+
+    Zone - Stores the zone the range belongs to.
+
+--*/
+
+typedef struct _PHYSICAL_MEMORY_ZONE_RANGE {
+    PHYSICAL_ADDRESS StartAddress;
+    PHYSICAL_ADDRESS EndAddress;
+    PHYSICAL_MEMORY_ZONE Zone;
+} PHYSICAL_MEMORY_ZONE_RANGE, *PPHYSICAL_MEMORY_ZONE_RANGE;
+
+/*++
+
 Structure Description:
 
     This structure defines the iteration context when initializing the physical
@@ -227,11 +268,20 @@ typedef struct _INIT_PHYSICAL_MEMORY_ITERATOR {
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+PPHYSICAL_MEMORY_SEGMENT
+MmpFindFreePhysicalPages (
+    UINTN PageCount,
+    UINTN PageAlignment,
+    BOOL HonorStrict,
+    PUINTN SelectedPageOffset
+    );
+
 PPHYSICAL_MEMORY_SEGMENT
 MmpFindPhysicalPages (
     UINTN PageCount,
     UINTN PageAlignment,
     PHYSICAL_MEMORY_SEARCH_TYPE SearchType,
+    PHYSICAL_MEMORY_ZONE Zone,
     PUINTN SelectedPageOffset,
     PUINTN PagesFound
     );
@@ -249,6 +299,17 @@ MmpUpdatePhysicalMemoryStatistics (
     BOOL Allocation
     );
 
+PHYSICAL_MEMORY_ZONE
+MmpGetPhysicalZone (
+    PHYSICAL_ADDRESS PhysicalAddress
+    );
+
+UINTN
+MmpCountPhysicalZoneBoundaries (
+    PHYSICAL_ADDRESS StartAddress,
+    PHYSICAL_ADDRESS EndAddress
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -308,6 +369,15 @@ UINTN MmLastAllocatedSegmentOffset;
 PPHYSICAL_MEMORY_SEGMENT MmLastPagedSegment;
 UINTN MmLastPagedSegmentOffset;
 
+//
+// Store the number of pages the pager has considered for eviction, and the
+// number of those it spared because they had been recently accessed. These
+// are only modified by the paging thread.
+//
+
+UINTN MmPagerScannedPages;
+UINTN MmPagerReferencedPages;
+
 //
 // Stores the lock protecting access to physical page data structures.
 //
@@ -368,6 +438,41 @@ UINTN MmPhysicalMemoryFreeCount;
 
 BOOL MmPhysicalPageZeroAvailable = FALSE;
 
+//
+// Store the physical address ranges that belong to zones other than the normal
+// zone. The boot memory map carries no notion of memory speed, so platforms
+// with on-chip SRAM or other fast memory add fast zone ranges here before the
+// physical page allocator is initialized. Memory not covered by any range is
+// in the normal zone.
+//
+
+PHYSICAL_MEMORY_ZONE_RANGE MmPhysicalZoneRanges[MAX_PHYSICAL_ZONE_RANGES] = {
+    {0, PHYSICAL_ZONE_DMA_END, PhysicalMemoryZoneDma},
+};
+
+ULONG MmPhysicalZoneRangeCount = 1;
+
+//
+// Store the order in which zones are tried when the preferred zone cannot
+// satisfy an allocation. DMA memory goes last so that it remains available to
+// the devices that need it.
+//
+
+PHYSICAL_MEMORY_ZONE MmPhysicalZoneFallbackOrder[PhysicalMemoryZoneCount] = {
+    PhysicalMemoryZoneNormal,
+    PhysicalMemoryZoneFast,
+    PhysicalMemoryZoneDma
+};
+
+//
+// Store the number of allocations satisfied by each zone, and how many of
+// those were fallbacks from another zone. These are protected by the physical
+// page lock.
+//
+
+ULONGLONG MmPhysicalZoneAllocations[PhysicalMemoryZoneCount];
+ULONGLONG MmPhysicalZoneFallbacks[PhysicalMemoryZoneCount];
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -430,6 +535,7 @@ Return Value:
     return MmPhysicalMemoryWarningLevel;
 }
 
+KERNEL_API
 UINTN
 MmGetTotalPhysicalPages (
     VOID
@@ -456,6 +562,7 @@ Return Value:
     return MmTotalPhysicalPages;
 }
 
+KERNEL_API
 UINTN
 MmGetTotalFreePhysicalPages (
     VOID
@@ -482,6 +589,50 @@ Return Value:
     return MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages;
 }
 
+KERNEL_API
+ULONG
+MmSetPhysicalZonePolicy (
+    ULONG Policy
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the physical memory zone policy for the current thread.
+    Physical pages allocated on behalf of the thread come from the preferred
+    zone when it has room, and otherwise from the other zones in the system's
+    fallback order unless the policy is strict.
+
+Arguments:
+
+    Policy - Supplies the new policy. The low bits hold the preferred
+        PHYSICAL_MEMORY_ZONE. See PHYSICAL_ZONE_POLICY_* for flags.
+
+Return Value:
+
+    Returns the previous policy, which the caller should restore when done.
+
+--*/
+
+{
+
+    ULONG OldPolicy;
+    PKTHREAD Thread;
+
+    ASSERT((Policy & PHYSICAL_ZONE_POLICY_ZONE_MASK) <
+           PhysicalMemoryZoneCount);
+
+    Thread = KeGetCurrentThread();
+    if (Thread == NULL) {
+        return PHYSICAL_ZONE_POLICY_DEFAULT;
+    }
+
+    OldPolicy = Thread->PhysicalZonePolicy;
+    Thread->PhysicalZonePolicy = Policy;
+    return OldPolicy;
+}
+
 VOID
 MmFreePhysicalPages (
     PHYSICAL_ADDRESS PhysicalAddress,
@@ -920,9 +1071,41 @@ Return Value:
 
 {
 
+    PLIST_ENTRY CurrentEntry;
+    ULONG PageShift;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    PMM_PHYSICAL_ZONE_STATISTICS Zone;
+    ULONG ZoneIndex;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    PageShift = MmPageShift();
+    KeAcquireQueuedLock(MmPhysicalPageLock);
     Statistics->PhysicalPages = MmTotalPhysicalPages;
     Statistics->AllocatedPhysicalPages = MmTotalAllocatedPhysicalPages;
     Statistics->NonPagedPhysicalPages = MmNonPagedPhysicalPages;
+    Statistics->PagerScannedPages = MmPagerScannedPages;
+    Statistics->PagerReferencedPages = MmPagerReferencedPages;
+    for (ZoneIndex = 0; ZoneIndex < PhysicalMemoryZoneCount; ZoneIndex += 1) {
+        Zone = &(Statistics->Zones[ZoneIndex]);
+        Zone->TotalPages = 0;
+        Zone->FreePages = 0;
+        Zone->Allocations = MmPhysicalZoneAllocations[ZoneIndex];
+        Zone->Fallbacks = MmPhysicalZoneFallbacks[ZoneIndex];
+    }
+
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        Zone = &(Statistics->Zones[Segment->Zone]);
+        Zone->TotalPages += (Segment->EndAddress - Segment->StartAddress) >>
+                            PageShift;
+
+        Zone->FreePages += Segment->FreePages;
+    }
+
+    KeReleaseQueuedLock(MmPhysicalPageLock);
     return;
 }
 
@@ -993,14 +1176,15 @@ Return Value:
         }
 
         //
-        // Attempt to find some free pages.
+        // Attempt to find some free pages. A strict zone policy is only
+        // honored on the first pass. The pager frees pages from whichever zone
+        // it likes, so waiting on it for a specific zone may never succeed.
         //
 
-        Segment = MmpFindPhysicalPages(PageCount,
-                                       Alignment,
-                                       PhysicalMemoryFindFree,
-                                       &SegmentOffset,
-                                       NULL);
+        Segment = MmpFindFreePhysicalPages(PageCount,
+                                           Alignment,
+                                           (Timeout == 0),
+                                           &SegmentOffset);
 
         //
         // If a section of free memory was available, grab it up!
@@ -1099,6 +1283,111 @@ Return Value:
     return WorkingAllocation;
 }
 
+PHYSICAL_ADDRESS
+MmpTryToAllocatePhysicalPages (
+    UINTN PageCount,
+    UINTN Alignment,
+    BOOL UseReserve
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to allocate physical pages without waiting. Unlike
+    the regular allocation routine, it never pages out or blocks waiting for
+    memory, so it is suitable for opportunistic allocations that have a
+    fallback.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive physical pages required.
+
+    Alignment - Supplies the alignment requirement of the allocation, in pages.
+        Valid values are powers of 2. Values of 1 or 0 indicate no alignment
+        requirement.
+
+    UseReserve - Supplies a boolean indicating whether the allocation may dip
+        into the free pages the system keeps in reserve. This is only meant
+        for the paging thread, which cannot wait on itself, and only when it
+        is about to free more pages than it takes.
+
+Return Value:
+
+    Returns the physical address of the first page of allocated memory on
+    success, or INVALID_PHYSICAL_ADDRESS if no suitable free run exists right
+    now.
+
+--*/
+
+{
+
+    PHYSICAL_ADDRESS Allocation;
+    UINTN FreePages;
+    UINTN PageIndex;
+    volatile PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentOffset;
+    BOOL SignalEvent;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT(MmPhysicalPageLock != NULL);
+
+    Allocation = INVALID_PHYSICAL_ADDRESS;
+    SignalEvent = FALSE;
+    if (Alignment == 0) {
+        Alignment = 1;
+    }
+
+    KeAcquireQueuedLock(MmPhysicalPageLock);
+
+    //
+    // Do not dip into the pages the system keeps in reserve. An opportunistic
+    // allocation should never be the one that forces paging.
+    //
+
+    FreePages = MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages;
+    if ((UseReserve == FALSE) &&
+        (FreePages < (MmMinimumFreePhysicalPages + PageCount))) {
+
+        goto TryToAllocatePhysicalPagesEnd;
+    }
+
+    Segment = MmpFindFreePhysicalPages(PageCount,
+                                       Alignment,
+                                       TRUE,
+                                       &SegmentOffset);
+
+    if (Segment == NULL) {
+        goto TryToAllocatePhysicalPagesEnd;
+    }
+
+    Allocation = Segment->StartAddress + (SegmentOffset << MmPageShift());
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    PhysicalPage += SegmentOffset;
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+
+        ASSERT(PhysicalPage->U.Free == PHYSICAL_PAGE_FREE);
+
+        PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
+        PhysicalPage += 1;
+    }
+
+    Segment->FreePages -= PageCount;
+    SignalEvent = MmpUpdatePhysicalMemoryStatistics(PageCount, TRUE);
+
+TryToAllocatePhysicalPagesEnd:
+    KeReleaseQueuedLock(MmPhysicalPageLock);
+    if (SignalEvent != FALSE) {
+
+        ASSERT(MmPhysicalMemoryWarningEvent != NULL);
+
+        KeSignalEvent(MmPhysicalMemoryWarningEvent, SignalOptionPulse);
+    }
+
+    return Allocation;
+}
+
 PHYSICAL_ADDRESS
 MmpAllocateIdentityMappablePhysicalPages (
     UINTN PageCount,
@@ -1154,6 +1443,7 @@ Return Value:
     Segment = MmpFindPhysicalPages(PageCount,
                                    Alignment,
                                    PhysicalMemoryFindIdentityMappable,
+                                   PhysicalMemoryZoneCount,
                                    &SegmentOffset,
                                    NULL);
 
@@ -1928,6 +2218,8 @@ Return Value:
     PPAGING_ENTRY PagingEntry;
     PHYSICAL_ADDRESS PhysicalAddress;
     PPHYSICAL_PAGE PhysicalPage;
+    BOOL SecondChance;
+    UINTN SecondChanceCount;
     PIMAGE_SECTION Section;
     UINTN SectionOffset;
     PPHYSICAL_MEMORY_SEGMENT Segment;
@@ -1939,13 +2231,18 @@ Return Value:
     PageShift = MmPageShift();
 
     //
-    // Now attempt to swap pages out to the backing store. This algorithm can
-    // get more intelligent with time, but for now just round robin the
-    // evictions.
+    // Now attempt to swap pages out to the backing store. The search sweeps
+    // across physical memory like the hand of a clock. A page that has been
+    // accessed since the hand last passed it has its accessed state cleared
+    // and is skipped, and is only evicted if it is still idle the next time
+    // around. If an entire revolution goes by without anything being evicted,
+    // then everything is hot and the second chances stop until progress is
+    // made.
     //
 
     FailureCount = 0;
     PageCountSinceEvent = 0;
+    SecondChanceCount = 0;
     TotalPagesPaged = 0;
     while (TRUE) {
         if (MmPhysicalPageLock != NULL) {
@@ -1984,6 +2281,7 @@ Return Value:
         Segment = MmpFindPhysicalPages(1,
                                        1,
                                        PhysicalMemoryFindPagable,
+                                       PhysicalMemoryZoneCount,
                                        &SegmentOffset,
                                        &PagesFound);
 
@@ -2010,6 +2308,13 @@ Return Value:
 
         Section = PagingEntry->Section;
         SectionOffset = PagingEntry->U.SectionOffset;
+        SecondChance = FALSE;
+        if (SecondChanceCount <
+            MmTotalPhysicalPages - MmNonPagedPhysicalPages) {
+
+            SecondChance = TRUE;
+        }
+
         if (LockHeld != FALSE) {
             KeReleaseQueuedLock(MmPhysicalPageLock);
             LockHeld = FALSE;
@@ -2025,9 +2330,15 @@ Return Value:
                             PhysicalAddress,
                             IoBuffer,
                             SwapRegion,
+                            SecondChance,
                             &PagesPaged);
 
-        if (KSUCCESS(Status)) {
+        MmPagerScannedPages += 1;
+        if (Status == STATUS_TRY_AGAIN) {
+            MmPagerReferencedPages += 1;
+            SecondChanceCount += 1;
+
+        } else if (KSUCCESS(Status)) {
             PageCountSinceEvent += PagesPaged;
 
             //
@@ -2045,6 +2356,9 @@ Return Value:
         }
 
         TotalPagesPaged += PagesPaged;
+        if (PagesPaged != 0) {
+            SecondChanceCount = 0;
+        }
 
         //
         // If the physical page run failed to be completely paged out, then
@@ -2078,11 +2392,109 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+PPHYSICAL_MEMORY_SEGMENT
+MmpFindFreePhysicalPages (
+    UINTN PageCount,
+    UINTN PageAlignment,
+    BOOL HonorStrict,
+    PUINTN SelectedPageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds a run of free physical pages according to the current
+    thread's zone policy. The preferred zone is searched first, followed by
+    the remaining zones in fallback order. The caller must hold the physical
+    page lock if it exists.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive pages needed to be found.
+
+    PageAlignment - Supplies the alignment of the physical allocation, in pages.
+
+    HonorStrict - Supplies a boolean indicating whether a strict policy should
+        prevent falling back to other zones.
+
+    SelectedPageOffset - Supplies a pointer where the index into the segment's
+        physical page array of the start of the run will be returned.
+
+Return Value:
+
+    Returns a pointer to the memory segment containing the free pages.
+
+    NULL if no zone the policy allows has enough contiguous free memory.
+
+--*/
+
+{
+
+    ULONG Index;
+    ULONG Policy;
+    PHYSICAL_MEMORY_ZONE Preferred;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    PKTHREAD Thread;
+    PHYSICAL_MEMORY_ZONE Zone;
+
+    Policy = PHYSICAL_ZONE_POLICY_DEFAULT;
+    Thread = KeGetCurrentThread();
+    if (Thread != NULL) {
+        Policy = Thread->PhysicalZonePolicy;
+    }
+
+    Preferred = Policy & PHYSICAL_ZONE_POLICY_ZONE_MASK;
+
+    ASSERT(Preferred < PhysicalMemoryZoneCount);
+
+    Segment = MmpFindPhysicalPages(PageCount,
+                                   PageAlignment,
+                                   PhysicalMemoryFindFree,
+                                   Preferred,
+                                   SelectedPageOffset,
+                                   NULL);
+
+    if (Segment != NULL) {
+        MmPhysicalZoneAllocations[Preferred] += 1;
+        return Segment;
+    }
+
+    if ((HonorStrict != FALSE) &&
+        ((Policy & PHYSICAL_ZONE_POLICY_STRICT) != 0)) {
+
+        return NULL;
+    }
+
+    for (Index = 0; Index < PhysicalMemoryZoneCount; Index += 1) {
+        Zone = MmPhysicalZoneFallbackOrder[Index];
+        if (Zone == Preferred) {
+            continue;
+        }
+
+        Segment = MmpFindPhysicalPages(PageCount,
+                                       PageAlignment,
+                                       PhysicalMemoryFindFree,
+                                       Zone,
+                                       SelectedPageOffset,
+                                       NULL);
+
+        if (Segment != NULL) {
+            MmPhysicalZoneAllocations[Zone] += 1;
+            MmPhysicalZoneFallbacks[Zone] += 1;
+            return Segment;
+        }
+    }
+
+    return NULL;
+}
+
 PPHYSICAL_MEMORY_SEGMENT
 MmpFindPhysicalPages (
     UINTN PageCount,
     UINTN PageAlignment,
     PHYSICAL_MEMORY_SEARCH_TYPE SearchType,
+    PHYSICAL_MEMORY_ZONE Zone,
     PUINTN SelectedPageOffset,
     PUINTN PagesFound
     )
@@ -2102,6 +2514,9 @@ Routine Description:
 
     SearchType - Supplies the type of physical memory to search for.
 
+    Zone - Supplies the zone to restrict the search to, or
+        PhysicalMemoryZoneCount to search every zone.
+
     SelectedPageOffset - Supplies a pointer where the index into the physical
         page database marking the beginning of the allocation will be returned
         on success. Said differently, this will contain an index into the
@@ -2198,6 +2613,7 @@ Return Value:
         //
 
         if ((Offset >= SegmentPageCount) ||
+            ((Zone != PhysicalMemoryZoneCount) && (Segment->Zone != Zone)) ||
             ((SearchType != PhysicalMemoryFindPagable) &&
              (Offset + PageCount > SegmentPageCount)) ||
             ((SearchType == PhysicalMemoryFindFree) &&
@@ -2462,11 +2878,13 @@ Return Value:
     PHYSICAL_ADDRESS LowestPhysicalAddress;
     PINIT_PHYSICAL_MEMORY_ITERATOR MemoryContext;
     UINTN OutOfBoundsAllocatedPageCount;
+    PHYSICAL_ADDRESS PageAddress;
     UINTN PageCount;
     UINTN PageShift;
     UINTN PageSize;
     ULONGLONG TrimmedSize;
     UINTN TruncatePageCount;
+    PHYSICAL_MEMORY_ZONE Zone;
 
     LowestPhysicalAddress = 0;
     MemoryContext = Context;
@@ -2624,6 +3042,17 @@ Return Value:
 
     MemoryContext->TotalMemoryBytes += TrimmedSize;
 
+    //
+    // Segments are split wherever the zone changes. Reserve room for a
+    // segment at every zone boundary in the descriptor. This may overcount
+    // slightly, which only wastes a few bytes.
+    //
+
+    MemoryContext->TotalSegments +=
+                           MmpCountPhysicalZoneBoundaries(BaseAddress,
+                                                          BaseAddress +
+                                                          TrimmedSize);
+
     //
     // If the last memory descriptor and this one are not contiguous,
     // then a new segment is required.
@@ -2643,6 +3072,7 @@ Return Value:
             CurrentSegment->StartAddress = BaseAddress;
             CurrentSegment->EndAddress = CurrentSegment->StartAddress;
             CurrentSegment->FreePages = 0;
+            CurrentSegment->Zone = MmpGetPhysicalZone(BaseAddress);
             MemoryContext->CurrentSegment = CurrentSegment;
             MemoryContext->CurrentPage = (PPHYSICAL_PAGE)(CurrentSegment + 1);
         }
@@ -2697,6 +3127,32 @@ Return Value:
                (MemoryContext->PagesInitialized <
                 MemoryContext->TotalMemoryPages)) {
 
+            //
+            // Start a new segment if this page crosses into another zone. An
+            // empty segment can just switch zones.
+            //
+
+            PageAddress = CurrentSegment->EndAddress;
+            Zone = MmpGetPhysicalZone(PageAddress);
+            if (Zone != CurrentSegment->Zone) {
+                if (PageAddress != CurrentSegment->StartAddress) {
+                    CurrentSegment =
+                        (PPHYSICAL_MEMORY_SEGMENT)(MemoryContext->CurrentPage);
+
+                    INSERT_BEFORE(&(CurrentSegment->ListEntry),
+                                  &(MmPhysicalSegmentListHead));
+
+                    CurrentSegment->StartAddress = PageAddress;
+                    CurrentSegment->EndAddress = PageAddress;
+                    CurrentSegment->FreePages = 0;
+                    MemoryContext->CurrentSegment = CurrentSegment;
+                    MemoryContext->CurrentPage =
+                                         (PPHYSICAL_PAGE)(CurrentSegment + 1);
+                }
+
+                CurrentSegment->Zone = Zone;
+            }
+
             //
             // If the page is not free, mark it as non-paged.
             //
@@ -2878,3 +3334,92 @@ Return Value:
     return SignalEvent;
 }
 
+PHYSICAL_MEMORY_ZONE
+MmpGetPhysicalZone (
+    PHYSICAL_ADDRESS PhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines which zone a physical address belongs to.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address to classify.
+
+Return Value:
+
+    Returns the zone of the first zone range containing the address, or the
+    normal zone if no range covers it.
+
+--*/
+
+{
+
+    ULONG Index;
+    PPHYSICAL_MEMORY_ZONE_RANGE Range;
+
+    for (Index = 0; Index < MmPhysicalZoneRangeCount; Index += 1) {
+        Range = &(MmPhysicalZoneRanges[Index]);
+        if ((PhysicalAddress >= Range->StartAddress) &&
+            (PhysicalAddress < Range->EndAddress)) {
+
+            return Range->Zone;
+        }
+    }
+
+    return PhysicalMemoryZoneNormal;
+}
+
+UINTN
+MmpCountPhysicalZoneBoundaries (
+    PHYSICAL_ADDRESS StartAddress,
+    PHYSICAL_ADDRESS EndAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine counts the zone range edges that fall within the given
+    physical address range.
+
+Arguments:
+
+    StartAddress - Supplies the first physical address of the range.
+
+    EndAddress - Supplies the first physical address after the range.
+
+Return Value:
+
+    Returns the number of zone range edges in the range.
+
+--*/
+
+{
+
+    UINTN Count;
+    ULONG Index;
+    PPHYSICAL_MEMORY_ZONE_RANGE Range;
+
+    Count = 0;
+    for (Index = 0; Index < MmPhysicalZoneRangeCount; Index += 1) {
+        Range = &(MmPhysicalZoneRanges[Index]);
+        if ((Range->StartAddress >= StartAddress) &&
+            (Range->StartAddress < EndAddress)) {
+
+            Count += 1;
+        }
+
+        if ((Range->EndAddress >= StartAddress) &&
+            (Range->EndAddress < EndAddress)) {
+
+            Count += 1;
+        }
+    }
+
+    return Count;
+}
+
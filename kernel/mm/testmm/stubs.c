@@ -486,7 +486,7 @@ Return Value:
 
 {
 
-    Lock->LockHeld = 0;
+    Lock->Tickets = 0;
     Lock->OwningThread = NULL;
     return;
 }
@@ -1633,6 +1633,32 @@ Return Value:
     return 0;
 }
 
+ULONG
+ArGetControlRegister4 (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the current value of CR4.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns CR4.
+
+--*/
+
+{
+
+    return 0;
+}
+
 VOID
 ArSetCurrentPageDirectory (
     ULONG Value
@@ -1865,9 +1891,9 @@ Return Value:
 
     do {
         LockValue = 1;
-        if (Lock->LockHeld == 0) {
+        if (Lock->Tickets == 0) {
             LockValue = 0;
-            Lock->LockHeld = 1;
+            Lock->Tickets = 0x10000;
         }
 
     } while (LockValue != 0);
@@ -1898,9 +1924,9 @@ Return Value:
 
 {
 
-    ASSERT(Lock->LockHeld != 0);
+    ASSERT(Lock->Tickets != 0);
 
-    Lock->LockHeld = 0;
+    Lock->Tickets = 0;
     return;
 }
 
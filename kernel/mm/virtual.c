@@ -231,6 +231,7 @@ Return Value:
     return MmVirtualMemoryWarningLevel;
 }
 
+KERNEL_API
 UINTN
 MmGetTotalVirtualMemory (
     VOID
@@ -257,6 +258,7 @@ Return Value:
     return (UINTN)MmKernelVirtualSpace.Mdl.TotalSpace;
 }
 
+KERNEL_API
 UINTN
 MmGetFreeVirtualMemory (
     VOID
@@ -1147,12 +1149,16 @@ Return Value:
 
     //
     // Preallocate all the page tables in the destination process so that
-    // allocations don't occur while holding the image section lock.
+    // allocations don't occur while holding the image section lock. If the
+    // destination populates its mappings lazily, nothing gets copied into it
+    // here, and its page tables are created as it faults.
     //
 
-    Status = MmpPreallocatePageTables(Source, Destination);
-    if (!KSUCCESS(Status)) {
-        goto CloneProcessAddressSpaceEnd;
+    if (MmLazyForkMappings == FALSE) {
+        Status = MmpPreallocatePageTables(Source, Destination);
+        if (!KSUCCESS(Status)) {
+            goto CloneProcessAddressSpaceEnd;
+        }
     }
 
     //
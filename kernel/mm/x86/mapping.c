@@ -67,6 +67,13 @@ MmpCreatePageTable (
     PVOID VirtualAddress
     );
 
+BOOL
+MmpDemoteLargePage (
+    PADDRESS_SPACE_X86 AddressSpace,
+    volatile PTE *Directory,
+    ULONG DirectoryIndex
+    );
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -99,6 +106,13 @@ PQUEUED_LOCK MmPageTableLock;
 
 PBLOCK_ALLOCATOR MmPageDirectoryBlockAllocator;
 
+//
+// Stores the size of a large page mapping, or 0 if the processor does not
+// have page size extensions enabled.
+//
+
+ULONG MmLargePageSize;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -405,18 +419,35 @@ Return Value:
             break;
         }
 
-        PageTable = GET_PAGE_TABLE(DirectoryIndex);
-        TableIndex = ((UINTN)Address & PTE_INDEX_MASK) >> PAGE_SHIFT;
-        if (PageTable[TableIndex].Present == 0) {
-            break;
-        }
+        //
+        // A large page directory entry maps the whole region itself.
+        //
 
-        if ((Writable != NULL) && (PageTable[TableIndex].Writable == 0)) {
-            *Writable = FALSE;
+        if (PageDirectory[DirectoryIndex].LargePage != 0) {
+            if ((Writable != NULL) &&
+                (PageDirectory[DirectoryIndex].Writable == 0)) {
+
+                *Writable = FALSE;
+            }
+
+            ByteOffset = (UINTN)Address & LARGE_PAGE_MASK;
+            BytesThisRound = LARGE_PAGE_SIZE - ByteOffset;
+
+        } else {
+            PageTable = GET_PAGE_TABLE(DirectoryIndex);
+            TableIndex = ((UINTN)Address & PTE_INDEX_MASK) >> PAGE_SHIFT;
+            if (PageTable[TableIndex].Present == 0) {
+                break;
+            }
+
+            if ((Writable != NULL) && (PageTable[TableIndex].Writable == 0)) {
+                *Writable = FALSE;
+            }
+
+            ByteOffset = (UINTN)Address & PAGE_MASK;
+            BytesThisRound = PAGE_SIZE - ByteOffset;
         }
 
-        ByteOffset = (UINTN)Address & PAGE_MASK;
-        BytesThisRound = PAGE_SIZE - ByteOffset;
         if (BytesThisRound > BytesRemaining) {
             BytesThisRound = BytesRemaining;
         }
@@ -495,8 +526,19 @@ Return Value:
 
     ASSERT(PageDirectory[DirectoryIndex].Present != 0);
 
-    PageTable = GET_PAGE_TABLE(DirectoryIndex);
-    TableIndex = ((UINTN)Address & PTE_INDEX_MASK) >> PAGE_SHIFT;
+    //
+    // Large pages are modified at the directory level. The whole large page
+    // changes protection, which is acceptable for the debugger's purposes.
+    //
+
+    if (PageDirectory[DirectoryIndex].LargePage != 0) {
+        PageTable = &(PageDirectory[DirectoryIndex]);
+        TableIndex = 0;
+
+    } else {
+        PageTable = GET_PAGE_TABLE(DirectoryIndex);
+        TableIndex = ((UINTN)Address & PTE_INDEX_MASK) >> PAGE_SHIFT;
+    }
 
     ASSERT(PageTable[TableIndex].Present != 0);
 
@@ -553,6 +595,8 @@ Return Value:
 {
 
     ULONG DirectoryIndex;
+    PADDRESS_SPACE OldAddressSpace;
+    PKTHREAD OldThread;
     PPROCESSOR_BLOCK ProcessorBlock;
     PADDRESS_SPACE_X86 Space;
     PTSS Tss;
@@ -571,6 +615,13 @@ Return Value:
 
     ProcessorBlock = Processor;
     Tss = ProcessorBlock->Tss;
+    OldThread = ProcessorBlock->RunningThread;
+    OldAddressSpace = OldThread->OwningProcess->AddressSpace;
+    if (OldAddressSpace != AddressSpace) {
+        MmpUpdateActiveProcessors(AddressSpace,
+                                  ProcessorBlock->ProcessorNumber,
+                                  TRUE);
+    }
 
     //
     // Set the CR3 first because an NMI can come in any time and change CR3 to
@@ -579,6 +630,18 @@ Return Value:
 
     Tss->Cr3 = Space->PageDirectoryPhysical;
     ArSetCurrentPageDirectory(Space->PageDirectoryPhysical);
+
+    //
+    // Loading CR3 flushed any user mode TLB entries for the old address
+    // space, so this processor no longer needs to hear about changes to it.
+    //
+
+    if (OldAddressSpace != AddressSpace) {
+        MmpUpdateActiveProcessors(OldAddressSpace,
+                                  ProcessorBlock->ProcessorNumber,
+                                  FALSE);
+    }
+
     return;
 }
 
@@ -719,6 +782,16 @@ Return Value:
         }
 
         MmPageDirectoryBlockAllocator = BlockAllocator;
+
+        //
+        // Large pages are only used if processor initialization turned on
+        // page size extensions.
+        //
+
+        if ((ArGetControlRegister4() & CR4_PAGE_SIZE_EXTENSION) != 0) {
+            MmLargePageSize = LARGE_PAGE_SIZE;
+        }
+
         Status = STATUS_SUCCESS;
 
     //
@@ -964,9 +1037,14 @@ Return Value:
                                         MmKernelPageDirectory[DirectoryIndex];
 
         //
-        // See if the page fault is resolved by this entry.
+        // See if the page fault is resolved by this entry. A large page
+        // directory entry maps the address directly.
         //
 
+        if (CurrentPageDirectory[DirectoryIndex].LargePage != 0) {
+            return TRUE;
+        }
+
         PageTable = GET_PAGE_TABLE(DirectoryIndex);
         TableIndex = ((UINTN)FaultingAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
         if (PageTable[TableIndex].Present == 1) {
@@ -1046,10 +1124,14 @@ Return Value:
 
     //
     // If no page table exists for this entry, allocate and initialize one.
+    // If a large page covers this entry, split it into small pages first.
     //
 
     if (Directory[DirectoryIndex].Present == 0) {
         MmpCreatePageTable(AddressSpace, Directory, VirtualAddress);
+
+    } else if (Directory[DirectoryIndex].LargePage != 0) {
+        MmpDemoteLargePage(AddressSpace, Directory, DirectoryIndex);
     }
 
     ASSERT(Directory[DirectoryIndex].Present != 0);
@@ -1145,6 +1227,7 @@ Return Value:
 {
 
     PADDRESS_SPACE_X86 AddressSpace;
+    MM_TLB_BATCH Batch;
     BOOL ChangedSomething;
     PVOID CurrentVirtual;
     volatile PTE *Directory;
@@ -1194,6 +1277,8 @@ Return Value:
 
     ASSERT(((UINTN)VirtualAddress & PAGE_MASK) == 0);
 
+    MmpInitializeTlbBatch(&Batch, &(AddressSpace->Common));
+
     //
     // Loop through once to turn them all off. Other processors may still have
     // TLB mappings to them, so the page is technically still in use.
@@ -1226,6 +1311,19 @@ Return Value:
             continue;
         }
 
+        //
+        // Split a large page so that its small pages can be unmapped
+        // individually.
+        //
+
+        if ((Directory[DirectoryIndex].LargePage != 0) &&
+            (MmpDemoteLargePage(AddressSpace, Directory, DirectoryIndex) ==
+             FALSE)) {
+
+            CurrentVirtual += PAGE_SIZE;
+            continue;
+        }
+
         PageTable = GET_PAGE_TABLE(DirectoryIndex);
         TableIndex = ((UINTN)CurrentVirtual & PTE_INDEX_MASK) >> PAGE_SHIFT;
 
@@ -1239,6 +1337,7 @@ Return Value:
             if (PageTable[TableIndex].Present != 0) {
                 ChangedSomething = TRUE;
                 PageWasPresent = TRUE;
+                MmpAddToTlbBatch(&Batch, CurrentVirtual);
             }
 
             MappedCount += 1;
@@ -1280,15 +1379,14 @@ Return Value:
 
     //
     // Send the invalidate IPI to get everyone faulting. After this the pages
-    // can be taken offline.
+    // can be taken offline. Only the pages that were actually present need
+    // invalidating.
     //
 
     if ((ChangedSomething != FALSE) &&
         ((UnmapFlags & UNMAP_FLAG_SEND_INVALIDATE_IPI) != 0)) {
 
-        MmpSendTlbInvalidateIpi(&(AddressSpace->Common),
-                                VirtualAddress,
-                                PageCount);
+        MmpFlushTlbBatch(&Batch);
     }
 
     //
@@ -1308,7 +1406,9 @@ Return Value:
         CurrentVirtual = VirtualAddress;
         for (PageNumber = 0; PageNumber < PageCount; PageNumber += 1) {
             DirectoryIndex = (UINTN)CurrentVirtual >> PAGE_DIRECTORY_SHIFT;
-            if (Directory[DirectoryIndex].Present == 0) {
+            if ((Directory[DirectoryIndex].Present == 0) ||
+                (Directory[DirectoryIndex].LargePage != 0)) {
+
                 CurrentVirtual += PAGE_SIZE;
                 continue;
             }
@@ -1436,6 +1536,31 @@ Return Value:
         return INVALID_PHYSICAL_ADDRESS;
     }
 
+    //
+    // A large page directory entry maps the address directly.
+    //
+
+    if (Directory[DirectoryIndex].LargePage != 0) {
+        PhysicalAddress =
+                      (UINTN)(Directory[DirectoryIndex].Entry << PAGE_SHIFT) +
+                      ((UINTN)VirtualAddress & LARGE_PAGE_MASK);
+
+        if (Attributes != NULL) {
+            *Attributes |= MAP_FLAG_PRESENT | MAP_FLAG_EXECUTE |
+                           MAP_FLAG_LARGE_PAGE;
+
+            if (Directory[DirectoryIndex].Writable == 0) {
+                *Attributes |= MAP_FLAG_READ_ONLY;
+            }
+
+            if (Directory[DirectoryIndex].Dirty != 0) {
+                *Attributes |= MAP_FLAG_DIRTY;
+            }
+        }
+
+        return PhysicalAddress;
+    }
+
     PageTable = GET_PAGE_TABLE(DirectoryIndex);
     TableIndex = ((UINTN)VirtualAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
     if (PageTable[TableIndex].Entry == 0) {
@@ -1527,6 +1652,14 @@ Return Value:
         return INVALID_PHYSICAL_ADDRESS;
     }
 
+    if (Directory[DirectoryIndex].LargePage != 0) {
+        PhysicalAddress =
+                      (UINTN)(Directory[DirectoryIndex].Entry << PAGE_SHIFT) +
+                      ((UINTN)VirtualAddress & LARGE_PAGE_MASK);
+
+        return PhysicalAddress;
+    }
+
     PageTablePhysical = (ULONG)(Directory[DirectoryIndex].Entry << PAGE_SHIFT);
     PageTableIndex = ((UINTN)VirtualAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
 
@@ -1557,6 +1690,117 @@ Return Value:
     return PhysicalAddress;
 }
 
+BOOL
+MmpTestAndClearPageAccessed (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given page has been accessed since the
+    last time this routine was called on it, and clears the accessed state. The
+    TLB is not flushed, so an access that hits a cached translation may go
+    unnoticed until the entry is evicted. Architectures without a hardware
+    accessed flag always return FALSE.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the page is mapped
+        in. This does not need to be the current address space.
+
+    VirtualAddress - Supplies the virtual address of the page to query.
+
+Return Value:
+
+    TRUE if the page is mapped and has been accessed.
+
+    FALSE if the page is not mapped, has not been accessed, or the
+    architecture does not track accesses.
+
+--*/
+
+{
+
+    BOOL Accessed;
+    volatile PTE *Directory;
+    ULONG DirectoryIndex;
+    PTE DirectoryEntry;
+    ULONG OldEntry;
+    RUNLEVEL OldRunLevel;
+    volatile PTE *PageTable;
+    ULONG PageTableIndex;
+    PHYSICAL_ADDRESS PageTablePhysical;
+    PPROCESSOR_BLOCK ProcessorBlock;
+    PADDRESS_SPACE_X86 Space;
+
+    Space = (PADDRESS_SPACE_X86)AddressSpace;
+    DirectoryIndex = (UINTN)VirtualAddress >> PAGE_DIRECTORY_SHIFT;
+    if (VirtualAddress >= KERNEL_VA_START) {
+        Directory = MmKernelPageDirectory;
+
+    } else {
+        Directory = Space->PageDirectory;
+    }
+
+    DirectoryEntry = Directory[DirectoryIndex];
+    if (DirectoryEntry.Present == 0) {
+        return FALSE;
+    }
+
+    //
+    // A large page only has the one accessed bit, in the directory entry. If
+    // the entry gets demoted in the meantime, this clears the accessed bit of
+    // the new page table's directory entry, which is harmless.
+    //
+
+    if (DirectoryEntry.LargePage != 0) {
+        OldEntry = RtlAtomicAnd32(
+                             (volatile ULONG *)&(Directory[DirectoryIndex]),
+                             ~PTE_ACCESSED);
+
+        if ((OldEntry & PTE_ACCESSED) != 0) {
+            return TRUE;
+        }
+
+        return FALSE;
+    }
+
+    PageTablePhysical = (ULONG)(DirectoryEntry.Entry << PAGE_SHIFT);
+    PageTableIndex = ((UINTN)VirtualAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
+
+    //
+    // Map the page table at dispatch level to avoid bouncing around to
+    // different processors and creating TLB entries that will have to be
+    // IPIed out. The accessed bit is cleared atomically since the processor
+    // may be setting the dirty bit in the same entry concurrently.
+    //
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    ProcessorBlock = KeGetCurrentProcessorBlock();
+    MmpMapPage(PageTablePhysical,
+               ProcessorBlock->SwapPage,
+               MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL);
+
+    PageTable = (volatile PTE *)(ProcessorBlock->SwapPage);
+    Accessed = FALSE;
+    if (PageTable[PageTableIndex].Present != 0) {
+        OldEntry = RtlAtomicAnd32(
+                          (volatile ULONG *)&(PageTable[PageTableIndex]),
+                          ~PTE_ACCESSED);
+
+        if ((OldEntry & PTE_ACCESSED) != 0) {
+            Accessed = TRUE;
+        }
+    }
+
+    MmpUnmapPages(ProcessorBlock->SwapPage, 1, 0, NULL);
+    KeLowerRunLevel(OldRunLevel);
+    return Accessed;
+}
+
 VOID
 MmpUnmapPageInOtherProcess (
     PADDRESS_SPACE AddressSpace,
@@ -1623,6 +1867,10 @@ Return Value:
         goto UnmapPageInOtherProcessEnd;
     }
 
+    if (Directory[DirectoryIndex].LargePage != 0) {
+        MmpDemoteLargePage(Space, Directory, DirectoryIndex);
+    }
+
     PageTablePhysical = (UINTN)(Directory[DirectoryIndex].Entry << PAGE_SHIFT);
     PageTableIndex = ((UINTN)VirtualAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
 
@@ -1756,6 +2004,9 @@ Return Value:
 
     if (Directory[DirectoryIndex].Present == 0) {
         MmpCreatePageTable(Space, Directory, VirtualAddress);
+
+    } else if (Directory[DirectoryIndex].LargePage != 0) {
+        MmpDemoteLargePage(Space, Directory, DirectoryIndex);
     }
 
     PageTablePhysical = (UINTN)(Directory[DirectoryIndex].Entry << PAGE_SHIFT);
@@ -1886,12 +2137,14 @@ Return Value:
 {
 
     PADDRESS_SPACE_X86 AddressSpace;
+    MM_TLB_BATCH Batch;
     BOOL ChangedSomething;
     BOOL ChangedSomethingThisRound;
     PVOID CurrentVirtual;
     volatile PTE *Directory;
     ULONG DirectoryIndex;
     BOOL InvalidateTlb;
+    ULONG LargePageCount;
     ULONG PageIndex;
     PPTE PageTable;
     ULONG PageTableIndex;
@@ -1927,7 +2180,9 @@ Return Value:
         }
     }
 
+    MmpInitializeTlbBatch(&Batch, &(AddressSpace->Common));
     ChangedSomething = FALSE;
+    LargePageCount = LARGE_PAGE_SIZE >> PAGE_SHIFT;
     Writable = ((MapFlags & MAP_FLAG_READ_ONLY) == 0);
     Present = ((MapFlags & MAP_FLAG_PRESENT) != 0);
     CurrentVirtual = VirtualAddress;
@@ -1949,6 +2204,47 @@ Return Value:
             continue;
         }
 
+        //
+        // If a user mode large page is entirely covered and only its write
+        // permission is changing, change the directory entry in place.
+        // Otherwise split it into small pages first.
+        //
+
+        if (Directory[DirectoryIndex].LargePage != 0) {
+            if ((CurrentVirtual < KERNEL_VA_START) &&
+                (((UINTN)CurrentVirtual & LARGE_PAGE_MASK) == 0) &&
+                ((PageCount - PageIndex) >= LargePageCount) &&
+                (((MapFlagsMask & MAP_FLAG_PRESENT) == 0) ||
+                 (Present != FALSE))) {
+
+                if (((MapFlagsMask & MAP_FLAG_READ_ONLY) != 0) &&
+                    (Directory[DirectoryIndex].Writable != Writable)) {
+
+                    Directory[DirectoryIndex].Writable = Writable;
+                    if (SendInvalidateIpi == FALSE) {
+                        if (InvalidateTlb != FALSE) {
+                            ArInvalidateTlbEntry(CurrentVirtual);
+                        }
+
+                    } else {
+                        ChangedSomething = TRUE;
+                        MmpAddToTlbBatch(&Batch, CurrentVirtual);
+                    }
+                }
+
+                CurrentVirtual += LARGE_PAGE_SIZE;
+                PageIndex += LargePageCount - 1;
+                continue;
+            }
+
+            if (MmpDemoteLargePage(AddressSpace, Directory, DirectoryIndex) ==
+                FALSE) {
+
+                CurrentVirtual += PAGE_SIZE;
+                continue;
+            }
+        }
+
         PageTable = GET_PAGE_TABLE(DirectoryIndex);
         if (PageTable[PageTableIndex].Entry == 0) {
 
@@ -1993,6 +2289,7 @@ Return Value:
 
             } else {
                 ChangedSomething = TRUE;
+                MmpAddToTlbBatch(&Batch, CurrentVirtual);
             }
         }
 
@@ -2007,9 +2304,7 @@ Return Value:
 
         ASSERT(SendInvalidateIpi != FALSE);
 
-        MmpSendTlbInvalidateIpi(&(AddressSpace->Common),
-                                VirtualAddress,
-                                PageCount);
+        MmpFlushTlbBatch(&Batch);
     }
 
     return;
@@ -2120,7 +2415,9 @@ Routine Description:
 
 Arguments:
 
-    Destination - Supplies a pointer to the destination address space.
+    Destination - Supplies an optional pointer to the destination address
+        space. If this is NULL, the source mappings are only converted to
+        read-only and nothing is copied.
 
     Source - Supplies a pointer to the source address space.
 
@@ -2156,7 +2453,11 @@ Return Value:
     PVOID VirtualEnd;
 
     DestinationSpace = (PADDRESS_SPACE_X86)Destination;
-    DestinationDirectory = DestinationSpace->PageDirectory;
+    DestinationDirectory = NULL;
+    if (DestinationSpace != NULL) {
+        DestinationDirectory = DestinationSpace->PageDirectory;
+    }
+
     SourceSpace = (PADDRESS_SPACE_X86)Source;
     SourceDirectory = SourceSpace->PageDirectory;
     VirtualEnd = VirtualAddress + Size;
@@ -2209,6 +2510,17 @@ Return Value:
             continue;
         }
 
+        //
+        // Split a large page in the source so that its small pages can be
+        // marked read-only and shared individually. The page table for this
+        // was set aside when the large page was created, so no allocation
+        // happens here.
+        //
+
+        if (SourceDirectory[DirectoryIndex].LargePage != 0) {
+            MmpDemoteLargePage(SourceSpace, SourceDirectory, DirectoryIndex);
+        }
+
         TableIndexEnd = ((UINTN)CurrentVirtual & PTE_INDEX_MASK) >>
                         PAGE_SHIFT;
 
@@ -2216,6 +2528,23 @@ Return Value:
             TableIndexEnd = PAGE_SIZE / sizeof(PTE);
         }
 
+        //
+        // Without a destination, just write protect the source. The TLB is
+        // flushed by the caller once all regions are done.
+        //
+
+        if (DestinationDirectory == NULL) {
+            SourceTable = GET_PAGE_TABLE(DirectoryIndex);
+            for (TableIndex = TableIndexStart;
+                 TableIndex < TableIndexEnd;
+                 TableIndex += 1) {
+
+                *((PULONG)&(SourceTable[TableIndex])) &= ~PTE_FLAG_WRITABLE;
+            }
+
+            continue;
+        }
+
         //
         // If the destination has not encountered this directory entry yet,
         // allocate a page table for the destination. Then proceed to copy the
@@ -2404,6 +2733,241 @@ Return Value:
     return;
 }
 
+KSTATUS
+MmpReserveLargePageTable (
+    PADDRESS_SPACE AddressSpace,
+    PPHYSICAL_ADDRESS PageTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the page table that a user mode large page mapping
+    will be split into should it ever need to be. Splitting a large page can
+    happen while an image section lock is held or on the paging thread, where
+    allocations are not allowed, so the table is set aside up front. This
+    routine must be called at low level without any image section locks held.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the large page will
+        be mapped in.
+
+    PageTable - Supplies a pointer where the physical address of the reserved
+        page table will be returned. The caller passes this to the large page
+        map routine, or frees it if the large page is never mapped.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if large pages are not supported.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+{
+
+    UINTN ArraySize;
+    PULONG LargePageTables;
+    ULONG OriginalValue;
+    PADDRESS_SPACE_X86 Space;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    *PageTable = INVALID_PHYSICAL_ADDRESS;
+    if (MmLargePageSize == 0) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    //
+    // Create the array of reserved tables if this is the first large page in
+    // the address space.
+    //
+
+    Space = (PADDRESS_SPACE_X86)AddressSpace;
+    if (Space->LargePageTables == NULL) {
+        ArraySize = ((UINTN)KERNEL_VA_START >> PAGE_DIRECTORY_SHIFT) *
+                    sizeof(ULONG);
+
+        LargePageTables = MmAllocateNonPagedPool(
+                                             ArraySize,
+                                             MM_ADDRESS_SPACE_ALLOCATION_TAG);
+
+        if (LargePageTables == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(LargePageTables, ArraySize);
+        OriginalValue = RtlAtomicCompareExchange(
+                                   (volatile ULONG *)&(Space->LargePageTables),
+                                   (ULONG)LargePageTables,
+                                   0);
+
+        if (OriginalValue != 0) {
+            MmFreeNonPagedPool(LargePageTables);
+        }
+    }
+
+    *PageTable = MmpTryToAllocatePhysicalPages(1, 1, FALSE);
+    if (*PageTable == INVALID_PHYSICAL_ADDRESS) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+MmpMapLargePage (
+    PHYSICAL_ADDRESS PhysicalAddress,
+    PVOID VirtualAddress,
+    ULONG Flags,
+    PHYSICAL_ADDRESS PageTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps a physically contiguous, large page aligned run of
+    physical memory with a single large page mapping. User mode mappings are
+    made in the current address space. Kernel mode large pages are permanent;
+    they are never split or unmapped.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address to back the mapping with.
+        This must be aligned to the large page size.
+
+    VirtualAddress - Supplies the virtual address to map. This must be aligned
+        to the large page size.
+
+    Flags - Supplies a bitfield of flags governing the options of the mapping.
+        See MAP_FLAG_* definitions.
+
+    PageTable - Supplies the physical address of the page table reserved for
+        splitting this mapping. This is required for user mode mappings and
+        must be INVALID_PHYSICAL_ADDRESS for kernel mode mappings. On success,
+        the address space takes ownership of the page table.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if large pages are not supported.
+
+    STATUS_RESOURCE_IN_USE if a page table or mapping already exists somewhere
+    in the region.
+
+--*/
+
+{
+
+    PADDRESS_SPACE_X86 AddressSpace;
+    volatile PTE *Directory;
+    ULONG DirectoryIndex;
+    PTE Entry;
+    PKTHREAD Thread;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+    ASSERT((PhysicalAddress & LARGE_PAGE_MASK) == 0);
+    ASSERT(((UINTN)VirtualAddress & LARGE_PAGE_MASK) == 0);
+
+    if (MmLargePageSize == 0) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    Thread = KeGetCurrentThread();
+    AddressSpace = (PADDRESS_SPACE_X86)(Thread->OwningProcess->AddressSpace);
+    if (VirtualAddress >= KERNEL_VA_START) {
+
+        ASSERT(PageTable == INVALID_PHYSICAL_ADDRESS);
+
+        Directory = MmKernelPageDirectory;
+
+    } else {
+
+        ASSERT((PageTable != INVALID_PHYSICAL_ADDRESS) &&
+               (AddressSpace->LargePageTables != NULL));
+
+        Directory = AddressSpace->PageDirectory;
+    }
+
+    RtlZeroMemory(&Entry, sizeof(PTE));
+    Entry.Entry = (ULONG)PhysicalAddress >> PAGE_SHIFT;
+    Entry.LargePage = 1;
+    if ((Flags & MAP_FLAG_READ_ONLY) == 0) {
+        Entry.Writable = 1;
+    }
+
+    if ((Flags & MAP_FLAG_CACHE_DISABLE) != 0) {
+        Entry.CacheDisabled = 1;
+
+    } else if ((Flags & MAP_FLAG_WRITE_THROUGH) != 0) {
+        Entry.WriteThrough = 1;
+    }
+
+    if ((Flags & MAP_FLAG_USER_MODE) != 0) {
+
+        ASSERT(VirtualAddress < KERNEL_VA_START);
+
+        Entry.User = 1;
+
+    } else if ((Flags & MAP_FLAG_GLOBAL) != 0) {
+        Entry.Global = 1;
+    }
+
+    if ((Flags & MAP_FLAG_DIRTY) != 0) {
+        Entry.Dirty = 1;
+    }
+
+    if ((Flags & MAP_FLAG_PRESENT) != 0) {
+        Entry.Present = 1;
+    }
+
+    //
+    // Install the entry under the page table lock so that it does not race
+    // with the creation of a page table for the same region. Only an
+    // entirely empty directory entry can become a large page.
+    //
+
+    DirectoryIndex = (UINTN)VirtualAddress >> PAGE_DIRECTORY_SHIFT;
+    KeAcquireQueuedLock(MmPageTableLock);
+    if (Directory[DirectoryIndex].Entry != 0) {
+        Status = STATUS_RESOURCE_IN_USE;
+        goto MapLargePageEnd;
+    }
+
+    if (VirtualAddress >= KERNEL_VA_START) {
+        MmKernelPageDirectory[DirectoryIndex] = Entry;
+        AddressSpace->PageDirectory[DirectoryIndex] = Entry;
+
+    } else {
+
+        ASSERT(AddressSpace->LargePageTables[DirectoryIndex] == 0);
+
+        AddressSpace->LargePageTables[DirectoryIndex] = PageTable;
+        Directory[DirectoryIndex] = Entry;
+        MmpUpdateResidentSetCounter(&(AddressSpace->Common),
+                                    LARGE_PAGE_SIZE >> PAGE_SHIFT);
+    }
+
+    //
+    // As with small pages, no TLB invalidation is necessary on a transition
+    // from not present to present.
+    //
+
+    RtlMemoryBarrier();
+    Status = STATUS_SUCCESS;
+
+MapLargePageEnd:
+    KeReleaseQueuedLock(MmPageTableLock);
+    return Status;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -2551,6 +3115,19 @@ Return Value:
          DirectoryIndex += 1) {
 
         if (Directory[DirectoryIndex].Entry != 0) {
+
+            //
+            // Large pages should have been split when the sections mapping
+            // them were unmapped. The pages themselves belong to the section.
+            //
+
+            if (Directory[DirectoryIndex].LargePage != 0) {
+
+                ASSERT(FALSE);
+
+                continue;
+            }
+
             Total += 1;
             PhysicalAddress = (ULONG)(Directory[DirectoryIndex].Entry <<
                                       PAGE_SHIFT);
@@ -2578,6 +3155,26 @@ Return Value:
         MmFreePhysicalPages(RunPhysicalAddress, RunSize >> PAGE_SHIFT);
     }
 
+    //
+    // Release any page tables that were set aside for large pages that never
+    // needed to be split.
+    //
+
+    if (AddressSpace->LargePageTables != NULL) {
+        for (DirectoryIndex = 0;
+             DirectoryIndex < ((UINTN)KERNEL_VA_START >> PAGE_DIRECTORY_SHIFT);
+             DirectoryIndex += 1) {
+
+            PhysicalAddress = AddressSpace->LargePageTables[DirectoryIndex];
+            if (PhysicalAddress != 0) {
+                MmFreePhysicalPage(PhysicalAddress);
+            }
+        }
+
+        MmFreeNonPagedPool(AddressSpace->LargePageTables);
+        AddressSpace->LargePageTables = NULL;
+    }
+
     //
     // Assert if page tables were leaked somewhere.
     //
@@ -2770,3 +3367,132 @@ Return Value:
     return;
 }
 
+BOOL
+MmpDemoteLargePage (
+    PADDRESS_SPACE_X86 AddressSpace,
+    volatile PTE *Directory,
+    ULONG DirectoryIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine splits a user mode large page mapping into a page table of
+    small pages with identical translations, using the page table that was
+    reserved when the large page was mapped. This routine does not allocate
+    memory, so it is safe to call with image section locks held and on the
+    paging thread.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space that owns the
+        directory. This does not need to be the current address space.
+
+    Directory - Supplies a pointer to the page directory.
+
+    DirectoryIndex - Supplies the index of the large page directory entry.
+
+Return Value:
+
+    TRUE if the large page was split or had already been split.
+
+    FALSE if the large page is a permanent kernel mapping that cannot be split.
+
+--*/
+
+{
+
+    PTE LargeEntry;
+    PTE NewEntry;
+    RUNLEVEL OldRunLevel;
+    volatile PTE *PageTable;
+    PHYSICAL_ADDRESS PageTablePhysical;
+    PPROCESSOR_BLOCK ProcessorBlock;
+    ULONG TableIndex;
+    PVOID VirtualAddress;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    VirtualAddress = (PVOID)(DirectoryIndex << PAGE_DIRECTORY_SHIFT);
+    if (VirtualAddress >= KERNEL_VA_START) {
+
+        ASSERT(FALSE);
+
+        return FALSE;
+    }
+
+    //
+    // Splits happen under the page table lock so that two parties do not
+    // both try to consume the reserved page table.
+    //
+
+    KeAcquireQueuedLock(MmPageTableLock);
+    LargeEntry = Directory[DirectoryIndex];
+    if (LargeEntry.LargePage == 0) {
+        KeReleaseQueuedLock(MmPageTableLock);
+        return TRUE;
+    }
+
+    ASSERT(AddressSpace->LargePageTables != NULL);
+
+    PageTablePhysical = AddressSpace->LargePageTables[DirectoryIndex];
+
+    ASSERT(PageTablePhysical != 0);
+
+    //
+    // Fill the page table with small pages that match the large page. Large
+    // pages are always mapped dirty, so no dirty state can be lost between
+    // reading the directory entry and replacing it. Raise to dispatch to
+    // avoid creating TLB entries for the staging page on other processors.
+    //
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    ProcessorBlock = KeGetCurrentProcessorBlock();
+    MmpMapPage(PageTablePhysical,
+               ProcessorBlock->SwapPage,
+               MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL);
+
+    PageTable = ProcessorBlock->SwapPage;
+    RtlZeroMemory(&NewEntry, sizeof(PTE));
+    NewEntry.Present = LargeEntry.Present;
+    NewEntry.Writable = LargeEntry.Writable;
+    NewEntry.User = LargeEntry.User;
+    NewEntry.WriteThrough = LargeEntry.WriteThrough;
+    NewEntry.CacheDisabled = LargeEntry.CacheDisabled;
+    NewEntry.Accessed = LargeEntry.Accessed;
+    NewEntry.Dirty = LargeEntry.Dirty;
+    for (TableIndex = 0;
+         TableIndex < PAGE_SIZE / sizeof(PTE);
+         TableIndex += 1) {
+
+        NewEntry.Entry = LargeEntry.Entry + TableIndex;
+        PageTable[TableIndex] = NewEntry;
+    }
+
+    MmpUnmapPages(ProcessorBlock->SwapPage, 1, 0, NULL);
+    KeLowerRunLevel(OldRunLevel);
+
+    //
+    // Swap the directory entry over to the page table in a single write.
+    // Processors still holding the large TLB entry see identical
+    // translations, but flush them anyway along with any stale self-map
+    // entry for the page table.
+    //
+
+    RtlZeroMemory(&NewEntry, sizeof(PTE));
+    NewEntry.Entry = (ULONG)PageTablePhysical >> PAGE_SHIFT;
+    NewEntry.Writable = 1;
+    NewEntry.User = 1;
+    NewEntry.Present = 1;
+    Directory[DirectoryIndex] = NewEntry;
+    AddressSpace->LargePageTables[DirectoryIndex] = 0;
+    AddressSpace->PageTableCount += 1;
+    KeReleaseQueuedLock(MmPageTableLock);
+    MmpSendTlbInvalidateIpi(&(AddressSpace->Common), VirtualAddress, 1);
+    MmpSendTlbInvalidateIpi(&(AddressSpace->Common),
+                            GET_PAGE_TABLE(DirectoryIndex),
+                            1);
+
+    return TRUE;
+}
@@ -531,10 +531,11 @@ Return Value:
     }
 
     //
-    // Destroy all timers.
+    // Destroy all timers and I/O rings.
     //
 
     PspDestroyProcessTimers(Process);
+    IoDestroyProcessIoRings(Process);
 
     //
     // Unload all images and free all memory associated with this image.
@@ -1468,6 +1469,39 @@ Return Value:
     return PsProcessCount;
 }
 
+KERNEL_API
+ULONGLONG
+PsSetProcessTimerSlack (
+    PKPROCESS Process,
+    ULONGLONG Slack
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the default timer slack for the given process. Timers
+    queued by threads in the process that don't have their own slack may
+    expire this much later than requested so that expirations can be batched
+    together. Child processes inherit the timer slack.
+
+Arguments:
+
+    Process - Supplies a pointer to the process.
+
+    Slack - Supplies the new default slack, in time counter ticks.
+
+Return Value:
+
+    Returns the previous default timer slack.
+
+--*/
+
+{
+
+    return RtlAtomicExchange64(&(Process->TimerSlack), Slack);
+}
+
 VOID
 PsIterateProcess (
     PROCESS_ID_TYPE Type,
@@ -1790,6 +1824,7 @@ Return Value:
     NewProcess->HandledSignals = Process->HandledSignals;
     NewProcess->IgnoredSignals = Process->IgnoredSignals;
     NewProcess->Umask = Process->Umask;
+    NewProcess->TimerSlack = Process->TimerSlack;
     INSERT_BEFORE(&(NewProcess->SiblingListEntry), &(Process->ChildListHead));
     KeReleaseQueuedLock(Process->QueuedLock);
     PspAddProcessToParentProcessGroup(NewProcess);
@@ -2822,6 +2857,7 @@ Return Value:
     //
 
     PspDestroyProcessTimers(Process);
+    IoDestroyProcessIoRings(Process);
     PspImUnloadAllImages(Process);
     IoCloseProcessHandles(Process, 0);
     MmCleanUpProcessMemory(Process);
@@ -4682,6 +4718,10 @@ Return Value:
         Buffer->Priority = 0;
         Buffer->NiceValue = 0;
         Buffer->Flags = 0;
+        Buffer->ResidentSet = 0;
+        if (Process->AddressSpace != NULL) {
+            Buffer->ResidentSet = Process->AddressSpace->ResidentSet;
+        }
 
     } else {
         Status = STATUS_BUFFER_TOO_SMALL;
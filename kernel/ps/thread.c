@@ -1559,6 +1559,17 @@ Return Value:
     NewThread->SchedulerEntry.Parent = CurrentThread->SchedulerEntry.Parent;
     NewThread->ThreadPointer = PsInitialThreadPointer;
 
+    //
+    // User mode threads inherit the scheduling class of their creator, so
+    // that a real-time process stays real-time across new threads and forks.
+    // Kernel worker threads always start in the normal class.
+    //
+
+    if ((Flags & THREAD_FLAG_USER_MODE) != 0) {
+        NewThread->SchedulingPolicy = CurrentThread->SchedulingPolicy;
+        NewThread->SchedulingPriority = CurrentThread->SchedulingPriority;
+    }
+
     //
     // Allocate a kernel stack.
     //
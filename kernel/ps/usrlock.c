@@ -36,6 +36,14 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the number of hash buckets user locks are spread across. This must
+// be a power of two.
+//
+
+#define USER_LOCK_BUCKET_SHIFT 8
+#define USER_LOCK_BUCKET_COUNT (1 << USER_LOCK_BUCKET_SHIFT)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -49,6 +57,27 @@ typedef enum _USER_LOCK_TYPE {
 
 /*++
 
+Structure Description:
+
+    This structure defines a hash bucket of user mode lock waiters.
+
+Members:
+
+    Lock - Stores the spin lock protecting the bucket. This is acquired at
+        dispatch level.
+
+    WaiterList - Stores the head of the list of USER_LOCK waiters whose
+        addresses hash to this bucket.
+
+--*/
+
+typedef struct _USER_LOCK_BUCKET {
+    KSPIN_LOCK Lock;
+    LIST_ENTRY WaiterList;
+} USER_LOCK_BUCKET, *PUSER_LOCK_BUCKET;
+
+/*++
+
 Structure Description:
 
     This structure defines a user mode lock, which is basically just a wait
@@ -56,8 +85,11 @@ Structure Description:
 
 Members:
 
-    TreeNode - Stores the accounting structure for keeping the entry in a
-        Red-Black tree.
+    ListEntry - Stores pointers to the next and previous waiters in the
+        bucket. The next pointer is NULL when the lock is not queued.
+
+    Bucket - Stores a pointer to the bucket the lock is queued in. This only
+        changes with both the old and new bucket locks held.
 
     Object - Stores a pointer to the object this lock is tied to. This is a
         process for a process local lock, an image section for a lock in a
@@ -65,9 +97,8 @@ Structure Description:
 
     Offset - Stores either 1) the offset into the file object, 2) the offset
         into the image section, or 3) the user mode address in the process
-        address space, depending on the type of lock.
-
-    ReferenceCount - Stores the reference count of the object.
+        address space, depending on the type of lock. A requeue operation may
+        change this to a different offset within the same object.
 
     Type - Stores the object type, used when trying to release the lock.
 
@@ -76,7 +107,8 @@ Structure Description:
 --*/
 
 typedef struct _USER_LOCK {
-    RED_BLACK_TREE_NODE TreeNode;
+    LIST_ENTRY ListEntry;
+    PUSER_LOCK_BUCKET Bucket;
     PVOID Object;
     UINTN Offset;
     USER_LOCK_TYPE Type;
@@ -93,7 +125,12 @@ PspUserLockWait (
     );
 
 KSTATUS
-PspUserLockWake (
+PspUserLockRequeue (
+    PSYSTEM_CALL_USER_LOCK Parameters
+    );
+
+KSTATUS
+PspUserLockWakeOperation (
     PSYSTEM_CALL_USER_LOCK Parameters
     );
 
@@ -109,19 +146,53 @@ PspReleaseUserLockObject (
     PUSER_LOCK Lock
     );
 
-COMPARISON_RESULT
-PspCompareUserLocks (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+PUSER_LOCK_BUCKET
+PspGetUserLockBucket (
+    PUSER_LOCK Lock
+    );
+
+RUNLEVEL
+PspAcquireUserLockBuckets (
+    PUSER_LOCK_BUCKET First,
+    PUSER_LOCK_BUCKET Second
+    );
+
+VOID
+PspReleaseUserLockBuckets (
+    PUSER_LOCK_BUCKET First,
+    PUSER_LOCK_BUCKET Second,
+    RUNLEVEL OldRunLevel
+    );
+
+ULONG
+PspWakeUserLockWaiters (
+    PUSER_LOCK_BUCKET Bucket,
+    PUSER_LOCK Key,
+    ULONG Count
+    );
+
+BOOL
+PspDequeueUserLock (
+    PUSER_LOCK Lock
+    );
+
+KSTATUS
+PspApplyUserLockWakeOperation (
+    PULONG Address,
+    ULONG Argument,
+    PBOOL CompareResult
     );
 
 //
 // -------------------------------------------------------------------- Globals
 //
 
-PQUEUED_LOCK PsUserLockLock;
-RED_BLACK_TREE PsUserLockTree;
+//
+// Store the hash table of user lock waiters. Unrelated locks land in
+// different buckets and so do not contend with each other.
+//
+
+USER_LOCK_BUCKET PsUserLockBuckets[USER_LOCK_BUCKET_COUNT];
 
 //
 // ------------------------------------------------------------------ Functions
@@ -160,6 +231,29 @@ Return Value:
 
     Parameters = SystemCallParameter;
     Operation = Parameters->Operation & USER_LOCK_OPERATION_MASK;
+
+    //
+    // The user memory accessors do no range checking of their own, so make
+    // sure no part of either lock word reaches into kernel space. Private
+    // locks in particular are operated on directly at the address given.
+    //
+
+    if ((UINTN)(Parameters->Address) >
+        (UINTN)KERNEL_VA_START - sizeof(ULONG)) {
+
+        Status = STATUS_ACCESS_VIOLATION;
+        goto SysUserLockEnd;
+    }
+
+    if (((Operation == UserLockRequeue) ||
+         (Operation == UserLockWakeOperation)) &&
+        ((UINTN)(Parameters->Address2) >
+         (UINTN)KERNEL_VA_START - sizeof(ULONG))) {
+
+        Status = STATUS_ACCESS_VIOLATION;
+        goto SysUserLockEnd;
+    }
+
     switch (Operation) {
     case UserLockWait:
         Status = PspUserLockWait(Parameters);
@@ -169,11 +263,20 @@ Return Value:
         Status = PspUserLockWake(Parameters);
         break;
 
+    case UserLockRequeue:
+        Status = PspUserLockRequeue(Parameters);
+        break;
+
+    case UserLockWakeOperation:
+        Status = PspUserLockWakeOperation(Parameters);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         break;
     }
 
+SysUserLockEnd:
     return Status;
 }
 
@@ -200,11 +303,13 @@ Return Value:
 
 {
 
-    PsUserLockLock = KeCreateQueuedLock();
+    ULONG Index;
 
-    ASSERT(PsUserLockLock != NULL);
+    for (Index = 0; Index < USER_LOCK_BUCKET_COUNT; Index += 1) {
+        KeInitializeSpinLock(&(PsUserLockBuckets[Index].Lock));
+        INITIALIZE_LIST_HEAD(&(PsUserLockBuckets[Index].WaiterList));
+    }
 
-    RtlRedBlackTreeInitialize(&PsUserLockTree, 0, PspCompareUserLocks);
     return;
 }
 
@@ -231,9 +336,9 @@ Return Value:
 
 {
 
-    PUSER_LOCK FoundLock;
-    PRED_BLACK_TREE_NODE FoundNode;
+    PUSER_LOCK_BUCKET Bucket;
     USER_LOCK Lock;
+    RUNLEVEL OldRunLevel;
     BOOL Private;
     ULONG ProcessesReleased;
     KSTATUS Status;
@@ -252,37 +357,13 @@ Return Value:
     // Release the specified number of processes.
     //
 
-    ProcessesReleased = 0;
-    KeAcquireQueuedLock(PsUserLockLock);
-    while (Parameters->Value != 0) {
-        FoundNode = RtlRedBlackTreeSearch(&PsUserLockTree, &(Lock.TreeNode));
-        if (FoundNode == NULL) {
-            break;
-        }
-
-        //
-        // Remove it from the tree first. The locks are stack allocated, so as
-        // soon as the thread is made ready the memory could go invalid.
-        //
+    Bucket = PspGetUserLockBucket(&Lock);
+    OldRunLevel = PspAcquireUserLockBuckets(Bucket, NULL);
+    ProcessesReleased = PspWakeUserLockWaiters(Bucket,
+                                               &Lock,
+                                               Parameters->Value);
 
-        FoundLock = RED_BLACK_TREE_VALUE(FoundNode, USER_LOCK, TreeNode);
-        RtlRedBlackTreeRemove(&PsUserLockTree, FoundNode);
-        ObSignalQueue(&(FoundLock->WaitQueue), SignalOptionSignalAll);
-
-        //
-        // The object can go away as soon as it's known to be removed from the
-        // tree. Make sure this thread is done touching the object before
-        // indicating to the woken thread that it can destroy this memory.
-        //
-
-        FoundNode->Parent = NULL;
-        ProcessesReleased += 1;
-        if (Parameters->Value != MAX_ULONG) {
-            Parameters->Value -= 1;
-        }
-    }
-
-    KeReleaseQueuedLock(PsUserLockLock);
+    PspReleaseUserLockBuckets(Bucket, NULL, OldRunLevel);
     PspReleaseUserLockObject(&Lock);
     Parameters->Value = ProcessesReleased;
     return STATUS_SUCCESS;
@@ -315,10 +396,12 @@ Return Value:
 
 {
 
+    PUSER_LOCK_BUCKET Bucket;
     ULONGLONG ElapsedTimeInMilliseconds;
     ULONGLONG EndTime;
     ULONGLONG Frequency;
     USER_LOCK Lock;
+    RUNLEVEL OldRunLevel;
     BOOL Private;
     ULONGLONG StartTime;
     KSTATUS Status;
@@ -335,7 +418,19 @@ Return Value:
     }
 
     ObInitializeWaitQueue(&(Lock.WaitQueue), NotSignaled);
-    KeAcquireQueuedLock(PsUserLockLock);
+
+    //
+    // Queue the lock before reading the user mode value, since the bucket
+    // lock is a spin lock and the read may fault. A waker always changes the
+    // value before looking in the bucket, so either this thread sees the new
+    // value or the waker sees this thread queued. The wake is never lost.
+    //
+
+    Bucket = PspGetUserLockBucket(&Lock);
+    OldRunLevel = PspAcquireUserLockBuckets(Bucket, NULL);
+    INSERT_BEFORE(&(Lock.ListEntry), &(Bucket->WaiterList));
+    Lock.Bucket = Bucket;
+    PspReleaseUserLockBuckets(Bucket, NULL, OldRunLevel);
 
     //
     // If the read failed, then bail out.
@@ -344,28 +439,29 @@ Return Value:
     if (MmUserRead32(Parameters->Address, &UserValue) == FALSE) {
         Status = STATUS_ACCESS_VIOLATION;
 
-    } else {
+    //
+    // If the value changed between the time user mode started to ask for
+    // a wait and now, bail out.
+    //
 
-        //
-        // If the value changed between the time user mode started to ask for
-        // a wait and now, bail out.
-        //
+    } else if (UserValue != Parameters->Value) {
+        Status = STATUS_OPERATION_WOULD_BLOCK;
+    }
 
-        if (UserValue != Parameters->Value) {
-            Status = STATUS_OPERATION_WOULD_BLOCK;
+    if (!KSUCCESS(Status)) {
 
         //
-        // The value is the same, commit to going down.
+        // If a waker already pulled this thread out of the bucket, it counted
+        // this thread as woken. Report a successful wait so that user mode
+        // retries rather than treating the wake as lost.
         //
 
-        } else {
+        if ((PspDequeueUserLock(&Lock) == FALSE) &&
+            (Status == STATUS_OPERATION_WOULD_BLOCK)) {
+
             Status = STATUS_SUCCESS;
-            RtlRedBlackTreeInsert(&PsUserLockTree, &(Lock.TreeNode));
         }
-    }
 
-    KeReleaseQueuedLock(PsUserLockLock);
-    if (!KSUCCESS(Status)) {
         goto UserLockWaitEnd;
     }
 
@@ -410,22 +506,232 @@ Return Value:
     }
 
     //
-    // Remove the object from the tree, racing with the parent who may
-    // have already done it to save the extra lock acquire.
+    // Remove the lock from its bucket, racing with the waker who may have
+    // already done it.
+    //
+
+    PspDequeueUserLock(&Lock);
+
+UserLockWaitEnd:
+    PspReleaseUserLockObject(&Lock);
+    return Status;
+}
+
+KSTATUS
+PspUserLockRequeue (
+    PSYSTEM_CALL_USER_LOCK Parameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes some waiters on one user mode address and moves the
+    rest to wait on a second address.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the requeue parameters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PUSER_LOCK_BUCKET Bucket;
+    PLIST_ENTRY CurrentEntry;
+    PUSER_LOCK CurrentLock;
+    RUNLEVEL OldRunLevel;
+    BOOL Private;
+    ULONG Requeued;
+    ULONG RequeueCount;
+    USER_LOCK Source;
+    KSTATUS Status;
+    USER_LOCK Target;
+    PUSER_LOCK_BUCKET TargetBucket;
+    ULONG UserValue;
+    ULONG Woken;
+
+    Private = FALSE;
+    if ((Parameters->Operation & USER_LOCK_PRIVATE) != 0) {
+        Private = TRUE;
+    }
+
+    Requeued = 0;
+    Woken = 0;
+    Status = PspInitializeUserLock(Parameters->Address, Private, &Source);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = PspInitializeUserLock(Parameters->Address2, Private, &Target);
+    if (!KSUCCESS(Status)) {
+        goto UserLockRequeueEnd;
+    }
+
+    //
+    // The comparison is done before the bucket locks are acquired since the
+    // read may fault. Moving a waiter that arrived just after the change is
+    // no worse than a spurious wakeup, which user mode must tolerate anyway.
+    //
+
+    if (MmUserRead32(Parameters->Address, &UserValue) == FALSE) {
+        Status = STATUS_ACCESS_VIOLATION;
+        goto UserLockRequeueEnd;
+    }
+
+    if (UserValue != Parameters->Argument) {
+        Status = STATUS_OPERATION_WOULD_BLOCK;
+        goto UserLockRequeueEnd;
+    }
+
+    Bucket = PspGetUserLockBucket(&Source);
+    TargetBucket = PspGetUserLockBucket(&Target);
+    OldRunLevel = PspAcquireUserLockBuckets(Bucket, TargetBucket);
+    Woken = PspWakeUserLockWaiters(Bucket, &Source, Parameters->Value);
+
+    //
+    // Waiters hold a reference on the object they originally looked up, so
+    // they can only be moved within that object. Wake them instead if the
+    // target lives somewhere else.
     //
 
-    if (Lock.TreeNode.Parent != NULL) {
-        KeAcquireQueuedLock(PsUserLockLock);
-        if (Lock.TreeNode.Parent != NULL) {
-            RtlRedBlackTreeRemove(&PsUserLockTree, &(Lock.TreeNode));
-            Lock.TreeNode.Parent = NULL;
+    RequeueCount = Parameters->Value2;
+    if (Source.Object != Target.Object) {
+        Woken += PspWakeUserLockWaiters(Bucket, &Source, RequeueCount);
+
+    } else {
+        CurrentEntry = Bucket->WaiterList.Next;
+        while ((CurrentEntry != &(Bucket->WaiterList)) &&
+               (RequeueCount != 0)) {
+
+            CurrentLock = LIST_VALUE(CurrentEntry, USER_LOCK, ListEntry);
+            CurrentEntry = CurrentEntry->Next;
+            if ((CurrentLock->Object != Source.Object) ||
+                (CurrentLock->Offset != Source.Offset)) {
+
+                continue;
+            }
+
+            CurrentLock->Offset = Target.Offset;
+            if (TargetBucket != Bucket) {
+                LIST_REMOVE(&(CurrentLock->ListEntry));
+                INSERT_BEFORE(&(CurrentLock->ListEntry),
+                              &(TargetBucket->WaiterList));
+
+                CurrentLock->Bucket = TargetBucket;
+            }
+
+            Requeued += 1;
+            if (RequeueCount != MAX_ULONG) {
+                RequeueCount -= 1;
+            }
         }
+    }
+
+    PspReleaseUserLockBuckets(Bucket, TargetBucket, OldRunLevel);
+    Status = STATUS_SUCCESS;
 
-        KeReleaseQueuedLock(PsUserLockLock);
+UserLockRequeueEnd:
+    if (Target.Object != NULL) {
+        PspReleaseUserLockObject(&Target);
     }
 
-UserLockWaitEnd:
-    PspReleaseUserLockObject(&Lock);
+    PspReleaseUserLockObject(&Source);
+    Parameters->Value = Woken;
+    Parameters->Value2 = Requeued;
+    return Status;
+}
+
+KSTATUS
+PspUserLockWakeOperation (
+    PSYSTEM_CALL_USER_LOCK Parameters
+    )
+
+/*++
+
+Routine Description:
+
+    This routine atomically modifies the second user mode address, wakes
+    waiters on the first address, and conditionally wakes waiters on the
+    second address based on its original value.
+
+Arguments:
+
+    Parameters - Supplies a pointer to the wake operation parameters.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PUSER_LOCK_BUCKET Bucket;
+    BOOL CompareResult;
+    USER_LOCK First;
+    RUNLEVEL OldRunLevel;
+    BOOL Private;
+    USER_LOCK Second;
+    PUSER_LOCK_BUCKET SecondBucket;
+    ULONG SecondWoken;
+    KSTATUS Status;
+    ULONG Woken;
+
+    Private = FALSE;
+    if ((Parameters->Operation & USER_LOCK_PRIVATE) != 0) {
+        Private = TRUE;
+    }
+
+    SecondWoken = 0;
+    Woken = 0;
+    Status = PspInitializeUserLock(Parameters->Address, Private, &First);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = PspInitializeUserLock(Parameters->Address2, Private, &Second);
+    if (!KSUCCESS(Status)) {
+        goto UserLockWakeOperationEnd;
+    }
+
+    //
+    // Modify the second value before looking in the buckets. Any waiter not
+    // yet queued will then see the new value, just as with a regular wake.
+    //
+
+    Status = PspApplyUserLockWakeOperation(Parameters->Address2,
+                                           Parameters->Argument,
+                                           &CompareResult);
+
+    if (!KSUCCESS(Status)) {
+        goto UserLockWakeOperationEnd;
+    }
+
+    Bucket = PspGetUserLockBucket(&First);
+    SecondBucket = PspGetUserLockBucket(&Second);
+    OldRunLevel = PspAcquireUserLockBuckets(Bucket, SecondBucket);
+    Woken = PspWakeUserLockWaiters(Bucket, &First, Parameters->Value);
+    if (CompareResult != FALSE) {
+        SecondWoken = PspWakeUserLockWaiters(SecondBucket,
+                                             &Second,
+                                             Parameters->Value2);
+    }
+
+    PspReleaseUserLockBuckets(Bucket, SecondBucket, OldRunLevel);
+
+UserLockWakeOperationEnd:
+    if (Second.Object != NULL) {
+        PspReleaseUserLockObject(&Second);
+    }
+
+    PspReleaseUserLockObject(&First);
+    Parameters->Value = Woken;
+    Parameters->Value2 = SecondWoken;
     return Status;
 }
 
@@ -463,6 +769,8 @@ Return Value:
 
     BOOL Shared;
 
+    Lock->ListEntry.Next = NULL;
+    Lock->Bucket = NULL;
     if (Private != FALSE) {
         Lock->Object = PsGetCurrentProcess();
         Lock->Offset = (UINTN)Address;
@@ -537,62 +845,391 @@ Return Value:
     return;
 }
 
-COMPARISON_RESULT
-PspCompareUserLocks (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+PUSER_LOCK_BUCKET
+PspGetUserLockBucket (
+    PUSER_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the hash bucket for the given user lock key.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock, whose object and offset are hashed.
+
+Return Value:
+
+    Returns a pointer to the bucket the lock belongs in.
+
+--*/
+
+{
+
+    ULONG Hash;
+
+    //
+    // Locks are at least four byte aligned and objects are at least eight
+    // byte aligned, so drop the low bits and mix with a multiplicative hash.
+    //
+
+    Hash = (ULONG)(((UINTN)(Lock->Object) >> 3) ^ (Lock->Offset >> 2));
+    Hash *= 0x9E3779B1;
+    Hash >>= 32 - USER_LOCK_BUCKET_SHIFT;
+    return &(PsUserLockBuckets[Hash]);
+}
+
+RUNLEVEL
+PspAcquireUserLockBuckets (
+    PUSER_LOCK_BUCKET First,
+    PUSER_LOCK_BUCKET Second
+    )
+
+/*++
+
+Routine Description:
+
+    This routine raises to dispatch level and acquires one or two user lock
+    buckets. Buckets are always acquired in address order to avoid deadlocks.
+
+Arguments:
+
+    First - Supplies a pointer to the first bucket to acquire.
+
+    Second - Supplies an optional pointer to a second bucket to acquire. This
+        may be the same as the first bucket.
+
+Return Value:
+
+    Returns the previous run level, which must be passed in when the buckets
+    are released.
+
+--*/
+
+{
+
+    RUNLEVEL OldRunLevel;
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    if ((Second == NULL) || (Second == First)) {
+        KeAcquireSpinLock(&(First->Lock));
+
+    } else if (First < Second) {
+        KeAcquireSpinLock(&(First->Lock));
+        KeAcquireSpinLock(&(Second->Lock));
+
+    } else {
+        KeAcquireSpinLock(&(Second->Lock));
+        KeAcquireSpinLock(&(First->Lock));
+    }
+
+    return OldRunLevel;
+}
+
+VOID
+PspReleaseUserLockBuckets (
+    PUSER_LOCK_BUCKET First,
+    PUSER_LOCK_BUCKET Second,
+    RUNLEVEL OldRunLevel
     )
 
 /*++
 
 Routine Description:
 
-    This routine compares two Red-Black tree nodes that in this case are user
-    mode lock objects.
+    This routine releases one or two user lock buckets and lowers the run
+    level.
 
 Arguments:
 
-    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+    First - Supplies a pointer to the first bucket to release.
 
-    FirstNode - Supplies a pointer to the left side of the comparison.
+    Second - Supplies an optional pointer to the second bucket to release.
 
-    SecondNode - Supplies a pointer to the second side of the comparison.
+    OldRunLevel - Supplies the run level returned when the buckets were
+        acquired.
 
 Return Value:
 
-    Same if the two nodes have the same value.
+    None.
 
-    Ascending if the first node is less than the second node.
+--*/
 
-    Descending if the second node is less than the first node.
+{
+
+    if ((Second != NULL) && (Second != First)) {
+        KeReleaseSpinLock(&(Second->Lock));
+    }
+
+    KeReleaseSpinLock(&(First->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+ULONG
+PspWakeUserLockWaiters (
+    PUSER_LOCK_BUCKET Bucket,
+    PUSER_LOCK Key,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine wakes waiters in the given bucket whose object and offset
+    match the given key. The bucket lock must be held.
+
+Arguments:
+
+    Bucket - Supplies a pointer to the locked bucket.
+
+    Key - Supplies a pointer to the lock containing the object and offset to
+        match.
+
+    Count - Supplies the maximum number of waiters to wake. Supply MAX_ULONG
+        to wake all of them.
+
+Return Value:
+
+    Returns the number of waiters woken.
 
 --*/
 
 {
 
-    PUSER_LOCK FirstLock;
-    PUSER_LOCK SecondLock;
+    PLIST_ENTRY CurrentEntry;
+    PUSER_LOCK CurrentLock;
+    ULONG Woken;
+
+    Woken = 0;
+    CurrentEntry = Bucket->WaiterList.Next;
+    while ((CurrentEntry != &(Bucket->WaiterList)) && (Count != 0)) {
+        CurrentLock = LIST_VALUE(CurrentEntry, USER_LOCK, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((CurrentLock->Object != Key->Object) ||
+            (CurrentLock->Offset != Key->Offset)) {
+
+            continue;
+        }
+
+        //
+        // Remove it from the bucket first. The locks are stack allocated, so
+        // as soon as the thread is made ready the memory could go invalid.
+        //
+
+        LIST_REMOVE(&(CurrentLock->ListEntry));
+        ObSignalQueue(&(CurrentLock->WaitQueue), SignalOptionSignalAll);
+
+        //
+        // The object can go away as soon as it's known to be removed from the
+        // bucket. Make sure this thread is done touching the object before
+        // indicating to the woken thread that it can destroy this memory.
+        //
+
+        CurrentLock->ListEntry.Next = NULL;
+        Woken += 1;
+        if (Count != MAX_ULONG) {
+            Count -= 1;
+        }
+    }
+
+    return Woken;
+}
+
+BOOL
+PspDequeueUserLock (
+    PUSER_LOCK Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a waiting lock from its bucket if a waker has not
+    already done so.
+
+Arguments:
+
+    Lock - Supplies a pointer to the lock to remove.
+
+Return Value:
+
+    TRUE if this routine removed the lock.
+
+    FALSE if a waker had already removed it.
+
+--*/
+
+{
+
+    PUSER_LOCK_BUCKET Bucket;
+    RUNLEVEL OldRunLevel;
+    BOOL Removed;
 
     //
-    // Compare raw pointers to the objects first.
+    // Check without the lock first to save the acquire if a waker already
+    // did the work. The bucket may change out from under this thread due to
+    // a requeue, so make sure the bucket acquired is still the right one.
     //
 
-    FirstLock = RED_BLACK_TREE_VALUE(FirstNode, USER_LOCK, TreeNode);
-    SecondLock = RED_BLACK_TREE_VALUE(SecondNode, USER_LOCK, TreeNode);
-    if (FirstLock->Object < SecondLock->Object) {
-        return ComparisonResultAscending;
-
-    } else if (FirstLock->Object > SecondLock->Object) {
-        return ComparisonResultDescending;
+    Removed = FALSE;
+    while (Lock->ListEntry.Next != NULL) {
+        Bucket = Lock->Bucket;
+        OldRunLevel = PspAcquireUserLockBuckets(Bucket, NULL);
+        if (Lock->Bucket != Bucket) {
+            PspReleaseUserLockBuckets(Bucket, NULL, OldRunLevel);
+            continue;
+        }
 
-    } else if (FirstLock->Offset > SecondLock->Offset) {
-        return ComparisonResultDescending;
+        if (Lock->ListEntry.Next != NULL) {
+            LIST_REMOVE(&(Lock->ListEntry));
+            Lock->ListEntry.Next = NULL;
+            Removed = TRUE;
+        }
 
-    } else if (FirstLock->Offset < SecondLock->Offset) {
-        return ComparisonResultAscending;
+        PspReleaseUserLockBuckets(Bucket, NULL, OldRunLevel);
+        break;
     }
 
-    return ComparisonResultSame;
+    return Removed;
 }
 
+KSTATUS
+PspApplyUserLockWakeOperation (
+    PULONG Address,
+    ULONG Argument,
+    PBOOL CompareResult
+    )
+
+/*++
+
+Routine Description:
+
+    This routine atomically applies the encoded operation to a user mode
+    value and evaluates the encoded comparison against the original value.
+
+Arguments:
+
+    Address - Supplies a pointer to the user mode value to modify.
+
+    Argument - Supplies the encoded operation. See USER_LOCK_WAKE_ARGUMENT.
+
+    CompareResult - Supplies a pointer where the result of the comparison will
+        be returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the operation is invalid or the address is
+    not aligned.
+
+    STATUS_ACCESS_VIOLATION if the address could not be accessed.
+
+--*/
+
+{
+
+    ULONG CompareValue;
+    ULONG NewValue;
+    ULONG Operand;
+    ULONG Operation;
+    ULONG OriginalValue;
+    ULONG Value;
+
+    if (ALIGN_RANGE_DOWN((UINTN)Address, sizeof(ULONG)) != (UINTN)Address) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Operation = USER_LOCK_WAKE_ARGUMENT_OPERATION(Argument);
+    Operand = USER_LOCK_WAKE_ARGUMENT_ARGUMENT(Argument);
+    CompareValue = USER_LOCK_WAKE_ARGUMENT_VALUE(Argument);
+    if ((Operation & USER_LOCK_WAKE_OPERATION_SHIFT) != 0) {
+        Operation &= ~USER_LOCK_WAKE_OPERATION_SHIFT;
+        if (Operand >= (sizeof(ULONG) * BITS_PER_BYTE)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        Operand = 1 << Operand;
+    }
+
+    if (MmUserRead32(Address, &Value) == FALSE) {
+        return STATUS_ACCESS_VIOLATION;
+    }
+
+    while (TRUE) {
+        switch (Operation) {
+        case USER_LOCK_WAKE_OPERATION_SET:
+            NewValue = Operand;
+            break;
+
+        case USER_LOCK_WAKE_OPERATION_ADD:
+            NewValue = Value + Operand;
+            break;
+
+        case USER_LOCK_WAKE_OPERATION_OR:
+            NewValue = Value | Operand;
+            break;
+
+        case USER_LOCK_WAKE_OPERATION_AND_NOT:
+            NewValue = Value & ~Operand;
+            break;
+
+        case USER_LOCK_WAKE_OPERATION_XOR:
+            NewValue = Value ^ Operand;
+            break;
+
+        default:
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        if (MmUserCompareExchange32(Address,
+                                    NewValue,
+                                    Value,
+                                    &OriginalValue) == FALSE) {
+
+            return STATUS_ACCESS_VIOLATION;
+        }
+
+        if (OriginalValue == Value) {
+            break;
+        }
+
+        Value = OriginalValue;
+    }
+
+    switch (USER_LOCK_WAKE_ARGUMENT_COMPARE(Argument)) {
+    case USER_LOCK_WAKE_COMPARE_EQUAL:
+        *CompareResult = (Value == CompareValue);
+        break;
+
+    case USER_LOCK_WAKE_COMPARE_NOT_EQUAL:
+        *CompareResult = (Value != CompareValue);
+        break;
+
+    case USER_LOCK_WAKE_COMPARE_LESS:
+        *CompareResult = ((LONG)Value < (LONG)CompareValue);
+        break;
+
+    case USER_LOCK_WAKE_COMPARE_LESS_EQUAL:
+        *CompareResult = ((LONG)Value <= (LONG)CompareValue);
+        break;
+
+    case USER_LOCK_WAKE_COMPARE_GREATER:
+        *CompareResult = ((LONG)Value > (LONG)CompareValue);
+        break;
+
+    case USER_LOCK_WAKE_COMPARE_GREATER_EQUAL:
+        *CompareResult = ((LONG)Value >= (LONG)CompareValue);
+        break;
+
+    default:
+        *CompareResult = FALSE;
+        break;
+    }
+
+    return STATUS_SUCCESS;
+}
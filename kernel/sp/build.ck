@@ -29,7 +29,8 @@ Module Name:
 function build() {
     base_sources = [
         "info.c",
-        "profiler.c"
+        "profiler.c",
+        "trace.c"
     ];
 
     if ((arch == "armv7") || (arch == "armv6")) {
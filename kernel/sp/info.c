@@ -106,6 +106,14 @@ Return Value:
         Status = SppGetSetState(Data, DataSize, Set);
         break;
 
+    case SpInformationTraceControl:
+        Status = SppGetSetTraceControl(Data, DataSize, Set);
+        break;
+
+    case SpInformationTraceData:
+        Status = SppGetTraceData(Data, DataSize, Set);
+        break;
+
     default:
         Status = STATUS_INVALID_PARAMETER;
         *DataSize = 0;
@@ -101,6 +101,66 @@ Return Value:
 
 --*/
 
+KSTATUS
+SppGetSetTraceControl (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the kernel event tracing state.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+SppGetTraceData (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads and consumes trace events from every processor's trace
+    buffer.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is returned.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the number of bytes returned.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 SppArchGetKernelStackData (
     PTRAP_FRAME TrapFrame,
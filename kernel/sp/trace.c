@@ -0,0 +1,541 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    trace.c
+
+Abstract:
+
+    This module implements low overhead kernel event tracing. Each processor
+    records events into its own ring buffer with interrupts disabled, so
+    writers never contend on a lock. A reader drains the buffers through the
+    system information interface.
+
+Author:
+
+    Evan Green 29-Mar-2017
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "spp.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define SP_TRACE_ALLOCATION_TAG 0x72547053 // 'rTpS'
+
+//
+// Define the number of events in each processor's ring buffer. This must be a
+// power of two.
+//
+
+#define SP_TRACE_EVENTS_PER_PROCESSOR 4096
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines a processor's trace ring buffer.
+
+Members:
+
+    WriteIndex - Stores the total number of events ever written to the buffer.
+        Only the owning processor modifies this, and it is published after
+        the event contents are written.
+
+    ReadIndex - Stores the total number of events consumed or skipped by the
+        reader. This is protected by the profiling lock.
+
+    LostEvents - Stores the number of events overwritten before the reader
+        got to them. This is protected by the profiling lock.
+
+    Events - Stores the ring of events.
+
+--*/
+
+typedef struct _SP_TRACE_BUFFER {
+    volatile ULONG WriteIndex;
+    ULONG ReadIndex;
+    ULONGLONG LostEvents;
+    SP_TRACE_EVENT Events[SP_TRACE_EVENTS_PER_PROCESSOR];
+} SP_TRACE_BUFFER, *PSP_TRACE_BUFFER;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+SppCreateTraceBuffers (
+    VOID
+    );
+
+ULONG
+SppReadTraceBuffer (
+    PSP_TRACE_BUFFER Buffer,
+    PSP_TRACE_EVENT Events,
+    ULONG Capacity
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+volatile ULONG SpTraceFlags;
+
+//
+// Store the array of per-processor trace buffers. These are created the first
+// time tracing is enabled and never freed, since a processor may be in the
+// middle of writing an event at any time.
+//
+
+PSP_TRACE_BUFFER *SpTraceBuffers;
+ULONG SpTraceBufferCount;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KERNEL_API
+VOID
+SpRecordTraceEvent (
+    ULONG Type,
+    ULONG Detail,
+    ULONGLONG Argument0,
+    ULONGLONG Argument1,
+    ULONGLONG Argument2
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records an event in the current processor's trace buffer.
+    It can be called at any run level. Callers should use the SpTraceEvent
+    macro, which skips the call when the category is disabled.
+
+Arguments:
+
+    Type - Supplies the event type. See SP_TRACE_EVENT_TYPE.
+
+    Detail - Supplies the event specific detail value.
+
+    Argument0 - Supplies the first event specific argument.
+
+    Argument1 - Supplies the second event specific argument.
+
+    Argument2 - Supplies the third event specific argument.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PSP_TRACE_BUFFER Buffer;
+    BOOL Enabled;
+    PSP_TRACE_EVENT Event;
+    ULONG Index;
+    PPROCESSOR_BLOCK Processor;
+    PKTHREAD Thread;
+
+    //
+    // Disabling interrupts keeps the processor fixed and prevents an event
+    // recorded from an interrupt handler from landing in the middle of this
+    // one.
+    //
+
+    Enabled = ArDisableInterrupts();
+    Processor = KeGetCurrentProcessorBlock();
+    if (Processor->ProcessorNumber >= SpTraceBufferCount) {
+        goto RecordTraceEventEnd;
+    }
+
+    Buffer = SpTraceBuffers[Processor->ProcessorNumber];
+    Index = Buffer->WriteIndex;
+    Event = &(Buffer->Events[Index & (SP_TRACE_EVENTS_PER_PROCESSOR - 1)]);
+    Event->Time = HlQueryTimeCounter();
+    Event->Type = Type;
+    Event->Processor = Processor->ProcessorNumber;
+    Event->Detail = Detail;
+    Thread = Processor->RunningThread;
+    if (Thread != NULL) {
+        Event->ThreadId = Thread->ThreadId;
+        Event->ProcessId = Thread->OwningProcess->Identifiers.ProcessId;
+
+    } else {
+        Event->ThreadId = 0;
+        Event->ProcessId = 0;
+    }
+
+    Event->Arguments[0] = Argument0;
+    Event->Arguments[1] = Argument1;
+    Event->Arguments[2] = Argument2;
+
+    //
+    // Make sure the event contents are visible before the reader can see the
+    // new write index.
+    //
+
+    RtlMemoryBarrier();
+    Buffer->WriteIndex = Index + 1;
+
+RecordTraceEventEnd:
+    if (Enabled != FALSE) {
+        ArEnableInterrupts();
+    }
+
+    return;
+}
+
+KSTATUS
+SppGetSetTraceControl (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the kernel event tracing state.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PSP_TRACE_CONTROL Control;
+    KSTATUS Status;
+
+    Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    if (*DataSize < sizeof(SP_TRACE_CONTROL)) {
+        *DataSize = sizeof(SP_TRACE_CONTROL);
+        return STATUS_DATA_LENGTH_MISMATCH;
+    }
+
+    Control = Data;
+    KeAcquireQueuedLock(SpProfilingQueuedLock);
+    if (Set != FALSE) {
+        if ((Control->Flags & ~SP_TRACE_FLAG_ALL) != 0) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto GetSetTraceControlEnd;
+        }
+
+        if ((Control->Flags != 0) && (SpTraceBuffers == NULL)) {
+            Status = SppCreateTraceBuffers();
+            if (!KSUCCESS(Status)) {
+                goto GetSetTraceControlEnd;
+            }
+        }
+
+        SpTraceFlags = Control->Flags;
+    }
+
+    Control->Flags = SpTraceFlags;
+    Control->EventsPerProcessor = SP_TRACE_EVENTS_PER_PROCESSOR;
+    *DataSize = sizeof(SP_TRACE_CONTROL);
+    Status = STATUS_SUCCESS;
+
+GetSetTraceControlEnd:
+    KeReleaseQueuedLock(SpProfilingQueuedLock);
+    return Status;
+}
+
+KSTATUS
+SppGetTraceData (
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads and consumes trace events from every processor's trace
+    buffer.
+
+Arguments:
+
+    Data - Supplies a pointer to the data buffer where the data is returned.
+
+    DataSize - Supplies a pointer that on input contains the size of the
+        data buffer. On output, contains the number of bytes returned.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or
+        a set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Capacity;
+    ULONG Count;
+    ULONG Index;
+    PSP_TRACE_DATA TraceData;
+    KSTATUS Status;
+
+    if (Set != FALSE) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    Status = PsCheckPermission(PERMISSION_SYSTEM_ADMINISTRATOR);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    if (*DataSize < sizeof(SP_TRACE_DATA)) {
+        *DataSize = sizeof(SP_TRACE_DATA);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    TraceData = Data;
+    if (TraceData->Version < SP_TRACE_DATA_VERSION) {
+        return STATUS_VERSION_MISMATCH;
+    }
+
+    Capacity = (*DataSize - FIELD_OFFSET(SP_TRACE_DATA, Events)) /
+               sizeof(SP_TRACE_EVENT);
+
+    TraceData->Version = SP_TRACE_DATA_VERSION;
+    TraceData->LostEventCount = 0;
+    TraceData->TimeCounterFrequency = HlQueryTimeCounterFrequency();
+    Count = 0;
+    KeAcquireQueuedLock(SpProfilingQueuedLock);
+    for (Index = 0; Index < SpTraceBufferCount; Index += 1) {
+        Count += SppReadTraceBuffer(SpTraceBuffers[Index],
+                                    &(TraceData->Events[Count]),
+                                    Capacity - Count);
+
+        TraceData->LostEventCount += SpTraceBuffers[Index]->LostEvents;
+        SpTraceBuffers[Index]->LostEvents = 0;
+    }
+
+    KeReleaseQueuedLock(SpProfilingQueuedLock);
+    TraceData->EventCount = Count;
+    *DataSize = FIELD_OFFSET(SP_TRACE_DATA, Events) +
+                (Count * sizeof(SP_TRACE_EVENT));
+
+    return STATUS_SUCCESS;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+SppCreateTraceBuffers (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a trace buffer for each active processor. This
+    routine assumes the profiling lock is held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PSP_TRACE_BUFFER *Buffers;
+    ULONG Count;
+    ULONG Index;
+    KSTATUS Status;
+
+    Count = KeGetActiveProcessorCount();
+    Buffers = MmAllocateNonPagedPool(Count * sizeof(PSP_TRACE_BUFFER),
+                                     SP_TRACE_ALLOCATION_TAG);
+
+    if (Buffers == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateTraceBuffersEnd;
+    }
+
+    RtlZeroMemory(Buffers, Count * sizeof(PSP_TRACE_BUFFER));
+    for (Index = 0; Index < Count; Index += 1) {
+        Buffers[Index] = MmAllocateNonPagedPool(sizeof(SP_TRACE_BUFFER),
+                                                SP_TRACE_ALLOCATION_TAG);
+
+        if (Buffers[Index] == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto CreateTraceBuffersEnd;
+        }
+
+        Buffers[Index]->WriteIndex = 0;
+        Buffers[Index]->ReadIndex = 0;
+        Buffers[Index]->LostEvents = 0;
+    }
+
+    //
+    // Publish the array before the count so that a writer that sees the
+    // count also sees valid buffers.
+    //
+
+    SpTraceBuffers = Buffers;
+    RtlMemoryBarrier();
+    SpTraceBufferCount = Count;
+    Status = STATUS_SUCCESS;
+
+CreateTraceBuffersEnd:
+    if (!KSUCCESS(Status)) {
+        if (Buffers != NULL) {
+            for (Index = 0; Index < Count; Index += 1) {
+                if (Buffers[Index] != NULL) {
+                    MmFreeNonPagedPool(Buffers[Index]);
+                }
+            }
+
+            MmFreeNonPagedPool(Buffers);
+        }
+    }
+
+    return Status;
+}
+
+ULONG
+SppReadTraceBuffer (
+    PSP_TRACE_BUFFER Buffer,
+    PSP_TRACE_EVENT Events,
+    ULONG Capacity
+    )
+
+/*++
+
+Routine Description:
+
+    This routine consumes events from a processor's trace buffer without
+    stopping the writer. Events the writer laps while they are being copied
+    are discarded and counted as lost. This routine assumes the profiling lock
+    is held.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the trace buffer to read.
+
+    Events - Supplies a pointer where the events are returned.
+
+    Capacity - Supplies the maximum number of events to return.
+
+Return Value:
+
+    Returns the number of events copied.
+
+--*/
+
+{
+
+    ULONG Count;
+    ULONG Index;
+    ULONG Overwritten;
+    ULONG ReadIndex;
+    ULONG Slot;
+    ULONG WriteIndex;
+
+    WriteIndex = Buffer->WriteIndex;
+    RtlMemoryBarrier();
+    ReadIndex = Buffer->ReadIndex;
+    if ((WriteIndex - ReadIndex) > SP_TRACE_EVENTS_PER_PROCESSOR) {
+        Buffer->LostEvents += WriteIndex - ReadIndex -
+                              SP_TRACE_EVENTS_PER_PROCESSOR;
+
+        ReadIndex = WriteIndex - SP_TRACE_EVENTS_PER_PROCESSOR;
+    }
+
+    Count = WriteIndex - ReadIndex;
+    if (Count > Capacity) {
+        Count = Capacity;
+    }
+
+    for (Index = 0; Index < Count; Index += 1) {
+        Slot = (ReadIndex + Index) & (SP_TRACE_EVENTS_PER_PROCESSOR - 1);
+        RtlCopyMemory(&(Events[Index]),
+                      &(Buffer->Events[Slot]),
+                      sizeof(SP_TRACE_EVENT));
+    }
+
+    //
+    // If the writer wrapped around onto the slots just copied, the oldest
+    // copies may be torn. Throw those away, including the slot the writer may
+    // be filling in right now.
+    //
+
+    RtlMemoryBarrier();
+    WriteIndex = Buffer->WriteIndex;
+    Overwritten = 0;
+    if ((WriteIndex - ReadIndex) >= SP_TRACE_EVENTS_PER_PROCESSOR) {
+        Overwritten = WriteIndex - ReadIndex -
+                      SP_TRACE_EVENTS_PER_PROCESSOR + 1;
+
+        if (Overwritten > Count) {
+            Overwritten = Count;
+        }
+
+        for (Index = 0; Index < Count - Overwritten; Index += 1) {
+            RtlCopyMemory(&(Events[Index]),
+                          &(Events[Index + Overwritten]),
+                          sizeof(SP_TRACE_EVENT));
+        }
+
+        Buffer->LostEvents += Overwritten;
+    }
+
+    Buffer->ReadIndex = ReadIndex + Count;
+    return Count - Overwritten;
+}
+
@@ -1632,6 +1632,17 @@ Return Value:
         ArRestoreFpuState = ArRestoreX87State;
     }
 
+    //
+    // Enable 4MB pages if the processor supports them. Memory management
+    // only uses them once it sees the bit set in CR4.
+    //
+
+    if ((Edx & X86_CPUID_BASIC_EDX_PAGE_SIZE_EXTENSION) != 0) {
+        Cr4 = ArGetControlRegister4();
+        Cr4 |= CR4_PAGE_SIZE_EXTENSION;
+        ArSetControlRegister4(Cr4);
+    }
+
     return;
 }
 
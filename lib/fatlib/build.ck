@@ -27,9 +27,11 @@ Module Name:
 
 function build() {
     sources = [
+        "extent.c",
         "fat.c",
         "fatcache.c",
         "fatsup.c",
+        "freemap.c",
         "idtodir.c"
     ];
 
@@ -0,0 +1,920 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    extent.c
+
+Abstract:
+
+    This module implements the per-file extent map, which caches runs of
+    physically contiguous clusters so that seeks and large I/Os do not need to
+    walk the cluster chain one entry at a time.
+
+Author:
+
+    Evan Green 20-Mar-2017
+
+Environment:
+
+    Kernel, Boot, Build
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/fat/fatlib.h>
+#include <minoca/lib/fat/fat.h>
+#include "fatlibp.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the maximum number of extents a single map will hold. Files
+// fragmented beyond this point fall back to the seek table and chain walks,
+// which keeps the memory cost of a pathological file bounded.
+//
+
+#define FAT_EXTENT_MAP_MAX_EXTENTS 4096
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores a single run of contiguous clusters within a file.
+
+Members:
+
+    TreeNode - Stores the red-black tree information.
+
+    FileCluster - Stores the index of the first cluster of the run within the
+        file.
+
+    DiskCluster - Stores the cluster number of the first cluster of the run.
+
+    Count - Stores the number of clusters in the run.
+
+--*/
+
+typedef struct _FAT_FILE_EXTENT {
+    RED_BLACK_TREE_NODE TreeNode;
+    ULONG FileCluster;
+    ULONG DiskCluster;
+    ULONG Count;
+} FAT_FILE_EXTENT, *PFAT_FILE_EXTENT;
+
+/*++
+
+Structure Description:
+
+    This structure stores the extent map for a file. It is shared by all open
+    handles to the file, and is built lazily from the front of the cluster
+    chain.
+
+Members:
+
+    TreeNode - Stores the red-black tree information for the volume's tree of
+        extent maps.
+
+    FirstCluster - Stores the starting cluster of the file, which is also its
+        file ID.
+
+    ReferenceCount - Stores the number of open files using this map. This is
+        protected by the volume lock.
+
+    Lock - Stores a pointer to the lock protecting the extents.
+
+    Tree - Stores the tree of extents, keyed by file cluster index.
+
+    LastExtent - Stores a pointer to the extent covering the end of the mapped
+        region, or NULL if nothing has been mapped yet.
+
+    MappedClusters - Stores the number of clusters from the start of the file
+        that are described by the extent tree.
+
+    ExtentCount - Stores the number of extents in the tree.
+
+--*/
+
+struct _FAT_EXTENT_MAP {
+    RED_BLACK_TREE_NODE TreeNode;
+    ULONG FirstCluster;
+    ULONG ReferenceCount;
+    PVOID Lock;
+    RED_BLACK_TREE Tree;
+    PFAT_FILE_EXTENT LastExtent;
+    ULONG MappedClusters;
+    ULONG ExtentCount;
+};
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+FatpExtendExtentMap (
+    PFAT_VOLUME Volume,
+    PFAT_EXTENT_MAP Map,
+    ULONG IoFlags,
+    ULONG ClusterCount
+    );
+
+VOID
+FatpTrimExtentMap (
+    PFAT_VOLUME Volume,
+    PFAT_EXTENT_MAP Map,
+    ULONG ClusterCount
+    );
+
+PFAT_EXTENT_MAP
+FatpFindExtentMap (
+    PFAT_VOLUME Volume,
+    ULONG FirstCluster
+    );
+
+COMPARISON_RESULT
+FatpCompareExtentMapNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+COMPARISON_RESULT
+FatpCompareExtentNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+FatpInitializeExtentMapTree (
+    PFAT_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes the tree of file extent maps for the given
+    volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlRedBlackTreeInitialize(&(Volume->ExtentMapTree),
+                              0,
+                              FatpCompareExtentMapNodes);
+
+    return;
+}
+
+VOID
+FatpDestroyExtentMapTree (
+    PFAT_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees any extent maps remaining on the volume. All files
+    should be closed by now, so this is only expected to find leaked maps.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFAT_EXTENT_MAP Map;
+    PRED_BLACK_TREE_NODE Node;
+
+    while (TRUE) {
+        Node = RtlRedBlackTreeGetLowestNode(&(Volume->ExtentMapTree));
+        if (Node == NULL) {
+            break;
+        }
+
+        ASSERT(FALSE);
+
+        RtlRedBlackTreeRemove(&(Volume->ExtentMapTree), Node);
+        Map = RED_BLACK_TREE_VALUE(Node, FAT_EXTENT_MAP, TreeNode);
+        FatpTrimExtentMap(Volume, Map, 0);
+        FatDestroyLock(Map->Lock);
+        FatFreePagedMemory(Volume->Device.DeviceToken, Map);
+    }
+
+    return;
+}
+
+KSTATUS
+FatpOpenExtentMap (
+    PFAT_VOLUME Volume,
+    ULONG FirstCluster,
+    PFAT_EXTENT_MAP *Map
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up or creates the extent map for the file starting at
+    the given cluster, and takes a reference on it.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    FirstCluster - Supplies the starting cluster of the file.
+
+    Map - Supplies a pointer where a pointer to the referenced extent map will
+        be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PFAT_EXTENT_MAP ExistingMap;
+    PFAT_EXTENT_MAP NewMap;
+    KSTATUS Status;
+
+    *Map = NULL;
+
+    //
+    // Take a reference on an existing map if there is one.
+    //
+
+    FatAcquireLock(Volume->Lock);
+    ExistingMap = FatpFindExtentMap(Volume, FirstCluster);
+    if (ExistingMap != NULL) {
+        ExistingMap->ReferenceCount += 1;
+    }
+
+    FatReleaseLock(Volume->Lock);
+    if (ExistingMap != NULL) {
+        *Map = ExistingMap;
+        return STATUS_SUCCESS;
+    }
+
+    NewMap = FatAllocatePagedMemory(Volume->Device.DeviceToken,
+                                    sizeof(FAT_EXTENT_MAP));
+
+    if (NewMap == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(NewMap, sizeof(FAT_EXTENT_MAP));
+    NewMap->FirstCluster = FirstCluster;
+    NewMap->ReferenceCount = 1;
+    RtlRedBlackTreeInitialize(&(NewMap->Tree), 0, FatpCompareExtentNodes);
+    Status = FatCreateLock(&(NewMap->Lock));
+    if (!KSUCCESS(Status)) {
+        FatFreePagedMemory(Volume->Device.DeviceToken, NewMap);
+        return Status;
+    }
+
+    //
+    // Check again in case another open raced in and created the map while
+    // the lock was released.
+    //
+
+    FatAcquireLock(Volume->Lock);
+    ExistingMap = FatpFindExtentMap(Volume, FirstCluster);
+    if (ExistingMap != NULL) {
+        ExistingMap->ReferenceCount += 1;
+
+    } else {
+        RtlRedBlackTreeInsert(&(Volume->ExtentMapTree), &(NewMap->TreeNode));
+    }
+
+    FatReleaseLock(Volume->Lock);
+    if (ExistingMap != NULL) {
+        FatDestroyLock(NewMap->Lock);
+        FatFreePagedMemory(Volume->Device.DeviceToken, NewMap);
+        *Map = ExistingMap;
+
+    } else {
+        *Map = NewMap;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FatpCloseExtentMap (
+    PFAT_VOLUME Volume,
+    PFAT_EXTENT_MAP Map
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on an extent map, destroying it if this
+    was the last reference.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Map - Supplies a pointer to the extent map to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL Destroy;
+
+    Destroy = FALSE;
+    FatAcquireLock(Volume->Lock);
+
+    ASSERT(Map->ReferenceCount != 0);
+
+    Map->ReferenceCount -= 1;
+    if (Map->ReferenceCount == 0) {
+        RtlRedBlackTreeRemove(&(Volume->ExtentMapTree), &(Map->TreeNode));
+        Destroy = TRUE;
+    }
+
+    FatReleaseLock(Volume->Lock);
+    if (Destroy == FALSE) {
+        return;
+    }
+
+    FatpTrimExtentMap(Volume, Map, 0);
+    FatDestroyLock(Map->Lock);
+    FatFreePagedMemory(Volume->Device.DeviceToken, Map);
+    return;
+}
+
+KSTATUS
+FatpExtentMapLookup (
+    PFAT_VOLUME Volume,
+    PFAT_EXTENT_MAP Map,
+    ULONG IoFlags,
+    ULONG FileCluster,
+    ULONG ClusterCount,
+    PULONG DiskCluster,
+    PULONG RunCount,
+    PULONG NextCluster
+    )
+
+/*++
+
+Routine Description:
+
+    This routine translates a cluster index within a file to a disk cluster,
+    extending the extent map from the cluster chain if necessary.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Map - Supplies a pointer to the file's extent map.
+
+    IoFlags - Supplies flags regarding any necessary I/O operations. See
+        IO_FLAG_* definitions.
+
+    FileCluster - Supplies the index of the cluster within the file to look
+        up.
+
+    ClusterCount - Supplies the number of clusters the caller is interested
+        in, starting at the given file cluster. The map is extended far enough
+        to cover this many clusters, if the file is that long.
+
+    DiskCluster - Supplies a pointer where the disk cluster corresponding to
+        the given file cluster will be returned. If the file cluster is beyond
+        the end of the file, the last cluster of the file is returned instead.
+
+    RunCount - Supplies a pointer where the number of physically contiguous
+        clusters starting at the returned disk cluster will be returned. If
+        the file cluster is beyond the end of the file, the total number of
+        clusters in the file is returned instead.
+
+    NextCluster - Supplies an optional pointer where the disk cluster
+        following the returned run will be returned. This is the volume's end
+        of chain value if the run ends the file.
+
+Return Value:
+
+    STATUS_SUCCESS if the file cluster was translated.
+
+    STATUS_END_OF_FILE if the file cluster is beyond the end of the file.
+
+    STATUS_NOT_FOUND if the file is too fragmented for the map to describe the
+    requested cluster. The caller should fall back to walking the chain.
+
+    Other error codes on device I/O failures or a corrupt chain.
+
+--*/
+
+{
+
+    PFAT_FILE_EXTENT Extent;
+    PRED_BLACK_TREE_NODE FoundNode;
+    PFAT_FILE_EXTENT NextExtent;
+    PRED_BLACK_TREE_NODE NextNode;
+    ULONG Offset;
+    FAT_FILE_EXTENT Search;
+    KSTATUS Status;
+    ULONG Target;
+
+    if (ClusterCount == 0) {
+        ClusterCount = 1;
+    }
+
+    //
+    // Extend one past the requested range so that the cluster following the
+    // run is known too.
+    //
+
+    Target = MAX_ULONG;
+    if ((ULONGLONG)FileCluster + ClusterCount + 1 < MAX_ULONG) {
+        Target = FileCluster + ClusterCount + 1;
+    }
+
+    FatAcquireLock(Map->Lock);
+    if (Map->MappedClusters < Target) {
+        Status = FatpExtendExtentMap(Volume, Map, IoFlags, Target);
+        if (!KSUCCESS(Status)) {
+            goto ExtentMapLookupEnd;
+        }
+    }
+
+    //
+    // If the map stops short of the requested cluster, either the chain ended
+    // or the map is full.
+    //
+
+    if (FileCluster >= Map->MappedClusters) {
+        if (Map->ExtentCount >= FAT_EXTENT_MAP_MAX_EXTENTS) {
+            Status = STATUS_NOT_FOUND;
+            goto ExtentMapLookupEnd;
+        }
+
+        Extent = Map->LastExtent;
+        if (Extent == NULL) {
+            Status = STATUS_FILE_CORRUPT;
+            goto ExtentMapLookupEnd;
+        }
+
+        *DiskCluster = Extent->DiskCluster + Extent->Count - 1;
+        *RunCount = Map->MappedClusters;
+        if (NextCluster != NULL) {
+            *NextCluster = Volume->ClusterEnd;
+        }
+
+        Status = STATUS_END_OF_FILE;
+        goto ExtentMapLookupEnd;
+    }
+
+    Search.FileCluster = FileCluster;
+    FoundNode = RtlRedBlackTreeSearchClosest(&(Map->Tree),
+                                             &(Search.TreeNode),
+                                             FALSE);
+
+    ASSERT(FoundNode != NULL);
+
+    Extent = RED_BLACK_TREE_VALUE(FoundNode, FAT_FILE_EXTENT, TreeNode);
+
+    ASSERT((FileCluster >= Extent->FileCluster) &&
+           (FileCluster - Extent->FileCluster < Extent->Count));
+
+    Offset = FileCluster - Extent->FileCluster;
+    *DiskCluster = Extent->DiskCluster + Offset;
+    *RunCount = Extent->Count - Offset;
+    if (NextCluster != NULL) {
+        NextNode = RtlRedBlackTreeGetNextNode(&(Map->Tree), FALSE, FoundNode);
+        if (NextNode != NULL) {
+            NextExtent = RED_BLACK_TREE_VALUE(NextNode,
+                                              FAT_FILE_EXTENT,
+                                              TreeNode);
+
+            *NextCluster = NextExtent->DiskCluster;
+
+        //
+        // If the map filled up, the last extent may not really end the chain.
+        // Callers that need to go further walk the chain themselves.
+        //
+
+        } else {
+            *NextCluster = Volume->ClusterEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+ExtentMapLookupEnd:
+    FatReleaseLock(Map->Lock);
+    return Status;
+}
+
+VOID
+FatpExtentMapTruncate (
+    PFAT_VOLUME Volume,
+    ULONG FirstCluster,
+    ULONG ClusterCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards any cached extents beyond the given number of
+    clusters for the file starting at the given cluster. It should be called
+    whenever clusters are removed from the end of a file.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    FirstCluster - Supplies the starting cluster of the file.
+
+    ClusterCount - Supplies the number of clusters the file still owns.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFAT_EXTENT_MAP Map;
+
+    FatAcquireLock(Volume->Lock);
+    Map = FatpFindExtentMap(Volume, FirstCluster);
+    if (Map != NULL) {
+        Map->ReferenceCount += 1;
+    }
+
+    FatReleaseLock(Volume->Lock);
+    if (Map == NULL) {
+        return;
+    }
+
+    FatAcquireLock(Map->Lock);
+    FatpTrimExtentMap(Volume, Map, ClusterCount);
+    FatReleaseLock(Map->Lock);
+    FatpCloseExtentMap(Volume, Map);
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+FatpExtendExtentMap (
+    PFAT_VOLUME Volume,
+    PFAT_EXTENT_MAP Map,
+    ULONG IoFlags,
+    ULONG ClusterCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine follows the cluster chain from the end of the mapped region
+    until the map covers the given number of clusters, the chain ends, or the
+    map fills up. This routine assumes the map lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Map - Supplies a pointer to the extent map.
+
+    IoFlags - Supplies flags regarding any necessary I/O operations. See
+        IO_FLAG_* definitions.
+
+    ClusterCount - Supplies the desired number of mapped clusters.
+
+Return Value:
+
+    Status code. Reaching the end of the chain is not an error.
+
+--*/
+
+{
+
+    PFAT_FILE_EXTENT Extent;
+    PFAT_FILE_EXTENT LastExtent;
+    ULONG NextCluster;
+    KSTATUS Status;
+
+    LastExtent = Map->LastExtent;
+    while (Map->MappedClusters < ClusterCount) {
+        if (LastExtent == NULL) {
+            NextCluster = Map->FirstCluster;
+
+        } else {
+            NextCluster = LastExtent->DiskCluster + LastExtent->Count - 1;
+            Status = FatpGetNextCluster(Volume,
+                                        IoFlags,
+                                        NextCluster,
+                                        &NextCluster);
+
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+        if (NextCluster > Volume->ClusterBad) {
+            break;
+        }
+
+        if ((NextCluster < FAT_CLUSTER_BEGIN) ||
+            (NextCluster == Volume->ClusterBad)) {
+
+            return STATUS_FILE_CORRUPT;
+        }
+
+        //
+        // Grow the last extent if this cluster directly follows it.
+        //
+
+        if ((LastExtent != NULL) &&
+            (NextCluster == LastExtent->DiskCluster + LastExtent->Count)) {
+
+            LastExtent->Count += 1;
+            Map->MappedClusters += 1;
+            continue;
+        }
+
+        if (Map->ExtentCount >= FAT_EXTENT_MAP_MAX_EXTENTS) {
+            break;
+        }
+
+        Extent = FatAllocatePagedMemory(Volume->Device.DeviceToken,
+                                        sizeof(FAT_FILE_EXTENT));
+
+        if (Extent == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Extent->FileCluster = Map->MappedClusters;
+        Extent->DiskCluster = NextCluster;
+        Extent->Count = 1;
+        RtlRedBlackTreeInsert(&(Map->Tree), &(Extent->TreeNode));
+        Map->ExtentCount += 1;
+        Map->MappedClusters += 1;
+        Map->LastExtent = Extent;
+        LastExtent = Extent;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FatpTrimExtentMap (
+    PFAT_VOLUME Volume,
+    PFAT_EXTENT_MAP Map,
+    ULONG ClusterCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes extents from the end of the given map until it
+    describes at most the given number of clusters. This routine assumes the
+    map lock is held or the map is otherwise inaccessible.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Map - Supplies a pointer to the extent map.
+
+    ClusterCount - Supplies the number of clusters to keep.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFAT_FILE_EXTENT Extent;
+    PRED_BLACK_TREE_NODE Node;
+
+    while (Map->MappedClusters > ClusterCount) {
+        Extent = Map->LastExtent;
+
+        ASSERT(Extent != NULL);
+
+        if (Extent->FileCluster < ClusterCount) {
+            Extent->Count = ClusterCount - Extent->FileCluster;
+            Map->MappedClusters = ClusterCount;
+            break;
+        }
+
+        Node = RtlRedBlackTreeGetNextNode(&(Map->Tree),
+                                          TRUE,
+                                          &(Extent->TreeNode));
+
+        RtlRedBlackTreeRemove(&(Map->Tree), &(Extent->TreeNode));
+        Map->ExtentCount -= 1;
+        Map->MappedClusters = Extent->FileCluster;
+        Map->LastExtent = NULL;
+        if (Node != NULL) {
+            Map->LastExtent = RED_BLACK_TREE_VALUE(Node,
+                                                   FAT_FILE_EXTENT,
+                                                   TreeNode);
+        }
+
+        FatFreePagedMemory(Volume->Device.DeviceToken, Extent);
+    }
+
+    return;
+}
+
+PFAT_EXTENT_MAP
+FatpFindExtentMap (
+    PFAT_VOLUME Volume,
+    ULONG FirstCluster
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the extent map for the given file. This routine
+    assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    FirstCluster - Supplies the starting cluster of the file.
+
+Return Value:
+
+    Returns a pointer to the extent map on success.
+
+    NULL if the file has no extent map.
+
+--*/
+
+{
+
+    PRED_BLACK_TREE_NODE FoundNode;
+    FAT_EXTENT_MAP Search;
+
+    Search.FirstCluster = FirstCluster;
+    FoundNode = RtlRedBlackTreeSearch(&(Volume->ExtentMapTree),
+                                      &(Search.TreeNode));
+
+    if (FoundNode == NULL) {
+        return NULL;
+    }
+
+    return RED_BLACK_TREE_VALUE(FoundNode, FAT_EXTENT_MAP, TreeNode);
+}
+
+COMPARISON_RESULT
+FatpCompareExtentMapNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares extent maps by the starting clusters of their files.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PFAT_EXTENT_MAP First;
+    PFAT_EXTENT_MAP Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, FAT_EXTENT_MAP, TreeNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, FAT_EXTENT_MAP, TreeNode);
+    if (First->FirstCluster > Second->FirstCluster) {
+        return ComparisonResultDescending;
+    }
+
+    if (First->FirstCluster < Second->FirstCluster) {
+        return ComparisonResultAscending;
+    }
+
+    return ComparisonResultSame;
+}
+
+COMPARISON_RESULT
+FatpCompareExtentNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares file extents by their starting file cluster index.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PFAT_FILE_EXTENT First;
+    PFAT_FILE_EXTENT Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, FAT_FILE_EXTENT, TreeNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, FAT_FILE_EXTENT, TreeNode);
+    if (First->FileCluster > Second->FileCluster) {
+        return ComparisonResultDescending;
+    }
+
+    if (First->FileCluster < Second->FileCluster) {
+        return ComparisonResultAscending;
+    }
+
+    return ComparisonResultSame;
+}
+
@@ -89,6 +89,14 @@ FatpPerformFileIo (
     PUINTN BytesCompleted
     );
 
+KSTATUS
+FatpAppendFileBlockEntry (
+    PFAT_VOLUME Volume,
+    PFILE_BLOCK_INFORMATION BlockInformation,
+    ULONG Cluster,
+    ULONG ClusterCount
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -964,6 +972,8 @@ Return Value:
                   sizeof(BLOCK_DEVICE_PARAMETERS));
 
     FatpInitializeFileMappingTree(FatVolume);
+    FatpInitializeExtentMapTree(FatVolume);
+    INITIALIZE_LIST_HEAD(&(FatVolume->ReservationList));
     FatVolume->BlockShift =
                           RtlCountTrailingZeros32(FatVolume->Device.BlockSize);
 
@@ -1206,8 +1216,22 @@ Return Value:
     PFAT_VOLUME FatVolume;
 
     FatVolume = (PFAT_VOLUME)Volume;
+
+    //
+    // Write out the free cluster count and next free hint if they were not
+    // kept up to date as clusters were allocated and freed.
+    //
+
+    if ((FatVolume->Flags & FAT_VOLUME_FLAG_INFORMATION_DIRTY) != 0) {
+        FatAcquireLock(FatVolume->Lock);
+        FatpUpdateInformationSector(FatVolume, NULL);
+        FatReleaseLock(FatVolume->Lock);
+    }
+
+    FatpDestroyFreeMap(FatVolume);
     FatpDestroyFatCache(FatVolume);
     FatpDestroyFileMappingTree(FatVolume);
+    FatpDestroyExtentMapTree(FatVolume);
     FatDestroyLock(FatVolume->Lock);
     FatFreeNonPagedMemory(FatVolume->Device.DeviceToken, FatVolume);
     return STATUS_SUCCESS;
@@ -1390,6 +1414,23 @@ Return Value:
         FatFile->IsRootDirectory = TRUE;
     }
 
+    //
+    // Hook up the extent map for regular opens. Page files have their own
+    // handling, and the FAT12/16 root directory has no cluster chain.
+    //
+
+    if (((Flags & OPEN_FLAG_PAGE_FILE) == 0) &&
+        (FatFile->IsRootDirectory == FALSE)) {
+
+        Status = FatpOpenExtentMap(FatVolume,
+                                   FirstCluster,
+                                   &(FatFile->ExtentMap));
+
+        if (!KSUCCESS(Status)) {
+            goto OpenFileIdEnd;
+        }
+    }
+
     *FileToken = FatFile;
     Status = STATUS_SUCCESS;
 
@@ -1453,6 +1494,11 @@ Return Value:
         FatDestroyLock(FatFile->ScratchIoBufferLock);
     }
 
+    if (FatFile->ExtentMap != NULL) {
+        FatpCloseExtentMap(FatFile->Volume, FatFile->ExtentMap);
+    }
+
+    FatpReleaseClusterReservation(FatFile->Volume, &(FatFile->Reservation));
     if ((FatFile->OpenFlags & OPEN_FLAG_PAGE_FILE) != 0) {
         FatFreeNonPagedMemory(FatFile->Volume->Device.DeviceToken, FatFile);
 
@@ -2793,6 +2839,7 @@ Return Value:
     ULONGLONG FileByteOffset;
     ULONG PreviousCluster;
     ULONG PreviousTableIndex;
+    ULONG RunCount;
     KSTATUS Status;
     ULONG TableIndex;
     PFAT_VOLUME Volume;
@@ -2938,6 +2985,65 @@ Return Value:
         goto FatFileSeekEnd;
     }
 
+    ClusterAlignedDestination = ALIGN_RANGE_DOWN(DestinationOffset,
+                                                 ClusterSize);
+
+    //
+    // Translate the offset through the extent map if there is one. This only
+    // falls through to the chain walk if the file is too fragmented for the
+    // map.
+    //
+
+    if (File->ExtentMap != NULL) {
+        Status = FatpExtentMapLookup(
+                            Volume,
+                            File->ExtentMap,
+                            IoFlags,
+                            ClusterAlignedDestination >> Volume->ClusterShift,
+                            1,
+                            &CurrentCluster,
+                            &RunCount,
+                            NULL);
+
+        if (KSUCCESS(Status)) {
+            DiskByteOffset = FAT_CLUSTER_TO_BYTE(Volume, CurrentCluster);
+            FatSeekInformation->ClusterByteOffset = DestinationOffset -
+                                                    ClusterAlignedDestination;
+
+            DiskByteOffset += FatSeekInformation->ClusterByteOffset;
+            FatSeekInformation->CurrentBlock = DiskByteOffset >> BlockShift;
+            FatSeekInformation->CurrentCluster = CurrentCluster;
+            FatSeekInformation->FileByteOffset = DestinationOffset;
+            goto FatFileSeekEnd;
+        }
+
+        //
+        // On hitting the end of the file, land just past the last cluster
+        // exactly as the chain walk below would. The run count holds the
+        // number of clusters in the file.
+        //
+
+        if (Status == STATUS_END_OF_FILE) {
+            CurrentOffset = (ULONGLONG)RunCount << Volume->ClusterShift;
+            if (CurrentOffset == ClusterAlignedDestination) {
+                Status = STATUS_SUCCESS;
+            }
+
+            DiskByteOffset = FAT_CLUSTER_TO_BYTE(Volume, CurrentCluster);
+            FatSeekInformation->CurrentBlock = DiskByteOffset >> BlockShift;
+            FatSeekInformation->ClusterByteOffset = ClusterSize;
+            FatSeekInformation->CurrentCluster = CurrentCluster;
+            FatSeekInformation->FileByteOffset = CurrentOffset;
+            goto FatFileSeekEnd;
+        }
+
+        if (Status != STATUS_NOT_FOUND) {
+            goto FatFileSeekEnd;
+        }
+
+        Status = STATUS_SUCCESS;
+    }
+
     //
     // Get the nearest seek table index, and march down until a seek table
     // entry is filled in. The first one is guaranteed to be filled in.
@@ -2979,9 +3085,6 @@ Return Value:
     // Cruise the singly linked list of clusters.
     //
 
-    ClusterAlignedDestination = ALIGN_RANGE_DOWN(DestinationOffset,
-                                                 ClusterSize);
-
     PreviousCluster = CurrentCluster;
     PreviousTableIndex = TableIndex;
     CurrentWindowIndex = MAX_ULONG;
@@ -3423,6 +3526,7 @@ Return Value:
     PFAT_FILE File;
     KSTATUS FlushStatus;
     ULONG NextCluster;
+    ULONG RemainingClusters;
     ULONG StartingCluster;
     KSTATUS Status;
     ULONG TableIndex;
@@ -3441,7 +3545,14 @@ Return Value:
            (StartingCluster >= FAT_CLUSTER_BEGIN) &&
            (StartingCluster < FatVolume->ClusterCount));
 
+    RemainingClusters = 0;
     if (Truncate != FALSE) {
+        RemainingClusters = ALIGN_RANGE_UP(FileSize, FatVolume->ClusterSize) >>
+                            FatVolume->ClusterShift;
+
+        if (RemainingClusters == 0) {
+            RemainingClusters = 1;
+        }
 
         //
         // If this is not a truncate to zero, then find the last cluster that
@@ -3531,6 +3642,13 @@ Return Value:
                       (FAT_SEEK_TABLE_SIZE - TableIndex) * FAT32_CLUSTER_WIDTH);
     }
 
+    //
+    // Drop the freed clusters from the extent map before they can be handed
+    // out to another file. The map is shared, so this covers all opens.
+    //
+
+    FatpExtentMapTruncate(FatVolume, (ULONG)FileId, RemainingClusters);
+
     //
     // Free up the clusters. This flushes the FAT cache.
     //
@@ -3599,14 +3717,17 @@ Return Value:
 
     PFILE_BLOCK_ENTRY BlockEntry;
     ULONG CurrentCluster;
-    ULONGLONG DiskByteOffset;
+    PFAT_EXTENT_MAP ExtentMap;
     PFAT_VOLUME FatVolume;
+    ULONG FileCluster;
+    ULONG FileClusterCount;
     PFILE_BLOCK_INFORMATION Information;
     ULONG NextCluster;
     ULONG RunCount;
     ULONG RunStart;
     KSTATUS Status;
 
+    ExtentMap = NULL;
     FatVolume = (PFAT_VOLUME)Volume;
     NextCluster = (ULONG)FileId;
 
@@ -3625,88 +3746,134 @@ Return Value:
     INITIALIZE_LIST_HEAD(&(Information->BlockList));
 
     //
-    // Loop getting the next cluster, creating a new run every time a
-    // non-contiguous cluster is discovered.
+    // Probe past the end of the file to map the whole chain. If the extent map
+    // can describe the entire file, its extents are exactly the runs needed.
     //
 
-    RunStart = NextCluster;
-    RunCount = 1;
-    while (TRUE) {
-        CurrentCluster = NextCluster;
-        Status = FatpGetNextCluster(FatVolume, 0, CurrentCluster, &NextCluster);
-        if (!KSUCCESS(Status)) {
-            goto GetFileBlockInformationEnd;
-        }
+    Status = FatpOpenExtentMap(FatVolume, (ULONG)FileId, &ExtentMap);
+    if (!KSUCCESS(Status)) {
+        goto GetFileBlockInformationEnd;
+    }
 
-        //
-        // If the next cluster is free, reserved, or bad, the file is corrupt.
-        //
+    Status = FatpExtentMapLookup(FatVolume,
+                                 ExtentMap,
+                                 0,
+                                 MAX_ULONG - 1,
+                                 1,
+                                 &RunStart,
+                                 &FileClusterCount,
+                                 NULL);
+
+    if (Status == STATUS_END_OF_FILE) {
+        FileCluster = 0;
+        while (FileCluster < FileClusterCount) {
+            Status = FatpExtentMapLookup(FatVolume,
+                                         ExtentMap,
+                                         0,
+                                         FileCluster,
+                                         1,
+                                         &RunStart,
+                                         &RunCount,
+                                         NULL);
 
-        if ((NextCluster < FAT_CLUSTER_BEGIN) ||
-            (NextCluster == FatVolume->ClusterBad)) {
+            if (!KSUCCESS(Status)) {
+                goto GetFileBlockInformationEnd;
+            }
 
-            Status = STATUS_FILE_CORRUPT;
-            goto GetFileBlockInformationEnd;
-        }
+            Status = FatpAppendFileBlockEntry(FatVolume,
+                                              Information,
+                                              RunStart,
+                                              RunCount);
 
-        //
-        // If this is the end of the file, exit and add the last run after the
-        // loop.
-        //
+            if (!KSUCCESS(Status)) {
+                goto GetFileBlockInformationEnd;
+            }
 
-        if (NextCluster > FatVolume->ClusterBad) {
-            break;
+            FileCluster += RunCount;
         }
 
-        //
-        // If this is part of the run, then up the count and continue.
-        //
+    } else if (Status != STATUS_NOT_FOUND) {
+        goto GetFileBlockInformationEnd;
 
-        if (NextCluster == (CurrentCluster + 1)) {
-            RunCount += 1;
-            continue;
-        }
+    //
+    // Loop getting the next cluster, creating a new run every time a
+    // non-contiguous cluster is discovered.
+    //
 
-        //
-        // The run is over. Add it to the list.
-        //
+    } else {
+        RunStart = NextCluster;
+        RunCount = 1;
+        while (TRUE) {
+            CurrentCluster = NextCluster;
+            Status = FatpGetNextCluster(FatVolume,
+                                        0,
+                                        CurrentCluster,
+                                        &NextCluster);
 
-        BlockEntry = FatAllocateNonPagedMemory(FatVolume->Device.DeviceToken,
-                                               sizeof(FILE_BLOCK_ENTRY));
+            if (!KSUCCESS(Status)) {
+                goto GetFileBlockInformationEnd;
+            }
 
-        if (BlockEntry == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto GetFileBlockInformationEnd;
-        }
+            //
+            // If the next cluster is free, reserved, or bad, the file is
+            // corrupt.
+            //
 
-        DiskByteOffset = FAT_CLUSTER_TO_BYTE(FatVolume, RunStart);
-        BlockEntry->Address = DiskByteOffset >> FatVolume->BlockShift;
-        BlockEntry->Count = (RunCount * FatVolume->ClusterSize) >>
-                            FatVolume->BlockShift;
+            if ((NextCluster < FAT_CLUSTER_BEGIN) ||
+                (NextCluster == FatVolume->ClusterBad)) {
 
-        INSERT_BEFORE(&(BlockEntry->ListEntry), &(Information->BlockList));
-        RunStart = NextCluster;
-        RunCount = 1;
-    }
+                Status = STATUS_FILE_CORRUPT;
+                goto GetFileBlockInformationEnd;
+            }
 
-    //
-    // Add the last run to the list.
-    //
+            //
+            // If this is the end of the file, exit and add the last run after
+            // the loop.
+            //
 
-    BlockEntry = FatAllocateNonPagedMemory(FatVolume->Device.DeviceToken,
-                                           sizeof(FILE_BLOCK_ENTRY));
+            if (NextCluster > FatVolume->ClusterBad) {
+                break;
+            }
 
-    if (BlockEntry == NULL) {
-        Status = STATUS_INSUFFICIENT_RESOURCES;
-        goto GetFileBlockInformationEnd;
-    }
+            //
+            // If this is part of the run, then up the count and continue.
+            //
+
+            if (NextCluster == (CurrentCluster + 1)) {
+                RunCount += 1;
+                continue;
+            }
+
+            //
+            // The run is over. Add it to the list.
+            //
+
+            Status = FatpAppendFileBlockEntry(FatVolume,
+                                              Information,
+                                              RunStart,
+                                              RunCount);
+
+            if (!KSUCCESS(Status)) {
+                goto GetFileBlockInformationEnd;
+            }
+
+            RunStart = NextCluster;
+            RunCount = 1;
+        }
+
+        //
+        // Add the last run to the list.
+        //
 
-    DiskByteOffset = FAT_CLUSTER_TO_BYTE(FatVolume, RunStart);
-    BlockEntry->Address = DiskByteOffset >> FatVolume->BlockShift;
-    BlockEntry->Count = (RunCount * FatVolume->ClusterSize) >>
-                        FatVolume->BlockShift;
+        Status = FatpAppendFileBlockEntry(FatVolume,
+                                          Information,
+                                          RunStart,
+                                          RunCount);
 
-    INSERT_BEFORE(&(BlockEntry->ListEntry), &(Information->BlockList));
+        if (!KSUCCESS(Status)) {
+            goto GetFileBlockInformationEnd;
+        }
+    }
 
     //
     // Now that the disk blocks are collected, query the backing device so that
@@ -3724,6 +3891,10 @@ Return Value:
     Status = STATUS_SUCCESS;
 
 GetFileBlockInformationEnd:
+    if (ExtentMap != NULL) {
+        FatpCloseExtentMap(FatVolume, ExtentMap);
+    }
+
     if (!KSUCCESS(Status)) {
         if (Information != NULL) {
             while (LIST_EMPTY(&(Information->BlockList)) == FALSE) {
@@ -3775,8 +3946,10 @@ Return Value:
 
 {
 
+    ULONG AllocatedCount;
     ULONG Cluster;
     ULONG ClusterCount;
+    ULONG ClustersNeeded;
     ULONGLONG CurrentSize;
     BOOL Dirty;
     PFAT_VOLUME FatVolume;
@@ -3799,7 +3972,18 @@ Return Value:
         }
 
         if (NextCluster >= ClusterCount) {
-            Status = FatpAllocateCluster(Volume, Cluster, &NextCluster, FALSE);
+            ClustersNeeded = ALIGN_RANGE_UP(FileSize - CurrentSize,
+                                            FatVolume->ClusterSize) >>
+                             FatVolume->ClusterShift;
+
+            Status = FatpAllocateClusterRun(Volume,
+                                            NULL,
+                                            Cluster,
+                                            ClustersNeeded,
+                                            &NextCluster,
+                                            &AllocatedCount,
+                                            FALSE);
+
             if (!KSUCCESS(Status)) {
                 return Status;
             }
@@ -3820,6 +4004,46 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+FatBuildFreeClusterMap (
+    PVOID Volume,
+    ULONG WindowCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds part of the in-memory free cluster map for a mounted
+    volume. Once the map is complete, cluster allocations search it for
+    contiguous runs instead of scanning the File Allocation Table. Callers
+    typically invoke this repeatedly from a background context shortly after
+    mounting, until it stops returning STATUS_MORE_PROCESSING_REQUIRED.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    WindowCount - Supplies the maximum number of FAT cache windows to scan
+        during this call. The volume lock is dropped between windows.
+
+Return Value:
+
+    STATUS_SUCCESS if the free cluster map is complete.
+
+    STATUS_MORE_PROCESSING_REQUIRED if more of the map remains to be built.
+
+    STATUS_NOT_SUPPORTED if the volume is FAT12.
+
+    Other error codes on allocation or device I/O failures.
+
+--*/
+
+{
+
+    return FatpBuildFreeMap(Volume, WindowCount);
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
@@ -3883,6 +4107,7 @@ Return Value:
 
 {
 
+    ULONG AllocatedCount;
     ULONG BlockByteOffset;
     UINTN BlockCount;
     ULONG BlockShift;
@@ -3893,14 +4118,19 @@ Return Value:
     ULONG ClusterCount;
     ULONG ClusterShift;
     ULONG ClusterSize;
+    ULONG ClustersNeeded;
     ULONG CurrentCluster;
     PFAT_FILE File;
     ULONGLONG FileByteOffset;
+    ULONG FileCluster;
     KSTATUS FlushStatus;
     UINTN MaxContiguousBytes;
     ULONG NewCluster;
     BOOL NewTerritory;
     ULONG NextCluster;
+    ULONG RunCluster;
+    BOOL RunComplete;
+    ULONG RunCount;
     PFAT_IO_BUFFER ScratchIoBuffer;
     BOOL ScratchLockHeld;
     KSTATUS Status;
@@ -4027,10 +4257,16 @@ Return Value:
             ASSERT((IoFlags & IO_FLAG_NO_ALLOCATE) == 0);
             ASSERT((File->OpenFlags & OPEN_FLAG_PAGE_FILE) == 0);
 
-            Status = FatpAllocateCluster(Volume,
-                                         FatSeekInformation->CurrentCluster,
-                                         &NewCluster,
-                                         FALSE);
+            ClustersNeeded = ALIGN_RANGE_UP(SizeInBytes, ClusterSize) >>
+                             ClusterShift;
+
+            Status = FatpAllocateClusterRun(Volume,
+                                            &(File->Reservation),
+                                            FatSeekInformation->CurrentCluster,
+                                            ClustersNeeded,
+                                            &NewCluster,
+                                            &AllocatedCount,
+                                            FALSE);
 
             if (!KSUCCESS(Status)) {
                 goto PerformFileIoEnd;
@@ -4097,7 +4333,61 @@ Return Value:
 
             CurrentCluster = FatSeekInformation->CurrentCluster;
             FileByteOffset = FatSeekInformation->FileByteOffset;
-            while (MaxContiguousBytes < SizeInBytes) {
+
+            //
+            // Use the extent map to find the whole contiguous run at once. The
+            // map also knows the cluster following the run, unless the run is
+            // the last one mapped, in which case the loop below picks up from
+            // the end of the run to extend the file or find the next cluster.
+            //
+
+            RunComplete = FALSE;
+            if ((File->ExtentMap != NULL) &&
+                (MaxContiguousBytes < SizeInBytes)) {
+
+                FileCluster = (FileByteOffset -
+                               FatSeekInformation->ClusterByteOffset) >>
+                              ClusterShift;
+
+                RunCount = ALIGN_RANGE_UP(
+                         FatSeekInformation->ClusterByteOffset + SizeInBytes,
+                         ClusterSize) >> ClusterShift;
+
+                Status = FatpExtentMapLookup(Volume,
+                                             File->ExtentMap,
+                                             IoFlags,
+                                             FileCluster,
+                                             RunCount,
+                                             &RunCluster,
+                                             &RunCount,
+                                             &NextCluster);
+
+                if ((KSUCCESS(Status)) && (RunCluster == CurrentCluster)) {
+                    MaxContiguousBytes += (UINTN)(RunCount - 1) <<
+                                          ClusterShift;
+
+                    CurrentCluster += RunCount - 1;
+                    FileByteOffset += (ULONGLONG)(RunCount - 1) <<
+                                      ClusterShift;
+
+                    if (NextCluster < ClusterBad) {
+                        RunComplete = TRUE;
+                    }
+
+                } else if ((!KSUCCESS(Status)) &&
+                           (Status != STATUS_NOT_FOUND) &&
+                           (Status != STATUS_END_OF_FILE)) {
+
+                    goto PerformFileIoEnd;
+                }
+
+                Status = STATUS_SUCCESS;
+            }
+
+            while ((RunComplete == FALSE) &&
+                   (MaxContiguousBytes < SizeInBytes)) {
+
+
                 Status = FatpGetNextCluster(Volume,
                                             IoFlags,
                                             CurrentCluster,
@@ -4122,10 +4412,17 @@ Return Value:
                     ASSERT((IoFlags & IO_FLAG_NO_ALLOCATE) == 0);
                     ASSERT((File->OpenFlags & OPEN_FLAG_PAGE_FILE) == 0);
 
-                    Status = FatpAllocateCluster(Volume,
-                                                 CurrentCluster,
-                                                 &NewCluster,
-                                                 FALSE);
+                    ClustersNeeded = ALIGN_RANGE_UP(
+                                          SizeInBytes - MaxContiguousBytes,
+                                          ClusterSize) >> ClusterShift;
+
+                    Status = FatpAllocateClusterRun(Volume,
+                                                    &(File->Reservation),
+                                                    CurrentCluster,
+                                                    ClustersNeeded,
+                                                    &NewCluster,
+                                                    &AllocatedCount,
+                                                    FALSE);
 
                     if (!KSUCCESS(Status)) {
                         goto PerformFileIoEnd;
@@ -4475,3 +4772,56 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+FatpAppendFileBlockEntry (
+    PFAT_VOLUME Volume,
+    PFILE_BLOCK_INFORMATION BlockInformation,
+    ULONG Cluster,
+    ULONG ClusterCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a block entry for a run of contiguous clusters to the
+    end of the given block information list.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    BlockInformation - Supplies a pointer to the block information to append
+        to.
+
+    Cluster - Supplies the first cluster of the run.
+
+    ClusterCount - Supplies the number of clusters in the run.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PFILE_BLOCK_ENTRY BlockEntry;
+    ULONGLONG DiskByteOffset;
+
+    BlockEntry = FatAllocateNonPagedMemory(Volume->Device.DeviceToken,
+                                           sizeof(FILE_BLOCK_ENTRY));
+
+    if (BlockEntry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DiskByteOffset = FAT_CLUSTER_TO_BYTE(Volume, Cluster);
+    BlockEntry->Address = DiskByteOffset >> Volume->BlockShift;
+    BlockEntry->Count = ((ULONGLONG)ClusterCount * Volume->ClusterSize) >>
+                        Volume->BlockShift;
+
+    INSERT_BEFORE(&(BlockEntry->ListEntry), &(BlockInformation->BlockList));
+    return STATUS_SUCCESS;
+}
+
@@ -584,6 +584,17 @@ Return Value:
         ((PULONG)FatWindow)[WindowOffset] = NewValue;
     }
 
+    //
+    // Keep the free cluster map in sync if the cluster changed between free
+    // and allocated.
+    //
+
+    if ((Volume->FreeMap != NULL) &&
+        ((Original == FAT_CLUSTER_FREE) != (NewValue == FAT_CLUSTER_FREE))) {
+
+        FatpFreeMapSetCluster(Volume, Cluster, NewValue == FAT_CLUSTER_FREE);
+    }
+
     //
     // Mark the region in the window that's dirty.
     //
@@ -120,11 +120,23 @@ Module Name:
 //
 
 #define FAT_VOLUME_FLAG_COMPATIBILITY_MODE 0x00000001
+#define FAT_VOLUME_FLAG_FREE_MAP_COMPLETE 0x00000002
+#define FAT_VOLUME_FLAG_INFORMATION_DIRTY 0x00000004
+
+//
+// Define the amount of space, in bytes, that is set aside past the end of a
+// file that is being extended, so that interleaved appends to several files
+// do not fragment each other.
+//
+
+#define FAT_CLUSTER_RESERVATION_SIZE (1024 * 1024)
 
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+typedef struct _FAT_EXTENT_MAP FAT_EXTENT_MAP, *PFAT_EXTENT_MAP;
+
 /*++
 
 Structure Description:
@@ -185,6 +197,32 @@ typedef struct _FAT_CACHE {
 
 /*++
 
+Structure Description:
+
+    This structure defines a range of free clusters set aside for the growth
+    of a particular file. Reservations live only in memory; the clusters remain
+    free on disk and are only handed to another file when no other free space
+    remains.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous reservations on the
+        volume. The next pointer is NULL if the reservation is not active.
+
+    Start - Stores the first reserved cluster, inclusive.
+
+    End - Stores the last reserved cluster, exclusive.
+
+--*/
+
+typedef struct _FAT_CLUSTER_RESERVATION {
+    LIST_ENTRY ListEntry;
+    ULONG Start;
+    ULONG End;
+} FAT_CLUSTER_RESERVATION, *PFAT_CLUSTER_RESERVATION;
+
+/*++
+
 Structure Description:
 
     This structure defines global state associated with a mounted FAT volume.
@@ -261,9 +299,32 @@ Structure Description:
     FileMappingTree - Stores the tree of mappings between file IDs and
         directory entries.
 
+    ExtentMapTree - Stores the tree of extent maps for open files, keyed by
+        file ID. This is protected by the volume lock.
+
     FatCache - Stores the File Allocation Table cache. This is used for cluster
         allocation and next cluster lookup during seek, read, and write.
 
+    FreeMap - Stores an optional pointer to a bitmap with one bit per cluster,
+        set if the cluster is free. Only bits belonging to FAT windows marked
+        in the free map valid bitmap are meaningful.
+
+    FreeMapValid - Stores an optional pointer to a bitmap with one bit per FAT
+        window, set if the free map has been populated for that window.
+
+    FreeMapNextWindow - Stores the next FAT window to populate in the free map.
+
+    FreeMapValidWindows - Stores the number of FAT windows populated so far.
+
+    FreeClusterCount - Stores the number of free clusters in the populated
+        portion of the free map.
+
+    FreeClusterDelta - Stores the change in free clusters that has not yet
+        been recorded in the FS information block.
+
+    ReservationList - Stores the head of the list of active cluster
+        reservations on the volume.
+
 --*/
 
 typedef struct _FAT_VOLUME {
@@ -290,7 +351,15 @@ typedef struct _FAT_VOLUME {
     ULONG FatCount;
     PVOID Lock;
     RED_BLACK_TREE FileMappingTree;
+    RED_BLACK_TREE ExtentMapTree;
     FAT_CACHE FatCache;
+    PULONG FreeMap;
+    PULONG FreeMapValid;
+    ULONG FreeMapNextWindow;
+    ULONG FreeMapValidWindows;
+    ULONG FreeClusterCount;
+    LONG FreeClusterDelta;
+    LIST_ENTRY ReservationList;
 } FAT_VOLUME, *PFAT_VOLUME;
 
 /*++
@@ -324,6 +393,12 @@ Structure Description:
         out the maximum theoretical file size of 4GB. The first value is file
         offset 0, and is always filled in.
 
+    ExtentMap - Stores a pointer to the extent map shared by all opens of this
+        file. This is NULL for page files and the FAT12/16 root directory.
+
+    Reservation - Stores the range of free clusters set aside for appends
+        through this handle.
+
 --*/
 
 typedef struct _FAT_FILE {
@@ -333,6 +408,8 @@ typedef struct _FAT_FILE {
     PVOID ScratchIoBufferLock;
     PFAT_IO_BUFFER ScratchIoBuffer;
     ULONG SeekTable[FAT_SEEK_TABLE_SIZE];
+    PFAT_EXTENT_MAP ExtentMap;
+    FAT_CLUSTER_RESERVATION Reservation;
 } FAT_FILE, *PFAT_FILE;
 
 /*++
@@ -664,6 +741,84 @@ Return Value:
 
 --*/
 
+KSTATUS
+FatpAllocateClusterRun (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG PreviousCluster,
+    ULONG ClusterCount,
+    PULONG NewCluster,
+    PULONG AllocatedCount,
+    BOOL Flush
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates a run of contiguous free clusters, chains them
+    together, and chains the run so that the specified previous cluster points
+    to it. Fewer clusters than requested may be allocated if no single free
+    run is large enough.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    Reservation - Supplies an optional pointer to the cluster reservation of
+        the file being extended.
+
+    PreviousCluster - Supplies the cluster that should point to the newly
+        allocated run. Specify FAT32_CLUSTER_END if no previous cluster
+        should be updated.
+
+    ClusterCount - Supplies the number of clusters desired.
+
+    NewCluster - Supplies a pointer that will receive the first cluster of the
+        new run.
+
+    AllocatedCount - Supplies a pointer that will receive the number of
+        clusters allocated, which is at least one on success.
+
+    Flush - Supplies a boolean indicating if the FAT cache should be flushed.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if an invalid cluster was supplied.
+
+    STATUS_VOLUME_FULL if no free clusters exist.
+
+    Other error codes on device I/O errors.
+
+--*/
+
+KSTATUS
+FatpUpdateInformationSector (
+    PFAT_VOLUME Volume,
+    PVOID Irp
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes the free cluster count and next free cluster hint out
+    to the FS information block. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    Irp - Supplies an optional pointer to an IRP to use for disk operations.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 FatpFreeClusterChain (
     PFAT_VOLUME Volume,
@@ -1325,6 +1480,364 @@ Return Value:
 
 --*/
 
+//
+// File extent map support functions.
+//
+
+VOID
+FatpInitializeExtentMapTree (
+    PFAT_VOLUME Volume
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes the tree of file extent maps for the given
+    volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+FatpDestroyExtentMapTree (
+    PFAT_VOLUME Volume
+    );
+
+/*++
+
+Routine Description:
+
+    This routine frees any extent maps remaining on the volume. All files
+    should be closed by now, so this is only expected to find leaked maps.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+FatpOpenExtentMap (
+    PFAT_VOLUME Volume,
+    ULONG FirstCluster,
+    PFAT_EXTENT_MAP *Map
+    );
+
+/*++
+
+Routine Description:
+
+    This routine looks up or creates the extent map for the file starting at
+    the given cluster, and takes a reference on it.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    FirstCluster - Supplies the starting cluster of the file.
+
+    Map - Supplies a pointer where a pointer to the referenced extent map will
+        be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VOID
+FatpCloseExtentMap (
+    PFAT_VOLUME Volume,
+    PFAT_EXTENT_MAP Map
+    );
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on an extent map, destroying it if this
+    was the last reference.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Map - Supplies a pointer to the extent map to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+FatpExtentMapLookup (
+    PFAT_VOLUME Volume,
+    PFAT_EXTENT_MAP Map,
+    ULONG IoFlags,
+    ULONG FileCluster,
+    ULONG ClusterCount,
+    PULONG DiskCluster,
+    PULONG RunCount,
+    PULONG NextCluster
+    );
+
+/*++
+
+Routine Description:
+
+    This routine translates a cluster index within a file to a disk cluster,
+    extending the extent map from the cluster chain if necessary.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Map - Supplies a pointer to the file's extent map.
+
+    IoFlags - Supplies flags regarding any necessary I/O operations. See
+        IO_FLAG_* definitions.
+
+    FileCluster - Supplies the index of the cluster within the file to look
+        up.
+
+    ClusterCount - Supplies the number of clusters the caller is interested
+        in, starting at the given file cluster. The map is extended far enough
+        to cover this many clusters, if the file is that long.
+
+    DiskCluster - Supplies a pointer where the disk cluster corresponding to
+        the given file cluster will be returned. If the file cluster is beyond
+        the end of the file, the last cluster of the file is returned instead.
+
+    RunCount - Supplies a pointer where the number of physically contiguous
+        clusters starting at the returned disk cluster will be returned. If
+        the file cluster is beyond the end of the file, the total number of
+        clusters in the file is returned instead.
+
+    NextCluster - Supplies an optional pointer where the disk cluster
+        following the returned run will be returned. This is the volume's end
+        of chain value if the run ends the file.
+
+Return Value:
+
+    STATUS_SUCCESS if the file cluster was translated.
+
+    STATUS_END_OF_FILE if the file cluster is beyond the end of the file.
+
+    STATUS_NOT_FOUND if the file is too fragmented for the map to describe the
+    requested cluster. The caller should fall back to walking the chain.
+
+    Other error codes on device I/O failures or a corrupt chain.
+
+--*/
+
+VOID
+FatpExtentMapTruncate (
+    PFAT_VOLUME Volume,
+    ULONG FirstCluster,
+    ULONG ClusterCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine discards any cached extents beyond the given number of
+    clusters for the file starting at the given cluster. It should be called
+    whenever clusters are removed from the end of a file.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    FirstCluster - Supplies the starting cluster of the file.
+
+    ClusterCount - Supplies the number of clusters the file still owns.
+
+Return Value:
+
+    None.
+
+--*/
+
+//
+// Free cluster map support functions.
+//
+
+KSTATUS
+FatpBuildFreeMap (
+    PFAT_VOLUME Volume,
+    ULONG WindowCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine populates more of the free cluster map for the given volume,
+    allocating the map if needed. Each window is populated with the volume
+    lock held, so allocations can proceed between windows.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    WindowCount - Supplies the maximum number of FAT windows to scan.
+
+Return Value:
+
+    STATUS_SUCCESS if the free map is complete.
+
+    STATUS_MORE_PROCESSING_REQUIRED if windows remain to be scanned.
+
+    STATUS_NOT_SUPPORTED if the volume is FAT12, which always uses a linear
+    scan of the FAT.
+
+    STATUS_INSUFFICIENT_RESOURCES if the map could not be allocated.
+
+    Other error codes on device I/O failures.
+
+--*/
+
+VOID
+FatpDestroyFreeMap (
+    PFAT_VOLUME Volume
+    );
+
+/*++
+
+Routine Description:
+
+    This routine tears down the free cluster map for the given volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+FatpFreeMapSetCluster (
+    PFAT_VOLUME Volume,
+    ULONG Cluster,
+    BOOL Free
+    );
+
+/*++
+
+Routine Description:
+
+    This routine records a cluster changing between free and allocated in the
+    free cluster map. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Cluster - Supplies the cluster that changed.
+
+    Free - Supplies a boolean indicating whether the cluster is now free (TRUE)
+        or allocated (FALSE).
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+FatpFreeMapAllocate (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG PreviousCluster,
+    ULONG ClusterCount,
+    PULONG Cluster,
+    PULONG RunCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine picks a run of free clusters using the free cluster map. It
+    prefers to extend the file in place, then the smallest free run that fits
+    the request plus a reservation, then the smallest run that fits just the
+    request, and finally the largest run available. Clusters reserved by other
+    files are avoided unless nothing else is free. This routine does not
+    modify the FAT; the caller is expected to chain the returned clusters.
+    This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Reservation - Supplies an optional pointer to the reservation of the file
+        being extended. On success, this is moved to cover free space directly
+        after the returned run.
+
+    PreviousCluster - Supplies the current last cluster of the file, or a value
+        greater than or equal to the bad cluster value if the file is empty.
+
+    ClusterCount - Supplies the number of clusters desired.
+
+    Cluster - Supplies a pointer where the first cluster of the run will be
+        returned.
+
+    RunCount - Supplies a pointer where the number of clusters in the run will
+        be returned. This will be between 1 and the cluster count, inclusive.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_READY if the free map has not been completely built. The caller
+    should fall back to scanning the FAT.
+
+    STATUS_VOLUME_FULL if no free clusters exist.
+
+--*/
+
+VOID
+FatpReleaseClusterReservation (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns any clusters set aside by the given reservation to
+    the general pool.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Reservation - Supplies a pointer to the reservation to release.
+
+Return Value:
+
+    None.
+
+--*/
+
 //
 // File Allocation Table cache support functions.
 //
@@ -74,6 +74,12 @@ FatpCreateDirectoryEntriesForFile (
     PULONG EntryCount
     );
 
+KSTATUS
+FatpScanForFreeCluster (
+    PFAT_VOLUME Volume,
+    PULONG FreeCluster
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -1319,236 +1325,300 @@ Return Value:
 
 {
 
-    ULONG AllocatedCluster;
-    ULONG BlockShift;
-    ULONG ClusterCount;
-    ULONG ClusterEnd;
-    ULONG CurrentCluster;
-    PFAT32_INFORMATION_SECTOR Information;
-    ULONGLONG InformationBlock;
-    PFAT_IO_BUFFER InformationIoBuffer;
-    ULONG IoFlags;
-    ULONG SearchStart;
-    KSTATUS Status;
-    ULONG Value;
-    PVOID Window;
-    PUSHORT Window16;
-    PULONG Window32;
-    ULONG WindowOffset;
-    ULONG WindowSize;
+    ULONG AllocatedCount;
 
-    AllocatedCluster = FAT_CLUSTER_FREE;
-    BlockShift = Volume->BlockShift;
-    ClusterCount = Volume->ClusterCount;
-    InformationIoBuffer = NULL;
-    IoFlags = IO_FLAG_FS_DATA | IO_FLAG_FS_METADATA;
+    return FatpAllocateClusterRun(Volume,
+                                  NULL,
+                                  PreviousCluster,
+                                  1,
+                                  NewCluster,
+                                  &AllocatedCount,
+                                  Flush);
+}
 
-    ASSERT((PreviousCluster >= Volume->ClusterBad) ||
-           (PreviousCluster < ClusterCount));
+KSTATUS
+FatpAllocateClusterRun (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG PreviousCluster,
+    ULONG ClusterCount,
+    PULONG NewCluster,
+    PULONG AllocatedCount,
+    BOOL Flush
+    )
 
-    if ((PreviousCluster < Volume->ClusterBad) &&
-        (PreviousCluster >= ClusterCount)) {
+/*++
 
-        return STATUS_INVALID_PARAMETER;
-    }
+Routine Description:
 
-    FatAcquireLock(Volume->Lock);
-    if ((Volume->ClusterSearchStart < FAT_CLUSTER_BEGIN) ||
-        (Volume->ClusterSearchStart >= ClusterCount)) {
+    This routine allocates a run of contiguous free clusters, chains them
+    together, and chains the run so that the specified previous cluster points
+    to it. Fewer clusters than requested may be allocated if no single free
+    run is large enough.
 
-        Volume->ClusterSearchStart = FAT_CLUSTER_BEGIN;
-    }
+Arguments:
 
-    //
-    // Search for a free block. Start just after the last allocated cluster.
-    //
+    Volume - Supplies a pointer to the FAT volume.
 
-    CurrentCluster = Volume->ClusterSearchStart;
-    ClusterEnd = ClusterCount;
-    SearchStart = CurrentCluster;
-    CurrentCluster += 1;
-    WindowSize = FAT_WINDOW_INDEX_TO_CLUSTER(Volume, 1);
-    WindowOffset = MAX_ULONG;
-    while (CurrentCluster != SearchStart) {
+    Reservation - Supplies an optional pointer to the cluster reservation of
+        the file being extended.
 
-        //
-        // If this is the end of the FAT, wrap around to the beginning.
-        //
+    PreviousCluster - Supplies the cluster that should point to the newly
+        allocated run. Specify FAT32_CLUSTER_END if no previous cluster
+        should be updated.
 
-        if (CurrentCluster >= ClusterEnd) {
-            CurrentCluster = FAT_CLUSTER_BEGIN;
-            WindowOffset = MAX_ULONG;
-            ClusterEnd = SearchStart;
-        }
+    ClusterCount - Supplies the number of clusters desired.
 
-        //
-        // Read the next window if needed.
-        //
+    NewCluster - Supplies a pointer that will receive the first cluster of the
+        new run.
 
-        if (WindowOffset >= WindowSize) {
-            Status = FatpFatCacheGetFatWindow(Volume,
-                                              TRUE,
-                                              CurrentCluster,
-                                              &Window,
-                                              &WindowOffset);
+    AllocatedCount - Supplies a pointer that will receive the number of
+        clusters allocated, which is at least one on success.
 
-            if (!KSUCCESS(Status)) {
-                goto AllocateClusterEnd;
-            }
-        }
+    Flush - Supplies a boolean indicating if the FAT cache should be flushed.
 
-        //
-        // Scan the whole window.
-        //
+Return Value:
 
-        if (Volume->Format == Fat12Format) {
-            while (CurrentCluster < ClusterEnd) {
-                Value = FAT12_READ_CLUSTER(Window, CurrentCluster);
-                if (Value == FAT_CLUSTER_FREE) {
-                    break;
-                }
+    STATUS_SUCCESS on success.
 
-                CurrentCluster += 1;
-            }
+    STATUS_INVALID_PARAMETER if an invalid cluster was supplied.
 
-        } else if (Volume->Format == Fat16Format) {
-            Window16 = Window;
-            while ((WindowOffset < WindowSize) &&
-                   (CurrentCluster < ClusterEnd) &&
-                   (Window16[WindowOffset] != FAT_CLUSTER_FREE)) {
+    STATUS_VOLUME_FULL if no free clusters exist.
 
-                WindowOffset += 1;
-                CurrentCluster += 1;
-            }
+    Other error codes on device I/O errors.
 
-        } else {
-            Window32 = Window;
-            while ((WindowOffset < WindowSize) &&
-                   (CurrentCluster < ClusterEnd) &&
-                   (Window32[WindowOffset] != FAT_CLUSTER_FREE)) {
+--*/
 
-                WindowOffset += 1;
-                CurrentCluster += 1;
-            }
-        }
+{
 
-        if ((WindowOffset >= WindowSize) || (CurrentCluster >= ClusterEnd)) {
-            continue;
-        }
+    ULONG AllocatedCluster;
+    ULONG Index;
+    ULONG NextValue;
+    ULONG RunCount;
+    KSTATUS Status;
+    ULONG TotalClusters;
 
-        Status = FatpFatCacheWriteClusterEntry(Volume,
-                                               CurrentCluster,
-                                               Volume->ClusterEnd,
-                                               NULL);
+    AllocatedCluster = FAT_CLUSTER_FREE;
+    RunCount = 0;
+    TotalClusters = Volume->ClusterCount;
 
-        if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
-        }
+    ASSERT(ClusterCount != 0);
+    ASSERT((PreviousCluster >= Volume->ClusterBad) ||
+           (PreviousCluster < TotalClusters));
 
-        //
-        // Mark a cluster as allocated now that it's been written in stone.
-        //
+    if ((PreviousCluster < Volume->ClusterBad) &&
+        (PreviousCluster >= TotalClusters)) {
 
-        AllocatedCluster = CurrentCluster;
-        break;
+        return STATUS_INVALID_PARAMETER;
     }
 
-    //
-    // If nothing was found, sadly return.
-    //
+    FatAcquireLock(Volume->Lock);
+    if ((Volume->ClusterSearchStart < FAT_CLUSTER_BEGIN) ||
+        (Volume->ClusterSearchStart >= TotalClusters)) {
 
-    if (AllocatedCluster == FAT_CLUSTER_FREE) {
-        Status = STATUS_VOLUME_FULL;
-        goto AllocateClusterEnd;
+        Volume->ClusterSearchStart = FAT_CLUSTER_BEGIN;
     }
 
     //
-    // Update the FS information block saving the new free space and last block
-    // allocated.
+    // Use the free cluster map if it's ready, otherwise fall back to scanning
+    // the FAT for a single free cluster.
     //
 
-    if ((FatMaintainFreeClusterCount != FALSE) &&
-        (Volume->InformationByteOffset != 0)) {
-
-        InformationIoBuffer = FatAllocateIoBuffer(Volume->Device.DeviceToken,
-                                                  Volume->Device.BlockSize);
-
-        if (InformationIoBuffer == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto AllocateClusterEnd;
-        }
-
-        InformationBlock = Volume->InformationByteOffset >> BlockShift;
-        Status = FatReadDevice(Volume->Device.DeviceToken,
-                               InformationBlock,
-                               1,
-                               IoFlags,
-                               NULL,
-                               InformationIoBuffer);
-
-        if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
-        }
+    Status = FatpFreeMapAllocate(Volume,
+                                 Reservation,
+                                 PreviousCluster,
+                                 ClusterCount,
+                                 &AllocatedCluster,
+                                 &RunCount);
 
-        Information = FatMapIoBuffer(InformationIoBuffer);
-        if (Information == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto AllocateClusterEnd;
-        }
+    if (Status == STATUS_NOT_READY) {
+        RunCount = 1;
+        Status = FatpScanForFreeCluster(Volume, &AllocatedCluster);
+    }
 
-        Information->LastClusterAllocated = AllocatedCluster;
+    if (!KSUCCESS(Status)) {
+        AllocatedCluster = FAT_CLUSTER_FREE;
+        RunCount = 0;
+        goto AllocateClusterRunEnd;
+    }
 
-        ASSERT(Information->FreeClusters != 0);
+    //
+    // Chain the run together, terminating it at the last cluster.
+    //
 
-        if (Information->FreeClusters != 0) {
-            Information->FreeClusters -= 1;
+    for (Index = 0; Index < RunCount; Index += 1) {
+        NextValue = AllocatedCluster + Index + 1;
+        if (Index == RunCount - 1) {
+            NextValue = Volume->ClusterEnd;
         }
 
-        Status = FatWriteDevice(Volume->Device.DeviceToken,
-                                InformationBlock,
-                                1,
-                                IoFlags,
-                                NULL,
-                                InformationIoBuffer);
+        Status = FatpFatCacheWriteClusterEntry(Volume,
+                                               AllocatedCluster + Index,
+                                               NextValue,
+                                               NULL);
 
         if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
+            goto AllocateClusterRunEnd;
         }
     }
 
-    Volume->ClusterSearchStart = AllocatedCluster;
+    Volume->ClusterSearchStart = AllocatedCluster + RunCount - 1;
 
     //
     // Lookup the previous block and update it.
     //
 
-    if ((PreviousCluster != 0) && (PreviousCluster < ClusterCount)) {
+    if ((PreviousCluster != 0) && (PreviousCluster < TotalClusters)) {
         Status = FatpFatCacheWriteClusterEntry(Volume,
                                                PreviousCluster,
                                                AllocatedCluster,
                                                NULL);
 
         if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
+            goto AllocateClusterRunEnd;
+        }
+    }
+
+    //
+    // Update the FS information block saving the new free space and last block
+    // allocated, or just remember that it needs to be written eventually.
+    //
+
+    Volume->FreeClusterDelta -= RunCount;
+    if (FatMaintainFreeClusterCount != FALSE) {
+        Status = FatpUpdateInformationSector(Volume, NULL);
+        if (!KSUCCESS(Status)) {
+            goto AllocateClusterRunEnd;
         }
+
+    } else {
+        Volume->Flags |= FAT_VOLUME_FLAG_INFORMATION_DIRTY;
     }
 
     if (Flush != FALSE) {
         Status = FatpFatCacheFlush(Volume, 0);
         if (!KSUCCESS(Status)) {
-            goto AllocateClusterEnd;
+            goto AllocateClusterRunEnd;
         }
     }
 
     Status = STATUS_SUCCESS;
 
-AllocateClusterEnd:
+AllocateClusterRunEnd:
     FatReleaseLock(Volume->Lock);
+    *NewCluster = AllocatedCluster;
+    *AllocatedCount = RunCount;
+    return Status;
+}
+
+KSTATUS
+FatpUpdateInformationSector (
+    PFAT_VOLUME Volume,
+    PVOID Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes the free cluster count and next free cluster hint out
+    to the FS information block. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    Irp - Supplies an optional pointer to an IRP to use for disk operations.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG FreeClusters;
+    PFAT32_INFORMATION_SECTOR Information;
+    ULONGLONG InformationBlock;
+    PFAT_IO_BUFFER InformationIoBuffer;
+    ULONG IoFlags;
+    KSTATUS Status;
+
+    InformationIoBuffer = NULL;
+    IoFlags = IO_FLAG_FS_DATA | IO_FLAG_FS_METADATA;
+    if (Volume->InformationByteOffset == 0) {
+        Status = STATUS_SUCCESS;
+        goto UpdateInformationSectorEnd;
+    }
+
+    InformationIoBuffer = FatAllocateIoBuffer(Volume->Device.DeviceToken,
+                                              Volume->Device.BlockSize);
+
+    if (InformationIoBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto UpdateInformationSectorEnd;
+    }
+
+    InformationBlock = Volume->InformationByteOffset >> Volume->BlockShift;
+    Status = FatReadDevice(Volume->Device.DeviceToken,
+                           InformationBlock,
+                           1,
+                           IoFlags,
+                           Irp,
+                           InformationIoBuffer);
+
+    if (!KSUCCESS(Status)) {
+        goto UpdateInformationSectorEnd;
+    }
+
+    Information = FatMapIoBuffer(InformationIoBuffer);
+    if (Information == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto UpdateInformationSectorEnd;
+    }
+
+    Information->LastClusterAllocated = Volume->ClusterSearchStart;
+
+    //
+    // The free map knows the exact count. Without it, apply the changes made
+    // since the last update, unless the count on disk is unknown.
+    //
+
+    if ((Volume->Flags & FAT_VOLUME_FLAG_FREE_MAP_COMPLETE) != 0) {
+        Information->FreeClusters = Volume->FreeClusterCount;
+
+    } else if (Information->FreeClusters != MAX_ULONG) {
+        FreeClusters = Information->FreeClusters + Volume->FreeClusterDelta;
+        if ((Volume->FreeClusterDelta < 0) &&
+            (FreeClusters > Information->FreeClusters)) {
+
+            FreeClusters = 0;
+
+        } else if (FreeClusters > Volume->ClusterCount - FAT_CLUSTER_BEGIN) {
+            FreeClusters = Volume->ClusterCount - FAT_CLUSTER_BEGIN;
+        }
+
+        Information->FreeClusters = FreeClusters;
+    }
+
+    Status = FatWriteDevice(Volume->Device.DeviceToken,
+                            InformationBlock,
+                            1,
+                            IoFlags,
+                            Irp,
+                            InformationIoBuffer);
+
+UpdateInformationSectorEnd:
+    if (KSUCCESS(Status)) {
+        Volume->FreeClusterDelta = 0;
+        Volume->Flags &= ~FAT_VOLUME_FLAG_INFORMATION_DIRTY;
+    }
+
     if (InformationIoBuffer != NULL) {
         FatFreeIoBuffer(InformationIoBuffer);
     }
 
-    *NewCluster = AllocatedCluster;
     return Status;
 }
 
@@ -1584,16 +1654,10 @@ Return Value:
 
     ULONG Cluster;
     ULONG ClusterCount;
-    PFAT32_INFORMATION_SECTOR Information;
-    ULONGLONG InformationBlock;
-    PFAT_IO_BUFFER InformationIoBuffer;
-    ULONG IoFlags;
     ULONG NextCluster;
     KSTATUS Status;
     ULONG TotalClusters;
 
-    InformationIoBuffer = NULL;
-    IoFlags = IO_FLAG_FS_DATA | IO_FLAG_FS_METADATA;
     FatAcquireLock(Volume->Lock);
     TotalClusters = Volume->ClusterCount;
     if ((FirstCluster < FAT_CLUSTER_BEGIN) || (FirstCluster >= TotalClusters)) {
@@ -1655,62 +1719,20 @@ Return Value:
     }
 
     //
-    // Update the FS information block saving the new free space.
+    // Update the FS information block saving the new free space, or just
+    // remember that it needs to be written eventually.
     //
 
-    if ((FatMaintainFreeClusterCount != FALSE) &&
-        (Volume->InformationByteOffset != 0)) {
-
-        InformationIoBuffer = FatAllocateIoBuffer(Volume->Device.DeviceToken,
-                                                  Volume->Device.BlockSize);
-
-        if (InformationIoBuffer == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto FreeClusterChainEnd;
-        }
-
-        InformationBlock = Volume->InformationByteOffset >> Volume->BlockShift;
-        Status = FatReadDevice(Volume->Device.DeviceToken,
-                               InformationBlock,
-                               1,
-                               IoFlags,
-                               Irp,
-                               InformationIoBuffer);
-
-        if (!KSUCCESS(Status)) {
-            goto FreeClusterChainEnd;
-        }
-
-        Information = FatMapIoBuffer(InformationIoBuffer);
-        if (Information == NULL) {
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto FreeClusterChainEnd;
-        }
-
-        Information->LastClusterAllocated = Cluster;
+    Volume->FreeClusterDelta += ClusterCount;
+    if (FatMaintainFreeClusterCount != FALSE) {
+        Status = FatpUpdateInformationSector(Volume, Irp);
 
-        ASSERT(Information->FreeClusters + ClusterCount >
-               Information->FreeClusters);
-
-        Information->FreeClusters += ClusterCount;
-        Status = FatWriteDevice(Volume->Device.DeviceToken,
-                                InformationBlock,
-                                1,
-                                IoFlags,
-                                Irp,
-                                InformationIoBuffer);
-
-        if (!KSUCCESS(Status)) {
-            goto FreeClusterChainEnd;
-        }
+    } else {
+        Volume->Flags |= FAT_VOLUME_FLAG_INFORMATION_DIRTY;
     }
 
 FreeClusterChainEnd:
     FatReleaseLock(Volume->Lock);
-    if (InformationIoBuffer != NULL) {
-        FatFreeIoBuffer(InformationIoBuffer);
-    }
-
     return Status;
 }
 
@@ -4059,3 +4081,135 @@ Return Value:
     return Status;
 }
 
+
+KSTATUS
+FatpScanForFreeCluster (
+    PFAT_VOLUME Volume,
+    PULONG FreeCluster
+    )
+
+/*++
+
+Routine Description:
+
+    This routine scans the File Allocation Table for a free cluster, starting
+    just after the most recently allocated cluster and wrapping around. This
+    is used for FAT12 volumes and while the free cluster map is still being
+    built. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume.
+
+    FreeCluster - Supplies a pointer where the free cluster will be returned.
+        This routine does not mark the cluster as allocated.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if no free clusters exist.
+
+    Other error codes on device I/O errors.
+
+--*/
+
+{
+
+    ULONG ClusterCount;
+    ULONG ClusterEnd;
+    ULONG CurrentCluster;
+    ULONG SearchStart;
+    KSTATUS Status;
+    ULONG Value;
+    PVOID Window;
+    PUSHORT Window16;
+    PULONG Window32;
+    ULONG WindowOffset;
+    ULONG WindowSize;
+
+    ClusterCount = Volume->ClusterCount;
+
+    //
+    // Search for a free block. Start just after the last allocated cluster.
+    //
+
+    CurrentCluster = Volume->ClusterSearchStart;
+    ClusterEnd = ClusterCount;
+    SearchStart = CurrentCluster;
+    CurrentCluster += 1;
+    WindowSize = FAT_WINDOW_INDEX_TO_CLUSTER(Volume, 1);
+    WindowOffset = MAX_ULONG;
+    while (CurrentCluster != SearchStart) {
+
+        //
+        // If this is the end of the FAT, wrap around to the beginning.
+        //
+
+        if (CurrentCluster >= ClusterEnd) {
+            CurrentCluster = FAT_CLUSTER_BEGIN;
+            WindowOffset = MAX_ULONG;
+            ClusterEnd = SearchStart;
+        }
+
+        //
+        // Read the next window if needed.
+        //
+
+        if (WindowOffset >= WindowSize) {
+            Status = FatpFatCacheGetFatWindow(Volume,
+                                              TRUE,
+                                              CurrentCluster,
+                                              &Window,
+                                              &WindowOffset);
+
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+        //
+        // Scan the whole window.
+        //
+
+        if (Volume->Format == Fat12Format) {
+            while (CurrentCluster < ClusterEnd) {
+                Value = FAT12_READ_CLUSTER(Window, CurrentCluster);
+                if (Value == FAT_CLUSTER_FREE) {
+                    break;
+                }
+
+                CurrentCluster += 1;
+            }
+
+        } else if (Volume->Format == Fat16Format) {
+            Window16 = Window;
+            while ((WindowOffset < WindowSize) &&
+                   (CurrentCluster < ClusterEnd) &&
+                   (Window16[WindowOffset] != FAT_CLUSTER_FREE)) {
+
+                WindowOffset += 1;
+                CurrentCluster += 1;
+            }
+
+        } else {
+            Window32 = Window;
+            while ((WindowOffset < WindowSize) &&
+                   (CurrentCluster < ClusterEnd) &&
+                   (Window32[WindowOffset] != FAT_CLUSTER_FREE)) {
+
+                WindowOffset += 1;
+                CurrentCluster += 1;
+            }
+        }
+
+        if ((WindowOffset >= WindowSize) || (CurrentCluster >= ClusterEnd)) {
+            continue;
+        }
+
+        *FreeCluster = CurrentCluster;
+        return STATUS_SUCCESS;
+    }
+
+    return STATUS_VOLUME_FULL;
+}
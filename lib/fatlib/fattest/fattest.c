@@ -50,10 +50,44 @@ Module Name:
 #define BLOCK_ITERATIONS 10000
 #define BLOCK_SIZE 4096
 
+//
+// Define the parameters of the random read benchmark. The benchmark file is
+// written in chunks, with a cluster of a second file allocated between each
+// chunk so that the big file is fragmented.
+//
+
+#define BENCHMARK_IMAGE "testfatbig.test"
+#define BENCHMARK_FILE_NAME "bigfile.bin"
+#define BENCHMARK_SPACER_NAME "spacer.bin"
+#define BENCHMARK_FILE_SIZE (1024ULL * 1024 * 1024)
+#define BENCHMARK_CHUNK_SIZE (1024 * 1024)
+#define BENCHMARK_DISK_SIZE (BENCHMARK_FILE_SIZE + (64 * 1024 * 1024))
+#define BENCHMARK_READS 100000
+
+//
+// Define the parameters of the append benchmark. The volume is filled by two
+// interleaved files, one of which is then truncated, leaving a nearly full
+// volume riddled with single cluster holes. Several files are then appended
+// to in round-robin fashion, first with the FAT scanning allocator and then
+// with the free cluster map.
+//
+
+#define APPEND_IMAGE "testfatappend.test"
+#define APPEND_DISK_SIZE (512ULL * 1024 * 1024)
+#define APPEND_FREE_SIZE (96ULL * 1024 * 1024)
+#define APPEND_FILL_NAME "fill.bin"
+#define APPEND_HOLES_NAME "holes.bin"
+#define APPEND_FILE_COUNT 4
+#define APPEND_FILE_SIZE (16 * 1024 * 1024)
+#define APPEND_CHUNK_SIZE (64 * 1024)
+#define APPEND_MAP_BATCH 16
+
 #define USAGE_STRING    \
     "Testfat.exe will test the FAT file system implementation.\n\n" \
-    "Usage: Testfat.exe [-v]\n\n" \
-    "    -v  Verbose mode\n\n" \
+    "Usage: Testfat.exe [-v] [-b] [-a]\n\n" \
+    "    -v  Verbose mode\n" \
+    "    -b  Benchmark random reads in a fragmented 1GB file\n" \
+    "    -a  Benchmark appends on a nearly full, fragmented volume\n\n" \
 
 #define SECTOR_SIZE            512
 
@@ -97,6 +131,33 @@ FormatDisk (
     PVOID *VolumeToken
     );
 
+BOOL
+RunReadBenchmark (
+    VOID
+    );
+
+BOOL
+RunAppendBenchmark (
+    VOID
+    );
+
+BOOL
+RunAppendRound (
+    PVOID VolumeToken,
+    PFILE_PROPERTIES DirectoryProperties,
+    ULONG Round,
+    PFAT_IO_BUFFER ChunkIoBuffer
+    );
+
+KSTATUS
+CreateTestFile (
+    PVOID VolumeToken,
+    PFILE_PROPERTIES DirectoryProperties,
+    PSTR Name,
+    PFILE_ID FileId,
+    PVOID *FileToken
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -107,6 +168,8 @@ FormatDisk (
 
 BOOL FatTestVerbose = FALSE;
 BOOL FatTestDebug = FALSE;
+BOOL FatTestBenchmark = FALSE;
+BOOL FatTestAppendBenchmark = FALSE;
 
 //
 // Store the size of one block on the device.
@@ -196,6 +259,12 @@ Return Value:
             FatTestVerbose = TRUE;
             FatTestDebug = TRUE;
 
+        } else if (strcmp(Argument, "b") == 0) {
+            FatTestBenchmark = TRUE;
+
+        } else if (strcmp(Argument, "a") == 0) {
+            FatTestAppendBenchmark = TRUE;
+
         } else {
             printf("%s: Invalid option\n\n%s", Argument, USAGE_STRING);
             return 1;
@@ -205,6 +274,16 @@ Return Value:
         Arguments += 1;
     }
 
+    if (FatTestBenchmark != FALSE) {
+        Result = RunReadBenchmark();
+        goto MainEnd;
+    }
+
+    if (FatTestAppendBenchmark != FALSE) {
+        Result = RunAppendBenchmark();
+        goto MainEnd;
+    }
+
     //
     // Start by opening the output file.
     //
@@ -571,6 +650,816 @@ Return Value:
     return Status;
 }
 
+BOOL
+RunReadBenchmark (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a large, fragmented file and times random reads from
+    it. Each block of the file is stamped with its block number, and every
+    read is checked against that stamp.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE on failure.
+
+--*/
+
+{
+
+    PULONG BlockBuffer;
+    ULONGLONG BlockCount;
+    ULONGLONG BlockIndex;
+    PFAT_IO_BUFFER BlockIoBuffer;
+    UINTN BytesCompleted;
+    PULONG ChunkBuffer;
+    ULONGLONG ChunkIndex;
+    PFAT_IO_BUFFER ChunkIoBuffer;
+    FILE_PROPERTIES DirectoryProperties;
+    clock_t End;
+    FILE_ID FileId;
+    PVOID FileToken;
+    ULONG FillIndex;
+    FILE *ImageFile;
+    ULONG Iteration;
+    BOOL Result;
+    double Seconds;
+    FAT_SEEK_INFORMATION SeekInformation;
+    FAT_SEEK_INFORMATION SpacerSeekInformation;
+    FILE_ID SpacerId;
+    PVOID SpacerToken;
+    clock_t Start;
+    KSTATUS Status;
+    PVOID VolumeToken;
+
+    BlockIoBuffer = NULL;
+    ChunkIoBuffer = NULL;
+    FileToken = NULL;
+    Result = FALSE;
+    SpacerToken = NULL;
+    ImageFile = fopen(BENCHMARK_IMAGE, "wb+");
+    if (ImageFile == NULL) {
+        printf("Unable to open benchmark image \"%s\".\n", BENCHMARK_IMAGE);
+        return FALSE;
+    }
+
+    VPRINT("Formatting benchmark disk of size %lld.\n",
+           (ULONGLONG)BENCHMARK_DISK_SIZE);
+
+    Status = FormatDisk(ImageFile,
+                        SECTOR_SIZE,
+                        BENCHMARK_DISK_SIZE / SECTOR_SIZE,
+                        &VolumeToken);
+
+    if (!KSUCCESS(Status)) {
+        goto RunReadBenchmarkEnd;
+    }
+
+    RtlZeroMemory(&DirectoryProperties, sizeof(FILE_PROPERTIES));
+    Status = FatLookup(VolumeToken, TRUE, 0, NULL, 0, &DirectoryProperties);
+    if (!KSUCCESS(Status)) {
+        printf("Error: Could not look up root directory. Status = %d.\n",
+               Status);
+
+        goto RunReadBenchmarkEnd;
+    }
+
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            BENCHMARK_FILE_NAME,
+                            &FileId,
+                            &FileToken);
+
+    if (!KSUCCESS(Status)) {
+        goto RunReadBenchmarkEnd;
+    }
+
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            BENCHMARK_SPACER_NAME,
+                            &SpacerId,
+                            &SpacerToken);
+
+    if (!KSUCCESS(Status)) {
+        goto RunReadBenchmarkEnd;
+    }
+
+    ChunkIoBuffer = FatAllocateIoBuffer(NULL, BENCHMARK_CHUNK_SIZE);
+    BlockIoBuffer = FatAllocateIoBuffer(NULL, BLOCK_SIZE);
+    if ((ChunkIoBuffer == NULL) || (BlockIoBuffer == NULL)) {
+        printf("Error: Unable to allocate benchmark buffers.\n");
+        goto RunReadBenchmarkEnd;
+    }
+
+    ChunkBuffer = FatMapIoBuffer(ChunkIoBuffer);
+    BlockBuffer = FatMapIoBuffer(BlockIoBuffer);
+
+    //
+    // Write the file a chunk at a time, adding a block to the spacer file
+    // after each chunk so that the big file's clusters are not contiguous.
+    //
+
+    VPRINT("Writing %lld byte file (. = 64MB)\n",
+           (ULONGLONG)BENCHMARK_FILE_SIZE);
+
+    RtlZeroMemory(&SeekInformation, sizeof(FAT_SEEK_INFORMATION));
+    RtlZeroMemory(&SpacerSeekInformation, sizeof(FAT_SEEK_INFORMATION));
+    BlockIndex = 0;
+    for (ChunkIndex = 0;
+         ChunkIndex < (BENCHMARK_FILE_SIZE / BENCHMARK_CHUNK_SIZE);
+         ChunkIndex += 1) {
+
+        if ((ChunkIndex != 0) && ((ChunkIndex % 64) == 0)) {
+            VPRINT(".");
+        }
+
+        for (FillIndex = 0;
+             FillIndex < (BENCHMARK_CHUNK_SIZE / sizeof(ULONG));
+             FillIndex += 1) {
+
+            if ((FillIndex % (BLOCK_SIZE / sizeof(ULONG))) == 0) {
+                BlockIndex += 1;
+            }
+
+            ChunkBuffer[FillIndex] = (ULONG)(BlockIndex - 1);
+        }
+
+        FatIoBufferSetOffset(ChunkIoBuffer, 0);
+        Status = FatWriteFile(FileToken,
+                              &SeekInformation,
+                              ChunkIoBuffer,
+                              BENCHMARK_CHUNK_SIZE,
+                              0,
+                              NULL,
+                              &BytesCompleted);
+
+        if ((!KSUCCESS(Status)) || (BytesCompleted != BENCHMARK_CHUNK_SIZE)) {
+            printf("Error: Failed to write chunk %lld. Status = %d.\n",
+                   ChunkIndex,
+                   Status);
+
+            goto RunReadBenchmarkEnd;
+        }
+
+        FatIoBufferSetOffset(BlockIoBuffer, 0);
+        Status = FatWriteFile(SpacerToken,
+                              &SpacerSeekInformation,
+                              BlockIoBuffer,
+                              BLOCK_SIZE,
+                              0,
+                              NULL,
+                              &BytesCompleted);
+
+        if ((!KSUCCESS(Status)) || (BytesCompleted != BLOCK_SIZE)) {
+            printf("Error: Failed to write spacer %lld. Status = %d.\n",
+                   ChunkIndex,
+                   Status);
+
+            goto RunReadBenchmarkEnd;
+        }
+    }
+
+    VPRINT("\nDoing %d random reads\n", BENCHMARK_READS);
+    BlockCount = BENCHMARK_FILE_SIZE / BLOCK_SIZE;
+    Start = clock();
+    for (Iteration = 0; Iteration < BENCHMARK_READS; Iteration += 1) {
+        BlockIndex = (((ULONGLONG)rand() << 15) ^ rand()) % BlockCount;
+        Status = FatFileSeek(FileToken,
+                             NULL,
+                             0,
+                             SeekCommandFromBeginning,
+                             BlockIndex * BLOCK_SIZE,
+                             &SeekInformation);
+
+        if (!KSUCCESS(Status)) {
+            printf("Error: Could not seek to offset 0x%llx.\n",
+                   BlockIndex * BLOCK_SIZE);
+
+            goto RunReadBenchmarkEnd;
+        }
+
+        FatIoBufferSetOffset(BlockIoBuffer, 0);
+        Status = FatReadFile(FileToken,
+                             &SeekInformation,
+                             BlockIoBuffer,
+                             BLOCK_SIZE,
+                             0,
+                             NULL,
+                             &BytesCompleted);
+
+        if ((!KSUCCESS(Status)) || (BytesCompleted != BLOCK_SIZE)) {
+            printf("Error: Read of block 0x%llx got %lu bytes, status %d.\n",
+                   BlockIndex,
+                   BytesCompleted,
+                   Status);
+
+            goto RunReadBenchmarkEnd;
+        }
+
+        if ((BlockBuffer[0] != (ULONG)BlockIndex) ||
+            (BlockBuffer[(BLOCK_SIZE / sizeof(ULONG)) - 1] !=
+             (ULONG)BlockIndex)) {
+
+            printf("Error: Block 0x%llx contained 0x%x.\n",
+                   BlockIndex,
+                   BlockBuffer[0]);
+
+            goto RunReadBenchmarkEnd;
+        }
+    }
+
+    End = clock();
+    Seconds = (double)(End - Start) / CLOCKS_PER_SEC;
+    printf("%d random %d byte reads in %.3f seconds",
+           BENCHMARK_READS,
+           BLOCK_SIZE,
+           Seconds);
+
+    if (Seconds != 0) {
+        printf(" (%.0f reads/second)", BENCHMARK_READS / Seconds);
+    }
+
+    printf(".\n");
+
+    //
+    // Truncate the file in half and make sure seeks beyond the new end fail,
+    // as cached cluster runs must not outlive the clusters they describe.
+    //
+
+    Status = FatDeleteFileBlocks(VolumeToken,
+                                 FileToken,
+                                 FileId,
+                                 BENCHMARK_FILE_SIZE / 2,
+                                 TRUE);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Failed to truncate benchmark file. Status = %d.\n",
+               Status);
+
+        goto RunReadBenchmarkEnd;
+    }
+
+    Status = FatFileSeek(FileToken,
+                         NULL,
+                         0,
+                         SeekCommandFromBeginning,
+                         (BENCHMARK_FILE_SIZE / 4) * 3,
+                         &SeekInformation);
+
+    if (Status != STATUS_END_OF_FILE) {
+        printf("Error: Seek beyond truncated end returned %d.\n", Status);
+        goto RunReadBenchmarkEnd;
+    }
+
+    Result = TRUE;
+
+RunReadBenchmarkEnd:
+    if (FileToken != NULL) {
+        FatCloseFile(FileToken);
+    }
+
+    if (SpacerToken != NULL) {
+        FatCloseFile(SpacerToken);
+    }
+
+    if (ChunkIoBuffer != NULL) {
+        FatFreeIoBuffer(ChunkIoBuffer);
+    }
+
+    if (BlockIoBuffer != NULL) {
+        FatFreeIoBuffer(BlockIoBuffer);
+    }
+
+    fclose(ImageFile);
+    remove(BENCHMARK_IMAGE);
+    return Result;
+}
+
+BOOL
+RunAppendBenchmark (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills a volume with interleaved files, frees every other
+    cluster, and then times appends to several files at once, both with the
+    FAT scanning allocator and with the free cluster map.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE on failure.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    PFAT_IO_BUFFER ChunkIoBuffer;
+    ULONG ClusterSize;
+    FILE_PROPERTIES DirectoryProperties;
+    clock_t End;
+    FAT_SEEK_INFORMATION FillSeekInformation;
+    FILE_ID FillId;
+    PVOID FillToken;
+    FAT_SEEK_INFORMATION HolesSeekInformation;
+    FILE_ID HolesId;
+    PVOID HolesToken;
+    FILE *ImageFile;
+    ULONGLONG Pair;
+    ULONGLONG PairCount;
+    BOOL Result;
+    clock_t Start;
+    KSTATUS Status;
+    PVOID VolumeToken;
+
+    ChunkIoBuffer = NULL;
+    FillToken = NULL;
+    HolesToken = NULL;
+    Result = FALSE;
+    ImageFile = fopen(APPEND_IMAGE, "wb+");
+    if (ImageFile == NULL) {
+        printf("Unable to open benchmark image \"%s\".\n", APPEND_IMAGE);
+        return FALSE;
+    }
+
+    //
+    // Write out the whole image first so that the host allocating blocks for
+    // a sparse file does not skew the timings of whichever round touches
+    // new territory.
+    //
+
+    ChunkIoBuffer = FatAllocateIoBuffer(NULL, APPEND_CHUNK_SIZE);
+    if (ChunkIoBuffer == NULL) {
+        printf("Error: Unable to allocate benchmark buffer.\n");
+        goto RunAppendBenchmarkEnd;
+    }
+
+    RtlZeroMemory(FatMapIoBuffer(ChunkIoBuffer), APPEND_CHUNK_SIZE);
+    for (Pair = 0; Pair < APPEND_DISK_SIZE / APPEND_CHUNK_SIZE; Pair += 1) {
+        fwrite(FatMapIoBuffer(ChunkIoBuffer), 1, APPEND_CHUNK_SIZE, ImageFile);
+    }
+
+    VPRINT("Formatting benchmark disk of size %lld.\n",
+           (ULONGLONG)APPEND_DISK_SIZE);
+
+    Status = FormatDisk(ImageFile,
+                        SECTOR_SIZE,
+                        APPEND_DISK_SIZE / SECTOR_SIZE,
+                        &VolumeToken);
+
+    if (!KSUCCESS(Status)) {
+        goto RunAppendBenchmarkEnd;
+    }
+
+    RtlZeroMemory(&DirectoryProperties, sizeof(FILE_PROPERTIES));
+    Status = FatLookup(VolumeToken, TRUE, 0, NULL, 0, &DirectoryProperties);
+    if (!KSUCCESS(Status)) {
+        printf("Error: Could not look up root directory. Status = %d.\n",
+               Status);
+
+        goto RunAppendBenchmarkEnd;
+    }
+
+    ClusterSize = DirectoryProperties.BlockSize;
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            APPEND_FILL_NAME,
+                            &FillId,
+                            &FillToken);
+
+    if (!KSUCCESS(Status)) {
+        goto RunAppendBenchmarkEnd;
+    }
+
+    Status = CreateTestFile(VolumeToken,
+                            &DirectoryProperties,
+                            APPEND_HOLES_NAME,
+                            &HolesId,
+                            &HolesToken);
+
+    if (!KSUCCESS(Status)) {
+        goto RunAppendBenchmarkEnd;
+    }
+
+    //
+    // Fill most of the volume a cluster at a time, alternating between two
+    // files, then truncate one of them to leave a hole at every other
+    // cluster.
+    //
+
+    PairCount = (APPEND_DISK_SIZE - APPEND_FREE_SIZE) / (ClusterSize * 2);
+    VPRINT("Filling volume with %lld cluster pairs.\n", PairCount);
+    RtlZeroMemory(&FillSeekInformation, sizeof(FAT_SEEK_INFORMATION));
+    RtlZeroMemory(&HolesSeekInformation, sizeof(FAT_SEEK_INFORMATION));
+    for (Pair = 0; Pair < PairCount; Pair += 1) {
+        FatIoBufferSetOffset(ChunkIoBuffer, 0);
+        Status = FatWriteFile(FillToken,
+                              &FillSeekInformation,
+                              ChunkIoBuffer,
+                              ClusterSize,
+                              0,
+                              NULL,
+                              &BytesCompleted);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        FatIoBufferSetOffset(ChunkIoBuffer, 0);
+        Status = FatWriteFile(HolesToken,
+                              &HolesSeekInformation,
+                              ChunkIoBuffer,
+                              ClusterSize,
+                              0,
+                              NULL,
+                              &BytesCompleted);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+    }
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Failed to fill volume at pair %lld. Status = %d.\n",
+               Pair,
+               Status);
+
+        goto RunAppendBenchmarkEnd;
+    }
+
+    Status = FatDeleteFileBlocks(VolumeToken, HolesToken, HolesId, 0, TRUE);
+    if (!KSUCCESS(Status)) {
+        printf("Error: Failed to truncate holes file. Status = %d.\n",
+               Status);
+
+        goto RunAppendBenchmarkEnd;
+    }
+
+    if (RunAppendRound(VolumeToken,
+                       &DirectoryProperties,
+                       0,
+                       ChunkIoBuffer) == FALSE) {
+
+        goto RunAppendBenchmarkEnd;
+    }
+
+    //
+    // Build the free cluster map the way the driver does it in the
+    // background, a batch of windows at a time.
+    //
+
+    Start = clock();
+    do {
+        Status = FatBuildFreeClusterMap(VolumeToken, APPEND_MAP_BATCH);
+
+    } while (Status == STATUS_MORE_PROCESSING_REQUIRED);
+
+    End = clock();
+    if (!KSUCCESS(Status)) {
+        printf("Error: Failed to build free cluster map. Status = %d.\n",
+               Status);
+
+        goto RunAppendBenchmarkEnd;
+    }
+
+    printf("Built free cluster map in %.3f seconds.\n",
+           (double)(End - Start) / CLOCKS_PER_SEC);
+
+    if (RunAppendRound(VolumeToken,
+                       &DirectoryProperties,
+                       1,
+                       ChunkIoBuffer) == FALSE) {
+
+        goto RunAppendBenchmarkEnd;
+    }
+
+    Result = TRUE;
+
+RunAppendBenchmarkEnd:
+    if (FillToken != NULL) {
+        FatCloseFile(FillToken);
+    }
+
+    if (HolesToken != NULL) {
+        FatCloseFile(HolesToken);
+    }
+
+    if (ChunkIoBuffer != NULL) {
+        FatFreeIoBuffer(ChunkIoBuffer);
+    }
+
+    fclose(ImageFile);
+    remove(APPEND_IMAGE);
+    return Result;
+}
+
+BOOL
+RunAppendRound (
+    PVOID VolumeToken,
+    PFILE_PROPERTIES DirectoryProperties,
+    ULONG Round,
+    PFAT_IO_BUFFER ChunkIoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates several files and appends to them in round-robin
+    fashion, then verifies their contents, reports the throughput and
+    fragmentation, and truncates them again.
+
+Arguments:
+
+    VolumeToken - Supplies the token identifying the volume.
+
+    DirectoryProperties - Supplies a pointer to the properties of the
+        directory to create the files in.
+
+    Round - Supplies the round number, used to name the files.
+
+    ChunkIoBuffer - Supplies a pointer to an I/O buffer of the chunk size.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE on failure.
+
+--*/
+
+{
+
+    PFILE_BLOCK_ENTRY BlockEntry;
+    PFILE_BLOCK_INFORMATION BlockInformation;
+    UINTN BytesCompleted;
+    ULONG Chunk;
+    PULONG ChunkBuffer;
+    ULONG ChunkCount;
+    PLIST_ENTRY CurrentEntry;
+    clock_t End;
+    ULONG ExtentCount;
+    FILE_ID FileIds[APPEND_FILE_COUNT];
+    ULONG FileIndex;
+    PVOID FileTokens[APPEND_FILE_COUNT];
+    ULONG FillIndex;
+    CHAR Name[32];
+    double ReadSeconds;
+    BOOL Result;
+    double Seconds;
+    FAT_SEEK_INFORMATION SeekInformation[APPEND_FILE_COUNT];
+    clock_t Start;
+    KSTATUS Status;
+    ULONG Value;
+
+    ChunkBuffer = FatMapIoBuffer(ChunkIoBuffer);
+    ChunkCount = APPEND_FILE_SIZE / APPEND_CHUNK_SIZE;
+    ExtentCount = 0;
+    Result = FALSE;
+    RtlZeroMemory(FileTokens, sizeof(FileTokens));
+    RtlZeroMemory(SeekInformation, sizeof(SeekInformation));
+    for (FileIndex = 0; FileIndex < APPEND_FILE_COUNT; FileIndex += 1) {
+        snprintf(Name, sizeof(Name), "append%d_%d.bin", Round, FileIndex);
+        Status = CreateTestFile(VolumeToken,
+                                DirectoryProperties,
+                                Name,
+                                &(FileIds[FileIndex]),
+                                &(FileTokens[FileIndex]));
+
+        if (!KSUCCESS(Status)) {
+            goto RunAppendRoundEnd;
+        }
+    }
+
+    //
+    // Append to each file in turn, stamping every chunk with its file and
+    // chunk number.
+    //
+
+    Start = clock();
+    for (Chunk = 0; Chunk < ChunkCount; Chunk += 1) {
+        for (FileIndex = 0; FileIndex < APPEND_FILE_COUNT; FileIndex += 1) {
+            Value = (FileIndex << 24) | Chunk;
+            for (FillIndex = 0;
+                 FillIndex < (APPEND_CHUNK_SIZE / sizeof(ULONG));
+                 FillIndex += 1) {
+
+                ChunkBuffer[FillIndex] = Value;
+            }
+
+            FatIoBufferSetOffset(ChunkIoBuffer, 0);
+            Status = FatWriteFile(FileTokens[FileIndex],
+                                  &(SeekInformation[FileIndex]),
+                                  ChunkIoBuffer,
+                                  APPEND_CHUNK_SIZE,
+                                  0,
+                                  NULL,
+                                  &BytesCompleted);
+
+            if ((!KSUCCESS(Status)) ||
+                (BytesCompleted != APPEND_CHUNK_SIZE)) {
+
+                printf("Error: Append %d to file %d failed. Status = %d.\n",
+                       Chunk,
+                       FileIndex,
+                       Status);
+
+                goto RunAppendRoundEnd;
+            }
+        }
+    }
+
+    End = clock();
+    Seconds = (double)(End - Start) / CLOCKS_PER_SEC;
+
+    //
+    // Read everything back, and count the extents in each file.
+    //
+
+    Start = clock();
+    for (FileIndex = 0; FileIndex < APPEND_FILE_COUNT; FileIndex += 1) {
+        RtlZeroMemory(&(SeekInformation[FileIndex]),
+                      sizeof(FAT_SEEK_INFORMATION));
+
+        for (Chunk = 0; Chunk < ChunkCount; Chunk += 1) {
+            FatIoBufferSetOffset(ChunkIoBuffer, 0);
+            Status = FatReadFile(FileTokens[FileIndex],
+                                 &(SeekInformation[FileIndex]),
+                                 ChunkIoBuffer,
+                                 APPEND_CHUNK_SIZE,
+                                 0,
+                                 NULL,
+                                 &BytesCompleted);
+
+            Value = (FileIndex << 24) | Chunk;
+            if ((!KSUCCESS(Status)) ||
+                (BytesCompleted != APPEND_CHUNK_SIZE) ||
+                (ChunkBuffer[0] != Value) ||
+                (ChunkBuffer[(APPEND_CHUNK_SIZE / sizeof(ULONG)) - 1] !=
+                 Value)) {
+
+                printf("Error: File %d chunk %d read back 0x%x, status %d.\n",
+                       FileIndex,
+                       Chunk,
+                       ChunkBuffer[0],
+                       Status);
+
+                goto RunAppendRoundEnd;
+            }
+        }
+    }
+
+    End = clock();
+    ReadSeconds = (double)(End - Start) / CLOCKS_PER_SEC;
+    for (FileIndex = 0; FileIndex < APPEND_FILE_COUNT; FileIndex += 1) {
+        Status = FatGetFileBlockInformation(VolumeToken,
+                                            FileIds[FileIndex],
+                                            &BlockInformation);
+
+        if (!KSUCCESS(Status)) {
+            printf("Error: Failed to get block information. Status = %d.\n",
+                   Status);
+
+            goto RunAppendRoundEnd;
+        }
+
+        while (LIST_EMPTY(&(BlockInformation->BlockList)) == FALSE) {
+            CurrentEntry = BlockInformation->BlockList.Next;
+            BlockEntry = LIST_VALUE(CurrentEntry, FILE_BLOCK_ENTRY, ListEntry);
+            LIST_REMOVE(CurrentEntry);
+            FatFreeNonPagedMemory(NULL, BlockEntry);
+            ExtentCount += 1;
+        }
+
+        FatFreeNonPagedMemory(NULL, BlockInformation);
+    }
+
+    printf("%s: %d MB appended to %d files in %.3f seconds, read back in "
+           "%.3f seconds, %.1f extents per file.\n",
+           (Round == 0) ? "FAT scan" : "Free map",
+           (APPEND_FILE_SIZE * APPEND_FILE_COUNT) / (1024 * 1024),
+           APPEND_FILE_COUNT,
+           Seconds,
+           ReadSeconds,
+           (double)ExtentCount / APPEND_FILE_COUNT);
+
+    Result = TRUE;
+
+RunAppendRoundEnd:
+    for (FileIndex = 0; FileIndex < APPEND_FILE_COUNT; FileIndex += 1) {
+        if (FileTokens[FileIndex] != NULL) {
+            FatDeleteFileBlocks(VolumeToken,
+                                FileTokens[FileIndex],
+                                FileIds[FileIndex],
+                                0,
+                                TRUE);
+
+            FatCloseFile(FileTokens[FileIndex]);
+        }
+    }
+
+    return Result;
+}
+
+KSTATUS
+CreateTestFile (
+    PVOID VolumeToken,
+    PFILE_PROPERTIES DirectoryProperties,
+    PSTR Name,
+    PFILE_ID FileId,
+    PVOID *FileToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates and opens a new file in the given directory.
+
+Arguments:
+
+    VolumeToken - Supplies the token identifying the volume.
+
+    DirectoryProperties - Supplies a pointer to the properties of the
+        directory to create the file in. The directory size is updated if it
+        grows.
+
+    Name - Supplies a pointer to the name of the file to create.
+
+    FileId - Supplies a pointer where the ID of the new file will be returned.
+
+    FileToken - Supplies a pointer where the open file token will be returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG DirectorySize;
+    ULONGLONG NewDirectorySize;
+    FILE_PROPERTIES Properties;
+    KSTATUS Status;
+
+    RtlZeroMemory(&Properties, sizeof(FILE_PROPERTIES));
+    Properties.Type = IoObjectRegularFile;
+    Properties.Permissions = FILE_PERMISSION_USER_READ |
+                             FILE_PERMISSION_USER_WRITE;
+
+    Properties.HardLinkCount = 1;
+    Status = FatCreate(VolumeToken,
+                       DirectoryProperties->FileId,
+                       Name,
+                       strlen(Name) + 1,
+                       &NewDirectorySize,
+                       &Properties);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Unable to create file %s. Status %d.\n", Name, Status);
+        return Status;
+    }
+
+    *FileId = Properties.FileId;
+    READ_INT64_SYNC(&(DirectoryProperties->FileSize), &DirectorySize);
+    if (NewDirectorySize > DirectorySize) {
+        WRITE_INT64_SYNC(&(DirectoryProperties->FileSize), NewDirectorySize);
+        FatWriteFileProperties(VolumeToken, DirectoryProperties, 0);
+    }
+
+    Status = FatOpenFileId(VolumeToken,
+                           Properties.FileId,
+                           IO_ACCESS_READ | IO_ACCESS_WRITE,
+                           OPEN_FLAG_CREATE,
+                           FileToken);
+
+    if (!KSUCCESS(Status)) {
+        printf("Error: Unable to open %s. Status %d.\n", Name, Status);
+    }
+
+    return Status;
+}
+
 VOID
 KdPrintWithArgumentList (
     PSTR Format,
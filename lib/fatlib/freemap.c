@@ -0,0 +1,1125 @@
+/*++
+
+Copyright (c) 2017 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    freemap.c
+
+Abstract:
+
+    This module implements the in-memory free cluster bitmap for FAT16 and
+    FAT32 volumes, along with the contiguous run allocator built on top of it.
+
+Author:
+
+    Evan Green 22-Mar-2017
+
+Environment:
+
+    Kernel, Boot, Build
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/fat/fatlib.h>
+#include <minoca/lib/fat/fat.h>
+#include "fatlibp.h"
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// These macros determine whether a bit in a bitmap of ULONGs is set.
+//
+
+#define FAT_BITMAP_WORD(_Index) ((_Index) >> 5)
+#define FAT_BITMAP_MASK(_Index) (1UL << ((_Index) & 0x1F))
+#define FAT_BITMAP_TEST(_Bitmap, _Index) \
+    (((_Bitmap)[FAT_BITMAP_WORD(_Index)] & FAT_BITMAP_MASK(_Index)) != 0)
+
+//
+// This macro returns the number of bytes needed for a bitmap of the given
+// number of bits.
+//
+
+#define FAT_BITMAP_SIZE(_BitCount) \
+    (ALIGN_RANGE_UP((_BitCount), 32) / 8)
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Any free run at least this long contains a completely free word of the
+// bitmap.
+//
+
+#define FAT_FREE_MAP_LONG_RUN 64
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores the running state of a search for a free run.
+
+Members:
+
+    Count - Stores the number of clusters the caller needs.
+
+    Desired - Stores the number of clusters the caller would like, which
+        includes room for a reservation past the end of the request.
+
+    Best - Stores the start of the smallest run at least the desired size.
+
+    BestLength - Stores the length of the best run, or 0 if none was found.
+
+    Fit - Stores the start of the smallest run at least the needed size.
+
+    FitLength - Stores the length of the fitting run, or 0 if none was found.
+
+    Largest - Stores the start of the largest unreserved run.
+
+    LargestLength - Stores the length of the largest unreserved run.
+
+--*/
+
+typedef struct _FAT_FREE_RUN_SEARCH {
+    ULONG Count;
+    ULONG Desired;
+    ULONG Best;
+    ULONG BestLength;
+    ULONG Fit;
+    ULONG FitLength;
+    ULONG Largest;
+    ULONG LargestLength;
+} FAT_FREE_RUN_SEARCH, *PFAT_FREE_RUN_SEARCH;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+FatpFreeMapPopulateWindow (
+    PFAT_VOLUME Volume,
+    ULONG WindowIndex
+    );
+
+ULONG
+FatpFreeMapFindCluster (
+    PFAT_VOLUME Volume,
+    ULONG Start,
+    ULONG End,
+    BOOL Free
+    );
+
+BOOL
+FatpFreeMapClipRun (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG Start,
+    PULONG End
+    );
+
+VOID
+FatpFreeMapSearch (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG Count,
+    ULONG Desired,
+    BOOL LongRunsOnly,
+    PFAT_FREE_RUN_SEARCH Search
+    );
+
+VOID
+FatpFreeMapConsiderRun (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG Start,
+    ULONG End,
+    PFAT_FREE_RUN_SEARCH Search
+    );
+
+VOID
+FatpFreeMapSetReservation (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG Start
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+FatpBuildFreeMap (
+    PFAT_VOLUME Volume,
+    ULONG WindowCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine populates more of the free cluster map for the given volume,
+    allocating the map if needed. Each window is populated with the volume
+    lock held, so allocations can proceed between windows.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    WindowCount - Supplies the maximum number of FAT windows to scan.
+
+Return Value:
+
+    STATUS_SUCCESS if the free map is complete.
+
+    STATUS_MORE_PROCESSING_REQUIRED if windows remain to be scanned.
+
+    STATUS_NOT_SUPPORTED if the volume is FAT12, which always uses a linear
+    scan of the FAT.
+
+    STATUS_INSUFFICIENT_RESOURCES if the map could not be allocated.
+
+    Other error codes on device I/O failures.
+
+--*/
+
+{
+
+    ULONG MapWindows;
+    KSTATUS Status;
+    ULONG WindowIndex;
+
+    if (Volume->Format == Fat12Format) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    MapWindows = FAT_WINDOW_INDEX(Volume, Volume->ClusterCount - 1) + 1;
+    FatAcquireLock(Volume->Lock);
+    if (Volume->FreeMap == NULL) {
+        Volume->FreeMap = FatAllocateNonPagedMemory(
+                                    Volume->Device.DeviceToken,
+                                    FAT_BITMAP_SIZE(Volume->ClusterCount));
+
+        if (Volume->FreeMap == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto BuildFreeMapEnd;
+        }
+
+        Volume->FreeMapValid = FatAllocateNonPagedMemory(
+                                                Volume->Device.DeviceToken,
+                                                FAT_BITMAP_SIZE(MapWindows));
+
+        if (Volume->FreeMapValid == NULL) {
+            FatFreeNonPagedMemory(Volume->Device.DeviceToken, Volume->FreeMap);
+            Volume->FreeMap = NULL;
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto BuildFreeMapEnd;
+        }
+
+        RtlZeroMemory(Volume->FreeMap, FAT_BITMAP_SIZE(Volume->ClusterCount));
+        RtlZeroMemory(Volume->FreeMapValid, FAT_BITMAP_SIZE(MapWindows));
+        Volume->FreeMapNextWindow = 0;
+        Volume->FreeMapValidWindows = 0;
+        Volume->FreeClusterCount = 0;
+    }
+
+    while ((Volume->Flags & FAT_VOLUME_FLAG_FREE_MAP_COMPLETE) == 0) {
+        if (WindowCount == 0) {
+            Status = STATUS_MORE_PROCESSING_REQUIRED;
+            goto BuildFreeMapEnd;
+        }
+
+        WindowIndex = Volume->FreeMapNextWindow;
+        Status = FatpFreeMapPopulateWindow(Volume, WindowIndex);
+        if (!KSUCCESS(Status)) {
+            goto BuildFreeMapEnd;
+        }
+
+        Volume->FreeMapNextWindow += 1;
+        WindowCount -= 1;
+
+        //
+        // Once the whole FAT has been scanned, the free count is exact. Record
+        // it in the FS information block, which other implementations may
+        // have left stale.
+        //
+
+        if (Volume->FreeMapNextWindow == MapWindows) {
+
+            ASSERT(Volume->FreeMapValidWindows == MapWindows);
+
+            Volume->Flags |= FAT_VOLUME_FLAG_FREE_MAP_COMPLETE;
+            Volume->FreeClusterDelta = 0;
+            Status = FatpUpdateInformationSector(Volume, NULL);
+            if (!KSUCCESS(Status)) {
+                goto BuildFreeMapEnd;
+            }
+
+            break;
+        }
+
+        //
+        // Give allocations a chance to get in between windows.
+        //
+
+        FatReleaseLock(Volume->Lock);
+        FatAcquireLock(Volume->Lock);
+    }
+
+    Status = STATUS_SUCCESS;
+
+BuildFreeMapEnd:
+    FatReleaseLock(Volume->Lock);
+    return Status;
+}
+
+VOID
+FatpDestroyFreeMap (
+    PFAT_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down the free cluster map for the given volume.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(LIST_EMPTY(&(Volume->ReservationList)) != FALSE);
+
+    if (Volume->FreeMap != NULL) {
+        FatFreeNonPagedMemory(Volume->Device.DeviceToken, Volume->FreeMap);
+        Volume->FreeMap = NULL;
+    }
+
+    if (Volume->FreeMapValid != NULL) {
+        FatFreeNonPagedMemory(Volume->Device.DeviceToken,
+                              Volume->FreeMapValid);
+
+        Volume->FreeMapValid = NULL;
+    }
+
+    Volume->Flags &= ~FAT_VOLUME_FLAG_FREE_MAP_COMPLETE;
+    return;
+}
+
+VOID
+FatpFreeMapSetCluster (
+    PFAT_VOLUME Volume,
+    ULONG Cluster,
+    BOOL Free
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records a cluster changing between free and allocated in the
+    free cluster map. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Cluster - Supplies the cluster that changed.
+
+    Free - Supplies a boolean indicating whether the cluster is now free (TRUE)
+        or allocated (FALSE).
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG WindowIndex;
+
+    ASSERT(Volume->FreeMap != NULL);
+
+    //
+    // Windows that have not been populated yet will pick up the current state
+    // when they are scanned.
+    //
+
+    WindowIndex = FAT_WINDOW_INDEX(Volume, Cluster);
+    if (!FAT_BITMAP_TEST(Volume->FreeMapValid, WindowIndex)) {
+        return;
+    }
+
+    ASSERT(FAT_BITMAP_TEST(Volume->FreeMap, Cluster) != Free);
+
+    if (Free != FALSE) {
+        Volume->FreeMap[FAT_BITMAP_WORD(Cluster)] |= FAT_BITMAP_MASK(Cluster);
+        Volume->FreeClusterCount += 1;
+
+    } else {
+        Volume->FreeMap[FAT_BITMAP_WORD(Cluster)] &= ~FAT_BITMAP_MASK(Cluster);
+
+        ASSERT(Volume->FreeClusterCount != 0);
+
+        Volume->FreeClusterCount -= 1;
+    }
+
+    return;
+}
+
+KSTATUS
+FatpFreeMapAllocate (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG PreviousCluster,
+    ULONG ClusterCount,
+    PULONG Cluster,
+    PULONG RunCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine picks a run of free clusters using the free cluster map. It
+    prefers to extend the file in place, then the smallest free run that fits
+    the request plus a reservation, then the smallest run that fits just the
+    request, and finally the largest run available. Clusters reserved by other
+    files are avoided unless nothing else is free. This routine does not
+    modify the FAT; the caller is expected to chain the returned clusters.
+    This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Reservation - Supplies an optional pointer to the reservation of the file
+        being extended. On success, this is moved to cover free space directly
+        after the returned run.
+
+    PreviousCluster - Supplies the current last cluster of the file, or a value
+        greater than or equal to the bad cluster value if the file is empty.
+
+    ClusterCount - Supplies the number of clusters desired.
+
+    Cluster - Supplies a pointer where the first cluster of the run will be
+        returned.
+
+    RunCount - Supplies a pointer where the number of clusters in the run will
+        be returned. This will be between 1 and the cluster count, inclusive.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_READY if the free map has not been completely built. The caller
+    should fall back to scanning the FAT.
+
+    STATUS_VOLUME_FULL if no free clusters exist.
+
+--*/
+
+{
+
+    ULONG Desired;
+    ULONG End;
+    ULONG Goal;
+    ULONG Length;
+    ULONG ReserveCount;
+    FAT_FREE_RUN_SEARCH Search;
+    ULONG Start;
+    ULONG TotalClusters;
+
+    if ((Volume->Flags & FAT_VOLUME_FLAG_FREE_MAP_COMPLETE) == 0) {
+        return STATUS_NOT_READY;
+    }
+
+    if (Volume->FreeClusterCount == 0) {
+        return STATUS_VOLUME_FULL;
+    }
+
+    ASSERT(ClusterCount != 0);
+
+    TotalClusters = Volume->ClusterCount;
+    if (ClusterCount > TotalClusters) {
+        ClusterCount = TotalClusters;
+    }
+
+    Length = 0;
+    Start = 0;
+
+    //
+    // First try to extend the file in place, which is the common case when
+    // the file's reservation is intact.
+    //
+
+    if ((PreviousCluster >= FAT_CLUSTER_BEGIN) &&
+        (PreviousCluster < TotalClusters - 1)) {
+
+        Goal = PreviousCluster + 1;
+        End = TotalClusters;
+        if (End - Goal > ClusterCount) {
+            End = Goal + ClusterCount;
+        }
+
+        End = FatpFreeMapFindCluster(Volume, Goal, End, FALSE);
+        if ((End > Goal) &&
+            (FatpFreeMapClipRun(Volume, Reservation, Goal, &End) != FALSE)) {
+
+            Start = Goal;
+            Length = End - Goal;
+        }
+    }
+
+    //
+    // Otherwise find the best fitting free run on the volume.
+    //
+
+    if (Length == 0) {
+        ReserveCount = 0;
+        if (Reservation != NULL) {
+            ReserveCount = FAT_CLUSTER_RESERVATION_SIZE >> Volume->ClusterShift;
+            if (ReserveCount == 0) {
+                ReserveCount = 1;
+            }
+        }
+
+        Desired = ClusterCount + ReserveCount;
+        if (Desired < ClusterCount) {
+            Desired = MAX_ULONG;
+        }
+
+        //
+        // Runs long enough to hold a reservation can be found quickly by
+        // only looking at completely free words of the bitmap. Fall back to
+        // examining every free run if there are none.
+        //
+
+        RtlZeroMemory(&Search, sizeof(FAT_FREE_RUN_SEARCH));
+        if (Desired >= FAT_FREE_MAP_LONG_RUN) {
+            FatpFreeMapSearch(Volume,
+                              Reservation,
+                              ClusterCount,
+                              Desired,
+                              TRUE,
+                              &Search);
+        }
+
+        if (Search.BestLength == 0) {
+            FatpFreeMapSearch(Volume,
+                              Reservation,
+                              ClusterCount,
+                              Desired,
+                              FALSE,
+                              &Search);
+        }
+
+        if (Search.BestLength != 0) {
+            Start = Search.Best;
+            Length = Search.BestLength;
+
+        } else if (Search.FitLength != 0) {
+            Start = Search.Fit;
+            Length = Search.FitLength;
+
+        } else if (Search.LargestLength != 0) {
+            Start = Search.Largest;
+            Length = Search.LargestLength;
+
+        //
+        // Everything left is reserved by other files. Take the first free
+        // cluster rather than failing the allocation.
+        //
+
+        } else {
+            Start = FatpFreeMapFindCluster(Volume,
+                                           FAT_CLUSTER_BEGIN,
+                                           TotalClusters,
+                                           TRUE);
+
+            if (Start >= TotalClusters) {
+                return STATUS_VOLUME_FULL;
+            }
+
+            Length = FatpFreeMapFindCluster(Volume,
+                                            Start,
+                                            TotalClusters,
+                                            FALSE) - Start;
+        }
+
+        if (Length > ClusterCount) {
+            Length = ClusterCount;
+        }
+    }
+
+    ASSERT((Length != 0) && (Start >= FAT_CLUSTER_BEGIN));
+
+    if (Reservation != NULL) {
+        FatpFreeMapSetReservation(Volume, Reservation, Start + Length);
+    }
+
+    *Cluster = Start;
+    *RunCount = Length;
+    return STATUS_SUCCESS;
+}
+
+VOID
+FatpReleaseClusterReservation (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns any clusters set aside by the given reservation to
+    the general pool.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Reservation - Supplies a pointer to the reservation to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Reservation->ListEntry.Next == NULL) {
+        return;
+    }
+
+    FatAcquireLock(Volume->Lock);
+    if (Reservation->ListEntry.Next != NULL) {
+        LIST_REMOVE(&(Reservation->ListEntry));
+        Reservation->ListEntry.Next = NULL;
+    }
+
+    FatReleaseLock(Volume->Lock);
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+FatpFreeMapPopulateWindow (
+    PFAT_VOLUME Volume,
+    ULONG WindowIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine scans one FAT window and records its free clusters in the
+    free cluster map. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    WindowIndex - Supplies the index of the window to scan.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Cluster;
+    ULONG End;
+    BOOL Free;
+    KSTATUS Status;
+    PVOID Window;
+    ULONG WindowOffset;
+
+    ASSERT(!FAT_BITMAP_TEST(Volume->FreeMapValid, WindowIndex));
+
+    Cluster = FAT_WINDOW_INDEX_TO_CLUSTER(Volume, WindowIndex);
+    End = Cluster + FAT_WINDOW_INDEX_TO_CLUSTER(Volume, 1);
+    if (End > Volume->ClusterCount) {
+        End = Volume->ClusterCount;
+    }
+
+    Status = FatpFatCacheGetFatWindow(Volume,
+                                      TRUE,
+                                      Cluster,
+                                      &Window,
+                                      &WindowOffset);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    if (Cluster < FAT_CLUSTER_BEGIN) {
+        WindowOffset += FAT_CLUSTER_BEGIN - Cluster;
+        Cluster = FAT_CLUSTER_BEGIN;
+    }
+
+    while (Cluster < End) {
+        if (Volume->Format == Fat16Format) {
+            Free = (((PUSHORT)Window)[WindowOffset] == FAT_CLUSTER_FREE);
+
+        } else {
+            Free = (((PULONG)Window)[WindowOffset] == FAT_CLUSTER_FREE);
+        }
+
+        if (Free != FALSE) {
+            Volume->FreeMap[FAT_BITMAP_WORD(Cluster)] |=
+                                                     FAT_BITMAP_MASK(Cluster);
+
+            Volume->FreeClusterCount += 1;
+        }
+
+        Cluster += 1;
+        WindowOffset += 1;
+    }
+
+    Volume->FreeMapValid[FAT_BITMAP_WORD(WindowIndex)] |=
+                                                  FAT_BITMAP_MASK(WindowIndex);
+
+    Volume->FreeMapValidWindows += 1;
+    return STATUS_SUCCESS;
+}
+
+ULONG
+FatpFreeMapFindCluster (
+    PFAT_VOLUME Volume,
+    ULONG Start,
+    ULONG End,
+    BOOL Free
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the first cluster in the given range that is either
+    free or allocated, according to the free cluster map.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Start - Supplies the first cluster to check, inclusive.
+
+    End - Supplies the end of the range, exclusive.
+
+    Free - Supplies a boolean indicating whether to search for a free cluster
+        (TRUE) or an allocated cluster (FALSE).
+
+Return Value:
+
+    Returns the first matching cluster, or the end value if no cluster in the
+    range matches.
+
+--*/
+
+{
+
+    ULONG Index;
+    ULONG Word;
+
+    Index = Start;
+    while (Index < End) {
+        Word = Volume->FreeMap[FAT_BITMAP_WORD(Index)];
+        if (Free == FALSE) {
+            Word = ~Word;
+        }
+
+        Word &= ~(FAT_BITMAP_MASK(Index) - 1);
+        if (Word != 0) {
+            Index = (Index & ~0x1F) + RtlCountTrailingZeros32(Word);
+            if (Index > End) {
+                Index = End;
+            }
+
+            return Index;
+        }
+
+        Index = (Index & ~0x1F) + 32;
+    }
+
+    return End;
+}
+
+BOOL
+FatpFreeMapClipRun (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG Start,
+    PULONG End
+    )
+
+/*++
+
+Routine Description:
+
+    This routine shortens a run of clusters so that it does not run into
+    clusters reserved by another file.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Reservation - Supplies an optional pointer to the caller's own
+        reservation, which is not considered a conflict.
+
+    Start - Supplies the first cluster of the run.
+
+    End - Supplies a pointer to the end of the run, exclusive. On return, this
+        will be shortened to the start of the first conflicting reservation.
+
+Return Value:
+
+    TRUE if a run remains starting at the given cluster.
+
+    FALSE if the first cluster itself is reserved by another file.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PFAT_CLUSTER_RESERVATION Other;
+
+    CurrentEntry = Volume->ReservationList.Next;
+    while (CurrentEntry != &(Volume->ReservationList)) {
+        Other = LIST_VALUE(CurrentEntry, FAT_CLUSTER_RESERVATION, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if ((Other == Reservation) ||
+            (Other->End <= Start) ||
+            (Other->Start >= *End)) {
+
+            continue;
+        }
+
+        if (Other->Start <= Start) {
+            return FALSE;
+        }
+
+        *End = Other->Start;
+    }
+
+    return TRUE;
+}
+
+VOID
+FatpFreeMapSearch (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG Count,
+    ULONG Desired,
+    BOOL LongRunsOnly,
+    PFAT_FREE_RUN_SEARCH Search
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the free runs of the volume looking for the best place
+    to put a new allocation. This routine assumes the volume lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Reservation - Supplies an optional pointer to the caller's own
+        reservation.
+
+    Count - Supplies the number of clusters needed.
+
+    Desired - Supplies the number of clusters wanted, including room for a
+        reservation.
+
+    LongRunsOnly - Supplies a boolean indicating whether to only consider runs
+        that contain a completely free word of the bitmap. This is much faster
+        on a volume with many small holes, and finds every run at least
+        FAT_FREE_MAP_LONG_RUN clusters long.
+
+    Search - Supplies a pointer where the results of the search are returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG End;
+    ULONG Index;
+    ULONG Start;
+    ULONG TotalClusters;
+    ULONG Word;
+    ULONG WordCount;
+
+    RtlZeroMemory(Search, sizeof(FAT_FREE_RUN_SEARCH));
+    Search->Count = Count;
+    Search->Desired = Desired;
+    TotalClusters = Volume->ClusterCount;
+    WordCount = TotalClusters / 32;
+    Index = FAT_CLUSTER_BEGIN;
+    while (Index < TotalClusters) {
+        if (LongRunsOnly != FALSE) {
+            Word = ALIGN_RANGE_UP(Index, 32) / 32;
+            while ((Word < WordCount) && (Volume->FreeMap[Word] != MAX_ULONG)) {
+                Word += 1;
+            }
+
+            if (Word >= WordCount) {
+                break;
+            }
+
+            //
+            // Back up to the real start of the run. The previous run ended
+            // at or before the index, so this cannot go further than that.
+            //
+
+            Start = Word * 32;
+            while ((Start > Index) &&
+                   (FAT_BITMAP_TEST(Volume->FreeMap, Start - 1))) {
+
+                Start -= 1;
+            }
+
+        } else {
+            Start = FatpFreeMapFindCluster(Volume, Index, TotalClusters, TRUE);
+            if (Start >= TotalClusters) {
+                break;
+            }
+        }
+
+        End = FatpFreeMapFindCluster(Volume, Start, TotalClusters, FALSE);
+
+        //
+        // Splitting around reservations only ever shrinks a run, so skip
+        // runs that could not improve on anything found so far.
+        //
+
+        if ((End - Start >= Search->Count) ||
+            (End - Start > Search->LargestLength)) {
+
+            FatpFreeMapConsiderRun(Volume, Reservation, Start, End, Search);
+        }
+
+        //
+        // A run of exactly the desired size cannot be beaten.
+        //
+
+        if (Search->BestLength == Desired) {
+            break;
+        }
+
+        Index = End;
+    }
+
+    return;
+}
+
+VOID
+FatpFreeMapConsiderRun (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG Start,
+    ULONG End,
+    PFAT_FREE_RUN_SEARCH Search
+    )
+
+/*++
+
+Routine Description:
+
+    This routine splits a free run around other files' reservations and
+    records each remaining piece as a candidate in the given search.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Reservation - Supplies an optional pointer to the caller's own
+        reservation.
+
+    Start - Supplies the first free cluster of the run.
+
+    End - Supplies the end of the free run, exclusive.
+
+    Search - Supplies a pointer to the search state to update.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONG Length;
+    PFAT_CLUSTER_RESERVATION Other;
+    ULONG PieceEnd;
+
+    while (Start < End) {
+        PieceEnd = End;
+        if (FatpFreeMapClipRun(Volume, Reservation, Start, &PieceEnd) ==
+            FALSE) {
+
+            //
+            // Skip past whichever reservation covers the start.
+            //
+
+            CurrentEntry = Volume->ReservationList.Next;
+            while (CurrentEntry != &(Volume->ReservationList)) {
+                Other = LIST_VALUE(CurrentEntry,
+                                   FAT_CLUSTER_RESERVATION,
+                                   ListEntry);
+
+                CurrentEntry = CurrentEntry->Next;
+                if ((Other != Reservation) &&
+                    (Other->Start <= Start) &&
+                    (Other->End > Start)) {
+
+                    Start = Other->End;
+                    break;
+                }
+            }
+
+            continue;
+        }
+
+        Length = PieceEnd - Start;
+        if ((Length >= Search->Desired) &&
+            ((Search->BestLength == 0) || (Length < Search->BestLength))) {
+
+            Search->Best = Start;
+            Search->BestLength = Length;
+        }
+
+        if ((Length >= Search->Count) &&
+            ((Search->FitLength == 0) || (Length < Search->FitLength))) {
+
+            Search->Fit = Start;
+            Search->FitLength = Length;
+        }
+
+        if (Length > Search->LargestLength) {
+            Search->Largest = Start;
+            Search->LargestLength = Length;
+        }
+
+        Start = PieceEnd;
+    }
+
+    return;
+}
+
+VOID
+FatpFreeMapSetReservation (
+    PFAT_VOLUME Volume,
+    PFAT_CLUSTER_RESERVATION Reservation,
+    ULONG Start
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves a file's reservation to cover the free clusters
+    directly after its most recent allocation. This routine assumes the volume
+    lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the FAT volume structure.
+
+    Reservation - Supplies a pointer to the reservation to move.
+
+    Start - Supplies the first cluster after the file's new last cluster.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG End;
+    ULONG ReserveCount;
+
+    End = Start;
+    if (Start < Volume->ClusterCount) {
+        ReserveCount = FAT_CLUSTER_RESERVATION_SIZE >> Volume->ClusterShift;
+        End = Volume->ClusterCount;
+        if (End - Start > ReserveCount) {
+            End = Start + ReserveCount;
+        }
+
+        End = FatpFreeMapFindCluster(Volume, Start, End, FALSE);
+        if ((End > Start) &&
+            (FatpFreeMapClipRun(Volume, Reservation, Start, &End) == FALSE)) {
+
+            End = Start;
+        }
+    }
+
+    //
+    // Drop the reservation entirely if there is nothing free to hold.
+    //
+
+    if (End == Start) {
+        if (Reservation->ListEntry.Next != NULL) {
+            LIST_REMOVE(&(Reservation->ListEntry));
+            Reservation->ListEntry.Next = NULL;
+        }
+
+        return;
+    }
+
+    Reservation->Start = Start;
+    Reservation->End = End;
+    if (Reservation->ListEntry.Next == NULL) {
+        INSERT_BEFORE(&(Reservation->ListEntry), &(Volume->ReservationList));
+    }
+
+    return;
+}
@@ -4891,6 +4891,7 @@ Return Value:
 
 {
 
+    ULONG Bucket;
     MEMORY_HEAP_TAG_STATISTIC SearchValue;
     PMEMORY_HEAP_TAG_STATISTIC Statistic;
     PRED_BLACK_TREE_NODE TreeNode;
@@ -4941,6 +4942,19 @@ Return Value:
                                          Node);
     }
 
+    //
+    // Find the size bucket. Bucket zero holds anything up to the minimum size,
+    // and the last bucket holds everything too large for the others.
+    //
+
+    Bucket = 0;
+    while ((Bucket < (MEMORY_HEAP_TAG_HISTOGRAM_BUCKETS - 1)) &&
+           (AllocationSize > (1UL << (MEMORY_HEAP_TAG_HISTOGRAM_SHIFT +
+                                      Bucket)))) {
+
+        Bucket += 1;
+    }
+
     //
     // Update the statistics for a new allocation by this tag.
     //
@@ -4956,6 +4970,8 @@ Return Value:
         }
 
         Statistic->LifetimeAllocationSize += AllocationSize;
+        Statistic->LifetimeAllocationCount += 1;
+        Statistic->Histogram[Bucket] += 1;
         Statistic->ActiveAllocationCount += 1;
         if (Statistic->ActiveAllocationCount >
             Statistic->LargestActiveAllocationCount) {
@@ -4972,9 +4988,11 @@ Return Value:
 
         ASSERT(Statistic->ActiveSize >= AllocationSize);
         ASSERT(Statistic->ActiveAllocationCount != 0);
+        ASSERT(Statistic->Histogram[Bucket] != 0);
 
         Statistic->ActiveSize -= AllocationSize;
         Statistic->ActiveAllocationCount -= 1;
+        Statistic->Histogram[Bucket] -= 1;
     }
 
     return;